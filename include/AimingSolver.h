@@ -7,14 +7,18 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
 #include <list>
-#include <deque>
 #include <chrono>
 #include <mutex>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "Parameters.h"
 #include "Utilities.h"
+#include "FixedCapacityVector.h"
+#include "TargetMotionFilter.h"
+#include "SequencedRingBuffer.h"
+#include "TimeSync.h"
 
 namespace meta {
 
@@ -37,7 +41,7 @@ public:
         cv::Point3f offset;                    // x, y, z in mm, relative to current view
         float avgLightAngle;
         bool largeArmor = false;
-        int number = 0;                        // 0 for empty (no number sticker)
+        int number = 0;                        // see NumberClassifier::Number, 0 if unknown
 
         cv::Point3f ypd;                       // YPD: Yaw (.x [deg]) + Pitch (.y [deg]) + Distance (.z [mm])
 
@@ -48,11 +52,43 @@ public:
         unsigned flags = 0;
     };
 
+    static constexpr size_t MAX_ARMORS = 32;
+
+    /**
+     * Armors of a frame. Fixed capacity so that passing them through the pipeline never allocates. Armors beyond the
+     * capacity are dropped.
+     */
+    using ArmorList = FixedCapacityVector<ArmorInfo, MAX_ARMORS>;
+
+    /**
+     * Set parameters and reset history.
+     * @param p
+     */
     void setParams(const package::ParamSet &p);
 
+    /**
+     * Set parameters and keep the tracking and TopKiller history, for changes that don't invalidate it (e.g. tuning
+     * TopKiller thresholds while the target spins).
+     * @param p
+     */
+    void updateParams(const package::ParamSet &p) { params = p; }
+
     void resetHistory();
 
-    void updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageCaptureTime);
+    /**
+     * Set the time from the capture of a frame until its command takes effect, for motion prediction.
+     * @param ms  [ms]
+     */
+    void setCommandLatency(float ms) { commandLatency = ms; }
+
+    /**
+     * Update with the armors of a frame, setting their ypd and flags.
+     * @param armors            Armors with offsets from PnP.
+     * @param imageCaptureTime  Capture time of the frame.
+     * @param attitude          Gimbal attitude at the exposure of the frame, nullptr if unknown. If known, the motion of
+     *                          the target is filtered in the world frame, without the motion of the gimbal itself.
+     */
+    void updateArmors(ArmorList &armors, TimePoint imageCaptureTime, const GimbalAttitude *attitude = nullptr);
 
     struct ControlCommand {
         bool detected;
@@ -77,6 +113,12 @@ public:
         int frameCount = 0;
     };
 
+    /**
+     * Pulses within the TopKiller window (tk_threshold), oldest first. Preallocated, and copies for outputs are synced
+     * incrementally (see SequencedRingBuffer).
+     */
+    using PulseHistory = SequencedRingBuffer<PulseInfo, 64>;
+
 private:
 
     package::ParamSet params;
@@ -87,24 +129,114 @@ private:
     ControlCommand latestCommand;
     bool shouldSendCommand = false;
 
-    // Tracker: select armor closest to the last target
+    float commandLatency = 0;  // [ms]
+
+    // Tracker: track all armors, each with its motion filter, and follow one of them as the target
     class Tracker {
     public:
         explicit Tracker(const ParamSet &params) : params(params) {}
 
-        void update(const ArmorInfo *selectedArmor);
+        /**
+         * Associate the armors of a frame with the tracks, updating the matched tracks, aging the others and starting
+         * tracks for the new armors. The target is kept until selectTarget().
+         * @param armors    Armors with offsets from PnP.
+         * @param time      Capture time of the frame.
+         * @param attitude  Gimbal attitude of the frame, nullptr if unknown.
+         */
+        void update(const ArmorList &armors, TimePoint time, const GimbalAttitude *attitude);
+
+        /**
+         * @return Index of the armor matched to the target track in the last update(), the size of the list if none.
+         */
+        size_t getTargetArmorIndex() const { return targetArmorIndex; }
+
+        /**
+         * Follow the track of an armor of the last update() as the target, or keep the current target track while it
+         * lives if none is selected.
+         * @param index  Index of the armor, the size of the list if none.
+         */
+        void selectTarget(const ArmorList &armors, size_t index);
+
+        /**
+         * @return Offset of the target predicted into the given future [s], relative to the view of the last update.
+         */
+        cv::Point3f predictOffset(float seconds) const;
+
+        /**
+         * @return Whether the motion filter of the target has its velocity, so that predictOffset() is meaningful.
+         */
+        bool predictionReady() const;
 
         cv::Point2f getTargetImgPoint();
 
+        int getTargetNumber() const { return tracking ? trackingArmor.number : 0; }
+
+        /**
+         * @return Whether the target track was matched in the last update(). If not, an armor selected is another one
+         *         (e.g. the next armor of a spinning top), rather than the motion of the target.
+         */
+        bool targetFound() const { return targetArmorFound; }
+
+        /**
+         * Region to search for the target in the next frame: around the last seen armor, growing with the frames it
+         * has been lost until tracking_life_time, so that it is found again after moving.
+         * @param imgSize  Image size.
+         * @return         Search region, empty if not tracking.
+         */
+        cv::Rect searchWindow(const cv::Size &imgSize) const;
+
         void reset();
 
+        // Of the target track
         bool tracking = false;
         ArmorInfo trackingArmor;
         int lostArmorFrameCount = 0;
 
+        bool worldFrame = false;          // tracks in the world frame (attitude known) or in the view frame
+        GimbalAttitude viewAttitude;      // at the last update, if worldFrame
+
+        // An armor this far from the prediction of a track is another armor (e.g. of a spinning top), not the motion
+        static constexpr float TARGET_SWITCH_DISTANCE = 250;  // [mm]
+
+        // The search window is the armor enlarged by this (the paired lights and the motion until the next frames),
+        // doubled at tracking_life_time lost frames
+        static constexpr float SEARCH_WINDOW_SCALE = 3;
+        static constexpr int SEARCH_WINDOW_MIN_SIZE = 96;  // [px]
+
+        // Every armor of a frame gets a track, evicting the tracks lost the longest if needed
+        static constexpr size_t MAX_TRACKS = MAX_ARMORS;
+
     private:
         const ParamSet &params;  // reference to AimingSolver's params
 
+        struct Track {
+            unsigned id = 0;
+            int number = 0;                   // robot of the armor, 0 if not known yet
+            int lostFrameCount = 0;
+            int armorIndex = -1;              // matched armor of the last update, -1 if lost in it
+            TargetMotionFilter motionFilter;
+        };
+        FixedCapacityVector<Track, MAX_TRACKS> tracks;
+        unsigned nextTrackID = 1;
+
+        unsigned targetTrackID = 0;           // 0 if not tracking
+        size_t targetArmorIndex = 0;
+        bool targetArmorFound = false;
+
+        // Pairs of a track and an armor within TARGET_SWITCH_DISTANCE, for greedy association by distance
+        struct Candidate {
+            float distance;
+            uint8_t track, armor;
+        };
+        std::array<Candidate, MAX_TRACKS * MAX_ARMORS> candidates;
+        std::array<cv::Point3f, MAX_ARMORS> positions;  // of the armors, in the frame of the tracks
+
+        Track *findTrack(unsigned id);
+
+        const Track *findTrack(unsigned id) const;
+
+        void removeTrack(size_t i);
+
     } tracker;
 
     // TopKiller: killer for spinning tops
@@ -112,7 +244,7 @@ private:
     public:
         explicit TopKiller(const ParamSet &params, const Tracker &tracker) : params(params), tracker(tracker) {}
 
-        void update(const ArmorInfo *armor, TimePoint time);  // called before Tracker's update
+        void update(const ArmorInfo *armor, TimePoint time);  // called before Tracker's selectTarget()
 
         bool isTriggered() const { return triggered; }
 
@@ -128,7 +260,7 @@ private:
         const ParamSet &params;  // reference to AimingSolver's params
         const Tracker &tracker;  // reference to AimingSolver's Tracker
 
-        std::deque<PulseInfo> pulses;
+        PulseHistory pulses;
 
         bool triggered = false;
         bool targetUpdated = false;
@@ -141,10 +273,22 @@ private:
     } topKiller;
 
 
+    /**
+     * Compute ypd of the armors, and return the one closest to the target image point in the image. Armors of the
+     * target number are preferred, so that tracking does not jump to another robot passing closer.
+     * @param targetNumber  Number of the tracked target, 0 if unknown or not tracking.
+     */
+    size_t convertArmors(ArmorList &armors, const cv::Point2f &targetImgPoint, int targetNumber);
+
     // Helpers
 
     static cv::Point3f xyzToYPD(const cv::Point3f &xyz);
 
+    // Rotate an offset between the view of the camera and the world frame (the gimbal at zero yaw and pitch)
+    static cv::Point3f viewToWorld(const cv::Point3f &offset, const GimbalAttitude &attitude);
+
+    static cv::Point3f worldToView(const cv::Point3f &offset, const GimbalAttitude &attitude);
+
     static constexpr float PI = 3.14159265358979323846264338327950288f;
 
     friend class Executor;
@@ -6,13 +6,26 @@
 #define META_VISION_SOLAIS_ARMORDETECTOR_H
 
 #include "Parameters.h"
+#include "LatencyStats.h"
+#include "BayerFormat.h"
+#include "TaskPool.h"
+#include "NumberClassifier.h"
+#include "LightThreshold.h"
 #include <mutex>
+#include <deque>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <array>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #ifdef ON_JETSON
 #include <NvInfer.h>
 #include <cuda_runtime_api.h>
 #include "YOLOv5_TensorRT.h"
+#include "NanoDet_TensorRT.h"
+#include "LightExtractor_CUDA.h"
 #endif
 
 namespace meta {
@@ -21,10 +34,36 @@ class ArmorDetector {
 public:
 
 #ifdef ON_JETSON
-    ArmorDetector() : yoloModel(std::string(NN_MODEL_ROOT) + std::string("/model-opt-4.onnx")) {
-    }
+    /**
+     * Load the YOLOv5 engine on GPU, until setParams() selects another model (detector_model) or device
+     * (detector_device). If the engine cache is missing or stale, the engine is built in a background thread and
+     * detect_NG() falls back to the light-bar detection until it is ready: on the GPU (see LightExtractor_CUDA), or
+     * detect() while the terminal asks for its intermediate images (requestDebugImages()).
+     */
+    ArmorDetector();
+
+    ~ArmorDetector();
+
+    bool isModelReady() const { return modelReady.load(std::memory_order_acquire); }
+
+    static std::string yoloModelFile() { return std::string(NN_MODEL_ROOT) + std::string("/model-opt-4.onnx"); }
+
+    static std::string nanoDetModelFile() { return std::string(NN_MODEL_ROOT) + std::string("/nanodet-armor.onnx"); }
+
+    /**
+     * INT8 if its engine has been built and is up to date (see tools/Utilities/BuildInt8Engine.cpp), otherwise FP16.
+     * @param dlaCore  DLA core of the engine, -1 for GPU.
+     */
+    static Detector::precision_t yoloPrecision(int dlaCore = -1);
+
+    // DLA core YOLOv5 runs on with detector_device, the first one (Orin and Xavier NX have two)
+    static constexpr int DLA_CORE = 0;
 #endif
-    void setParams(const ParamSet &p) { params = p; }
+    /**
+     * Set parameters. A change of detector_model, detector_device or detection_contexts takes effect at the next
+     * submit_NG() without pending frames (see modelSwitchRequested_NG()).
+     */
+    void setParams(const ParamSet &p);
 
     const ParamSet &getParams() const { return params; }
 
@@ -32,29 +71,414 @@ public:
         std::array<cv::Point2f, 4> points;
         cv::Point2f center;
         bool largeArmor = false;
-        int number = 0;                 // not implemented yet
+        int number = 0;                 // see NumberClassifier::Number, 0 if unknown
         std::array<int, 2> lightIndex;  // left, right ; already deprecated after YOLO model
         float lightAngleDiff;           // absolute value, non-negative
         float avgLightAngle;
     };
 
     [[deprecated]] std::vector<DetectedArmor> detect(const cv::Mat &img);
-    std::vector<DetectedArmor> detect_NG(const cv::Mat &img);
+
+    /**
+     * Same as detect(img), but write into the given storage so that its capacity is reused across frames.
+     * @param img             Input image.
+     * @param acceptedArmors  [Out] Detected armors, cleared first.
+     * @param searchROI       Only search in this region (see AimingSolver::Tracker::searchWindow()), empty for the
+     *                        whole image. Results and intermediate images are still of the whole image.
+     */
+    [[deprecated]] void detect(const cv::Mat &img, std::vector<DetectedArmor> &acceptedArmors,
+                               const cv::Rect &searchROI = cv::Rect());
+    std::vector<DetectedArmor> detect_NG(const cv::Mat &img, const cv::Rect &searchROI = cv::Rect(),
+                                         const BayerFormat &format = BayerFormat());
+
+#ifdef ON_JETSON
+    /**
+     * Start detection of a frame by the model without waiting for the results (see Detector::submit). At most
+     * maxPendingFrames_NG() frames can be pending. Do not mix with detect_NG() while frames are pending. With
+     * light_fusion, the lights are extracted on the GPU alongside, and the armors of those the model misses are added.
+     * @param img        Input image, BGR8 or raw Bayer (demosaiced on the GPU if the model supports it, otherwise on
+     *                   the CPU).
+     * @param searchROI  Only search in this region (see trackingSearchROI()), empty for the whole image.
+     * @param format     Format of img.
+     */
+    void submit_NG(const cv::Mat &img, const cv::Rect &searchROI = cv::Rect(),
+                   const BayerFormat &format = BayerFormat());
+
+    /**
+     * Region of a native input size of the model around a tracked target, clamped into the image. The model must be
+     * ready.
+     * @param imgSize   Image size.
+     * @param center    Predicted target center.
+     * @param minSize   Size the region needs to cover (see AimingSolver::Tracker::searchWindow()). The smallest input
+     *                  size that covers it is used (see Detector::fitting_input_size()), empty for the default one.
+     * @return          Search region.
+     */
+    cv::Rect trackingSearchROI(const cv::Size &imgSize, const cv::Point2f &center,
+                               const cv::Size &minSize = cv::Size()) const;
+
+    /**
+     * Collect the results of the oldest pending frame. imgOriginal is set to that frame.
+     * @return Detected armors.
+     */
+    std::vector<DetectedArmor> collect_NG();
+
+    size_t pendingCount_NG() const { return pendingFrames.size(); }
+
+    /**
+     * @return Frames that can be pending at the same time: the inference slots of the loaded model (see
+     *         Detector::infer_slots()), or Detector::INFER_SLOTS before it is ready.
+     */
+    int maxPendingFrames_NG() const;
+
+    /**
+     * @return Whether a model switch (see setParams()) is waiting for the pending frames to be collected, and can
+     *         take place once they are. A build in progress is not waited for.
+     */
+    bool modelSwitchRequested_NG() const;
+
+    /**
+     * Detect armors in frames of several cameras, batched into as few inferences as the static batch of the model
+     * allows (see Detector::batch_size()). The shipped models have a batch of 1, so each frame is inferred on its own,
+     * up to infer_slots() of them at once. Do not call while frames are pending. imgOriginal is set to the first frame.
+     * @param imgs        Input images, one per camera.
+     * @param searchROIs  Search region of each image, empty (or missing) for the whole image.
+     * @param formats     Bayer format of each image, BGR8 if missing.
+     * @return            Detected armors of each image, in the same order.
+     */
+    std::vector<std::vector<DetectedArmor>> detectBatch_NG(const std::vector<cv::Mat> &imgs,
+                                                           const std::vector<cv::Rect> &searchROIs = {},
+                                                           const std::vector<BayerFormat> &formats = {});
+#endif
 
     static float normalizeLightAngle(float angle) { return angle <= 90 ? angle : 180 - angle; }
 
+    /**
+     * Ask detect() to output the brightness and color images for a while (DEBUG_IMAGES_HOLD_TIME), called when the
+     * terminal fetches them. Otherwise only the lights image is produced. Can be called from any thread.
+     * @param period  Min time between the frames output with them, e.g. that of the fetches.
+     */
+    void requestDebugImages(LatencyClock::duration period = LatencyClock::duration::zero()) {
+        debugImagesPeriod = period.count();
+        debugImagesRequestTime = LatencyClock::now().time_since_epoch().count();
+    }
+
+    /**
+     * Stop outputting the brightness and color images at once, e.g. when the terminal disconnects.
+     */
+    void cancelDebugImages() { debugImagesRequestTime = 0; }
+
 private:
 
     ParamSet params;
 
+    /**
+     * The light and armor filters of params, taken as plain values by setParams() for the loops over contours and
+     * light pairs, which would otherwise go through the protobuf getters for every contour and pair.
+     */
+    struct Filter {
+        bool enabled = false;
+        float min = 0, max = 0;  // val() of a ToggledFloat or ToggledInt in both
+
+        void set(const ToggledFloat &p) { enabled = p.enabled(), min = max = p.val(); }
+
+        void set(const ToggledInt &p) { enabled = p.enabled(), min = max = (float) p.val(); }
+
+        void set(const ToggledFloatRange &p) { enabled = p.enabled(), min = p.min(), max = p.max(); }
+
+        void set(const FloatRange &p) { enabled = true, min = p.min(), max = p.max(); }
+
+        bool contains(float value) const { return min <= value && value <= max; }
+    };
+    struct Filters {
+        Filter contourPixelCount, contourMinArea, longEdgeMinLength, lightMaxRotation, lightAspectRatio;
+        Filter lightLengthMaxRatio, lightXDistOverL, lightYDistOverL, lightAngleMaxDiff;
+        Filter smallArmorAspectRatio, largeArmorAspectRatio;
+    } filters;
+
+    LightThresholdParams thresholdParams;
+
     cv::Mat imgOriginal;
-    cv::Mat imgGray;
     cv::Mat imgBrightness;
     cv::Mat imgColor;
     std::vector<cv::RotatedRect> lightRects;
     cv::Mat imgLights;
+
+    static constexpr auto DEBUG_IMAGES_HOLD_TIME = std::chrono::seconds(1);
+    std::atomic<LatencyClock::rep> debugImagesRequestTime{0};
+
+    std::atomic<LatencyClock::rep> debugImagesPeriod{0};
+    LatencyClock::time_point lastDebugImagesTime;  // detection thread only
+
+    bool debugImagesRequested(LatencyClock::time_point now = LatencyClock::now()) const {
+        return now - LatencyClock::time_point(LatencyClock::duration(debugImagesRequestTime.load())) <
+               DEBUG_IMAGES_HOLD_TIME;
+    }
+
+    /**
+     * @return Whether detect() outputs the debug images for this frame, at most once per requested period.
+     */
+    bool debugImagesDue() {
+        const auto now = LatencyClock::now();
+        if (!debugImagesRequested(now) ||
+            now - lastDebugImagesTime < LatencyClock::duration(debugImagesPeriod.load())) {
+            return false;
+        }
+        lastDebugImagesTime = now;
+        return true;
+    }
+
+    /*
+     * Scratch storage of detect(), reused across frames so that no allocation happens per frame in steady state.
+     * Image buffers are only reallocated when the ROI changes.
+     */
+
+    /**
+     * A few reusable buffers of an intermediate image. Buffers still referenced outside (images of earlier frames held
+     * by the Executor as outputs) are not reused, so that published images are never overwritten.
+     */
+    class ImagePool {
+    public:
+        /**
+         * Get a buffer that is not referenced anywhere else, blank outside a window that only it is written in.
+         * @param size    Image size.
+         * @param type    Image type.
+         * @param window  Region to be written, inside the image.
+         * @return        A buffer from the pool, or a newly allocated one if all of them are in use.
+         */
+        cv::Mat acquire(const cv::Size &size, int type, const cv::Rect &window);
+
+    private:
+        static constexpr int POOL_SIZE = 6;  // current, in the pipeline, and up to three held by outputs and the terminal
+
+        struct Buffer {
+            cv::Mat image;
+            cv::Rect written;  // window of the last use, the only region that may not be blank
+        };
+        std::array<Buffer, POOL_SIZE> buffers;
+
+        /**
+         * Blank the part of written outside window, so that the window moving from frame to frame only clears the
+         * strips it left instead of the whole image.
+         */
+        static void blankOutside(cv::Mat &image, const cv::Rect &written, const cv::Rect &window);
+    };
+
+    ImagePool brightnessPool, colorPool, lightsPool;
+
+    cv::Rect detectWindow;  // search region of the current detect()
+
+    /**
+     * Acquire an intermediate image of the whole image size, blank outside detectWindow.
+     */
+    cv::Mat acquireImage(ImagePool &pool);
+
+    /**
+     * Elliptic structuring element, recreated only when its size parameter changes.
+     */
+    struct CachedKernel {
+        int size = -1;
+        cv::Mat element;
+
+        const cv::Mat &get(int newSize) {
+            if (newSize != size) {
+                element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(newSize, newSize));
+                size = newSize;
+            }
+            return element;
+        }
+    };
+
+    CachedKernel erodeKernel, dilateKernel, openKernel, closeKernel;
+
+    std::vector<std::vector<cv::Point>> contours;
+
+    NumberClassifier numberClassifier;
+    std::vector<std::array<cv::Point2f, 4>> numberCorners;
+    std::vector<char> numberLargeArmor;
+    std::vector<NumberClassifier::Result> numberResults;
+
+    /**
+     * Classify the numbers of armors (if number_classifier is enabled). Confident results replace the numbers from
+     * YOLO, and armors confidently classified as not armors are removed, before PnP and tracking.
+     * @param img     Image the armors are detected in.
+     * @param armors  [In/Out] Armors.
+     */
+    void classifyNumbers(const cv::Mat &img, std::vector<DetectedArmor> &armors);
+
+    /**
+     * Canonicalize a fitted light and apply the filters of its rect.
+     * @param rect  [In/Out] Fitted light, canonicalized.
+     * @return      Whether it is accepted as a light.
+     */
+    bool acceptLight(cv::RotatedRect &rect) const;
+
+    /**
+     * Filter a contour and fit it into a light.
+     * @param contour  Contour of the lights image.
+     * @param rect     [Out] Canonicalized light rect.
+     * @return         Whether the contour is accepted as a light.
+     */
+    bool fitLight(const std::vector<cv::Point> &contour, cv::RotatedRect &rect) const {
+        return (this->*fitLightFunction)(contour, rect);
+    }
+
+    /**
+     * fitLight() of a fit function, selected by setParams() so that the switch is compiled out of the contour loop.
+     */
+    template<ParamSet::ContourFitFunction FIT>
+    bool fitLightWith(const std::vector<cv::Point> &contour, cv::RotatedRect &rect) const;
+
+    using FitLightFunction = bool (ArmorDetector::*)(const std::vector<cv::Point> &, cv::RotatedRect &) const;
+    FitLightFunction fitLightFunction = &ArmorDetector::fitLightWith<ParamSet::MIN_AREA_RECT>;
+
+    /**
+     * Structure-of-arrays copy of the sorted lightRects, with what pairing needs of each light computed once: the
+     * midpoints of its short edges, which are corners of the armor, and its length between them. The vectors keep
+     * their capacity across frames.
+     */
+    struct LightBuffer {
+        std::vector<float> centerX, centerY, angle;
+        std::vector<float> bottomX, bottomY, topX, topY;  // midpoints of the short edges
+        std::vector<float> length;                        // from bottom to top
+        std::vector<uint8_t> upward;                      // top above bottom, otherwise the light pairs with none
+        std::vector<uint8_t> pairAccepted;                // scratch of pairLights(), by right light
+        std::vector<float> pairAspectRatio;
+
+        void resize(size_t n);
+    } lightBuffer;
+
+    /**
+     * Combine the sorted lightRects into armors. For each left light, the right lights within the x-distance band
+     * allowed by the filters are scored in a pass over the buffer without branching on the filters, then the accepted
+     * pairs are emitted.
+     * @param acceptedArmors  [Out] Armors in the order of (left light index, right light index), appended.
+     */
+    void pairLights(std::vector<DetectedArmor> &acceptedArmors);
+
+    /**
+     * Sort lightRects, pair them into armors and filter the armors sharing lights.
+     * @param acceptedArmors  [Out] Armors, appended.
+     */
+    void combineLights(std::vector<DetectedArmor> &acceptedArmors);
+
+    static constexpr float BAND_ROUNDING_SLACK = 1.001f;  // of the x band, so that rounding never drops a pair
+
+    /*
+     * Row-band tiling of detect() (params.parallel_bands()). The threshold runs on bands of rows in parallel, and so do
+     * findContours() and fitLight(). A contour that reaches the rows at a cut between bands may be cut in two, so it is
+     * left out of the band, and found again in a strip of rows around the cut that holds the whole of it. The lights
+     * are the same as those of findContours() over the whole image, only in another order before they are sorted.
+     */
+
+    TaskPool bandPool;
+
+    struct LightBand {
+        int top, bottom;                                     // rows [top, bottom)
+        std::vector<std::vector<cv::Point>> contours;
+        std::vector<cv::RotatedRect> lights;                 // accepted
+        std::vector<int> lightContours;                      // contour of each of lights
+        std::vector<cv::Range> cutContourRows;               // bands: rows of contours reaching a cut
+        std::vector<std::pair<int, cv::Rect>> cutContours;   // strips: contours reaching a cut, with bounding rects
+    };
+    std::vector<LightBand> lightBands, lightStrips;
+    std::vector<int> bandCuts;          // first rows of the bands after the first
+    std::vector<cv::Range> stripRows;
+
+    static constexpr int MIN_BAND_ROWS = 32;
+
+    /**
+     * Split rows [top, top + rows) into bands, fewer than count if they would be too thin.
+     */
+    void splitLightBands(int top, int rows, int count);
+
+    /**
+     * Find the lights of imgLights with bands in parallel into lightRects, in any order.
+     */
+    void findLightsInBands();
+
+    /**
+     * Find the contours of the rows of a band or strip, and the lights out of them.
+     * @param strip  Keep the contours reaching the cuts (a strip), or the others (a band).
+     */
+    void findBandLights(LightBand &band, bool strip);
+
 #ifdef ON_JETSON
-    YOLODet yoloModel;
+    std::unique_ptr<Detector> model;
+    std::unique_ptr<Detector> trackingModel;  // on GPU for the tracking search regions, with DLA_SEARCH_GPU_TRACK
+    std::atomic<bool> modelReady{false};  // model (and trackingModel) can be used
+    std::thread modelBuildThread;
+    ParamSet::DetectorModel loadedModel = ParamSet::YOLOV5;
+    ParamSet::DetectorModel requestedModel = ParamSet::YOLOV5;
+    ParamSet::DetectorDevice loadedDevice = ParamSet::GPU;
+    ParamSet::DetectorDevice requestedDevice = ParamSet::GPU;
+    int loadedContexts = Detector::INFER_SLOTS;
+    int requestedContexts = Detector::INFER_SLOTS;  // of detection_contexts, MAX_INFER_SLOTS to be tuned (0)
+
+    /**
+     * Load a model in place of the current one, in modelBuildThread if its engine has to be built. Devices other than
+     * GPU fall back to it if there is no DLA.
+     * @param contexts  Inference slots of YOLOv5 (see Detector::infer_slots()).
+     */
+    void loadModel(ParamSet::DetectorModel which, ParamSet::DetectorDevice device, int contexts);
+
+    /**
+     * Switch to requestedModel, requestedDevice and requestedContexts if no frame is pending and no engine is being
+     * built.
+     */
+    void switchModelIfRequested();
+
+    /**
+     * Model a frame is submitted to: trackingModel for a search region if loaded, otherwise model.
+     */
+    Detector *modelFor(const cv::Rect &searchROI) const;
+
+    struct PendingFrame {
+        Detector::ticket_t ticket;
+        Detector *detector;                         // submitted to, nullptr if the model was not ready
+        cv::Mat img;
+        bool legacy;                                // detected by detect() as the model is not ready
+        std::vector<DetectedArmor> legacyResults;
+        // Intermediate images of detect() for a legacy frame, restored at collect_NG() as later frames overwrite them
+        cv::Mat legacyBrightness, legacyColor, legacyLights;
+        std::vector<cv::RotatedRect> legacyLightRects;
+        bool gpuLights = false;                     // submitted to lightExtractor, without the model or with it
+        uint64_t lightsTicket = 0;
+    };
+    std::deque<PendingFrame> pendingFrames;
+
+    LightExtractor_CUDA lightExtractor;
+    LightExtractor_CUDA::Morphology lightMorphology;  // of params
+    bool gpuLightsSupported = true;                   // morphology sizes within LightExtractor_CUDA::MAX_KERNEL_SIZE
+    float componentLengthScale = 0;                   // of the standard deviation along an axis, by the fit function
+
+    /**
+     * Fit a component of lightExtractor into a light from its second moments, as a uniform rect (MIN_AREA_RECT) or
+     * ellipse (the others) of the same moments, and filter it as fitLight(), with the boundary pixels of the component
+     * for contour_pixel_count and its pixel count for contour_min_area.
+     * @param c       Component.
+     * @param offset  Origin of its coordinates.
+     * @param rect    [Out] Canonicalized light rect.
+     * @return        Whether the component is accepted as a light.
+     */
+    bool fitComponentLight(const LightExtractor_CUDA::Component &c, const cv::Point &offset,
+                           cv::RotatedRect &rect) const;
+
+    /**
+     * Collect the components of a frame from lightExtractor into lightRects and combine them into armors. The images
+     * of detect() are not made.
+     * @param ticket          Of the frame.
+     * @param acceptedArmors  [Out] Armors, appended.
+     */
+    void collectGpuLights(uint64_t ticket, std::vector<DetectedArmor> &acceptedArmors);
+
+    /**
+     * Light fusion: add the armors of the lights that no armor of the model overlaps (either center in the other).
+     * @param armors       [In/Out] Armors of the model.
+     * @param lightArmors  Armors of the lights.
+     */
+    static void addMissedLightArmors(std::vector<DetectedArmor> &armors, const std::vector<DetectedArmor> &lightArmors);
+
+    std::vector<DetectedArmor> acceptModelResults(const std::vector<Detector::bbox_t> &detectResults) const;
 #endif
     static void drawRotatedRect(cv::Mat &img, const cv::RotatedRect &rect, const cv::Scalar &boarderColor);
 
@@ -68,9 +492,29 @@ private:
      */
     static void canonicalizeRotatedRect(cv::RotatedRect &rect);
 
-    std::vector<DetectedArmor>::iterator filterAcceptedArmorsToRemove(std::vector<DetectedArmor> &acceptedArmors) const;
+    /**
+     * Remove armors that share lights with others, in one sweep. Same result as repeatedly removing, out of the first
+     * pair (in the order of acceptedArmors) of armors sharing a light, the large one if the other is small, or the one
+     * with lights more nonparallel.
+     * @param acceptedArmors  [In/Out] Candidate armors in the order of (left light index, right light index).
+     */
+    void filterArmorsSharingLights(std::vector<DetectedArmor> &acceptedArmors);
+
+    /**
+     * Whether a of the pair (a, b) sharing a light is the one to remove (otherwise b).
+     */
+    static bool shouldRemoveFirstOfSharingPair(const DetectedArmor &a, const DetectedArmor &b) {
+        if (a.largeArmor != b.largeArmor) return a.largeArmor;  // one small one large, prioritize small
+        return a.lightAngleDiff > b.lightAngleDiff;  // remove the one that has lights more nonparallel
+    }
+
+    // Scratch storage of filterArmorsSharingLights(): indices of armors of each light, flattened
+    std::vector<int> lightArmorBegin, lightArmorCursor, lightArmors;
+    std::vector<char> armorRemoved;
 
     friend class Executor;
+    friend class ComponentBenchmark;  // tools/Utilities
+    friend class DetectionEquivalenceCheck;  // tools/Utilities
 
 };
 
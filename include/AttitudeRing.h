@@ -0,0 +1,137 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_ATTITUDERING_H
+#define META_VISION_SOLAIS_ATTITUDERING_H
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace rm {
+
+// Shared by Solais (AttitudeHistory) and solais_serial (SharedAttitudeHistory, in shared memory)
+
+/**
+ * Ring of recent gimbal attitudes keyed on a stamp [ns], appended by one writer and read by any thread without
+ * locking. A reader retries if the writer overwrites the ring while read (a sequence lock), which is rare as the ring
+ * is far longer than it takes to read. The retries are bounded, so that a writer that died in the middle of a push
+ * (another process) does not hang the readers. Only lock-free atomics, so it also works in shared memory, where a zero
+ * filled ring is an empty one.
+ * @tparam CAPACITY  Attitudes kept.
+ */
+template<size_t CAPACITY>
+class AttitudeRing {
+public:
+
+    static constexpr int MAX_READ_RETRIES = 1000;  // a push is only a few stores
+
+    static_assert(std::atomic<int64_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free && std::atomic<float>::is_always_lock_free,
+                  "AttitudeRing needs lock-free atomics");
+
+    /**
+     * Drop the history. Writer only, while no reader uses the ring (e.g. setting up a shared segment).
+     */
+    void reset() {
+        seq.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Append an attitude. Writer only. A stamp earlier than the last one drops the history.
+     */
+    void push(int64_t stamp, float yaw, float pitch) {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        if (n > 0 && stamp < entries[(n - 1) % CAPACITY].stamp.load(std::memory_order_relaxed)) {
+            n = 0;  // out of order (e.g. the clock mapping moved earlier while settling), start over
+        }
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);  // readers see the odd sequence before any change
+
+        Entry &e = entries[n % CAPACITY];
+        e.stamp.store(stamp, std::memory_order_relaxed);
+        e.yaw.store(yaw, std::memory_order_relaxed);
+        e.pitch.store(pitch, std::memory_order_relaxed);
+        count.store(n + 1, std::memory_order_relaxed);
+
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    /**
+     * Attitude at a stamp, interpolated between the two samples around it.
+     * @param stamp      Usually the exposure time of a frame [ns].
+     * @param maxHold    How long after the last sample it is held [ns].
+     * @param turn       A full turn in the unit of yaw (360 or 2 pi), to interpolate across its wrap-around.
+     * @param yaw        [Out]
+     * @param pitch      [Out]
+     * @return           False if the stamp is out of the history, or if the ring kept changing for MAX_READ_RETRIES.
+     */
+    bool interpolate(int64_t stamp, int64_t maxHold, float turn, float &yaw, float &pitch) const {
+        for (int retry = 0; retry < MAX_READ_RETRIES; retry++) {
+            uint32_t s = seq.load(std::memory_order_acquire);
+            if (s & 1) continue;
+
+            bool found = false;
+            float y = 0, p = 0;
+            uint64_t n = count.load(std::memory_order_relaxed);
+            if (n > 0) {
+                auto stampAt = [this](uint64_t i) {
+                    return entries[i % CAPACITY].stamp.load(std::memory_order_relaxed);
+                };
+                uint64_t lo = (n > CAPACITY ? n - CAPACITY : 0), hi = n - 1;
+
+                if (stamp >= stampAt(hi)) {  // hold the last sample for a while
+                    if (stamp - stampAt(hi) <= maxHold) {
+                        const Entry &e = entries[hi % CAPACITY];
+                        y = e.yaw.load(std::memory_order_relaxed);
+                        p = e.pitch.load(std::memory_order_relaxed);
+                        found = true;
+                    }
+                } else if (stamp >= stampAt(lo)) {
+                    while (hi - lo > 1) {  // stampAt(lo) <= stamp < stampAt(hi)
+                        uint64_t mid = lo + (hi - lo) / 2;
+                        if (stampAt(mid) <= stamp) lo = mid; else hi = mid;
+                    }
+                    const Entry &a = entries[lo % CAPACITY], &b = entries[hi % CAPACITY];
+                    int64_t ta = a.stamp.load(std::memory_order_relaxed), tb = b.stamp.load(std::memory_order_relaxed);
+                    float k = (tb > ta ? (float) (stamp - ta) / (float) (tb - ta) : 0.0f);
+                    float yawA = a.yaw.load(std::memory_order_relaxed), yawB = b.yaw.load(std::memory_order_relaxed);
+                    float pitchA = a.pitch.load(std::memory_order_relaxed);
+                    float pitchB = b.pitch.load(std::memory_order_relaxed);
+                    y = yawA + k * std::remainder(yawB - yawA, turn);  // across the wrap-around
+                    p = pitchA + k * (pitchB - pitchA);
+                    found = true;
+                }
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);  // the reads above complete before checking again
+            if (seq.load(std::memory_order_relaxed) == s) {
+                if (found) {
+                    yaw = y;
+                    pitch = p;
+                }
+                return found;
+            }
+        }
+        return false;
+    }
+
+private:
+
+    struct Entry {
+        std::atomic<int64_t> stamp{0};
+        std::atomic<float> yaw{0};
+        std::atomic<float> pitch{0};
+    };
+    Entry entries[CAPACITY];
+    std::atomic<uint64_t> count{0};  // pushed
+    std::atomic<uint32_t> seq{0};    // odd while the writer is in the middle of a push
+};
+
+}
+
+#endif //META_VISION_SOLAIS_ATTITUDERING_H
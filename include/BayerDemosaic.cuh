@@ -0,0 +1,48 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_BAYERDEMOSAIC_CUH
+#define META_VISION_SOLAIS_BAYERDEMOSAIC_CUH
+
+#include <cstdint>
+
+// Device functions of the kernels reading raw frames (YOLOv5 pre-processing, LightExtractor_CUDA), in a header as
+// they are compiled without relocatable device code
+
+namespace meta {
+
+    __device__ __forceinline__ int reflect101(int i, int n) {
+        return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+    }
+
+    __device__ __forceinline__ float bayer_at(const uint8_t *src, int src_step, int src_width, int src_height,
+                                              int x, int y) {
+        return src[reflect101(y, src_height) * src_step + reflect101(x, src_width)];
+    }
+
+    // Bilinear demosaicing of one pixel, rgb in [0, 255]
+    __device__ __forceinline__ void demosaic_at(const uint8_t *src, int src_step, int src_width, int src_height,
+                                                int x, int y, int red_x, int red_y, float rgb[3]) {
+#define AT(dx, dy) bayer_at(src, src_step, src_width, src_height, x + (dx), y + (dy))
+        float c = AT(0, 0);
+        bool red_row = ((y & 1) == red_y), red_col = ((x & 1) == red_x);
+        if (red_row == red_col) {  // red or blue
+            float cross = (AT(-1, 0) + AT(1, 0) + AT(0, -1) + AT(0, 1)) * 0.25f;
+            float diagonal = (AT(-1, -1) + AT(1, -1) + AT(-1, 1) + AT(1, 1)) * 0.25f;
+            rgb[0] = red_row ? c : diagonal;
+            rgb[1] = cross;
+            rgb[2] = red_row ? diagonal : c;
+        } else {  // green, with red neighbors horizontally on red rows and vertically on blue rows
+            float horizontal = (AT(-1, 0) + AT(1, 0)) * 0.5f;
+            float vertical = (AT(0, -1) + AT(0, 1)) * 0.5f;
+            rgb[0] = red_row ? horizontal : vertical;
+            rgb[1] = c;
+            rgb[2] = red_row ? vertical : horizontal;
+        }
+#undef AT
+    }
+
+} // meta
+
+#endif //META_VISION_SOLAIS_BAYERDEMOSAIC_CUH
@@ -0,0 +1,61 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_BAYERFORMAT_H
+#define META_VISION_SOLAIS_BAYERFORMAT_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+namespace meta {
+
+/**
+ * Color filter layout of a raw frame, named by its top-left 2x2 block in row-major order.
+ */
+enum class BayerPattern : uint8_t {
+    NONE = 0,  // not raw, BGR8
+    RGGB,
+    GRBG,
+    GBRG,
+    BGGR,
+};
+
+/**
+ * Format of a frame: BGR8, or raw Bayer (CV_8UC1) with the white balance gains the ISP would have applied.
+ */
+struct BayerFormat {
+    BayerPattern pattern = BayerPattern::NONE;
+    float gains[3] = {1, 1, 1};  // R, G, B
+
+    bool raw() const { return pattern != BayerPattern::NONE; }
+
+    /**
+     * @return Position of the red pixel in the top-left 2x2 block, as (x, y) in {0, 1}.
+     */
+    int redX() const { return (pattern == BayerPattern::GRBG || pattern == BayerPattern::BGGR) ? 1 : 0; }
+
+    int redY() const { return (pattern == BayerPattern::GBRG || pattern == BayerPattern::BGGR) ? 1 : 0; }
+};
+
+/**
+ * Demosaic a raw frame on the CPU, with white balance, for consumers that need BGR (terminal preview, recording,
+ * legacy detector). A BGR8 frame is assigned as it is.
+ * @param src       Raw (CV_8UC1) or BGR8 frame.
+ * @param format    Format of src.
+ * @param dst       [Out] BGR8 image, can be src.
+ * @param halfSize  Take each 2x2 block as one pixel (half the width and height) instead of interpolating, much
+ *                  cheaper and enough for the preview.
+ */
+void bayerToBGR(const cv::Mat &src, const BayerFormat &format, cv::Mat &dst, bool halfSize = false);
+
+/**
+ * Estimate the white balance gains of a raw frame by the gray world assumption, with green as the reference.
+ * @param src     Raw frame (CV_8UC1).
+ * @param format  [In/Out] Pattern of src, gains are set.
+ */
+void estimateWhiteBalance(const cv::Mat &src, BayerFormat &format);
+
+}
+
+#endif //META_VISION_SOLAIS_BAYERFORMAT_H
@@ -1,24 +1,49 @@
-#ifndef _CRC_CHECK_H_
-#define _CRC_CHECK_H_
+#ifndef META_VISION_SOLAIS_CRC_H
+#define META_VISION_SOLAIS_CRC_H
 
+#include <cstddef>
 #include <cstdint>
 
 namespace rm {
 
+// Shared by Solais (Serial) and solais_serial, keep compatible with the CRC of Control
+
+constexpr uint8_t CRC8_INIT = 0xff;
+constexpr uint16_t CRC16_INIT = 0xffff;
+
 /**
- * Get CRC16 checksum.
+ * Continue a CRC8 over more data, for checking a package piece by piece as it is received.
+ * @param crc     CRC8_INIT, or the return value for the data before.
+ * @param data    Data to check
+ * @param length  Data length
+ * @return        CRC checksum of all the data so far
+ */
+uint8_t updateCRC8(uint8_t crc, const uint8_t *data, size_t length);
+
+/**
+ * Continue a CRC16 over more data, for checking a package piece by piece as it is received.
+ * @param crc     CRC16_INIT, or the return value for the data before.
+ * @param data    Data to check
+ * @param length  Data length
+ * @return        CRC checksum of all the data so far
+ */
+uint16_t updateCRC16(uint16_t crc, const uint8_t *data, size_t length);
+
+/**
+ * Get CRC8 checksum.
  * @param pchMessage  Data to check
  * @param dwLength    Data length
  * @return            CRC checksum
  */
-uint8_t getCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+uint8_t getCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
- * Append CRC8 to the end of data.
- * @param pchMessage  Data to append CRC
+ * CRC8 verification function.
+ * @param pchMessage  Data to verify
  * @param dwLength    Stream length = data + checksum
+ * @return            CRC verify result
  */
-bool verifyCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+bool verifyCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * Append CRC8 to the end of data.
@@ -33,7 +58,7 @@ void appendCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
  * @param dwLength    Data length
  * @return            CRC checksum
  */
-uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+uint16_t getCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * CRC16 verification function.
@@ -41,7 +66,7 @@ uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
  * @param dwLength    Stream length = data + checksum
  * @return            CRC verify result
  */
-bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+bool verifyCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength);
 
 /**
  * Append CRC16 to the end of data.
@@ -52,4 +77,4 @@ void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
 
 }
 
-#endif
+#endif //META_VISION_SOLAIS_CRC_H
@@ -6,8 +6,14 @@
 #define META_VISION_SOLAIS_CAMERA_H
 
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include "Parameters.pb.h"
 #include "InputSource.h"
+#include "VideoRecorder.h"
+#include "TimeSync.h"
 #include "CameraApi.h"
 #include "Utilities.h"
 
@@ -24,15 +30,22 @@ public:
 
     virtual bool startRecordToVideo(std::string &path, const package::ParamSet &params);  // path will be changed to filename
 
-    virtual void stopRecordToVideo();
+    virtual void stopRecordToVideo() { recorder.close(); }
 
-    virtual bool isRecordingVideo() const { return recordingVideo; }
+    virtual bool isRecordingVideo() const { return recorder.isOpened(); }
+
+    /**
+     * @return Frames written and dropped (the writer fell behind) by the current or the last recording.
+     */
+    std::pair<unsigned, unsigned> getRecordingStats() const {
+        return {recorder.writtenFrames(), recorder.droppedFrames()};
+    }
 
 protected:
 
-    cv::VideoWriter videoWriter;
-    std::mutex videoWriterMutex;
-    bool recordingVideo = false;  // for lock-free query isRecordingVideo()
+    VideoRecorder recorder;  // frames are pushed by the capture thread after publishing
+
+    ClockMapper cameraClock;  // camera timestamps to LatencyClock, used by the capture thread, reset at open()
 
 };
 
@@ -51,27 +64,105 @@ public:
 
     int getFPS() const override { return (int) cap.get(cv::CAP_PROP_FPS); }
 
-    TimePoint getFrameCaptureTime() const override { return bufferCaptureTime[lastBuffer]; }
-
-    const cv::Mat &getFrame() const override { return buffer[lastBuffer]; }
-
 private:
 
     cv::VideoCapture cap;
 
     std::stringstream capInfoSS;
 
-    // Double buffering
-    uint8_t lastBuffer = 0;
-    cv::Mat buffer[2];
-    TimePoint bufferCaptureTime[2] = {0, 0};
-
     std::thread *th = nullptr;
-    bool threadShouldExit;
+    std::atomic<bool> threadShouldExit{false};
 
     void readFrameFromCamera(const package::ParamSet &params);
 };
 
+/**
+ * A V4L2 device (/dev/video<camera_id>, e.g. a UVC camera) captured through mmap buffers, without cv::VideoCapture.
+ * Frames carry the timestamps of the driver, on LatencyClock as they are if the driver stamps them on the monotonic
+ * clock. Frames of a format the consumers take as it is (8-bit Bayer with raw_bayer_capture, or BGR24) are handed to
+ * the frame pool without copying: the slot wraps the buffer, which is queued back to the driver once the slot is free
+ * again. YUYV is converted of the ROI only and MJPEG decoded, straight into the slots. The ROI is cropped by the driver
+ * if it supports it, otherwise it is a view of the frame.
+ *
+ * v4l2_buffer_count buffers are queued. Wrapped frames held by consumers are out of the queue, so a shallow queue
+ * drops frames while the executor holds several of them, and a deep one takes memory and delivers the same frames.
+ */
+class V4L2Camera : public Camera {
+public:
+
+    ~V4L2Camera() override;
+
+    bool open(const package::ParamSet &params) override;
+
+    bool isOpened() const override { return capturing; }
+
+    void close() override;
+
+    std::string getCameraInfo() const override { return capInfoSS.str(); };
+
+    int getFPS() const override { return fps; }
+
+private:
+
+    int fd = -1;
+    std::stringstream capInfoSS;
+    int fps = 0;
+
+    std::thread *th = nullptr;
+    std::atomic<bool> threadShouldExit{false};
+    std::atomic<bool> capturing{false};  // cleared by the capture thread when it exits, e.g. the device is unplugged
+
+    enum Conversion {
+        WRAPPED,  // raw Bayer or BGR24
+        YUYV,
+        MJPEG,
+    };
+    Conversion conversion = WRAPPED;
+    cv::Size frameSize;       // as captured
+    int sourceType = CV_8UC3; // of a captured frame, CV_8UC2 for YUYV, unused for MJPEG
+    size_t bytesPerLine = 0;
+    cv::Rect crop;            // ROI in the captured frame, the whole frame if the driver crops
+    BayerFormat rawFormat;    // gains estimated on the first frame
+    bool whiteBalanced = false;
+
+    static constexpr std::chrono::milliseconds OPEN_TIMEOUT{3000};  // for the test frame
+    static constexpr int POLL_TIMEOUT_MS = 100;  // bounds the delay of close()
+
+    struct Buffer {
+        uint8_t *start = nullptr;
+        size_t length = 0;
+        FrameSlot *slot = nullptr;  // wrapping the buffer, which is out of the queue until the slot is free
+    };
+    std::vector<Buffer> buffers;
+    std::vector<Buffer> retiredBuffers;  // of a closed device, still wrapped, unmapped once their slots are free
+
+    /**
+     * Negotiate the format, the ROI, the frame rate and the exposure with the device, reported to capInfoSS.
+     */
+    bool configure(const package::ParamSet &params);
+
+    bool mapBuffers(int count);
+
+    bool queueBuffer(unsigned index);
+
+    /**
+     * Queue back the buffers of free slots, and unmap the retired ones. Capture thread only.
+     */
+    void reclaimBuffers();
+
+    /**
+     * Take back the buffer wrapped by a slot just acquired, freed after the last reclaimBuffers().
+     */
+    void releaseBufferOf(const FrameSlot *slot);
+
+    void captureFrames(package::ParamSet params);
+
+    /**
+     * Stop streaming, unmap the buffers (retiring the wrapped ones) and close the device.
+     */
+    void closeDevice();
+};
+
 class MVCamera : public Camera {
 public:
 
@@ -87,12 +178,10 @@ public:
 
     int getFPS() const override { return params.fps(); }
 
-    TimePoint getFrameCaptureTime() const override { return bufferCaptureTime[lastBuffer]; }
-
-    const cv::Mat &getFrame() const override { return buffer[lastBuffer]; }
-
     void fetchNextFrame() override;
 
+    void followRegion(const cv::Rect &region) override;
+
 private:
 
     int hCamera = 0;
@@ -100,11 +189,58 @@ private:
 
     std::stringstream capInfoSS;
 
-    // Double buffering for processing
-    bool shouldFetchNextFrame = true;
-    uint8_t lastBuffer = 0;
-    cv::Mat buffer[2];
-    TimePoint bufferCaptureTime[2] = {0, 0};
+    // Images of the frame pool are allocated at open() from pinnedMatAllocator(), so that the ISP writes directly into
+    // memory the inference can read without copying
+    std::atomic<bool> shouldFetchNextFrame{true};  // handoff between the SDK callback thread and the consumer
+    bool callbackThreadScheduled = false;  // capture_thread_scheduling applied, in the callback thread after open()
+    cv::Size frameSize;      // of the configured ROI, set at open()
+    cv::Size lastFrameSize;  // size reported by the SDK, checked at open()
+
+    // In raw mode (raw_bayer_capture), the sensor data is copied as it is and the ISP (CameraImageProcess) is bypassed,
+    // leaving demosaicing and white balance to the consumers (on the GPU for inference)
+    bool rawCapture = false;
+    BayerFormat rawFormat;   // gains estimated at open()
+
+    static constexpr std::chrono::milliseconds OPEN_TIMEOUT{3000};  // for the test frame
+
+    /*
+     * Sensor window (dynamic_sensor_roi): a part of the configured ROI around the target, moved by followRegion(), so
+     * that the sensor reads out fewer rows and the USB carries fewer pixels. Frames do not tell the window they are
+     * captured with, so a frame exposed before the last change takes the previous window, and is dropped if its size
+     * does not match it. A change restarts the readout of the sensor, which blocks the SDK call for a while, so it is
+     * posted by followRegion() (on the aiming stage) and applied by windowThread. A frame exposed during the call may
+     * be of either window whatever its size, so it is dropped. The images of the frame pool are
+     * views of buffers of the whole ROI (see FramePool::prepareView()), so that the callback never reallocates.
+     */
+    struct SensorWindow {
+        cv::Rect rect;                   // in the configured ROI
+        LatencyClock::time_point since;  // host time it was applied
+    };
+    std::mutex windowMutex;
+    SensorWindow window, previousWindow;  // under windowMutex, written by windowThread and open()
+    LatencyClock::time_point windowChangeStart;  // under windowMutex, of the last call, until window.since if done
+    bool windowChanging = false;                 // under windowMutex, the call has not returned yet
+    cv::Rect requestedWindow;             // under windowMutex, the last posted, or the applied one if it failed
+    cv::Rect pendingWindow;               // under windowMutex, posted and not taken by windowThread, empty if none
+    bool windowThreadShouldExit = false;  // under windowMutex
+    std::condition_variable windowCondition;
+    std::thread windowThread;
+    tSdkImageResolution roiResolution{};  // of the configured ROI, set at open()
+    cv::Size minWindowSize;               // of the sensor
+    LatencyClock::time_point lastWindowChange;
+
+    void applySensorWindows();  // windowThread
+
+    void stopWindowThread();
+
+    static constexpr int SENSOR_WINDOW_ALIGNMENT = 16;  // of the offsets and sizes in the ROI [px]
+    // Each change restarts the readout of the sensor, so follow the target in steps rather than continuously
+    static constexpr std::chrono::milliseconds SENSOR_WINDOW_MIN_INTERVAL{50};
+
+    /**
+     * @return The window of the given scale of the ROI around a region, the whole ROI if the region does not fit.
+     */
+    cv::Rect sensorWindowAround(const cv::Rect &region) const;
 
     static void newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFrameHead *pFrameHead, PVOID pContext);
 
@@ -0,0 +1,95 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_DETECTIONPOOLTUNER_H
+#define META_VISION_SOLAIS_DETECTIONPOOLTUNER_H
+
+#include "LatencyStats.h"
+#include <chrono>
+
+namespace meta {
+
+/**
+ * Number of frames the pipelined detection keeps in flight on the inference contexts (detection_contexts). A fixed
+ * number is taken as it is. With 0, the depth is tuned from the throughput of the detection: starting from
+ * Detector::INFER_SLOTS, a deeper pool is probed and kept while it delivers more frames per second, and every
+ * RETUNE_PERIOD the depth is probed again, alternately one deeper and one shallower. A shallower pool is kept unless it
+ * loses throughput, as each frame in flight adds up to a frame interval of latency. Frames the camera doesn't deliver
+ * faster can't be gained, so a GPU that keeps up with the camera stays at a low depth.
+ *
+ * All calls are from the detection thread.
+ */
+class DetectionPoolTuner {
+public:
+
+    /**
+     * @param fixedDepth  detection_contexts, or 0 to tune.
+     * @param maxDepth    Frames the detector can keep pending (see ArmorDetector::maxPendingFrames_NG()). Tuning
+     *                    restarts if it changes, e.g. after a model switch.
+     */
+    void configure(int fixedDepth, int maxDepth);
+
+    /**
+     * Restart tuning from the initial depth, e.g. at the start of the detection.
+     */
+    void reset();
+
+    /**
+     * The results of a frame have been collected.
+     */
+    void frameCollected(LatencyClock::time_point time = LatencyClock::now());
+
+    /**
+     * @return Frames to keep in flight, in [1, maxDepth].
+     */
+    int depth() const { return current; }
+
+private:
+
+    static constexpr int INITIAL_DEPTH = 2;  // Detector::INFER_SLOTS
+
+    // Frames in flight before a change are collected in the settle time, and the throughput is measured after it
+    static constexpr auto SETTLE_TIME = std::chrono::milliseconds(500);
+    static constexpr auto MEASURE_WINDOW = std::chrono::seconds(2);
+    static constexpr auto RETUNE_PERIOD = std::chrono::seconds(10);
+
+    static constexpr float DEEPER_MIN_GAIN = 1.05f;  // of the throughput for a deeper pool to be kept
+    static constexpr float SHALLOWER_MAX_LOSS = 0.98f;  // of the throughput a shallower pool keeps
+
+    enum Phase {
+        BASELINE,  // measuring the throughput at the kept depth
+        PROBE,     // measuring it one deeper or shallower
+        HOLD       // until the next probe
+    };
+
+    int fixed = 0;
+    int maxDepth = INITIAL_DEPTH;
+    int current = INITIAL_DEPTH;
+    int kept = INITIAL_DEPTH;  // depth a probe is compared with
+
+    Phase phase = BASELINE;
+    bool climbing = true;          // a deeper pool paid off, probe one deeper again right away
+    bool probingDeeper = false;
+    bool nextProbeDeeper = false;  // of the periodic probes, alternately
+    float keptRate = 0;            // throughput at kept [frames/s]
+
+    bool started = false;  // phaseStart is set at the first frame of a phase
+    bool settling = false;
+    LatencyClock::time_point phaseStart;
+    unsigned frames = 0;  // in the measure window
+
+    void startPhase(Phase p);
+
+    void startProbe(bool deeper);
+
+    /**
+     * Keep the probed depth or go back, and hold until the next probe unless a deeper pool paid off.
+     * @param rate  Throughput at the probed depth [frames/s].
+     */
+    void concludeProbe(float rate);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_DETECTIONPOOLTUNER_H
@@ -0,0 +1,180 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_DETECTOR_H
+#define META_VISION_SOLAIS_DETECTOR_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "BayerFormat.h"
+
+namespace meta {
+
+    /**
+     * Armor detection network backend. Frames are submitted and collected asynchronously, so that frame N+1 is
+     * uploaded and inferred while frame N is post-processed. Backends stage frames through MappedBuffer (see
+     * TrtCudaUtils.h), so that on integrated GPUs they all read frames and write outputs in place, and their latencies
+     * compare under the same plumbing.
+     */
+    class Detector {
+    public:
+        struct alignas(4) bbox_t {
+            std::array<cv::Point2f, 4> pts; // [pt0, pt1, pt2, pt3]
+            float confidence;
+            int color_id; // 0: blue, 1: red, 2: gray
+            int tag_id;   // 0: guard, 1-5: number, 6: base
+
+            bool operator==(const bbox_t& other) const {
+                return (pts == other.pts) && (confidence == other.confidence) && (color_id == other.color_id) && (tag_id == other.tag_id);
+            }
+            bool operator!=(const bbox_t& other) const {
+                return (pts != other.pts) || (confidence != other.confidence) || (color_id != other.color_id) || (tag_id != other.tag_id);
+            }
+        };
+
+        enum class precision_t {
+            FP32,
+            FP16,  // falls back to FP32 if not supported
+            INT8   // calibrated, with FP16 allowed for layers without INT8 kernels
+        };
+
+        static const char *precision_name(precision_t precision);
+
+        /**
+         * Engine file of a model: <model>.engine for FP16 on GPU (the original name), with .<precision> for other
+         * precisions and .dla<core> for engines built for a DLA core, e.g. <model>.int8.dla0.engine.
+         * @param dla_core  DLA core the engine runs on, -1 for GPU.
+         */
+        static std::string engine_file(const std::string &model_file, precision_t precision, int dla_core = -1);
+
+        virtual ~Detector() = default;
+
+        static constexpr int INFER_SLOTS = 2;  // by default
+
+        // Most slots a backend can be created with. Engines with dynamic input have profiles for as many slots.
+        static constexpr int MAX_INFER_SLOTS = 4;
+
+        using ticket_t = uint64_t;
+
+        /**
+         * Start inference of a frame asynchronously. At most infer_slots() frames can be in flight.
+         * @param src  BGR8 frame. Page-locked frames are read in place and must not be overwritten until collect();
+         *             others are copied before return.
+         * @return     Ticket to collect the results.
+         */
+        ticket_t submit(const cv::Mat &src) { return submit(src, cv::Rect()); }
+
+        /**
+         * Same as submit(src), but only run on a region of the frame. The region is fed at native resolution if it is
+         * no larger than the network input. Results are in the coordinates of the whole frame.
+         * @param src     BGR8 frame, or a raw Bayer frame (CV_8UC1) if supports_raw().
+         * @param roi     Region of the frame, empty for the whole frame.
+         * @param format  Format of the frame.
+         * @return        Ticket to collect the results.
+         */
+        ticket_t submit(const cv::Mat &src, const cv::Rect &roi, const BayerFormat &format = BayerFormat()) {
+            return submit_batch({src}, {roi}, {format});
+        }
+
+        /**
+         * Submit frames of several cameras as one batched inference. Same as submit() otherwise.
+         * @param frames   BGR8 or raw frames, at most batch_size().
+         * @param rois     Region of each frame, or empty for whole frames.
+         * @param formats  Format of each frame, or empty for BGR8 frames.
+         * @return         Ticket to collect the results.
+         */
+        virtual ticket_t submit_batch(const std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rois = {},
+                                      const std::vector<BayerFormat> &formats = {}) = 0;
+
+        /**
+         * Wait for a submitted frame and post-process it.
+         * @param ticket  Ticket returned by submit().
+         * @return        Detected boxes.
+         */
+        std::vector<bbox_t> collect(ticket_t ticket) { return collect_batch(ticket)[0]; }
+
+        /**
+         * Wait for submitted frames and post-process them.
+         * @param ticket  Ticket returned by submit_batch().
+         * @return        Detected boxes of each submitted frame, in the order of submission.
+         */
+        virtual std::vector<std::vector<bbox_t>> collect_batch(ticket_t ticket) = 0;
+
+        std::vector<bbox_t> operator()(const cv::Mat &src) { return collect(submit(src)); }
+
+        /**
+         * Number of frames an inference takes, the static batch dimension of the model.
+         */
+        int batch_size() const { return batch; }
+
+        /**
+         * Number of submissions that can be in flight, each running on an execution context, stream and buffers of its
+         * own over the same engine.
+         */
+        int infer_slots() const { return slot_count; }
+
+        precision_t precision() const { return engine_precision; }
+
+        /**
+         * Native network input size, the default one. Regions up to it are fed without downscaling.
+         */
+        cv::Size input_size() const { return inputs.front(); }
+
+        /**
+         * All native input sizes, input_size() first. A model built for several sizes takes smaller regions (e.g.
+         * around a tracked target) at a smaller input, which is proportionally faster.
+         */
+        const std::vector<cv::Size> &input_sizes() const { return inputs; }
+
+        /**
+         * Smallest native input size that takes a region without downscaling, input_size() if none does.
+         */
+        cv::Size fitting_input_size(const cv::Size &region) const { return inputs[fitting_input(region)]; }
+
+        /**
+         * Whether raw Bayer frames can be submitted (demosaiced in the pre-processing kernel). Otherwise frames must
+         * be BGR8.
+         */
+        bool supports_raw() const { return raw_input; }
+
+        virtual const char *name() const = 0;
+
+        struct timing_t {
+            float preprocess_ms = 0;   // GPU time of upload and pre-processing
+            float inference_ms = 0;    // GPU time of the network
+            float postprocess_ms = 0;  // GPU post-processing and D2H copy, or D2H copy and CPU post-processing
+        };
+
+        /**
+         * Stage timing of the last collected submission, measured with CUDA events so that overlapped slots don't
+         * count each other.
+         */
+        const timing_t &last_timing() const { return timing; }
+
+    protected:
+        Detector(precision_t precision, bool supports_raw) : engine_precision(precision), raw_input(supports_raw) {}
+
+        // Set by the backend once the engine is loaded
+        int batch = 1;
+        int slot_count = INFER_SLOTS;
+        std::vector<cv::Size> inputs;  // the default first
+
+        /**
+         * Index of fitting_input_size() in inputs.
+         */
+        size_t fitting_input(const cv::Size &region) const;
+
+        timing_t timing;
+
+    private:
+        precision_t engine_precision;
+        bool raw_input;
+    };
+
+} // meta
+
+#endif //META_VISION_SOLAIS_DETECTOR_H
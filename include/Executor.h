@@ -16,17 +16,29 @@
 #include "PositionCalculator.h"
 #include "AimingSolver.h"
 #include "Serial.h"
+#include "SPSCQueue.h"
+#include "ParamSetDiff.h"
+#include "TripleBuffer.h"
+#include "QualityController.h"
+#include "DetectionPoolTuner.h"
 #include <thread>
+#include <atomic>
+#include <string_view>
 
 namespace meta {
 
 class Executor : protected FrameCounterBase /* we would like to rename the function */ {
 public:
 
-    explicit Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, ImageSet *imageSet, VideoSet *videoSet,
-                      ParamSetManager *paramSetManager,
+    /**
+     * @param secondaryMvCamera            Second MindVision camera of secondary_camera, nullptr if not supported.
+     * @param secondaryPositionCalculator  PositionCalculator with the intrinsics of the second camera.
+     */
+    explicit Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, V4L2Camera *v4l2Camera, ImageSet *imageSet,
+                      VideoSet *videoSet, ParamSetManager *paramSetManager,
                       ArmorDetector *detector, PositionCalculator *positionCalculator, AimingSolver *aimingSolver,
-                      Serial *serial);
+                      Serial *serial, MVCamera *secondaryMvCamera = nullptr,
+                      PositionCalculator *secondaryPositionCalculator = nullptr);
 
     /** Read-Only Components **/
 
@@ -52,6 +64,11 @@ public:
 
     void reloadLists();
 
+    /**
+     * List image sets and videos if not done yet. They are not scanned at startup, but when a terminal asks for them.
+     */
+    void listDataSetsIfNeeded();
+
     int switchImageSet(const std::string &path);
 
     void switchParamSet(const std::string &paramSetName);
@@ -68,7 +85,11 @@ public:
 
     std::string startRecordToVideo();
 
-    void stopRecordToVideo() { camera_->stopRecordToVideo(); }
+    /**
+     * Stop recording.
+     * @return Statistics of the recording, for the terminal.
+     */
+    std::string stopRecordToVideo();
 
     /** Execution **/
 
@@ -115,9 +136,48 @@ public:
 
     bool hasOutputs();
 
+    /**
+     * Images of the outputs, in the order of the image mask of the terminal.
+     */
+    enum OutputImage {
+        CAMERA_IMAGE,
+        BRIGHTNESS_IMAGE,
+        COLOR_IMAGE,
+        LIGHTS_IMAGE,
+        OUTPUT_IMAGE_COUNT
+    };
+
+    /**
+     * Subscribe the terminal to images of the outputs for a while (SUBSCRIPTION_HOLD_TIME), called at each fetch. Only
+     * the subscribed images are kept through the detection stages and published, and the detector only makes the
+     * brightness and color images for them at the rate of the fetches (see ArmorDetector::requestDebugImages()),
+     * unless the adaptive quality has stopped them. With no subscription, e.g. no terminal connected during a match,
+     * the outputs carry the armors and TopKiller only. Can be called from any thread.
+     * @param mask         'T' for each OutputImage requested, as allowed by ResultStreamController::filterMask().
+     * @param everyFrame   Debug images for every frame, regardless of the fetch rate and the adaptive quality, e.g. for
+     *                     the one frame of a single image detection.
+     */
+    void subscribeOutputs(std::string_view mask, bool everyFrame = false);
+
+    /**
+     * End the subscriptions at once, e.g. when the terminal disconnects.
+     */
+    void unsubscribeOutputs();
+
+    /**
+     * @return Lowest level of the terminal stream (ResultStreamController) allowed by the adaptive quality.
+     */
+    int minStreamQualityLevel() const { return qualityController.minStreamLevel(); }
+
+    /**
+     * @return Decisions of the adaptive quality since the last fetch.
+     */
+    std::vector<std::string> fetchQualityDecisions() { return qualityController.fetchDecisions(); }
+
     /**
      * Fetch image outputs. Outputs are guaranteed to be completed and from the same detection pipeline. This function
      * can be called from another thread than the detection thread.
+     * @param sourceFrame      Frame of the source, to be held as long as originalImage is used
      * @param originalImage
      * @param brightnessImage
      * @param colorImage
@@ -125,17 +185,19 @@ public:
      * @param lightRects
      * @param armors
      * @param tkTriggered
-     * @param tkPulses
+     * @param tkPulses  [In/Out] Synced incrementally, keep it across calls (see SequencedRingBuffer::syncFrom())
      * @param tkPeriod
      */
-    void fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage, cv::Mat &lightsImage,
-                      std::vector<cv::RotatedRect> &lightRects, std::vector<AimingSolver::ArmorInfo> &armors,
-                      bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod);
+    void fetchOutputs(FrameHandle &sourceFrame, cv::Mat &originalImage, cv::Mat &brightnessImage,
+                      cv::Mat &colorImage, cv::Mat &lightsImage,
+                      std::vector<cv::RotatedRect> &lightRects, AimingSolver::ArmorList &armors,
+                      bool &tkTriggered, AimingSolver::PulseHistory &tkPulses, TimePoint &tkPeriod);
 
 private:
 
     OpenCVCamera *openCvCamera_;
     MVCamera *mvCamera_;
+    V4L2Camera *v4l2Camera_;
     Camera *camera_ = nullptr;
     ImageSet *imageSet_;
     VideoSet *videoSet_;
@@ -144,10 +206,15 @@ private:
     PositionCalculator *positionCalculator_;
     AimingSolver *aimingSolver_;
     Serial *serial_;
+    MVCamera *secondaryCamera_;
+    PositionCalculator *secondaryPositionCalculator_;
 
     InputSource *currentInput_ = nullptr;
 
-    ParamSet params;
+    ParamSet params;  // owned by the control thread, stages read stageParams
+    bool paramsInitialized = false;
+
+    bool dataSetsListed = false;
 
     enum Action {
         NONE,
@@ -158,26 +225,228 @@ private:
     Action curAction = NONE;
 
     std::thread *th = nullptr;
-    bool threadShouldExit = false;
+    std::atomic<bool> threadShouldExit{false};
 
+    /**
+     * Apply parameters. Only components whose fields change are notified. While detection is running, updates are
+     * handed to the stages and applied by their own threads at the next frame boundary (see applyPendingParams()).
+     * Input fields (camera, ROI) still reopen the source, and execution fields take effect on the next start.
+     * @param p  New parameters.
+     */
     void applyParams(const ParamSet &p);
 
-    void runStreamingDetection(InputSource *source);
+    // Stages that apply parameter updates on their own threads
+    enum ParamStage {
+        DETECTION_STAGE,
+        PNP_STAGE,
+        AIMING_STAGE,
+        PARAM_STAGE_COUNT
+    };
+
+    PendingParams pendingParams[PARAM_STAGE_COUNT];
+    ParamSet stageParams[PARAM_STAGE_COUNT];  // the copy of params read by each stage, fields of other stages may be old
+
+    /**
+     * Apply the pending parameter update of a stage, if any. Called by the thread of the stage between frames, or by
+     * the control thread when detection is not running.
+     * @param stage  The stage.
+     */
+    void applyPendingParams(ParamStage stage);
+
+    void applyAllPendingParams() {
+        for (int i = 0; i < PARAM_STAGE_COUNT; i++) applyPendingParams((ParamStage) i);
+    }
+
+    /**
+     * Load the camera calibration of the image size and set PositionCalculator, and the one of the second camera
+     * (secondary_camera) if any.
+     */
+    void loadPositionCalculatorParams(const ParamSet &p);
+
+    /**
+     * Second camera (secondary_camera): a MindVision camera on the same gimbal, next to the first one and with its own
+     * lens (e.g. a wide one beside a long one), with the same parameters except camera_id. Its frames are detected
+     * with the frames of the first camera and solved with its own intrinsics, and its armors are brought into the
+     * camera coordinates of the first camera by the extrinsics of its calibration file. The gimbal aims with them while
+     * the first camera sees none. Without extrinsics, the tracks restart at each switch of camera.
+     */
+    bool usesSecondaryCamera(const ParamSet &p) const {
+        return secondaryCamera_ && p.secondary_camera().enabled() && p.camera_backend() == ParamSet::MV_CAMERA;
+    }
+
+    static ParamSet secondaryCameraParams(const ParamSet &p);
+
+    /**
+     * @param secondary  Second camera, nullptr if none (see usesSecondaryCamera()).
+     */
+    void runStreamingDetection(InputSource *source, InputSource *secondary);
+
+    /**
+     * Intermediate results of one frame, passed through the detection stages.
+     */
+    struct DetectionFrame {
+        TimePoint frameTime = 0;  // capture time, 0 marks the end of the stream
+        LatencyClock::time_point arrivalTime;  // host arrival time, for latency stats
+        FrameHandle sourceFrame;               // keeps the frame of the source intact
+        bool late = false;                     // a full-frame search would miss latency_budget
+        cv::Mat originalImage;
+        cv::Mat brightnessImage;
+        cv::Mat colorImage;
+        cv::Mat lightsImage;
+        std::vector<cv::RotatedRect> lightRects;
+        std::vector<ArmorDetector::DetectedArmor> detectedArmors;
+        AimingSolver::ArmorList armors;
+        std::array<PositionCalculator::Pose, AimingSolver::MAX_ARMORS> armorPoses;  // of armors, by index
+
+        /**
+         * @return Exposure of the frame on the host clock if the source has timestamps, otherwise its arrival.
+         */
+        LatencyClock::time_point captureTime() const {
+            auto exposureTime = sourceFrame.exposureTime();
+            return exposureTime != LatencyClock::time_point() ? exposureTime : arrivalTime;
+        }
+    };
+
+    /**
+     * Wait for the next frame from the source.
+     * @param source         Input source.
+     * @param lastFrameTime  [In/Out] Capture time of the last frame, updated to the new one.
+     * @param frame          [Out] frameTime, arrivalTime, sourceFrame, originalImage and late are set.
+     * @return               False if the stream ends or the thread should exit.
+     */
+    bool waitNextFrame(InputSource *source, TimePoint &lastFrameTime, DetectionFrame &frame);
+
+    // latency_budget, used by the detection stage
+    float smoothedDetectionTime = 0;  // [ms], 0 before the first frame
+    static constexpr float DETECTION_TIME_GAIN = 0.1f;
+    unsigned staleFrames = 0;  // dropped over the budget
+    unsigned lateFrames = 0;   // searched around the target only
+    unsigned consecutiveStaleFrames = 0;
+    static constexpr unsigned MAX_CONSECUTIVE_STALE_FRAMES = 3;
+
+    void recordDetectionTime(LatencyClock::duration d);
+
+    static constexpr std::chrono::milliseconds FRAME_WAIT_TIMEOUT{20};  // bounds the delay of stop()
+
+    void detectArmors(DetectionFrame &frame);
+
+    void keepDetectorResults(DetectionFrame &frame);
+
+    PositionCalculator::PoseHistory poseHistory;  // used by the PnP stage, to warm-start PnP of each armor
+    PositionCalculator::PoseHistory secondaryPoseHistory;  // of the second camera
+
+    // Second camera to the first one (extrinsicRotation, extrinsicTranslation), set with its calibration
+    bool secondaryExtrinsics = false;
+    cv::Matx33d secondaryRotation = cv::Matx33d::eye();
+    cv::Vec3d secondaryTranslation;  // [mm]
+
+    void solveArmorPositions(DetectionFrame &frame) { solveArmorPositions(frame, positionCalculator_, poseHistory); }
+
+    /**
+     * An armor not in the history takes the pose of the target as the prior if it is in the search window of the
+     * tracker (see trackingHintPose).
+     * @param calculator  PositionCalculator of the camera of the frame.
+     * @param history     Poses of the armors of the last frames of the camera.
+     * @param secondary   The frame is of the second camera, which the hints are not of.
+     */
+    void solveArmorPositions(DetectionFrame &frame, PositionCalculator *calculator,
+                             PositionCalculator::PoseHistory &history, bool secondary = false);
+
+    /**
+     * @param secondary  The frame is of the second camera, whose image coordinates are not the ones of the hints.
+     */
+    void aimAndPublish(DetectionFrame &frame, bool secondary = false);
+
+    bool aimingOnSecondary = false;  // the camera followed is the second one, only accessed by the aiming stage
+
+    /**
+     * Run the stages in turn on the frames of the first camera, with the newest frame of the second camera if it
+     * has a new one. Pipelined execution does not apply.
+     */
+    void runDualCameraDetection(InputSource *source, InputSource *secondary);
+
+    /**
+     * Log the input and the results of AimingSolver for the frame (telemetry_log), by the aiming stage.
+     * @param commandLatency  Set to AimingSolver for the frame.
+     * @param attitude        Used by AimingSolver, nullptr if unknown.
+     * @param command         Sent to the serial, nullptr if none (still logged if AimingSolver has one).
+     */
+    void logTelemetry(const DetectionFrame &frame, float commandLatency, const GimbalAttitude *attitude,
+                      const AimingSolver::ControlCommand *command);
+
+    /**
+     * Run detection, PnP and aiming (with serial and output publishing) on separate threads connected by bounded
+     * SPSC queues. Enabled by pipelined_execution, with drop-oldest behavior by pipeline_drop_oldest.
+     */
+    void runPipelinedDetection(InputSource *source);
+
+    std::atomic<unsigned> pipelineDroppedFrames{0};
+
+    // Target of the aiming stage, used to choose the search region of following frames (tracking_roi)
+    // In the coordinates of the configured ROI, as the target, whatever the sensor window (dynamic_sensor_roi)
+    std::mutex trackingHintMutex;
+    bool trackingHintValid = false;  // tracking and the target was found in the last frame
+    cv::Point2f trackingHintCenter;
+    cv::Rect trackingHintWindow;     // for legacy detection, tracking even if lost (see Tracker::searchWindow())
+    // Pose of the target when last seen, the prior of PnP in trackingHintWindow. The tracker predicts positions only,
+    // and the rotation in the view is taken as kept, so that the warm start survives frames the target is lost in.
+    bool trackingHintPoseValid = false;
+    PositionCalculator::Pose trackingHintPose;
+    int framesSinceFullSearch = 0;   // only accessed by the detection stage
+
+    // Adaptive quality (adaptive_quality), driven by the detection stage
+    QualityController qualityController;
+
+    // Frames in flight in the pipelined detection on Jetson (detection_contexts), driven by the detection stage
+    DetectionPoolTuner detectionPoolTuner;
+
+    /**
+     * Search region for the next frame: around the tracked target if tracking_roi is enabled (or the adaptive quality
+     * forces it), except every N frames or after the target is lost (for YOLO) or tracking stops (for legacy detection), when the whole frame is
+     * searched.
+     * @param imgSize  Frame size.
+     * @param late     The frame is late (DetectionFrame::late), search around the target if there is one.
+     * @param offset   Offset of the frame in the configured ROI (FrameHandle::offset()).
+     * @return         Search region in the frame, empty for the whole frame.
+     */
+    cv::Rect nextSearchROI(const cv::Size &imgSize, bool late, const cv::Point &offset);
+
+    /**
+     * Results of a completed detection, published to the terminal thread all at once.
+     */
+    struct Outputs {
+        // Mats are assigned (no copying)
+        FrameHandle sourceFrame;  // keeps originalImage intact
+        cv::Mat originalImage;
+        cv::Mat brightnessImage;
+        cv::Mat colorImage;
+        cv::Mat lightsImage;
+
+        std::vector<cv::RotatedRect> lightRects;
+        AimingSolver::ArmorList armors;
+        bool tkTriggered = false;
+        AimingSolver::PulseHistory tkPulses;
+        TimePoint tkPeriod = 0;
+    };
+
+    // Published by the aiming stage, fetched by fetchOutputs(). Every result is published without waiting.
+    TripleBuffer<Outputs> outputs;
+
+    // Debug images of the detector come at the rate of the fetches, held by the aiming stage for the frames between
+    cv::Mat heldBrightnessImage;
+    cv::Mat heldColorImage;
 
-    std::mutex outputMutex;
+    static constexpr auto SUBSCRIPTION_HOLD_TIME = std::chrono::seconds(1);
 
-    // Output Mats are assigned (no copying) after a completed detection so there is no intermediate result
-    cv::Mat originalOutput;
-    cv::Mat grayOutput;
-    cv::Mat brightnessOutput;
-    cv::Mat colorOutput;
-    cv::Mat lightsImageOutput;
+    // LatencyClock of the last subscription to each OutputImage, and to any of them at ANY_OUTPUT (lightRects and the
+    // frame, for the armors to be drawn over)
+    static constexpr int ANY_OUTPUT = OUTPUT_IMAGE_COUNT;
+    std::atomic<LatencyClock::rep> subscriptionTimes[OUTPUT_IMAGE_COUNT + 1]{};
 
-    std::vector<cv::RotatedRect> lightRectsOutput;
-    std::vector<AimingSolver::ArmorInfo> armorsOutput;
-    bool tkTriggeredOutput;
-    std::deque<AimingSolver::PulseInfo> tkPulsesOutput;
-    TimePoint tkPeriodOutput;
+    bool subscribed(int image, LatencyClock::time_point now = LatencyClock::now()) const {
+        return now - LatencyClock::time_point(LatencyClock::duration(subscriptionTimes[image].load())) <
+               SUBSCRIPTION_HOLD_TIME;
+    }
 };
 
 }
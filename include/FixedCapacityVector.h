@@ -0,0 +1,94 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_FIXEDCAPACITYVECTOR_H
+#define META_VISION_SOLAIS_FIXEDCAPACITYVECTOR_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+
+namespace meta {
+
+/**
+ * A vector with in-place storage of a fixed capacity, for per-frame lists that should never allocate. Elements are
+ * kept constructed (T must be default-constructible), and copying copies only the elements in use.
+ * @tparam T  Element type.
+ * @tparam N  Capacity.
+ */
+template<class T, size_t N>
+class FixedCapacityVector {
+public:
+
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    FixedCapacityVector() = default;
+
+    FixedCapacityVector(const FixedCapacityVector &other) { *this = other; }
+
+    FixedCapacityVector &operator=(const FixedCapacityVector &other) {
+        if (this != &other) {
+            for (size_t i = 0; i < other.n; i++) data_[i] = other.data_[i];
+            n = other.n;
+        }
+        return *this;
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+    size_t size() const { return n; }
+
+    bool empty() const { return n == 0; }
+
+    bool full() const { return n == N; }
+
+    void clear() { n = 0; }
+
+    /**
+     * Append an element. Must not be full().
+     */
+    template<class... Args>
+    T &emplace_back(Args &&... args) {
+        assert(n < N && "FixedCapacityVector is full");
+        data_[n] = T(std::forward<Args>(args)...);
+        return data_[n++];
+    }
+
+    void push_back(const T &v) { emplace_back(v); }
+
+    /**
+     * Remove the last element. Must not be empty().
+     */
+    void pop_back() {
+        assert(n > 0 && "FixedCapacityVector is empty");
+        n--;
+    }
+
+    T &operator[](size_t i) { return data_[i]; }
+
+    const T &operator[](size_t i) const { return data_[i]; }
+
+    T *data() { return data_.data(); }
+
+    const T *data() const { return data_.data(); }
+
+    iterator begin() { return data_.data(); }
+
+    iterator end() { return data_.data() + n; }
+
+    const_iterator begin() const { return data_.data(); }
+
+    const_iterator end() const { return data_.data() + n; }
+
+private:
+    std::array<T, N> data_;
+    size_t n = 0;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_FIXEDCAPACITYVECTOR_H
@@ -0,0 +1,234 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_FRAMEPOOL_H
+#define META_VISION_SOLAIS_FRAMEPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include "Utilities.h"
+#include "LatencyStats.h"
+#include "BayerFormat.h"
+
+namespace meta {
+
+class FramePool;
+
+/**
+ * A slot of FramePool. Written only by the producer, while no handle refers to it.
+ */
+struct FrameSlot {
+    cv::Mat image;
+    cv::Mat storage;                       // of images that are views, see FramePool::prepareView()
+    BayerFormat format;                    // BGR8 by default
+    TimePoint captureTime = 0;
+    LatencyClock::time_point arrivalTime;  // default (epoch) if unknown
+    LatencyClock::time_point exposureTime; // captureTime mapped to LatencyClock, default (epoch) if unknown
+    cv::Point offset;                      // of the image in the configured ROI, for a moving sensor window
+    uint64_t sequence = 0;                 // assigned at publishing, increasing
+    std::atomic<unsigned> refs{0};         // handles, plus one while being filled or being the latest frame
+    FramePool *pool = nullptr;             // owning the slot, woken when its last handle is released
+};
+
+/**
+ * Reference-counted reference to a frame in a FramePool. The slot is not reused while any handle to it remains, so
+ * that consumers can hold frames without copying and without the producer overwriting them. Mats taken from image()
+ * share the pixels, so keep the handle as long as they are used. Copy a handle for each thread, like shared_ptr.
+ */
+class FrameHandle {
+public:
+
+    FrameHandle() = default;
+
+    FrameHandle(const FrameHandle &other) : slot(other.slot) { retain(); }
+
+    FrameHandle(FrameHandle &&other) noexcept: slot(other.slot) { other.slot = nullptr; }
+
+    FrameHandle &operator=(FrameHandle other) noexcept {
+        std::swap(slot, other.slot);
+        return *this;
+    }
+
+    ~FrameHandle() { release(); }
+
+    void reset() {
+        release();
+        slot = nullptr;
+    }
+
+    explicit operator bool() const { return slot != nullptr; }
+
+    /**
+     * @return The image, empty for a null handle.
+     */
+    const cv::Mat &image() const { return slot ? slot->image : emptyImage(); }
+
+    /**
+     * @return Format of image(), raw Bayer if the source captures raw frames.
+     */
+    BayerFormat format() const { return slot ? slot->format : BayerFormat(); }
+
+    TimePoint captureTime() const { return slot ? slot->captureTime : 0; }
+
+    LatencyClock::time_point arrivalTime() const { return slot ? slot->arrivalTime : LatencyClock::time_point(); }
+
+    /**
+     * @return Capture time on the host clock (see ClockMapper), for matching with the gimbal attitude. Default (epoch)
+     *         if the source has no timestamps of its own.
+     */
+    LatencyClock::time_point exposureTime() const {
+        return slot ? slot->exposureTime : LatencyClock::time_point();
+    }
+
+    uint64_t sequence() const { return slot ? slot->sequence : 0; }
+
+    /**
+     * @return Top-left of image() in the configured ROI, non-zero if the source captures a window of it that follows
+     *         the target (dynamic_sensor_roi). Image points add it to be in the coordinates of the camera calibration.
+     */
+    cv::Point offset() const { return slot ? slot->offset : cv::Point(); }
+
+private:
+
+    friend class FramePool;
+
+    explicit FrameHandle(FrameSlot *slot) : slot(slot) { retain(); }
+
+    FrameSlot *slot = nullptr;
+
+    void retain() {
+        if (slot) slot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void release();
+
+    static const cv::Mat &emptyImage() {
+        static const cv::Mat empty;
+        return empty;
+    }
+};
+
+/**
+ * A fixed number of frame slots shared by a producer (an InputSource) and its consumers. The producer acquires a free
+ * slot, fills it and publishes it as the latest frame. Consumers take handles of the latest frame. There is no
+ * copying, and a frame never changes while a handle to it is held. There should be only one producer at a time.
+ */
+class FramePool {
+public:
+
+    explicit FramePool(size_t slotCount) : slots(new FrameSlot[slotCount]), slotCount(slotCount) {
+        for (size_t i = 0; i < slotCount; i++) slots[i].pool = this;
+    }
+
+    FramePool(const FramePool &) = delete;
+
+    FramePool &operator=(const FramePool &) = delete;
+
+    size_t size() const { return slotCount; }
+
+    /**
+     * Allocate the images of the free slots, for producers writing into the images in place. Slots still held keep
+     * their images until they are acquired again, see prepare().
+     * @param views  Allocate the storage of prepareView() instead, of size.
+     */
+    void preallocate(cv::Size size, int type, cv::MatAllocator *allocator = nullptr, bool views = false);
+
+    /**
+     * Make sure the image of an acquired slot is of the given size, type and allocator, without reallocating if so.
+     */
+    static void prepare(FrameSlot *slot, cv::Size size, int type, cv::MatAllocator *allocator = nullptr);
+
+    /**
+     * Same as prepare(), but the image is a continuous view of the storage of the slot, allocated once for the
+     * largest size, so that images of varying sizes up to it (e.g. of a moving sensor window) don't reallocate.
+     * @param capacity  Largest size of the images, the storage is reallocated only if it is smaller.
+     */
+    static void prepareView(FrameSlot *slot, cv::Size size, cv::Size capacity, int type,
+                            cv::MatAllocator *allocator = nullptr);
+
+    /**
+     * Take a free slot to be filled, to be published or discarded afterwards. Producer only.
+     * @return A free slot, or nullptr if all slots are held (the frame should be dropped, see countDroppedFrame()).
+     */
+    FrameSlot *acquire();
+
+    /**
+     * Same as acquire(), but wait for a consumer to release a slot if all are held, for producers that must not drop
+     * frames. Producer only.
+     * @param cancel  Stop waiting once set, see cancelWait().
+     * @return A free slot, or nullptr if cancelled.
+     */
+    FrameSlot *acquireWait(const std::atomic<bool> &cancel);
+
+    /**
+     * Wake acquireWait() to check its cancel flag, to be called after setting it.
+     */
+    void cancelWait();
+
+    /**
+     * Give back an acquired slot without publishing it (e.g. a failed read). Producer only.
+     */
+    static void discard(FrameSlot *slot) { slot->refs.store(0, std::memory_order_release); }
+
+    /**
+     * Make an acquired and filled slot the latest frame. The previous latest frame is released. Producer only.
+     */
+    void publish(FrameSlot *slot);
+
+    /**
+     * Mark the end of the stream: no latest frame, and latestCaptureTime() returns 0.
+     */
+    void publishEnd();
+
+    /**
+     * @return Handle of the latest frame, null if there is none or the stream has ended.
+     */
+    FrameHandle latest() const;
+
+    /**
+     * @return Capture time of the latest frame (0 for none), without taking a handle.
+     */
+    TimePoint latestCaptureTime() const { return latestTime.load(std::memory_order_acquire); }
+
+    /**
+     * @return Frames that could not be captured because all slots were held, since construction.
+     */
+    unsigned droppedFrames() const { return dropCount.load(std::memory_order_relaxed); }
+
+    void countDroppedFrame() { dropCount.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+
+    friend class FrameHandle;
+
+    std::unique_ptr<FrameSlot[]> slots;
+    const size_t slotCount;
+    size_t nextSlot = 0;            // where acquire() starts searching, producer only
+    uint64_t nextSequence = 1;      // producer only
+
+    mutable std::mutex latestMutex;  // taking a reference of the latest slot must not race with replacing it
+    FrameSlot *latestSlot = nullptr;
+    std::atomic<TimePoint> latestTime{0};
+
+    std::atomic<unsigned> dropCount{0};
+
+    // acquireWait() sleeps on freeCondition, and the release of a slot notifies it only while anyone is waiting
+    std::mutex freeMutex;
+    std::condition_variable freeCondition;
+    std::atomic<unsigned> freeWaiters{0};
+
+    void notifySlotFreed();
+};
+
+void FrameHandle::release() {
+    // Acquire-release ordering: reads of the frame complete before the producer can reuse the slot
+    if (slot && slot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) slot->pool->notifySlotFreed();
+}
+
+}
+
+#endif //META_VISION_SOLAIS_FRAMEPOOL_H
@@ -0,0 +1,98 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_GPUMEMORYPOOL_H
+#define META_VISION_SOLAIS_GPUMEMORYPOOL_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <cuda_runtime_api.h>
+#include <NvInfer.h>
+
+namespace meta {
+
+/**
+ * Process-wide pool of device memory, shared by the detector backends, their calibrators and TensorRT itself (through
+ * trtAllocator()), so that engines built or switched in the background reuse the memory of the ones they replace
+ * instead of fragmenting it, and the usage of the whole process is known in one place.
+ *
+ * With CUDA 11.2+ on a device that supports it, the memory comes from a stream-ordered pool (cudaMallocFromPoolAsync)
+ * that keeps freed memory for reuse instead of returning it to the driver. Otherwise freed blocks are cached by size,
+ * and released to the driver only when an allocation fails.
+ *
+ * Thread-safe.
+ */
+class GpuMemoryPool {
+public:
+
+    static GpuMemoryPool &instance();
+
+    /**
+     * @param bytes   Size, aligned to at least ALIGNMENT.
+     * @param stream  Stream the memory is first used on, in stream order (nullptr for the legacy default stream, which
+     *                orders with all blocking streams).
+     * @return        Device memory, nullptr if out of memory.
+     */
+    void *allocate(size_t bytes, cudaStream_t stream = nullptr);
+
+    /**
+     * Return memory of allocate(), after the work using it on the stream. nullptr is ignored.
+     */
+    void free(void *ptr, cudaStream_t stream = nullptr);
+
+    /**
+     * Allocator for IBuilder::setGpuAllocator() and IRuntime::setGpuAllocator(), taking TensorRT's engines, contexts
+     * and build workspace from the pool.
+     */
+    nvinfer1::IGpuAllocator *trtAllocator();
+
+    struct Stats {
+        size_t inUse = 0;         // [bytes]
+        size_t peakInUse = 0;     // [bytes]
+        size_t reserved = 0;      // [bytes] taken from the driver, in use or kept for reuse
+        size_t allocations = 0;   // in use
+    };
+
+    Stats stats() const;
+
+    /**
+     * Log the stats, e.g. "GpuMemoryPool: after building the engine, ...".
+     */
+    void logStats(const char *when) const;
+
+    static constexpr size_t ALIGNMENT = 256;  // of cudaMalloc
+
+private:
+
+    GpuMemoryPool();
+
+    bool streamOrdered = false;
+#if CUDART_VERSION >= 11020
+    cudaMemPool_t pool = nullptr;
+#endif
+
+    mutable std::mutex mutex;
+    std::unordered_map<void *, size_t> blockSizes;  // of the blocks in use
+    std::multimap<size_t, void *> cachedBlocks;     // freed blocks by size, without a stream-ordered pool
+    Stats counters;
+
+    // Without a stream-ordered pool, sizes are rounded so that blocks are reusable across close sizes, and a cached
+    // block serves a request at most this many times smaller
+    static constexpr size_t SMALL_BLOCK_ROUNDING = 4096;
+    static constexpr size_t LARGE_BLOCK_ROUNDING = 2 << 20;
+    static constexpr size_t MAX_CACHED_BLOCK_WASTE = 2;
+
+    /**
+     * @param bytes  [In/Out] Rounded size, set to the size of the block, which may be a larger cached one.
+     */
+    void *allocateCached(size_t &bytes);
+
+    void releaseCachedBlocks();
+};
+
+}
+
+#endif //META_VISION_SOLAIS_GPUMEMORYPOOL_H
@@ -0,0 +1,173 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_IMAGEENCODER_H
+#define META_VISION_SOLAIS_IMAGEENCODER_H
+
+#include "Parameters.h"
+#include <string>
+#include <memory>
+#include <opencv2/core.hpp>
+
+#ifdef GSTREAMER_FOUND
+#include <gst/gst.h>
+#endif
+
+namespace meta {
+
+/**
+ * Encoder of the images streamed to the terminal. Not thread-safe, each thread should use its own encoders.
+ */
+class ImageEncoder {
+public:
+
+    virtual ~ImageEncoder() = default;
+
+    /**
+     * @return Format of the encoded data.
+     */
+    virtual package::Image::ImageFormat format() const = 0;
+
+    /**
+     * @return Name of the backend, for logs.
+     */
+    virtual const char *name() const = 0;
+
+    /**
+     * Encode an image.
+     * @param img  BGR8 or gray image.
+     * @param out  [Out] Encoded data.
+     * @return     Success or not.
+     */
+    virtual bool encode(const cv::Mat &img, std::string &out) = 0;
+
+    /**
+     * Restart the stream so that the next frame can be decoded on its own, e.g. for a new client. No-op for still
+     * image encoders.
+     */
+    virtual void reset() {}
+
+    /**
+     * Set the quality of lossy encoders, to adapt to the link to the terminal. No-op for lossless encoders.
+     * @param quality  [1, 100], as IMWRITE_JPEG_QUALITY. Video encoders scale their bitrate by it.
+     */
+    virtual void setQuality(int quality) {}
+};
+
+/**
+ * CPU JPEG encoding with cv::imencode.
+ */
+class OpenCVJPEGEncoder : public ImageEncoder {
+public:
+
+    explicit OpenCVJPEGEncoder(int quality = 60) : quality(quality) {}
+
+    package::Image::ImageFormat format() const override { return package::Image::JPEG; }
+
+    const char *name() const override { return "OpenCV JPEG"; }
+
+    bool encode(const cv::Mat &img, std::string &out) override;
+
+    void setQuality(int q) override { quality = q; }
+
+private:
+    int quality;
+    std::vector<uchar> buf;
+};
+
+/**
+ * Run-length encoding of binary masks (see MaskRLE.h). Lossless for the 0/255 debug images of the detector, and much
+ * smaller and cheaper than JPEG.
+ */
+class MaskRLEEncoder : public ImageEncoder {
+public:
+
+    package::Image::ImageFormat format() const override { return package::Image::MASK_RLE; }
+
+    const char *name() const override { return "mask RLE"; }
+
+    bool encode(const cv::Mat &img, std::string &out) override;
+};
+
+#ifdef GSTREAMER_FOUND
+
+/**
+ * Encoding through a GStreamer pipeline between an appsrc and an appsink, e.g. with the NVJPEG or NVENC elements on
+ * Jetson. encode() pushes a frame and takes what the pipeline has finished so far without waiting for it, so the
+ * result may be of an earlier frame: the latest finished image of a still image format, or all the finished access
+ * units of a video stream in order. The pipeline is (re)built when the image size or type changes.
+ */
+class GStreamerEncoder : public ImageEncoder {
+public:
+
+    /**
+     * @param encoderElement   Name of the encoder element, to check its availability.
+     * @param encoderPipeline  Elements after the conversion from the raw image to I420, e.g. "nvjpegenc quality=60".
+     * @param format           Format of the output of the pipeline.
+     * @param name             Name for logs.
+     * @param qualityProperty  Property of the element named "enc" in the pipeline to be set by setQuality(), or
+     *                         nullptr if the quality is fixed.
+     * @param qualityScale     The property is set to quality * qualityScale.
+     */
+    GStreamerEncoder(std::string encoderElement, std::string encoderPipeline, package::Image::ImageFormat format,
+                     const char *name, const char *qualityProperty = nullptr, unsigned qualityScale = 1);
+
+    ~GStreamerEncoder() override { close(); }
+
+    package::Image::ImageFormat format() const override { return format_; }
+
+    const char *name() const override { return name_; }
+
+    /**
+     * @return False if no frame has been finished yet (of the video stream, since the last call).
+     */
+    bool encode(const cv::Mat &img, std::string &out) override;
+
+    void reset() override { close(); }
+
+    void setQuality(int q) override;
+
+    /**
+     * Check if the encoder element is available.
+     */
+    bool available() const;
+
+private:
+
+    std::string encoderElement;
+    std::string encoderPipeline;
+    package::Image::ImageFormat format_;
+    const char *name_;
+    const char *qualityProperty;
+    unsigned qualityScale;
+    int quality = -1;  // -1 for the value in the pipeline description
+
+    GstElement *pipeline = nullptr;
+    GstElement *appsrc = nullptr;
+    GstElement *appsink = nullptr;
+    cv::Size size;
+    int type = -1;
+    uint64_t frameIndex = 0;
+    std::string lastImage;  // latest finished image of a still image format, empty if none yet
+
+    bool open(const cv::Size &newSize, int newType);
+
+    void applyQuality();
+
+    void close();
+};
+
+#endif
+
+/**
+ * Create the encoder of camera images for an encoding setting. Falls back to CPU JPEG if hardware encoding is not
+ * available. Masks (brightness, color and contour images) always use MaskRLEEncoder.
+ * @param encoding  Setting.
+ * @return          A JPEG encoder, or a video encoder for HARDWARE_H264_CAMERA.
+ */
+std::unique_ptr<ImageEncoder> createCameraImageEncoder(package::ParamSet::TerminalImageEncoding encoding);
+
+}
+
+#endif //META_VISION_SOLAIS_IMAGEENCODER_H
@@ -6,9 +6,13 @@
 #define META_VISION_SOLAIS_IMAGESET_H
 
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <filesystem>
 #include "Parameters.h"
 #include "InputSource.h"
+#include "PackedImageSet.h"
 
 namespace meta {
 
@@ -27,6 +31,21 @@ public:
 
     const std::vector<std::string> &getImageList() const { return images; }
 
+    /**
+     * Load an image of the current image set, resized to the ROI.
+     * @param index   Index in getImageList().
+     * @param params
+     * @return Empty if it fails.
+     */
+    cv::Mat loadImage(size_t index, const ParamSet &params) const;
+
+    /**
+     * Load the XML annotation of an image of the current image set.
+     * @param index  Index in getImageList().
+     * @return Empty if the image has none.
+     */
+    std::string loadAnnotation(size_t index) const;
+
     bool openSingleImage(const std::string &imageName, const ParamSet &params);
 
     bool openCurrentImageSet(const package::ParamSet &params);
@@ -35,10 +54,6 @@ public:
 
     void close() override;
 
-    TimePoint getFrameCaptureTime() const override { return bufferCaptureTime[lastBuffer]; }
-
-    const cv::Mat &getFrame() const override { return buffer[lastBuffer]; }
-
     void fetchNextFrame() override;
 
     std::string saveCapturedImage(const cv::Mat &image, const package::ParamSet &params);
@@ -48,18 +63,18 @@ protected:
     const fs::path imageSetRoot;
 
     fs::path currentImageSetPath;
-    std::vector<std::string> imageSets;      // directory name
+    std::vector<std::string> imageSets;      // directory name, or filename of a packed image set
     std::vector<std::string> images;         // jpg filenames
+    PackedImageSet pack;                     // opened if the current image set is packed
     std::vector<cv::Mat> imageMats;          // empty if not running
 
-    // Double buffering
-    bool shouldFetchNextFrame;
-    uint8_t lastBuffer = 0;
-    cv::Mat buffer[2];
-    TimePoint bufferCaptureTime[2] = {0, 0};
+    // Requests of the next frame to the thread
+    std::mutex fetchMutex;
+    std::condition_variable fetchCondition;
+    bool shouldFetchNextFrame = false;  // guarded by fetchMutex
 
     std::thread *th = nullptr;
-    bool threadShouldExit = false;
+    std::atomic<bool> threadShouldExit{false};  // set with fetchMutex held
 
     void loadFrameFromImageSet(const ParamSet &params);
 };
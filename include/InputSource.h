@@ -8,9 +8,15 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/videoio.hpp>
 #include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include "Parameters.pb.h"
 #include "FrameCounterBase.h"
 #include "Utilities.h"
+#include "LatencyStats.h"
+#include "FramePool.h"
+#include "Detector.h"
+#include "VideoRecorder.h"
 
 namespace meta {
 
@@ -19,6 +25,9 @@ public:
 
     virtual ~InputSource() {}
 
+    // Frames each queue between the stages of the pipelined execution holds at most (pipelined_execution is clamped)
+    static constexpr size_t MAX_STAGE_QUEUE_DEPTH = 3;
+
     // Open function can be implemented differently
 
     /**
@@ -36,19 +45,85 @@ public:
      * Get current frame capture time. 0 indicates the end of the stream.
      * @return
      */
-    virtual TimePoint getFrameCaptureTime() const = 0;
+    TimePoint getFrameCaptureTime() const { return framePool.latestCaptureTime(); }
 
     /**
-     * Get current frame. No need for data copying due to double buffering.
-     * @return
+     * Get current frame, with the capture time and the host arrival time (default if unknown, e.g. image sets). No
+     * data copying, and the frame stays intact as long as the handle (or a copy of it) is held.
+     * @return Null handle if there is no frame or the stream has ended.
+     */
+    FrameHandle getFrame() const { return framePool.latest(); }
+
+    /**
+     * @return Frames dropped as all slots of the frame pool were held by consumers, since the source is created.
      */
-    virtual const cv::Mat &getFrame() const = 0;
+    unsigned getPoolDroppedFrames() const { return framePool.droppedFrames(); }
 
     /**
-     * Fetch next frame. Called after current frame is accepted (no copy needed due to double buffering).
+     * Fetch next frame. Called after current frame is accepted.
      */
     virtual void fetchNextFrame() {};
 
+    /**
+     * Move the capture window of the sensor to keep a region in it (dynamic_sensor_roi), for sources that support it.
+     * Frames carry the offset of their window, see FrameHandle::offset().
+     * @param region  Region around the target, in the coordinates of the configured ROI, empty to capture the whole
+     *                ROI again.
+     */
+    virtual void followRegion(const cv::Rect &region) {}
+
+    /**
+     * Block until the capture time of current frame differs from the given one (a new frame or the end of the stream),
+     * woken by the producer instead of polling.
+     * @param lastFrameTime  Capture time of the frame last taken.
+     * @param timeout        Max time to wait, to allow the caller to check for exit.
+     * @return               Whether current frame has changed.
+     */
+    bool waitForFrame(TimePoint lastFrameTime, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(frameMutex);
+        if (getFrameCaptureTime() != lastFrameTime) return true;  // not waiting, nothing to record
+        if (!frameCondition.wait_for(lock, timeout, [&] { return getFrameCaptureTime() != lastFrameTime; })) {
+            return false;
+        }
+        latencyStats().record(LatencyStats::WAKEUP, LatencyClock::time_point(LatencyClock::duration(notifyTime)),
+                              LatencyClock::now());
+        return true;
+    }
+
+protected:
+
+    /*
+     * Frames in flight: the latest and the one being filled, the ones in the executor (submitted to the inference
+     * contexts, in the two stage queues, held by the PnP and the aiming stages, and the results in the triple buffer),
+     * the one being encoded for the terminal with the one it fetches next, and the ones queued for recording.
+     */
+    static constexpr size_t FRAME_POOL_SIZE = 2 + Detector::MAX_INFER_SLOTS + 2 * MAX_STAGE_QUEUE_DEPTH + 2 + 3 + 2 +
+                                              VideoRecorder::QUEUE_CAPACITY;
+    FramePool framePool{FRAME_POOL_SIZE};
+
+    /**
+     * To be called by the producer after publishing a frame to framePool (including the end of the stream).
+     */
+    void notifyNewFrame() {
+        {
+            std::lock_guard<std::mutex> lock(frameMutex);  // a waiter is either before its check or in wait()
+            notifyTime = LatencyClock::now().time_since_epoch().count();
+        }
+        frameCondition.notify_all();
+    }
+
+    template<class Predicate>
+    bool waitUntil(Predicate predicate, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(frameMutex);
+        return frameCondition.wait_for(lock, timeout, predicate);
+    }
+
+private:
+
+    std::mutex frameMutex;
+    std::condition_variable frameCondition;
+    LatencyClock::rep notifyTime = 0;  // of the last notifyNewFrame(), under frameMutex
+
 };
 
 }
@@ -0,0 +1,162 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_LATENCYSTATS_H
+#define META_VISION_SOLAIS_LATENCYSTATS_H
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace meta {
+
+using LatencyClock = std::chrono::steady_clock;
+
+/**
+ * Lock-free latency histogram. Values are binned in microseconds into 8 sub-buckets per power of two (< 6.25% relative
+ * error), from 1 us to more than half an hour.
+ *
+ * record() can be called from any thread without blocking, though LatencyStats gives each thread histograms of its
+ * own, so that the relaxed increments don't contend. fetchAndClear() is called by the thread serving the terminal:
+ * buckets are exchanged one by one, so a sample recording concurrently is reported either in this fetch or the next.
+ */
+class LatencyHistogram {
+public:
+
+    struct Summary {
+        unsigned count = 0;
+        float p50 = 0, p95 = 0, p99 = 0, max = 0;  // [ms]
+    };
+
+    void record(LatencyClock::duration d);
+
+    void record(LatencyClock::time_point start, LatencyClock::time_point end) { record(end - start); }
+
+    void recordMs(float ms) {
+        record(std::chrono::duration_cast<LatencyClock::duration>(std::chrono::duration<float, std::milli>(ms)));
+    }
+
+    /**
+     * Get percentiles of samples since last fetch and clear the histogram.
+     * @return Summary, all 0 if there is no sample.
+     */
+    Summary fetchAndClear();
+
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr uint32_t SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+    static constexpr int BUCKET_COUNT = SUB_BUCKETS * (32 - SUB_BUCKET_BITS + 1);
+
+    /**
+     * Samples taken out of the histograms of several threads, merged into one before the summary.
+     */
+    struct Counts {
+        std::array<uint32_t, BUCKET_COUNT> buckets{};
+        uint32_t maxUs = 0;
+
+        Summary summary() const;
+    };
+
+    /**
+     * Add the samples since last fetch to counts and clear the histogram.
+     */
+    void fetchAndClearInto(Counts &counts);
+
+private:
+
+    static int bucketIndex(uint32_t us);
+
+    static float bucketValue(int index);  // middle of the bucket [us]
+
+    std::array<std::atomic<uint32_t>, BUCKET_COUNT> buckets{};
+    std::atomic<uint32_t> maxUs{0};
+};
+
+/**
+ * Latency of each stage of the pipeline, fetched by the terminal (see the latency package in doc/message-table.md).
+ * Each thread records into histograms of its own, so that threads never write the same cache lines, which are merged
+ * when fetched. The histograms of a thread that has exited are kept, with their samples, for the next new thread.
+ */
+class LatencyStats {
+public:
+
+    enum Stage {
+        CAPTURE,         // frame arrival at the host to getFrame() by the executor
+        WAKEUP,          // notification of a new frame to the waiting executor running (scheduling latency)
+        PREPROCESS,      // upload and pre-processing (GPU time)
+        INFERENCE,       // network inference (GPU time), or the whole legacy detect()
+        POSTPROCESS,     // NMS, decoding and result filtering
+        PNP,             // PositionCalculator::solve() of all armors of a frame
+        AIMING,          // AimingSolver::updateArmors() and getControlCommand()
+        SERIAL_ENQUEUE,  // Serial::sendControlCommand()
+        END_TO_END,      // frame arrival to completion of the serial write (or end of aiming if serial is disabled)
+
+        STAGE_COUNT
+    };
+
+    static const char *stageName(Stage stage);
+
+    void record(Stage stage, LatencyClock::duration d) { localShard().histograms[stage].record(d); }
+
+    void record(Stage stage, LatencyClock::time_point start, LatencyClock::time_point end) {
+        localShard().histograms[stage].record(start, end);
+    }
+
+    void recordMs(Stage stage, float ms) { localShard().histograms[stage].recordMs(ms); }
+
+    /**
+     * Get summaries of all stages since last fetch, merged over the threads, and clear the histograms.
+     */
+    std::array<LatencyHistogram::Summary, STAGE_COUNT> fetchAndClear();
+
+private:
+
+    struct alignas(64) Shard {
+        std::array<LatencyHistogram, STAGE_COUNT> histograms;
+        bool inUse = false;  // by a thread, guarded by shardMutex
+    };
+
+    class LocalShard;  // of the calling thread, released when it exits
+
+    std::mutex shardMutex;
+    std::vector<std::unique_ptr<Shard>> shards;  // guarded by shardMutex, only added
+
+    Shard &localShard();
+
+    Shard *acquireShard();
+
+    void releaseShard(Shard *shard);
+};
+
+/**
+ * Process-wide latency stats, shared by all components.
+ */
+LatencyStats &latencyStats();
+
+/**
+ * Record the lifetime of the object as the latency of a stage.
+ */
+class ScopedLatency {
+public:
+
+    explicit ScopedLatency(LatencyStats::Stage stage) : stage(stage), start(LatencyClock::now()) {}
+
+    ~ScopedLatency() { latencyStats().record(stage, start, LatencyClock::now()); }
+
+    ScopedLatency(const ScopedLatency &) = delete;
+
+    ScopedLatency &operator=(const ScopedLatency &) = delete;
+
+private:
+
+    LatencyStats::Stage stage;
+    LatencyClock::time_point start;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_LATENCYSTATS_H
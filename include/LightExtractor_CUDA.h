@@ -0,0 +1,137 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_LIGHTEXTRACTOR_CUDA_H
+#define META_VISION_SOLAIS_LIGHTEXTRACTOR_CUDA_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <cuda_runtime_api.h>
+#include "BayerFormat.h"
+#include "LightThreshold.h"
+#include "TrtCudaUtils.h"
+
+namespace meta {
+
+/**
+ * The light stages of ArmorDetector::detect() on the GPU: brightness and color threshold (the same integer math as
+ * thresholdLightsRow(), with the demosaicing of YOLODet fused in for raw frames), color erode/dilate and contour
+ * open/close with the elliptic kernels, and connected components of the lights image (8-connected, as the external
+ * contours of findContours()). The frame is read where the models read it (MappedBuffer::stage(), in place on Jetson),
+ * and only the statistics of the components go back to the CPU, where ArmorDetector fits and pairs them.
+ *
+ * Work is queued on a stream per slot, like the detector backends, so that it runs alongside the inference of the same
+ * frame. At most SLOTS submissions can be in flight.
+ */
+class LightExtractor_CUDA {
+public:
+
+    static constexpr int SLOTS = 4;  // Detector::MAX_INFER_SLOTS, the most frames ArmorDetector keeps pending
+
+    static constexpr int MAX_COMPONENTS = 1024;  // per frame, the others are dropped
+
+    static constexpr int MAX_KERNEL_SIZE = 31;   // of the morphology kernels
+
+    /**
+     * Statistics of a connected component of the lights image. Moments are relative to its first pixel (in row-major
+     * order), so that they fit in integers exactly.
+     */
+    struct Component {
+        int32_t count;          // pixels
+        int32_t boundaryCount;  // pixels with a 4-neighbour out of the component, the length of its contour
+        int32_t originX;        // first pixel
+        int32_t originY;
+        int32_t left, top, right, bottom;  // bounding box, inclusive
+        int64_t sumX, sumY, sumXX, sumXY, sumYY;
+    };
+
+    /**
+     * Structuring element of a morphology, as the columns [first, last] of each row relative to the anchor. Rows of
+     * an elliptic element are contiguous.
+     */
+    struct Element {
+        int rows = 0;        // 0 to skip the operation
+        int anchorY = 0;
+        int8_t first[MAX_KERNEL_SIZE];
+        int8_t last[MAX_KERNEL_SIZE];  // < first for an empty row
+
+        /**
+         * @param element  CV_8UC1 0/non-zero, as of cv::getStructuringElement(), anchored at its center.
+         */
+        static Element fromMat(const cv::Mat &element);
+    };
+
+    struct Morphology {
+        Element erode, dilate;  // of the color image
+        Element open, close;    // of the lights image
+    };
+
+    LightExtractor_CUDA();
+
+    ~LightExtractor_CUDA();
+
+    LightExtractor_CUDA(const LightExtractor_CUDA &) = delete;
+
+    LightExtractor_CUDA &operator=(const LightExtractor_CUDA &) = delete;
+
+    /**
+     * Queue the extraction of the lights of a frame, without waiting.
+     * @param img     BGR8 or raw Bayer frame.
+     * @param format  Format of img.
+     * @param window  Region to search, non-empty and in img. Components are not taken across its edges, which are
+     *                the borders of the morphology (cv::morphologyDefaultBorderValue()).
+     * @param p       Threshold parameters.
+     * @param m       Morphology, by the sizes of the parameters.
+     * @return        Ticket for collect().
+     */
+    uint64_t submit(const cv::Mat &img, const BayerFormat &format, const cv::Rect &window,
+                    const LightThresholdParams &p, const Morphology &m);
+
+    /**
+     * Wait for the components of a submission.
+     * @param ticket  From submit(), in the order submitted.
+     * @param count   [Out] Number of components, at most MAX_COMPONENTS.
+     * @param offset  [Out] Position of the window in the frame, the origin of the coordinates of the components.
+     * @return        Components, valid until the slot is submitted to again.
+     */
+    const Component *collect(uint64_t ticket, int &count, cv::Point &offset);
+
+    /**
+     * GPU time of the last collected submission [ms].
+     */
+    float lastGpuTime() const { return gpuTime; }
+
+private:
+
+    struct Output {
+        int32_t count;  // components found, may exceed MAX_COMPONENTS
+        int32_t reserved;
+        Component components[MAX_COMPONENTS];
+    };
+
+    struct Slot {
+        cudaStream_t stream = nullptr;
+        cudaEvent_t events[2] = {};     // submitted, done
+        MappedBuffer staging{false};    // of the frame, unless it is already mapped
+        Output *work = nullptr;         // components accumulated in device memory, compacted into output
+        MappedBuffer output;
+        uint8_t *masks[3] = {};         // brightness and two for the others in turn
+        int32_t *labels = nullptr;
+        size_t pixels = 0;              // capacity of masks and labels
+        cv::Point offset;
+
+        bool inFlight = false;
+        uint64_t ticket = 0;
+    };
+
+    Slot slots[SLOTS];
+    uint64_t nextTicket = 0;
+    float gpuTime = 0;
+
+    void reserve(Slot &slot, size_t pixels);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_LIGHTEXTRACTOR_CUDA_H
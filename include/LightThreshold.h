@@ -0,0 +1,59 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_LIGHTTHRESHOLD_H
+#define META_VISION_SOLAIS_LIGHTTHRESHOLD_H
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+namespace package {
+class ParamSet;  // not included, so that nvcc does not parse the protobuf headers (LightExtractor_CUDA)
+}
+
+namespace meta {
+
+/**
+ * Integer form of the threshold parameters of ArmorDetector::detect(), with the same rounding as the original
+ * OpenCV calls (threshold() floors the threshold, inRange() rounds the bounds). The channels and the hue wrap follow
+ * the enemy color, and the threshold is specialized at compile time for each color mode and enemy color.
+ */
+struct LightThresholdParams {
+    int32_t grayLimit;    // lit if B * 1868 + G * 9617 + R * 4899 > grayLimit, the fixed-point gray of cvtColor
+    bool hsv;             // HSV or RB_CHANNELS
+    int mainChannel;      // RB_CHANNELS: lit if saturate(main - opposite) > rbThreshold
+    int oppositeChannel;
+    int rbThreshold;      // [-1, 255], 255 never passes
+    int hueMin, hueMax;   // HSV: lit if hueMin <= hue <= hueMax, or with hueWrap, hue <= hueMax || hue >= hueMin
+    bool hueWrap;
+
+    static LightThresholdParams fromParamSet(const package::ParamSet &params);
+};
+
+/**
+ * Brightness and color threshold of a row of BGR8 pixels in a single pass, equivalent to
+ *   brightness = threshold(cvtColor(BGR2GRAY))
+ *   color = threshold(subtract(main, opposite)) / inRange(cvtColor(BGR2HSV))
+ *   lights = brightness & color
+ * Vectorized with SSSE3 (x86, if the CPU has it) or NEON (ARM) for RB_CHANNELS. HSV is scalar as the hue division
+ * takes a table lookup, but still fused.
+ * @param bgr         Source row.
+ * @param width       Number of pixels.
+ * @param p           Parameters.
+ * @param lights      [Out] brightness & color (0/255), can be nullptr.
+ * @param brightness  [Out] Brightness mask (0/255), can be nullptr.
+ * @param color       [Out] Color mask (0/255), can be nullptr.
+ */
+void thresholdLightsRow(const uint8_t *bgr, int width, const LightThresholdParams &p,
+                        uint8_t *lights, uint8_t *brightness, uint8_t *color);
+
+/**
+ * Apply thresholdLightsRow() to an image. Outputs that are not nullptr are (re)created as CV_8UC1 of the same size.
+ */
+void thresholdLights(const cv::Mat &bgr, const LightThresholdParams &p,
+                     cv::Mat *lights, cv::Mat *brightness, cv::Mat *color);
+
+}
+
+#endif //META_VISION_SOLAIS_LIGHTTHRESHOLD_H
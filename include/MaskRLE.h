@@ -0,0 +1,47 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_MASKRLE_H
+#define META_VISION_SOLAIS_MASKRLE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace meta {
+
+/*
+ * Run-length encoding of binary mask images (Image::MASK_RLE), shared by Solais and the terminal.
+ *
+ * A mask is scanned in row-major order as alternating runs of off and on pixels, starting with off (the first run can
+ * be empty). Each run length is a LEB128 varint. Runs continue across rows. Thresholded images and contours have few
+ * and long runs, so they compress to a small fraction of JPEG, without artifacts.
+ */
+
+/**
+ * Encode a mask.
+ * @param data       First row.
+ * @param width      Width.
+ * @param height     Height.
+ * @param step       Bytes per row.
+ * @param out        [Out] Encoded data.
+ * @param threshold  Pixels >= threshold are on.
+ */
+void encodeMaskRLE(const uint8_t *data, int width, int height, size_t step, std::string &out,
+                   uint8_t threshold = 128);
+
+/**
+ * Decode a mask.
+ * @param in      Encoded data.
+ * @param width   Width.
+ * @param height  Height.
+ * @param out     [Out] First row, pixels are set to 0 or 255.
+ * @param step    Bytes per row of out.
+ * @return        False if the data is malformed or doesn't match the size.
+ */
+bool decodeMaskRLE(const std::string &in, int width, int height, uint8_t *out, size_t step);
+
+}
+
+#endif //META_VISION_SOLAIS_MASKRLE_H
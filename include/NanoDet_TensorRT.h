@@ -9,58 +9,116 @@
 #include <NvInfer.h>
 #include <NvInferRuntimeCommon.h>
 #include <cuda_runtime_api.h>
-#include <opencv2/opencv.hpp>
-#include <cassert>
 #include <vector>
-#include <algorithm>
-#include <numeric>
 #include <memory>
-#include <iostream>
-#include <fstream>
+#include <string>
+#include "Detector.h"
 #include "TrtCudaUtils.h"
 #include "TrtLogger.h"
 
+namespace meta {
 
-typedef struct BoxInfo
-{
-    float x1;
-    float y1;
-    float x2;
-    float y2;
-    float score;
-    int label;
-} BoxInfo;
-
-
-class NanoDet_TensorRT {
-public:
-    NanoDet_TensorRT();
-    ~NanoDet_TensorRT();
-    std::vector<BoxInfo> detect(cv::Mat& image, float score_threshold, float nms_threshold);
-    bool loadEngine(const std::string& engineFilePath);
-
-private:
-    void preprocess(cv::Mat& image) const;
-    void prepare_buffer();
-    void infer();
-    void postprocess(float threshold, std::vector<std::vector<BoxInfo>> &results);
-    BoxInfo disPred2Bbox(const float*& dfl_det, int label, float score, int x, int y, int stride) const;
-    static void nms(std::vector<BoxInfo>& result, float nms_threshold);
-    std::vector<int> strides_{ 8, 16, 32, 64 };
-    int input_size_ = 416;
-    int num_class_ = 80;
-    int reg_max_ = 7;
-    std::unique_ptr<nvinfer1::IRuntime> runtime;
-    std::unique_ptr<nvinfer1::ICudaEngine> engine;
-    std::unique_ptr<nvinfer1::IExecutionContext> context;
-    cudaStream_t stream{};
-    float* gpu_buffers[2] = {nullptr, nullptr};
-//    float* cpu_input_buffer = nullptr;
-//    float* cpu_output_buffer = nullptr;
-    float* zero_copy_buffers[2] = {nullptr, nullptr};
-    int64_t input_buffer_size = 0;
-    int64_t output_buffer_size = 0;
-};
+    /**
+     * NanoDet-Plus armor detector. The engine is built from the ONNX export with trtexec and named as
+     * Detector::engine_file(). The single output is [batch, anchors, classes + 4 * (REG_MAX + 1)]: class scores
+     * (after sigmoid) and the distributions of the distances to the four edges, for the anchors of all strides.
+     * Classes are color-major, class = color_id * TAG_COUNT + tag_id, with the colors and tags of YOLODet.
+     *
+     * NanoDet gives axis-aligned boxes, whose corners are taken as the armor points.
+     */
+    class NanoDet_TensorRT : public Detector {
+    public:
+        static constexpr int TAG_COUNT = 7;
+        static constexpr int REG_MAX = 7;
+        static constexpr float SCORE_THRES = 0.4f;
+        static constexpr float NMS_THRES = 0.5f;
 
+        /**
+         * Load the engine of a model.
+         * @param model_file  ONNX model, whose engine_file() is loaded.
+         * @param precision   Precision the engine was built with.
+         * @param cuda_graph  Replay the GPU work of a submission from a CUDA graph, see YOLODet.
+         */
+        explicit NanoDet_TensorRT(const std::string &model_file, precision_t precision = precision_t::FP16,
+                                  bool cuda_graph = true);
+
+        /**
+         * Whether the engine of a model has been built.
+         */
+        static bool is_engine_ready(const std::string &model_file, precision_t precision);
+
+        ~NanoDet_TensorRT() override;
+
+        NanoDet_TensorRT(const NanoDet_TensorRT &) = delete;
+
+        NanoDet_TensorRT operator=(const NanoDet_TensorRT &) = delete;
+
+        /**
+         * Upload, pre-processing (resize and normalization, fused on GPU) and enqueue are queued on the stream of a
+         * free slot. The output is mapped memory on integrated GPUs and is read in place by the CPU post-processing.
+         * Only BGR8 frames.
+         */
+        ticket_t submit_batch(const std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rois = {},
+                              const std::vector<BayerFormat> &formats = {}) override;
+
+        std::vector<std::vector<bbox_t>> collect_batch(ticket_t ticket) override;
+
+        const char *name() const override { return "NanoDet"; }
+
+        // Arguments of the pre-processing kernel for a frame, read when it runs
+        struct preprocess_args_t {
+            const uint8_t *src;
+            int src_step, src_width, src_height;
+        };
+
+    private:
+        // Per frame of a batch
+        struct batch_item_t {
+            MappedBuffer staging{false};  // of the source frame, see YOLODet
+            const uint8_t *src = nullptr;  // device-accessible staged frame or region
+            int src_step = 0, src_width = 0, src_height = 0;
+            float fx = 1, fy = 1;         // scale from network input to source
+            float ox = 0, oy = 0;         // offset of the region in source
+        };
+
+        struct infer_slot_t {
+            std::unique_ptr<nvinfer1::IExecutionContext> context;
+            cudaStream_t stream = nullptr;
+            void *bindings[2] = {nullptr, nullptr};
+            float *input_device = nullptr;  // [batch] written by the pre-processing kernel
+            MappedBuffer output;            // [batch] read back on CPU
+            std::vector<batch_item_t> items;
+            int count = 0;
+            cudaEvent_t events[4] = {};     // submitted, pre-processed, inferred, done
+            MappedBuffer launch_args;       // [batch] preprocess_args_t, written before each submission
+            CudaGraphCache graph;
+            CudaGraphCache::Key graph_key;
+
+            bool in_flight = false;
+            ticket_t ticket = 0;
+        };
+
+        void enqueue_preprocess(infer_slot_t &slot);
+
+        void postprocess(const float *output, const batch_item_t &item, std::vector<bbox_t> &boxes) const;
+
+        Detector::bbox_t distance_to_bbox(const float *dfl_det, int label, float score, int x, int y,
+                                          int stride) const;
+
+        static void nms(std::vector<bbox_t> &boxes, float nms_threshold);
+
+        std::vector<int> strides_{8, 16, 32, 64};
+        cv::Size input_;
+        int num_class_ = 0;
+        int anchor_count_ = 0;
+        size_t input_sz_ = 0, output_sz_ = 0;  // floats of a single frame
+        std::unique_ptr<nvinfer1::IRuntime> runtime;
+        std::unique_ptr<nvinfer1::ICudaEngine> engine;
+        infer_slot_t slots[INFER_SLOTS];
+        ticket_t next_ticket = 0;
+        bool cuda_graph;
+    };
+
+} // meta
 
 #endif //META_VISION_SOLAIS_NANODET_TENSORRT_H
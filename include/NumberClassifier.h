@@ -0,0 +1,93 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_NUMBERCLASSIFIER_H
+#define META_VISION_SOLAIS_NUMBERCLASSIFIER_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+namespace meta {
+
+/**
+ * Classifier of the number sticker of armors. The sticker of each armor is warped to a small binarized patch, and all
+ * the patches of a frame are classified together in a single forward pass of a small network (number-classifier.onnx,
+ * an MLP or CNN taking [N, 1, PATCH_H, PATCH_W] and giving [N, CLASS_COUNT] logits in the order of CLASS_NUMBERS).
+ *
+ * Runs on the CPU with OpenCV DNN: for a handful of 20x28 patches, the network takes tens of microseconds, less than a
+ * transfer to the GPU would.
+ */
+class NumberClassifier {
+public:
+
+    // Numbers, as in DetectedArmor::number and ArmorInfo::number
+    enum Number {
+        UNKNOWN = 0,  // not classified
+        // 1-5: robots
+        GUARD = 6,
+        BASE = 7,
+        NOT_ARMOR = -1
+    };
+
+    static constexpr int PATCH_W = 20;
+    static constexpr int PATCH_H = 28;
+    static constexpr int CLASS_COUNT = 8;
+    static constexpr std::array<int, CLASS_COUNT> CLASS_NUMBERS = {1, 2, 3, 4, 5, GUARD, BASE, NOT_ARMOR};
+
+    static std::string modelFile();
+
+    /**
+     * Load the model. If it is missing, ready() is false and classify() does nothing.
+     */
+    explicit NumberClassifier(const std::string &onnxFile = modelFile());
+
+    bool ready() const { return loaded; }
+
+    struct Result {
+        int number = UNKNOWN;
+        float confidence = 0;
+    };
+
+    /**
+     * Classify the stickers of armors.
+     * @param img         BGR8 image, or raw Bayer (CV_8UC1), taken as gray.
+     * @param armors      Armor corners (bottom left, top left, top right, bottom right; the inner edges of the lights).
+     * @param largeArmor  Whether each armor is large.
+     * @param results     [Out] Result of each armor.
+     */
+    void classify(const cv::Mat &img, const std::vector<std::array<cv::Point2f, 4>> &armors,
+                  const std::vector<char> &largeArmor, std::vector<Result> &results);
+
+    /**
+     * Number of a YOLO tag_id (0: guard, 1-5: number, 6: base).
+     */
+    static int numberOfYOLOTag(int tagId) {
+        if (tagId >= 1 && tagId <= 5) return tagId;
+        if (tagId == 0) return GUARD;
+        if (tagId == 6) return BASE;
+        return UNKNOWN;
+    }
+
+private:
+
+    cv::dnn::Net net;
+    bool loaded = false;
+
+    // Reused across frames
+    cv::Mat patch, gray, binary;
+    cv::Mat blob;
+    std::vector<cv::Mat> outputs;
+
+    // The lights take the middle of the patch, and the sticker extends above and below them
+    static constexpr int LIGHT_LENGTH = 12;
+    static constexpr int SMALL_ARMOR_WIDTH = 32;
+    static constexpr int LARGE_ARMOR_WIDTH = 54;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_NUMBERCLASSIFIER_H
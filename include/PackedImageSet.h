@@ -0,0 +1,136 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_PACKEDIMAGESET_H
+#define META_VISION_SOLAIS_PACKEDIMAGESET_H
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+namespace meta {
+
+namespace fs = std::filesystem;
+
+/**
+ * An image set packed into one file (<name>.pack under data/images, see tools/Utilities/PackImageSet.cpp), which is
+ * memory-mapped instead of decoded. Frames are raw pixels of the same size and type, already resized, and each one is
+ * page-aligned so that it is used in place as a cv::Mat. The name and the XML annotation of the original image are
+ * kept with it.
+ *
+ * Layout: header, frames, then names and annotations, and the index (an entry per frame) at the end.
+ */
+class PackedImageSet {
+public:
+
+    static constexpr const char *EXTENSION = ".pack";
+
+    PackedImageSet() = default;
+
+    PackedImageSet(const PackedImageSet &) = delete;
+
+    PackedImageSet &operator=(const PackedImageSet &) = delete;
+
+    /**
+     * Map a packed file, replacing the current one. Frames taken before stay valid.
+     * @param file
+     * @return Whether the file is mapped and its index is valid. Errors are printed.
+     */
+    bool open(const fs::path &file);
+
+    void close();
+
+    bool isOpened() const { return mapping != nullptr; }
+
+    size_t size() const { return count; }
+
+    cv::Size frameSize() const { return imageSize; }
+
+    int frameType() const { return type; }
+
+    /**
+     * Get a frame without any copy. The Mat keeps the mapping alive, even after close() or open() of another file.
+     * Pages are mapped copy-on-write, so writing to the Mat never reaches the file.
+     * @param index  Less than size().
+     * @return
+     */
+    cv::Mat frame(size_t index) const;
+
+    /**
+     * @param index  Less than size().
+     * @return Filename of the original image (e.g. 2021-05-25_10-00-00-000.jpg).
+     */
+    std::string_view name(size_t index) const;
+
+    /**
+     * @param index  Less than size().
+     * @return XML annotation of the original image, empty if there was none.
+     */
+    std::string_view annotation(size_t index) const;
+
+    static bool isPackFile(const fs::path &file);
+
+    /**
+     * Writes a packed file frame by frame, so that a large image set never has to be in memory.
+     */
+    class Writer {
+    public:
+
+        /**
+         * @param file  Output file, replaced.
+         * @param size  Size of all frames.
+         * @param type  Type of all frames (e.g. CV_8UC3 for BGR).
+         * @return
+         */
+        bool open(const fs::path &file, cv::Size size, int type);
+
+        /**
+         * @param name        Filename of the original image.
+         * @param frame       Of the size and type given to open().
+         * @param annotation  XML annotation, empty if none.
+         * @return
+         */
+        bool add(const std::string &name, const cv::Mat &frame, const std::string &annotation);
+
+        /**
+         * Write the index and the header. Until then, the file is rejected by PackedImageSet::open().
+         * @return
+         */
+        bool finish();
+
+    private:
+
+        struct PendingEntry {
+            uint64_t frameOffset;
+            std::string name;
+            std::string annotation;
+        };
+
+        std::ofstream out;
+        cv::Size size;
+        int type = 0;
+        std::vector<PendingEntry> pending;
+
+        void pad();
+    };
+
+private:
+
+    struct Mapping;
+    struct Entry;
+
+    std::shared_ptr<const Mapping> mapping;
+    const Entry *entries = nullptr;  // in mapping
+    size_t count = 0;
+    cv::Size imageSize;
+    int type = 0;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_PACKEDIMAGESET_H
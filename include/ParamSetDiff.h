@@ -0,0 +1,76 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_PARAMSETDIFF_H
+#define META_VISION_SOLAIS_PARAMSETDIFF_H
+
+#include "Parameters.h"
+#include <bitset>
+#include <atomic>
+#include <initializer_list>
+
+namespace meta {
+
+/**
+ * Field-level change mask of ParamSet: bit i stands for the field with field number i in Parameters.proto. Masks of
+ * components are built from the generated ParamSet::k*FieldNumber constants.
+ */
+constexpr int PARAM_MASK_BITS = 128;  // must be larger than the largest field number of ParamSet
+using ParamMask = std::bitset<PARAM_MASK_BITS>;
+
+/**
+ * Build a mask from field numbers, e.g. paramMask({ParamSet::kFpsFieldNumber, ParamSet::kGammaFieldNumber}).
+ */
+ParamMask paramMask(std::initializer_list<int> fieldNumbers);
+
+/**
+ * Compare two parameter sets field by field through protobuf reflection.
+ * @return  Mask of fields that differ. All bits are set if a field number doesn't fit in the mask.
+ */
+ParamMask diffParamSets(const ParamSet &a, const ParamSet &b);
+
+/**
+ * A parameter update handed from the control thread to a detection thread, to be applied at a frame boundary.
+ */
+struct ParamUpdate {
+    ParamSet params;
+    ParamMask changed;  // fields changed since the last update taken by the consumer
+};
+
+/**
+ * Single-producer single-consumer mailbox of the latest ParamUpdate. Neither side takes a lock: the producer swaps in
+ * a new update (folding in the mask of one not taken yet), and the consumer polls it once per frame.
+ */
+class PendingParams {
+public:
+
+    PendingParams() = default;
+
+    PendingParams(const PendingParams &) = delete;
+
+    PendingParams &operator=(const PendingParams &) = delete;
+
+    ~PendingParams() { delete pending.exchange(nullptr); }
+
+    /**
+     * Post an update, replacing the one not yet taken. Producer side.
+     * @param params   New parameters.
+     * @param changed  Mask of changed fields.
+     */
+    void post(const ParamSet &params, const ParamMask &changed);
+
+    /**
+     * Take the pending update, if any. Consumer side.
+     * @param update  [Out] The update.
+     * @return        Whether there is an update.
+     */
+    bool take(ParamUpdate &update);
+
+private:
+    std::atomic<ParamUpdate *> pending{nullptr};
+};
+
+}
+
+#endif //META_VISION_SOLAIS_PARAMSETDIFF_H
@@ -7,6 +7,10 @@
 
 #include "Parameters.h"
 #include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
 
 namespace meta {
 
@@ -17,7 +21,9 @@ public:
 
     ParamSetManager();
 
-    void reloadParamSetList();  // switch to default
+    ~ParamSetManager();  // saves in progress are written
+
+    void reloadParamSetList();  // switch to default, and load all parameter sets ahead
 
     const std::vector<std::string> &getParamSetList() const { return paramsSetNames; }
 
@@ -25,20 +31,68 @@ public:
 
     const std::string &currentParamSetName() const { return curParamSetName; }
 
+    /**
+     * Load the current parameter set: from memory if its JSON file is unchanged since it was last loaded or saved,
+     * then from its binary cache (data/params/.cache) if the cache matches the file (mtime, size and hash of the
+     * content), otherwise by parsing the JSON file. Saves not written yet are taken into account.
+     * @return Default ParamSet if it fails.
+     */
     ParamSet loadCurrentParamSet() const;
 
+    /**
+     * Save the current parameter set, and a backup in params_backup. Returns at once: files are written by a thread
+     * of the manager, each one atomically (written aside and renamed), and only the latest of the saves of a
+     * parameter set arriving while a write is in progress is written.
+     * @param p
+     */
     void saveCurrentParamSet(const ParamSet &p);
 
+    /**
+     * Wait until all saves are written.
+     */
+    void flush();
+
 private:
 
     const fs::path paramSetRoot;
+    const fs::path cacheRoot;
 
     const std::string defaultParamSetName;      // use host name as default (without the extension)
 
     std::vector<std::string> paramsSetNames;    // json filenames without the extension
     std::string curParamSetName;                // json filenames without the extension
 
-    void saveParamSetToJson(const ParamSet &p, const fs::path &filename);
+    struct LoadedParamSet {
+        ParamSet params;
+        fs::file_time_type mtime;  // of the JSON file
+        uintmax_t size = 0;
+    };
+    mutable std::mutex loadedMutex;
+    mutable std::unordered_map<std::string, LoadedParamSet> loaded;  // by name, guarded by loadedMutex
+
+    struct PendingSave {
+        ParamSet params;
+        unsigned version = 0;  // increments on each save of the same parameter set
+    };
+    mutable std::mutex saveMutex;
+    std::condition_variable saveCondition;
+    std::unordered_map<std::string, PendingSave> pendingSaves;  // by name, until written, guarded by saveMutex
+    bool saveThreadShouldExit = false;                          // guarded by saveMutex
+    std::thread saveThread;
+
+    ParamSet loadParamSet(const std::string &name) const;
+
+    bool loadBinaryCache(const std::string &name, const std::string &json, const fs::file_time_type &mtime,
+                         ParamSet &p) const;
+
+    void saveBinaryCache(const std::string &name, const std::string &json, const fs::file_time_type &mtime,
+                         const ParamSet &p) const;
+
+    void runSaveThread();
+
+    void writeParamSet(const std::string &name, const ParamSet &p);
+
+    bool saveParamSetToJson(const ParamSet &p, const fs::path &filename, std::string *content = nullptr);
 };
 
 }
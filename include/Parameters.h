@@ -71,19 +71,18 @@ inline FloatPair *allocFloatPair(float x, float y) {
     return ret;
 }
 
-inline ResultPoint2f *allocResultPoint2f(float x, float y) {
-    auto ret = new ResultPoint2f;
-    ret->set_x(x);
-    ret->set_y(y);
-    return ret;
+/**
+ * Set a point of a Result, in place so that the message can be reused.
+ */
+inline void setResultPoint2f(ResultPoint2f *point, float x, float y) {
+    point->set_x(x);
+    point->set_y(y);
 }
 
-inline ResultPoint3f *allocResultPoint3f(float x, float y, float z) {
-    auto ret = new ResultPoint3f;
-    ret->set_x(x);
-    ret->set_y(y);
-    ret->set_z(z);
-    return ret;
+inline void setResultPoint3f(ResultPoint3f *point, float x, float y, float z) {
+    point->set_x(x);
+    point->set_y(y);
+    point->set_z(z);
 }
 
 }
@@ -0,0 +1,26 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_PINNEDMATALLOCATOR_H
+#define META_VISION_SOLAIS_PINNEDMATALLOCATOR_H
+
+#include <opencv2/core/mat.hpp>
+
+namespace meta {
+
+/**
+ * Get the allocator of page-locked, device-mapped host memory for cv::Mat. Frames allocated with it can be read by
+ * CUDA kernels in place on Jetson (unified memory), without any copy. Reference counting of cv::Mat works as usual, so
+ * a view held somewhere else keeps its buffer alive.
+ *
+ * Usage: mat.allocator = pinnedMatAllocator(); mat.create(size, type);
+ *
+ * Without CUDA (not ON_JETSON), the default OpenCV allocator is returned.
+ * @return Allocator singleton.
+ */
+cv::MatAllocator *pinnedMatAllocator();
+
+}
+
+#endif //META_VISION_SOLAIS_PINNEDMATALLOCATOR_H
@@ -7,14 +7,29 @@
 
 #include <vector>
 #include <array>
+#include <string>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include "Parameters.h"
 
 namespace meta {
 
+/**
+ * PnP of the armor rectangle with the closed-form IPPE solution (Collins & Bartoli, Infinitesimal Plane-Based Pose
+ * Estimation, IJCV 2014), specialized for four coplanar points centered at the origin. No iteration and no heap
+ * allocation per solve.
+ */
 class PositionCalculator {
 public:
 
+    /**
+     * Pose of an armor in the camera frame.
+     */
+    struct Pose {
+        cv::Matx33d rotation;
+        cv::Vec3d translation;  // [mm]
+    };
+
     /**
      * Set parameters.
      * @param smallArmorSize  [mm]
@@ -22,9 +37,24 @@ public:
      * @param cameraMatrix
      * @param distCoeffs
      * @param zScale
+     * @param imageSize       Size of the images (ROI) to be solved, covered by the undistortion map.
      */
     void setParameters(cv::Point2f smallArmorSize, cv::Point2f largeArmorSize,
-                       const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, float zScale);
+                       const cv::Mat &cameraMatrix, const cv::Mat &distCoeffs, float zScale, cv::Size imageSize);
+
+    /**
+     * @return Camera calibration of the image size of a param set, data/params/<width>x<height> without ".xml".
+     */
+    static std::string calibrationPath(const ParamSet &p);
+
+    /**
+     * Set parameters with a camera calibration (the principal point scaled into the ROI) and the armor sizes and the
+     * ROI of a param set.
+     * @param p         Param set.
+     * @param filename  Calibration file with cameraMatrix, distCoeffs and zScale (see calibrationPath()).
+     * @return          False if the file can't be opened.
+     */
+    bool loadCalibration(const ParamSet &p, const std::string &filename);
 
     /**
      * Solve armor position in physical world.
@@ -32,23 +62,94 @@ public:
      * @param largeArmor
      * @param manualImagePoints
      * @param offset       [Out] Displacement: x, y, z(distance) in mm
-     * @return
+     * @param pose         [Out] Pose of the armor, can be nullptr.
+     * @param prior        Pose of the same armor in the previous frame, can be nullptr. A plane has two poses that fit
+     *                     its image almost equally well when viewed nearly head-on. The one closer to the prior is
+     *                     taken then, instead of flipping between them from frame to frame.
+     * @return             Success or not (degenerate image points).
      */
     bool solve(const std::array<cv::Point2f, 4> &imagePoints, bool largeArmor, bool manualImagePoints,
-               cv::Point3f &offset) const;
+               cv::Point3f &offset, Pose *pose = nullptr, const Pose *prior = nullptr) const;
+
+    /**
+     * Poses of the armors in the previous frame, as the priors of solve(). An armor takes the prior of the nearest
+     * armor in the previous frame, if close enough in the image. Not thread-safe, use on the thread that solves.
+     */
+    class PoseHistory {
+    public:
+
+        /**
+         * @param center  Image center of an armor.
+         * @param radius  Max distance to the center of the same armor in the previous frame [pixel].
+         * @return        The pose of the armor in the previous frame, or nullptr if not found.
+         */
+        const Pose *find(const cv::Point2f &center, float radius) const;
+
+        /**
+         * Record the pose of an armor of the current frame.
+         */
+        void add(const cv::Point2f &center, const Pose &pose) { current.emplace_back(center, pose); }
+
+        /**
+         * Move on to the next frame. The poses added become the priors.
+         */
+        void nextFrame();
+
+        void clear() {
+            previous.clear();
+            current.clear();
+        }
+
+    private:
+        std::vector<std::pair<cv::Point2f, Pose>> previous;
+        std::vector<std::pair<cv::Point2f, Pose>> current;
+    };
 
 private:
 
     cv::Point2f smallArmorSize;
     cv::Point2f largeArmorSize;
 
-    std::vector<cv::Point3f> smallArmorObjectPoints;
-    std::vector<cv::Point3f> largeArmorObjectPoints;
+    std::array<cv::Point3d, 4> smallArmorObjectPoints;
+    std::array<cv::Point3d, 4> largeArmorObjectPoints;
 
     cv::Mat cameraMatrix;
     cv::Mat distCoeffs;
 
     float zScale;
+
+    /*
+     * Undistortion map: normalized (undistorted, K^-1 applied) coordinates of a grid over the image, so that an image
+     * point is undistorted with a bilinear lookup instead of the iterative cv::undistortPoints. Built in
+     * setParameters() only when the intrinsics or the image size change.
+     */
+    static constexpr int UNDISTORT_MAP_STEP = 4;  // [pixel], the distortion is smooth at this scale
+    cv::Size imageSize;
+    int undistortMapCols = 0;
+    int undistortMapRows = 0;
+    std::vector<cv::Point2f> undistortMap;  // row-major
+    bool hasDistortion = false;
+
+    void buildUndistortMap();
+
+    /**
+     * Undistort and normalize image points through the map. Points outside the map fall back to cv::undistortPoints.
+     */
+    void undistort(const std::array<cv::Point2f, 4> &points, std::array<cv::Point2d, 4> &normalizedPoints) const;
+
+    // Take the prior unless the reprojection error of the other solution is clearly smaller
+    static constexpr double AMBIGUITY_RATIO = 4.0;
+
+    /**
+     * Closed-form IPPE.
+     * @param objectPoints  Coplanar (z = 0) points centered at the origin.
+     * @param imagePoints   Normalized (undistorted) image points.
+     * @param poses         [Out] The two solutions.
+     * @param errors        [Out] Sum of squared reprojection errors of the two solutions, in normalized coordinates.
+     * @return              Success or not.
+     */
+    static bool solveIPPE(const std::array<cv::Point3d, 4> &objectPoints, const std::array<cv::Point2d, 4> &imagePoints,
+                          std::array<Pose, 2> &poses, std::array<double, 2> &errors);
 };
 
 }
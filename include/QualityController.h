@@ -0,0 +1,156 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_QUALITYCONTROLLER_H
+#define META_VISION_SOLAIS_QUALITYCONTROLLER_H
+
+#include "LatencyStats.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace meta {
+
+/**
+ * Keep the detection within a frame deadline (adaptive_quality) when the board slows down, e.g. as a Jetson throttles
+ * its clocks when it gets hot. The controller takes the busy time of the detection thread for each frame, and a
+ * low-priority sampler thread of its own reads the SoC temperature and the CPU and GPU clocks from sysfs, so that the
+ * detection thread never blocks on the files. When the smoothed busy time misses the deadline or the SoC is hot, it
+ * walks down a ladder of levels, each one saving more than the last, and walks up again after the detection has kept
+ * well within the deadline for a while. Every change is logged and kept for the terminal.
+ *
+ * frameProcessed() and reset() are called by the detection thread, the level can be read from any thread.
+ */
+class QualityController {
+public:
+
+    enum Level {
+        FULL,                // as configured
+        LIGHT_OUTPUTS,       // no debug images from the detector, terminal stream at its lower qualities
+        TRACKING_ROI,        // search around the target even if tracking_roi is disabled
+        SPARSE_FULL_SEARCH,  // and search the whole frame half as often
+        LEVEL_COUNT
+    };
+
+    struct BoardStatus {
+        float temperature = 0;  // hottest CPU or GPU thermal zone [Celsius], 0 if unknown
+        int cpuMHz = 0, cpuMaxMHz = 0;  // of CPU 0, 0 if unknown
+        int gpuMHz = 0, gpuMaxMHz = 0;  // 0 if unknown (not a Jetson)
+    };
+
+    /**
+     * Start the sampler thread.
+     */
+    QualityController();
+
+    ~QualityController();
+
+    /**
+     * @param enabled     adaptive_quality enabled, otherwise the level stays FULL.
+     * @param deadlineMs  Max busy time of the detection thread per frame.
+     */
+    void setDeadline(bool enabled, float deadlineMs);
+
+    /**
+     * Back to FULL, e.g. at the start of the detection.
+     */
+    void reset();
+
+    /**
+     * A frame has been processed by the detection thread.
+     * @param busy  Time the detection thread spent on the frame, not including the wait for it.
+     */
+    void frameProcessed(LatencyClock::duration busy, LatencyClock::time_point time = LatencyClock::now());
+
+    Level level() const { return currentLevel.load(std::memory_order_relaxed); }
+
+    bool allowsDebugImages() const { return level() < LIGHT_OUTPUTS; }
+
+    /**
+     * @return Lowest level of ResultStreamController allowed for the terminal stream.
+     */
+    int minStreamLevel() const { return level() >= LIGHT_OUTPUTS ? LIGHT_STREAM_LEVEL : 0; }
+
+    bool forcesTrackingROI() const { return level() >= TRACKING_ROI; }
+
+    /**
+     * @param interval  Frames between searches of the whole frame, as configured.
+     * @return          Interval at the current level.
+     */
+    int fullSearchInterval(int interval) const { return level() >= SPARSE_FULL_SEARCH ? interval * 2 : interval; }
+
+    /**
+     * @return Decisions since the last fetch, for the terminal.
+     */
+    std::vector<std::string> fetchDecisions();
+
+    /**
+     * @return Last sample of the sampler thread, without any IO. All 0 before the first one.
+     */
+    BoardStatus boardStatus() const;
+
+    /**
+     * Read the temperature and the clocks from sysfs. Entries missing on the board are left 0.
+     */
+    static BoardStatus readBoardStatus();
+
+    static const char *levelName(Level level);
+
+    // Full-frame searches when TRACKING_ROI forces tracking_roi, which is disabled
+    static constexpr int DEFAULT_FULL_SEARCH_INTERVAL = 10;
+
+private:
+
+    static constexpr int LIGHT_STREAM_LEVEL = 2;  // of ResultStreamController, without brightness and color masks
+
+    // Step down fast, but step up only after a while, to avoid oscillating
+    static constexpr auto STEP_DOWN_HOLD = std::chrono::milliseconds(300);
+    static constexpr auto STEP_UP_HOLD = std::chrono::seconds(3);
+    static constexpr float STEP_UP_RATIO = 0.7f;  // of the deadline, under which the detection keeps well within it
+
+    // Jetsons start to throttle at about 90 (Orin) to 97 (Nano) degrees Celsius
+    static constexpr float HOT_TEMPERATURE = 85;
+    static constexpr float COOL_TEMPERATURE = 80;
+
+    static constexpr auto BOARD_SAMPLE_PERIOD = std::chrono::milliseconds(500);
+
+    static constexpr float BUSY_GAIN = 0.1f;  // of the moving average
+
+    static constexpr size_t MAX_PENDING_DECISIONS = 32;
+
+    bool enabled = false;
+    float deadline = 0;  // [ms]
+
+    std::atomic<Level> currentLevel{FULL};
+    float smoothedBusy = 0;  // [ms], 0 before the first frame
+    BoardStatus board;  // as of the last frame
+    LatencyClock::time_point lastChangeTime;
+    LatencyClock::time_point lastNotGoodTime;  // busy time over STEP_UP_RATIO of the deadline or not cool
+
+    std::mutex decisionMutex;
+    std::deque<std::string> decisions;
+
+    // Published by the sampler thread, each field on its own, as they are only shown together
+    std::atomic<float> sampledTemperature{0};
+    std::atomic<int> sampledCpuMHz{0}, sampledCpuMaxMHz{0};
+    std::atomic<int> sampledGpuMHz{0}, sampledGpuMaxMHz{0};
+
+    std::mutex samplerMutex;
+    std::condition_variable samplerCondition;
+    bool samplerShouldExit = false;  // guarded by samplerMutex
+    std::thread samplerThread;
+
+    void runSampler();
+
+    void changeLevel(Level level, const char *reason, LatencyClock::time_point time);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_QUALITYCONTROLLER_H
@@ -0,0 +1,29 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_RESULTENCODING_H
+#define META_VISION_SOLAIS_RESULTENCODING_H
+
+#include <vector>
+#include <opencv2/core/types.hpp>
+#include "Parameters.h"
+#include "AimingSolver.h"
+
+namespace meta {
+
+/**
+ * Add the light rects and the armors of a frame to a Result for the terminal, in the coordinates of its preview
+ * image. Shared by Solais and the benchmark of the reply (tools/Utilities/ComponentBenchmark).
+ * @param lightRects   Light rects of ArmorDetector, in the coordinates of the frame.
+ * @param armors       Armors of AimingSolver, in the coordinates of the configured ROI.
+ * @param frameOffset  Position of the frame in the configured ROI (see FrameHandle::offset()).
+ * @param imageScale   Preview image size to frame size.
+ * @param result       [Out] Lights and armors are added.
+ */
+void addResultDetections(const std::vector<cv::RotatedRect> &lightRects, const AimingSolver::ArmorList &armors,
+                         const cv::Point2f &frameOffset, float imageScale, Result &result);
+
+}
+
+#endif //META_VISION_SOLAIS_RESULTENCODING_H
@@ -0,0 +1,105 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_RESULTSTREAMCONTROLLER_H
+#define META_VISION_SOLAIS_RESULTSTREAMCONTROLLER_H
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace meta {
+
+/**
+ * Adapt the result stream to the link to the terminal. The terminal sends the next fetch only after it has received
+ * and shown a result, so the time from a reply handed to the socket to the next fetch is the round trip of the stream,
+ * including the transmission. On a congested link it grows, and so do the bytes in flight on the socket. The controller
+ * then steps down the quality (preview height, JPEG quality and the images sent) and steps up again when the link
+ * keeps up with the target round trip.
+ *
+ * Not thread-safe. Call replySent() and fetchReceived() on the TCP thread.
+ */
+class ResultStreamController {
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Quality {
+        int previewHeight;      // height of the images
+        int jpegQuality;        // [1, 100], also scales the bitrate of video encoders
+        const char *imageMask;  // images allowed, 'T' or 'F' for camera, brightness, color, and contours
+    };
+
+    /**
+     * @param targetRoundTrip   Smoothed round trip above which the quality is stepped down.
+     * @param maxBytesInFlight  Bytes in flight on the socket above which the quality is stepped down.
+     */
+    explicit ResultStreamController(std::chrono::milliseconds targetRoundTrip = std::chrono::milliseconds(120),
+                                    size_t maxBytesInFlight = 256 * 1024)
+            : targetRoundTrip(targetRoundTrip), maxBytesInFlight(maxBytesInFlight) {}
+
+    /**
+     * A non-empty reply is handed to the socket. The next fetch acknowledges it.
+     */
+    void replySent(Clock::time_point time = Clock::now());
+
+    /**
+     * A fetch arrives. Take the round trip of the last reply and adapt the quality for the reply to this fetch.
+     * @param bytesInFlight  Bytes in flight on the socket.
+     * @return               Quality of the reply.
+     */
+    const Quality &fetchReceived(size_t bytesInFlight, Clock::time_point time = Clock::now());
+
+    /**
+     * @param mask  Images requested by the terminal.
+     * @return      Images requested and allowed by the current quality.
+     */
+    std::string filterMask(std::string_view mask) const;
+
+    /**
+     * Back to the full quality, e.g. for a new connection.
+     */
+    void reset();
+
+    /**
+     * Keep the quality at or below a level whatever the link, e.g. when the detection has to save time on the host.
+     * Takes effect at the next fetch.
+     */
+    void setMinLevel(int level) { minLevel = level; }
+
+    int level() const { return currentLevel; }
+
+    float smoothedRoundTrip() const { return srtt; }  // [ms], 0 before the first sample
+
+private:
+
+    std::chrono::milliseconds targetRoundTrip;
+    size_t maxBytesInFlight;
+
+    static const Quality LEVELS[];
+    static const int LEVEL_COUNT;
+
+    // Step down fast, but step up only after the link has been good for a while, to avoid oscillating
+    static constexpr auto STEP_DOWN_HOLD = std::chrono::milliseconds(500);
+    static constexpr auto STEP_UP_HOLD = std::chrono::seconds(3);
+
+    // A longer "round trip" means the terminal stopped fetching (e.g. image transfer disabled), not congestion
+    static constexpr auto STREAM_PAUSE = std::chrono::seconds(5);
+
+    static constexpr float SRTT_GAIN = 0.25f;
+
+    int currentLevel = 0;
+    int minLevel = 0;
+    float srtt = 0;
+    bool awaitingAck = false;
+    Clock::time_point replyTime;
+    Clock::time_point lastChangeTime;
+    Clock::time_point lastNotGoodTime;
+
+    void changeLevel(int level, size_t bytesInFlight, Clock::time_point time);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_RESULTSTREAMCONTROLLER_H
@@ -0,0 +1,185 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_SPSCQUEUE_H
+#define META_VISION_SOLAIS_SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+
+namespace meta {
+
+/**
+ * Bounded lock-free single-producer single-consumer ring buffer, used to connect pipeline stages running on
+ * different threads.
+ *
+ * push() must only be called from the producer thread, and pop()/popLatest() only from the consumer thread. Slots are
+ * preallocated at construction and reused, so no allocation happens on push or pop (other than what the moved-in
+ * element itself does).
+ *
+ * The consumer can choose between two policies per call:
+ *  pop():       take the oldest element, every element is processed (no frame drop, suitable for image sets).
+ *  popLatest(): take the newest element and discard all older ones, so that the latency of a lagging stage stays
+ *               bounded by a single element (suitable for real-time streaming).
+ */
+template<class T>
+class SPSCQueue {
+public:
+
+    /**
+     * Create a queue.
+     * @param capacity  Max number of elements that can be queued (at least 1).
+     */
+    explicit SPSCQueue(size_t capacity = 2) : slots(capacity + 1) {}
+
+    SPSCQueue(const SPSCQueue &) = delete;
+
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+    size_t capacity() const { return slots.size() - 1; }
+
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+
+    /**
+     * Push an element. Called by the producer only.
+     * @param item  Element to be moved into the queue. Not moved if the queue is full.
+     * @return      False if the queue is full.
+     */
+    bool push(T &&item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire)) return false;  // full
+        slots[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pop the oldest element. Called by the consumer only.
+     * @param item  [Out] The element.
+     * @return      False if the queue is empty.
+     */
+    bool pop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;  // empty
+        item = std::move(slots[h]);
+        slots[h] = T();  // release resources held by the slot early
+        head.store(increment(h), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pop the newest element and discard all older ones (drop-oldest). Called by the consumer only.
+     * @param item     [Out] The element.
+     * @param dropped  [Out] Number of discarded elements, added to the given value.
+     * @return         False if the queue is empty.
+     */
+    bool popLatest(T &item, unsigned &dropped) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        if (h == t) return false;  // empty
+        size_t newest = (t == 0 ? slots.size() - 1 : t - 1);
+        for (; h != newest; h = increment(h)) {
+            slots[h] = T();
+            ++dropped;
+        }
+        item = std::move(slots[newest]);
+        slots[newest] = T();
+        head.store(t, std::memory_order_release);
+        return true;
+    }
+
+private:
+
+    std::vector<T> slots;  // one slot is always left empty to tell full from empty
+
+    // Written by different threads, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> head = 0;  // written by the consumer
+    alignas(64) std::atomic<size_t> tail = 0;  // written by the producer
+
+    size_t increment(size_t i) const { return (i + 1 == slots.size() ? 0 : i + 1); }
+};
+
+/**
+ * SPSCQueue whose ends wait for each other: the producer while the queue is full, the consumer while it is empty.
+ * The handoff itself stays lock-free, the mutex and the conditions are only touched by a side that has to sleep, and
+ * by the other side to wake it up. Same thread requirements as SPSCQueue.
+ */
+template<class T>
+class BlockingSPSCQueue {
+public:
+
+    explicit BlockingSPSCQueue(size_t capacity = 2) : queue(capacity) {}
+
+    size_t capacity() const { return queue.capacity(); }
+
+    /**
+     * Push an element, waiting while the queue is full. Called by the producer only.
+     */
+    void push(T &&item) {
+        if (!queue.push(std::move(item))) {
+            std::unique_lock<std::mutex> lock(mutex);
+            producerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the fence of wake()
+            notFull.wait(lock, [&] { return queue.push(std::move(item)); });  // not moved until pushed
+            producerWaiting.store(false, std::memory_order_relaxed);
+        }
+        wake(consumerWaiting, notEmpty);
+    }
+
+    /**
+     * Pop the oldest element, waiting while the queue is empty. Called by the consumer only.
+     */
+    void pop(T &item) {
+        consume([&] { return queue.pop(item); });
+    }
+
+    /**
+     * Pop the newest element and discard all older ones, waiting while the queue is empty (see
+     * SPSCQueue::popLatest()). Called by the consumer only.
+     */
+    void popLatest(T &item, unsigned &dropped) {
+        consume([&] { return queue.popLatest(item, dropped); });
+    }
+
+private:
+
+    SPSCQueue<T> queue;
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::atomic<bool> producerWaiting{false};
+    std::atomic<bool> consumerWaiting{false};
+
+    template<class TryPop>
+    void consume(TryPop tryPop) {
+        if (!tryPop()) {
+            std::unique_lock<std::mutex> lock(mutex);
+            consumerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the fence of wake()
+            notEmpty.wait(lock, tryPop);
+            consumerWaiting.store(false, std::memory_order_relaxed);
+        }
+        wake(producerWaiting, notFull);
+    }
+
+    /**
+     * After a push or a pop, wake up the other side if it sleeps. Either it sees the change when it checks the queue
+     * again after raising its flag, or this sees the flag, and the mutex makes sure it is waiting before notifying.
+     */
+    void wake(std::atomic<bool> &waiting, std::condition_variable &condition) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!waiting.load(std::memory_order_relaxed)) return;
+        { std::lock_guard<std::mutex> lock(mutex); }
+        condition.notify_one();
+    }
+};
+
+}
+
+#endif //META_VISION_SOLAIS_SPSCQUEUE_H
@@ -0,0 +1,104 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_SEQUENCEDRINGBUFFER_H
+#define META_VISION_SOLAIS_SEQUENCEDRINGBUFFER_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace meta {
+
+/**
+ * A preallocated ring buffer of a fixed capacity, for histories that are appended at the back and expire at the front.
+ * When full, pushing drops the oldest element. Every element pushed gets the next sequence number, so that a copy can
+ * be brought up to date with syncFrom() by copying only what changed since, instead of the whole history. Only the
+ * last element may be modified in place (back()), which syncFrom() always copies again.
+ * @tparam T  Element type, default-constructible.
+ * @tparam N  Capacity.
+ */
+template<class T, size_t N>
+class SequencedRingBuffer {
+public:
+
+    static constexpr size_t capacity() { return N; }
+
+    size_t size() const { return (size_t) (endSeq - beginSeq); }
+
+    bool empty() const { return endSeq == beginSeq; }
+
+    T &operator[](size_t i) { return buf[(beginSeq + i) % N]; }
+
+    const T &operator[](size_t i) const { return buf[(beginSeq + i) % N]; }
+
+    T &front() { return (*this)[0]; }
+
+    const T &front() const { return (*this)[0]; }
+
+    T &back() { return buf[(endSeq - 1) % N]; }
+
+    const T &back() const { return buf[(endSeq - 1) % N]; }
+
+    void push_back(const T &v) {
+        buf[endSeq % N] = v;
+        endSeq++;
+        if (endSeq - beginSeq > N) beginSeq++;  // drop the oldest
+    }
+
+    void pop_front() {
+        assert(!empty());
+        beginSeq++;
+    }
+
+    void clear() { beginSeq = endSeq; }  // keep the sequence numbers increasing for syncFrom()
+
+    /**
+     * Make this a copy of another buffer, which this was copied from before (or is empty). Copies only the elements
+     * pushed since, and the last element of the last copy as it may have been modified.
+     */
+    void syncFrom(const SequencedRingBuffer &src) {
+        uint64_t from = (endSeq > 0 ? endSeq - 1 : 0);
+        if (from < src.beginSeq || from > src.endSeq) from = src.beginSeq;  // far behind or another source
+        for (uint64_t seq = from; seq < src.endSeq; seq++) buf[seq % N] = src.buf[seq % N];
+        beginSeq = src.beginSeq;
+        endSeq = src.endSeq;
+    }
+
+    class const_iterator {
+    public:
+        const_iterator(const SequencedRingBuffer *ring, uint64_t seq) : ring(ring), seq(seq) {}
+
+        const T &operator*() const { return ring->buf[seq % N]; }
+
+        const T *operator->() const { return &ring->buf[seq % N]; }
+
+        const_iterator &operator++() {
+            seq++;
+            return *this;
+        }
+
+        bool operator!=(const const_iterator &other) const { return seq != other.seq; }
+
+        bool operator==(const const_iterator &other) const { return seq == other.seq; }
+
+    private:
+        const SequencedRingBuffer *ring;
+        uint64_t seq;
+    };
+
+    const_iterator begin() const { return {this, beginSeq}; }
+
+    const_iterator end() const { return {this, endSeq}; }
+
+private:
+    std::array<T, N> buf;
+    uint64_t beginSeq = 0;  // sequence number of the front
+    uint64_t endSeq = 0;    // sequence number of the next push
+};
+
+}
+
+#endif //META_VISION_SOLAIS_SEQUENCEDRINGBUFFER_H
@@ -7,20 +7,67 @@
 
 #include <string>
 #include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <boost/asio.hpp>
 #include <utility>
 #include "FrameCounterBase.h"
 #include "Utilities.h"
+#include "LatencyStats.h"
+#include "TimeSync.h"
 
 namespace meta {
 
 class Serial : public FrameCounterBase {
 public:
 
+    /**
+     * Construct without opening the device, see open().
+     */
     explicit Serial(boost::asio::io_context &ioContext);
 
+    /**
+     * Open SERIAL_DEVICE and start receiving, exiting if the device can't be opened. Once, from any thread, so that
+     * the bring-up can go on while the device opens.
+     */
+    void open();
+
+    /**
+     * Async send a control command, waiting for open() to finish if it hasn't. Latest wins: if a write is in progress,
+     * the command waits in a single slot, which a newer command replaces (see getSupersededCommands()), so that the
+     * gimbal never receives stale commands piled up behind a slow link. No allocation.
+     * @param frameArrivalTime  Host arrival time of the frame, to record end-to-end latency when the write completes.
+     *                          Not recorded if default (epoch).
+     * @param frameCaptureTime  Capture of the frame on the host clock, from which the age of the command is sent.
+     *                          frameArrivalTime if default.
+     * @return                  Whether the operation succeeded.
+     */
     bool sendControlCommand(bool detected, bool topKillerTriggered, TimePoint time, float yawDelta, float pitchDelta, float distance,
-                            float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period);
+                            float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period,
+                            LatencyClock::time_point frameArrivalTime = {},
+                            LatencyClock::time_point frameCaptureTime = {});
+
+    /**
+     * @return Smoothed latency from the arrival of a frame to the completed write of its command [ms], 0 if never
+     *         measured. The time a command takes to take effect, for prediction.
+     */
+    float getSmoothedLatency() const { return smoothedLatency; }
+
+    /**
+     * @return Commands replaced by a newer one before being written, since construction.
+     */
+    unsigned getSupersededCommands() const { return supersededCommands; }
+
+    /**
+     * Gimbal attitude at a time, from the feedback of Control. Thread-safe.
+     * @param time      On LatencyClock, usually the exposure time of a frame (FrameHandle::exposureTime()).
+     * @param attitude  [Out]
+     * @return          False if there is no feedback around the time (e.g. Control does not send it).
+     */
+    bool getGimbalAttitude(LatencyClock::time_point time, GimbalAttitude &attitude) const {
+        return attitudeHistory.interpolate(time, attitude);
+    }
 
 private:
 
@@ -44,6 +91,16 @@ private:
         int16_t imageY;                 // pixel
         int16_t remainingTimeToTarget;  // [ms]
         int16_t period;                 // [ms]
+        uint16_t frameAge;              // [0.1ms] from the capture of the frame to the write of this command, 0xFFFF
+                                        // if older or unknown. Unlike frameTime it never wraps around, so Control can
+                                        // tell how stale the command is without a common clock
+    };
+
+    // Control -> Vision, sent periodically
+    struct __attribute__((packed, aligned(1))) GimbalFeedback {
+        uint32_t time;   // when the angles were sampled, on the clock of Control [0.1ms]
+        int16_t yaw;     // absolute angle, rightward for positive [deg] * 100
+        int16_t pitch;   // absolute angle, downward for positive [deg] * 100
     };
 
     struct __attribute__((packed, aligned(1))) Package {
@@ -51,17 +108,20 @@ private:
         uint8_t cmdID;
         union {  // union takes the maximal size of its elements
             VisionCommand command;
+            GimbalFeedback feedback;
         };
         uint8_t crc8;  // just for reference but not use (the offset of this is not correct)
     };
 
     enum CommandID : uint8_t {
         VISION_CONTROL_CMD_ID = 0,
+        GIMBAL_FEEDBACK_CMD_ID = 1,
         CMD_ID_COUNT
     };
 
     static constexpr size_t DATA_SIZE[CMD_ID_COUNT] = {
-            sizeof(VisionCommand)
+            sizeof(VisionCommand),
+            sizeof(GimbalFeedback)
     };
 
 private:
@@ -69,7 +129,16 @@ private:
     boost::asio::io_context &ioContext;
     boost::asio::serial_port serial;
 
+    std::atomic<bool> opened{false};  // set at the end of open(), with openMutex held
+    std::mutex openMutex;
+    std::condition_variable openCondition;
+
+    // SERIAL_BAUD can be defined in CMakeLists.txt for faster UARTs. USB CDC ACM links ignore the baud rate.
+#ifdef SERIAL_BAUD
+    static constexpr int SERIAL_BAUD_RATE = SERIAL_BAUD;
+#else
     static constexpr int SERIAL_BAUD_RATE = 115200;
+#endif
 
     enum ReceiverState {
         RECV_PREAMBLE,          // 0xA5
@@ -82,9 +151,36 @@ private:
 
     uint8_t sendSeq = 0;
 
+    // Two preallocated packages: the one being written, and the latest command waiting for the write to complete
+    static constexpr size_t COMMAND_PACKAGE_SIZE = sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t);
+    struct TxSlot {
+        Package pkg;
+        LatencyClock::time_point frameArrivalTime;
+        LatencyClock::time_point frameCaptureTime;  // frameAge and the CRC are filled when the write starts
+    };
+    TxSlot txWriting, txPending;
+    std::mutex txMutex;             // sendControlCommand() from the aiming thread, handleSend() from the IO thread
+    bool writing = false;           // guarded by txMutex
+    bool hasPending = false;        // guarded by txMutex
+    std::atomic<unsigned> supersededCommands{0};
+
+    std::atomic<float> smoothedLatency = 0;  // written by the IO thread
+    static constexpr float LATENCY_SMOOTHING_GAIN = 0.1f;
+
     Package recvPackage;
 
-    void handleSend(std::shared_ptr<Package> buf, const boost::system::error_code &error, size_t numBytes);
+    // Feedback is mapped onto LatencyClock by the timestamps of Control, both used by the IO thread only
+    ClockMapper controlClock;
+    AttitudeHistory attitudeHistory;
+
+    // Time on the wire of a package of size bytes (8N1, 10 bits per byte), subtracted from its arrival time
+    static constexpr std::chrono::microseconds transferTime(size_t size) {
+        return std::chrono::microseconds(size * 10 * 1000000 / SERIAL_BAUD_RATE);
+    }
+
+    void startWrite();  // of txWriting, with txMutex held
+
+    void handleSend(const boost::system::error_code &error, size_t numBytes);
 
     void handleRecv(const boost::system::error_code &error, size_t numBytes);
 
@@ -0,0 +1,133 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_SHAREDRESULTRING_H
+#define META_VISION_SOLAIS_SHAREDRESULTRING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace meta {
+
+/**
+ * Ring of result slots in POSIX shared memory, for a terminal on the same machine (e.g. on the HDMI output of the
+ * robot in the pit). Results then carry raw images (Image::RAW) instead of encoded ones, which skips the encoding in
+ * Solais and the decoding in the terminal. The TCP socket still carries the fetches and a small notification of each
+ * slot ("resShm"), so that the fetch cycle and ResultStreamController work as over TCP.
+ *
+ * A slot holds the raw images followed by the serialized Result, which locates the images by Image::data_offset. The
+ * writer fills the slots in turn. The state of a slot is its sequence number, or 0 while it is written (a seqlock): a
+ * reader uses a slot in place and checks with isValid() that it has not been rewritten meanwhile. As the terminal
+ * fetches the next result only after it is done with a slot, a slot is rewritten SLOT_COUNT - 1 replies after that,
+ * so the check only fails for a reader that fell behind.
+ *
+ * Single writer (Solais creates the ring and removes it when closed) and single reader. Not thread-safe.
+ */
+class SharedResultRing {
+public:
+
+    static constexpr const char *DEFAULT_NAME = "/solais-results";
+    static constexpr uint32_t SLOT_COUNT = 3;
+    static constexpr size_t SLOT_CAPACITY = 8 * 1024 * 1024;  // bytes of images and message in a slot
+
+    SharedResultRing() = default;
+
+    ~SharedResultRing() { close(); }
+
+    SharedResultRing(const SharedResultRing &) = delete;
+
+    SharedResultRing &operator=(const SharedResultRing &) = delete;
+
+    /**
+     * Create the ring as the writer, replacing a stale one of the same name.
+     * @param name  Name of the shared memory object.
+     * @return      Whether the operation succeeded. See errorMessage() otherwise.
+     */
+    bool create(const std::string &name = DEFAULT_NAME);
+
+    /**
+     * Open the ring created by the writer, as the reader.
+     * @param name  Name of the shared memory object.
+     * @return      Whether the operation succeeded. See errorMessage() otherwise.
+     */
+    bool open(const std::string &name = DEFAULT_NAME);
+
+    /**
+     * Unmap the ring, and remove it if created by create().
+     */
+    void close();
+
+    bool isOpen() const { return base != nullptr; }
+
+    const std::string &name() const { return ringName; }
+
+    const std::string &errorMessage() const { return error; }
+
+    // ================================ Writer ================================
+
+    /**
+     * Start writing the next slot, which readers see as invalid until commit().
+     * @return  Payload of the slot, SLOT_CAPACITY bytes.
+     */
+    uint8_t *beginWrite();
+
+    /**
+     * Publish the slot started by beginWrite().
+     * @param messageOffset  Offset of the serialized Result in the payload, after the images.
+     * @param messageSize    Size of the serialized Result.
+     * @return               Sequence number of the slot, to be sent to the reader.
+     */
+    uint64_t commit(size_t messageOffset, size_t messageSize);
+
+    // ================================ Reader ================================
+
+    struct SlotView {
+        const uint8_t *payload;  // images at Image::data_offset, up to message
+        const uint8_t *message;  // serialized Result
+        size_t messageOffset;
+        size_t messageSize;
+    };
+
+    /**
+     * Get a slot in place.
+     * @param sequence  Sequence number sent by the writer.
+     * @param view      [Out] The slot.
+     * @return          False if the slot has been rewritten (or is being written), or is malformed.
+     */
+    bool read(uint64_t sequence, SlotView &view) const;
+
+    /**
+     * @return Whether the slot of a sequence number is still the one read(), to be checked after using it.
+     */
+    bool isValid(uint64_t sequence) const;
+
+private:
+
+    struct RingHeader;
+    struct SlotHeader;
+
+    uint8_t *base = nullptr;
+    size_t mappedSize = 0;
+    bool owner = false;
+    std::string ringName;
+    std::string error;
+
+    uint64_t nextSequence = 1;  // of the writer
+    uint64_t writingSequence = 0;
+
+    static size_t slotStride();
+
+    static size_t totalSize();
+
+    SlotHeader *slot(uint64_t sequence) const;
+
+    bool map(int fd, bool writable);
+
+    bool fail(const std::string &what);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_SHAREDRESULTRING_H
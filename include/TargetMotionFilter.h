@@ -0,0 +1,84 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_TARGETMOTIONFILTER_H
+#define META_VISION_SOLAIS_TARGETMOTIONFILTER_H
+
+#include <array>
+#include <chrono>
+#include <opencv2/core.hpp>
+#include "Utilities.h"
+
+namespace meta {
+
+/**
+ * Kalman filter of the position of a target, with a constant-velocity model and white acceleration noise. Measurements
+ * are the PnP offsets, keyed on the camera capture time. The three axes are independent under this model, so each is
+ * a 2-state (position, velocity) filter, with no matrix library involved.
+ */
+class TargetMotionFilter {
+public:
+
+    /**
+     * @param accelNoise        Standard deviation of the acceleration [mm/s^2].
+     * @param measurementNoise  Standard deviation of the measured position [mm].
+     */
+    void setNoise(float accelNoise, float measurementNoise) {
+        q = accelNoise * accelNoise;
+        r = measurementNoise * measurementNoise;
+    }
+
+    /**
+     * Start over from a measurement, with an unknown velocity.
+     */
+    void reset(const cv::Point3f &position, TimePoint time);
+
+    /**
+     * Predict to the time of a measurement and correct with it.
+     */
+    void update(const cv::Point3f &position, TimePoint time);
+
+    /**
+     * @return Position predicted from the last update into the given future [s], without changing the state.
+     */
+    cv::Point3f predict(float seconds) const;
+
+    /**
+     * @return Position predicted to the time of a measurement, to check if the measurement belongs to this target.
+     */
+    cv::Point3f predictAt(TimePoint time) const;
+
+    /**
+     * @return Whether the velocity has been estimated from at least two measurements.
+     */
+    bool ready() const { return updateCount >= 2; }
+
+    bool initialized() const { return updateCount > 0; }
+
+    cv::Point3f velocity() const { return {axes[0].v, axes[1].v, axes[2].v}; }  // [mm/s]
+
+private:
+
+    struct Axis {
+        float p, v;            // position [mm] and velocity [mm/s]
+        float p00, p01, p11;   // covariance
+    };
+    std::array<Axis, 3> axes;
+
+    float q = 0;  // acceleration variance
+    float r = 0;  // measurement variance
+
+    TimePoint lastTime = 0;
+    unsigned updateCount = 0;
+
+    static constexpr float INITIAL_VELOCITY_VARIANCE = 4000.0f * 4000.0f;  // [mm/s]^2, faster than any robot
+
+    static float secondsBetween(TimePoint from, TimePoint to) {
+        return (float) (int) (to - from) / 10000.0f;  // TimePoint is 0.1 ms, wraps around
+    }
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TARGETMOTIONFILTER_H
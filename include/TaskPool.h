@@ -0,0 +1,70 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_TASKPOOL_H
+#define META_VISION_SOLAIS_TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace meta {
+
+/**
+ * A few persistent worker threads running the tasks of a parallel loop. Tasks are not assigned up front: each thread
+ * (the caller included) takes the next task as soon as it finishes the last one, so that bands that take longer (more
+ * lights) do not hold up the others.
+ */
+class TaskPool {
+public:
+
+    TaskPool() = default;
+
+    ~TaskPool() { setWorkerCount(0); }
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    /**
+     * (Re)start the worker threads, no-op if the count is unchanged. Do not call while run() is in progress.
+     * @param count  Number of threads besides the caller of run().
+     */
+    void setWorkerCount(int count);
+
+    int workerCount() const { return (int) workers.size(); }
+
+    /**
+     * Run task(0) ... task(taskCount - 1) on the workers and the calling thread, and wait for all of them.
+     */
+    void run(int taskCount, const std::function<void(int)> &task);
+
+private:
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeCV;  // a job is posted or stopping
+    std::condition_variable doneCV;  // all workers are done with the job
+    uint64_t generation = 0;         // incremented for each job
+    bool stopping = false;
+    const std::function<void(int)> *job = nullptr;
+    int jobTaskCount = 0;
+    int busyWorkers = 0;
+    std::atomic<int> nextTask{0};
+
+    /**
+     * @param seen  Generation when the worker is started, the jobs after which it takes part in.
+     */
+    void workerLoop(uint64_t seen);
+
+    void runTasks();
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TASKPOOL_H
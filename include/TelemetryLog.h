@@ -0,0 +1,311 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_TELEMETRYLOG_H
+#define META_VISION_SOLAIS_TELEMETRYLOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "Parameters.h"
+#include "AimingSolver.h"
+#include "LatencyStats.h"
+#include "SPSCQueue.h"
+
+namespace meta {
+
+/**
+ * Append-only binary log of every frame of a run (telemetry_log), for post-match analysis: the armors handed to
+ * AimingSolver and its results, the command and the gimbal attitude it used, the aiming parameters as they change, and
+ * from the serial, every command written and every gimbal feedback received. TelemetryReplay reads it back and
+ * re-drives AimingSolver offline.
+ *
+ * Records are fixed-size structs of a few types, copied by the producers into lock-free queues, one per producer
+ * thread: the aiming stage (params and frames) and the serial IO thread (commands and feedback). A writer thread of its
+ * own appends them to a file mapped in chunks, so that producers never touch the file, and a record costs them a copy
+ * of a few KB at most. A record that finds its queue full is dropped and counted.
+ *
+ * File layout (host byte order): FileHeader, then records, each a RecordHeader followed by header.size -
+ * sizeof(RecordHeader) bytes of the struct of its type, padded to RECORD_ALIGNMENT. A FrameRecord is cut after its
+ * armorCount armors. The file is preallocated by chunks and truncated at close(). After a crash, the records end at a
+ * RecordHeader of type NONE or at one running past the end of the file.
+ */
+class TelemetryLog {
+public:
+
+    static constexpr uint32_t MAGIC = 0x544C4F53;  // "SOLT"
+    static constexpr uint16_t VERSION = 1;
+
+    struct FileHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t headerSize;
+        int64_t startTime;  // LatencyClock [ns] at open(), to which record times are comparable
+        int64_t wallTime;   // system_clock [ns] at open()
+        uint8_t reserved[40];
+    };
+
+    enum RecordType : uint16_t {
+        NONE = 0,  // end of the records of a crashed run (preallocated zeros)
+        PARAMS,
+        FRAME,
+        COMMAND,
+        FEEDBACK,
+        RECORD_TYPE_COUNT
+    };
+
+    struct RecordHeader {
+        uint16_t type;
+        uint16_t size;      // [bytes] including this header
+        uint32_t reserved;
+        int64_t time;       // LatencyClock [ns] when the record was made
+    };
+
+    // Parameters of AimingSolver, at the start of a run and whenever the aiming stage applies a change. Followed by
+    // the serialized ParamSet.
+    struct ParamsRecord {
+        uint8_t resetHistory;  // applied with AimingSolver::setParams(), otherwise updateParams()
+        uint8_t reserved[3];
+        uint32_t size;         // [bytes] of the serialized ParamSet
+    };
+
+    static constexpr size_t MAX_PARAMS_SIZE = 4096;  // of a serialized ParamSet
+
+    static constexpr size_t RECORD_ALIGNMENT = 8;  // of the size of every record, so that all records are aligned
+
+    struct ArmorRecord {
+        float imgPoints[8];  // x, y pixel of the 4 points, in the configured ROI
+        float imgCenter[2];
+        float offset[3];     // [mm]
+        float ypd[3];        // set by AimingSolver
+        float avgLightAngle;
+        uint8_t largeArmor;
+        uint8_t number;
+        uint16_t flags;      // AimingSolver::ArmorInfo::Flag, set by AimingSolver
+    };
+
+    enum FrameFlag : uint8_t {
+        HAS_ATTITUDE = 1,
+        HAS_COMMAND = 2,
+        DETECTED = 4,
+        TOP_KILLER_TRIGGERED = 8,
+        LATE = 16,  // searched around the target only (latency_budget)
+    };
+
+    // Input and results of AimingSolver for a frame, made when the aiming stage is done with it
+    struct FrameRecord {
+        uint32_t frameTime;      // TimePoint [0.1 ms]
+        int16_t offsetX;         // of the frame in the configured ROI (dynamic_sensor_roi) [pixel]
+        int16_t offsetY;
+        int64_t arrivalTime;     // LatencyClock [ns]
+        int64_t captureTime;     // LatencyClock [ns], exposure if known, otherwise arrival
+        float commandLatency;    // [ms] set to AimingSolver
+        float attitudeYaw;       // [deg] at the exposure, if HAS_ATTITUDE
+        float attitudePitch;
+        uint8_t flags;           // FrameFlag
+        uint8_t armorCount;
+        uint16_t reserved;
+        // Command of AimingSolver, if HAS_COMMAND
+        float yawDelta;
+        float pitchDelta;
+        float distance;
+        float avgLightAngle;
+        float imageX;
+        float imageY;
+        int32_t remainingTimeToTarget;
+        int32_t period;
+        ArmorRecord armors[AimingSolver::MAX_ARMORS];  // only armorCount of them are logged
+    };
+
+    // A command written to the serial, as on the wire. Time of the record is the completion of the write.
+    struct CommandRecord {
+        uint32_t frameTime;      // TimePoint [0.1 ms], 16 bits on the wire
+        int16_t yawDelta;        // [deg] * 100, leftward for positive (Control convention)
+        int16_t pitchDelta;      // [deg] * 100
+        int16_t distance;        // [mm]
+        int16_t avgLightAngle;   // [deg] * 100
+        int16_t imageX;
+        int16_t imageY;
+        int16_t remainingTimeToTarget;
+        int16_t period;
+        uint16_t frameAge;       // [0.1 ms], 0xFFFF if unknown
+        uint8_t flag;            // of the command
+        uint8_t reserved;
+        int64_t frameArrivalTime;  // LatencyClock [ns], 0 if unknown
+    };
+
+    // A gimbal feedback received. Time of the record is its arrival.
+    struct FeedbackRecord {
+        uint32_t controlTime;  // on the clock of Control [0.1 ms]
+        int16_t yaw;           // [deg] * 100
+        int16_t pitch;         // [deg] * 100
+        int64_t sampleTime;    // LatencyClock [ns] the angles were sampled at, mapped from controlTime
+    };
+
+    ~TelemetryLog() { close(); }
+
+    /**
+     * Create a log file named by the current time and start the writer thread.
+     * @param directory  Created if missing.
+     * @return           Path of the file, empty if it fails.
+     */
+    std::string open(const std::string &directory);
+
+    /**
+     * Write the queued records, truncate the file and stop the writer thread. Logs the statistics.
+     */
+    void close();
+
+    bool isOpened() const { return running.load(std::memory_order_relaxed); }
+
+    /**
+     * Called by the aiming stage only, like logFrame(). No-op if not opened.
+     */
+    void logParams(const package::ParamSet &p, bool resetHistory);
+
+    /**
+     * Called by the aiming stage only. No-op if not opened.
+     * @param record  With armorCount armors.
+     */
+    void logFrame(const FrameRecord &record);
+
+    /**
+     * Called by the serial IO thread only, like logFeedback(). No-op if not opened.
+     */
+    void logCommand(const CommandRecord &record);
+
+    void logFeedback(const FeedbackRecord &record);
+
+    static ArmorRecord toRecord(const AimingSolver::ArmorInfo &armor);
+
+    /**
+     * @return The armor as handed to AimingSolver, without the results.
+     */
+    static AimingSolver::ArmorInfo fromRecord(const ArmorRecord &record);
+
+    static int64_t toNanoseconds(LatencyClock::time_point time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+private:
+
+    struct ParamsPayload {
+        ParamsRecord record;
+        uint8_t serialized[MAX_PARAMS_SIZE];
+    };
+
+    struct FrameSlot {
+        RecordHeader header;
+        union {
+            FrameRecord frame;
+            ParamsPayload params;
+        };
+    };
+
+    struct EventSlot {
+        RecordHeader header;
+        union {
+            CommandRecord command;
+            FeedbackRecord feedback;
+        };
+    };
+
+    // The writer drains them every WRITER_PERIOD, in which a few frames come at most
+    static constexpr size_t FRAME_QUEUE_CAPACITY = 64;
+    static constexpr size_t EVENT_QUEUE_CAPACITY = 256;
+    SPSCQueue<FrameSlot> frameQueue{FRAME_QUEUE_CAPACITY};
+    SPSCQueue<EventSlot> eventQueue{EVENT_QUEUE_CAPACITY};
+
+    static constexpr auto WRITER_PERIOD = std::chrono::milliseconds(5);
+    static constexpr auto SYNC_PERIOD = std::chrono::seconds(1);  // to the disk, in case the robot loses power
+
+    // The file is mapped and preallocated one chunk at a time, so that locked memory (lock_memory) stays small and a
+    // full disk fails the preallocation instead of a write to the mapping
+    static constexpr size_t CHUNK_SIZE = 8 << 20;
+    static constexpr size_t MAX_FILE_SIZE = size_t(2) << 30;
+
+    std::atomic<bool> running{false};
+    std::thread *th = nullptr;
+    std::string path;
+
+    // Writer thread only
+    int fd = -1;
+    uint8_t *chunk = nullptr;  // mapping of the file at chunkOffset
+    size_t chunkOffset = 0;
+    size_t chunkUsed = 0;
+    bool writeFailed = false;
+
+    std::atomic<unsigned> dropped{0};
+    unsigned written = 0;
+
+    void writeRecords();
+
+    /**
+     * Append to the file, mapping the next chunk when the current one is full.
+     */
+    bool append(const void *data, size_t size);
+
+    bool mapChunk(size_t offset);
+};
+
+static_assert(sizeof(TelemetryLog::FileHeader) == 64);
+static_assert(sizeof(TelemetryLog::RecordHeader) == 16);
+static_assert(sizeof(TelemetryLog::ArmorRecord) == 72);
+static_assert(offsetof(TelemetryLog::FrameRecord, armors) == 72);
+static_assert(sizeof(TelemetryLog::CommandRecord) == 32);
+static_assert(sizeof(TelemetryLog::FeedbackRecord) == 16);
+static_assert(sizeof(TelemetryLog::ParamsRecord) % TelemetryLog::RECORD_ALIGNMENT == 0);
+
+/**
+ * Process-wide telemetry log, shared by the executor and the serial.
+ */
+TelemetryLog &telemetryLog();
+
+/**
+ * Read a log of TelemetryLog, mapped into memory.
+ */
+class TelemetryReader {
+public:
+
+    ~TelemetryReader() { close(); }
+
+    /**
+     * @return Whether the operation succeeded. See errorMessage() otherwise.
+     */
+    bool open(const std::string &path);
+
+    void close();
+
+    const TelemetryLog::FileHeader &fileHeader() const {
+        return *reinterpret_cast<const TelemetryLog::FileHeader *>(data);
+    }
+
+    /**
+     * Next record, in the order written (records of different producers may be slightly out of time order).
+     * @param header   [Out]
+     * @param payload  [Out] Struct of the type, header->size - sizeof(RecordHeader) bytes.
+     * @return         False at the end of the records (including a truncated one).
+     */
+    bool next(const TelemetryLog::RecordHeader *&header, const uint8_t *&payload);
+
+    /**
+     * Parse the ParamSet of a PARAMS record.
+     */
+    static bool parseParams(const uint8_t *payload, size_t size, package::ParamSet &params, bool &resetHistory);
+
+    const std::string &errorMessage() const { return error; }
+
+private:
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    std::string error;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TELEMETRYLOG_H
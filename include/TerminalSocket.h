@@ -6,6 +6,9 @@
 #define META_VISION_SOLAIS_TERMINALSOCKET_H
 
 #include <thread>
+#include <map>
+#include <mutex>
+#include <string>
 #include <boost/asio.hpp>
 #include <utility>
 #include <google/protobuf/message.h>
@@ -109,6 +112,52 @@ public:
      */
     bool sendBytes(const std::string &name, const google::protobuf::Message &message);
 
+    /**
+     * Async send bytes of a stream where only the latest package matters, e.g. results. If a package sent this way
+     * with the same name is still being written, this one waits for it instead of being queued, and replaces an
+     * earlier waiting one (which is dropped). So at most one package per name is in flight and one waiting.
+     * @param name  Name of the package.
+     * @param data  The start of the data. Doesn't need to be alive after this call (copied for async operation).
+     * @param size  The number of bytes to send.
+     * @return      Whether the operation succeeded (including being coalesced).
+     */
+    bool sendLatestBytes(const std::string &name, const uint8_t *data, size_t size);
+
+    /**
+     * A complete package (header and content) ready to be written to the socket.
+     */
+    using Package = std::shared_ptr<std::vector<uint8_t>>;
+
+    /**
+     * Build a bytes package of a protobuf message, serialized straight into a pooled buffer after the header space.
+     * Thread-safe, so that large messages can be serialized on the thread that builds them. The buffer returns to the
+     * pool once the package is written (or dropped).
+     * @param name     Name of the package.
+     * @param message  A protobuf message. Doesn't need to be alive after this call.
+     * @return         The package, to be sent with sendPackage() or sendLatestPackage().
+     */
+    Package packMessage(const std::string &name, const google::protobuf::Message &message);
+
+    /**
+     * Async send a package built by packMessage().
+     * @param package  The package.
+     * @return         Whether the operation succeeded.
+     */
+    bool sendPackage(Package package);
+
+    /**
+     * Async send a package built by packMessage(), coalesced as sendLatestBytes().
+     * @param name     Name of the package, which must match the one given to packMessage().
+     * @param package  The package.
+     * @return         Whether the operation succeeded (including being coalesced).
+     */
+    bool sendLatestPackage(const std::string &name, Package package);
+
+    /**
+     * @return Number of bytes queued on the socket but not yet written, as the backpressure of the connection.
+     */
+    size_t getBytesInFlight() const { return bytesInFlight; }
+
     /**
      * Async send a list of strings
      * @param name  Name of the package.
@@ -201,9 +250,43 @@ private:
 
     // ================================ Sending ================================
 
+    std::atomic<size_t> bytesInFlight = 0;
+
+    void startSend(std::shared_ptr<std::vector<uint8_t>> buf);
+
     void handleSend(std::shared_ptr<std::vector<uint8_t>> buf, const boost::system::error_code &error, size_t numBytes);
 
-    static std::shared_ptr<std::vector<uint8_t>> allocateBuffer(PackageType type, const std::string &name, size_t contentSize);
+    struct LatestPackageSlot {
+        bool writing = false;                         // a package of the name is being written
+        std::shared_ptr<std::vector<uint8_t>> waiting;  // the latest package to be written after it
+    };
+    std::map<std::string, LatestPackageSlot, std::less<>> latestPackageSlots;
+    unsigned socketGeneration = 0;  // to ignore completions of writes on a previous socket
+
+    void startLatestSend(const std::string &name, std::shared_ptr<std::vector<uint8_t>> buf);
+
+    /**
+     * Buffers of packages are recycled rather than freed, so that sending a result of hundreds of KB each frame doesn't
+     * allocate. A buffer acquired holds a weak reference to the pool and goes back to it as the last shared_ptr is
+     * released, usually after handleSend(). Thread-safe.
+     */
+    class BufferPool : public std::enable_shared_from_this<BufferPool> {
+    public:
+        std::shared_ptr<std::vector<uint8_t>> acquire(size_t capacity);
+
+    private:
+        static constexpr size_t MAX_POOLED_BUFFERS = 8;
+        static constexpr size_t MAX_POOLED_CAPACITY = 4 * 1024 * 1024;  // do not keep the occasional huge buffer
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<std::vector<uint8_t>>> buffers;
+
+        void recycle(std::vector<uint8_t> *buf);
+    };
+
+    std::shared_ptr<BufferPool> bufferPool = std::make_shared<BufferPool>();
+
+    std::shared_ptr<std::vector<uint8_t>> allocateBuffer(PackageType type, const std::string &name, size_t contentSize);
 
     static void emplaceInt32(std::vector<uint8_t> &buf, int32_t n);
 
@@ -0,0 +1,54 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_THREADSCHEDULING_H
+#define META_VISION_SOLAIS_THREADSCHEDULING_H
+
+#include <cstddef>
+#include "Parameters.h"
+
+namespace meta {
+
+/**
+ * Roles of the threads of Solais, each with its CPUs and priority in the parameter set (GROUP Scheduling).
+ */
+enum class ThreadRole {
+    CAPTURE,    // camera (or image set and video replay) thread, capture_thread_scheduling
+    DETECTION,  // Executor thread and the stage threads of pipelined execution, detection_thread_scheduling
+    SERIAL,     // main thread running the serial IO context, serial_thread_scheduling
+    IO          // TCP IO and result encoder threads, io_thread_scheduling
+};
+
+/**
+ * Pin the calling thread to the CPUs of its role and set its policy, SCHED_FIFO of the given priority or the default
+ * time sharing if the priority is 0. Threads it creates afterwards inherit both, so this is to be called before them.
+ * Each role is applied when its thread starts: the capture and detection threads at each start of a source or of
+ * the detection, the others at launch.
+ * @param role
+ * @param params  The CPU mask (bit i for CPU i, 0 for all CPUs) and the SCHED_FIFO priority (1-99, 0 for the default
+ *                policy) of the role.
+ * @return Whether both are applied. Failures are logged (SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO), and the
+ *         thread keeps the affinity or the policy it had.
+ */
+bool applyThreadScheduling(ThreadRole role, const ParamSet &params);
+
+/**
+ * Lock the pages mapped so far (code, libraries and stacks) in memory if lock_memory is set, and enable lockBuffer().
+ * Pages mapped later are not locked, as locking everything would also pin the host copies of the engine and whatever
+ * the libraries allocate. To be called at launch, before the hot buffers are allocated.
+ * @return Whether memory is locked (false if lock_memory is not set).
+ */
+bool lockProcessMemory(const ParamSet &params);
+
+/**
+ * Lock a buffer in memory if lockProcessMemory() has locked the process, for the buffers that the real-time threads
+ * touch every frame (frame pools, intermediate images, shared result ring, telemetry chunks), so that they never wait
+ * for a page fault. Pages stay locked until unmapped, i.e. until the buffer is freed for large allocations.
+ * @return Whether the buffer is locked. Failures are logged once (RLIMIT_MEMLOCK).
+ */
+bool lockBuffer(const void *data, size_t size);
+
+}
+
+#endif //META_VISION_SOLAIS_THREADSCHEDULING_H
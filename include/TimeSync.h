@@ -0,0 +1,103 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_TIMESYNC_H
+#define META_VISION_SOLAIS_TIMESYNC_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "Utilities.h"
+#include "LatencyStats.h"
+#include "AttitudeRing.h"
+
+namespace meta {
+
+/**
+ * Map timestamps of a device clock (camera or Control board, TimePoint in 0.1 ms, wrapping around) to LatencyClock,
+ * so that frames and gimbal feedback are on one clock. Each timestamp is received some non-negative delay after it is
+ * taken, so the offset between the clocks is the minimal (host time - device time) over a recent window, which also
+ * follows the drift between the clocks. The mapped time is late by the minimal transfer delay, which is constant.
+ * Used by one thread only.
+ */
+class ClockMapper {
+public:
+
+    void reset();
+
+    /**
+     * Add a timestamp with the host time it was received, and map it.
+     * @param deviceTime    Timestamp of the device.
+     * @param receivedTime  Host time when the timestamp is received, with the transfer time subtracted if known.
+     * @return              deviceTime on LatencyClock.
+     */
+    LatencyClock::time_point map(TimePoint deviceTime, LatencyClock::time_point receivedTime);
+
+    /**
+     * @return A device timestamp near the last one added, on LatencyClock. Undefined before the first map().
+     */
+    LatencyClock::time_point toHost(TimePoint deviceTime) const;
+
+    bool synced() const { return sampleCount > 0; }
+
+private:
+
+    static constexpr size_t WINDOW = 64;   // samples
+    std::array<int64_t, WINDOW> offsets;   // host time - device time [ns]
+    size_t sampleCount = 0;
+    int64_t offset = 0;                    // minimum of offsets
+
+    TimePoint lastDeviceTime = 0;
+    int64_t lastUnwrapped = 0;             // lastDeviceTime without wrapping around [0.1 ms]
+
+    // An offset this much larger than the current one is a restart of the device clock, not a delay
+    static constexpr int64_t RESYNC_THRESHOLD = 1000000000;  // [ns]
+
+    int64_t unwrap(TimePoint deviceTime) const {
+        return lastUnwrapped + (int32_t) (deviceTime - lastDeviceTime);
+    }
+};
+
+/**
+ * Attitude of the gimbal [deg], in the same directions as the yaw and pitch of AimingSolver.
+ */
+struct GimbalAttitude {
+    float yaw = 0;    // +: rightward
+    float pitch = 0;  // +: downward
+};
+
+/**
+ * Recent gimbal attitudes keyed on LatencyClock, appended by one writer thread (the serial IO thread) and read by any
+ * thread without locking, see rm::AttitudeRing.
+ */
+class AttitudeHistory {
+public:
+
+    /**
+     * Append an attitude. Writer only. A time earlier than the last one drops the history.
+     */
+    void push(LatencyClock::time_point time, const GimbalAttitude &attitude);
+
+    /**
+     * Attitude at a time, interpolated between the two samples around it.
+     * @param time      Usually the exposure time of a frame.
+     * @param attitude  [Out]
+     * @return          False if the time is out of the history (or later than the last sample by more than
+     *                  MAX_HOLD_TIME, when the last sample is held), or if the history kept changing while read.
+     */
+    bool interpolate(LatencyClock::time_point time, GimbalAttitude &attitude) const;
+
+    static constexpr std::chrono::milliseconds MAX_HOLD_TIME{20};
+
+private:
+
+    static constexpr size_t CAPACITY = 256;  // about 0.25 s at 1 kHz feedback
+
+    rm::AttitudeRing<CAPACITY> ring;  // keyed on LatencyClock [ns]
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TIMESYNC_H
@@ -0,0 +1,70 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_TRIPLEBUFFER_H
+#define META_VISION_SOLAIS_TRIPLEBUFFER_H
+
+#include <atomic>
+
+namespace meta {
+
+/**
+ * Lock-free triple buffer to hand the latest complete value from one producer thread to one consumer thread.
+ *
+ * The producer fills back() and calls publish(), which swaps it with the middle slot by a single atomic exchange. The
+ * consumer calls update() to swap the middle slot into front() if a newer value has been published since. Neither side
+ * ever blocks or waits for the other, the producer never loses its latest value, and the consumer always reads the
+ * freshest complete one. Slots are reused, so elements keep their capacity (vectors, etc.) across publications.
+ */
+template<class T>
+class TripleBuffer {
+public:
+
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer &) = delete;
+
+    TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+    /**
+     * Slot to be filled. Producer only. It holds an old value, which is not visible to the consumer.
+     */
+    T &back() { return slots[backIndex]; }
+
+    /**
+     * Publish back() and get another slot as back(). Producer only.
+     */
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /**
+     * Take the latest published value as front(), if there is a new one. Consumer only.
+     * @return  Whether front() has changed.
+     */
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    /**
+     * Latest value taken by update(). Consumer only.
+     */
+    const T &front() const { return slots[frontIndex]; }
+
+private:
+
+    static constexpr unsigned INDEX_MASK = 3;
+    static constexpr unsigned FRESH = 4;  // set in middle when it has not been taken by the consumer
+
+    T slots[3];
+    unsigned backIndex = 0;              // only accessed by the producer
+    unsigned frontIndex = 1;             // only accessed by the consumer
+    std::atomic<unsigned> middle{2};     // index of the middle slot, with FRESH
+};
+
+}
+
+#endif //META_VISION_SOLAIS_TRIPLEBUFFER_H
@@ -20,10 +20,14 @@
 
 
 #include <cassert>
+#include <cstring>
 #include <cuda.h>
 #include <cuda_runtime.h>
+#include <cstdint>
 #include <iostream>
 #include <thread>
+#include <vector>
+#include "GpuMemoryPool.h"
 #include "TrtLogger.h"
 
 namespace meta
@@ -86,6 +90,252 @@ namespace meta
         throw std::runtime_error("Invalid DataType.");
     }
 
+    inline bool isIntegratedGpu()
+    {
+        int device, integrated;
+        cudaCheck(cudaGetDevice(&device));
+        cudaCheck(cudaDeviceGetAttribute(&integrated, cudaDevAttrIntegrated, device));
+        return integrated != 0;
+    }
+
+    //!
+    //! \brief  Buffer shared by the CPU and the GPU, the zero-copy plumbing of the detector backends.
+    //!
+    //! \details On integrated GPUs (Jetson) it is mapped page-locked memory that both sides access in place, and
+    //!          toDevice()/toHost() do nothing. On discrete GPUs it is device memory mirrored by a page-locked host
+    //!          buffer (if hostMirror), and they queue the copies. Only grows.
+    //!
+    class MappedBuffer
+    {
+    public:
+        explicit MappedBuffer(bool hostMirror = true) : mapped(isIntegratedGpu()), hostMirror(hostMirror) {}
+
+        ~MappedBuffer() { release(); }
+
+        MappedBuffer(const MappedBuffer&) = delete;
+
+        MappedBuffer& operator=(const MappedBuffer&) = delete;
+
+        MappedBuffer(MappedBuffer&& other) noexcept
+            : mapped(other.mapped), hostMirror(other.hostMirror), host(other.host), device(other.device),
+              capacity(other.capacity)
+        {
+            other.host = nullptr;
+            other.device = nullptr;
+            other.capacity = 0;
+        }
+
+        void reserve(size_t bytes)
+        {
+            if (bytes <= capacity) return;
+            release();
+            if (mapped)
+            {
+                cudaCheck(cudaHostAlloc(&host, bytes, cudaHostAllocMapped));
+                cudaCheck(cudaHostGetDevicePointer(&device, host, 0));
+            }
+            else
+            {
+                if (hostMirror) cudaCheck(cudaMallocHost(&host, bytes));
+                device = GpuMemoryPool::instance().allocate(bytes);
+                if (device == nullptr) cudaCheck(cudaErrorMemoryAllocation);
+            }
+            capacity = bytes;
+        }
+
+        bool isMapped() const { return mapped; }
+
+        size_t size() const { return capacity; }
+
+        void* hostData() const { return host; }  // nullptr on discrete GPUs without hostMirror
+
+        void* deviceData() const { return device; }
+
+        void toDevice(size_t bytes, cudaStream_t stream) const
+        {
+            if (!mapped) cudaCheck(cudaMemcpyAsync(device, host, bytes, cudaMemcpyHostToDevice, stream));
+        }
+
+        void toHost(size_t bytes, cudaStream_t stream) const
+        {
+            if (!mapped) cudaCheck(cudaMemcpyAsync(host, device, bytes, cudaMemcpyDeviceToHost, stream));
+        }
+
+        //!
+        //! \brief  Device pointer to host memory the GPU reads, e.g. a frame: src itself if it is already mapped
+        //!         page-locked memory, otherwise a copy in this buffer. src can be reused after return.
+        //!
+        const void* stage(const void* src, size_t bytes, cudaStream_t stream)
+        {
+            if (mapped)
+            {
+                cudaPointerAttributes attr{};
+                if (cudaPointerGetAttributes(&attr, src) == cudaSuccess && attr.type == cudaMemoryTypeHost
+                    && attr.devicePointer != nullptr)
+                {
+                    return attr.devicePointer;
+                }
+                cudaGetLastError();  // older CUDA reports an error for pageable memory, clear it
+            }
+            reserve(bytes);
+            if (mapped)
+            {
+                memcpy(host, src, bytes);
+            }
+            else
+            {
+                // Returns after pageable memory is staged by the driver
+                cudaCheck(cudaMemcpyAsync(device, src, bytes, cudaMemcpyHostToDevice, stream));
+            }
+            return device;
+        }
+
+    private:
+        void release()
+        {
+            cudaFreeHost(host);
+            if (!mapped) GpuMemoryPool::instance().free(device);  // otherwise the mapping of host
+            host = nullptr;
+            device = nullptr;
+            capacity = 0;
+        }
+
+        bool mapped;
+        bool hostMirror;
+        void* host = nullptr;
+        void* device = nullptr;
+        size_t capacity = 0;
+    };
+
+    //!
+    //! \brief  Work of a stream captured into CUDA graphs and replayed, so that its many small launches (e.g. the
+    //!         kernels of a TensorRT enqueue) cost a single launch.
+    //!
+    //! \details A graph bakes in the arguments of its launches, so each graph is captured for a key of every argument
+    //!          that changes. Arguments that change every frame (source pointers, regions) are better read by the
+    //!          kernels from a buffer written before the launch, so that the key is only the shape of the work and
+    //!          the few shapes there are stay cached. On a miss the least recently used graph is re-captured and
+    //!          updated in place if its topology is the same, which is cheaper than instantiating it again, but
+    //!          still slower than launching directly.
+    //!
+    //!          The first launch runs the work directly, as TensorRT needs an enqueue before one is captured. If
+    //!          capturing fails, the work is run directly from then on.
+    //!
+    class CudaGraphCache
+    {
+    public:
+        using Key = std::vector<uint64_t>;
+
+        explicit CudaGraphCache(size_t capacity = 4) : entries(capacity) {}
+
+        ~CudaGraphCache()
+        {
+            for (auto& entry : entries)
+            {
+                if (entry.exec != nullptr) cudaGraphExecDestroy(entry.exec);
+            }
+        }
+
+        CudaGraphCache(const CudaGraphCache&) = delete;
+
+        CudaGraphCache& operator=(const CudaGraphCache&) = delete;
+
+        //!
+        //! \brief  Run enqueue(), which enqueues the work on stream, through the graph captured for key.
+        //!
+        template <typename F>
+        void launch(const Key& key, cudaStream_t stream, F&& enqueue)
+        {
+            if (disabled || !warmedUp)
+            {
+                warmedUp = true;
+                enqueue();
+                return;
+            }
+
+            Entry* entry = &entries[0];
+            for (auto& e : entries)
+            {
+                if (e.exec != nullptr && e.key == key)
+                {
+                    entry = &e;
+                    break;
+                }
+                if (e.lastUse < entry->lastUse) entry = &e;
+            }
+            entry->lastUse = ++uses;
+
+            if (entry->exec == nullptr || entry->key != key)
+            {
+                if (!capture(*entry, stream, enqueue)) return;  // run directly
+                entry->key = key;
+                captures++;
+            }
+            cudaCheck(cudaGraphLaunch(entry->exec, stream));
+        }
+
+        size_t captureCount() const { return captures; }
+
+    private:
+        struct Entry
+        {
+            Key key;
+            cudaGraphExec_t exec = nullptr;
+            uint64_t lastUse = 0;
+        };
+
+        template <typename F>
+        bool capture(Entry& entry, cudaStream_t stream, F&& enqueue)
+        {
+            cudaGraph_t graph = nullptr;
+            cudaCheck(cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+            enqueue();
+            if (cudaStreamEndCapture(stream, &graph) != cudaSuccess || graph == nullptr)
+            {
+                std::cerr << "CUDA graph capture failed, launching directly" << std::endl;
+                cudaGetLastError();
+                disabled = true;
+                enqueue();  // nothing ran while capturing
+                return false;
+            }
+
+            bool updated = false;
+            if (entry.exec != nullptr)
+            {
+#if CUDART_VERSION >= 12000
+                cudaGraphExecUpdateResultInfo info{};
+                updated = (cudaGraphExecUpdate(entry.exec, graph, &info) == cudaSuccess);
+#else
+                cudaGraphNode_t errorNode;
+                cudaGraphExecUpdateResult result;
+                updated = (cudaGraphExecUpdate(entry.exec, graph, &errorNode, &result) == cudaSuccess);
+#endif
+                if (!updated)
+                {
+                    cudaGetLastError();
+                    cudaGraphExecDestroy(entry.exec);
+                    entry.exec = nullptr;
+                }
+            }
+            if (!updated)
+            {
+#if CUDART_VERSION >= 12000
+                cudaCheck(cudaGraphInstantiate(&entry.exec, graph, 0));
+#else
+                cudaCheck(cudaGraphInstantiate(&entry.exec, graph, nullptr, nullptr, 0));
+#endif
+            }
+            cudaGraphDestroy(graph);
+            return true;
+        }
+
+        std::vector<Entry> entries;
+        uint64_t uses = 0;
+        size_t captures = 0;
+        bool warmedUp = false;
+        bool disabled = false;
+    };
+
 } // namespace meta
 
 #endif //META_VISION_SOLAIS_TRTCUDAUTILS_H
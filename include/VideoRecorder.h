@@ -0,0 +1,82 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_VIDEORECORDER_H
+#define META_VISION_SOLAIS_VIDEORECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <opencv2/videoio.hpp>
+#include "FramePool.h"
+#include "SPSCQueue.h"
+
+namespace meta {
+
+/**
+ * Video recording on a writer thread of its own, so that encoding never runs in the capture thread (or the camera SDK
+ * callback). The capture thread pushes frame handles into a bounded queue, without copying. A frame that finds the
+ * queue full is dropped and counted, instead of delaying the capture.
+ */
+class VideoRecorder {
+public:
+
+    // Frames waiting for the writer hold slots of the frame pool of the source, keep the queue shorter than the pool
+    static constexpr size_t QUEUE_CAPACITY = 3;
+
+    ~VideoRecorder() { close(); }
+
+    /**
+     * Open the video and start the writer thread. On Jetson (GStreamer available), the hardware H.264 encoder
+     * nvv4l2h264enc is used, falling back to omxh264enc and then to what OpenCV provides.
+     * @param path  Path of the .mkv file.
+     * @param fps
+     * @param size  Frame size.
+     * @return      Success or not.
+     */
+    bool open(const std::string &path, int fps, cv::Size size);
+
+    /**
+     * Write the frames still queued, close the video and stop the writer thread. Logs the statistics.
+     */
+    void close();
+
+    bool isOpened() const { return running; }
+
+    /**
+     * Queue a frame to be written. Called by the capture thread only.
+     * @return False if the frame is dropped (the queue is full) or not recording.
+     */
+    bool push(const FrameHandle &frame);
+
+    unsigned writtenFrames() const { return written; }
+
+    unsigned droppedFrames() const { return dropped; }
+
+    const std::string &backendName() const { return backend; }
+
+private:
+
+    SPSCQueue<FrameHandle> queue{QUEUE_CAPACITY};
+
+    cv::VideoWriter writer;
+    cv::Mat bgr;  // demosaiced raw frame, writer thread only
+    std::string backend;
+
+    std::mutex mutex;  // held briefly by push() and the thread, so that a push never misses a wakeup
+    std::condition_variable condition;
+    std::atomic<bool> running{false};
+    std::thread *th = nullptr;
+
+    std::atomic<unsigned> written{0};
+    std::atomic<unsigned> dropped{0};
+
+    void writeFrames();
+};
+
+}
+
+#endif //META_VISION_SOLAIS_VIDEORECORDER_H
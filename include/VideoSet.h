@@ -6,6 +6,10 @@
 #define META_VISION_SOLAIS_VIDEOSET_H
 
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include "Parameters.h"
 #include "InputSource.h"
@@ -15,6 +19,12 @@ namespace meta {
 
 namespace fs = std::filesystem;
 
+/**
+ * Replays a video. A decoder thread decodes ahead into a queue (video_decode_queue_depth) and resizes to the ROI, and
+ * the thread of the source publishes the frames, either at the pace of their original timestamps (REAL_TIME, frames
+ * are dropped if the consumers fall behind like a camera) or one per fetchNextFrame() without any drop (MAX_SPEED, to
+ * benchmark detection rather than decoding).
+ */
 class VideoSet : public InputSource {
 public:
 
@@ -32,9 +42,16 @@ public:
 
     void close() override;
 
-    TimePoint getFrameCaptureTime() const override { return bufferCaptureTime[lastBuffer]; }
+    void fetchNextFrame() override;
 
-    const cv::Mat &getFrame() const override { return buffer[lastBuffer]; }
+    /**
+     * Open a video with the fastest decoder available: NVDEC (GStreamer nvv4l2decoder) on Jetson, which also scales
+     * to the given size, otherwise FFmpeg with its hardware acceleration if any and a decoding thread per core.
+     * @param file
+     * @param size  Size of the frames wanted, only a hint: frames may still be of the original size.
+     * @return
+     */
+    static cv::VideoCapture openCapture(const fs::path &file, const cv::Size &size);
 
     const fs::path videoSetRoot;
 
@@ -42,16 +59,24 @@ protected:
 
     std::vector<std::string> videos;
 
-    // Double buffering
-    uint8_t lastBuffer = 0;
-    cv::Mat buffer[2];
-    TimePoint bufferCaptureTime[2] = {0, 0};
-
     std::thread *th = nullptr;
-    bool threadShouldExit = false;
-    bool threadRunning = false;
+    std::atomic<bool> threadShouldExit{false};  // set with queueMutex held
+    std::atomic<bool> threadRunning{false};
+
+    struct DecodedFrame {
+        cv::Mat image;  // empty for the end of the video
+        double timeMS = 0;
+    };
+
+    // Frames decoded ahead, and requests of the next frame in MAX_SPEED
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<DecodedFrame> decodedFrames;  // guarded by queueMutex
+    bool shouldFetchNextFrame = false;       // guarded by queueMutex
 
     void loadFrameFromVideo(const std::string &videoName, const ParamSet &params);
+
+    void decodeVideo(cv::VideoCapture &video, size_t queueDepth, cv::Size size);
 };
 
 }
@@ -0,0 +1,57 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_YOLOV5_CALIBRATOR_H
+#define META_VISION_SOLAIS_YOLOV5_CALIBRATOR_H
+
+#include <NvInfer.h>
+#include <string>
+#include <vector>
+
+namespace meta {
+
+    /**
+     * INT8 entropy calibrator for the armor YOLOv5 model, after Int8EntropyCalibrator2 in TensorRTX. Calibration images
+     * go through yolo_preprocess(), the same path as inference, since the model takes HWC RGB in [0, 255] instead of the
+     * letterboxed planar input of TensorRTX.
+     */
+    class YOLOCalibrator : public nvinfer1::IInt8EntropyCalibrator2 {
+    public:
+
+        /**
+         * @param image_dir    Directory of calibration images (*.jpg), e.g. an image set under DATA_SET_ROOT/images.
+         * @param table_file   Calibration table. Read if it exists (skipping calibration) and written after calibration.
+         * @param input_w      Network input width.
+         * @param input_h      Network input height.
+         */
+        YOLOCalibrator(const std::string &image_dir, std::string table_file, int input_w, int input_h);
+
+        ~YOLOCalibrator() override;
+
+        YOLOCalibrator(const YOLOCalibrator &) = delete;
+
+        YOLOCalibrator operator=(const YOLOCalibrator &) = delete;
+
+        int getBatchSize() const noexcept override { return 1; }
+
+        bool getBatch(void *bindings[], const char *names[], int nbBindings) noexcept override;
+
+        const void *readCalibrationCache(size_t &length) noexcept override;
+
+        void writeCalibrationCache(const void *cache, size_t length) noexcept override;
+
+    private:
+        std::vector<std::string> image_files;
+        size_t image_idx = 0;
+        std::string table_file;
+        int input_w, input_h;
+        void *device_input = nullptr;
+        void *device_image = nullptr;
+        size_t device_image_sz = 0;
+        std::vector<char> table;
+    };
+
+} // meta
+
+#endif //META_VISION_SOLAIS_YOLOV5_CALIBRATOR_H
@@ -0,0 +1,54 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_YOLOV5_POSTPROCESS_H
+#define META_VISION_SOLAIS_YOLOV5_POSTPROCESS_H
+
+#include <cstdint>
+#include <cuda_runtime_api.h>
+
+namespace meta {
+
+    // Same layout as YOLODet::bbox_t, without depending on OpenCV in device code
+    struct alignas(4) yolo_box_t {
+        float pts[8];
+        float confidence;
+        int color_id;
+        int tag_id;
+    };
+
+    static constexpr int YOLO_MAX_DETECTIONS = 16;  // boxes kept after NMS, highest confidence first
+
+    // Compact result copied back to host
+    struct yolo_detections_t {
+        int count;
+        yolo_box_t boxes[YOLO_MAX_DETECTIONS];
+    };
+
+    // From network input to source image: x * fx + ox, y * fy + oy
+    struct yolo_transform_t {
+        float fx, fy;  // scales
+        float ox, oy;  // offset of the region fed to the network
+    };
+
+    /**
+     * YOLOv5 post-processing on GPU: threshold, greedy NMS (axis-aligned overlap of the four corners, same as the CPU
+     * version) and decode of the TopK output, with at most YOLO_MAX_DETECTIONS boxes written into dst.
+     * Runs as a single block, so the time does not depend on the number of candidates.
+     * The kernel is enqueued on the stream and not synchronized.
+     * @param output      Device pointer of the TopK output, sorted by confidence in descending order.
+     * @param num         Number of candidates (TopK), at most 1024.
+     * @param stride      Number of floats per candidate.
+     * @param keep_logit  Confidence threshold before sigmoid.
+     * @param transform   Device-accessible transform of the boxes, read when the kernel runs (see
+     *                    yolo_preprocess_indirect()).
+     * @param dst         Device-accessible result.
+     * @param stream      CUDA stream.
+     */
+    void yolo_postprocess(const float *output, int num, int stride, float keep_logit,
+                          const yolo_transform_t *transform, yolo_detections_t *dst, cudaStream_t stream);
+
+} // meta
+
+#endif //META_VISION_SOLAIS_YOLOV5_POSTPROCESS_H
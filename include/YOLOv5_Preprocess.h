@@ -0,0 +1,65 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_YOLOV5_PREPROCESS_H
+#define META_VISION_SOLAIS_YOLOV5_PREPROCESS_H
+
+#include <cstdint>
+#include <cuda_runtime_api.h>
+
+namespace meta {
+
+    /**
+     * Fused YOLOv5 pre-processing on GPU: bilinear resize (same sampling as cv::resize with INTER_LINEAR), BGR to RGB
+     * and uint8 to float, written into the network input in one pass. Output layout is the same as the frame after
+     * cv::cvtColor + cv::resize + convertTo(CV_32F) (HWC, RGB, [0, 255]), which is what the model expects.
+     * The kernel is enqueued on the stream and not synchronized.
+     * @param src         Device-accessible BGR8 image (device memory or mapped host memory).
+     * @param src_step    Row step of the source in bytes.
+     * @param src_width   Source width.
+     * @param src_height  Source height.
+     * @param dst         Device pointer of the input binding.
+     * @param dst_width   Network input width.
+     * @param dst_height  Network input height.
+     * @param stream      CUDA stream.
+     */
+    void yolo_preprocess(const uint8_t *src, int src_step, int src_width, int src_height,
+                         float *dst, int dst_width, int dst_height, cudaStream_t stream);
+
+    /**
+     * Same as yolo_preprocess(), but from a raw Bayer frame: bilinear demosaicing and white balance are fused into the
+     * same pass, so that the camera ISP is not needed. Each source sample of the resize is demosaiced from its 3x3
+     * neighborhood (reflected at the borders, which keeps the color of each position).
+     * @param src         Device-accessible raw frame (CV_8UC1).
+     * @param red_x       Position of the red pixel in the top-left 2x2 block of src, in {0, 1}.
+     * @param red_y
+     * @param gain_r      White balance gains.
+     * @param gain_g
+     * @param gain_b
+     */
+    void yolo_preprocess_bayer(const uint8_t *src, int src_step, int src_width, int src_height, int red_x, int red_y,
+                               float gain_r, float gain_g, float gain_b,
+                               float *dst, int dst_width, int dst_height, cudaStream_t stream);
+
+    // Arguments of a frame, see yolo_preprocess() and yolo_preprocess_bayer()
+    struct yolo_preprocess_args_t {
+        const uint8_t *src;
+        int src_step, src_width, src_height;
+        int red_x, red_y;  // raw frames only
+        float gains[3];
+    };
+
+    /**
+     * Same as yolo_preprocess() or yolo_preprocess_bayer(), with the arguments of the frame read from device-accessible
+     * memory when the kernel runs. A CUDA graph captured with it takes a new frame by rewriting them, without
+     * capturing it again.
+     * @param args  Device-accessible arguments, unchanged until the kernel has run.
+     * @param raw   Raw Bayer frame, yolo_preprocess_bayer(), otherwise BGR8.
+     */
+    void yolo_preprocess_indirect(const yolo_preprocess_args_t *args, bool raw,
+                                  float *dst, int dst_width, int dst_height, cudaStream_t stream);
+
+} // meta
+
+#endif //META_VISION_SOLAIS_YOLOV5_PREPROCESS_H
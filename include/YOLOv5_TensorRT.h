@@ -5,33 +5,77 @@
 #ifndef META_VISION_SOLAIS_YOLOV5_TENSORRT_H
 #define META_VISION_SOLAIS_YOLOV5_TENSORRT_H
 
+#include <memory>
 #include <opencv2/core.hpp>
 #include <NvInfer.h>
+#include "YOLOv5_Preprocess.h"
+#include "YOLOv5_Postprocess.h"
+#include "Detector.h"
+#include "TrtCudaUtils.h"
 
 
 
 namespace meta {
-    class YOLODet {
+    struct engine_cache_header_t;
+
+    class YOLODet : public Detector {
 
         static constexpr int TOPK_NUM = 128;
         static constexpr float KEEP_THRES = 0.1f;
+        static const float KEEP_LOGIT;  // KEEP_THRES before sigmoid, compared with the raw output
+        static constexpr size_t MAX_WORKSPACE_SIZE = 1UL << 30;
 
     public:
-        struct alignas(4) bbox_t {
-            std::array<cv::Point2f, 4> pts; // [pt0, pt1, pt2, pt3]
-            float confidence;
-            int color_id; // 0: blue, 1: red, 2: gray
-            int tag_id;   // 0: guard, 1-5: number, 6: base
-
-            bool operator==(const bbox_t& other) const {
-                return (pts == other.pts) && (confidence == other.confidence) && (color_id == other.color_id) && (tag_id == other.tag_id);
-            }
-            bool operator!=(const bbox_t& other) const {
-                return (pts != other.pts) || (confidence != other.confidence) || (color_id != other.color_id) || (tag_id != other.tag_id);
-            }
-        };
-
-        explicit YOLODet(const std::string &onnx_file);
+        // Network input of model-opt-4, the default
+        static constexpr int INPUT_W = 640;
+        static constexpr int INPUT_H = 384;
+
+        /**
+         * Input sizes an ONNX model with a dynamic input size is built for (see input_sizes()), the default first,
+         * then sizes for regions around a tracked target. Multiples of 32, the largest stride. Models with a static
+         * input size only take INPUT_W x INPUT_H.
+         */
+        static const std::vector<cv::Size> PROFILE_SIZES;
+
+        /**
+         * Load the model, building and caching the engine if needed.
+         * @param onnx_file        ONNX model. The engine is cached next to it (see engine_file()).
+         * @param precision        Build precision.
+         * @param calib_image_dir  Calibration images for INT8. The calibration table is stored next to the engine and
+         *                         reused if it exists.
+         * @param gpu_postprocess  NMS and decoding on GPU (see yolo_postprocess), so that only the surviving boxes are
+         *                         copied back. Otherwise the whole TopK output is copied back and processed on CPU.
+         * @param cuda_graph       Replay the GPU work of a submission (pre-processing, network, post-processing and
+         *                         D2H copy) from a CUDA graph (see CudaGraphCache), so that its launches cost one.
+         *                         The stages are then timed as one: last_timing().inference_ms covers all of them,
+         *                         and preprocess_ms only the upload.
+         * @param dla_core         Run the network on a DLA core (see dla_core_count()), with the layers it doesn't
+         *                         support on GPU. DLA only runs FP16 or INT8 and static shapes, so a dynamic input is
+         *                         fixed to INPUT_W x INPUT_H. -1 for GPU.
+         * @param slots            Submissions in flight (see infer_slots()), up to MAX_INFER_SLOTS. Each takes the
+         *                         activation memory of a context for every input size, so more slots only pay off on
+         *                         GPUs a single submission doesn't keep busy.
+         */
+        explicit YOLODet(const std::string &onnx_file, precision_t precision = precision_t::FP16,
+                         const std::string &calib_image_dir = "", bool gpu_postprocess = true,
+                         bool cuda_graph = true, int dla_core = -1, int slots = INFER_SLOTS);
+
+        /**
+         * Whether the engine cache exists and matches the model, TensorRT version, GPU, precision and DLA core, so
+         * that the constructor only needs to deserialize it. Otherwise the constructor builds the engine, which takes
+         * minutes. False without the model file, which the constructor needs either way.
+         */
+        static bool is_cache_valid(const std::string &onnx_file, precision_t precision, int dla_core = -1);
+
+        /**
+         * Number of DLA cores of the device, 0 on GPUs without (everything but Xavier and Orin).
+         */
+        static int dla_core_count();
+
+        /**
+         * DLA core the network runs on, -1 for GPU.
+         */
+        int dla_core() const { return dla; }
 
         ~YOLODet();
 
@@ -39,23 +83,94 @@ namespace meta {
 
         YOLODet operator=(const YOLODet &) = delete;
 
-        std::vector<bbox_t> operator()(const cv::Mat &src) const;
+        /**
+         * Upload, pre-processing, enqueue and the D2H copy of the output are queued on the stream of a free slot.
+         * Raw Bayer frames are demosaiced in the pre-processing kernel, with the pattern of a region shifted by its
+         * offset.
+         */
+        ticket_t submit_batch(const std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rois = {},
+                              const std::vector<BayerFormat> &formats = {}) override;
 
+        std::vector<std::vector<bbox_t>> collect_batch(ticket_t ticket) override;
+
+        const char *name() const override { return "YOLOv5"; }
 
     private:
-        void build_engine_from_onnx(const std::string &onnx_file);
+        void build_engine_from_onnx(const std::string &onnx_file, precision_t precision,
+                                    const std::string &calib_image_dir, const std::string &calib_table_file);
+
+        bool build_engine_from_cache(const std::string &cache_file, const engine_cache_header_t &expected);
+
+        void cache_engine(const std::string &cache_file, engine_cache_header_t header);
+
+        /**
+         * Whether the input of an engine is what this code feeds: INPUT_W x INPUT_H for a static input, or the
+         * profiles of PROFILE_SIZES (MAX_INFER_SLOTS of each) for a dynamic one.
+         */
+        static bool has_expected_input(const nvinfer1::ICudaEngine &engine);
+
+        // Per frame of a batch
+        struct batch_item_t {
+            // Staging of the source frame, read by the pre-processing kernel. On integrated GPUs (Jetson) it is
+            // mapped pinned memory and is not copied again, otherwise it is device memory.
+            MappedBuffer staging{false};
+
+            // Arguments of the pre-processing kernel
+            const uint8_t *src = nullptr;  // device-accessible staged frame or region
+            int src_step = 0, src_width = 0, src_height = 0;
+            BayerFormat format;
+            int red_x = 0, red_y = 0;      // of the region
+
+            float fx = 1, fy = 1;  // scale from network input to source
+            float ox = 0, oy = 0;  // offset of the region in source
+        };
+
+        // Arguments of the kernels for a frame of a batch, read by them when they run, so that the graph of a slot
+        // is only captured again for another shape of submission (see submit_batch())
+        struct launch_args_t {
+            yolo_preprocess_args_t preprocess;
+            yolo_transform_t transform;
+        };
+
+        // Each slot has its own execution context, stream and buffers so that slots run independently
+        struct infer_slot_t {
+            std::vector<nvinfer1::IExecutionContext *> contexts;  // of each input size
+            size_t input_index = 0;  // of the input size of this submission
+            cudaStream_t stream = nullptr;
+            void *device_buffer[2] = {nullptr, nullptr};
+            // Read back on CPU: [batch] TopK output bound as the output (CPU post-processing), or the surviving boxes
+            // (GPU post-processing). Mapped on integrated GPUs, so that there is no D2H copy at all.
+            MappedBuffer output;
+            MappedBuffer detections;
+            std::vector<batch_item_t> items;
+            int count = 0;  // frames in this submission
+            cudaEvent_t events[4] = {};  // submitted, pre-processed, inferred, done
+            MappedBuffer launch_args;    // [batch] launch_args_t, written before each submission
+
+            CudaGraphCache graph;
+            CudaGraphCache::Key graph_key;  // reused across submissions
+
+            bool in_flight = false;
+            ticket_t ticket = 0;
+        };
+
+        const uint8_t *upload_input(batch_item_t &item, cudaStream_t stream, const cv::Mat &src);
+
+        void enqueue_preprocess(infer_slot_t &slot);
 
-        void build_engine_from_cache(const std::string &cache_file);
+        void enqueue_postprocess(infer_slot_t &slot);
 
-        void cache_engine(const std::string &cache_file);
+        std::vector<bbox_t> postprocess_on_cpu(const float *output_buffer, const batch_item_t &item);
 
         nvinfer1::ICudaEngine *engine;
-        nvinfer1::IExecutionContext *context;
-        mutable void *device_buffer[2];
-        float *output_buffer;
-        cudaStream_t stream;
+        std::unique_ptr<infer_slot_t[]> slots;  // slot_count of them
+        ticket_t next_ticket = 0;
         int input_idx, output_idx;
-        size_t input_sz, output_sz;
+        size_t output_sz;  // of a single frame
+        bool dynamic_input;
+        bool gpu_postprocess;
+        bool cuda_graph;
+        int dla;
     };
 
 } // meta
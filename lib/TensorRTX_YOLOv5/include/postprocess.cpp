@@ -1,5 +1,11 @@
 #include "postprocess.h"
 #include "utils.h"
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 cv::Rect get_rect(cv::Mat& img, float bbox[4]) {
   float l, r, t, b;
@@ -27,56 +33,151 @@ cv::Rect get_rect(cv::Mat& img, float bbox[4]) {
   return cv::Rect(round(l), round(t), round(r - l), round(b - t));
 }
 
-static float iou(float lbox[4], float rbox[4]) {
-  float interBox[] = {
-    (std::max)(lbox[0] - lbox[2] / 2.f , rbox[0] - rbox[2] / 2.f), //left
-    (std::min)(lbox[0] + lbox[2] / 2.f , rbox[0] + rbox[2] / 2.f), //right
-    (std::max)(lbox[1] - lbox[3] / 2.f , rbox[1] - rbox[3] / 2.f), //top
-    (std::min)(lbox[1] + lbox[3] / 2.f , rbox[1] + rbox[3] / 2.f), //bottom
-  };
+/*
+ * NMS works on per-class buckets of the candidates above the confidence threshold, as structure-of-arrays of their
+ * corners and areas. The storage is per thread and reserved once for kMaxNumOutputBbox candidates, so that NMS of
+ * the images of a batch can run in parallel without allocating.
+ *
+ * Candidates are selected from a max-heap of their confidence, most confident first, and kept unless a kept box
+ * overlaps them more than nms_thresh. That is the result of removing, in the sorted bucket, the boxes overlapping each
+ * kept one, and each candidate is checked against the kept boxes in one branch-free (SIMD) pass. Selection stops once
+ * max_det boxes of the class are kept: building the heap is linear, and only the candidates popped before that are
+ * ordered. Without a limit, every candidate is popped and that costs as much as a full sort.
+ */
+namespace {
 
-  if (interBox[2] > interBox[3] || interBox[0] > interBox[1])
-    return 0.0f;
+struct NmsBucket {
+  std::vector<float> left, top, right, bottom, area, conf;
+  std::vector<int> index;  // of the detection in the output
+  size_t size = 0;
 
-  float interBoxS = (interBox[1] - interBox[0])*(interBox[3] - interBox[2]);
-  return interBoxS / (lbox[2] * lbox[3] + rbox[2] * rbox[3] - interBoxS);
-}
+  void reserve(size_t n) {
+    for (auto* v : {&left, &top, &right, &bottom, &area, &conf}) v->resize(n);
+    index.resize(n);
+  }
+
+  void add(const float* bbox, float confidence, int i) {
+    left[size] = bbox[0] - bbox[2] / 2.f;
+    right[size] = bbox[0] + bbox[2] / 2.f;
+    top[size] = bbox[1] - bbox[3] / 2.f;
+    bottom[size] = bbox[1] + bbox[3] / 2.f;
+    area[size] = bbox[2] * bbox[3];
+    conf[size] = confidence;
+    index[size] = i;
+    size++;
+  }
+};
+
+struct NmsScratch {
+  NmsBucket candidates[kNumClass];
+  NmsBucket kept;
+  std::vector<int> heap;
 
-static bool cmp(const Detection& a, const Detection& b) {
-  return a.conf > b.conf;
+  NmsScratch() {
+    for (auto& bucket : candidates) bucket.reserve(kMaxNumOutputBbox);
+    kept.reserve(kMaxNumOutputBbox);
+    heap.reserve(kMaxNumOutputBbox);
+  }
+};
+
+// Whether box i of candidates overlaps any of the kept boxes more than nms_thresh (IoU)
+bool overlaps_kept(const NmsBucket& candidates, size_t i, const NmsBucket& kept, float nms_thresh) {
+  const float l = candidates.left[i], t = candidates.top[i], r = candidates.right[i], b = candidates.bottom[i];
+  const float a = candidates.area[i];
+  size_t j = 0;
+  // inter / (a + kept area - inter) > nms_thresh, without the division
+#if defined(__SSE2__)
+  {
+    const __m128 lv = _mm_set1_ps(l), tv = _mm_set1_ps(t), rv = _mm_set1_ps(r), bv = _mm_set1_ps(b);
+    const __m128 av = _mm_set1_ps(a), thresh = _mm_set1_ps(nms_thresh), zero = _mm_setzero_ps();
+    __m128 any = zero;
+    for (; j + 4 <= kept.size; j += 4) {
+      __m128 w = _mm_sub_ps(_mm_min_ps(rv, _mm_loadu_ps(&kept.right[j])), _mm_max_ps(lv, _mm_loadu_ps(&kept.left[j])));
+      __m128 h = _mm_sub_ps(_mm_min_ps(bv, _mm_loadu_ps(&kept.bottom[j])), _mm_max_ps(tv, _mm_loadu_ps(&kept.top[j])));
+      __m128 inter = _mm_mul_ps(_mm_max_ps(w, zero), _mm_max_ps(h, zero));
+      __m128 uni = _mm_sub_ps(_mm_add_ps(av, _mm_loadu_ps(&kept.area[j])), inter);
+      any = _mm_or_ps(any, _mm_cmpgt_ps(inter, _mm_mul_ps(thresh, uni)));
+    }
+    if (_mm_movemask_ps(any)) return true;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  {
+    const float32x4_t lv = vdupq_n_f32(l), tv = vdupq_n_f32(t), rv = vdupq_n_f32(r), bv = vdupq_n_f32(b);
+    const float32x4_t av = vdupq_n_f32(a), zero = vdupq_n_f32(0);
+    uint32x4_t any = vdupq_n_u32(0);
+    for (; j + 4 <= kept.size; j += 4) {
+      float32x4_t w = vsubq_f32(vminq_f32(rv, vld1q_f32(&kept.right[j])), vmaxq_f32(lv, vld1q_f32(&kept.left[j])));
+      float32x4_t h = vsubq_f32(vminq_f32(bv, vld1q_f32(&kept.bottom[j])), vmaxq_f32(tv, vld1q_f32(&kept.top[j])));
+      float32x4_t inter = vmulq_f32(vmaxq_f32(w, zero), vmaxq_f32(h, zero));
+      float32x4_t uni = vsubq_f32(vaddq_f32(av, vld1q_f32(&kept.area[j])), inter);
+      any = vorrq_u32(any, vcgtq_f32(inter, vmulq_n_f32(uni, nms_thresh)));
+    }
+    if (vmaxvq_u32(any)) return true;
+  }
+#endif
+  bool any = false;
+  for (; j < kept.size; j++) {
+    float w = std::max(std::min(r, kept.right[j]) - std::max(l, kept.left[j]), 0.f);
+    float h = std::max(std::min(b, kept.bottom[j]) - std::max(t, kept.top[j]), 0.f);
+    float inter = w * h;
+    any |= (inter > nms_thresh * (a + kept.area[j] - inter));
+  }
+  return any;
 }
 
-void nms(std::vector<Detection>& res, float* output, float conf_thresh, float nms_thresh) {
-  int det_size = sizeof(Detection) / sizeof(float);
-  std::map<float, std::vector<Detection>> m;
-  for (int i = 0; i < output[0] && i < kMaxNumOutputBbox; i++) {
-    if (output[1 + det_size * i + 4] <= conf_thresh) continue;
-    Detection det;
-    memcpy(&det, &output[1 + det_size * i], det_size * sizeof(float));
-    if (m.count(det.class_id) == 0) m.emplace(det.class_id, std::vector<Detection>());
-    m[det.class_id].push_back(det);
+}  // namespace
+
+void nms(std::vector<Detection>& res, float* output, float conf_thresh, float nms_thresh, int max_det) {
+  thread_local NmsScratch scratch;
+  const int det_size = sizeof(Detection) / sizeof(float);
+  const float* dets = output + 1;
+
+  // Prefilter by confidence into the buckets of the classes
+  for (auto& bucket : scratch.candidates) bucket.size = 0;
+  const int count = std::min((int)output[0], kMaxNumOutputBbox);
+  for (int i = 0; i < count; i++) {
+    const float* det = dets + det_size * i;
+    if (det[4] <= conf_thresh) continue;
+    int class_id = (int)det[5];
+    if (class_id < 0 || class_id >= kNumClass) continue;  // not a class of the model
+    scratch.candidates[class_id].add(det, det[4], i);
   }
-  for (auto it = m.begin(); it != m.end(); it++) {
-    auto& dets = it->second;
-    std::sort(dets.begin(), dets.end(), cmp);
-    for (size_t m = 0; m < dets.size(); ++m) {
-      auto& item = dets[m];
-      res.push_back(item);
-      for (size_t n = m + 1; n < dets.size(); ++n) {
-        if (iou(item.bbox, dets[n].bbox) > nms_thresh) {
-          dets.erase(dets.begin() + n);
-          --n;
-        }
-      }
+
+  for (const auto& bucket : scratch.candidates) {
+    if (bucket.size == 0) continue;
+    auto& heap = scratch.heap;
+    heap.resize(bucket.size);
+    for (size_t i = 0; i < bucket.size; i++) heap[i] = (int)i;
+    auto less_conf = [&](int a, int b) { return bucket.conf[a] < bucket.conf[b]; };
+    std::make_heap(heap.begin(), heap.end(), less_conf);
+
+    auto& kept = scratch.kept;
+    kept.size = 0;
+    while (!heap.empty() && (int)kept.size < max_det) {
+      std::pop_heap(heap.begin(), heap.end(), less_conf);
+      int i = heap.back();
+      heap.pop_back();
+      if (overlaps_kept(bucket, i, kept, nms_thresh)) continue;
+      const float* det = dets + det_size * bucket.index[i];
+      kept.add(det, bucket.conf[i], bucket.index[i]);
+      Detection& d = res.emplace_back();
+      memcpy(&d, det, sizeof(Detection));
     }
   }
 }
 
-void batch_nms(std::vector<std::vector<Detection>>& res_batch, float *output, int batch_size, int output_size, float conf_thresh, float nms_thresh) {
+void batch_nms(std::vector<std::vector<Detection>>& res_batch, float *output, int batch_size, int output_size, float conf_thresh, float nms_thresh, int max_det) {
   res_batch.resize(batch_size);
-  for (int i = 0; i < batch_size; i++) {
-    nms(res_batch[i], &output[i * output_size], conf_thresh, nms_thresh);
+  if (batch_size == 1) {
+    nms(res_batch[0], output, conf_thresh, nms_thresh, max_det);
+    return;
   }
+  // Images are independent, each thread works on its own scratch
+  cv::parallel_for_(cv::Range(0, batch_size), [&](const cv::Range& range) {
+    for (int i = range.start; i < range.end; i++) {
+      nms(res_batch[i], &output[i * output_size], conf_thresh, nms_thresh, max_det);
+    }
+  });
 }
 
 void draw_bbox(std::vector<cv::Mat>& img_batch, std::vector<std::vector<Detection>>& res_batch) {
@@ -5,9 +5,10 @@
 
 cv::Rect get_rect(cv::Mat& img, float bbox[4]);
 
-void nms(std::vector<Detection>& res, float *output, float conf_thresh, float nms_thresh = 0.5);
+// max_det: most detections kept per class, the most confident ones
+void nms(std::vector<Detection>& res, float *output, float conf_thresh, float nms_thresh = 0.5, int max_det = kMaxNumOutputBbox);
 
-void batch_nms(std::vector<std::vector<Detection>>& batch_res, float *output, int batch_size, int output_size, float conf_thresh, float nms_thresh = 0.5);
+void batch_nms(std::vector<std::vector<Detection>>& batch_res, float *output, int batch_size, int output_size, float conf_thresh, float nms_thresh = 0.5, int max_det = kMaxNumOutputBbox);
 
 void draw_bbox(std::vector<cv::Mat>& img_batch, std::vector<std::vector<Detection>>& res_batch);
 
@@ -20,11 +20,14 @@ robot_description = Command(['xacro ', os.path.join(
     ' xyz:=', launch_params['odom2camera']['xyz'], ' rpy:=', launch_params['odom2camera']['rpy']])
 
 
-robot_state_publisher = Node(
+# Composed with the others, so that its TF does not go through DDS from another process
+robot_state_publisher = ComposableNode(
     package='robot_state_publisher',
-    executable='robot_state_publisher',
+    plugin='robot_state_publisher::RobotStatePublisher',
+    name='robot_state_publisher',
     parameters=[{'robot_description': robot_description,
-                 'publish_frequency': 1000.0}]
+                 'publish_frequency': 100.0}],
+    extra_arguments=[{'use_intra_process_comms': True}]
 )
 
 def generate_launch_description():
@@ -45,38 +48,35 @@ def generate_launch_description():
         extra_arguments=[{'use_intra_process_comms': True}]
     )
     
-    camera_detector_container = ComposableNodeContainer(
-        name='camera_detector_container',
+    serial_node = ComposableNode(
+        package='solais_serial',
+        plugin='solais_serial::SerialNodeLegacy',
+        name='solais_serial_legacy',
+        parameters=[node_params],
+        extra_arguments=[{'use_intra_process_comms': True}]
+    )
+
+    # All nodes in one process on a multi-threaded executor: messages between them are passed by pointer (intra
+    # process), and each node runs its callbacks in its own callback group, so that the serial node and TF are not
+    # blocked behind detection
+    solais_container = ComposableNodeContainer(
+        name='solais_container',
         namespace='',
         package='rclcpp_components',
-        executable='component_container',
+        executable='component_container_mt',
         composable_node_descriptions=[
             camera_node,
-            detector_node
+            detector_node,
+            serial_node,
+            robot_state_publisher,
         ],
         output='both',
         emulate_tty=True,
-        ros_arguments=['--ros-args', '--log-level',
-                        'armor_detector:='+launch_params['detector_log_level']],
+        ros_arguments=['--ros-args',
+                       '--log-level', 'armor_detector:='+launch_params['detector_log_level'],
+                       '--log-level', 'solais_serial_legacy:='+launch_params['serial_log_level']],
         on_exit=Shutdown(),
     )
-    
-    # serial_driver_node = Node(
-    #     package='rm_serial_driver',
-    #     executable='rm_serial_driver_node',
-    #     name='serial_driver',
-    #     output='both',
-    #     emulate_tty=True,
-    #     parameters=[node_params],
-    #     on_exit=Shutdown(),
-    #     ros_arguments=['--ros-args', '--log-level',
-    #                    'serial_driver:='+launch_params['serial_log_level']],
-    # )
-
-    # delay_serial_node = TimerAction(
-    #     period=1.5,
-    #     actions=[serial_driver_node],
-    # )
 
     # delay_tracker_node = TimerAction(
     #     period=2.0,
@@ -84,8 +84,6 @@ def generate_launch_description():
     # )
 
     return LaunchDescription([
-        robot_state_publisher,
-        camera_detector_container,
-        # delay_serial_node,
+        solais_container,
         # delay_tracker_node,
     ])
@@ -0,0 +1,125 @@
+// Copyright 2023 Meta-Team
+#ifndef SOLAIS_SERIAL__ATTITUDE_HISTORY_HPP_
+#define SOLAIS_SERIAL__ATTITUDE_HISTORY_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// The sequence lock shared with Solais (include/AttitudeRing.h at the root of the repository)
+#include "AttitudeRing.h"
+
+namespace solais_serial
+{
+
+/**
+ * Gimbal attitude history in POSIX shared memory, written by the serial node at the feedback rate and read by the
+ * tracker (in the same container or another process) for the attitude at the capture time of each frame, without
+ * going through tf2. One writer. Readers never block the writer: a sequence lock makes them retry if the history is
+ * overwritten while they read, a bounded number of times (rm::AttitudeRing).
+ *
+ * Stamps are ROS time [ns] (same as the TF the serial node publishes), angles [rad] as in the TF (yaw counterclockwise,
+ * pitch downward for positive).
+ */
+class SharedAttitudeHistory
+{
+public:
+  static constexpr const char * DEFAULT_NAME = "/solais_gimbal_attitude";
+
+  /**
+   * Create (or take over) the segment, as the writer.
+   * @return nullptr on failure.
+   */
+  static std::unique_ptr<SharedAttitudeHistory> create(const std::string & name = DEFAULT_NAME)
+  {
+    return map(name, true);
+  }
+
+  /**
+   * Open the segment of a writer, as a reader.
+   * @return nullptr if there is no writer yet.
+   */
+  static std::unique_ptr<SharedAttitudeHistory> open(const std::string & name = DEFAULT_NAME)
+  {
+    return map(name, false);
+  }
+
+  ~SharedAttitudeHistory()
+  {
+    munmap(segment_, sizeof(Segment));
+    if (writer_) {shm_unlink(name_.c_str());}
+  }
+
+  SharedAttitudeHistory(const SharedAttitudeHistory &) = delete;
+  SharedAttitudeHistory & operator=(const SharedAttitudeHistory &) = delete;
+
+  /**
+   * Append an attitude. Writer only. A stamp earlier than the last one drops the history.
+   */
+  void push(int64_t stamp_ns, float yaw, float pitch)
+  {
+    segment_->ring.push(stamp_ns, yaw, pitch);
+  }
+
+  /**
+   * Attitude at a stamp, interpolated between the samples around it.
+   * @param max_hold_ns  How long after the last sample it is held.
+   * @return             False if the stamp is out of the history, or if the writer kept changing it (e.g. died in the
+   *                     middle of a push).
+   */
+  bool interpolate(int64_t stamp_ns, float & yaw, float & pitch, int64_t max_hold_ns = 20000000) const
+  {
+    return segment_->ring.interpolate(stamp_ns, max_hold_ns, static_cast<float>(2 * M_PI), yaw, pitch);
+  }
+
+private:
+  static constexpr uint32_t MAGIC = 0x41545448;  // "ATTH"
+  static constexpr size_t CAPACITY = 512;        // 0.5 s at 1 kHz
+
+  // Lock-free atomics are address-free, so they work across processes
+  struct Segment
+  {
+    std::atomic<uint32_t> magic;  // set last by the writer, so readers don't open a segment being set up
+    rm::AttitudeRing<CAPACITY> ring;
+  };
+
+  Segment * segment_;
+  std::string name_;
+  bool writer_;
+
+  SharedAttitudeHistory(Segment * segment, std::string name, bool writer)
+  : segment_(segment), name_(std::move(name)), writer_(writer) {}
+
+  static std::unique_ptr<SharedAttitudeHistory> map(const std::string & name, bool writer)
+  {
+    int fd = shm_open(name.c_str(), writer ? (O_CREAT | O_RDWR) : O_RDONLY, 0644);
+    if (fd < 0) {return nullptr;}
+    if (writer && ftruncate(fd, sizeof(Segment)) != 0) {
+      close(fd);
+      return nullptr;
+    }
+    void * addr = mmap(nullptr, sizeof(Segment), writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {return nullptr;}
+
+    auto segment = static_cast<Segment *>(addr);
+    if (writer) {
+      segment->magic.store(0, std::memory_order_relaxed);
+      segment->ring.reset();
+      segment->magic.store(MAGIC, std::memory_order_release);
+    } else if (segment->magic.load(std::memory_order_acquire) != MAGIC) {
+      munmap(addr, sizeof(Segment));
+      return nullptr;
+    }
+    return std::unique_ptr<SharedAttitudeHistory>(new SharedAttitudeHistory(segment, name, writer));
+  }
+};
+
+}  // namespace solais_serial
+
+#endif  // SOLAIS_SERIAL__ATTITUDE_HISTORY_HPP_
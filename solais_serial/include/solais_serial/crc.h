@@ -1,55 +1,23 @@
-#ifndef _CRC_CHECK_H_
-#define _CRC_CHECK_H_
+// Copyright 2023 Meta-Team
+#ifndef SOLAIS_SERIAL__CRC_H_
+#define SOLAIS_SERIAL__CRC_H_
 
-#include <cstdint>
+// The CRC shared with Solais (include/CRC.h and src/CRC.cpp at the root of the repository)
+#include "CRC.h"
 
 namespace solais_serial {
 
-/**
- * Get CRC16 checksum.
- * @param pchMessage  Data to check
- * @param dwLength    Data length
- * @return            CRC checksum
- */
-uint8_t getCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
-
-/**
- * Append CRC8 to the end of data.
- * @param pchMessage  Data to append CRC
- * @param dwLength    Stream length = data + checksum
- */
-bool verifyCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
-
-/**
- * Append CRC8 to the end of data.
- * @param pchMessage  Data to append CRC
- * @param dwLength    Stream length = data + checksum
- */
-void appendCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength);
-
-/**
- * Get CRC16 checksum.
- * @param pchMessage  Data to check
- * @param dwLength    Data length
- * @return            CRC checksum
- */
-uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
-
-/**
- * CRC16 verification function.
- * @param pchMessage  Data to verify
- * @param dwLength    Stream length = data + checksum
- * @return            CRC verify result
- */
-bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
-
-/**
- * Append CRC16 to the end of data.
- * @param pchMessage  Data to append CRC
- * @param dwLength    Stream length = data + checksum
- */
-void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength);
+using rm::CRC8_INIT;
+using rm::CRC16_INIT;
+using rm::updateCRC8;
+using rm::updateCRC16;
+using rm::getCRC8CheckSum;
+using rm::verifyCRC8CheckSum;
+using rm::appendCRC8CheckSum;
+using rm::getCRC16CheckSum;
+using rm::verifyCRC16CheckSum;
+using rm::appendCRC16CheckSum;
 
 }
 
-#endif
+#endif  // SOLAIS_SERIAL__CRC_H_
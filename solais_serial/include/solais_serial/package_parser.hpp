@@ -0,0 +1,119 @@
+// Copyright 2023 Meta-Team
+#ifndef SOLAIS_SERIAL__PACKAGE_PARSER_HPP_
+#define SOLAIS_SERIAL__PACKAGE_PARSER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "solais_serial/crc.h"
+
+namespace solais_serial
+{
+
+/**
+ * Streaming parser of fixed-size packages that start with a SOF byte and end with a CRC16 (little endian) over the
+ * rest. Received bytes in chunks of any size are appended to a ring buffer, and complete packages are decoded in place,
+ * without allocation. On a wrong SOF or CRC, it resynchronizes by skipping one byte and searching for the next SOF.
+ * @tparam Package   Packed struct, sof first and crc16 last.
+ * @tparam SOF       Start of frame.
+ * @tparam CAPACITY  Ring buffer size, a power of 2 larger than a package.
+ */
+template<class Package, uint8_t SOF, size_t CAPACITY = 1024>
+class PackageParser
+{
+  static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+  static_assert(CAPACITY > sizeof(Package), "CAPACITY must hold a package");
+
+public:
+  /**
+   * Append received bytes. Bytes that do not fit (the packages are not parsed fast enough) drop the oldest ones.
+   */
+  void feed(const uint8_t * data, size_t size)
+  {
+    while (size > 0) {
+      size_t tail = end_ & MASK;
+      size_t n = std::min(size, CAPACITY - tail);  // contiguous up to the end of the ring
+      std::memcpy(&buf_[tail], data, n);
+      end_ += n;
+      data += n;
+      size -= n;
+    }
+    if (end_ - begin_ > CAPACITY) {
+      dropped_bytes_ += end_ - begin_ - CAPACITY;
+      begin_ = end_ - CAPACITY;
+    }
+  }
+
+  /**
+   * Decode all complete packages.
+   * @param on_package  Called with each valid package (a reference valid only during the call).
+   * @return            Number of packages decoded.
+   */
+  template<class F>
+  size_t parse(F && on_package)
+  {
+    size_t count = 0;
+    while (end_ - begin_ >= sizeof(Package)) {
+      if (buf_[begin_ & MASK] != SOF) {
+        begin_++;  // search for the next SOF
+        skipped_bytes_++;
+        continue;
+      }
+
+      // CRC16 over the package except the CRC, in one or two contiguous spans of the ring
+      constexpr size_t CRC_SPAN = sizeof(Package) - sizeof(uint16_t);
+      size_t head = begin_ & MASK;
+      size_t first = std::min(CRC_SPAN, CAPACITY - head);
+      uint16_t crc = updateCRC16(CRC16_INIT, &buf_[head], first);
+      crc = updateCRC16(crc, &buf_[0], CRC_SPAN - first);
+      uint16_t expected = static_cast<uint16_t>(
+        at(begin_ + CRC_SPAN) | (at(begin_ + CRC_SPAN + 1) << 8));
+
+      if (crc != expected) {
+        begin_++;  // a SOF in the data, or a corrupted package
+        crc_errors_++;
+        continue;
+      }
+
+      copyOut(begin_, reinterpret_cast<uint8_t *>(&package_));
+      begin_ += sizeof(Package);
+      count++;
+      on_package(static_cast<const Package &>(package_));
+    }
+    return count;
+  }
+
+  uint64_t crcErrors() const {return crc_errors_;}
+
+  uint64_t skippedBytes() const {return skipped_bytes_;}
+
+  uint64_t droppedBytes() const {return dropped_bytes_;}
+
+private:
+  static constexpr size_t MASK = CAPACITY - 1;
+
+  std::array<uint8_t, CAPACITY> buf_;
+  uint64_t begin_ = 0;  // positions not wrapped, used as begin_ & MASK
+  uint64_t end_ = 0;
+  Package package_;     // the decoded package, copied out of the ring as it may wrap around
+
+  uint64_t crc_errors_ = 0;
+  uint64_t skipped_bytes_ = 0;
+  uint64_t dropped_bytes_ = 0;
+
+  uint8_t at(uint64_t pos) const {return buf_[pos & MASK];}
+
+  void copyOut(uint64_t pos, uint8_t * out) const
+  {
+    size_t head = pos & MASK;
+    size_t first = std::min(sizeof(Package), CAPACITY - head);
+    std::memcpy(out, &buf_[head], first);
+    std::memcpy(out + first, &buf_[0], sizeof(Package) - first);
+  }
+};
+
+}  // namespace solais_serial
+
+#endif  // SOLAIS_SERIAL__PACKAGE_PARSER_HPP_
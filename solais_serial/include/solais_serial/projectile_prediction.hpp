@@ -1,16 +1,72 @@
-#ifndef PROJECTILE_PREDICTION_HPP
-#define PROJECTILE_PREDICTION_HPP
+// Copyright 2023 Meta-Team
+#ifndef SOLAIS_SERIAL__PROJECTILE_PREDICTION_HPP_
+#define SOLAIS_SERIAL__PROJECTILE_PREDICTION_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
 #include "rclcpp/rclcpp.hpp"
+#include "rmoss_projectile_motion/projectile_solver_interface.hpp"
+
+namespace solais_serial
+{
 
-namespace solais_serial {
-class ProjectilePrediction
+/**
+ * Projectile solver backed by a table of pitch angles over horizontal distance x height, precomputed with the
+ * configured rmoss solver (gravity or gaf) and bilinearly interpolated, so that a solve takes constant and negligible
+ * time instead of iterating numerically. Targets out of the table (or near the maximal range, where the table has
+ * no solution at some corners) fall back to the rmoss solver.
+ *
+ * The table is rebuilt only when the shoot speed or friction changes (configure()), and swapped in atomically, so
+ * solve() can run on another thread meanwhile.
+ */
+class ProjectilePrediction : public rmoss_projectile_motion::ProjectileSolverInterface
 {
 public:
-	ProjectilePrediction(rclcpp::Node::SharedPtr node);
-	
+  /**
+   * Declares the table range parameters (projectile.table.*) and builds the table.
+   * @param solver_type  "gravity" or "gaf".
+   */
+  ProjectilePrediction(
+    rclcpp::Node::SharedPtr node, const std::string & solver_type, double shoot_speed,
+    double friction);
+
+  /**
+   * Rebuild the table if the parameters changed.
+   */
+  void configure(double shoot_speed, double friction);
+
+  /**
+   * @param target_x  Horizontal distance [m].
+   * @param target_h  Height [m].
+   * @param angle     [Out] Pitch [rad], upward for positive.
+   * @return          False if the target is out of range.
+   */
+  bool solve(double target_x, double target_h, double & angle) override;
+
 private:
-	rclcpp::Node::SharedPtr node_;
+  struct Table
+  {
+    double shoot_speed;
+    double friction;
+    std::shared_ptr<rmoss_projectile_motion::ProjectileSolverInterface> solver;  // for building and falling back
+
+    double x_min, h_min, step;
+    int x_count, h_count;
+    std::vector<float> pitch;  // [x_count][h_count], NaN for no solution
+
+    float at(int xi, int hi) const {return pitch[xi * h_count + hi];}
+  };
+
+  rclcpp::Node::SharedPtr node_;
+  std::string solver_type_;
+  double x_min_, x_max_, h_min_, h_max_, step_;  // table range [m]
+
+  std::shared_ptr<const Table> table_;  // accessed with std::atomic_load/store
+
+  std::shared_ptr<const Table> build(double shoot_speed, double friction) const;
 };
-}
 
-#endif // PROJECTILE_PREDICTION_HPP
\ No newline at end of file
+}  // namespace solais_serial
+
+#endif  // SOLAIS_SERIAL__PROJECTILE_PREDICTION_HPP_
@@ -15,10 +15,39 @@
 
 #include <Eigen/Dense>
 
+#include <atomic>
+#include <vector>
+
+#include "solais_serial/attitude_history.hpp"
+#include "solais_serial/package_parser.hpp"
+#include "solais_serial/projectile_prediction.hpp"
+
 // #include "tf2_ros/buffer.h"
 
 namespace solais_serial
 {
+struct __attribute__((packed, aligned(1))) SentPackage
+{
+  uint8_t sof = 0x5A;  // Start of frame
+  float yaw;
+  float pitch;
+  uint8_t crc8;
+};
+
+struct __attribute__((packed, aligned(1))) ReceivedPackage
+{
+  uint8_t sof = 0x5A;  // Start of frame
+  float yaw;  // Yaw -180 to 180, counterclockwise is positive
+  float pitch;  // Pitch -20 to 5, going up is negative
+  uint16_t crc16;
+};
+
+enum class CommandID : uint8_t
+{
+  VISION_CONTROL_CMD_ID = 0,
+  CMD_ID_COUNT
+};
+
 class SerialNodeLegacy
 {
 public:
@@ -31,6 +60,8 @@ private:
 
   void receivePackage();
 
+  void handlePackage(const ReceivedPackage & package);
+
   void sendPackage(const auto_aim_interfaces::msg::Target::SharedPtr msg);
 
   void reopenPort();
@@ -44,15 +75,30 @@ private:
   long baud_rate_;
   std::shared_ptr<drivers::serial_driver::SerialPortConfig> device_config_;
   std::shared_ptr<drivers::serial_driver::SerialDriver> serial_driver_;
+  rclcpp::CallbackGroup::SharedPtr callback_group_;
   rclcpp::Subscription<auto_aim_interfaces::msg::Target>::SharedPtr armors_sub_;
-  double timestamp_offset_ = 0;
+  std::atomic<double> timestamp_offset_{0};  // updated by the parameter callback, read by the receive thread
+  rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr param_callback_;
   std::unique_ptr<tf2_ros::TransformBroadcaster> tf_broadcaster_;
+  geometry_msgs::msg::TransformStamped gimbal_tf_;  // frame ids set once, stamp and rotation per package
+
+  // Every feedback goes to the shared attitude history (read by the tracker), TF only at tf_publish_rate for the
+  // other users of the tree (rviz, the projectile offsets)
+  std::unique_ptr<SharedAttitudeHistory> attitude_history_;
+  rclcpp::Duration tf_interval_{0, 0};
+  rclcpp::Time last_tf_stamp_;
 
   // Debug
   rclcpp::Publisher<visualization_msgs::msg::Marker>::SharedPtr marker_pub_;
   visualization_msgs::msg::Marker aiming_point_;
   std::thread receive_thread_;
 
+  // The receive thread reads chunks as they come into rx_chunk_ (allocated once) and feeds them to the parser
+  static constexpr size_t RX_CHUNK_SIZE = 256;
+  std::vector<uint8_t> rx_chunk_;
+  PackageParser<ReceivedPackage, 0x5A> rx_parser_;
+  std::vector<uint8_t> tx_buffer_;  // preallocated, SentPackage
+
 
   // For projectile prediction
   double cur_pitch_ = 0.;
@@ -69,47 +115,9 @@ private:
 
   std::string solver_type_;
   std::shared_ptr<rmoss_projectile_motion::ProjectileSolverInterface> solver_;
+  std::shared_ptr<ProjectilePrediction> projectile_prediction_;  // solver_, configurable
 };
 
-
-struct __attribute__((packed, aligned(1))) SentPackage
-{
-  uint8_t sof = 0x5A;  // Start of frame
-  float yaw;
-  float pitch;
-  uint8_t crc8;
-};
-
-struct __attribute__((packed, aligned(1))) ReceivedPackage
-{
-  uint8_t sof = 0x5A;  // Start of frame
-  float yaw;  // Yaw -180 to 180, counterclockwise is positive
-  float pitch;  // Pitch -20 to 5, going up is negative
-  uint16_t crc16;
-};
-
-enum class CommandID : uint8_t
-{
-  VISION_CONTROL_CMD_ID = 0,
-  CMD_ID_COUNT
-};
-
-inline std::vector<uint8_t> Pak2Vector(const SentPackage & data)
-{
-  std::vector<uint8_t> package(sizeof(SentPackage));
-  std::copy(
-    reinterpret_cast<const uint8_t *>(&data),
-    reinterpret_cast<const uint8_t *>(&data) + sizeof(SentPackage), package.begin());
-  return package;
-}
-
-inline ReceivedPackage Vector2Pak(const std::vector<uint8_t> & data)
-{
-  ReceivedPackage package;
-  std::copy(data.begin(), data.end(), reinterpret_cast<uint8_t *>(&package));
-  return package;
-}
-
 }  // namespace solais_serial
 
 
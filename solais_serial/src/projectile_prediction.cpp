@@ -0,0 +1,104 @@
+// Copyright 2023 Meta-Team
+#include "solais_serial/projectile_prediction.hpp"
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include "rmoss_projectile_motion/gravity_projectile_solver.hpp"
+#include "rmoss_projectile_motion/gaf_projectile_solver.hpp"
+
+namespace solais_serial
+{
+
+ProjectilePrediction::ProjectilePrediction(
+  rclcpp::Node::SharedPtr node, const std::string & solver_type, double shoot_speed,
+  double friction)
+: node_(std::move(node)), solver_type_(solver_type)
+{
+  x_min_ = node_->declare_parameter("projectile.table.min_distance", 0.5);
+  x_max_ = node_->declare_parameter("projectile.table.max_distance", 12.0);
+  h_min_ = node_->declare_parameter("projectile.table.min_height", -1.5);
+  h_max_ = node_->declare_parameter("projectile.table.max_height", 2.0);
+  step_ = node_->declare_parameter("projectile.table.step", 0.05);
+
+  std::atomic_store(&table_, build(shoot_speed, friction));
+}
+
+void ProjectilePrediction::configure(double shoot_speed, double friction)
+{
+  auto table = std::atomic_load(&table_);
+  if (table && table->shoot_speed == shoot_speed && table->friction == friction) {
+    return;
+  }
+  std::atomic_store(&table_, build(shoot_speed, friction));
+}
+
+std::shared_ptr<const ProjectilePrediction::Table> ProjectilePrediction::build(
+  double shoot_speed, double friction) const
+{
+  auto start = std::chrono::steady_clock::now();
+
+  auto table = std::make_shared<Table>();
+  table->shoot_speed = shoot_speed;
+  table->friction = friction;
+  if (solver_type_ == "gaf") {
+    table->solver =
+      std::make_shared<rmoss_projectile_motion::GafProjectileSolver>(shoot_speed, friction);
+  } else {
+    table->solver = std::make_shared<rmoss_projectile_motion::GravityProjectileSolver>(shoot_speed);
+  }
+
+  table->x_min = x_min_;
+  table->h_min = h_min_;
+  table->step = step_;
+  table->x_count = static_cast<int>(std::floor((x_max_ - x_min_) / step_)) + 1;
+  table->h_count = static_cast<int>(std::floor((h_max_ - h_min_) / step_)) + 1;
+  table->pitch.resize(static_cast<size_t>(table->x_count) * table->h_count);
+
+  int solved = 0;
+  for (int xi = 0; xi < table->x_count; ++xi) {
+    for (int hi = 0; hi < table->h_count; ++hi) {
+      double angle;
+      float & entry = table->pitch[xi * table->h_count + hi];
+      if (table->solver->solve(x_min_ + xi * step_, h_min_ + hi * step_, angle)) {
+        entry = static_cast<float>(angle);
+        ++solved;
+      } else {
+        entry = std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+  }
+
+  auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  RCLCPP_INFO(
+    node_->get_logger(), "Projectile table (%s, %.2f m/s, friction %.4f): %dx%d, %d solved, built in %.1f ms",
+    solver_type_.c_str(), shoot_speed, friction, table->x_count, table->h_count, solved, ms);
+  return table;
+}
+
+bool ProjectilePrediction::solve(double target_x, double target_h, double & angle)
+{
+  auto table = std::atomic_load(&table_);
+
+  double fx = (target_x - table->x_min) / table->step;
+  double fh = (target_h - table->h_min) / table->step;
+  int xi = static_cast<int>(std::floor(fx));
+  int hi = static_cast<int>(std::floor(fh));
+  if (xi >= 0 && hi >= 0 && xi + 1 < table->x_count && hi + 1 < table->h_count) {
+    float p00 = table->at(xi, hi), p01 = table->at(xi, hi + 1);
+    float p10 = table->at(xi + 1, hi), p11 = table->at(xi + 1, hi + 1);
+    if (!std::isnan(p00) && !std::isnan(p01) && !std::isnan(p10) && !std::isnan(p11)) {
+      double tx = fx - xi, th = fh - hi;
+      angle = (1 - tx) * ((1 - th) * p00 + th * p01) + tx * ((1 - th) * p10 + th * p11);
+      return true;
+    }
+  }
+
+  // Out of the table, or at the edge of the range
+  if (!table->solver->solve(target_x, target_h, angle)) {
+    error_message_ = table->solver->error_message();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace solais_serial
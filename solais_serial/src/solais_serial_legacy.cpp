@@ -6,11 +6,11 @@
 #include "serial_driver/serial_port.hpp"
 #include "solais_serial/crc.h"
 #include <limits>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <tf2_geometry_msgs/tf2_geometry_msgs.hpp>
-#include <tf2/LinearMath/Matrix3x3.h>
 #include <tf2/LinearMath/Quaternion.h>
-#include "rmoss_projectile_motion/gravity_projectile_solver.hpp"
-#include "rmoss_projectile_motion/gaf_projectile_solver.hpp"
 
 namespace solais_serial
 {
@@ -23,10 +23,46 @@ SerialNodeLegacy::SerialNodeLegacy(const rclcpp::NodeOptions & options)
   declareParameters();
 
   timestamp_offset_ = node_->declare_parameter("timestamp_offset", 0.0);
+  // Cached instead of get_parameter() for every package at the feedback rate
+  param_callback_ = node_->add_on_set_parameters_callback(
+    [this](const std::vector<rclcpp::Parameter> & params) {
+      for (const auto & param : params) {
+        if (param.get_name() == "timestamp_offset") {
+          timestamp_offset_ = param.as_double();
+        } else if (param.get_name() == "projectile.initial_speed") {
+          shoot_speed_ = param.as_double();
+          if (projectile_prediction_) {projectile_prediction_->configure(shoot_speed_, friction_);}
+        } else if (param.get_name() == "projectile.friction") {
+          friction_ = param.as_double();
+          if (projectile_prediction_) {projectile_prediction_->configure(shoot_speed_, friction_);}
+        }
+      }
+      rcl_interfaces::msg::SetParametersResult result;
+      result.successful = true;
+      return result;
+    });
   tf_broadcaster_ = std::make_unique<tf2_ros::TransformBroadcaster>(*node_);
+  gimbal_tf_.header.frame_id = "odom";
+  gimbal_tf_.child_frame_id = "gimbal_link";
+
+  double tf_publish_rate = node_->declare_parameter("tf_publish_rate", 100.0);
+  tf_interval_ = rclcpp::Duration::from_seconds(tf_publish_rate > 0 ? 1.0 / tf_publish_rate : 0.0);
+  last_tf_stamp_ = rclcpp::Time(0, 0, node_->get_clock()->get_clock_type());
+  const std::string attitude_shm_name =
+    node_->declare_parameter<std::string>("attitude_shm_name", SharedAttitudeHistory::DEFAULT_NAME);
+  attitude_history_ = SharedAttitudeHistory::create(attitude_shm_name);
+  if (!attitude_history_) {
+    RCLCPP_ERROR(
+      node_->get_logger(), "Failed to create the shared attitude history %s: %s", attitude_shm_name.c_str(),
+      std::strerror(errno));
+  }
 
   marker_pub_ = node_->create_publisher<visualization_msgs::msg::Marker>("/aiming_point", 10);
 
+  // Buffers of the receive thread and sendPackage(), allocated once
+  rx_chunk_.resize(RX_CHUNK_SIZE);
+  tx_buffer_.resize(sizeof(SentPackage));
+
   //  Open serial port
   serial_driver_->init_port(device_name_, *device_config_);
   if (!serial_driver_->port()->is_open()) {
@@ -35,16 +71,16 @@ SerialNodeLegacy::SerialNodeLegacy(const rclcpp::NodeOptions & options)
   }
 
   RCLCPP_INFO(node_->get_logger(), "Projectile motion solver type: %s", solver_type_.c_str());
-  if (solver_type_ == "gravity") {
-    solver_ = std::make_shared<rmoss_projectile_motion::GravityProjectileSolver>(shoot_speed_);
-  } else if (solver_type_ == "gaf") {
+  if (solver_type_ == "gaf") {
     friction_ = node_->declare_parameter("projectile.friction", 0.001);
-    solver_ =
-      std::make_shared<rmoss_projectile_motion::GafProjectileSolver>(shoot_speed_, friction_);
-  } else {
+  } else if (solver_type_ != "gravity") {
     RCLCPP_ERROR(node_->get_logger(), "Unknown solver type: %s", solver_type_.c_str());
     return;
   }
+  // The rmoss solver precomputed into a table, rebuilt when the speed or friction parameter changes
+  projectile_prediction_ =
+    std::make_shared<ProjectilePrediction>(node_, solver_type_, shoot_speed_, friction_);
+  solver_ = projectile_prediction_;
 
   aiming_point_.header.frame_id = "odom";
   aiming_point_.ns = "aiming_point";
@@ -58,10 +94,15 @@ SerialNodeLegacy::SerialNodeLegacy(const rclcpp::NodeOptions & options)
   aiming_point_.lifetime = rclcpp::Duration::from_seconds(0.1);
 
 
+  // A callback group of its own, so that in a multi-threaded container targets are handled as they come instead of
+  // waiting behind the callbacks of the other nodes
+  callback_group_ = node_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+  rclcpp::SubscriptionOptions sub_options;
+  sub_options.callback_group = callback_group_;
   armors_sub_ = node_->create_subscription<auto_aim_interfaces::msg::Target>(
     "/tracker/target", rclcpp::SensorDataQoS(), [this](const auto_aim_interfaces::msg::Target::SharedPtr msg) {
       sendPackage(msg);
-    });
+    }, sub_options);
 }
 
 SerialNodeLegacy::~SerialNodeLegacy()
@@ -138,47 +179,26 @@ void SerialNodeLegacy::declareParameters()
 
 void SerialNodeLegacy::receivePackage()
 {
-  std::vector<uint8_t> header(1);
-  std::vector<uint8_t> data;
-  data.reserve(sizeof(ReceivedPackage));
+  uint64_t last_crc_errors = 0, last_skipped_bytes = 0;
 
   while (rclcpp::ok()) {
     try {
-      serial_driver_->port()->receive(header);
-
-      if (header[0] == 0x5A) {
-        data.resize(sizeof(ReceivedPackage) - 1);
-        serial_driver_->port()->receive(data);
-
-        data.insert(data.begin(), header[0]);
-        ReceivedPackage package = Vector2Pak(data);
-
-        bool crc16_check = verifyCRC16CheckSum(reinterpret_cast<uint8_t *>(&package), sizeof(ReceivedPackage));
-
-        if (crc16_check) {
-          RCLCPP_INFO(node_->get_logger(), "Yaw: %f, Pitch: %f", package.yaw, package.pitch);
-          cur_pitch_ = package.pitch / 180. * M_PI;
-          cur_yaw_ = package.yaw / 180. * M_PI;
-
-          geometry_msgs::msg::TransformStamped t;
-            timestamp_offset_ = node_->get_parameter("timestamp_offset").as_double();
-            t.header.stamp = node_->now() + rclcpp::Duration::from_seconds(timestamp_offset_);
-            t.header.frame_id = "odom";
-            t.child_frame_id = "gimbal_link";
-            tf2::Quaternion q;
-            q.setRPY(0., package.pitch / 180. * M_PI, package.yaw / 180. * M_PI);
-            t.transform.rotation = tf2::toMsg(q);
-            tf2::Matrix3x3 m(q);
-            double tmp_pitch, tmp_roll, tmp_yaw;
-            m.getRPY(tmp_roll, tmp_pitch, tmp_yaw);
-            cur_yaw_cropped_ = tmp_yaw;  // Get cropped yaw
-            tf_broadcaster_->sendTransform(t);
-          RCLCPP_INFO(node_->get_logger(), " TF2 Yaw: %f", tmp_yaw / M_PI * 180.0);
-        } else {
-          RCLCPP_ERROR(node_->get_logger(), "CRC16 check failed");
-        }
-      } else {
-        RCLCPP_WARN_THROTTLE(node_->get_logger(), *(node_->get_clock()), 20, "Invalid header: %02X", header[0]);
+      // Blocks until some bytes arrive, and takes all that have arrived (up to a chunk) at once
+      size_t size = serial_driver_->port()->receive(rx_chunk_);
+      rx_parser_.feed(rx_chunk_.data(), size);
+      rx_parser_.parse([this](const ReceivedPackage & package) {handlePackage(package);});
+
+      if (rx_parser_.crcErrors() != last_crc_errors) {
+        last_crc_errors = rx_parser_.crcErrors();
+        RCLCPP_ERROR_THROTTLE(
+          node_->get_logger(), *(node_->get_clock()), 20, "CRC16 check failed (%lu in total)",
+          static_cast<unsigned long>(last_crc_errors));
+      }
+      if (rx_parser_.skippedBytes() != last_skipped_bytes) {
+        last_skipped_bytes = rx_parser_.skippedBytes();
+        RCLCPP_WARN_THROTTLE(
+          node_->get_logger(), *(node_->get_clock()), 20, "Invalid header (%lu bytes skipped in total)",
+          static_cast<unsigned long>(last_skipped_bytes));
       }
     } catch (const std::exception & e) {
       RCLCPP_ERROR_THROTTLE(node_->get_logger(), *(node_->get_clock()), 20, "Error receiving data: %s", e.what());
@@ -187,6 +207,32 @@ void SerialNodeLegacy::receivePackage()
   }
 }
 
+void SerialNodeLegacy::handlePackage(const ReceivedPackage & package)
+{
+  RCLCPP_DEBUG(node_->get_logger(), "Yaw: %f, Pitch: %f", package.yaw, package.pitch);
+  cur_pitch_ = package.pitch / 180. * M_PI;
+  cur_yaw_ = package.yaw / 180. * M_PI;
+
+  cur_yaw_cropped_ = std::remainder(cur_yaw_, 2 * M_PI);
+  if (cur_yaw_cropped_ >= M_PI) {cur_yaw_cropped_ -= 2 * M_PI;}
+
+  rclcpp::Time stamp = node_->now() + rclcpp::Duration::from_seconds(timestamp_offset_);
+  if (attitude_history_) {
+    attitude_history_->push(
+      stamp.nanoseconds(), static_cast<float>(cur_yaw_), static_cast<float>(cur_pitch_));
+  }
+
+  if (stamp - last_tf_stamp_ < tf_interval_) {
+    return;
+  }
+  last_tf_stamp_ = stamp;
+  gimbal_tf_.header.stamp = stamp;
+  tf2::Quaternion q;
+  q.setRPY(0., cur_pitch_, cur_yaw_);
+  gimbal_tf_.transform.rotation = tf2::toMsg(q);
+  tf_broadcaster_->sendTransform(gimbal_tf_);
+}
+
 void SerialNodeLegacy::reopenPort()
 {
   RCLCPP_WARN(node_->get_logger(), "Attempting to reopen port");
@@ -291,8 +337,8 @@ void SerialNodeLegacy::sendPackage(const auto_aim_interfaces::msg::Target::Share
     package.yaw = (yaw_diff + cur_yaw_ + offset_yaw_) / M_PI * 180;
     appendCRC8CheckSum((uint8_t *) (&package), sizeof(SentPackage));
 
-    std::vector<uint8_t> package_vec = Pak2Vector(package);
-    // serial_driver_->port()->send(package_vec);
+    std::memcpy(tx_buffer_.data(), &package, sizeof(SentPackage));
+    // serial_driver_->port()->send(tx_buffer_);
 
     RCLCPP_INFO(node_->get_logger(), " Target Yaw: %f, Target Pitch: %f", package.yaw, package.pitch);
 
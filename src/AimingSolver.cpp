@@ -4,6 +4,7 @@
 
 #include "AimingSolver.h"
 #include <algorithm>
+#include <cmath>
 
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
@@ -23,39 +24,66 @@ cv::Point3f AimingSolver::xyzToYPD(const cv::Point3f &xyz) {
             (float) norm(xyz)};  // +: away
 }
 
-void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageCaptureTime) {
+cv::Point3f AimingSolver::viewToWorld(const cv::Point3f &offset, const GimbalAttitude &attitude) {
+    float a = attitude.yaw * (PI / 180.0f), p = attitude.pitch * (PI / 180.0f);
+    float ca = std::cos(a), sa = std::sin(a), cp = std::cos(p), sp = std::sin(p);
+    // Pitch (about x, downward) then yaw (about y, rightward)
+    float y = offset.y * cp + offset.z * sp, z = -offset.y * sp + offset.z * cp;
+    return {offset.x * ca + z * sa, y, -offset.x * sa + z * ca};
+}
 
-    frameCount++;
-    ArmorInfo *selectedArmor = nullptr;
+cv::Point3f AimingSolver::worldToView(const cv::Point3f &offset, const GimbalAttitude &attitude) {
+    float a = attitude.yaw * (PI / 180.0f), p = attitude.pitch * (PI / 180.0f);
+    float ca = std::cos(a), sa = std::sin(a), cp = std::cos(p), sp = std::sin(p);
+    // Inverse of viewToWorld()
+    float x = offset.x * ca - offset.z * sa, z = offset.x * sa + offset.z * ca;
+    return {x, offset.y * cp - z * sp, offset.y * sp + z * cp};
+}
 
-    if (armors.empty()) {
+size_t AimingSolver::convertArmors(ArmorList &armors, const cv::Point2f &targetImgPoint, int targetNumber) {
+    const size_t n = armors.size();
+
+    // Squared distances keep the order of the distances
+    auto imgDist2 = [&](size_t i) {
+        return pow2(armors[i].imgCenter.x - targetImgPoint.x) + pow2(armors[i].imgCenter.y - targetImgPoint.y);
+    };
+
+    // Compute ypd, and select out of the armors of the target number if there are any
+    size_t selected = n;
+    for (size_t i = 0; i < n; i++) {
+        auto &armor = armors[i];
+        armor.offset.z += 200;  //FIXME:
+        armor.ypd = xyzToYPD(armor.offset);
+        if (targetNumber != 0 && armor.number != targetNumber) continue;
+        if (selected == n || imgDist2(i) < imgDist2(selected)) selected = i;
+    }
+    if (selected == n) {
+        selected = 0;
+        for (size_t i = 1; i < n; i++) {
+            if (imgDist2(i) < imgDist2(selected)) selected = i;
+        }
+    }
+    return selected;
+}
 
-        tracker.update(nullptr);
+void AimingSolver::updateArmors(ArmorList &armors, TimePoint imageCaptureTime, const GimbalAttitude *attitude) {
 
-    } else {
+    frameCount++;
+    ArmorInfo *selectedArmor = nullptr;
 
-        for (auto &armor : armors) {
-            armor.offset.z += 200;  //FIXME:
-            armor.ypd = xyzToYPD(armor.offset);
-        }
+    // Compute ypd, and find the armor closest to the point required by the Tracker, in case the target is lost
+    size_t selected = armors.size();
+    if (!armors.empty()) selected = convertArmors(armors, tracker.getTargetImgPoint(), tracker.getTargetNumber());
 
-        // Select the armor closest to the point required by the Tracker
-        cv::Point2f targetImgPoint = tracker.getTargetImgPoint();
-        float imgMinDist = 1000000;
-        for (auto &armor : armors) {
-            float imgDist = cv::norm(armor.imgCenter - targetImgPoint);
-            if (imgDist < imgMinDist) {
-                imgMinDist = imgDist;
-                selectedArmor = &armor;
-            }
-        }
+    tracker.update(armors, imageCaptureTime, attitude);
+    if (tracker.targetFound()) selected = tracker.getTargetArmorIndex();  // follow the target track
 
-        // Update
+    if (selected < armors.size()) {
+        selectedArmor = &armors[selected];
         selectedArmor->flags |= ArmorInfo::SELECTED_TARGET;
-        topKiller.update(selectedArmor, imageCaptureTime);  // TopKiller needs to be updated before Tracker
-        tracker.update(selectedArmor);
-
+        topKiller.update(selectedArmor, imageCaptureTime);  // TopKiller needs to be updated before selecting
     }
+    tracker.selectTarget(armors, selected);
 
     if (!topKiller.isTriggered()) {
 
@@ -64,8 +92,14 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
     if (selectedArmor) {
 
         // Aim at the selected armor
-        const auto &xyz = selectedArmor->offset;
-        const auto &ypd = selectedArmor->ypd;
+        cv::Point3f ypd = selectedArmor->ypd;
+        if (params.motion_prediction().enabled() && params.motion_prediction().val() > 0 &&
+            tracker.predictionReady()) {
+            // Where the target will be when the projectile arrives: the command takes effect after commandLatency
+            // (from the frame), then the projectile flies the distance at the bullet speed [m/s] = [mm/ms]
+            float flightTime = ypd.z / params.motion_prediction().val();  // [ms]
+            ypd = xyzToYPD(tracker.predictOffset((commandLatency + flightTime) / 1000.0f));
+        }
         latestCommand.detected = true;
         latestCommand.yawDelta = ypd.x + params.manual_delta_offset().x();
         latestCommand.pitchDelta = ypd.y + params.manual_delta_offset().y();
@@ -108,21 +142,138 @@ void AimingSolver::updateArmors(std::vector<ArmorInfo> &armors, TimePoint imageC
 
 /** Tracker **/
 
-void AimingSolver::Tracker::update(const AimingSolver::ArmorInfo *selectedArmor) {
-    if (selectedArmor == nullptr) {
-        if (tracking) {
-            lostArmorFrameCount++;
-            if (lostArmorFrameCount > params.tracking_life_time()) {
-                // Stop tracking and discard last selected armor
-                tracking = false;
-                lostArmorFrameCount = 0;
+void AimingSolver::Tracker::update(const ArmorList &armors, TimePoint time, const GimbalAttitude *attitude) {
+    const size_t n = armors.size();
+
+    // In the world frame if the attitude is known, so that turning the gimbal is not taken as target motion
+    bool useWorldFrame = (attitude != nullptr);
+    if (useWorldFrame != worldFrame) {
+        tracks.clear();  // positions of the tracks are in the other frame
+        worldFrame = useWorldFrame;
+    }
+    if (attitude) viewAttitude = *attitude;
+    for (size_t i = 0; i < n; i++) {
+        positions[i] = (useWorldFrame ? viewToWorld(armors[i].offset, viewAttitude) : armors[i].offset);
+    }
+
+    // Pairs of a track and an armor close to its prediction, not of another robot
+    size_t candidateCount = 0;
+    for (size_t t = 0; t < tracks.size(); t++) {
+        Track &track = tracks[t];
+        track.armorIndex = -1;
+        cv::Point3f predicted = track.motionFilter.predictAt(time);
+        for (size_t i = 0; i < n; i++) {
+            if (track.number != 0 && armors[i].number != 0 && armors[i].number != track.number) continue;
+            auto distance = (float) cv::norm(positions[i] - predicted);
+            if (distance <= TARGET_SWITCH_DISTANCE) candidates[candidateCount++] = {distance, (uint8_t) t, (uint8_t) i};
+        }
+    }
+
+    // Greedy association, closest pairs first
+    std::sort(candidates.begin(), candidates.begin() + candidateCount,
+              [](const Candidate &a, const Candidate &b) { return a.distance < b.distance; });
+    std::array<bool, MAX_ARMORS> armorMatched{};
+    for (size_t c = 0; c < candidateCount; c++) {
+        const Candidate &candidate = candidates[c];
+        if (tracks[candidate.track].armorIndex != -1 || armorMatched[candidate.armor]) continue;
+        tracks[candidate.track].armorIndex = candidate.armor;
+        armorMatched[candidate.armor] = true;
+    }
+
+    // Update the matched tracks, and discard the ones lost over tracking_life_time
+    const float accelNoise = params.motion_filter_noise().x() * 1000.0f;
+    const float measurementNoise = params.motion_filter_noise().y();
+    for (size_t t = 0; t < tracks.size();) {
+        Track &track = tracks[t];
+        if (track.armorIndex != -1) {
+            const ArmorInfo &armor = armors[track.armorIndex];
+            if (armor.number != 0) track.number = armor.number;
+            track.lostFrameCount = 0;
+            track.motionFilter.setNoise(accelNoise, measurementNoise);
+            track.motionFilter.update(positions[track.armorIndex], time);
+        } else if (++track.lostFrameCount > params.tracking_life_time()) {
+            removeTrack(t);
+            continue;  // the last track is moved here
+        }
+        t++;
+    }
+
+    // New tracks for the other armors
+    for (size_t i = 0; i < n; i++) {
+        if (armorMatched[i]) continue;
+        if (tracks.full()) {
+            // Evict the track lost the longest. There is one, as at most one track is matched to each armor.
+            size_t evicted = tracks.size();
+            for (size_t t = 0; t < tracks.size(); t++) {
+                if (tracks[t].armorIndex == -1 &&
+                    (evicted == tracks.size() || tracks[t].lostFrameCount > tracks[evicted].lostFrameCount)) {
+                    evicted = t;
+                }
+            }
+            removeTrack(evicted);
+        }
+        Track &track = tracks.emplace_back();
+        track.id = nextTrackID++;
+        if (nextTrackID == 0) nextTrackID = 1;  // 0 for no target
+        track.number = armors[i].number;
+        track.armorIndex = (int) i;
+        track.motionFilter.setNoise(accelNoise, measurementNoise);
+        track.motionFilter.reset(positions[i], time);
+    }
+
+    const Track *target = findTrack(targetTrackID);
+    targetArmorFound = (target != nullptr && target->armorIndex != -1);
+    targetArmorIndex = (targetArmorFound ? (size_t) target->armorIndex : n);
+}
+
+void AimingSolver::Tracker::selectTarget(const ArmorList &armors, size_t index) {
+    if (index < armors.size()) {
+        for (const auto &track : tracks) {
+            if (track.armorIndex == (int) index) {
+                targetTrackID = track.id;
+                break;
             }
         }
-    } else {
         tracking = true;
         lostArmorFrameCount = 0;
-        trackingArmor = *selectedArmor;
+        trackingArmor = armors[index];
+    } else if (const Track *target = findTrack(targetTrackID)) {
+        lostArmorFrameCount = target->lostFrameCount;
+    } else {
+        // Stop tracking and discard last selected armor
+        targetTrackID = 0;
+        tracking = false;
+        lostArmorFrameCount = 0;
+    }
+}
+
+AimingSolver::Tracker::Track *AimingSolver::Tracker::findTrack(unsigned id) {
+    if (id == 0) return nullptr;
+    for (auto &track : tracks) {
+        if (track.id == id) return &track;
     }
+    return nullptr;
+}
+
+const AimingSolver::Tracker::Track *AimingSolver::Tracker::findTrack(unsigned id) const {
+    return const_cast<Tracker *>(this)->findTrack(id);
+}
+
+void AimingSolver::Tracker::removeTrack(size_t i) {
+    tracks[i] = tracks[tracks.size() - 1];
+    tracks.pop_back();
+}
+
+cv::Point3f AimingSolver::Tracker::predictOffset(float seconds) const {
+    const Track *target = findTrack(targetTrackID);
+    if (target == nullptr) return trackingArmor.offset;
+    cv::Point3f position = target->motionFilter.predict(seconds);
+    return (worldFrame ? worldToView(position, viewAttitude) : position);
+}
+
+bool AimingSolver::Tracker::predictionReady() const {
+    const Track *target = findTrack(targetTrackID);
+    return target != nullptr && target->motionFilter.ready();
 }
 
 cv::Point2f AimingSolver::Tracker::getTargetImgPoint() {
@@ -135,9 +286,35 @@ cv::Point2f AimingSolver::Tracker::getTargetImgPoint() {
     }
 }
 
+cv::Rect AimingSolver::Tracker::searchWindow(const cv::Size &imgSize) const {
+    if (!tracking) return {};
+
+    cv::Point2f tl = trackingArmor.imgPoints[0], br = tl;
+    for (const auto &point : trackingArmor.imgPoints) {
+        tl.x = std::min(tl.x, point.x);
+        tl.y = std::min(tl.y, point.y);
+        br.x = std::max(br.x, point.x);
+        br.y = std::max(br.y, point.y);
+    }
+    float lostRatio = (float) lostArmorFrameCount / (float) std::max(params.tracking_life_time(), 1);
+    float scale = SEARCH_WINDOW_SCALE * (1 + lostRatio);
+    float halfWidth = std::max((br.x - tl.x) * scale, (float) SEARCH_WINDOW_MIN_SIZE) / 2;
+    float halfHeight = std::max((br.y - tl.y) * scale, (float) SEARCH_WINDOW_MIN_SIZE) / 2;
+    cv::Point2f center = (tl + br) / 2;
+
+    cv::Rect window(cv::Point((int) std::floor(center.x - halfWidth), (int) std::floor(center.y - halfHeight)),
+                    cv::Point((int) std::ceil(center.x + halfWidth), (int) std::ceil(center.y + halfHeight)));
+    return window & cv::Rect(cv::Point(0, 0), imgSize);
+}
+
 void AimingSolver::Tracker::reset() {
+    tracks.clear();
+    targetTrackID = 0;
+    targetArmorIndex = 0;
+    targetArmorFound = false;
     tracking = false;
     lostArmorFrameCount = 0;
+    worldFrame = false;
 }
 
 /** TopKiller **/
@@ -158,16 +335,17 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
         historyChanged = true;
     }
 
-    // Detect new pulses
-    if (armor != nullptr && tracker.tracking) {
+    // Detect new pulses: the target switching to another armor of the same robot, not the target moving
+    if (armor != nullptr && tracker.tracking && !tracker.targetFound()) {
         const ArmorInfo *lastArmor = &tracker.trackingArmor;
-        if (std::abs(armor->offset.y - lastArmor->offset.y) <= params.pulse_max_y_offset() &&
+        bool otherRobot = (armor->number != 0 && lastArmor->number != 0 && armor->number != lastArmor->number);
+        if (!otherRobot &&
+            std::abs(armor->offset.y - lastArmor->offset.y) <= params.pulse_max_y_offset() &&
             std::abs(armor->offset.x - lastArmor->offset.x) >= params.pulse_min_x_offset()) {
 
             // Multiple pulses are triggered at the edge of switching armors
             if (!pulses.empty() && time - pulses.back().endTime <= params.pulse_min_interval() * 10) {
                 PulseInfo lastPulse = pulses.back();
-                pulses.pop_back();
 
                 /*
                  * Completely replace the pulse position with the latest.
@@ -176,7 +354,7 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
                  * Let Control filter the angles and the distance.
                  */
 
-                pulses.emplace_back(PulseInfo{
+                pulses.back() = PulseInfo{
                         {(lastArmor->ypd.x + armor->ypd.x) / 2,
                          (lastArmor->ypd.y + armor->ypd.y) / 2,
                          (lastPulse.ypdMid.z * lastPulse.frameCount + (lastArmor->ypd.z + armor->ypd.z)) /
@@ -185,9 +363,9 @@ void AimingSolver::TopKiller::update(const AimingSolver::ArmorInfo *armor, TimeP
                         (lastPulse.avgTime * lastPulse.frameCount + time) / (lastPulse.frameCount + 1),
                         time,
                         lastPulse.frameCount + 1
-                });
+                };
             } else {
-                pulses.emplace_back(PulseInfo{
+                pulses.push_back(PulseInfo{
                         (lastArmor->ypd + armor->ypd) / 2,
                         time,
                         time,
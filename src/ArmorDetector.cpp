@@ -3,7 +3,13 @@
 //
 
 #include "ArmorDetector.h"
+#include "LightThreshold.h"
+#include "ThreadScheduling.h"
 #include <spdlog/spdlog.h>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <tuple>
 
 using namespace cv;
 
@@ -17,6 +23,12 @@ namespace meta {
  * @deprecated use detect_NG(const cv::Mat &img) instead
  */
 std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect(const Mat &img) {
+    std::vector<DetectedArmor> acceptedArmors;
+    detect(img, acceptedArmors);
+    return acceptedArmors;
+}
+
+void ArmorDetector::detect(const Mat &img, std::vector<DetectedArmor> &acceptedArmors, const Rect &searchROI) {
 
     /*
      * Note: in this mega function, steps are wrapped with {} to reduce local variable pollution and make it easier to
@@ -24,347 +36,853 @@ std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect(const Mat &img)
      * Note: for debug purpose, allows some local variables and single-line compound statements.
      */
 
+    ScopedLatency latency(LatencyStats::INFERENCE);  // the whole legacy detection
+
     // ================================ Setup ================================
     {
         imgOriginal = img;
-        imgGray = imgBrightness = imgColor = imgLights = Mat();
+        imgBrightness = imgColor = imgLights = Mat();  // release last frame's buffers back to the pools
+        acceptedArmors.clear();
+
+        // Everything below only works on the window, in the coordinates of the whole image
+        detectWindow = searchROI & Rect(0, 0, img.cols, img.rows);
+        if (detectWindow.empty()) detectWindow = Rect(0, 0, img.cols, img.rows);
     }
 
-    // ================================ Brightness Threshold ================================
-    {
-        cvtColor(imgOriginal, imgGray, COLOR_BGR2GRAY);
-        threshold(imgGray, imgBrightness, params.brightness_threshold(), 255, THRESH_BINARY);
+    bool tiled = false;
+    if (params.parallel_bands().enabled() && params.parallel_bands().val() > 1) {
+        splitLightBands(detectWindow.y, detectWindow.height, params.parallel_bands().val());
+        tiled = lightBands.size() > 1;
+        bandPool.setWorkerCount((int) lightBands.size() - 1);
     }
 
-    // ================================ Color Threshold ================================
+    // ================================ Brightness and Color Threshold ================================
     {
-        if (params.color_threshold_mode() == ParamSet::HSV) {
-
-            // Convert to HSV color space
-            Mat hsvImg;
-            cvtColor(imgOriginal, hsvImg, COLOR_BGR2HSV);
-
-            if (params.enemy_color() == ParamSet::RED) {
-                // Red color spreads over the 0 (180) boundary, so combine them
-                Mat thresholdImg0, thresholdImg1;
-                inRange(hsvImg, Scalar(0, 0, 0), Scalar(params.hsv_red_hue().max(), 255, 255), thresholdImg0);
-                inRange(hsvImg, Scalar(params.hsv_red_hue().min(), 0, 0), Scalar(180, 255, 255), thresholdImg1);
-                imgColor = thresholdImg0 | thresholdImg1;
-            } else {
-                inRange(hsvImg, Scalar(params.hsv_blue_hue().min(), 0, 0),
-                        Scalar(params.hsv_blue_hue().max(), 255, 255),
-                        imgColor);
+        // Fused into a single pass over the image (see thresholdLightsRow()). The brightness and color images are only
+        // materialized when color morphology needs the color image alone or the terminal asks for them, at the rate
+        // of its fetches.
+        bool colorMorphology = params.contour_erode().enabled() || params.contour_dilate().enabled();
+        bool separateImages = colorMorphology || debugImagesDue();
+        if (separateImages) {
+            imgBrightness = acquireImage(brightnessPool);
+            imgColor = acquireImage(colorPool);
+        }
+        if (!colorMorphology) imgLights = acquireImage(lightsPool);
+        const Range cols(detectWindow.x, detectWindow.x + detectWindow.width);
+        auto thresholdRows = [&](const Range &rows) {
+            Mat lights, brightness, color;  // parts of the outputs, which thresholdLights() writes in place
+            if (!colorMorphology) lights = imgLights(rows, cols);
+            if (separateImages) {
+                brightness = imgBrightness(rows, cols);
+                color = imgColor(rows, cols);
             }
-
+            thresholdLights(imgOriginal(rows, cols), thresholdParams,
+                            colorMorphology ? nullptr : &lights,
+                            separateImages ? &brightness : nullptr,
+                            separateImages ? &color : nullptr);
+        };
+        if (tiled) {
+            bandPool.run((int) lightBands.size(), [&](int i) {
+                thresholdRows(Range(lightBands[i].top, lightBands[i].bottom));
+            });
         } else {
-
-            std::vector<Mat> channels;
-            split(imgOriginal, channels);
-
-            // Filter using channel subtraction
-            int mainChannel = (params.enemy_color() == ParamSet::RED ? 2 : 0);
-            int oppositeChannel = (params.enemy_color() == ParamSet::RED ? 0 : 2);
-            subtract(channels[mainChannel], channels[oppositeChannel], imgColor);
-            threshold(imgColor, imgColor, params.rb_channel_threshold(), 255, THRESH_BINARY);
-
+            thresholdRows(Range(detectWindow.y, detectWindow.y + detectWindow.height));
         }
 
-        // Color erode
-        if (params.contour_erode().enabled()) {
-            Mat element = cv::getStructuringElement(
-                    cv::MORPH_ELLIPSE,
-                    cv::Size(params.contour_erode().val(), params.contour_erode().val()));
-            erode(imgColor, imgColor, element);
-        }
+        if (colorMorphology) {
+            // Color erode
+            if (params.contour_erode().enabled()) {
+                Mat eroded = acquireImage(colorPool);
+                erode(imgColor(detectWindow), eroded(detectWindow), erodeKernel.get(params.contour_erode().val()));
+                imgColor = eroded;
+            }
 
-        // Color dilate
-        if (params.contour_dilate().enabled()) {
-            Mat element = cv::getStructuringElement(
-                    cv::MORPH_ELLIPSE,
-                    cv::Size(params.contour_dilate().val(), params.contour_dilate().val()));
-            dilate(imgColor, imgColor, element);
-        }
+            // Color dilate
+            if (params.contour_dilate().enabled()) {
+                Mat dilated = acquireImage(colorPool);
+                dilate(imgColor(detectWindow), dilated(detectWindow), dilateKernel.get(params.contour_dilate().val()));
+                imgColor = dilated;
+            }
 
-        // Apply filter
-        imgLights = imgBrightness & imgColor;
+            // Apply filter
+            imgLights = acquireImage(lightsPool);
+            bitwise_and(imgBrightness(detectWindow), imgColor(detectWindow), imgLights(detectWindow));
+        }
     }
 
     // ================================ Find Contours ================================
 
+    // Morphology is not tiled, as OpenCV already splits it into stripes in parallel
     // Contour open
     if (params.contour_open().enabled()) {
-        Mat element = cv::getStructuringElement(
-                cv::MORPH_ELLIPSE,
-                cv::Size(params.contour_open().val(), params.contour_open().val()));
-        morphologyEx(imgLights, imgLights, MORPH_OPEN, element);
+        Mat opened = acquireImage(lightsPool);
+        morphologyEx(imgLights(detectWindow), opened(detectWindow), MORPH_OPEN,
+                     openKernel.get(params.contour_open().val()));
+        imgLights = opened;
     }
 
     // Contour close
     if (params.contour_close().enabled()) {
-        Mat element = cv::getStructuringElement(
-                cv::MORPH_ELLIPSE,
-                cv::Size(params.contour_close().val(), params.contour_close().val()));
-        morphologyEx(imgLights, imgLights, MORPH_CLOSE, element);
+        Mat closed = acquireImage(lightsPool);
+        morphologyEx(imgLights(detectWindow), closed(detectWindow), MORPH_CLOSE,
+                     closeKernel.get(params.contour_close().val()));
+        imgLights = closed;
     }
 
     {
         lightRects.clear();
 
-        std::vector<std::vector<Point>> contours;
-        findContours(imgLights, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
-
-        // Filter individual contours
-        for (const auto &contour : contours) {
-
-            // Filter pixel count
-            if (params.contour_pixel_count().enabled()) {
-                if (contour.size() < params.contour_pixel_count().val()) {
-                    continue;
-                }
-            }
-
-            // Filter area size
-            if (params.contour_min_area().enabled()) {
-                double area = contourArea(contour);
-                if (area < params.contour_min_area().val()) {
-                    continue;
-                }
-            }
-
-            // Fit contour using a rotated rect
-            RotatedRect rect;
-            switch (params.contour_fit_function()) {
-                case ParamSet::MIN_AREA_RECT:
-                    rect = minAreaRect(contour);
-                    break;
-                case ParamSet::ELLIPSE:
-                    // There should be at least 5 points to fit the ellipse
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipse(contour);
-                    break;
-                case ParamSet::ELLIPSE_AMS:
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipseAMS(contour);
-                    break;
-                case ParamSet::ELLIPSE_DIRECT:
-                    if (contour.size() < 5) continue;
-                    rect = fitEllipseDirect(contour);
-                    break;
-                default:
-                    assert(!"Invalid params.contour_fit_function()");
-            }
-            canonicalizeRotatedRect(rect);
-            // Now, width: the short edge, height: the long edge, angle: in [0, 180)
-
-            // Filter long edge min length
-            if (params.long_edge_min_length().enabled() && rect.size.height < params.long_edge_min_length().val()) {
-                continue;
-            }
-
-            // Filter angle
-            if (params.light_max_rotation().enabled() &&
-                std::min(rect.angle, 180 - rect.angle) >= params.light_max_rotation().val()) {
-                continue;
-            }
+        if (tiled) {
+            findLightsInBands();
+        } else {
+            // contours is a member, findContours() resizes the vectors in place and keeps their capacity
+            findContours(imgLights(detectWindow), contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, detectWindow.tl());
 
-            // Filter aspect ratio
-            if (params.light_aspect_ratio().enabled()) {
-                double aspectRatio = rect.size.height / rect.size.width;
-                if (!inRange(aspectRatio, params.light_aspect_ratio())) {
-                    continue;
-                }
+            // Filter individual contours
+            for (const auto &contour : contours) {
+                RotatedRect rect;
+                if (fitLight(contour, rect)) lightRects.emplace_back(rect);
             }
-
-            // Accept the rect
-            lightRects.emplace_back(rect);
         }
     }
 
+    // ================================ Combine Lights to Armors ================================
+    combineLights(acceptedArmors);
+
+    classifyNumbers(imgOriginal, acceptedArmors);
+}
+
+void ArmorDetector::combineLights(std::vector<DetectedArmor> &acceptedArmors) {
     // If there is less than two light contours, stop detection
     if (lightRects.size() < 2) {
-        return {};
+        return;
     }
 
-    // Sort lights from left to right based on center X
+    // Sort lights from left to right based on center X, ties broken by the rest so that the order does not depend on
+    // the order of the contours
     sort(lightRects.begin(), lightRects.end(),
-         [](RotatedRect &a1, RotatedRect &a2) {
-             return a1.center.x < a2.center.x;
+         [](const RotatedRect &a1, const RotatedRect &a2) {
+             return std::tie(a1.center.x, a1.center.y, a1.size.width, a1.size.height, a1.angle) <
+                    std::tie(a2.center.x, a2.center.y, a2.size.width, a2.size.height, a2.angle);
          });
 
+    pairLights(acceptedArmors);
+
+    // Filter armors that share lights
+    filterArmorsSharingLights(acceptedArmors);
+}
+
+void ArmorDetector::LightBuffer::resize(size_t n) {
+    for (auto *v : {&centerX, &centerY, &angle, &bottomX, &bottomY, &topX, &topY, &length, &pairAspectRatio}) {
+        v->resize(n);
+    }
+    upward.resize(n);
+    pairAccepted.resize(n);
+}
+
+void ArmorDetector::pairLights(std::vector<DetectedArmor> &acceptedArmors) {
+
     /*
      * OpenCV coordinate: +x right, +y down
+     *
+     *              1 ----------- 2
+     *            |*|             |*|
+     * left light |*|             |*| right light
+     *            |*|             |*|
+     *              0 ----------- 3
+     *
+     * Edges (0, 1) and (2, 3) lie on inner edge
      */
 
-    // ================================ Combine Lights to Armors ================================
-    std::vector<DetectedArmor> acceptedArmors;
-    {
-        std::array<Point2f, 4> armorPoints;
+    const size_t n = lightRects.size();
+    LightBuffer &b = lightBuffer;
+    b.resize(n);
+
+    // Convert the lights once, instead of for each pair
+    float maxLength = 0;
+    for (size_t i = 0; i < n; i++) {
+        const RotatedRect &rect = lightRects[i];  // already canonicalized
+        Point2f points[4];
+        rect.points(points);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
+        Point2f bottom, top;
+        if (rect.angle <= 90) {
+            bottom = (points[0] + points[3]) / 2;
+            top = (points[1] + points[2]) / 2;
+        } else {
+            bottom = (points[1] + points[2]) / 2;
+            top = (points[0] + points[3]) / 2;
+        }
+        b.centerX[i] = rect.center.x;
+        b.centerY[i] = rect.center.y;
+        b.angle[i] = rect.angle;
+        b.bottomX[i] = bottom.x;
+        b.bottomY[i] = bottom.y;
+        b.topX[i] = top.x;
+        b.topY[i] = top.y;
+        b.length[i] = std::hypot(top.x - bottom.x, top.y - bottom.y);
+        b.upward[i] = (top.y <= bottom.y);  // the edge should be upward, or lights intersect
+        maxLength = std::max(maxLength, b.length[i]);
+    }
+
+    // Filters as locals, so that the scoring loop has no loads through this
+    const Filter lengthRatioFilter = filters.lightLengthMaxRatio, xDistFilter = filters.lightXDistOverL;
+    const Filter yDistFilter = filters.lightYDistOverL, angleDiffFilter = filters.lightAngleMaxDiff;
+    const Filter smallFilter = filters.smallArmorAspectRatio, largeFilter = filters.largeArmorAspectRatio;
+
+    for (size_t l = 0; l + 1 < n; l++) {
+        if (!b.upward[l]) continue;
+
+        const float leftCenterX = b.centerX[l], leftCenterY = b.centerY[l], leftAngle = b.angle[l];
+        const float leftBottomX = b.bottomX[l], leftBottomY = b.bottomY[l], leftTopX = b.topX[l], leftTopY = b.topY[l];
+        const float leftLength = b.length[l];
+
         /*
-         *              1 ----------- 2
-         *            |*|             |*|
-         * left light |*|             |*| right light
-         *            |*|             |*|
-         *              0 ----------- 3
-         *
-         * Edges (0, 1) and (2, 3) lie on inner edge
+         * The lights are sorted by x, so the right lights end at the first one too far in x for the X distance filter
+         * with the longest average length it may have with this light: with the longest light, or with the longest
+         * one allowed by the length ratio filter.
          */
+        size_t end = n;
+        if (xDistFilter.enabled) {
+            float maxAverageLength = (leftLength + maxLength) / 2;
+            if (lengthRatioFilter.enabled) {
+                maxAverageLength = std::min(maxAverageLength, leftLength * (1 + lengthRatioFilter.max) / 2);
+            }
+            float maxCenterX = leftCenterX + xDistFilter.max * maxAverageLength * BAND_ROUNDING_SLACK;
+            end = std::upper_bound(b.centerX.begin() + (long) l + 1, b.centerX.end(), maxCenterX) - b.centerX.begin();
+        }
 
-        for (int leftLightIndex = 0; leftLightIndex < lightRects.size() - 1; ++leftLightIndex) {
+        // Score the pairs in the band without branching on any filter. The loop doesn't auto-vectorize: std::sqrt may
+        // set errno (the build has no -fno-math-errno), and the byte stores to pairAccepted may alias the buffer.
+        for (size_t r = l + 1; r < end; r++) {
+            float topDX = b.topX[r] - leftTopX, topDY = b.topY[r] - leftTopY;              // right
+            float bottomDX = b.bottomX[r] - leftBottomX, bottomDY = b.bottomY[r] - leftBottomY;  // right
+            float rightLength = b.length[r];
+            float averageLength = (leftLength + rightLength) / 2;  // also the armor height
+
+            float lengthRatio = std::max(leftLength, rightLength) / std::min(leftLength, rightLength);  // >= 1
+            float xDiffOverAvgL = std::abs(b.centerX[r] - leftCenterX) / averageLength;
+            float yDiffOverAvgL = std::abs(b.centerY[r] - leftCenterY) / averageLength;
+            float angleDiff = std::abs(leftAngle - b.angle[r]);
+            angleDiff = std::min(angleDiff, 180 - angleDiff);
+            float armorWidth = (std::sqrt(topDX * topDX + topDY * topDY) +
+                                std::sqrt(bottomDX * bottomDX + bottomDY * bottomDY)) / 2;
+            float aspectRatio = armorWidth / averageLength;
+
+            bool accepted = b.upward[r] &
+                            (topDX >= 0) & (bottomDX >= 0) &  // top and bottom should be rightward, or lights intersect
+                            (!lengthRatioFilter.enabled | (lengthRatio <= lengthRatioFilter.max)) &
+                            (!xDistFilter.enabled | xDistFilter.contains(xDiffOverAvgL)) &
+                            (!yDistFilter.enabled | yDistFilter.contains(yDiffOverAvgL)) &
+                            (!angleDiffFilter.enabled | (angleDiff <= angleDiffFilter.max)) &
+                            (smallFilter.contains(aspectRatio) | largeFilter.contains(aspectRatio));
+            b.pairAccepted[r] = accepted;
+            b.pairAspectRatio[r] = aspectRatio;
+        }
 
-            const RotatedRect &leftRect = lightRects[leftLightIndex];  // already canonicalized
+        // Accept the armors
+        for (size_t r = l + 1; r < end; r++) {
+            if (!b.pairAccepted[r]) continue;
 
+            std::array<Point2f, 4> armorPoints = {Point2f(leftBottomX, leftBottomY), Point2f(leftTopX, leftTopY),
+                                                  Point2f(b.topX[r], b.topY[r]), Point2f(b.bottomX[r], b.bottomY[r])};
 
-            Point2f leftPoints[4];
-            leftRect.points(leftPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
-            if (leftRect.angle <= 90) {
-                armorPoints[0] = (leftPoints[0] + leftPoints[3]) / 2;
-                armorPoints[1] = (leftPoints[1] + leftPoints[2]) / 2;
-            } else {
-                armorPoints[0] = (leftPoints[1] + leftPoints[2]) / 2;
-                armorPoints[1] = (leftPoints[0] + leftPoints[3]) / 2;
+            // Just use the average X and Y coordinate for the four point
+            Point2f center = {0, 0};
+            for (int i = 0; i < 4; i++) {
+                center.x += armorPoints[i].x;
+                center.y += armorPoints[i].y;
             }
+            center.x /= 4;
+            center.y /= 4;
 
-            auto &leftCenter = leftRect.center;
+            float angleDiff = std::abs(leftAngle - b.angle[r]);
+            if (angleDiffFilter.enabled && angleDiff > 90) angleDiff = 180 - angleDiff;
+
+            acceptedArmors.emplace_back(DetectedArmor{
+                    armorPoints,
+                    center,
+                    !smallFilter.contains(b.pairAspectRatio[r]),  // large armor
+                    0,
+                    {(int) l, (int) r},
+                    angleDiff,
+                    (normalizeLightAngle(leftAngle) + normalizeLightAngle(b.angle[r])) / 2
+            });
+        }
+    }
+}
 
-            for (int rightLightIndex = leftLightIndex + 1; rightLightIndex < lightRects.size(); rightLightIndex++) {
+void ArmorDetector::classifyNumbers(const cv::Mat &img, std::vector<DetectedArmor> &armors) {
+    if (!params.number_classifier().enabled() || !numberClassifier.ready() || armors.empty()) return;
 
-                const RotatedRect &rightRect = lightRects[rightLightIndex];  // already canonicalized
+    numberCorners.clear();
+    numberLargeArmor.clear();
+    for (const auto &armor : armors) {
+        numberCorners.emplace_back(armor.points);
+        numberLargeArmor.emplace_back(armor.largeArmor);
+    }
+    numberClassifier.classify(img, numberCorners, numberLargeArmor, numberResults);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < armors.size(); i++) {
+        const auto &result = numberResults[i];
+        if (result.confidence >= params.number_classifier().val()) {
+            if (result.number == NumberClassifier::NOT_ARMOR) continue;
+            armors[i].number = result.number;
+        }
+        if (kept != i) armors[kept] = armors[i];
+        kept++;
+    }
+    armors.resize(kept);
+}
 
+template<ParamSet::ContourFitFunction FIT>
+bool ArmorDetector::fitLightWith(const std::vector<cv::Point> &contour, RotatedRect &rect) const {
+    // Filter pixel count
+    if (filters.contourPixelCount.enabled) {
+        if (contour.size() < filters.contourPixelCount.min) {
+            return false;
+        }
+    }
 
-                Point2f rightPoints[4];
-                rightRect.points(rightPoints);  // bottomLeft, topLeft, topRight, bottomRight of unrotated rect
-                if (rightRect.angle <= 90) {
-                    armorPoints[3] = (rightPoints[0] + rightPoints[3]) / 2;
-                    armorPoints[2] = (rightPoints[1] + rightPoints[2]) / 2;
-                } else {
-                    armorPoints[3] = (rightPoints[1] + rightPoints[2]) / 2;
-                    armorPoints[2] = (rightPoints[0] + rightPoints[3]) / 2;
-                }
+    // Filter area size
+    if (filters.contourMinArea.enabled) {
+        double area = contourArea(contour);
+        if (area < filters.contourMinArea.min) {
+            return false;
+        }
+    }
 
+    // Fit contour using a rotated rect
+    if constexpr (FIT == ParamSet::MIN_AREA_RECT) {
+        rect = minAreaRect(contour);
+    } else {
+        // There should be at least 5 points to fit the ellipse
+        if (contour.size() < 5) return false;
+        if constexpr (FIT == ParamSet::ELLIPSE) {
+            rect = fitEllipse(contour);
+        } else if constexpr (FIT == ParamSet::ELLIPSE_AMS) {
+            rect = fitEllipseAMS(contour);
+        } else {
+            static_assert(FIT == ParamSet::ELLIPSE_DIRECT, "Invalid contour fit function");
+            rect = fitEllipseDirect(contour);
+        }
+    }
+    return acceptLight(rect);
+}
 
-                auto leftVector = armorPoints[1] - armorPoints[0];   // up
-                if (leftVector.y > 0) {
-                    continue;  // leftVector should be upward, or lights intersect
-                }
-                auto rightVector = armorPoints[2] - armorPoints[3];  // up
-                if (rightVector.y > 0) {
-                    continue;  // rightVector should be upward, or lights intersect
-                }
-                auto topVector = armorPoints[2] - armorPoints[1];    // right
-                if (topVector.x < 0) {
-                    continue;  // topVector should be rightward, or lights intersect
-                }
-                auto bottomVector = armorPoints[3] - armorPoints[0];  // right
-                if (bottomVector.x < 0) {
-                    continue;  // bottomVector should be rightward, or lights intersect
-                }
+bool ArmorDetector::acceptLight(RotatedRect &rect) const {
+    canonicalizeRotatedRect(rect);
+    // Now, width: the short edge, height: the long edge, angle: in [0, 180)
 
+    // Filter long edge min length
+    if (filters.longEdgeMinLength.enabled && rect.size.height < filters.longEdgeMinLength.min) {
+        return false;
+    }
 
-                auto &rightCenter = rightRect.center;
+    // Filter angle
+    if (filters.lightMaxRotation.enabled &&
+        std::min(rect.angle, 180 - rect.angle) >= filters.lightMaxRotation.max) {
+        return false;
+    }
 
-                double leftLength = cv::norm(armorPoints[1] - armorPoints[0]);
-                double rightLength = cv::norm(armorPoints[2] - armorPoints[3]);
-                double averageLength = (leftLength + rightLength) / 2;
+    // Filter aspect ratio
+    if (filters.lightAspectRatio.enabled) {
+        double aspectRatio = rect.size.height / rect.size.width;
+        if (!filters.lightAspectRatio.contains(aspectRatio)) {
+            return false;
+        }
+    }
 
-                // Filter long light length to short light length ratio
-                if (params.light_length_max_ratio().enabled()) {
-                    double lengthRatio = leftLength > rightLength ?
-                                         leftLength / rightLength : rightLength / leftLength;  // >= 1
-                    if (lengthRatio > params.light_length_max_ratio().val()) continue;
-                }
+    return true;
+}
 
-                // Filter central X's difference
-                if (params.light_x_dist_over_l().enabled()) {
-                    double xDiffOverAvgL = abs(leftCenter.x - rightCenter.x) / averageLength;
-                    if (!inRange(xDiffOverAvgL, params.light_x_dist_over_l())) {
-                        continue;
-                    }
-                }
+Mat ArmorDetector::acquireImage(ImagePool &pool) {
+    // Blank outside the window, as the terminal shows the whole image, and the morphology reads around the window
+    return pool.acquire(imgOriginal.size(), CV_8UC1, detectWindow);
+}
 
-                // Filter central Y's difference
-                if (params.light_y_dist_over_l().enabled()) {
-                    double yDiffOverAvgL = abs(leftCenter.y - rightCenter.y) / averageLength;
-                    if (!inRange(yDiffOverAvgL, params.light_y_dist_over_l())) {
-                        continue;
-                    }
-                }
+void ArmorDetector::splitLightBands(int top, int rows, int count) {
+    count = std::clamp(count, 1, std::max(rows / MIN_BAND_ROWS, 1));
+    lightBands.resize(count);
+    bandCuts.clear();
+    for (int i = 0; i < count; i++) {
+        lightBands[i].top = top + rows * i / count;
+        lightBands[i].bottom = top + rows * (i + 1) / count;
+        if (i > 0) bandCuts.emplace_back(lightBands[i].top);
+    }
+}
 
-                // Filter angle difference
-                float angleDiff = std::abs(leftRect.angle - rightRect.angle);
-                if (params.light_angle_max_diff().enabled()) {
-                    if (angleDiff > 90) {
-                        angleDiff = 180 - angleDiff;
-                    }
-                    if (angleDiff > params.light_angle_max_diff().val()) {
-                        continue;
+void ArmorDetector::findBandLights(LightBand &band, bool strip) {
+    band.lights.clear();
+    band.lightContours.clear();
+    band.cutContourRows.clear();
+    band.cutContours.clear();
+
+    findContours(imgLights(Range(band.top, band.bottom), Range(detectWindow.x, detectWindow.x + detectWindow.width)),
+                 band.contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE, Point(detectWindow.x, band.top));
+
+    for (int i = 0; i < (int) band.contours.size(); i++) {
+        const auto &contour = band.contours[i];
+        Rect bound = boundingRect(contour);
+        int first = bound.y, last = bound.y + bound.height - 1;
+
+        // Whether the contour has pixels on the rows right above or below a cut
+        bool reachesCut;
+        if (strip) {
+            auto cut = std::lower_bound(bandCuts.begin(), bandCuts.end(), first);
+            reachesCut = (cut != bandCuts.end() && *cut <= last + 1);
+        } else {
+            reachesCut = (first == band.top && band.top != lightBands.front().top) ||
+                         (last == band.bottom - 1 && band.bottom != lightBands.back().bottom);
+        }
+
+        // Bands take the contours away from the cuts, which are whole, and strips the others
+        if (reachesCut != strip) {
+            if (reachesCut) band.cutContourRows.emplace_back(first, last + 1);
+            continue;
+        }
+        if (strip) band.cutContours.emplace_back(i, bound);
+
+        RotatedRect rect;
+        if (fitLight(contour, rect)) {
+            band.lights.emplace_back(rect);
+            band.lightContours.emplace_back(i);
+        }
+    }
+}
+
+void ArmorDetector::findLightsInBands() {
+    bandPool.run((int) lightBands.size(), [this](int i) { findBandLights(lightBands[i], false); });
+
+    // Strips of rows around the contours reaching the cuts, with a row of margin so that they are not cut again. The
+    // pieces of a contour cut in bands all reach the same cut, so the strips they merge into hold all of it.
+    stripRows.clear();
+    for (const auto &band : lightBands) {
+        for (const auto &rows : band.cutContourRows) {
+            stripRows.emplace_back(std::max(rows.start - 1, lightBands.front().top),
+                                   std::min(rows.end + 1, lightBands.back().bottom));
+        }
+    }
+    std::sort(stripRows.begin(), stripRows.end(), [](const Range &a, const Range &b) { return a.start < b.start; });
+    int stripCount = 0;
+    for (const auto &rows : stripRows) {
+        if (stripCount > 0 && rows.start <= lightStrips[stripCount - 1].bottom) {
+            lightStrips[stripCount - 1].bottom = std::max(lightStrips[stripCount - 1].bottom, rows.end);
+        } else {
+            if ((int) lightStrips.size() == stripCount) lightStrips.emplace_back();
+            lightStrips[stripCount].top = rows.start;
+            lightStrips[stripCount].bottom = rows.end;
+            stripCount++;
+        }
+    }
+    bandPool.run(stripCount, [this](int i) { findBandLights(lightStrips[i], true); });
+
+    for (int s = 0; s < stripCount; s++) {
+        lightRects.insert(lightRects.end(), lightStrips[s].lights.begin(), lightStrips[s].lights.end());
+    }
+
+    // findContours(RETR_EXTERNAL) leaves out contours in holes of others. A band does so itself, except in holes of the
+    // contours reaching the cuts, which may be cut open in the band.
+    for (const auto &band : lightBands) {
+        for (size_t k = 0; k < band.lights.size(); k++) {
+            const Point &p = band.contours[band.lightContours[k]].front();
+            bool inHole = false;
+            for (int s = 0; s < stripCount && !inHole; s++) {
+                const auto &strip = lightStrips[s];
+                for (const auto &[i, bound] : strip.cutContours) {
+                    if (bound.contains(p) && pointPolygonTest(strip.contours[i], p, false) > 0) {
+                        inHole = true;
+                        break;
                     }
                 }
+            }
+            if (!inHole) lightRects.emplace_back(band.lights[k]);
+        }
+    }
+}
 
-                double armorHeight = (cv::norm(leftVector) + cv::norm(rightVector)) / 2;
-                double armorWidth = (cv::norm(topVector) + cv::norm(bottomVector)) / 2;
-
-                // Filter armor aspect ratio
-                bool largeArmor;
-                if (inRange(armorWidth / armorHeight, params.small_armor_aspect_ratio())) {
-                    largeArmor = false;
-                } else if (inRange(armorWidth / armorHeight, params.large_armor_aspect_ratio())) {
-                    largeArmor = true;
-                } else {
-                    continue;
-                }
+void ArmorDetector::setParams(const ParamSet &p) {
+    params = p;
+    thresholdParams = LightThresholdParams::fromParamSet(p);
+
+    filters.contourPixelCount.set(p.contour_pixel_count());
+    filters.contourMinArea.set(p.contour_min_area());
+    filters.longEdgeMinLength.set(p.long_edge_min_length());
+    filters.lightMaxRotation.set(p.light_max_rotation());
+    filters.lightAspectRatio.set(p.light_aspect_ratio());
+    filters.lightLengthMaxRatio.set(p.light_length_max_ratio());
+    filters.lightXDistOverL.set(p.light_x_dist_over_l());
+    filters.lightYDistOverL.set(p.light_y_dist_over_l());
+    filters.lightAngleMaxDiff.set(p.light_angle_max_diff());
+    filters.smallArmorAspectRatio.set(p.small_armor_aspect_ratio());
+    filters.largeArmorAspectRatio.set(p.large_armor_aspect_ratio());
+
+    switch (p.contour_fit_function()) {
+        case ParamSet::ELLIPSE:
+            fitLightFunction = &ArmorDetector::fitLightWith<ParamSet::ELLIPSE>;
+            break;
+        case ParamSet::ELLIPSE_AMS:
+            fitLightFunction = &ArmorDetector::fitLightWith<ParamSet::ELLIPSE_AMS>;
+            break;
+        case ParamSet::ELLIPSE_DIRECT:
+            fitLightFunction = &ArmorDetector::fitLightWith<ParamSet::ELLIPSE_DIRECT>;
+            break;
+        default:
+            fitLightFunction = &ArmorDetector::fitLightWith<ParamSet::MIN_AREA_RECT>;
+            break;
+    }
+#ifdef ON_JETSON
+    requestedModel = p.detector_model();
+    requestedDevice = p.detector_device();
+    requestedContexts = (p.detection_contexts() <= 0 ? Detector::MAX_INFER_SLOTS :
+                         std::min(p.detection_contexts(), Detector::MAX_INFER_SLOTS));
+
+    gpuLightsSupported = true;
+    auto element = [this](const ToggledInt &size) {
+        LightExtractor_CUDA::Element e;  // rows = 0, skipped
+        if (!size.enabled() || size.val() <= 0) return e;
+        if (size.val() > LightExtractor_CUDA::MAX_KERNEL_SIZE) {
+            gpuLightsSupported = false;
+            return e;
+        }
+        return LightExtractor_CUDA::Element::fromMat(getStructuringElement(MORPH_ELLIPSE,
+                                                                           Size(size.val(), size.val())));
+    };
+    lightMorphology.erode = element(p.contour_erode());
+    lightMorphology.dilate = element(p.contour_dilate());
+    lightMorphology.open = element(p.contour_open());
+    lightMorphology.close = element(p.contour_close());
+    if (!gpuLightsSupported) {
+        spdlog::warn("ArmorDetector: morphology larger than {} px, light-bar detection on the CPU",
+                     LightExtractor_CUDA::MAX_KERNEL_SIZE);
+    }
+    // Standard deviation to the length of the axis: sqrt(12) of a uniform segment, 4 of a uniform ellipse
+    componentLengthScale = (p.contour_fit_function() == ParamSet::MIN_AREA_RECT ? std::sqrt(12.0f) : 4.0f);
+#endif
+}
 
+#ifdef ON_JETSON
 
-                // Accept the armor
-                Point2f center = {0, 0};
-                for (int i = 0; i < 4; i++) {
-                    center.x += armorPoints[i].x;
-                    center.y += armorPoints[i].y;
-                }
+ArmorDetector::ArmorDetector() {
+    loadModel(ParamSet::YOLOV5, ParamSet::GPU, Detector::INFER_SLOTS);
+}
 
-                // Just use the average X and Y coordinate for the four point
-                center.x /= 4;
-                center.y /= 4;
-
-                acceptedArmors.emplace_back(DetectedArmor{
-                        armorPoints,
-                        center,
-                        largeArmor,
-                        0,
-                        {leftLightIndex, rightLightIndex},
-                        angleDiff,
-                        (normalizeLightAngle(leftRect.angle) + normalizeLightAngle(rightRect.angle)) / 2
-                });
-            }
+ArmorDetector::~ArmorDetector() {
+    if (modelBuildThread.joinable()) {
+        if (!modelReady) spdlog::info("ArmorDetector: waiting for YOLOv5 engine build to finish...");
+        modelBuildThread.join();
+    }
+}
+
+Detector::precision_t ArmorDetector::yoloPrecision(int dlaCore) {
+    // INT8 needs calibration images, so only use an INT8 engine that can be loaded as is
+    if (YOLODet::is_cache_valid(yoloModelFile(), Detector::precision_t::INT8, dlaCore)) {
+        spdlog::info("ArmorDetector: using INT8 engine{}", dlaCore >= 0 ? " on DLA" : "");
+        return Detector::precision_t::INT8;
+    }
+    return Detector::precision_t::FP16;
+}
+
+void ArmorDetector::loadModel(ParamSet::DetectorModel which, ParamSet::DetectorDevice device, int contexts) {
+    modelReady = false;
+    model.reset();
+    trackingModel.reset();
+    loadedModel = which;
+    loadedDevice = device;
+    loadedContexts = contexts;
+
+    if (which == ParamSet::NANODET) {
+        if (device != ParamSet::GPU) spdlog::warn("ArmorDetector: NanoDet only runs on GPU");
+        // Prebuilt with trtexec, only deserialized
+        auto precision = Detector::precision_t::FP16;
+        if (NanoDet_TensorRT::is_engine_ready(nanoDetModelFile(), precision)) {
+            model = std::make_unique<NanoDet_TensorRT>(nanoDetModelFile(), precision);
+            modelReady = true;
+        } else {
+            spdlog::error("ArmorDetector: no NanoDet engine {}, using legacy detection",
+                          Detector::engine_file(nanoDetModelFile(), precision));
         }
+        return;
     }
 
-    // Filter armors that share lights
-    {
-        while(true) {
-            auto it = filterAcceptedArmorsToRemove(acceptedArmors);
-            if (it == acceptedArmors.end()) break;  // nothing to remove
-            acceptedArmors.erase(it);       // remove the armor
-            // continue to try again
+    if (!std::filesystem::exists(yoloModelFile())) {
+        // Hashed for the engine cache and parsed to build it, both of which would abort without it
+        spdlog::error("ArmorDetector: no YOLOv5 model {}, using legacy detection", yoloModelFile());
+        return;
+    }
+    int dlaCore = -1;
+    if (device != ParamSet::GPU) {
+        if (YOLODet::dla_core_count() > DLA_CORE) {
+            dlaCore = DLA_CORE;
+        } else {
+            spdlog::warn("ArmorDetector: no DLA on this device, running YOLOv5 on GPU");
+            device = ParamSet::GPU;
+        }
+    }
+    // Full frames on DLA, and the smaller search regions on GPU at the input sizes of its profiles
+    bool gpuTracking = (device == ParamSet::DLA_SEARCH_GPU_TRACK);
+    auto precision = yoloPrecision(dlaCore);
+    auto trackingPrecision = (gpuTracking ? yoloPrecision() : precision);
+    auto load = [this, precision, trackingPrecision, dlaCore, gpuTracking, contexts] {
+        model = std::make_unique<YOLODet>(yoloModelFile(), precision, "", true, true, dlaCore, contexts);
+        if (gpuTracking) {
+            trackingModel = std::make_unique<YOLODet>(yoloModelFile(), trackingPrecision, "", true, true, -1,
+                                                      contexts);
         }
+    };
+
+    if (YOLODet::is_cache_valid(yoloModelFile(), precision, dlaCore) &&
+        (!gpuTracking || YOLODet::is_cache_valid(yoloModelFile(), trackingPrecision))) {
+        load();
+        modelReady = true;
+    } else {
+        spdlog::warn("ArmorDetector: building YOLOv5 engine in background, using legacy detection until ready");
+        modelBuildThread = std::thread([this, load] {
+            load();
+            modelReady.store(true, std::memory_order_release);
+            spdlog::info("ArmorDetector: YOLOv5 engine ready");
+        });
     }
+}
 
-    return acceptedArmors;
+void ArmorDetector::switchModelIfRequested() {
+    if (!modelSwitchRequested_NG() || !pendingFrames.empty()) return;
+    if (modelBuildThread.joinable()) modelBuildThread.join();  // done
+    spdlog::info("ArmorDetector: switching detector model to {} on {}, {} contexts",
+                 ParamSet::DetectorModel_Name(requestedModel), ParamSet::DetectorDevice_Name(requestedDevice),
+                 requestedContexts);
+    loadModel(requestedModel, requestedDevice, requestedContexts);
+}
+
+bool ArmorDetector::modelSwitchRequested_NG() const {
+    if (requestedModel == loadedModel && requestedDevice == loadedDevice && requestedContexts == loadedContexts) {
+        return false;
+    }
+    // NanoDet has the default slots only
+    if (requestedModel == ParamSet::NANODET && requestedModel == loadedModel && requestedDevice == loadedDevice) {
+        return false;
+    }
+    return !modelBuildThread.joinable() || isModelReady();  // switch once the build in progress is done
+}
+
+int ArmorDetector::maxPendingFrames_NG() const {
+    if (!isModelReady()) return Detector::INFER_SLOTS;
+    int slots = model->infer_slots();
+    if (trackingModel) slots = std::min(slots, trackingModel->infer_slots());
+    return std::min(slots, LightExtractor_CUDA::SLOTS);
+}
+
+Detector *ArmorDetector::modelFor(const cv::Rect &searchROI) const {
+    return (trackingModel && !searchROI.empty()) ? trackingModel.get() : model.get();
 }
-#ifdef ON_JETSON
 
 /**
- * @brief detect armor (with YOLOv5)
+ * @brief detect armor (with YOLOv5 or NanoDet)
  * @param img: input image
+ * @param searchROI: region of the tracked target (tracking model or light bars), empty for the whole image
+ * @param format: format of img, raw Bayer if the source captures raw frames
  * @return detected armors
  */
-std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect_NG(const cv::Mat &img) {
-    imgOriginal = img;
-    // Calculate inference time in ms, with high precision
-    auto start = std::chrono::high_resolution_clock::now();
-    std::vector<YOLODet::bbox_t> detectResults = yoloModel(img);
-    auto end = std::chrono::high_resolution_clock::now();
-    double inferenceTime = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(end - start).count();
-    spdlog::debug("Inference time: {} ms", inferenceTime);
+std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect_NG(const cv::Mat &img, const cv::Rect &searchROI,
+                                                                   const BayerFormat &format) {
+    submit_NG(img, searchROI, format);
+    return collect_NG();
+}
+
+cv::Rect ArmorDetector::trackingSearchROI(const cv::Size &imgSize, const cv::Point2f &center,
+                                          const cv::Size &minSize) const {
+    const Detector *detector = (trackingModel ? trackingModel.get() : model.get());  // the one run on regions
+    cv::Size inputSize = (minSize.empty() ? detector->input_size() : detector->fitting_input_size(minSize));
+    int width = std::min(inputSize.width, imgSize.width);
+    int height = std::min(inputSize.height, imgSize.height);
+    int x = std::clamp((int) std::round(center.x) - width / 2, 0, imgSize.width - width);
+    int y = std::clamp((int) std::round(center.y) - height / 2, 0, imgSize.height - height);
+    return {x, y, width, height};
+}
+
+void ArmorDetector::submit_NG(const cv::Mat &img, const cv::Rect &searchROI, const BayerFormat &format) {
+    switchModelIfRequested();
+    const bool ready = isModelReady();
+
+    // The lights on the GPU without the model, or with it for light fusion. The terminal tunes the thresholds on the
+    // intermediate images, which only detect() makes.
+    const bool gpuLights = gpuLightsSupported && (ready ? params.light_fusion() : !debugImagesRequested());
+    if (!ready && !gpuLights) {
+        cv::Mat bgr;
+        bayerToBGR(img, format, bgr);  // no-op for BGR8
+        PendingFrame frame{0, nullptr, bgr, true, {}};
+        detect(bgr, frame.legacyResults, searchROI);
+        frame.legacyBrightness = imgBrightness;  // pooled buffers, not reused while referenced here
+        frame.legacyColor = imgColor;
+        frame.legacyLights = imgLights;
+        frame.legacyLightRects = lightRects;
+        pendingFrames.emplace_back(std::move(frame));
+        return;
+    }
+
+    PendingFrame frame{0, nullptr, img, false, {}};
+    if (gpuLights) {
+        cv::Rect window = searchROI & cv::Rect(0, 0, img.cols, img.rows);
+        if (window.empty()) window = cv::Rect(0, 0, img.cols, img.rows);
+        frame.gpuLights = true;
+        frame.lightsTicket = lightExtractor.submit(img, format, window, thresholdParams, lightMorphology);
+    }
+    if (ready) {
+        Detector *detector = modelFor(searchROI);
+        BayerFormat inputFormat = format;
+        if (format.raw() && !detector->supports_raw()) {
+            bayerToBGR(img, format, frame.img);  // on the CPU for models without raw input
+            inputFormat = BayerFormat();
+        }
+        frame.ticket = detector->submit(frame.img, searchROI, inputFormat);
+        frame.detector = detector;
+    }
+    pendingFrames.emplace_back(std::move(frame));
+}
+
+std::vector<ArmorDetector::DetectedArmor> ArmorDetector::collect_NG() {
+    PendingFrame frame = std::move(pendingFrames.front());
+    pendingFrames.pop_front();
+    imgOriginal = frame.img;
+    if (frame.legacy) {
+        // Those of this frame rather than of the last detect(), which may be of a frame submitted after it
+        imgBrightness = std::move(frame.legacyBrightness);
+        imgColor = std::move(frame.legacyColor);
+        imgLights = std::move(frame.legacyLights);
+        lightRects = std::move(frame.legacyLightRects);
+        return std::move(frame.legacyResults);
+    }
+
+    std::vector<DetectedArmor> lightArmors;
+    if (frame.gpuLights) collectGpuLights(frame.lightsTicket, lightArmors);
+    if (frame.detector == nullptr) {
+        classifyNumbers(imgOriginal, lightArmors);
+        latencyStats().recordMs(LatencyStats::INFERENCE, lightExtractor.lastGpuTime());
+        return lightArmors;
+    }
+
+    std::vector<Detector::bbox_t> detectResults = frame.detector->collect(frame.ticket);
+
+    auto acceptStart = LatencyClock::now();
+    auto acceptedArmors = acceptModelResults(detectResults);
+    if (frame.gpuLights) addMissedLightArmors(acceptedArmors, lightArmors);
+    classifyNumbers(imgOriginal, acceptedArmors);
+    const auto &timing = frame.detector->last_timing();
+    latencyStats().recordMs(LatencyStats::PREPROCESS, timing.preprocess_ms);
+    latencyStats().recordMs(LatencyStats::INFERENCE, timing.inference_ms);
+    latencyStats().recordMs(LatencyStats::POSTPROCESS, timing.postprocess_ms +
+            std::chrono::duration<float, std::milli>(LatencyClock::now() - acceptStart).count());
+    return acceptedArmors;
+}
+
+std::vector<std::vector<ArmorDetector::DetectedArmor>> ArmorDetector::detectBatch_NG(
+        const std::vector<cv::Mat> &imgs, const std::vector<cv::Rect> &searchROIs,
+        const std::vector<BayerFormat> &formats) {
+    auto roiOf = [&](size_t i) { return i < searchROIs.size() ? searchROIs[i] : cv::Rect(); };
+    auto formatOf = [&](size_t i) { return i < formats.size() ? formats[i] : BayerFormat(); };
+
+    std::vector<std::vector<DetectedArmor>> results;
+    results.reserve(imgs.size());
+    switchModelIfRequested();
+    if (!isModelReady()) {
+        for (size_t i = 0; i < imgs.size(); i++) {
+            cv::Mat bgr;
+            bayerToBGR(imgs[i], formatOf(i), bgr);  // no-op for BGR8
+            detect(bgr, results.emplace_back(), roiOf(i));
+        }
+        return results;
+    }
+
+    // Frames the model takes, debayered on the CPU for models without raw input
+    std::vector<cv::Mat> inputs(imgs.size());
+    std::vector<cv::Rect> rois(imgs.size());
+    std::vector<BayerFormat> inputFormats(imgs.size());
+    for (size_t i = 0; i < imgs.size(); i++) {
+        inputs[i] = imgs[i];
+        rois[i] = roiOf(i);
+        inputFormats[i] = formatOf(i);
+        if (inputFormats[i].raw() && !model->supports_raw()) {
+            bayerToBGR(imgs[i], inputFormats[i], inputs[i]);
+            inputFormats[i] = BayerFormat();
+        }
+    }
+
+    // Split into batches of the model, up to infer_slots() of which are in flight at the same time
+    size_t batchSize = model->batch_size();
+    std::deque<Detector::ticket_t> tickets;
+    auto collectOldest = [&] {
+        for (const auto &detectResults : model->collect_batch(tickets.front())) {
+            results.emplace_back(acceptModelResults(detectResults));
+            classifyNumbers(inputs[results.size() - 1], results.back());
+        }
+        tickets.pop_front();
+    };
+    for (size_t i = 0; i < inputs.size(); i += batchSize) {
+        if ((int) tickets.size() == model->infer_slots()) collectOldest();
+        size_t end = std::min(i + batchSize, inputs.size());
+        tickets.emplace_back(model->submit_batch(std::vector<cv::Mat>(inputs.begin() + i, inputs.begin() + end),
+                                                 std::vector<cv::Rect>(rois.begin() + i, rois.begin() + end),
+                                                 std::vector<BayerFormat>(inputFormats.begin() + i,
+                                                                          inputFormats.begin() + end)));
+    }
+    while (!tickets.empty()) collectOldest();
+
+    imgOriginal = inputs.front();
+    return results;
+}
+
+bool ArmorDetector::fitComponentLight(const LightExtractor_CUDA::Component &c, const cv::Point &offset,
+                                      RotatedRect &rect) const {
+    if (filters.contourPixelCount.enabled && c.boundaryCount < filters.contourPixelCount.min) return false;
+    if (filters.contourMinArea.enabled && c.count < filters.contourMinArea.min) return false;
+
+    // Covariance of the pixels, each of them a unit square (variance 1/12 along each axis)
+    const double n = c.count;
+    const double meanX = c.sumX / n, meanY = c.sumY / n;
+    const double xx = c.sumXX / n - meanX * meanX + 1.0 / 12;
+    const double yy = c.sumYY / n - meanY * meanY + 1.0 / 12;
+    const double xy = c.sumXY / n - meanX * meanY;
+
+    // Principal axes
+    const double halfDiff = (xx - yy) / 2, halfSum = (xx + yy) / 2;
+    const double r = std::sqrt(halfDiff * halfDiff + xy * xy);
+    const double major = std::sqrt(halfSum + r), minor = std::sqrt(std::max(halfSum - r, 0.0));
+    const double angle = 0.5 * std::atan2(2 * xy, xx - yy) * 180 / CV_PI;  // of the major axis
+
+    rect = RotatedRect(Point2f((float) (offset.x + c.originX + meanX), (float) (offset.y + c.originY + meanY)),
+                       Size2f((float) (major * componentLengthScale), (float) (minor * componentLengthScale)),
+                       (float) angle);
+    return acceptLight(rect);
+}
+
+void ArmorDetector::collectGpuLights(uint64_t ticket, std::vector<DetectedArmor> &acceptedArmors) {
+    int count;
+    cv::Point offset;
+    const auto *components = lightExtractor.collect(ticket, count, offset);
+    imgBrightness = imgColor = imgLights = Mat();
+
+    lightRects.clear();
+    for (int i = 0; i < count; i++) {
+        RotatedRect rect;
+        if (fitComponentLight(components[i], offset, rect)) lightRects.emplace_back(rect);
+    }
+    combineLights(acceptedArmors);
+}
+
+void ArmorDetector::addMissedLightArmors(std::vector<DetectedArmor> &armors,
+                                         const std::vector<DetectedArmor> &lightArmors) {
+    const size_t modelCount = armors.size();
+    for (const auto &lightArmor : lightArmors) {
+        bool overlapped = false;
+        for (size_t k = 0; k < modelCount && !overlapped; k++) {
+            overlapped = pointPolygonTest(armors[k].points, lightArmor.center, false) >= 0 ||
+                         pointPolygonTest(lightArmor.points, armors[k].center, false) >= 0;
+        }
+        if (!overlapped) armors.emplace_back(lightArmor);
+    }
+}
+
+std::vector<ArmorDetector::DetectedArmor> ArmorDetector::acceptModelResults(const std::vector<Detector::bbox_t> &detectResults) const {
     std::vector<DetectedArmor> acceptedArmors_NG;
 
     int cnt = 0;
@@ -382,9 +900,9 @@ std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect_NG(const cv::Mat
             double armorWidth = (cv::norm(topVector) + cv::norm(bottomVector)) / 2;
 
             bool largeArmor;
-            if (inRange(armorWidth / armorHeight, params.small_armor_aspect_ratio())) {
+            if (filters.smallArmorAspectRatio.contains(armorWidth / armorHeight)) {
                 largeArmor = false;
-            } else if (inRange(armorWidth / armorHeight, params.large_armor_aspect_ratio())) {
+            } else if (filters.largeArmorAspectRatio.contains(armorWidth / armorHeight)) {
                 largeArmor = true;
             } else {
                 continue;
@@ -406,7 +924,7 @@ std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect_NG(const cv::Mat
             acceptedArmors_NG.emplace_back(DetectedArmor{armorPoints,
                                                       center,
                                                       largeArmor,
-                                                      0,
+                                                      NumberClassifier::numberOfYOLOTag(armor.tag_id),
                                                       {0 ,0},
                                                       angleDiff,
                                                       (normalizeLightAngle(leftAngle) +\
@@ -418,24 +936,105 @@ std::vector<ArmorDetector::DetectedArmor> ArmorDetector::detect_NG(const cv::Mat
     return acceptedArmors_NG;
 }
 #endif
-std::vector<ArmorDetector::DetectedArmor>::iterator
-ArmorDetector::filterAcceptedArmorsToRemove(std::vector<DetectedArmor> &acceptedArmors) const {
-    for (auto it = acceptedArmors.begin(); it != acceptedArmors.end(); ++it) {
-        for (auto it2 = it + 1; it2 != acceptedArmors.end(); ++it2) {
-            if (it->lightIndex[0] == it2->lightIndex[0] || it->lightIndex[0] == it2->lightIndex[1] ||
-                it->lightIndex[1] == it2->lightIndex[0] || it->lightIndex[1] == it2->lightIndex[1]) {
-                // Share light
-
-                if (it->largeArmor != it2->largeArmor) {  // one small one large, prioritize small
-                    return it->largeArmor ? it : it2;
-                }
 
-                // Remove the one that has lights more nonparallel
-                return (it->lightAngleDiff > it2->lightAngleDiff) ? it : it2;
+cv::Mat ArmorDetector::ImagePool::acquire(const cv::Size &size, int type, const cv::Rect &window) {
+    const Rect whole(Point(0, 0), size);
+    Buffer *free = nullptr;
+
+    // Prefer a free buffer that already has the right size
+    for (auto &buffer : buffers) {
+        const Mat &image = buffer.image;
+        if (image.u && image.u->refcount == 1 && image.size() == size && image.type() == type) {
+            free = &buffer;
+            break;
+        }
+    }
+    if (!free) {
+        for (auto &buffer : buffers) {
+            if (buffer.image.empty() || buffer.image.u->refcount == 1) {
+                buffer.image.create(size, type);  // of another size or type, reallocated
+                lockBuffer(buffer.image.datastart, buffer.image.dataend - buffer.image.datastart);
+                buffer.written = whole;
+                free = &buffer;
+                break;
             }
         }
     }
-    return acceptedArmors.end();  // nothing to remove
+
+    if (!free) {  // all in use
+        Mat image(size, type);
+        blankOutside(image, whole, window);
+        return image;
+    }
+    blankOutside(free->image, free->written, window);
+    free->written = window;
+    return free->image;
+}
+
+void ArmorDetector::ImagePool::blankOutside(Mat &image, const Rect &written, const Rect &window) {
+    auto blank = [&](int top, int bottom, int left, int right) {
+        if (top < bottom && left < right) image(Range(top, bottom), Range(left, right)).setTo(0);
+    };
+    const int top = std::max(written.y, window.y), bottom = std::min(written.br().y, window.br().y);
+    blank(written.y, std::min(written.br().y, window.y), written.x, written.br().x);  // above the window
+    blank(std::max(written.y, window.br().y), written.br().y, written.x, written.br().x);  // below
+    blank(top, bottom, written.x, std::min(written.br().x, window.x));  // left
+    blank(top, bottom, std::max(written.x, window.br().x), written.br().x);  // right
+}
+
+void ArmorDetector::filterArmorsSharingLights(std::vector<DetectedArmor> &acceptedArmors) {
+    /*
+     * The original algorithm finds the first pair (i, j), i < j, of armors sharing a light, removes one of them, and
+     * starts over. Removal never creates new sharing, so once no armor after i shares a light with i, it never will,
+     * and the i of the first pair never goes back. For each i in order, the j of the pair is the next remaining armor
+     * after i on either of its lights. As both i and removed armors only go forward on each light, a cursor per light
+     * finds them with a single pass over the armors of the light.
+     */
+    const int armorCount = (int) acceptedArmors.size();
+    const int lightCount = (int) lightRects.size();
+    if (armorCount < 2) return;
+
+    // Armors of each light, in order
+    lightArmorBegin.assign(lightCount + 1, 0);
+    for (const auto &armor : acceptedArmors) {
+        lightArmorBegin[armor.lightIndex[0] + 1]++;
+        lightArmorBegin[armor.lightIndex[1] + 1]++;
+    }
+    for (int light = 0; light < lightCount; light++) lightArmorBegin[light + 1] += lightArmorBegin[light];
+    lightArmors.resize(lightArmorBegin[lightCount]);
+    lightArmorCursor.assign(lightArmorBegin.begin(), lightArmorBegin.end() - 1);
+    for (int k = 0; k < armorCount; k++) {
+        for (int light : acceptedArmors[k].lightIndex) lightArmors[lightArmorCursor[light]++] = k;
+    }
+    lightArmorCursor.assign(lightArmorBegin.begin(), lightArmorBegin.end() - 1);
+    armorRemoved.assign(armorCount, false);
+
+    // Next remaining armor after i on the light, or armorCount
+    auto nextSharingArmor = [&](int light, int i) {
+        int &cursor = lightArmorCursor[light];
+        while (cursor < lightArmorBegin[light + 1] && (lightArmors[cursor] <= i || armorRemoved[lightArmors[cursor]])) {
+            cursor++;
+        }
+        return cursor < lightArmorBegin[light + 1] ? lightArmors[cursor] : armorCount;
+    };
+
+    for (int i = 0; i < armorCount; i++) {
+        const auto &lightIndex = acceptedArmors[i].lightIndex;
+        while (!armorRemoved[i]) {
+            int j = std::min(nextSharingArmor(lightIndex[0], i), nextSharingArmor(lightIndex[1], i));
+            if (j == armorCount) break;  // nothing shares a light with i
+            armorRemoved[shouldRemoveFirstOfSharingPair(acceptedArmors[i], acceptedArmors[j]) ? i : j] = true;
+        }
+    }
+
+    int remaining = 0;
+    for (int k = 0; k < armorCount; k++) {
+        if (!armorRemoved[k]) {
+            if (remaining != k) acceptedArmors[remaining] = acceptedArmors[k];
+            remaining++;
+        }
+    }
+    acceptedArmors.erase(acceptedArmors.begin() + remaining, acceptedArmors.end());
 }
 
 void ArmorDetector::drawRotatedRect(Mat &img, const RotatedRect &rect, const Scalar &boarderColor) {
@@ -0,0 +1,84 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "BayerFormat.h"
+#include <opencv2/imgproc.hpp>
+
+namespace meta {
+
+namespace {
+
+// OpenCV names a Bayer pattern by the 2x2 block starting from the second row and the second column
+int cvtColorCode(BayerPattern pattern) {
+    switch (pattern) {
+        case BayerPattern::RGGB: return cv::COLOR_BayerBG2BGR;
+        case BayerPattern::GRBG: return cv::COLOR_BayerGB2BGR;
+        case BayerPattern::GBRG: return cv::COLOR_BayerGR2BGR;
+        case BayerPattern::BGGR: return cv::COLOR_BayerRG2BGR;
+        default: return -1;
+    }
+}
+
+void buildGainLUT(float gain, uint8_t lut[256]) {
+    for (int v = 0; v < 256; v++) lut[v] = cv::saturate_cast<uint8_t>(v * gain);
+}
+
+}
+
+void bayerToBGR(const cv::Mat &src, const BayerFormat &format, cv::Mat &dst, bool halfSize) {
+    if (!format.raw() || src.empty()) {
+        dst = src;
+        return;
+    }
+    CV_Assert(src.type() == CV_8UC1);
+
+    if (!halfSize) {
+        cv::cvtColor(src, dst, cvtColorCode(format.pattern));
+        if (format.gains[0] != 1 || format.gains[1] != 1 || format.gains[2] != 1) {
+            cv::multiply(dst, cv::Scalar(format.gains[2], format.gains[1], format.gains[0]), dst);  // saturated
+        }
+        return;
+    }
+
+    uint8_t lutR[256], lutG[256], lutB[256];
+    buildGainLUT(format.gains[0], lutR);
+    buildGainLUT(format.gains[1], lutG);
+    buildGainLUT(format.gains[2], lutB);
+
+    const cv::Mat in = src;  // keep the pixels if dst is src
+    const int rx = format.redX(), ry = format.redY();
+    dst.create(in.rows / 2, in.cols / 2, CV_8UC3);
+    for (int y = 0; y < dst.rows; y++) {
+        const uint8_t *rows[2] = {in.ptr<uint8_t>(2 * y), in.ptr<uint8_t>(2 * y + 1)};
+        const uint8_t *redRow = rows[ry], *blueRow = rows[1 - ry];
+        auto *out = dst.ptr<uint8_t>(y);
+        for (int x = 0; x < dst.cols; x++, out += 3) {
+            int r = redRow[2 * x + rx], b = blueRow[2 * x + 1 - rx];
+            int g = (redRow[2 * x + 1 - rx] + blueRow[2 * x + rx] + 1) / 2;
+            out[0] = lutB[b];
+            out[1] = lutG[g];
+            out[2] = lutR[r];
+        }
+    }
+}
+
+void estimateWhiteBalance(const cv::Mat &src, BayerFormat &format) {
+    CV_Assert(src.type() == CV_8UC1 && format.raw());
+    const int rx = format.redX(), ry = format.redY();
+    double sum[3] = {0, 0, 0};  // R, G, B
+    for (int y = 0; y + 1 < src.rows; y += 2) {
+        const uint8_t *redRow = src.ptr<uint8_t>(y + ry), *blueRow = src.ptr<uint8_t>(y + 1 - ry);
+        for (int x = 0; x + 1 < src.cols; x += 2) {
+            sum[0] += redRow[x + rx];
+            sum[1] += redRow[x + 1 - rx] + blueRow[x + rx];
+            sum[2] += blueRow[x + 1 - rx];
+        }
+    }
+    sum[1] /= 2;
+    format.gains[0] = (sum[0] > 0 ? (float) (sum[1] / sum[0]) : 1.0f);
+    format.gains[1] = 1.0f;
+    format.gains[2] = (sum[2] > 0 ? (float) (sum[1] / sum[2]) : 1.0f);
+}
+
+}
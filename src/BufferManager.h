@@ -20,6 +20,7 @@
 
 
 #include "NvInfer.h"
+#include "GpuMemoryPool.h"
 #include "common.h"
 #include "half.h"
 #include <cassert>
@@ -183,7 +184,7 @@ namespace meta
     public:
         bool operator()(void** ptr, size_t size) const
         {
-            return cudaMalloc(ptr, size) == cudaSuccess;
+            return (*ptr = GpuMemoryPool::instance().allocate(size)) != nullptr;
         }
     };
 
@@ -192,7 +193,7 @@ namespace meta
     public:
         void operator()(void* ptr) const
         {
-            cudaFree(ptr);
+            GpuMemoryPool::instance().free(ptr);
         }
     };
 
@@ -4,8 +4,7 @@ namespace rm {
 
 // CRC8 generator polynomial: G(x) = x8+x5+x4+1
 
-const uint8_t CRC8_INIT = 0xff;
-const uint8_t CRC8_TAB[256] =
+constexpr uint8_t CRC8_TAB[256] =
         {
                 0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83, 0xc2, 0x9c, 0x7e, 0x20, 0xa3, 0xfd, 0x1f, 0x41,
                 0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e, 0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc,
@@ -25,19 +24,40 @@ const uint8_t CRC8_TAB[256] =
                 0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7, 0xb6, 0xe8, 0x0a, 0x54, 0xd7, 0x89, 0x6b, 0x35,
         };
 
-uint8_t getCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint8_t ucCRC8 = CRC8_INIT;
-    uint8_t ucIndex;
+/*
+ * Slicing-by-8: table k gives the CRC of a byte followed by k zero bytes. As the CRCs are linear, the CRC after 8 bytes
+ * is the XOR of one lookup per byte, the 8 of which are independent instead of a chain of 8 dependent lookups.
+ * The tables are derived from the byte tables at compile time.
+ */
 
-    while (dwLength--) {
-        ucIndex = ucCRC8 ^ (*pchMessage++);
-        ucCRC8 = CRC8_TAB[ucIndex];
+struct CRC8Tables {
+    uint8_t t[8][256];
+
+    constexpr CRC8Tables() : t() {
+        for (int i = 0; i < 256; i++) t[0][i] = CRC8_TAB[i];
+        for (int k = 1; k < 8; k++) {
+            for (int i = 0; i < 256; i++) t[k][i] = t[0][t[k - 1][i]];
+        }
+    }
+};
+
+constexpr CRC8Tables CRC8_SLICES;
+
+uint8_t updateCRC8(uint8_t crc, const uint8_t *data, size_t length) {
+    const auto &t = CRC8_SLICES.t;
+    for (; length >= 8; length -= 8, data += 8) {
+        crc = t[7][crc ^ data[0]] ^ t[6][data[1]] ^ t[5][data[2]] ^ t[4][data[3]] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
     }
+    while (length--) crc = t[0][crc ^ *data++];
+    return crc;
+}
 
-    return (ucCRC8);
+uint8_t getCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    return updateCRC8(CRC8_INIT, pchMessage, dwLength);
 }
 
-bool verifyCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
+bool verifyCRC8CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
     unsigned char ucExpected;
 
     if ((pchMessage == nullptr) || (dwLength <= 2)) return false;
@@ -51,12 +71,11 @@ void appendCRC8CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
 
     if ((pchMessage == nullptr) || (dwLength <= 2)) return;
 
-    ucCRC = getCRC8CheckSum((unsigned char *) pchMessage, dwLength - 1);
+    ucCRC = getCRC8CheckSum(pchMessage, dwLength - 1);
     pchMessage[dwLength - 1] = ucCRC;
 }
 
-uint16_t CRC_INIT = 0xffff;
-const uint16_t wCRC_Table[256] =
+constexpr uint16_t wCRC_Table[256] =
         {
                 0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
                 0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
@@ -92,23 +111,39 @@ const uint16_t wCRC_Table[256] =
                 0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
         };
 
-uint16_t getCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
-    uint16_t wCRC = CRC_INIT;
-    uint8_t chData;
+struct CRC16Tables {
+    uint16_t t[8][256];
 
-    if (pchMessage == nullptr) {
-        return 0xFFFF;
+    constexpr CRC16Tables() : t() {
+        for (int i = 0; i < 256; i++) t[0][i] = wCRC_Table[i];
+        for (int k = 1; k < 8; k++) {
+            for (int i = 0; i < 256; i++) t[k][i] = (uint16_t) ((t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff]);
+        }
     }
+};
+
+constexpr CRC16Tables CRC16_SLICES;
 
-    while (dwLength--) {
-        chData = *pchMessage++;
-        (wCRC) = ((uint16_t) (wCRC) >> 8) ^ wCRC_Table[((uint16_t) (wCRC) ^ (uint16_t) (chData)) & 0x00ff];
+uint16_t updateCRC16(uint16_t crc, const uint8_t *data, size_t length) {
+    const auto &t = CRC16_SLICES.t;
+    for (; length >= 8; length -= 8, data += 8) {
+        // Reflected: the CRC is XORed into the first two bytes
+        uint8_t b0 = (uint8_t) (crc ^ data[0]), b1 = (uint8_t) ((crc >> 8) ^ data[1]);
+        crc = t[7][b0] ^ t[6][b1] ^ t[5][data[2]] ^ t[4][data[3]] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
     }
+    while (length--) crc = (uint16_t) ((crc >> 8) ^ t[0][(crc ^ *data++) & 0xff]);
+    return crc;
+}
 
-    return wCRC;
+uint16_t getCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
+    if (pchMessage == nullptr) {
+        return 0xFFFF;
+    }
+    return updateCRC16(CRC16_INIT, pchMessage, dwLength);
 }
 
-bool verifyCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
+bool verifyCRC16CheckSum(const uint8_t *pchMessage, uint32_t dwLength) {
     uint16_t wExpected;
 
     if ((pchMessage == nullptr) || (dwLength <= 2)) {
@@ -126,7 +161,7 @@ void appendCRC16CheckSum(uint8_t *pchMessage, uint32_t dwLength) {
         return;
     }
 
-    wCRC = getCRC16CheckSum((uint8_t *) pchMessage, dwLength - 2);
+    wCRC = getCRC16CheckSum(pchMessage, dwLength - 2);
     pchMessage[dwLength - 2] = (uint8_t) (wCRC & 0x00ff);
     pchMessage[dwLength - 1] = (uint8_t) ((wCRC >> 8) & 0x00ff);
 }
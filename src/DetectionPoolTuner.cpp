@@ -0,0 +1,122 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "DetectionPoolTuner.h"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace meta {
+
+void DetectionPoolTuner::configure(int fixedDepth, int maxDepth_) {
+    fixedDepth = std::max(fixedDepth, 0);
+    maxDepth_ = std::max(maxDepth_, 1);
+    if (fixedDepth == fixed && maxDepth_ == maxDepth) return;
+    fixed = fixedDepth;
+    maxDepth = maxDepth_;
+    reset();
+}
+
+void DetectionPoolTuner::reset() {
+    if (fixed > 0) {
+        current = kept = std::min(fixed, maxDepth);
+        spdlog::info("DetectionPoolTuner: {} frames in flight", current);
+        return;
+    }
+    current = kept = std::min(INITIAL_DEPTH, maxDepth);
+    climbing = true;
+    nextProbeDeeper = false;
+    keptRate = 0;
+    startPhase(BASELINE);
+    spdlog::info("DetectionPoolTuner: tuning from {} frames in flight, up to {}", current, maxDepth);
+}
+
+void DetectionPoolTuner::startPhase(Phase p) {
+    phase = p;
+    started = false;
+    settling = (p != HOLD);
+    frames = 0;
+}
+
+void DetectionPoolTuner::startProbe(bool deeper) {
+    probingDeeper = deeper;
+    kept = current;
+    current += (deeper ? 1 : -1);
+    startPhase(PROBE);
+}
+
+void DetectionPoolTuner::frameCollected(LatencyClock::time_point time) {
+    if (fixed > 0) return;
+    if (!started) {
+        started = true;
+        phaseStart = time;
+        return;
+    }
+    if (phase == HOLD) {
+        if (time - phaseStart >= RETUNE_PERIOD) startPhase(BASELINE);
+        return;
+    }
+    if (settling) {
+        if (time - phaseStart >= SETTLE_TIME) {
+            settling = false;
+            phaseStart = time;
+        }
+        return;
+    }
+
+    ++frames;
+    auto elapsed = time - phaseStart;
+    if (elapsed < MEASURE_WINDOW) return;
+    float rate = (float) frames / std::chrono::duration<float>(elapsed).count();
+
+    if (phase == PROBE) {
+        concludeProbe(rate);
+        return;
+    }
+    keptRate = rate;
+    bool deeper = (climbing || nextProbeDeeper);
+    if (deeper && current >= maxDepth) deeper = false;
+    if (!deeper && current <= 1) deeper = (current < maxDepth);
+    if (deeper ? current >= maxDepth : current <= 1) {
+        climbing = false;
+        startPhase(HOLD);  // a single slot, nothing to tune
+        return;
+    }
+    startProbe(deeper);
+}
+
+void DetectionPoolTuner::concludeProbe(float rate) {
+    if (probingDeeper) {
+        if (rate > keptRate * DEEPER_MIN_GAIN) {
+            spdlog::info("DetectionPoolTuner: {} -> {} frames in flight, {:.1f} -> {:.1f} fps", kept, current,
+                         keptRate, rate);
+            keptRate = rate;
+            kept = current;
+            if (current < maxDepth) {
+                climbing = true;
+                startProbe(true);
+                return;
+            }
+        } else {
+            if (climbing) {  // periodic probes mostly end here, not logged
+                spdlog::info("DetectionPoolTuner: {} frames in flight, {:.1f} fps ({:.1f} fps with {})", kept,
+                             keptRate, rate, current);
+            }
+            current = kept;
+        }
+    } else {
+        if (rate >= keptRate * SHALLOWER_MAX_LOSS) {
+            spdlog::info("DetectionPoolTuner: {} -> {} frames in flight, {:.1f} -> {:.1f} fps", kept, current,
+                         keptRate, rate);
+            keptRate = rate;
+            kept = current;
+        } else {
+            current = kept;
+        }
+    }
+    climbing = false;
+    nextProbeDeeper = !probingDeeper;
+    startPhase(HOLD);
+}
+
+}
@@ -0,0 +1,41 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "Detector.h"
+#include <filesystem>
+
+namespace meta {
+
+    namespace fs = std::filesystem;
+
+    const char *Detector::precision_name(precision_t precision) {
+        switch (precision) {
+            case precision_t::FP32: return "fp32";
+            case precision_t::FP16: return "fp16";
+            case precision_t::INT8: return "int8";
+        }
+        return "";
+    }
+
+    std::string Detector::engine_file(const std::string &model_file, precision_t precision, int dla_core) {
+        fs::path cache_file_path(model_file);
+        std::string extension;
+        if (precision != precision_t::FP16) extension += std::string(precision_name(precision)) + ".";
+        if (dla_core >= 0) extension += "dla" + std::to_string(dla_core) + ".";
+        cache_file_path.replace_extension(extension + "engine");
+        return cache_file_path.string();
+    }
+
+    size_t Detector::fitting_input(const cv::Size &region) const {
+        size_t best = 0;
+        bool fits = false;
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].width < region.width || inputs[i].height < region.height) continue;
+            if (!fits || inputs[i].area() < inputs[best].area()) best = i;
+            fits = true;
+        }
+        return best;  // the default if nothing fits
+    }
+
+} // meta
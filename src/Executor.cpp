@@ -4,20 +4,33 @@
 
 #include "Executor.h"
 #include "Utilities.h"
+#include "ThreadScheduling.h"
+#include "TelemetryLog.h"
 #include <spdlog/spdlog.h>
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+#ifdef ON_JETSON
+#include "GpuMemoryPool.h"
+#endif
 
 namespace meta {
 
-Executor::Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, ImageSet *imageSet, VideoSet *videoSet,
-                   ParamSetManager *paramSetManager,
+Executor::Executor(OpenCVCamera *openCvCamera, MVCamera *mvCamera, V4L2Camera *v4l2Camera, ImageSet *imageSet,
+                   VideoSet *videoSet, ParamSetManager *paramSetManager,
                    ArmorDetector *detector, PositionCalculator *positionCalculator, AimingSolver *aimingSolver,
-                   Serial *serial)
-        : openCvCamera_(openCvCamera), mvCamera_(mvCamera), imageSet_(imageSet), videoSet_(videoSet),
+                   Serial *serial, MVCamera *secondaryMvCamera, PositionCalculator *secondaryPositionCalculator)
+        : openCvCamera_(openCvCamera), mvCamera_(mvCamera), v4l2Camera_(v4l2Camera), imageSet_(imageSet),
+          videoSet_(videoSet),
           paramSetManager_(paramSetManager),
           detector_(detector), positionCalculator_(positionCalculator), aimingSolver_(aimingSolver),
-          serial_(serial) {
+          serial_(serial), secondaryCamera_(secondaryMvCamera),
+          secondaryPositionCalculator_(secondaryPositionCalculator) {
 
-    reloadLists();
+    // Image sets and videos are listed on demand, so that startup does not wait for scanning directories
+    paramSetManager_->reloadParamSetList();  // switch to default parameter set
+    applyParams(paramSetManager_->loadCurrentParamSet());
 }
 
 void Executor::switchParamSet(const std::string &paramSetName) {
@@ -30,74 +43,157 @@ void Executor::saveAndApplyParams(const ParamSet &p) {
     applyParams(p);
 }
 
+namespace {
+
+// Fields read by each component
+const ParamMask CAMERA_PARAMS = paramMask({
+        ParamSet::kCameraBackendFieldNumber, ParamSet::kCameraIdFieldNumber,
+        ParamSet::kImageWidthFieldNumber, ParamSet::kImageHeightFieldNumber, ParamSet::kFpsFieldNumber,
+        ParamSet::kGammaFieldNumber, ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber,
+        ParamSet::kManualExposureFieldNumber, ParamSet::kRawBayerCaptureFieldNumber,
+        ParamSet::kDynamicSensorRoiFieldNumber, ParamSet::kV4l2BufferCountFieldNumber,
+        ParamSet::kSecondaryCameraFieldNumber});
+
+const ParamMask IMAGE_SET_PARAMS = paramMask({ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber});
+
+const ParamMask POSITION_CALCULATOR_PARAMS = paramMask({
+        ParamSet::kImageWidthFieldNumber, ParamSet::kImageHeightFieldNumber,
+        ParamSet::kRoiWidthFieldNumber, ParamSet::kRoiHeightFieldNumber,
+        ParamSet::kSmallArmorSizeFieldNumber, ParamSet::kLargeArmorSizeFieldNumber,
+        ParamSet::kSecondaryCameraFieldNumber});
+
+const ParamMask PNP_STAGE_PARAMS = POSITION_CALCULATOR_PARAMS |
+                                   paramMask({ParamSet::kManualPnpRectMaxHeightFieldNumber});
+
+const ParamMask AIMING_SOLVER_PARAMS = POSITION_CALCULATOR_PARAMS | paramMask({
+        ParamSet::kPulseMinXOffsetFieldNumber, ParamSet::kPulseMaxYOffsetFieldNumber,
+        ParamSet::kPulseMinIntervalFieldNumber, ParamSet::kTkThresholdFieldNumber,
+        ParamSet::kTkComputePeriodUsingPulsesFieldNumber, ParamSet::kTkTargetDistOffsetFieldNumber,
+        ParamSet::kTrackingLifeTimeFieldNumber, ParamSet::kManualDeltaOffsetFieldNumber,
+        ParamSet::kMotionPredictionFieldNumber, ParamSet::kMotionFilterNoiseFieldNumber,
+        ParamSet::kDynamicSensorRoiFieldNumber});
+
+// Changes that invalidate the aiming history, whose positions are in the image and camera coordinates of the old ones
+const ParamMask AIMING_RESET_PARAMS = POSITION_CALCULATOR_PARAMS;
+
+}
+
 void Executor::applyParams(const ParamSet &p) {
     // For better user experience for parameter tuning, here we don't stop the detection thread
     // But if there is some changes in the streaming source, detection may terminate anyway
 
+    // Everything changes on the first call
+    ParamMask changed = paramsInitialized ? diffParamSets(params, p) : ParamMask().set();
+    paramsInitialized = true;
+
     // Input of Camera
     // Skip re-opening the video source if the parameter doesn't change to save some time
-    if (!(p.camera_backend() == params.camera_backend() && p.camera_id() == params.camera_id() &&
-          p.image_width() == params.image_width() && p.image_height() == params.image_height() &&
-          p.fps() == params.fps() &&
-          p.gamma().enabled() == params.gamma().enabled() && p.gamma().val() == params.gamma().val() &&
-          p.roi_width() == params.roi_width() && p.roi_height() == params.roi_height() &&
-          p.manual_exposure().enabled() == params.manual_exposure().enabled() &&
-          p.manual_exposure().val() == params.manual_exposure().val())) {
+    if ((changed & CAMERA_PARAMS).any()) {
 
         bool cameraOpened = camera_ && camera_->isOpened();
         if (cameraOpened) camera_->close();
+        bool secondaryOpened = secondaryCamera_ && secondaryCamera_->isOpened();
+        if (secondaryOpened) secondaryCamera_->close();
         if (p.camera_backend() == ParamSet::MV_CAMERA) {
             camera_ = mvCamera_;
             spdlog::info("Executor: Using MVCamera as camera");
+        } else if (p.camera_backend() == ParamSet::V4L2) {
+            camera_ = v4l2Camera_;
+            spdlog::info("Executor: Using V4L2Camera as camera");
         } else {
             camera_ = openCvCamera_;
             spdlog::info("Executor: Using OpenCVCamera as camera");
         }
         if (cameraOpened) camera_->open(p);
+        if (secondaryOpened && usesSecondaryCamera(p)) secondaryCamera_->open(secondaryCameraParams(p));
     }
 
     // Local copy
     params = p;
 
-    // Input of ImageSet
-    if (imageSet_->isOpened()) {
-        stop();
+    // Hand the update to the stages that read the changed fields
+    if (changed.any()) pendingParams[DETECTION_STAGE].post(params, changed);  // the detector reads most of them
+    if ((changed & PNP_STAGE_PARAMS).any()) pendingParams[PNP_STAGE].post(params, changed);
+    if ((changed & AIMING_SOLVER_PARAMS).any()) pendingParams[AIMING_STAGE].post(params, changed);
+
+    // Input of ImageSet, images are resized to the ROI when opened
+    if (imageSet_->isOpened() && (changed & IMAGE_SET_PARAMS).any()) {
+        stop();  // pending parameters are applied inside
         imageSet_->close();
     }
 
-    // Detector
-    detector_->setParams(params);
+    // Not running. Otherwise the stages apply them, or the next run does if the thread has stopped by itself.
+    if (!th) applyAllPendingParams();
+}
 
-    // PositionCalculator
-    {
-        std::string filename =
-                std::string(PARAM_SET_ROOT) + "/params/" +
-                std::to_string(params.image_width()) + "x" + std::to_string(params.image_height()) + ".xml";
+void Executor::applyPendingParams(ParamStage stage) {
+    ParamUpdate update;
+    if (!pendingParams[stage].take(update)) return;
+    stageParams[stage] = update.params;
+
+    switch (stage) {
+        case DETECTION_STAGE:
+            detector_->setParams(update.params);
+            qualityController.setDeadline(update.params.adaptive_quality().enabled(),
+                                          update.params.adaptive_quality().val());
+            break;
+        case PNP_STAGE:
+            // Rare (calibration or armor sizes), reading the calibration file here is acceptable
+            if ((update.changed & POSITION_CALCULATOR_PARAMS).any()) loadPositionCalculatorParams(update.params);
+            break;
+        case AIMING_STAGE:
+            if ((update.changed & AIMING_RESET_PARAMS).any()) {
+                aimingSolver_->setParams(update.params);  // reset history inside
+                telemetryLog().logParams(update.params, true);
+            } else {
+                aimingSolver_->updateParams(update.params);  // keep tracking and TopKiller history
+                telemetryLog().logParams(update.params, false);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-        cv::Mat cameraMatrix;
-        cv::Mat distCoeffs;
-        float zScale;
+void Executor::loadPositionCalculatorParams(const ParamSet &p) {
+    const std::string calibration = PositionCalculator::calibrationPath(p);
+    if (!positionCalculator_->loadCalibration(p, calibration + ".xml")) {
+        spdlog::error("Failed to open {}.xml", calibration);
+        std::exit(1);
+    }
 
-        cv::FileStorage fs(filename, cv::FileStorage::READ);
-        if (!fs.isOpened()) {
-            spdlog::error("Failed to open {}", filename);
-            std::exit(1);
+    secondaryExtrinsics = false;
+    if (secondaryPositionCalculator_ && p.secondary_camera().enabled()) {
+        // Its own calibration if there is one, otherwise its lens is taken as the one of the first camera
+        std::string filename = calibration + "-camera" + std::to_string(p.secondary_camera().val()) + ".xml";
+        if (!secondaryPositionCalculator_->loadCalibration(p, filename)) {
+            spdlog::warn("Executor: no {}, the second camera takes the calibration of the first one", filename);
+            secondaryPositionCalculator_->loadCalibration(p, calibration + ".xml");
+            return;
         }
 
-        fs["cameraMatrix"] >> cameraMatrix;
-        cameraMatrix.at<double>(0, 2) *= (float) params.roi_width() / (float) params.image_width();
-        cameraMatrix.at<double>(1, 2) *= (float) params.roi_height() / (float) params.image_height();
-        fs["distCoeffs"] >> distCoeffs;
-        fs["zScale"] >> zScale;
-
-        positionCalculator_->setParameters(
-                {(float) params.small_armor_size().x(), (float) params.small_armor_size().y()},
-                {(float) params.large_armor_size().x(), (float) params.large_armor_size().y()},
-                cameraMatrix, distCoeffs, zScale);
+        // From the camera coordinates of the second camera into the ones of the first camera, p1 = R p2 + t
+        cv::FileStorage fs(filename, cv::FileStorage::READ);
+        cv::Mat rotation, translation;
+        fs["extrinsicRotation"] >> rotation;
+        fs["extrinsicTranslation"] >> translation;  // [mm]
+        if (rotation.rows == 3 && rotation.cols == 3 && translation.total() == 3) {
+            rotation.convertTo(rotation, CV_64F);
+            translation.convertTo(translation, CV_64F);
+            secondaryRotation = cv::Matx33d((const double *) rotation.data);
+            secondaryTranslation = cv::Vec3d((const double *) translation.data);
+            secondaryExtrinsics = true;
+        } else {
+            spdlog::warn("Executor: no extrinsics in {}, the target is tracked again on a switch of camera", filename);
+        }
     }
+}
 
-    // AimingSolver
-    aimingSolver_->setParams(params);  // reset history inside
+ParamSet Executor::secondaryCameraParams(const ParamSet &p) {
+    ParamSet q = p;
+    q.set_camera_id(p.secondary_camera().val());
+    q.mutable_dynamic_sensor_roi()->set_enabled(false);  // no hints in its coordinates, see aimAndPublish()
+    return q;
 }
 
 void Executor::stop() {
@@ -108,6 +204,7 @@ void Executor::stop() {
         th = nullptr;
     }
     curAction = NONE;
+    applyAllPendingParams();  // posted while running
 }
 
 bool Executor::startRealTimeDetection() {
@@ -120,10 +217,20 @@ bool Executor::startRealTimeDetection() {
         }
     }
 
+    InputSource *secondary = nullptr;
+    if (usesSecondaryCamera(params)) {
+        if (secondaryCamera_->isOpened() || secondaryCamera_->open(secondaryCameraParams(params))) {
+            secondary = secondaryCamera_;
+        } else {
+            spdlog::error("Executor: failed to open the second camera {}, running with the first one only",
+                          params.secondary_camera().val());
+        }
+    }
+
     // Start real-time detection thread
     curAction = STREAMING_DETECTION;
     threadShouldExit = false;
-    th = new std::thread(&Executor::runStreamingDetection, this, camera_);
+    th = new std::thread(&Executor::runStreamingDetection, this, camera_, secondary);
     return true;
 }
 
@@ -136,7 +243,7 @@ bool Executor::startImageSetDetection() {
     // Start real-time detection thread
     curAction = STREAMING_DETECTION;
     threadShouldExit = false;
-    th = new std::thread(&Executor::runStreamingDetection, this, imageSet_);
+    th = new std::thread(&Executor::runStreamingDetection, this, imageSet_, nullptr);
     return true;
 }
 
@@ -145,10 +252,11 @@ bool Executor::startSingleImageDetection(const std::string &imageName) {
 
     if (imageSet_->isOpened()) imageSet_->close();
     if (!imageSet_->openSingleImage(imageName, params)) return false;
+    subscribeOutputs("TTTT", true);  // the result is fetched only after the run
 
     curAction = SINGLE_IMAGE_DETECTION;
     threadShouldExit = false;
-    th = new std::thread(&Executor::runStreamingDetection, this, imageSet_);
+    th = new std::thread(&Executor::runStreamingDetection, this, imageSet_, nullptr);
     return true;
 }
 
@@ -160,122 +268,637 @@ bool Executor::startVideoDetection(const std::string &videoName) {
 
     curAction = STREAMING_DETECTION;
     threadShouldExit = false;
-    th = new std::thread(&Executor::runStreamingDetection, this, videoSet_);
+    th = new std::thread(&Executor::runStreamingDetection, this, videoSet_, nullptr);
     return true;
 }
 
-void Executor::runStreamingDetection(InputSource *source) {
+void Executor::runStreamingDetection(InputSource *source, InputSource *secondary) {
     spdlog::info("Executor: start streaming");
+    const unsigned poolDroppedFrames = source->getPoolDroppedFrames();
+    const unsigned supersededCommands = (serial_ ? serial_->getSupersededCommands() : 0);
     currentInput_ = source;
     currentInput_->fetchAndClearFrameCounter();
+    applyAllPendingParams();  // posted after the last run stopped by itself
+    applyThreadScheduling(ThreadRole::DETECTION, stageParams[DETECTION_STAGE]);  // inherited by the stage threads
+    qualityController.reset();
+    detectionPoolTuner.reset();
     aimingSolver_->resetHistory();
+    poseHistory.clear();
+    secondaryPoseHistory.clear();
+    aimingOnSecondary = false;
+    {
+        std::lock_guard<std::mutex> lock(trackingHintMutex);
+        trackingHintValid = false;
+        trackingHintWindow = cv::Rect();
+        trackingHintPoseValid = false;
+    }
+    framesSinceFullSearch = 0;
+    smoothedDetectionTime = 0;
+    staleFrames = lateFrames = consecutiveStaleFrames = 0;
+    if (stageParams[DETECTION_STAGE].telemetry_log()) {
+        // DATA_SET_ROOT defined in CMakeLists.txt
+        telemetryLog().open(std::string(DATA_SET_ROOT) + "/telemetry");
+        telemetryLog().logParams(stageParams[AIMING_STAGE], true);  // the history has just been reset
+    }
 
-    TimePoint lastFrameTime = 0;  // use last frame capture time to wait for new frame
-    TimePoint frameTime = 0;
-    while (true) {
+    if (secondary) {
 
-        // Wait for new frame, fetch and store time first and then compare
-        while (!threadShouldExit && lastFrameTime == (frameTime = source->getFrameCaptureTime())) {
-            source->fetchNextFrame();
-            std::this_thread::yield();
+        if (stageParams[DETECTION_STAGE].pipelined_execution().enabled()) {
+            spdlog::warn("Executor: pipelined execution does not apply with a second camera");
         }
+        runDualCameraDetection(source, secondary);
 
-        if (threadShouldExit || frameTime == 0) {
-            break;
+    } else if (stageParams[DETECTION_STAGE].pipelined_execution().enabled()) {
+
+        runPipelinedDetection(source);
+
+    } else {
+
+        TimePoint lastFrameTime = 0;  // use last frame capture time to wait for new frame
+        DetectionFrame frame;
+        while (waitNextFrame(source, lastFrameTime, frame)) {
+            auto startTime = LatencyClock::now();
+            applyAllPendingParams();  // frame boundary of all stages
+            detectArmors(frame);
+            solveArmorPositions(frame);
+            aimAndPublish(frame);
+            qualityController.frameProcessed(LatencyClock::now() - startTime);
+        }
+    }
+
+    spdlog::info("Executor: stopped, {} frames dropped by the source as all its frames were held",
+                 source->getPoolDroppedFrames() - poolDroppedFrames);
+    if (stageParams[DETECTION_STAGE].latency_budget().enabled()) {
+        spdlog::info("Executor: {} frames dropped over the latency budget, {} searched around the target only",
+                     staleFrames, lateFrames);
+    }
+#ifdef ON_JETSON
+    GpuMemoryPool::instance().logStats("Executor stopped");
+#endif
+    if (serial_) {
+        spdlog::info("Executor: {} commands superseded by newer ones while the serial was busy",
+                     serial_->getSupersededCommands() - supersededCommands);
+    }
+
+    telemetryLog().close();
+    source->close();
+    if (secondary) secondary->close();
+    currentInput_ = nullptr;
+    if (curAction != SINGLE_IMAGE_DETECTION) {  // do not reset SINGLE_IMAGE_DETECTION for result fetching
+        curAction = NONE;
+    }
+}
+
+bool Executor::waitNextFrame(InputSource *source, TimePoint &lastFrameTime, DetectionFrame &frame) {
+    const auto &budget = stageParams[DETECTION_STAGE].latency_budget();
+    while (true) {
+        // Sleep until the source switches the frame, waking up periodically to check for exit
+        while (!threadShouldExit && !source->waitForFrame(lastFrameTime, FRAME_WAIT_TIMEOUT)) {}
+        if (threadShouldExit) {
+            return false;
+        }
+
+        frame.sourceFrame = source->getFrame();  // held through the stages, so the source does not overwrite it
+        TimePoint frameTime = frame.sourceFrame.captureTime();
+        if (frameTime == 0) {
+            return false;
         }
         lastFrameTime = frameTime;
 
-        auto &img = source->getFrame();  // no need for deep copying
+        frame.frameTime = frameTime;
+        frame.originalImage = frame.sourceFrame.image();  // no need for deep copying
+        frame.arrivalTime = frame.sourceFrame.arrivalTime();
+        frame.late = false;
         source->fetchNextFrame();
 
+        auto now = LatencyClock::now();
+        if (frame.arrivalTime == LatencyClock::time_point()) {
+            frame.arrivalTime = now;  // arrival unknown (e.g. image sets), measure end-to-end from here
+        } else {
+            latencyStats().record(LatencyStats::CAPTURE, frame.arrivalTime, now);
+        }
+        if (!budget.enabled()) return true;
+
+        // Latency budget from the capture: a frame already over it is dropped for the next one, which is on its way,
+        // and one that a full-frame search would take over it is only searched around the target. Never too many drops
+        // in a row, so that a budget below the latency of the camera itself does not stop the commands.
+        float age = std::chrono::duration<float, std::milli>(now - frame.captureTime()).count();
+        if (age > budget.val() && consecutiveStaleFrames < MAX_CONSECUTIVE_STALE_FRAMES) {
+            ++staleFrames;
+            ++consecutiveStaleFrames;
+            continue;
+        }
+        consecutiveStaleFrames = 0;
+        if (age + smoothedDetectionTime > budget.val()) {
+            frame.late = true;
+            ++lateFrames;
+        }
+        return true;
+    }
+}
 
-        // Run armor detection algorithm
-        // For the compile on no CUDA supported platforms
+void Executor::detectArmors(DetectionFrame &frame) {
+    auto startTime = LatencyClock::now();
+    // Run armor detection algorithm
+    // For the compile on no CUDA supported platforms
 #ifdef ON_JETSON
-        std::vector<ArmorDetector::DetectedArmor> detectedArmors = detector_->detect_NG(img);
+    frame.detectedArmors = detector_->detect_NG(frame.originalImage,
+                                                nextSearchROI(frame.originalImage.size(), frame.late,
+                                                              frame.sourceFrame.offset()),
+                                                frame.sourceFrame.format());
 #else
-        std::vector<ArmorDetector::DetectedArmor> detectedArmors = detector_->detect(img);
+    cv::Mat bgr;
+    bayerToBGR(frame.originalImage, frame.sourceFrame.format(), bgr);  // no-op for BGR8
+    detector_->detect(bgr, frame.detectedArmors, nextSearchROI(bgr.size(), frame.late, frame.sourceFrame.offset()));
 #endif
+    keepDetectorResults(frame);
+    recordDetectionTime(LatencyClock::now() - startTime);
+}
 
-        // Solve armor positions
-        std::vector<AimingSolver::ArmorInfo> armors;
-        for (const auto &detectedArmor : detectedArmors) {
-            cv::Point3f offset;
-            float longLightLength = std::max(cv::norm(detectedArmor.points[1] - detectedArmor.points[0]),
-                                             cv::norm(detectedArmor.points[2] - detectedArmor.points[3]));
-            if (positionCalculator_->solve(detectedArmor.points,
-                                           detectedArmor.largeArmor,
-                                           params.manual_pnp_rect_max_height().enabled() &&
-                                           (longLightLength < params.manual_pnp_rect_max_height().val()),
-                                           offset)) {
-                armors.emplace_back(AimingSolver::ArmorInfo{
-                        detectedArmor.points,
-                        detectedArmor.center,
-                        offset,
-                        detectedArmor.avgLightAngle,
-                        detectedArmor.largeArmor,
-                        detectedArmor.number
-                });
+void Executor::recordDetectionTime(LatencyClock::duration d) {
+    float sample = std::chrono::duration<float, std::milli>(d).count();
+    float &t = smoothedDetectionTime;
+    t = (t == 0 ? sample : t + DETECTION_TIME_GAIN * (sample - t));
+}
+
+cv::Rect Executor::nextSearchROI(const cv::Size &imgSize, bool late, const cv::Point &offset) {
+    const auto &p = stageParams[DETECTION_STAGE];
+    if (p.tracking_roi().enabled() || qualityController.forcesTrackingROI() || late) {
+        // A late frame postpones the full-frame search, as long as there is a target to search around
+        const int fullSearchInterval = late ? std::numeric_limits<int>::max() : qualityController.fullSearchInterval(
+                p.tracking_roi().enabled() ? p.tracking_roi().val() : QualityController::DEFAULT_FULL_SEARCH_INTERVAL);
+        [[maybe_unused]] bool valid;
+        [[maybe_unused]] cv::Point2f center;
+        cv::Rect window;
+        {
+            std::lock_guard<std::mutex> lock(trackingHintMutex);
+            valid = trackingHintValid;
+            center = trackingHintCenter;
+            window = trackingHintWindow;
+        }
+        // From the configured ROI into the frame, which is a part of it if the sensor window follows the target
+        center -= cv::Point2f(offset);
+        if (!window.empty()) window = (window - offset) & cv::Rect(cv::Point(0, 0), imgSize);
+        // In pipelined execution the hint is a few frames old, which the margin of the region covers
+#ifdef ON_JETSON
+        if (detector_->isModelReady()) {
+            // Region of a network input size, the smallest one around the target, only while the target is seen
+            if (valid && ++framesSinceFullSearch < fullSearchInterval) {
+                return detector_->trackingSearchROI(imgSize, center, window.size());
             }
+            framesSinceFullSearch = 0;
+            return {};
         }
+#endif
+        // Legacy detection: region around the target, growing while it is lost
+        if (!window.empty() && ++framesSinceFullSearch < fullSearchInterval) {
+            return window;
+        }
+    }
+    framesSinceFullSearch = 0;
+    return {};
+}
+
+void Executor::keepDetectorResults(DetectionFrame &frame) {
+    // Keep intermediate results (no copying for cv::Mat) as the detector reuses its members for the next frame. Those
+    // not subscribed to are left for the detector to reuse their buffers.
+    const auto now = LatencyClock::now();
+    frame.originalImage = detector_->imgOriginal;
+    if (subscribed(BRIGHTNESS_IMAGE, now)) frame.brightnessImage = detector_->imgBrightness;
+    if (subscribed(COLOR_IMAGE, now)) frame.colorImage = detector_->imgColor;
+    if (subscribed(LIGHTS_IMAGE, now)) frame.lightsImage = detector_->imgLights;
+    if (subscribed(ANY_OUTPUT, now)) frame.lightRects = detector_->lightRects;
+}
 
-        // Update
-        aimingSolver_->updateArmors(armors, frameTime);
+void Executor::solveArmorPositions(DetectionFrame &frame, PositionCalculator *calculator,
+                                   PositionCalculator::PoseHistory &history, bool secondary) {
+    ScopedLatency latency(LatencyStats::PNP);
+    const auto &p = stageParams[PNP_STAGE];
+    // Armors are solved and tracked in the configured ROI, the image of the calibration (and of the principal point)
+    const cv::Point2f frameOffset = frame.sourceFrame.offset();
+    bool trackedPriorValid = false;
+    cv::Rect trackedWindow;
+    PositionCalculator::Pose trackedPrior;
+    if (!secondary) {
+        std::lock_guard<std::mutex> lock(trackingHintMutex);
+        trackedPriorValid = trackingHintPoseValid;
+        trackedWindow = trackingHintWindow;
+        trackedPrior = trackingHintPose;
+    }
+    frame.armors.clear();
+    for (const auto &detectedArmor : frame.detectedArmors) {
+        if (frame.armors.full()) break;
+        std::array<cv::Point2f, 4> points = detectedArmor.points;
+        for (auto &point : points) point += frameOffset;
+        cv::Point2f center = detectedArmor.center + frameOffset;
+        cv::Point3f offset;
+        float longLightLength = std::max(cv::norm(points[1] - points[0]), cv::norm(points[2] - points[3]));
+        PositionCalculator::Pose pose;
+        const PositionCalculator::Pose *prior = history.find(center, longLightLength);
+        if (!prior && trackedPriorValid && trackedWindow.contains(center)) prior = &trackedPrior;
+        if (calculator->solve(points,
+                              detectedArmor.largeArmor,
+                              p.manual_pnp_rect_max_height().enabled() &&
+                              (longLightLength < p.manual_pnp_rect_max_height().val()),
+                              offset, &pose, prior)) {
+            history.add(center, pose);
+            frame.armorPoses[frame.armors.size()] = pose;
+            frame.armors.emplace_back(AimingSolver::ArmorInfo{
+                    points,
+                    center,
+                    offset,
+                    detectedArmor.avgLightAngle,
+                    detectedArmor.largeArmor,
+                    detectedArmor.number
+            });
+        }
+    }
+    history.nextFrame();
+}
 
-        AimingSolver::ControlCommand command;
-        if (serial_ && aimingSolver_->getControlCommand(command)) {
-            // Send control command
-            serial_->sendControlCommand(
-                    command.detected,
-                    command.topKillerTriggered,
-                    frameTime,
-                    command.yawDelta,
-                    command.pitchDelta,
-                    command.dist,
-                    command.avgLightAngle,
-                    command.imageX,
-                    command.imageY,
-                    command.remainingTimeToTarget,
-                    command.period);
+void Executor::aimAndPublish(DetectionFrame &frame, bool secondary) {
+
+    // Update
+    auto aimingStart = LatencyClock::now();
+    // The serial latency counts from the arrival of the frame, add the time from its exposure (if known) to that
+    const float transferLatency =
+            std::chrono::duration<float, std::milli>(frame.arrivalTime - frame.captureTime()).count();
+    const float commandLatency = (serial_ ? serial_->getSmoothedLatency() + transferLatency : 0);
+    if (serial_) aimingSolver_->setCommandLatency(commandLatency);
+    // Gimbal attitude at the exposure, both on the host clock, if the source has timestamps and Control sends feedback
+    GimbalAttitude attitude;
+    auto exposureTime = frame.sourceFrame.exposureTime();
+    bool hasAttitude = serial_ && exposureTime != LatencyClock::time_point() &&
+                       serial_->getGimbalAttitude(exposureTime, attitude);
+    aimingSolver_->updateArmors(frame.armors, frame.frameTime, hasAttitude ? &attitude : nullptr);
+    // The hints are in the configured ROI, of which the frame is a part if the sensor window follows the target
+    const auto &p = stageParams[AIMING_STAGE];
+    const bool followTarget = p.dynamic_sensor_roi().enabled();
+    const cv::Size roiSize = (followTarget ? cv::Size(p.roi_width(), p.roi_height()) : frame.originalImage.size());
+    // No hints while the tracked armor is of the second camera, the first one searches its whole ROI
+    aimingOnSecondary = secondary;
+    {
+        std::lock_guard<std::mutex> lock(trackingHintMutex);
+        trackingHintValid = !aimingOnSecondary && aimingSolver_->tracker.tracking &&
+                            aimingSolver_->tracker.lostArmorFrameCount == 0;
+        trackingHintCenter = aimingSolver_->tracker.trackingArmor.imgCenter;
+        trackingHintWindow = (aimingOnSecondary ? cv::Rect() : aimingSolver_->tracker.searchWindow(roiSize));
+        if (trackingHintValid) {
+            // The selected armor is the target, as it was found in this frame
+            for (size_t i = 0; i < frame.armors.size(); i++) {
+                if (frame.armors[i].flags & AimingSolver::ArmorInfo::SELECTED_TARGET) {
+                    trackingHintPose = frame.armorPoses[i];
+                    trackingHintPoseValid = true;
+                    break;
+                }
+            }
+        } else if (aimingOnSecondary || !aimingSolver_->tracker.tracking) {
+            trackingHintPoseValid = false;
         }
+    }
+    if (followTarget && currentInput_) {
+        currentInput_->followRegion(trackingHintWindow);  // written by this stage only, no lock needed
+    }
+
+    AimingSolver::ControlCommand command;
+    bool hasCommand = serial_ && aimingSolver_->getControlCommand(command);
+    auto aimingEnd = LatencyClock::now();
+    latencyStats().record(LatencyStats::AIMING, aimingStart, aimingEnd);
+    if (telemetryLog().isOpened()) {
+        logTelemetry(frame, commandLatency, hasAttitude ? &attitude : nullptr, hasCommand ? &command : nullptr);
+    }
 
-        // Assign (no copying for cv::Mat) results all at once, if the result is not being processed
-        if (outputMutex.try_lock()) {
-            originalOutput = detector_->imgOriginal;
-            brightnessOutput = detector_->imgBrightness;
-            colorOutput = detector_->imgColor;
-            lightsImageOutput = detector_->imgLights;
-            lightRectsOutput = detector_->lightRects;
-            armorsOutput = armors;
-            tkTriggeredOutput = aimingSolver_->topKiller.triggered;
-            tkPulsesOutput = aimingSolver_->topKiller.pulses;
-            tkPeriodOutput = aimingSolver_->topKiller.period;
+    if (hasCommand) {
+        // Send control command, end-to-end latency is recorded when the write completes
+        serial_->sendControlCommand(
+                command.detected,
+                command.topKillerTriggered,
+                frame.frameTime,
+                command.yawDelta,
+                command.pitchDelta,
+                command.dist,
+                command.avgLightAngle,
+                command.imageX,
+                command.imageY,
+                command.remainingTimeToTarget,
+                command.period,
+                frame.arrivalTime,
+                frame.captureTime());
+        latencyStats().record(LatencyStats::SERIAL_ENQUEUE, aimingEnd, LatencyClock::now());
+    } else if (!serial_) {
+        latencyStats().record(LatencyStats::END_TO_END, frame.arrivalTime, aimingEnd);
+    }
 
-            outputMutex.unlock();
+    // Assign (no copying for cv::Mat, reusing the capacity of containers) results all at once
+    {
+        const auto now = LatencyClock::now();
+        const bool anySubscribed = subscribed(ANY_OUTPUT, now);
+        // Frames without the debug images of the detector keep the last ones
+        if (!frame.brightnessImage.empty() || !frame.colorImage.empty() || !anySubscribed) {
+            heldBrightnessImage = frame.brightnessImage;
+            heldColorImage = frame.colorImage;
         }
-        // Otherwise, simple discard the results of current run
 
-        // Increment frame counter
-        cumulativeFrameCounter++;
+        auto &o = outputs.back();
+        if (anySubscribed) {
+            o.sourceFrame = std::move(frame.sourceFrame);
+        } else {
+            o.sourceFrame.reset();  // not pinning the frame of the source
+        }
+        if (subscribed(CAMERA_IMAGE, now)) {
+            o.originalImage = frame.originalImage;
+        } else {
+            o.originalImage.release();
+        }
+        o.brightnessImage = heldBrightnessImage;
+        o.colorImage = heldColorImage;
+        o.lightsImage = frame.lightsImage;
+        o.lightRects.swap(frame.lightRects);
+        if (!anySubscribed) o.lightRects.clear();
+        o.armors = frame.armors;
+        o.tkTriggered = aimingSolver_->topKiller.triggered;
+        o.tkPulses.syncFrom(aimingSolver_->topKiller.pulses);  // only the pulses changed since this slot was used
+        o.tkPeriod = aimingSolver_->topKiller.period;
+        outputs.publish();
+
+        // The new back slot holds a result never fetched, release its images for the detector to reuse
+        auto &stale = outputs.back();
+        stale.sourceFrame.reset();
+        stale.originalImage.release();
+        stale.brightnessImage.release();
+        stale.colorImage.release();
+        stale.lightsImage.release();
     }
 
-    spdlog::info("Executor: stopped");
+    // Increment frame counter
+    cumulativeFrameCounter++;
+}
 
-    source->close();
-    currentInput_ = nullptr;
-    if (curAction != SINGLE_IMAGE_DETECTION) {  // do not reset SINGLE_IMAGE_DETECTION for result fetching
-        curAction = NONE;
+void Executor::logTelemetry(const DetectionFrame &frame, float commandLatency, const GimbalAttitude *attitude,
+                            const AimingSolver::ControlCommand *command) {
+    TelemetryLog::FrameRecord r;  // only the armors to log are filled
+    r.frameTime = frame.frameTime;
+    r.offsetX = (int16_t) frame.sourceFrame.offset().x;
+    r.offsetY = (int16_t) frame.sourceFrame.offset().y;
+    r.arrivalTime = TelemetryLog::toNanoseconds(frame.arrivalTime);
+    r.captureTime = TelemetryLog::toNanoseconds(frame.captureTime());
+    r.commandLatency = commandLatency;
+    r.flags = (frame.late ? TelemetryLog::LATE : 0);
+    r.attitudeYaw = r.attitudePitch = 0;
+    if (attitude) {
+        r.flags |= TelemetryLog::HAS_ATTITUDE;
+        r.attitudeYaw = attitude->yaw;
+        r.attitudePitch = attitude->pitch;
+    }
+    AimingSolver::ControlCommand c{};
+    bool hasCommand = true;
+    if (command) {
+        c = *command;
+    } else {
+        hasCommand = aimingSolver_->getControlCommand(c);  // also logged without the serial
+    }
+    if (hasCommand) {
+        r.flags |= TelemetryLog::HAS_COMMAND | (c.detected ? TelemetryLog::DETECTED : 0) |
+                   (c.topKillerTriggered ? TelemetryLog::TOP_KILLER_TRIGGERED : 0);
+    }
+    r.yawDelta = c.yawDelta;
+    r.pitchDelta = c.pitchDelta;
+    r.distance = c.dist;
+    r.avgLightAngle = c.avgLightAngle;
+    r.imageX = c.imageX;
+    r.imageY = c.imageY;
+    r.remainingTimeToTarget = c.remainingTimeToTarget;
+    r.period = c.period;
+    r.reserved = 0;
+    r.armorCount = (uint8_t) frame.armors.size();
+    for (size_t i = 0; i < frame.armors.size(); i++) r.armors[i] = TelemetryLog::toRecord(frame.armors[i]);
+    telemetryLog().logFrame(r);
+}
+
+void Executor::runDualCameraDetection(InputSource *source, InputSource *secondary) {
+    spdlog::info("Executor: detecting with the second camera {}", stageParams[DETECTION_STAGE].secondary_camera().val());
+
+    // The newest frame of the second camera, if it has a new one. The first camera paces the detection.
+    TimePoint lastSecondaryTime = 0;
+    DetectionFrame second;
+    auto takeSecondaryFrame = [&] {
+        if (secondary->getFrameCaptureTime() == lastSecondaryTime) return false;
+        second.sourceFrame = secondary->getFrame();
+        TimePoint frameTime = second.sourceFrame.captureTime();
+        if (frameTime == 0) {  // closed, e.g. reopened by applyParams()
+            second.sourceFrame.reset();
+            return false;
+        }
+        lastSecondaryTime = frameTime;
+        second.frameTime = frameTime;
+        second.originalImage = second.sourceFrame.image();
+        second.arrivalTime = second.sourceFrame.arrivalTime();
+        if (second.arrivalTime == LatencyClock::time_point()) second.arrivalTime = LatencyClock::now();
+        second.late = false;
+        secondary->fetchNextFrame();
+        return true;
+    };
+
+    TimePoint lastFrameTime = 0;
+    DetectionFrame frame;
+    while (waitNextFrame(source, lastFrameTime, frame)) {
+        auto startTime = LatencyClock::now();
+        applyAllPendingParams();  // frame boundary of all stages
+        const bool hasSecond = takeSecondaryFrame();
+        if (!hasSecond && !aimingOnSecondary) {
+            detectArmors(frame);
+            solveArmorPositions(frame);
+            aimAndPublish(frame);
+            qualityController.frameProcessed(LatencyClock::now() - startTime);
+            continue;
+        }
+        if (!hasSecond) {  // the camera followed has no new frame, only a target in the first one switches to it
+            detectArmors(frame);
+            solveArmorPositions(frame);
+            if (!frame.armors.empty()) {
+                if (!secondaryExtrinsics) aimingSolver_->tracker.reset();
+                aimAndPublish(frame);
+            }
+            qualityController.frameProcessed(LatencyClock::now() - startTime);
+            continue;
+        }
+
+#ifdef ON_JETSON
+        // One inference per frame with the shipped models (static batch of 1), run at once on two contexts. Only a
+        // model exported with a static batch of 2 takes both frames in one inference (see Detector::batch_size()).
+        auto results = detector_->detectBatch_NG(
+                {frame.originalImage, second.originalImage},
+                {nextSearchROI(frame.originalImage.size(), frame.late, frame.sourceFrame.offset()), cv::Rect()},
+                {frame.sourceFrame.format(), second.sourceFrame.format()});
+        frame.detectedArmors = std::move(results[0]);
+        second.detectedArmors = std::move(results[1]);
+        keepDetectorResults(frame);  // the intermediate images are of the first frame
+        recordDetectionTime(LatencyClock::now() - startTime);
+#else
+        cv::Mat bgr;
+        bayerToBGR(second.originalImage, second.sourceFrame.format(), bgr);  // no-op for BGR8
+        detector_->detect(bgr, second.detectedArmors);
+        second.originalImage = bgr;
+        detectArmors(frame);  // after the second one, so that the intermediate images are of the first frame
+#endif
+        solveArmorPositions(frame);
+        solveArmorPositions(second, secondaryPositionCalculator_ ? secondaryPositionCalculator_ : positionCalculator_,
+                            secondaryPoseHistory, true);
+        if (secondaryExtrinsics) {
+            for (auto &armor : second.armors) {  // into the camera coordinates of the first camera
+                cv::Vec3d p = secondaryRotation * cv::Vec3d(armor.offset.x, armor.offset.y, armor.offset.z) +
+                              secondaryTranslation;
+                armor.offset = cv::Point3f((float) p[0], (float) p[1], (float) p[2]);
+            }
+        }
+
+        // The first camera while it sees armors, the second one while only it does, and the last one followed if
+        // neither does. Without extrinsics, the positions of the two cameras don't line up and the tracks restart.
+        bool aimSecondary = frame.armors.empty() && (!second.armors.empty() || aimingOnSecondary);
+        if (aimSecondary != aimingOnSecondary && !secondaryExtrinsics) aimingSolver_->tracker.reset();
+        aimAndPublish(aimSecondary ? second : frame, aimSecondary);
+        second.sourceFrame.reset();  // give the slot back to the second camera
+        qualityController.frameProcessed(LatencyClock::now() - startTime);
     }
 }
 
+void Executor::runPipelinedDetection(InputSource *source) {
+
+    /*
+     * Stages are connected by SPSC queues and each runs on its own thread:
+     *   [input thread] -> detection (this thread) -> PnP -> aiming, serial and outputs
+     * On Jetson, the detection stage itself keeps frames in flight on the inference contexts of the model, so that the
+     * next frames are uploaded and inferred while the last one is post-processed.
+     * Serial writes are async on the serial io_context. With drop-oldest enabled, a stage that falls behind always
+     * takes the newest frame and discards the older ones, so the age of the control command stays bounded. A stage
+     * only waits on a queue that is full (for the producer) or empty (for the consumer), asleep rather than spinning,
+     * as the stages share the cores with the input and the detection.
+     */
+
+    const size_t depth = std::clamp(stageParams[DETECTION_STAGE].pipelined_execution().val(), 1,
+                                    (int) InputSource::MAX_STAGE_QUEUE_DEPTH);  // the frame pools hold as many
+    const bool dropOldest = stageParams[DETECTION_STAGE].pipeline_drop_oldest();
+    spdlog::info("Executor: pipelined execution, queue depth {}, {}", depth, dropOldest ? "drop oldest" : "no drop");
+
+    BlockingSPSCQueue<DetectionFrame> detectedQueue(depth);
+    BlockingSPSCQueue<DetectionFrame> solvedQueue(depth);
+    pipelineDroppedFrames = 0;
+
+    auto pushFrame = [](BlockingSPSCQueue<DetectionFrame> &queue, DetectionFrame &&frame) {
+        queue.push(std::move(frame));  // the end-of-stream frame (frameTime = 0) too, the consumer never drops it
+    };
+    auto popFrame = [this, dropOldest](BlockingSPSCQueue<DetectionFrame> &queue, DetectionFrame &frame) {
+        unsigned dropped = 0;
+        if (dropOldest) {
+            queue.popLatest(frame, dropped);
+        } else {
+            queue.pop(frame);
+        }
+        if (dropped) pipelineDroppedFrames += dropped;
+    };
+
+    std::thread pnpThread([&] {
+        DetectionFrame frame;
+        while (true) {
+            popFrame(detectedQueue, frame);
+            bool endOfStream = (frame.frameTime == 0);
+            if (!endOfStream) {
+                applyPendingParams(PNP_STAGE);
+                solveArmorPositions(frame);
+            }
+            pushFrame(solvedQueue, std::move(frame));
+            if (endOfStream) break;
+        }
+    });
+
+    std::thread aimingThread([&] {
+        DetectionFrame frame;
+        while (true) {
+            popFrame(solvedQueue, frame);
+            if (frame.frameTime == 0) break;
+            applyPendingParams(AIMING_STAGE);
+            aimAndPublish(frame);
+        }
+    });
+
+    TimePoint lastFrameTime = 0;
+#ifdef ON_JETSON
+    // Keep frames in flight on the inference contexts (detectionPoolTuner), so that the next frames are uploaded and
+    // inferred while the oldest is post-processed. Frames are collected in the order they are submitted, so results
+    // reach the next stages in the order of capture whatever context finishes first.
+    struct SubmittedFrame {
+        DetectionFrame frame;
+        LatencyClock::time_point startTime;  // detection time is measured from the start of each frame, not the newest
+    };
+    std::deque<SubmittedFrame> submitted;
+    auto collectOldest = [&] {
+        SubmittedFrame &oldest = submitted.front();
+        oldest.frame.detectedArmors = detector_->collect_NG();
+        keepDetectorResults(oldest.frame);
+        auto now = LatencyClock::now();
+        recordDetectionTime(now - oldest.startTime);
+        qualityController.frameProcessed(now - oldest.startTime);  // not waiting for the queue
+        detectionPoolTuner.frameCollected(now);
+        pushFrame(detectedQueue, std::move(oldest.frame));
+        submitted.pop_front();
+    };
+    while (true) {
+        DetectionFrame frame;
+        bool hasFrame = waitNextFrame(source, lastFrameTime, frame);
+        auto startTime = LatencyClock::now();
+        if (!hasFrame) break;
+
+        applyPendingParams(DETECTION_STAGE);
+        // A model switch (e.g. of detection_contexts) waits for the frames in flight
+        if (detector_->modelSwitchRequested_NG()) {
+            while (!submitted.empty()) collectOldest();
+        }
+        while ((int) submitted.size() >= detector_->maxPendingFrames_NG()) collectOldest();
+        detector_->submit_NG(frame.originalImage,
+                             nextSearchROI(frame.originalImage.size(), frame.late, frame.sourceFrame.offset()),
+                             frame.sourceFrame.format());
+        submitted.emplace_back(SubmittedFrame{std::move(frame), startTime});
+
+        detectionPoolTuner.configure(stageParams[DETECTION_STAGE].detection_contexts(),
+                                     detector_->maxPendingFrames_NG());
+        while ((int) submitted.size() >= detectionPoolTuner.depth()) collectOldest();
+    }
+    while (!submitted.empty()) collectOldest();
+#else
+    DetectionFrame frame;
+    while (waitNextFrame(source, lastFrameTime, frame)) {
+        auto startTime = LatencyClock::now();
+        applyPendingParams(DETECTION_STAGE);
+        detectArmors(frame);
+        qualityController.frameProcessed(LatencyClock::now() - startTime);  // not waiting for the queue
+        pushFrame(detectedQueue, std::move(frame));
+    }
+#endif
+    pushFrame(detectedQueue, DetectionFrame{});  // end of stream
+
+    pnpThread.join();
+    aimingThread.join();
+
+    spdlog::info("Executor: pipeline dropped {} stale frames", pipelineDroppedFrames);
+}
+
 void Executor::reloadLists() {
     imageSet_->reloadImageSetList();
     videoSet_->reloadVideoList();
+    dataSetsListed = true;
     paramSetManager_->reloadParamSetList();  // switch to default parameter set
     applyParams(paramSetManager_->loadCurrentParamSet());
 }
 
+void Executor::listDataSetsIfNeeded() {
+    if (dataSetsListed) return;
+    imageSet_->reloadImageSetList();
+    videoSet_->reloadVideoList();
+    dataSetsListed = true;
+}
+
 int Executor::switchImageSet(const std::string &path) {
+    listDataSetsIfNeeded();  // listing later would clear the image set
     return imageSet_->switchImageSet(path);
 }
 
@@ -299,7 +922,9 @@ std::string Executor::captureImageFromCamera() {
             return "[Error: failed to open camera]";
         }
     }
-    cv::Mat img = camera_->getFrame();  // no actual data copy
+    FrameHandle frame = camera_->getFrame();  // no actual data copy
+    cv::Mat img;
+    bayerToBGR(frame.image(), frame.format(), img);  // no-op for BGR8
     return imageSet_->saveCapturedImage(img, params);
 }
 
@@ -322,6 +947,13 @@ std::string Executor::startRecordToVideo() {
     return filename;
 }
 
+std::string Executor::stopRecordToVideo() {
+    if (!camera_) return "[Error: camera backend not set]";
+    camera_->stopRecordToVideo();
+    auto [written, dropped] = camera_->getRecordingStats();
+    return std::to_string(written) + " frames recorded, " + std::to_string(dropped) + " dropped";
+}
+
 bool Executor::hasOutputs() {
     if (curAction == SINGLE_IMAGE_DETECTION) {
         curAction = NONE;  // reset
@@ -332,28 +964,50 @@ bool Executor::hasOutputs() {
     return false;
 }
 
-void Executor::fetchOutputs(cv::Mat &originalImage, cv::Mat &brightnessImage, cv::Mat &colorImage,
-                            cv::Mat &lightsImage, std::vector<cv::RotatedRect> &lightRects,
-                            std::vector<AimingSolver::ArmorInfo> &armors,
-                            bool &tkTriggered, std::deque<AimingSolver::PulseInfo> &tkPulses, TimePoint &tkPeriod) {
+void Executor::subscribeOutputs(std::string_view mask, bool everyFrame) {
+    const auto now = LatencyClock::now();
+    const auto lastTime = LatencyClock::time_point(LatencyClock::duration(subscriptionTimes[ANY_OUTPUT].load()));
+    // Debug images are made once per fetch, at once for the first one
+    auto period = (now - lastTime < SUBSCRIPTION_HOLD_TIME ? now - lastTime : LatencyClock::duration::zero());
+    if (everyFrame) period = LatencyClock::duration::zero();
+    for (int i = 0; i < OUTPUT_IMAGE_COUNT && i < (int) mask.size(); i++) {
+        if (mask[i] == 'T') subscriptionTimes[i] = now.time_since_epoch().count();
+    }
+    subscriptionTimes[ANY_OUTPUT] = now.time_since_epoch().count();
+
+    if ((subscribed(BRIGHTNESS_IMAGE, now) || subscribed(COLOR_IMAGE, now)) &&
+        (everyFrame || qualityController.allowsDebugImages())) {
+        detector_->requestDebugImages(period);
+    }
+}
+
+void Executor::unsubscribeOutputs() {
+    for (auto &time : subscriptionTimes) time = 0;
+    detector_->cancelDebugImages();
+}
+
+void Executor::fetchOutputs(FrameHandle &sourceFrame, cv::Mat &originalImage, cv::Mat &brightnessImage,
+                            cv::Mat &colorImage, cv::Mat &lightsImage, std::vector<cv::RotatedRect> &lightRects,
+                            AimingSolver::ArmorList &armors,
+                            bool &tkTriggered, AimingSolver::PulseHistory &tkPulses, TimePoint &tkPeriod) {
     if (curAction != NONE) {
-        outputMutex.lock();
-        {
-            originalImage = originalOutput;
-            brightnessImage = brightnessOutput;
-            colorImage = colorOutput;
-            lightsImage = lightsImageOutput;
-            lightRects = lightRectsOutput;
-            armors = armorsOutput;
-            tkTriggered = tkTriggeredOutput;
-            tkPulses = tkPulsesOutput;
-            tkPeriod = tkPeriodOutput;
-        }
-        outputMutex.unlock();
+        outputs.update();  // keep the last one if nothing new
+        const auto &o = outputs.front();
+        sourceFrame = o.sourceFrame;
+        originalImage = o.originalImage;
+        brightnessImage = o.brightnessImage;
+        colorImage = o.colorImage;
+        lightsImage = o.lightsImage;
+        lightRects = o.lightRects;
+        armors = o.armors;
+        tkTriggered = o.tkTriggered;
+        tkPulses.syncFrom(o.tkPulses);
+        tkPeriod = o.tkPeriod;
 
     } else {
         if (camera_ && camera_->isRecordingVideo()) {
-            originalImage = camera_->getFrame();
+            sourceFrame = camera_->getFrame();
+            originalImage = sourceFrame.image();
         }
     }
 }
@@ -0,0 +1,121 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "FramePool.h"
+#include "ThreadScheduling.h"
+
+namespace meta {
+
+void FramePool::prepare(FrameSlot *slot, cv::Size size, int type, cv::MatAllocator *allocator) {
+    cv::Mat &image = slot->image;
+    if (image.size() == size && image.type() == type && image.allocator == allocator && image.isContinuous()) {
+        return;
+    }
+    image = cv::Mat();  // Mats still sharing the old pixels keep them
+    image.allocator = allocator;
+    image.create(size, type);
+    lockBuffer(image.datastart, image.dataend - image.datastart);
+}
+
+void FramePool::prepareView(FrameSlot *slot, cv::Size size, cv::Size capacity, int type,
+                            cv::MatAllocator *allocator) {
+    CV_Assert(size.width <= capacity.width && size.height <= capacity.height);
+    cv::Mat &storage = slot->storage;
+    if (storage.total() < (size_t) capacity.area() || storage.type() != type || storage.allocator != allocator) {
+        slot->image = cv::Mat();
+        storage = cv::Mat();  // Mats still sharing the old pixels keep them
+        storage.allocator = allocator;
+        storage.create(1, capacity.area(), type);  // a single row, so that any prefix of it is continuous
+        lockBuffer(storage.datastart, storage.dataend - storage.datastart);
+    }
+    cv::Mat &image = slot->image;
+    if (image.data == storage.data && image.size() == size && image.type() == type) return;
+    image = storage.colRange(0, size.area()).reshape(0, size.height);  // sharing the reference count of storage
+}
+
+void FramePool::preallocate(cv::Size size, int type, cv::MatAllocator *allocator, bool views) {
+    for (size_t i = 0; i < slotCount; i++) {
+        FrameSlot *slot = &slots[i];
+        unsigned expected = 0;
+        if (slot->refs.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+            if (views) {
+                prepareView(slot, size, size, type, allocator);
+            } else {
+                prepare(slot, size, type, allocator);
+            }
+            discard(slot);
+        }
+    }
+}
+
+FrameSlot *FramePool::acquire() {
+    for (size_t n = 0; n < slotCount; n++) {
+        FrameSlot *slot = &slots[nextSlot];
+        nextSlot = (nextSlot + 1) % slotCount;
+
+        // A free slot is neither the latest nor held, so no one else can take a reference of it meanwhile
+        if (slot->refs.load(std::memory_order_acquire) == 0) {
+            slot->refs.store(1, std::memory_order_relaxed);  // the reference of the producer, kept as the latest
+            return slot;
+        }
+    }
+    return nullptr;
+}
+
+FrameSlot *FramePool::acquireWait(const std::atomic<bool> &cancel) {
+    if (FrameSlot *slot = acquire()) return slot;
+
+    FrameSlot *slot = nullptr;
+    freeWaiters.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence of notifySlotFreed(): either it sees the waiter, or acquire() sees the freed slot
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    {
+        std::unique_lock<std::mutex> lock(freeMutex);
+        freeCondition.wait(lock, [&] { return cancel.load() || (slot = acquire()) != nullptr; });
+    }
+    freeWaiters.fetch_sub(1, std::memory_order_relaxed);
+    return slot;
+}
+
+void FramePool::cancelWait() {
+    std::lock_guard<std::mutex> lock(freeMutex);  // not between the check and the sleep of acquireWait()
+    freeCondition.notify_all();
+}
+
+void FramePool::notifySlotFreed() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (freeWaiters.load(std::memory_order_relaxed) == 0) return;  // the common case, no lock
+    std::lock_guard<std::mutex> lock(freeMutex);
+    freeCondition.notify_all();
+}
+
+void FramePool::publish(FrameSlot *slot) {
+    slot->sequence = nextSequence++;
+    FrameSlot *previous;
+    {
+        std::lock_guard<std::mutex> lock(latestMutex);
+        previous = latestSlot;
+        latestSlot = slot;
+        latestTime.store(slot->captureTime, std::memory_order_release);
+    }
+    if (previous) previous->refs.fetch_sub(1, std::memory_order_release);
+}
+
+void FramePool::publishEnd() {
+    FrameSlot *previous;
+    {
+        std::lock_guard<std::mutex> lock(latestMutex);
+        previous = latestSlot;
+        latestSlot = nullptr;
+        latestTime.store(0, std::memory_order_release);
+    }
+    if (previous) previous->refs.fetch_sub(1, std::memory_order_release);
+}
+
+FrameHandle FramePool::latest() const {
+    std::lock_guard<std::mutex> lock(latestMutex);
+    return FrameHandle(latestSlot);
+}
+
+}
@@ -0,0 +1,178 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "GpuMemoryPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <spdlog/spdlog.h>
+
+namespace meta {
+
+namespace {
+
+class PoolTrtAllocator : public nvinfer1::IGpuAllocator {
+public:
+
+    void *allocate(uint64_t size, uint64_t alignment, nvinfer1::AllocatorFlags) noexcept override {
+        if (alignment > GpuMemoryPool::ALIGNMENT) {
+            spdlog::error("GpuMemoryPool: TensorRT asked for an alignment of {} bytes", alignment);
+            return nullptr;
+        }
+        return GpuMemoryPool::instance().allocate(size);
+    }
+
+    bool deallocate(void *memory) noexcept override {
+        GpuMemoryPool::instance().free(memory);
+        return true;
+    }
+
+#if NV_TENSORRT_MAJOR < 10
+    void free(void *memory) noexcept override { GpuMemoryPool::instance().free(memory); }
+#endif
+};
+
+}
+
+GpuMemoryPool &GpuMemoryPool::instance() {
+    static auto *pool = new GpuMemoryPool;  // never destroyed, detectors may outlive static destruction
+    return *pool;
+}
+
+GpuMemoryPool::GpuMemoryPool() {
+#if CUDART_VERSION >= 11020
+    int device = 0, supported = 0;
+    if (cudaGetDevice(&device) == cudaSuccess &&
+        cudaDeviceGetAttribute(&supported, cudaDevAttrMemoryPoolsSupported, device) == cudaSuccess && supported) {
+        cudaMemPoolProps props{};
+        props.allocType = cudaMemAllocationTypePinned;
+        props.location.type = cudaMemLocationTypeDevice;
+        props.location.id = device;
+        if (cudaMemPoolCreate(&pool, &props) == cudaSuccess) {
+            uint64_t threshold = UINT64_MAX;  // keep freed memory for reuse, never trim at synchronization
+            cudaMemPoolSetAttribute(pool, cudaMemPoolAttrReleaseThreshold, &threshold);
+            streamOrdered = true;
+        }
+    }
+    cudaGetLastError();  // clear the error of an unsupported device
+#endif
+    spdlog::info("GpuMemoryPool: {}", streamOrdered ? "stream-ordered pool" : "caching allocator");
+}
+
+void *GpuMemoryPool::allocate(size_t bytes, cudaStream_t stream) {
+    if (bytes == 0) bytes = 1;
+    void *ptr = nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+
+#if CUDART_VERSION >= 11020
+    if (streamOrdered) {
+        if (cudaMallocFromPoolAsync(&ptr, bytes, pool, stream) != cudaSuccess) ptr = nullptr;
+        if (ptr != nullptr && stream == nullptr) cudaStreamSynchronize(nullptr);  // usable at return, as cudaMalloc
+    } else
+#endif
+    {
+        bytes = (bytes < LARGE_BLOCK_ROUNDING ? (bytes + SMALL_BLOCK_ROUNDING - 1) / SMALL_BLOCK_ROUNDING *
+                                                SMALL_BLOCK_ROUNDING
+                                              : (bytes + LARGE_BLOCK_ROUNDING - 1) / LARGE_BLOCK_ROUNDING *
+                                                LARGE_BLOCK_ROUNDING);
+        ptr = allocateCached(bytes);  // bytes of the block, maybe a larger cached one
+    }
+
+    if (ptr == nullptr) {
+        cudaGetLastError();
+        spdlog::error("GpuMemoryPool: out of memory for {} KB, {} MB in use", bytes >> 10, counters.inUse >> 20);
+        return nullptr;
+    }
+    blockSizes.emplace(ptr, bytes);
+    counters.inUse += bytes;
+    counters.peakInUse = std::max(counters.peakInUse, counters.inUse);
+    counters.allocations++;
+    return ptr;
+}
+
+void *GpuMemoryPool::allocateCached(size_t &bytes) {
+    auto it = cachedBlocks.lower_bound(bytes);
+    if (it != cachedBlocks.end() && it->first <= bytes * MAX_CACHED_BLOCK_WASTE) {
+        void *ptr = it->second;
+        bytes = it->first;  // in use and cached again at its whole size
+        cachedBlocks.erase(it);
+        return ptr;
+    }
+    void *ptr = nullptr;
+    if (cudaMalloc(&ptr, bytes) != cudaSuccess) {
+        // Fragmented by blocks of other sizes, give them all back and try again
+        cudaGetLastError();
+        releaseCachedBlocks();
+        if (cudaMalloc(&ptr, bytes) != cudaSuccess) return nullptr;
+    }
+    counters.reserved += bytes;
+    return ptr;
+}
+
+void GpuMemoryPool::releaseCachedBlocks() {
+    if (cachedBlocks.empty()) return;
+    cudaDeviceSynchronize();  // cudaFree() would anyway
+    for (const auto &block : cachedBlocks) {
+        cudaFree(block.second);
+        counters.reserved -= block.first;
+    }
+    cachedBlocks.clear();
+}
+
+void GpuMemoryPool::free(void *ptr, cudaStream_t stream) {
+    if (ptr == nullptr) return;
+    size_t bytes;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = blockSizes.find(ptr);
+        if (it == blockSizes.end()) {
+            spdlog::error("GpuMemoryPool: freeing {} not from the pool", ptr);
+            return;
+        }
+        bytes = it->second;
+        blockSizes.erase(it);
+        counters.inUse -= bytes;
+        counters.allocations--;
+
+#if CUDART_VERSION >= 11020
+        if (streamOrdered) {
+            cudaFreeAsync(ptr, stream);
+            return;
+        }
+#endif
+    }
+    // Reused by the next allocate(), so the work on stream must be done with it. Waited for out of the lock, so that
+    // the other threads allocating or freeing don't wait for this stream too.
+    if (stream != nullptr) cudaStreamSynchronize(stream);
+    std::lock_guard<std::mutex> lock(mutex);
+    cachedBlocks.emplace(bytes, ptr);
+}
+
+nvinfer1::IGpuAllocator *GpuMemoryPool::trtAllocator() {
+    static PoolTrtAllocator allocator;
+    return &allocator;
+}
+
+GpuMemoryPool::Stats GpuMemoryPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats s = counters;
+#if CUDART_VERSION >= 11020
+    if (streamOrdered) {
+        uint64_t reserved = 0;
+        cudaMemPoolGetAttribute(pool, cudaMemPoolAttrReservedMemCurrent, &reserved);
+        s.reserved = reserved;
+    }
+#endif
+    return s;
+}
+
+void GpuMemoryPool::logStats(const char *when) const {
+    Stats s = stats();
+    size_t free = 0, total = 0;
+    cudaMemGetInfo(&free, &total);
+    spdlog::info("GpuMemoryPool: {}, {} MB in use in {} blocks (peak {} MB), {} MB reserved, {}/{} MB free on the "
+                 "device", when, s.inUse >> 20, s.allocations, s.peakInUse >> 20, s.reserved >> 20, free >> 20,
+                 total >> 20);
+}
+
+}
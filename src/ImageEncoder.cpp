@@ -0,0 +1,202 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ImageEncoder.h"
+#include "MaskRLE.h"
+#include <mutex>
+#include <cstring>
+#include <opencv2/imgcodecs.hpp>
+#include <spdlog/spdlog.h>
+
+#ifdef GSTREAMER_FOUND
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#endif
+
+namespace meta {
+
+bool OpenCVJPEGEncoder::encode(const cv::Mat &img, std::string &out) {
+    if (img.empty()) return false;
+    if (!cv::imencode(".jpg", img, buf, {cv::IMWRITE_JPEG_QUALITY, quality})) return false;
+    out.assign(buf.begin(), buf.end());
+    return true;
+}
+
+bool MaskRLEEncoder::encode(const cv::Mat &img, std::string &out) {
+    if (img.empty() || img.type() != CV_8UC1) return false;
+    encodeMaskRLE(img.data, img.cols, img.rows, img.step, out);
+    return true;
+}
+
+#ifdef GSTREAMER_FOUND
+
+GStreamerEncoder::GStreamerEncoder(std::string encoderElement, std::string encoderPipeline,
+                                   package::Image::ImageFormat format, const char *name,
+                                   const char *qualityProperty, unsigned qualityScale)
+        : encoderElement(std::move(encoderElement)), encoderPipeline(std::move(encoderPipeline)),
+          format_(format), name_(name), qualityProperty(qualityProperty), qualityScale(qualityScale) {
+    static std::once_flag gstInitialized;
+    std::call_once(gstInitialized, [] { gst_init(nullptr, nullptr); });
+}
+
+bool GStreamerEncoder::available() const {
+    GstElementFactory *factory = gst_element_factory_find(encoderElement.c_str());
+    if (!factory) return false;
+    gst_object_unref(factory);
+    return true;
+}
+
+bool GStreamerEncoder::open(const cv::Size &newSize, int newType) {
+    close();
+
+    std::string description = "appsrc name=src is-live=true format=time ! videoconvert ! video/x-raw,format=I420 ! " +
+                              encoderPipeline + " ! appsink name=sink sync=false max-buffers=2 drop=false";
+    GError *error = nullptr;
+    pipeline = gst_parse_launch(description.c_str(), &error);
+    if (error) {
+        spdlog::error("{}: failed to create pipeline: {}", name_, error->message);
+        g_error_free(error);
+        if (pipeline) gst_object_unref(pipeline);
+        pipeline = nullptr;
+        return false;
+    }
+    appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    appsink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, newType == CV_8UC1 ? "GRAY8" : "BGR",
+                                        "width", G_TYPE_INT, newSize.width,
+                                        "height", G_TYPE_INT, newSize.height,
+                                        "framerate", GST_TYPE_FRACTION, 0, 1,
+                                        nullptr);
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    gst_caps_unref(caps);
+
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        spdlog::error("{}: failed to start pipeline", name_);
+        close();
+        return false;
+    }
+
+    size = newSize;
+    type = newType;
+    frameIndex = 0;
+    applyQuality();
+    spdlog::info("{}: pipeline started for {}x{}", name_, size.width, size.height);
+    return true;
+}
+
+void GStreamerEncoder::setQuality(int q) {
+    if (q == quality) return;
+    quality = q;
+    applyQuality();
+}
+
+void GStreamerEncoder::applyQuality() {
+    if (!pipeline || !qualityProperty || quality < 0) return;
+    GstElement *enc = gst_bin_get_by_name(GST_BIN(pipeline), "enc");
+    if (!enc) return;
+    g_object_set(enc, qualityProperty, (guint) (quality * qualityScale), nullptr);  // both elements take it live
+    gst_object_unref(enc);
+}
+
+void GStreamerEncoder::close() {
+    if (!pipeline) return;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (appsrc) gst_object_unref(appsrc);
+    if (appsink) gst_object_unref(appsink);
+    gst_object_unref(pipeline);
+    pipeline = appsrc = appsink = nullptr;
+    type = -1;
+    lastImage.clear();  // of the old size
+}
+
+bool GStreamerEncoder::encode(const cv::Mat &img, std::string &out) {
+    if (img.empty() || (img.type() != CV_8UC1 && img.type() != CV_8UC3)) return false;
+    if (!pipeline || img.size() != size || img.type() != type) {
+        if (!open(img.size(), img.type())) return false;
+    }
+
+    // Raw video rows are 4-byte aligned in GStreamer
+    const size_t rowBytes = img.cols * img.elemSize();
+    const size_t stride = (rowBytes + 3) & ~(size_t) 3;
+    GstBuffer *buffer = gst_buffer_new_allocate(nullptr, stride * img.rows, nullptr);
+    GstMapInfo map;
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    for (int y = 0; y < img.rows; y++) {
+        memcpy(map.data + y * stride, img.ptr(y), rowBytes);
+    }
+    gst_buffer_unmap(buffer, &map);
+
+    // Timestamps only need to increase
+    GST_BUFFER_PTS(buffer) = frameIndex * GST_SECOND / 30;
+    GST_BUFFER_DURATION(buffer) = GST_SECOND / 30;
+    ++frameIndex;
+
+    if (gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer) != GST_FLOW_OK) {  // takes the buffer
+        spdlog::error("{}: failed to push frame", name_);
+        close();
+        return false;
+    }
+
+    // Take the finished frames without waiting: a video stream needs all of them, a still image only the latest
+    const bool stream = (format_ == package::Image::H264);
+    out.clear();
+    while (GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), 0)) {
+        GstBuffer *encoded = gst_sample_get_buffer(sample);
+        if (encoded && gst_buffer_map(encoded, &map, GST_MAP_READ)) {
+            if (stream) {
+                out.append((const char *) map.data, map.size);  // access units of the byte-stream, in order
+            } else {
+                lastImage.assign((const char *) map.data, map.size);
+            }
+            gst_buffer_unmap(encoded, &map);
+        }
+        gst_sample_unref(sample);
+    }
+    if (!stream) out = lastImage;
+    return !out.empty();
+}
+
+#endif
+
+std::unique_ptr<ImageEncoder> createCameraImageEncoder(package::ParamSet::TerminalImageEncoding encoding) {
+    std::unique_ptr<ImageEncoder> encoder;
+
+#ifdef GSTREAMER_FOUND
+    if (encoding == package::ParamSet::HARDWARE_H264_CAMERA) {
+        // Low latency: no B-frames, one access unit out per frame in, SPS/PPS and an IDR frame every second
+        auto h264 = std::make_unique<GStreamerEncoder>(
+                "nvv4l2h264enc",
+                "nvvidconv ! video/x-raw(memory:NVMM),format=NV12 ! "
+                "nvv4l2h264enc name=enc maxperf-enable=true insert-sps-pps=true iframeinterval=30 idrinterval=30 "
+                "bitrate=2000000 ! video/x-h264,stream-format=byte-stream,alignment=au",
+                package::Image::H264, "NVENC H.264", "bitrate", 2000000 / 60);  // 2 Mbps at quality 60
+        if (h264->available()) {
+            encoder = std::move(h264);
+        } else {
+            spdlog::warn("ImageEncoder: NVENC H.264 not available");
+        }
+    }
+    if (!encoder && encoding != package::ParamSet::CPU_JPEG) {
+        auto nvjpeg = std::make_unique<GStreamerEncoder>("nvjpegenc", "nvjpegenc name=enc quality=60",
+                                                         package::Image::JPEG, "NVJPEG", "quality");
+        if (nvjpeg->available()) {
+            encoder = std::move(nvjpeg);
+        } else {
+            spdlog::warn("ImageEncoder: NVJPEG not available");
+        }
+    }
+#else
+    if (encoding != package::ParamSet::CPU_JPEG) {
+        spdlog::warn("ImageEncoder: built without GStreamer, hardware encoding not available");
+    }
+#endif
+
+    if (!encoder) encoder = std::make_unique<OpenCVJPEGEncoder>();
+    spdlog::info("ImageEncoder: {} for camera images", encoder->name());
+    return encoder;
+}
+
+}
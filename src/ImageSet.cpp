@@ -4,8 +4,11 @@
 
 #include "ImageSet.h"
 #include "Utilities.h"
+#include "ThreadScheduling.h"
 #include <iostream>
+#include <fstream>
 #include <iomanip>
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 
 namespace meta {
@@ -23,7 +26,8 @@ void ImageSet::reloadImageSetList() {
     images.clear();
     if (fs::is_directory(imageSetRoot)) {
         for (const auto &entry : fs::directory_iterator(imageSetRoot)) {
-            if (fs::is_directory(imageSetRoot / entry.path().filename())) {
+            if (fs::is_directory(imageSetRoot / entry.path().filename()) ||
+                PackedImageSet::isPackFile(entry.path())) {
                 imageSets.emplace_back(entry.path().filename().string());
             }
         }
@@ -35,9 +39,19 @@ int ImageSet::switchImageSet(const std::string &dataSetName) {
 
     currentImageSetPath = imageSetRoot / dataSetName;
     images.clear();
+    pack.close();  // frames still in use keep their mapping
 
     std::cout << "ImageSet: loading data set " << currentImageSetPath << "..." << std::endl;
 
+    if (PackedImageSet::isPackFile(currentImageSetPath)) {
+        if (pack.open(currentImageSetPath)) {
+            images.reserve(pack.size());
+            for (size_t i = 0; i < pack.size(); i++) images.emplace_back(pack.name(i));
+        }
+        std::cout << "ImageSet: " << images.size() << " images mapped." << std::endl;
+        return images.size();  // in the order they were packed
+    }
+
     for (const auto &entry : fs::directory_iterator(currentImageSetPath)) {
 #ifdef BOOST_OS_WINDOWS
         if (wcscmp(entry.path().extension().c_str(), L".jpg") == 0) {
@@ -63,24 +77,53 @@ int ImageSet::switchImageSet(const std::string &dataSetName) {
     return images.size();
 }
 
+cv::Mat ImageSet::loadImage(size_t index, const ParamSet &params) const {
+    cv::Mat img;
+    if (pack.isOpened()) {
+        img = pack.frame(index);  // no copy
+    } else {
+        img = cv::imread((fs::path(currentImageSetPath) / images[index]).string());
+    }
+    if (!img.empty() && (img.rows != params.roi_height() || img.cols != params.roi_width())) {
+        cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+    }
+    return img;
+}
+
+std::string ImageSet::loadAnnotation(size_t index) const {
+    if (pack.isOpened()) return std::string(pack.annotation(index));
+    fs::path xmlFile = fs::path(currentImageSetPath) / fs::path(images[index]).stem();
+    xmlFile += ".xml";
+    std::ifstream file(xmlFile.string());
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
 bool ImageSet::openSingleImage(const std::string &imageName, const ParamSet &params) {
     if (currentImageSetPath.empty()) {
         std::cerr << "ImageSet: failed to open as no image set is selected\n";
         return false;
     }
 
-    fs::path imageFile = fs::path(currentImageSetPath) / imageName;
-    auto img = cv::imread(imageFile.string());
-    if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
-        cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+    auto it = std::find(images.begin(), images.end(), imageName);
+    if (it == images.end()) {
+        std::cerr << "ImageSet: " << imageName << " is not in the image set\n";
+        return false;
     }
-
-    // Load the image to the latest buffer
-    buffer[lastBuffer] = img;
-    bufferCaptureTime[lastBuffer] = 1;
+    auto img = loadImage(it - images.begin(), params);
 
     if (th) close();
     th = nullptr;  // do not start thread and clear the pointer for fetchNextFrame
+
+    // Load the image as the latest frame
+    FrameSlot *slot = framePool.acquire();
+    if (!slot) {
+        std::cerr << "ImageSet: failed to open as all frames are held\n";
+        return false;
+    }
+    slot->image = img;
+    slot->captureTime = 1;
+    framePool.publish(slot);
+    notifyNewFrame();
     return true;
 }
 
@@ -92,54 +135,61 @@ bool ImageSet::openCurrentImageSet(const ParamSet &params) {
         return false;
     }
 
+    if (pack.isOpened() && pack.frameSize() != cv::Size(params.roi_width(), params.roi_height())) {
+        std::cerr << "ImageSet: packed frames are " << pack.frameSize() << " and are resized to the ROI, "
+                  << "repack the image set at the ROI to replay it without any copy\n";
+    }
+
     std::cout << "ImageSet: loading " << images.size() << " images into memory\n";
     imageMats.clear();
     imageMats.reserve(images.size());
-    for (const auto &image : images) {
-        fs::path imageFile = fs::path(currentImageSetPath) / image;
-        auto img = cv::imread(imageFile.string());
-        if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
-            cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
-        }
-        imageMats.emplace_back(img);
+    for (size_t i = 0; i < images.size(); i++) {
+        auto img = loadImage(i, params);  // frames of a packed image set are views of the mapping
+        if (!img.empty()) imageMats.emplace_back(img);
     }
 
     threadShouldExit = false;
+    shouldFetchNextFrame = true;  // the first frame
     th = new std::thread(&ImageSet::loadFrameFromImageSet, this, params);
     return true;
 }
 
 void ImageSet::loadFrameFromImageSet(const ParamSet &params) {
-    shouldFetchNextFrame = true;
-
+    applyThreadScheduling(ThreadRole::CAPTURE, params);  // replays as the camera would run
     auto it = imageMats.begin();  // next frame iterator
+    TimePoint lastCaptureTime = 0;
     while (true) {
 
-        while (!shouldFetchNextFrame && !threadShouldExit) std::this_thread::yield();
-
-        uint8_t workingBuffer = 1 - lastBuffer;
+        {
+            std::unique_lock<std::mutex> lock(fetchMutex);
+            fetchCondition.wait(lock, [this] { return shouldFetchNextFrame || threadShouldExit; });
+            shouldFetchNextFrame = false;  // cleared before the switch, so a fetch after the switch is a new request
+        }
 
         if (threadShouldExit || it == imageMats.end()) {  // no more image
-            bufferCaptureTime[workingBuffer] = 0;  // indicate invalid frame
-            lastBuffer = workingBuffer;  // switch
             break;
         }
 
+        // Images are not to be skipped, wait for consumers to release a frame (only if the pipeline holds them all)
+        FrameSlot *slot = framePool.acquireWait(threadShouldExit);
+        if (!slot) break;
+
         // Set the image
-        buffer[workingBuffer] = *it;
+        slot->image = *it;
         ++it;
 
         // Increment frame time
-        bufferCaptureTime[workingBuffer] = bufferCaptureTime[lastBuffer] + 1;
+        slot->captureTime = ++lastCaptureTime;
 
         // Switch
-        lastBuffer = workingBuffer;
+        framePool.publish(slot);
+        notifyNewFrame();
 
         // The only place of incrementing
         ++cumulativeFrameCounter;
-
-        shouldFetchNextFrame = false;
     }
+    framePool.publishEnd();  // indicate invalid frame
+    notifyNewFrame();
 
     imageMats.clear();
     std::cout << "ImageSet: closed\n";
@@ -150,22 +200,27 @@ void ImageSet::fetchNextFrame() {
 
     if (th) {  // if the thread is created
 
-        while (shouldFetchNextFrame) {  // check for flag set last time
-            std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lock(fetchMutex);
+            shouldFetchNextFrame = true;
         }
-        shouldFetchNextFrame = true;
+        fetchCondition.notify_one();
 
     } else {  // for single image, the thread is not created
 
-        uint8_t workingBuffer = 1 - lastBuffer;
-        bufferCaptureTime[workingBuffer] = 0;  // indicate invalid frame
-        lastBuffer = workingBuffer;  // switch
+        framePool.publishEnd();  // indicate invalid frame
+        notifyNewFrame();
     }
 }
 
 void ImageSet::close() {
     if (th) {
-        threadShouldExit = true;
+        {
+            std::lock_guard<std::mutex> lock(fetchMutex);
+            threadShouldExit = true;
+        }
+        fetchCondition.notify_one();
+        framePool.cancelWait();  // may be waiting for a free slot
         th->join();
         delete th;
         th = nullptr;
@@ -0,0 +1,148 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "LatencyStats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace meta {
+
+int LatencyHistogram::bucketIndex(uint32_t us) {
+    if (us < SUB_BUCKETS) return (int) us;  // exact below SUB_BUCKETS us
+    int exponent = 31 - __builtin_clz(us);  // >= SUB_BUCKET_BITS
+    int sub = (int) ((us >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (int) SUB_BUCKETS + (exponent - SUB_BUCKET_BITS) * (int) SUB_BUCKETS + sub;
+}
+
+float LatencyHistogram::bucketValue(int index) {
+    if (index < (int) SUB_BUCKETS) return (float) index;
+    int exponent = (index - (int) SUB_BUCKETS) / (int) SUB_BUCKETS + SUB_BUCKET_BITS;
+    int sub = (index - (int) SUB_BUCKETS) % (int) SUB_BUCKETS;
+    float width = std::ldexp(1.0f, exponent - SUB_BUCKET_BITS);
+    return (float) (SUB_BUCKETS + sub) * width + width / 2;
+}
+
+void LatencyHistogram::record(LatencyClock::duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    auto v = (uint32_t) std::clamp<decltype(us)>(us, 0, std::numeric_limits<uint32_t>::max());
+
+    buckets[bucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t m = maxUs.load(std::memory_order_relaxed);
+    while (v > m && !maxUs.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::fetchAndClearInto(Counts &counts) {
+    for (int i = 0; i < BUCKET_COUNT; i++) counts.buckets[i] += buckets[i].exchange(0, std::memory_order_relaxed);
+    counts.maxUs = std::max(counts.maxUs, maxUs.exchange(0, std::memory_order_relaxed));
+}
+
+LatencyHistogram::Summary LatencyHistogram::fetchAndClear() {
+    Counts counts;
+    fetchAndClearInto(counts);
+    return counts.summary();
+}
+
+LatencyHistogram::Summary LatencyHistogram::Counts::summary() const {
+    Summary ret;
+    for (auto n : buckets) ret.count += n;
+    float maxValue = (float) maxUs;
+    if (ret.count == 0) return ret;
+
+    auto percentile = [&](double p) {
+        auto rank = (unsigned) std::ceil(p * ret.count);
+        unsigned cumulative = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            cumulative += buckets[i];
+            if (cumulative >= rank) return std::min(bucketValue(i), maxValue) / 1000.0f;
+        }
+        return maxValue / 1000.0f;
+    };
+    ret.p50 = percentile(0.50);
+    ret.p95 = percentile(0.95);
+    ret.p99 = percentile(0.99);
+    ret.max = maxValue / 1000.0f;
+    return ret;
+}
+
+const char *LatencyStats::stageName(Stage stage) {
+    switch (stage) {
+        case CAPTURE:        return "capture";
+        case WAKEUP:         return "wakeup";
+        case PREPROCESS:     return "preprocess";
+        case INFERENCE:      return "inference";
+        case POSTPROCESS:    return "postprocess";
+        case PNP:            return "pnp";
+        case AIMING:         return "aiming";
+        case SERIAL_ENQUEUE: return "serial";
+        case END_TO_END:     return "end-to-end";
+        default:             return "unknown";
+    }
+}
+
+class LatencyStats::LocalShard {
+public:
+
+    ~LocalShard() {
+        if (owner) owner->releaseShard(shard);
+    }
+
+    Shard &get(LatencyStats *stats) {
+        if (owner != stats) {  // first record of the thread (there is normally only latencyStats())
+            if (owner) owner->releaseShard(shard);
+            shard = stats->acquireShard();
+            owner = stats;
+        }
+        return *shard;
+    }
+
+private:
+
+    LatencyStats *owner = nullptr;
+    Shard *shard = nullptr;
+};
+
+LatencyStats::Shard &LatencyStats::localShard() {
+    thread_local LocalShard local;
+    return local.get(this);
+}
+
+LatencyStats::Shard *LatencyStats::acquireShard() {
+    std::lock_guard<std::mutex> lock(shardMutex);
+    for (auto &shard : shards) {
+        if (!shard->inUse) {  // of an exited thread, e.g. a stage thread of an earlier run
+            shard->inUse = true;
+            return shard.get();
+        }
+    }
+    shards.emplace_back(std::make_unique<Shard>());
+    shards.back()->inUse = true;
+    return shards.back().get();
+}
+
+void LatencyStats::releaseShard(Shard *shard) {
+    std::lock_guard<std::mutex> lock(shardMutex);
+    shard->inUse = false;  // the samples are kept until the next fetch
+}
+
+std::array<LatencyHistogram::Summary, LatencyStats::STAGE_COUNT> LatencyStats::fetchAndClear() {
+    std::array<LatencyHistogram::Counts, STAGE_COUNT> counts;
+    {
+        std::lock_guard<std::mutex> lock(shardMutex);
+        for (auto &shard : shards) {
+            for (int i = 0; i < STAGE_COUNT; i++) shard->histograms[i].fetchAndClearInto(counts[i]);
+        }
+    }
+    std::array<LatencyHistogram::Summary, STAGE_COUNT> ret;
+    for (int i = 0; i < STAGE_COUNT; i++) ret[i] = counts[i].summary();
+    return ret;
+}
+
+LatencyStats &latencyStats() {
+    static LatencyStats stats;
+    return stats;
+}
+
+}
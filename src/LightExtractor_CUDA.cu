@@ -0,0 +1,424 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "LightExtractor_CUDA.h"
+#include "BayerDemosaic.cuh"
+#include "GpuMemoryPool.h"
+#include <algorithm>
+#include <climits>
+
+namespace meta {
+
+namespace {
+
+// Fixed-point coefficients of cvtColor(BGR2GRAY) for 8-bit images, as in LightThreshold.cpp
+constexpr int32_t GRAY_B = 1868, GRAY_G = 9617, GRAY_R = 4899;
+
+constexpr int32_t UNLIT = -1;  // label of the pixels out of the lights
+
+dim3 gridOf(int width, int height, dim3 block) {
+    return {(width + block.x - 1) / block.x, (height + block.y - 1) / block.y};
+}
+
+struct ThresholdArgs {
+    const uint8_t *src;  // rows of the frame the window is in
+    int srcStep, srcWidth, srcHeight;
+    int redX, redY;      // raw frames, in src
+    float gainR, gainG, gainB;
+    int windowX, windowY, width, height;  // window in src
+    LightThresholdParams p;
+    uint8_t *lights, *brightness, *color;  // of the window, can be nullptr
+};
+
+/**
+ * Hue of cvtColor(BGR2HSV) for 8-bit images, as hue() of LightThreshold.cpp computing its table entry.
+ */
+__device__ __forceinline__ int hueOf(int b, int g, int r) {
+    int v = max(b, max(g, r));
+    int diff = v - min(b, min(g, r));
+    int h;
+    if (v == r) h = g - b;
+    else if (v == g) h = b - r + 2 * diff;
+    else h = r - g + 4 * diff;
+    int hdiv = (diff == 0 ? 0 : __double2int_rn((180 << 12) / (6.0 * diff)));  // rounds to even, as lrint()
+    h = (h * hdiv + (1 << 11)) >> 12;
+    if (h < 0) h += 180;
+    return min(h, 255);
+}
+
+/**
+ * thresholdLightsRow() of a pixel, of a color mode and an enemy color, from a BGR8 or raw frame.
+ */
+template<bool HSV, bool RED, bool RAW>
+__global__ void thresholdKernel(ThresholdArgs a) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= a.width || y >= a.height) return;
+
+    int b, g, r;
+    if (RAW) {
+        float rgb[3];
+        demosaic_at(a.src, a.srcStep, a.srcWidth, a.srcHeight, a.windowX + x, a.windowY + y, a.redX, a.redY, rgb);
+        r = min(__float2int_rn(rgb[0] * a.gainR), 255);
+        g = min(__float2int_rn(rgb[1] * a.gainG), 255);
+        b = min(__float2int_rn(rgb[2] * a.gainB), 255);
+    } else {
+        const uint8_t *pixel = a.src + (a.windowY + y) * a.srcStep + (a.windowX + x) * 3;
+        b = pixel[0], g = pixel[1], r = pixel[2];
+    }
+
+    bool lit = (b * GRAY_B + g * GRAY_G + r * GRAY_R > a.p.grayLimit);
+    bool inColor;
+    if (HSV) {
+        int h = hueOf(b, g, r);
+        inColor = (RED ? (h <= a.p.hueMax || h >= a.p.hueMin) : (a.p.hueMin <= h && h <= a.p.hueMax));
+    } else {
+        inColor = (max(RED ? r - b : b - r, 0) > a.p.rbThreshold);  // saturated subtraction, 255 never passes
+    }
+
+    int i = y * a.width + x;
+    if (a.lights) a.lights[i] = (lit && inColor ? 255 : 0);
+    if (a.brightness) a.brightness[i] = (lit ? 255 : 0);
+    if (a.color) a.color[i] = (inColor ? 255 : 0);
+}
+
+template<bool HSV, bool RED>
+void launchThreshold(const ThresholdArgs &a, bool raw, cudaStream_t stream) {
+    const dim3 block(32, 8);
+    const dim3 grid = gridOf(a.width, a.height, block);
+    if (raw) {
+        thresholdKernel<HSV, RED, true><<<grid, block, 0, stream>>>(a);
+    } else {
+        thresholdKernel<HSV, RED, false><<<grid, block, 0, stream>>>(a);
+    }
+}
+
+/**
+ * Erode (all pixels under the element lit) or dilate (any of them lit), with the pixels out of the image ignored as
+ * cv::morphologyDefaultBorderValue(). Optionally ANDed with another mask, to fuse the brightness into the last color
+ * morphology.
+ */
+template<bool ERODE>
+__global__ void morphologyKernel(const uint8_t *src, uint8_t *dst, const uint8_t *andMask, int width, int height,
+                                 LightExtractor_CUDA::Element e) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+
+    bool result = ERODE;
+    for (int row = 0; row < e.rows && result == ERODE; row++) {
+        int sy = y + row - e.anchorY;
+        if (sy < 0 || sy >= height || e.first[row] > e.last[row]) continue;
+        const uint8_t *line = src + sy * width;
+        int from = max(x + e.first[row], 0), to = min(x + e.last[row], width - 1);
+        for (int sx = from; sx <= to; sx++) {
+            if ((line[sx] != 0) != ERODE) {
+                result = !ERODE;
+                break;
+            }
+        }
+    }
+
+    int i = y * width + x;
+    dst[i] = (result && (andMask == nullptr || andMask[i] != 0) ? 255 : 0);
+}
+
+/*
+ * Connected components by union-find over the labels (Playne and Hawick, "A New Algorithm for Parallel Connected-
+ * Component Labelling on GPUs", 2018). Each lit pixel starts as its own tree and is united with its lit neighbors
+ * before it, trees always pointing to the smaller index, so that the root of a component is its first pixel.
+ */
+
+__device__ __forceinline__ int findRoot(const int32_t *labels, int i) {
+    int next;
+    while ((next = labels[i]) != i) i = next;
+    return i;
+}
+
+__device__ void unite(int32_t *labels, int a, int b) {
+    while (true) {
+        a = findRoot(labels, a);
+        b = findRoot(labels, b);
+        if (a == b) return;
+        if (a > b) {
+            int t = a;
+            a = b;
+            b = t;
+        }
+        int old = atomicMin(&labels[b], a);
+        if (old == b) return;  // b was still a root, now under a
+        b = old;               // another thread moved b, unite with where it went
+    }
+}
+
+__global__ void initLabelsKernel(const uint8_t *lights, int32_t *labels, int width, int height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int i = y * width + x;
+    labels[i] = (lights[i] ? i : UNLIT);
+}
+
+__global__ void mergeKernel(const uint8_t *lights, int32_t *labels, int width, int height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int i = y * width + x;
+    if (!lights[i]) return;
+
+    // 8-connected, the neighbors before the pixel (the others unite with it themselves)
+    if (x > 0 && lights[i - 1]) unite(labels, i, i - 1);
+    if (y > 0) {
+        int up = i - width;
+        if (x > 0 && lights[up - 1]) unite(labels, i, up - 1);
+        if (lights[up]) unite(labels, i, up);
+        if (x + 1 < width && lights[up + 1]) unite(labels, i, up + 1);
+    }
+}
+
+__global__ void compressKernel(int32_t *labels, int width, int height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int i = y * width + x;
+    if (labels[i] != UNLIT) labels[i] = findRoot(labels, i);
+}
+
+/**
+ * Give each root a component, whose index replaces its label as -2 - index. Other pixels keep the root.
+ */
+__global__ void rootsKernel(int32_t *labels, LightExtractor_CUDA::Component *components, int32_t *count,
+                            int width, int height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int i = y * width + x;
+    if (labels[i] != i) return;
+
+    int index = atomicAdd(count, 1);
+    labels[i] = -2 - index;
+    if (index >= LightExtractor_CUDA::MAX_COMPONENTS) return;
+    auto &c = components[index];
+    c.count = c.boundaryCount = 0;
+    c.originX = c.left = c.right = x;
+    c.originY = c.top = c.bottom = y;
+    c.sumX = c.sumY = c.sumXX = c.sumXY = c.sumYY = 0;
+}
+
+__device__ __forceinline__ void atomicAddInt64(int64_t *address, int64_t value) {
+    // Two's complement, the unsigned sum wraps into the signed one
+    atomicAdd(reinterpret_cast<unsigned long long *>(address), (unsigned long long) value);
+}
+
+/**
+ * Accumulate the statistics of the components by runs of lit pixels in a row, which are in the same component, so
+ * that a component takes a few atomics per row instead of per pixel. A thread per pixel, those starting a run walk it.
+ */
+__global__ void statsKernel(const uint8_t *lights, const int32_t *labels, LightExtractor_CUDA::Component *components,
+                            int width, int height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= width || y >= height) return;
+    int i = y * width + x;
+    if (!lights[i] || (x > 0 && lights[i - 1])) return;
+
+    int label = labels[i];
+    int index = -2 - (label >= 0 ? labels[label] : label);
+    if (index >= LightExtractor_CUDA::MAX_COMPONENTS) return;
+    auto &c = components[index];
+
+    const uint8_t *row = lights + y * width;
+    const uint8_t *up = (y > 0 ? row - width : nullptr);
+    const uint8_t *down = (y + 1 < height ? row + width : nullptr);
+    const int dy = y - c.originY;
+    int64_t sumX = 0, sumXX = 0;
+    int boundary = 0;
+    int end = x;
+    for (; end < width && row[end]; end++) {
+        int dx = end - c.originX;
+        sumX += dx;
+        sumXX += (int64_t) dx * dx;
+        // The ends of the run are boundary, and so are the pixels out of the window
+        bool inside = end > x && end + 1 < width && row[end + 1] && up && up[end] && down && down[end];
+        if (!inside) boundary++;
+    }
+    int n = end - x;
+
+    atomicAdd(&c.count, n);
+    atomicAdd(&c.boundaryCount, boundary);
+    atomicMin(&c.left, x);
+    atomicMax(&c.right, end - 1);
+    atomicMax(&c.bottom, y);
+    atomicAddInt64(&c.sumX, sumX);
+    atomicAddInt64(&c.sumY, (int64_t) n * dy);
+    atomicAddInt64(&c.sumXX, sumXX);
+    atomicAddInt64(&c.sumXY, sumX * dy);
+    atomicAddInt64(&c.sumYY, (int64_t) n * dy * dy);
+}
+
+/**
+ * Copy the components found into the output, so that only the used part of it goes over to the CPU.
+ */
+__global__ void compactKernel(const int32_t *count, const LightExtractor_CUDA::Component *components,
+                              int32_t *outputCount, LightExtractor_CUDA::Component *outputComponents) {
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i == 0) *outputCount = *count;
+    if (i < min(*count, LightExtractor_CUDA::MAX_COMPONENTS)) outputComponents[i] = components[i];
+}
+
+}
+
+LightExtractor_CUDA::Element LightExtractor_CUDA::Element::fromMat(const cv::Mat &element) {
+    CV_Assert(element.type() == CV_8UC1 && element.rows <= MAX_KERNEL_SIZE && element.cols <= MAX_KERNEL_SIZE);
+    Element e;
+    e.rows = element.rows;
+    e.anchorY = element.rows / 2;
+    const int anchorX = element.cols / 2;
+    for (int r = 0; r < element.rows; r++) {
+        int first = element.cols, last = -1;
+        for (int c = 0; c < element.cols; c++) {
+            if (element.at<uint8_t>(r, c)) {
+                first = std::min(first, c);
+                last = c;
+            }
+        }
+        e.first[r] = (int8_t) (first - anchorX);
+        e.last[r] = (int8_t) (last - anchorX);
+    }
+    return e;
+}
+
+LightExtractor_CUDA::LightExtractor_CUDA() {
+    for (auto &slot : slots) {
+        cudaCheck(cudaStreamCreate(&slot.stream));
+        for (auto &event : slot.events) cudaCheck(cudaEventCreate(&event));
+        slot.work = static_cast<Output *>(GpuMemoryPool::instance().allocate(sizeof(Output), slot.stream));
+        if (slot.work == nullptr) cudaCheck(cudaErrorMemoryAllocation);
+        slot.output.reserve(sizeof(Output));
+    }
+}
+
+LightExtractor_CUDA::~LightExtractor_CUDA() {
+    for (auto &slot : slots) {
+        if (slot.inFlight) cudaStreamSynchronize(slot.stream);
+        for (auto &mask : slot.masks) GpuMemoryPool::instance().free(mask, slot.stream);
+        GpuMemoryPool::instance().free(slot.labels, slot.stream);
+        GpuMemoryPool::instance().free(slot.work, slot.stream);
+        for (auto &event : slot.events) cudaEventDestroy(event);
+        cudaStreamDestroy(slot.stream);
+    }
+}
+
+void LightExtractor_CUDA::reserve(Slot &slot, size_t pixels) {
+    if (pixels <= slot.pixels) return;
+    auto &pool = GpuMemoryPool::instance();
+    for (auto &mask : slot.masks) {
+        pool.free(mask, slot.stream);
+        mask = static_cast<uint8_t *>(pool.allocate(pixels, slot.stream));
+        if (mask == nullptr) cudaCheck(cudaErrorMemoryAllocation);
+    }
+    pool.free(slot.labels, slot.stream);
+    slot.labels = static_cast<int32_t *>(pool.allocate(pixels * sizeof(int32_t), slot.stream));
+    if (slot.labels == nullptr) cudaCheck(cudaErrorMemoryAllocation);
+    slot.pixels = pixels;
+}
+
+uint64_t LightExtractor_CUDA::submit(const cv::Mat &img, const BayerFormat &format, const cv::Rect &window,
+                                     const LightThresholdParams &p, const Morphology &m) {
+    CV_Assert(img.type() == (format.raw() ? CV_8UC1 : CV_8UC3) && !window.empty() &&
+              (window & cv::Rect(0, 0, img.cols, img.rows)) == window);
+    uint64_t ticket = nextTicket++;
+    auto &slot = slots[ticket % SLOTS];
+    CV_Assert(!slot.inFlight);  // more than SLOTS frames submitted without collecting
+    slot.ticket = ticket;
+    slot.inFlight = true;
+    slot.offset = window.tl();
+
+    const int width = window.width, height = window.height;
+    reserve(slot, (size_t) width * height);
+    cudaEventRecord(slot.events[0], slot.stream);
+
+    // Stage the rows of the window, and a row around it for the demosaicing of raw frames
+    const int margin = (format.raw() ? 1 : 0);
+    const int firstRow = std::max(window.y - margin, 0);
+    const int lastRow = std::min(window.y + height + margin, img.rows);
+    const cv::Mat rows = img.rowRange(firstRow, lastRow);
+    size_t bytes = rows.step[0] * (rows.rows - 1) + rows.cols * rows.elemSize();
+    ThresholdArgs a{};
+    a.src = static_cast<const uint8_t *>(slot.staging.stage(rows.data, bytes, slot.stream));
+    a.srcStep = (int) rows.step[0], a.srcWidth = rows.cols, a.srcHeight = rows.rows;
+    a.redX = format.redX(), a.redY = format.redY() ^ (firstRow & 1);
+    a.gainR = format.gains[0], a.gainG = format.gains[1], a.gainB = format.gains[2];
+    a.windowX = window.x, a.windowY = window.y - firstRow, a.width = width, a.height = height;
+    a.p = p;
+
+    // In the brightness mask and the other two in turn. Without color morphology, the threshold gives the lights.
+    uint8_t *brightness = slot.masks[0], *current = slot.masks[1], *spare = slot.masks[2];
+    const bool colorMorphology = (m.erode.rows > 0 || m.dilate.rows > 0);
+    if (colorMorphology) {
+        a.brightness = brightness;
+        a.color = current;
+    } else {
+        a.lights = current;
+    }
+    const bool red = (p.mainChannel == 2);
+    if (p.hsv && red) launchThreshold<true, true>(a, format.raw(), slot.stream);
+    else if (p.hsv) launchThreshold<true, false>(a, format.raw(), slot.stream);
+    else if (red) launchThreshold<false, true>(a, format.raw(), slot.stream);
+    else launchThreshold<false, false>(a, format.raw(), slot.stream);
+
+    const dim3 block(32, 8);
+    const dim3 grid = gridOf(width, height, block);
+    auto morphology = [&](const Element &e, bool erode, const uint8_t *andMask) {
+        if (erode) {
+            morphologyKernel<true><<<grid, block, 0, slot.stream>>>(current, spare, andMask, width, height, e);
+        } else {
+            morphologyKernel<false><<<grid, block, 0, slot.stream>>>(current, spare, andMask, width, height, e);
+        }
+        std::swap(current, spare);
+    };
+    if (colorMorphology) {
+        // The brightness is applied by the last color morphology
+        if (m.erode.rows > 0) morphology(m.erode, true, m.dilate.rows > 0 ? nullptr : brightness);
+        if (m.dilate.rows > 0) morphology(m.dilate, false, brightness);
+    }
+    if (m.open.rows > 0) {
+        morphology(m.open, true, nullptr);
+        morphology(m.open, false, nullptr);
+    }
+    if (m.close.rows > 0) {
+        morphology(m.close, false, nullptr);
+        morphology(m.close, true, nullptr);
+    }
+
+    // Connected components of the lights, now in current
+    cudaMemsetAsync(&slot.work->count, 0, sizeof(int32_t), slot.stream);
+    initLabelsKernel<<<grid, block, 0, slot.stream>>>(current, slot.labels, width, height);
+    mergeKernel<<<grid, block, 0, slot.stream>>>(current, slot.labels, width, height);
+    compressKernel<<<grid, block, 0, slot.stream>>>(slot.labels, width, height);
+    rootsKernel<<<grid, block, 0, slot.stream>>>(slot.labels, slot.work->components, &slot.work->count,
+                                                  width, height);
+    statsKernel<<<grid, block, 0, slot.stream>>>(current, slot.labels, slot.work->components, width, height);
+    auto *output = static_cast<Output *>(slot.output.deviceData());
+    compactKernel<<<(MAX_COMPONENTS + 255) / 256, 256, 0, slot.stream>>>(&slot.work->count, slot.work->components,
+                                                                          &output->count, output->components);
+    slot.output.toHost(sizeof(Output), slot.stream);
+    cudaEventRecord(slot.events[1], slot.stream);
+    return ticket;
+}
+
+const LightExtractor_CUDA::Component *LightExtractor_CUDA::collect(uint64_t ticket, int &count, cv::Point &offset) {
+    auto &slot = slots[ticket % SLOTS];
+    CV_Assert(slot.inFlight && slot.ticket == ticket);
+    cudaCheck(cudaStreamSynchronize(slot.stream));
+    slot.inFlight = false;
+    cudaEventElapsedTime(&gpuTime, slot.events[0], slot.events[1]);
+
+    const auto *output = static_cast<const Output *>(slot.output.hostData());
+    count = std::min(output->count, (int32_t) MAX_COMPONENTS);
+    offset = slot.offset;
+    return output->components;
+}
+
+}
@@ -0,0 +1,257 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "LightThreshold.h"
+#include "Parameters.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>  // built for SSSE3 alone (target attribute), selected at runtime
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace meta {
+
+// Fixed-point coefficients of cvtColor(BGR2GRAY) for 8-bit images
+static constexpr int32_t GRAY_B = 1868, GRAY_G = 9617, GRAY_R = 4899, GRAY_SHIFT = 14;
+
+LightThresholdParams LightThresholdParams::fromParamSet(const package::ParamSet &params) {
+    LightThresholdParams p{};
+
+    // threshold() on 8-bit images compares with the floored threshold, gray = (sum + 2^13) >> 14
+    int brightness = std::clamp((int) std::floor(params.brightness_threshold()), -1, 255);
+    p.grayLimit = ((brightness + 1) << GRAY_SHIFT) - (1 << (GRAY_SHIFT - 1)) - 1;
+
+    p.hsv = (params.color_threshold_mode() == package::ParamSet::HSV);
+    p.mainChannel = (params.enemy_color() == package::ParamSet::RED ? 2 : 0);
+    p.oppositeChannel = (params.enemy_color() == package::ParamSet::RED ? 0 : 2);
+    p.rbThreshold = std::clamp((int) std::floor(params.rb_channel_threshold()), -1, 255);
+
+    // inRange() rounds the bounds to the image depth
+    auto roundHue = [](float hue) { return std::clamp((int) std::lrint(hue), 0, 255); };
+    if (params.enemy_color() == package::ParamSet::RED) {
+        // Red color spreads over the 0 (180) boundary
+        p.hueWrap = true;
+        p.hueMin = roundHue(params.hsv_red_hue().min());
+        p.hueMax = roundHue(params.hsv_red_hue().max());
+    } else {
+        p.hueWrap = false;
+        p.hueMin = roundHue(params.hsv_blue_hue().min());
+        p.hueMax = roundHue(params.hsv_blue_hue().max());
+    }
+    return p;
+}
+
+/**
+ * Hue of cvtColor(BGR2HSV) for 8-bit images, [0, 180).
+ */
+static inline int hue(int b, int g, int r) {
+    static const auto hdivTable = [] {
+        std::array<int, 256> table{};
+        for (int i = 1; i < 256; i++) table[i] = (int) std::lrint((180 << 12) / (6.0 * i));
+        return table;
+    }();
+
+    int v = std::max(b, std::max(g, r));
+    int diff = v - std::min(b, std::min(g, r));
+    int h;
+    if (v == r) h = g - b;
+    else if (v == g) h = b - r + 2 * diff;
+    else h = r - g + 4 * diff;
+    h = (h * hdivTable[diff] + (1 << 11)) >> 12;
+    if (h < 0) h += 180;
+    return std::min(h, 255);
+}
+
+static inline void storeMasks(int i, uint8_t bright, uint8_t color,
+                              uint8_t *lights, uint8_t *brightness, uint8_t *colorOut) {
+    if (lights) lights[i] = bright & color;
+    if (brightness) brightness[i] = bright;
+    if (colorOut) colorOut[i] = color;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static bool cpuHasSSSE3() {
+#if defined(__SSSE3__)
+    return true;  // built for it
+#else
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+#endif
+}
+
+/**
+ * The RB_CHANNELS threshold of thresholdRow() on blocks of 16 pixels with SSSE3, built for it whatever the target of
+ * the build (x86-64 only guarantees SSE2), so that it is only called if cpuHasSSSE3().
+ * @return Pixels done, the rest of the row is left to the scalar loop.
+ */
+template<int MAIN, int OPPOSITE>
+__attribute__((target("ssse3")))
+static int thresholdRowSSSE3(const uint8_t *bgr, int width, uint8_t rbBound, bool rbNever, int32_t grayLimitValue,
+                             uint8_t *lights, uint8_t *brightness, uint8_t *color) {
+    int i = 0;
+    // Deinterleave 16 BGR pixels from 3 vectors
+    const __m128i shuffle[3][3] = {
+            {_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)},
+            {_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)},
+            {_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1),
+                    _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)}
+    };
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coeffBG = _mm_setr_epi16(GRAY_B, GRAY_G, GRAY_B, GRAY_G, GRAY_B, GRAY_G, GRAY_B, GRAY_G);
+    const __m128i coeffR = _mm_setr_epi16(GRAY_R, 0, GRAY_R, 0, GRAY_R, 0, GRAY_R, 0);
+    const __m128i grayLimit = _mm_set1_epi32(grayLimitValue);
+    const __m128i rbBoundV = _mm_set1_epi8((char) rbBound);
+    const __m128i rbEnable = (rbNever ? zero : _mm_set1_epi8(-1));
+
+    for (; i + 16 <= width; i += 16, bgr += 48) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bgr));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bgr + 16));
+        __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bgr + 32));
+        __m128i ch[3];
+        for (int c = 0; c < 3; c++) {
+            ch[c] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, shuffle[c][0]), _mm_shuffle_epi8(v1, shuffle[c][1])),
+                                 _mm_shuffle_epi8(v2, shuffle[c][2]));
+        }
+
+        // Weighted sum in 32 bits, 4 pixels at a time: madd of interleaved (B, G) and (R, 0)
+        __m128i b16[2] = {_mm_unpacklo_epi8(ch[0], zero), _mm_unpackhi_epi8(ch[0], zero)};
+        __m128i g16[2] = {_mm_unpacklo_epi8(ch[1], zero), _mm_unpackhi_epi8(ch[1], zero)};
+        __m128i r16[2] = {_mm_unpacklo_epi8(ch[2], zero), _mm_unpackhi_epi8(ch[2], zero)};
+        __m128i lit32[4];
+        for (int h = 0; h < 2; h++) {
+            __m128i bgLo = _mm_unpacklo_epi16(b16[h], g16[h]), bgHi = _mm_unpackhi_epi16(b16[h], g16[h]);
+            __m128i rLo = _mm_unpacklo_epi16(r16[h], zero), rHi = _mm_unpackhi_epi16(r16[h], zero);
+            __m128i sumLo = _mm_add_epi32(_mm_madd_epi16(bgLo, coeffBG), _mm_madd_epi16(rLo, coeffR));
+            __m128i sumHi = _mm_add_epi32(_mm_madd_epi16(bgHi, coeffBG), _mm_madd_epi16(rHi, coeffR));
+            lit32[h * 2] = _mm_cmpgt_epi32(sumLo, grayLimit);
+            lit32[h * 2 + 1] = _mm_cmpgt_epi32(sumHi, grayLimit);
+        }
+        __m128i lit = _mm_packs_epi16(_mm_packs_epi32(lit32[0], lit32[1]), _mm_packs_epi32(lit32[2], lit32[3]));
+
+        __m128i diff = _mm_subs_epu8(ch[MAIN], ch[OPPOSITE]);
+        __m128i inColor = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(diff, rbBoundV), diff), rbEnable);
+
+        if (lights) _mm_storeu_si128(reinterpret_cast<__m128i *>(lights + i), _mm_and_si128(lit, inColor));
+        if (brightness) _mm_storeu_si128(reinterpret_cast<__m128i *>(brightness + i), lit);
+        if (color) _mm_storeu_si128(reinterpret_cast<__m128i *>(color + i), inColor);
+    }
+    return i;
+}
+
+#endif
+
+/**
+ * thresholdLightsRow() of a color mode and an enemy color, which fix the channels and the hue wrap at compile time.
+ */
+template<bool HSV, bool RED>
+static void thresholdRow(const uint8_t *bgr, int width, const LightThresholdParams &p,
+                         uint8_t *lights, uint8_t *brightness, uint8_t *color) {
+    constexpr int MAIN = (RED ? 2 : 0), OPPOSITE = (RED ? 0 : 2);
+    int i = 0;
+
+    if constexpr (HSV) {
+        for (; i < width; i++, bgr += 3) {
+            int b = bgr[0], g = bgr[1], r = bgr[2];
+            uint8_t lit = (b * GRAY_B + g * GRAY_G + r * GRAY_R > p.grayLimit ? 255 : 0);
+            int h = hue(b, g, r);
+            bool inHue = (RED ? (h <= p.hueMax || h >= p.hueMin) : (p.hueMin <= h && h <= p.hueMax));
+            storeMasks(i, lit, inHue ? 255 : 0, lights, brightness, color);
+        }
+        return;
+    }
+
+    // RB_CHANNELS: x > t as max(x, t + 1) == x, which also covers t = -1. t = 255 never passes.
+    const bool rbNever = (p.rbThreshold >= 255);
+    const auto rbBound = (uint8_t) (rbNever ? 255 : p.rbThreshold + 1);
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasSSSE3()) {
+        i = thresholdRowSSSE3<MAIN, OPPOSITE>(bgr, width, rbBound, rbNever, p.grayLimit, lights, brightness, color);
+        bgr += 3 * i;
+    }
+#elif defined(__ARM_NEON)
+    {
+        const int32x4_t grayLimit = vdupq_n_s32(p.grayLimit);
+        const uint8x16_t rbBoundV = vdupq_n_u8(rbBound);
+        const uint8x16_t rbEnable = vdupq_n_u8(rbNever ? 0 : 255);
+
+        for (; i + 16 <= width; i += 16, bgr += 48) {
+            uint8x16x3_t ch = vld3q_u8(bgr);  // deinterleaved B, G, R
+
+            uint16x8_t b16[2] = {vmovl_u8(vget_low_u8(ch.val[0])), vmovl_u8(vget_high_u8(ch.val[0]))};
+            uint16x8_t g16[2] = {vmovl_u8(vget_low_u8(ch.val[1])), vmovl_u8(vget_high_u8(ch.val[1]))};
+            uint16x8_t r16[2] = {vmovl_u8(vget_low_u8(ch.val[2])), vmovl_u8(vget_high_u8(ch.val[2]))};
+            uint16x8_t lit16[2];
+            for (int h = 0; h < 2; h++) {
+                uint32x4_t sumLo = vmull_n_u16(vget_low_u16(b16[h]), GRAY_B);
+                sumLo = vmlal_n_u16(sumLo, vget_low_u16(g16[h]), GRAY_G);
+                sumLo = vmlal_n_u16(sumLo, vget_low_u16(r16[h]), GRAY_R);
+                uint32x4_t sumHi = vmull_n_u16(vget_high_u16(b16[h]), GRAY_B);
+                sumHi = vmlal_n_u16(sumHi, vget_high_u16(g16[h]), GRAY_G);
+                sumHi = vmlal_n_u16(sumHi, vget_high_u16(r16[h]), GRAY_R);
+                lit16[h] = vcombine_u16(vmovn_u32(vcgtq_s32(vreinterpretq_s32_u32(sumLo), grayLimit)),
+                                        vmovn_u32(vcgtq_s32(vreinterpretq_s32_u32(sumHi), grayLimit)));
+            }
+            uint8x16_t lit = vcombine_u8(vmovn_u16(lit16[0]), vmovn_u16(lit16[1]));
+
+            uint8x16_t diff = vqsubq_u8(ch.val[MAIN], ch.val[OPPOSITE]);
+            uint8x16_t inColor = vandq_u8(vceqq_u8(vmaxq_u8(diff, rbBoundV), diff), rbEnable);
+
+            if (lights) vst1q_u8(lights + i, vandq_u8(lit, inColor));
+            if (brightness) vst1q_u8(brightness + i, lit);
+            if (color) vst1q_u8(color + i, inColor);
+        }
+    }
+#endif
+
+    // Remaining pixels (all of them without SIMD)
+    for (; i < width; i++, bgr += 3) {
+        int b = bgr[0], g = bgr[1], r = bgr[2];
+        uint8_t lit = (b * GRAY_B + g * GRAY_G + r * GRAY_R > p.grayLimit ? 255 : 0);
+        int diff = std::max(bgr[MAIN] - bgr[OPPOSITE], 0);
+        uint8_t inColor = (!rbNever && diff >= rbBound ? 255 : 0);
+        storeMasks(i, lit, inColor, lights, brightness, color);
+    }
+}
+
+using ThresholdRowFunction = void (*)(const uint8_t *, int, const LightThresholdParams &, uint8_t *, uint8_t *,
+                                      uint8_t *);
+
+static ThresholdRowFunction thresholdRowFunction(const LightThresholdParams &p) {
+    bool red = (p.mainChannel == 2);  // and the hue wraps, see fromParamSet()
+    if (p.hsv) return red ? thresholdRow<true, true> : thresholdRow<true, false>;
+    return red ? thresholdRow<false, true> : thresholdRow<false, false>;
+}
+
+void thresholdLightsRow(const uint8_t *bgr, int width, const LightThresholdParams &p,
+                        uint8_t *lights, uint8_t *brightness, uint8_t *color) {
+    thresholdRowFunction(p)(bgr, width, p, lights, brightness, color);
+}
+
+void thresholdLights(const cv::Mat &bgr, const LightThresholdParams &p,
+                     cv::Mat *lights, cv::Mat *brightness, cv::Mat *color) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    for (cv::Mat *m : {lights, brightness, color}) {
+        if (m) m->create(bgr.size(), CV_8UC1);
+    }
+    auto thresholdRow = thresholdRowFunction(p);  // selected once for all rows
+    for (int y = 0; y < bgr.rows; y++) {
+        thresholdRow(bgr.ptr<uint8_t>(y), bgr.cols, p,
+                     lights ? lights->ptr<uint8_t>(y) : nullptr,
+                     brightness ? brightness->ptr<uint8_t>(y) : nullptr,
+                     color ? color->ptr<uint8_t>(y) : nullptr);
+    }
+}
+
+}
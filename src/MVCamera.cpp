@@ -4,22 +4,45 @@
 
 #include "Camera.h"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "Utilities.h"
+#include "PinnedMatAllocator.h"
+#include "ThreadScheduling.h"
 
 
 namespace meta {
 
+namespace {
+
+// MindVision names 8-bit Bayer types by the first two pixels of the first row
+BayerPattern bayerPatternOf(UINT mediaType) {
+    switch (mediaType) {
+        case CAMERA_MEDIA_TYPE_BAYRG8: return BayerPattern::RGGB;
+        case CAMERA_MEDIA_TYPE_BAYGR8: return BayerPattern::GRBG;
+        case CAMERA_MEDIA_TYPE_BAYGB8: return BayerPattern::GBRG;
+        case CAMERA_MEDIA_TYPE_BAYBG8: return BayerPattern::BGGR;
+        default: return BayerPattern::NONE;
+    }
+}
+
+}
+
 bool MVCamera::open(const package::ParamSet &params) {
 
+    stopWindowThread();  // of a previous open()
     this->params = params;
+    callbackThreadScheduled = false;
 
     capInfoSS.str(std::string());  // clear capInfoSS
 
     // CameraSdkInit should be called outside
 
-    int cameraCount = 1;
-    tSdkCameraDevInfo cameraEnumList;
+    // Several cameras (e.g. sentry) are told apart by camera_id, the index in enumeration
+    constexpr int MAX_CAMERA_COUNT = 4;
+    int cameraCount = MAX_CAMERA_COUNT;
+    tSdkCameraDevInfo cameraEnumList[MAX_CAMERA_COUNT];
     tSdkCameraCapbility capability;
 
 #define TRY_CALL(func, ...) do {                                         \
@@ -30,14 +53,20 @@ bool MVCamera::open(const package::ParamSet &params) {
         }                                                                      \
     } while(0)
 
-    TRY_CALL(CameraEnumerateDevice, &cameraEnumList, &cameraCount);
+    TRY_CALL(CameraEnumerateDevice, cameraEnumList, &cameraCount);
 
     if (cameraCount == 0) {
         std::cerr << "CameraCoreMVCamera: no MindVision camera found" << std::endl;
         return false;
     }
 
-    TRY_CALL(CameraInit, &cameraEnumList, -1, -1, &hCamera);
+    if (params.camera_id() < 0 || params.camera_id() >= cameraCount) {
+        std::cerr << "MVCamera: camera " << params.camera_id() << " not found, " << cameraCount << " cameras"
+                  << std::endl;
+        return false;
+    }
+
+    TRY_CALL(CameraInit, &cameraEnumList[params.camera_id()], -1, -1, &hCamera);
     TRY_CALL(CameraGetCapability, hCamera, &capability);
 
     capInfoSS << "Supported output formats: \n";
@@ -46,9 +75,30 @@ bool MVCamera::open(const package::ParamSet &params) {
                   << capability.pMediaTypeDesc[i].iMediaType << " \n";
     }
 
+    rawCapture = false;
+    rawFormat = BayerFormat();
+    if (params.raw_bayer_capture()) {
+        for (int i = 0; i < capability.iMediaTypdeDesc; i++) {
+            BayerPattern pattern = bayerPatternOf(capability.pMediaTypeDesc[i].iMediaType);
+            if (pattern != BayerPattern::NONE &&
+                CameraSetMediaType(hCamera, capability.pMediaTypeDesc[i].iIndex) == CAMERA_STATUS_SUCCESS) {
+                rawCapture = true;
+                rawFormat.pattern = pattern;
+                capInfoSS << "Note: raw Bayer capture (" << capability.pMediaTypeDesc[i].acDescription
+                          << "), ISP bypassed.\n";
+                break;
+            }
+        }
+        if (!rawCapture) {
+            capInfoSS << "Note: no 8-bit Bayer output, raw Bayer capture disabled.\n";
+        }
+    }
+
     TRY_CALL(CameraPlay, hCamera);
-    TRY_CALL(CameraSetOnceWB, hCamera);
-    TRY_CALL(CameraSetIspOutFormat, hCamera, CAMERA_MEDIA_TYPE_BGR8);
+    if (!rawCapture) {
+        TRY_CALL(CameraSetOnceWB, hCamera);
+        TRY_CALL(CameraSetIspOutFormat, hCamera, CAMERA_MEDIA_TYPE_BGR8);
+    }
 
     capInfoSS << "Note: FPS is not effective.\n";
 
@@ -73,27 +123,59 @@ bool MVCamera::open(const package::ParamSet &params) {
     resolution.iHeightFOV = resolution.iHeight = params.roi_height();
     TRY_CALL(CameraSetImageResolution, hCamera, &resolution);
     capInfoSS << "Note: ROI enabled.\n";
+    roiResolution = resolution;
+    minWindowSize = cv::Size(capability.sResolutionRange.iWidthMin, capability.sResolutionRange.iHeightMin);
 
     // Setup callback
-    buffer[0] = cv::Mat(cv::Size(params.roi_width(), params.roi_height()), CV_8UC3);
-    buffer[1] = cv::Mat(cv::Size(params.roi_width(), params.roi_height()), CV_8UC3);
+    frameSize = cv::Size(params.roi_width(), params.roi_height());
+    {
+        std::lock_guard<std::mutex> lock(windowMutex);
+        window = previousWindow = SensorWindow{cv::Rect(cv::Point(0, 0), frameSize), LatencyClock::now()};
+        requestedWindow = window.rect;
+        pendingWindow = cv::Rect();
+        windowChangeStart = window.since;
+        windowChanging = false;
+        windowThreadShouldExit = false;
+    }
+    lastWindowChange = LatencyClock::time_point();
+    if (params.dynamic_sensor_roi().enabled()) {
+        capInfoSS << "Note: sensor window following the target, " << sensorWindowAround({0, 0, 1, 1}).size()
+                  << " of the ROI.\n";
+        windowThread = std::thread(&MVCamera::applySensorWindows, this);
+    }
+    // Buffers of the whole ROI, so that sensor windows are views of them. Frames still held are prepared when reused.
+    framePool.preallocate(frameSize, rawCapture ? CV_8UC1 : CV_8UC3, pinnedMatAllocator(), true);
     shouldFetchNextFrame = true;
+    lastFrameSize = cv::Size();
+    cameraClock.reset();
     TRY_CALL(CameraSetCallbackFunction, hCamera, &MVCamera::newFrameCallback, this, nullptr);
 
-    // Wait for a test frame
-    while (shouldFetchNextFrame) std::this_thread::yield();
-    cv::Mat testFrame = getFrame();
-    fetchNextFrame();
-
-    if (buffer->empty()) {
-        capInfoSS << "Failed to fetch test image from camera " << params.camera_id() << "\n";
+    // Wait for a test frame (a frame of wrong size is not loaded but also ends waiting)
+    if (!waitUntil([this] { return !shouldFetchNextFrame || (!lastFrameSize.empty() && lastFrameSize != frameSize); },
+                   OPEN_TIMEOUT)) {
+        capInfoSS << "No frame from camera " << params.camera_id() << " in " << OPEN_TIMEOUT.count() << " ms\n";
         std::cerr << capInfoSS.rdbuf();
         return false;
     }
-    if (buffer[0].cols != params.roi_width() || buffer[0].rows != params.roi_height()) {
+    FrameHandle testFrame = getFrame();
+    cv::Size testFrameSize = lastFrameSize;  // written again by the callback after fetchNextFrame()
+    if (rawCapture && testFrame) {
+        // The callback reads rawFormat only while a frame is requested, i.e. not now
+        estimateWhiteBalance(testFrame.image(), rawFormat);
+        capInfoSS << "White balance gains (R, G, B): " << rawFormat.gains[0] << ", " << rawFormat.gains[1] << ", "
+                  << rawFormat.gains[2] << "\n";
+    }
+    fetchNextFrame();
+
+    if (testFrameSize != frameSize) {
         capInfoSS << "Invalid frame size. "
                   << "Expected: " << params.roi_width() << "x" << params.roi_height() << ", "
-                  << "Actual: " << buffer[0].cols << "x" << buffer[0].rows << "\n";
+                  << "Actual: " << testFrameSize.width << "x" << testFrameSize.height << "\n";
+        std::cerr << capInfoSS.rdbuf();
+        return false;
+    }
+    if (!testFrame) {
+        capInfoSS << "Failed to fetch test image from camera " << params.camera_id() << "\n";
         std::cerr << capInfoSS.rdbuf();
         return false;
     }
@@ -124,6 +206,11 @@ void MVCamera::newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFr
 
     auto p = static_cast<MVCamera *>(pContext);
 
+    if (!p->callbackThreadScheduled) {  // the grabbing thread of the SDK, always the same one
+        applyThreadScheduling(ThreadRole::CAPTURE, p->params);
+        p->callbackThreadScheduled = true;
+    }
+
     p->cumulativeFrameCounter++;  // count frame even if it's not processed
 
     if (!p->shouldFetchNextFrame) {  // do not process if not required
@@ -134,47 +221,181 @@ void MVCamera::newFrameCallback(CameraHandle hCamera, BYTE *pFrameBuffer, tSdkFr
     } else {
 
         tSdkFrameHead frameInfo = *pFrameHead;  // make a copy
-
-        uint8_t workingBuffer = 1 - p->lastBuffer;
-
-        cv::Mat &image = p->buffer[workingBuffer];
-        if (image.cols != p->params.roi_width() || p->params.roi_height()) {
-            image = cv::Mat(cv::Size(p->params.roi_width(), p->params.roi_height()), CV_8UC3);
+        auto arrivalTime = LatencyClock::now();
+        auto exposureTime = p->cameraClock.map(frameInfo.uiTimeStamp, arrivalTime);
+
+        // The configured ROI, or the sensor window the frame is exposed with
+        cv::Rect window, otherWindow;
+        bool exposedDuringChange;
+        {
+            std::lock_guard<std::mutex> lock(p->windowMutex);
+            exposedDuringChange = (exposureTime >= p->windowChangeStart &&
+                                   (p->windowChanging || exposureTime < p->window.since));
+            bool exposedAfterChange = (exposureTime >= p->window.since);
+            window = (exposedAfterChange ? p->window : p->previousWindow).rect;
+            otherWindow = (exposedAfterChange ? p->previousWindow : p->window).rect;
+        }
+        if (exposedDuringChange) {  // of either window, its offset is unknown
+            CameraReleaseImageBuffer(hCamera, pFrameBuffer);
+            return;
         }
 
-        auto res = CameraImageProcess(hCamera, pFrameBuffer, image.data, &frameInfo);  // load directly into buffer
-        if (res != CAMERA_STATUS_SUCCESS) {
-            std::cerr << "MVCamera: CameraImageProcess returned " << res << std::endl;
+        p->lastFrameSize = cv::Size(frameInfo.iWidth, frameInfo.iHeight);
+        if (p->lastFrameSize != window.size()) {
+            if (p->lastFrameSize != otherWindow.size()) {  // not just exposed around a change of the window
+                std::cerr << "MVCamera: unexpected frame size " << frameInfo.iWidth << "x" << frameInfo.iHeight
+                          << std::endl;
+            }
+            CameraReleaseImageBuffer(hCamera, pFrameBuffer);
+            p->notifyNewFrame();  // wake up open()
             return;
         }
 
-        if (p->recordingVideo) {
-            p->videoWriterMutex.lock();
-            {
-                if (p->videoWriter.isOpened()) p->videoWriter << image;
+        FrameSlot *slot = p->framePool.acquire();
+        if (!slot) {  // all frames held by consumers
+            p->framePool.countDroppedFrame();
+            CameraReleaseImageBuffer(hCamera, pFrameBuffer);
+            return;
+        }
+        // A view of the buffer of the whole ROI, allocated only if held since open()
+        FramePool::prepareView(slot, window.size(), p->frameSize, p->rawCapture ? CV_8UC1 : CV_8UC3,
+                               pinnedMatAllocator());
+        cv::Mat &image = slot->image;
+
+        if (p->rawCapture) {
+            std::memcpy(image.data, pFrameBuffer, image.total());  // sensor data as it is, demosaiced by consumers
+            slot->format = p->rawFormat;
+        } else {
+            auto res = CameraImageProcess(hCamera, pFrameBuffer, image.data, &frameInfo);  // load directly into slot
+            if (res != CAMERA_STATUS_SUCCESS) {
+                std::cerr << "MVCamera: CameraImageProcess returned " << res << std::endl;
+                FramePool::discard(slot);
+                CameraReleaseImageBuffer(hCamera, pFrameBuffer);
+                return;
             }
-            p->videoWriterMutex.unlock();
+            slot->format = BayerFormat();
         }
 
-        p->bufferCaptureTime[workingBuffer] = frameInfo.uiTimeStamp;
+        slot->captureTime = frameInfo.uiTimeStamp;
+        slot->arrivalTime = arrivalTime;
+        slot->exposureTime = exposureTime;
+        slot->offset = window.tl();
 
         // Switch frame
-        p->lastBuffer = workingBuffer;
+        p->framePool.publish(slot);
         p->shouldFetchNextFrame = false;
 
         CameraReleaseImageBuffer(hCamera, pFrameBuffer);
+        p->notifyNewFrame();
+
+        // Save frame if required, encoded on the thread of the recorder, which takes frames of the whole ROI only
+        if (p->recorder.isOpened() && window.size() == p->frameSize) p->recorder.push(p->getFrame());
         return;
     }
 
 }
 
+cv::Rect MVCamera::sensorWindowAround(const cv::Rect &region) const {
+    const cv::Rect roi(cv::Point(0, 0), frameSize);
+    auto alignDown = [](int v) { return v / SENSOR_WINDOW_ALIGNMENT * SENSOR_WINDOW_ALIGNMENT; };
+    auto alignUp = [&](int v) { return alignDown(v + SENSOR_WINDOW_ALIGNMENT - 1); };
+
+    float scale = params.dynamic_sensor_roi().val();
+    cv::Size size(std::max(alignDown((int) ((float) roi.width * scale)), alignUp(minWindowSize.width)),
+                  std::max(alignDown((int) ((float) roi.height * scale)), alignUp(minWindowSize.height)));
+    if (size.width >= roi.width || size.height >= roi.height || region.width > size.width ||
+        region.height > size.height) {
+        return roi;
+    }
+
+    cv::Point center = (region.tl() + region.br()) / 2;
+    return {alignDown(std::clamp(center.x - size.width / 2, 0, roi.width - size.width)),
+            alignDown(std::clamp(center.y - size.height / 2, 0, roi.height - size.height)),
+            size.width, size.height};
+}
+
+void MVCamera::followRegion(const cv::Rect &region) {
+    if (!params.dynamic_sensor_roi().enabled() || hCamera == 0) return;
+
+    cv::Rect current;
+    {
+        std::lock_guard<std::mutex> lock(windowMutex);
+        current = requestedWindow;  // posted but maybe not applied yet
+    }
+
+    // The whole ROI without a target, or while recording (a video is of one frame size)
+    cv::Rect next(cv::Point(0, 0), frameSize);
+    if (!region.empty() && !recorder.isOpened()) {
+        next = sensorWindowAround(region);
+        // Move only once the region reaches the border of the current window
+        if (next.size() == current.size() && (current & region) == region) return;
+    }
+    if (next == current) return;
+
+    auto now = LatencyClock::now();
+    if (now - lastWindowChange < SENSOR_WINDOW_MIN_INTERVAL) return;
+    lastWindowChange = now;
+
+    {
+        std::lock_guard<std::mutex> lock(windowMutex);
+        requestedWindow = pendingWindow = next;  // replaces one not taken yet
+    }
+    windowCondition.notify_one();
+}
+
+void MVCamera::applySensorWindows() {
+    applyThreadScheduling(ThreadRole::CAPTURE, params);
+
+    std::unique_lock<std::mutex> lock(windowMutex);
+    while (true) {
+        windowCondition.wait(lock, [this] { return windowThreadShouldExit || !pendingWindow.empty(); });
+        if (windowThreadShouldExit) return;
+        cv::Rect next = pendingWindow;
+        pendingWindow = cv::Rect();
+        windowChangeStart = LatencyClock::now();
+        windowChanging = true;
+        lock.unlock();
+
+        tSdkImageResolution resolution = roiResolution;
+        resolution.iHOffsetFOV += next.x;
+        resolution.iVOffsetFOV += next.y;
+        resolution.iWidthFOV = resolution.iWidth = next.width;
+        resolution.iHeightFOV = resolution.iHeight = next.height;
+        CameraSdkStatus res = CameraSetImageResolution(hCamera, &resolution);  // restarts the readout, blocks
+
+        lock.lock();
+        windowChanging = false;
+        if (res != CAMERA_STATUS_SUCCESS) {
+            windowChangeStart = window.since;  // unchanged, the frames exposed during the call are of it
+            std::cerr << "MVCamera: CameraSetImageResolution of window " << next << " returned " << res << std::endl;
+            if (pendingWindow.empty()) requestedWindow = window.rect;  // so that followRegion() posts it again
+            continue;
+        }
+        previousWindow = window;
+        window = SensorWindow{next, LatencyClock::now()};
+    }
+}
+
+void MVCamera::stopWindowThread() {
+    if (!windowThread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(windowMutex);
+        windowThreadShouldExit = true;
+    }
+    windowCondition.notify_one();
+    windowThread.join();
+}
+
 void MVCamera::close() {
+    stopWindowThread();
     CameraUnInit(hCamera);
-    bufferCaptureTime[0] = bufferCaptureTime[1] = 0;  // indicate invalid frame
+    framePool.publishEnd();  // indicate invalid frame
     hCamera = 0;
+    notifyNewFrame();
 }
 
 MVCamera::~MVCamera() {
+    stopWindowThread();
     if (hCamera) CameraUnInit(hCamera);
 }
 
@@ -0,0 +1,80 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "MaskRLE.h"
+#include <cstring>
+#include <algorithm>
+
+namespace meta {
+
+static void putVarint(std::string &out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char) (v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char) v);
+}
+
+static bool getVarint(const std::string &in, size_t &pos, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        auto byte = (uint8_t) in[pos++];
+        v |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void encodeMaskRLE(const uint8_t *data, int width, int height, size_t step, std::string &out, uint8_t threshold) {
+    out.clear();
+    bool on = false;    // state of the current run
+    uint64_t run = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = data + y * step;
+        int x = 0;
+        while (x < width) {
+            // Extend the current run as far as it goes in this row
+            int start = x;
+            if (on) {
+                while (x < width && row[x] >= threshold) x++;
+            } else {
+                while (x < width && row[x] < threshold) x++;
+            }
+            run += x - start;
+            if (x < width) {  // the state flips inside the row
+                putVarint(out, run);
+                run = 0;
+                on = !on;
+            }
+        }
+    }
+    putVarint(out, run);  // the last run, implied by the size but kept for validation
+}
+
+bool decodeMaskRLE(const std::string &in, int width, int height, uint8_t *out, size_t step) {
+    const uint64_t total = (uint64_t) width * height;
+    uint64_t filled = 0;
+    size_t pos = 0;
+    bool on = false;
+    int x = 0, y = 0;
+    while (pos < in.size()) {
+        uint64_t run;
+        if (!getVarint(in, pos, run) || run > total - filled) return false;
+        filled += run;
+        while (run > 0) {
+            auto n = (int) std::min<uint64_t>(run, width - x);
+            memset(out + y * step + x, on ? 255 : 0, n);
+            run -= n;
+            x += n;
+            if (x == width) {
+                x = 0;
+                y++;
+            }
+        }
+        on = !on;
+    }
+    return filled == total;
+}
+
+}
@@ -3,6 +3,22 @@
 //
 
 #include "NanoDet_TensorRT.h"
+#include "GpuMemoryPool.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include "spdlog/spdlog.h"
+
+#define TRT_ASSERT(expr)                                                      \
+    do{                                                                       \
+        if(!(expr)) {                                                         \
+            spdlog::error("assert fail: '" #expr "'");                        \
+            exit(-1);                                                         \
+        }                                                                     \
+    } while(0)
 
 
 inline float fast_exp(float x)
@@ -15,11 +31,6 @@ inline float fast_exp(float x)
     return v.f;
 }
 
-inline float sigmoid(float x)
-{
-    return 1.0f / (1.0f + fast_exp(-x));
-}
-
 template<typename Tp>
 int activation_function_softmax(const Tp* src, Tp* dst, int length)
 {
@@ -40,279 +51,276 @@ int activation_function_softmax(const Tp* src, Tp* dst, int length)
     return 0;
 }
 
-
-NanoDet_TensorRT::NanoDet_TensorRT() : stream(nullptr)
-{
-    cudaError_t error_code = cudaStreamCreate(&stream);
-    if (error_code != cudaSuccess) {
-        std::cerr << "CUDA error " << error_code << " at " << __FILE__ << ":" << __LINE__;\
-        assert(false);
+/*
+ * Bilinear resize (same sampling as cv::resize with INTER_LINEAR) and normalization of a BGR8 image into the planar
+ * (CHW, BGR) input of NanoDet, one thread per output pixel. The source is read from args when the kernel runs, so that
+ * a captured graph takes another frame without capturing it again.
+ */
+__global__ void nanodet_preprocess_kernel(const meta::NanoDet_TensorRT::preprocess_args_t *args,
+                                          float *dst, int dst_width, int dst_height) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= dst_width || y >= dst_height) return;
+    const uint8_t *src = args->src;
+    const int src_step = args->src_step, src_width = args->src_width, src_height = args->src_height;
+
+    const float mean[3] = {103.53f, 116.28f, 123.675f};
+    const float std_inv[3] = {0.017429f, 0.017507f, 0.017125f};
+
+    float sx = ((float) x + 0.5f) * (float) src_width / (float) dst_width - 0.5f;
+    float sy = ((float) y + 0.5f) * (float) src_height / (float) dst_height - 0.5f;
+    int x0 = (int) floorf(sx), y0 = (int) floorf(sy);
+    float ax = sx - (float) x0, ay = sy - (float) y0;
+    int x1 = min(max(x0 + 1, 0), src_width - 1), y1 = min(max(y0 + 1, 0), src_height - 1);
+    x0 = min(max(x0, 0), src_width - 1), y0 = min(max(y0, 0), src_height - 1);
+
+    const uint8_t *row0 = src + y0 * src_step, *row1 = src + y1 * src_step;
+    size_t plane = (size_t) dst_width * dst_height;
+    for (int c = 0; c < 3; c++) {
+        float top = (float) row0[x0 * 3 + c] * (1 - ax) + (float) row0[x1 * 3 + c] * ax;
+        float bottom = (float) row1[x0 * 3 + c] * (1 - ax) + (float) row1[x1 * 3 + c] * ax;
+        float pixel = top * (1 - ay) + bottom * ay;
+        dst[c * plane + y * dst_width + x] = (pixel - mean[c]) * std_inv[c];
     }
 }
 
-NanoDet_TensorRT::~NanoDet_TensorRT()
-{
-    cudaStreamDestroy(stream);
-//    cudaFree(gpu_buffers[0]);
-//    cudaFree(gpu_buffers[1]);
-//    cudaFreeHost(cpu_input_buffer);
-//    cudaFreeHost(cpu_output_buffer);
-    cudaFreeHost(zero_copy_buffers[0]);
-    cudaFreeHost(zero_copy_buffers[1]);
-}
+namespace meta {
 
-bool NanoDet_TensorRT::loadEngine(const std::string& engineFilePath) {
-    std::ifstream engineFile(engineFilePath, std::ios::binary);
-    if (!engineFile.is_open()) {
-        std::cout << "Error opening engine file: " << engineFilePath << std::endl;
-        return false;
-    }
-
-    size_t size;
-    engineFile.seekg(0, std::ifstream::end);
-    size = engineFile.tellg();
-    engineFile.seekg(0, std::ifstream::beg);
-    char *engineData = new char[size];
-    assert(engineData);
-    engineFile.read(engineData, size);
-    engineFile.close();
+    namespace fs = std::filesystem;
 
-    runtime.reset(nvinfer1::createInferRuntime(meta::gLogger));
-    assert(runtime != nullptr);
-    engine.reset(runtime->deserializeCudaEngine(engineData, size));
-    assert(engine != nullptr);
-    context.reset(engine->createExecutionContext());
-    assert(context != nullptr);
+    static inline size_t get_dims_size(const nvinfer1::Dims &dims) {
+        size_t sz = 1;
+        for (int i = 0; i < dims.nbDims; i++) sz *= dims.d[i];
+        return sz;
+    }
 
-    delete[] engineData;
+    bool NanoDet_TensorRT::is_engine_ready(const std::string &model_file, precision_t precision) {
+        return fs::exists(engine_file(model_file, precision));
+    }
 
-    prepare_buffer();
+    NanoDet_TensorRT::NanoDet_TensorRT(const std::string &model_file, precision_t precision, bool cuda_graph)
+            : Detector(precision, false), cuda_graph(cuda_graph) {
+        auto file = engine_file(model_file, precision);
+        std::ifstream ifs(file, std::ios::binary);
+        TRT_ASSERT(ifs.good());
+        ifs.seekg(0, std::ios::end);
+        size_t sz = ifs.tellg();
+        ifs.seekg(0, std::ios::beg);
+        auto buffer = std::make_unique<char[]>(sz);
+        ifs.read(buffer.get(), sz);
+
+        spdlog::info("NanoDet: Loading engine {}", file);
+        runtime.reset(nvinfer1::createInferRuntime(gLogger));
+        TRT_ASSERT(runtime != nullptr);
+        runtime->setGpuAllocator(GpuMemoryPool::instance().trtAllocator());
+        engine.reset(runtime->deserializeCudaEngine(buffer.get(), sz));
+        TRT_ASSERT(engine != nullptr);
+        TRT_ASSERT(engine->getNbBindings() == 2);
+
+        auto input_dims = engine->getBindingDimensions(0);     // [batch, 3, H, W]
+        auto output_dims = engine->getBindingDimensions(1);    // [batch, anchors, classes + 4 * (REG_MAX + 1)]
+        TRT_ASSERT(input_dims.nbDims == 4 && input_dims.d[1] == 3 && output_dims.nbDims == 3);
+        batch = input_dims.d[0];
+        TRT_ASSERT(batch >= 1);  // the batch dimension of the model must be static
+        input_ = {input_dims.d[3], input_dims.d[2]};
+        inputs = {input_};
+        anchor_count_ = output_dims.d[1];
+        num_class_ = output_dims.d[2] - 4 * (REG_MAX + 1);
+        TRT_ASSERT(num_class_ > 0 && num_class_ % TAG_COUNT == 0);
+        input_sz_ = get_dims_size(input_dims) / batch;
+        output_sz_ = get_dims_size(output_dims) / batch;
+
+        for (auto &slot : slots) {
+            slot.context.reset(engine->createExecutionContext());
+            TRT_ASSERT(slot.context != nullptr);
+            TRT_ASSERT(cudaStreamCreate(&slot.stream) == 0);
+            slot.input_device = static_cast<float *>(
+                    GpuMemoryPool::instance().allocate(batch * input_sz_ * sizeof(float), slot.stream));
+            TRT_ASSERT(slot.input_device != nullptr);
+            slot.output.reserve(batch * output_sz_ * sizeof(float));
+            slot.bindings[0] = slot.input_device;
+            slot.bindings[1] = slot.output.deviceData();
+            slot.launch_args.reserve(batch * sizeof(preprocess_args_t));
+            for (auto &event : slot.events) TRT_ASSERT(cudaEventCreate(&event) == 0);
+            slot.items.resize(batch);
+        }
+        spdlog::info("NanoDet: input {}x{}, {} classes, output {}, {} inference slots, batch {}{}",
+                     input_.width, input_.height, num_class_,
+                     slots[0].output.isMapped() ? "in mapped memory" : "copied back", INFER_SLOTS, batch,
+                     cuda_graph ? ", CUDA graphs" : "");
+    }
 
-    return true;
-}
+    NanoDet_TensorRT::~NanoDet_TensorRT() {
+        for (auto &slot : slots) {
+            if (slot.in_flight) cudaStreamSynchronize(slot.stream);
+            slot.context.reset();  // before the engine
+            GpuMemoryPool::instance().free(slot.input_device, slot.stream);
+            for (auto &event : slot.events) cudaEventDestroy(event);
+            cudaStreamDestroy(slot.stream);  // last, the free is ordered on it
+        }
+    }
 
-__global__ void preprocess_kernel(float *data, const float *image_data, int input_size, int channelLength, const float *img_mean, const float *img_std) {
-//    unsigned int c = blockIdx.x;
-    unsigned int idx = threadIdx.x + blockDim.x * blockIdx.y;
+    NanoDet_TensorRT::ticket_t NanoDet_TensorRT::submit_batch(const std::vector<cv::Mat> &frames,
+                                                              const std::vector<cv::Rect> &rois,
+                                                              const std::vector<BayerFormat> &formats) {
+        TRT_ASSERT(!frames.empty() && (int) frames.size() <= batch);
+        TRT_ASSERT(rois.empty() || rois.size() == frames.size());
+        TRT_ASSERT(std::none_of(formats.begin(), formats.end(), [](const BayerFormat &f) { return f.raw(); }));
+
+        ticket_t ticket = next_ticket++;
+        auto &slot = slots[ticket % INFER_SLOTS];
+        TRT_ASSERT(!slot.in_flight);  // more than INFER_SLOTS frames submitted without collecting
+        slot.ticket = ticket;
+        slot.in_flight = true;
+        slot.count = (int) frames.size();
+
+        cudaEventRecord(slot.events[0], slot.stream);
+        // Stage the frames first, the copies can't be in a graph (see YOLODet)
+        for (int i = 0; i < slot.count; i++) {
+            TRT_ASSERT(frames[i].type() == CV_8UC3);
+            cv::Rect roi = (rois.empty() ? cv::Rect() : rois[i]);
+            const cv::Mat src = (roi.empty() ? frames[i] : frames[i](roi));  // view, no copying
+            auto &item = slot.items[i];
+            item.fx = (float) src.cols / (float) input_.width, item.fy = (float) src.rows / (float) input_.height;
+            item.ox = (float) roi.x, item.oy = (float) roi.y;
+
+            size_t sz = src.step[0] * (src.rows - 1) + src.cols * src.elemSize();  // src may be a region of a frame
+            item.src = static_cast<const uint8_t *>(item.staging.stage(src.data, sz, slot.stream));
+            item.src_step = (int) src.step[0], item.src_width = src.cols, item.src_height = src.rows;
+        }
 
-    if (idx < channelLength) {
-        int row = idx / input_size;
-        int col = idx % input_size;
-//        int offset = c * channelLength + row * input_size + col;
-        int offset = idx;
+        // Sources of the frames, read by the kernel when it runs. The slot is not in flight, so the last submission
+        // has read them.
+        auto *args = static_cast<preprocess_args_t *>(slot.launch_args.hostData());
+        for (int i = 0; i < slot.count; i++) {
+            const auto &item = slot.items[i];
+            args[i] = {item.src, item.src_step, item.src_width, item.src_height};
+        }
+        slot.launch_args.toDevice(slot.count * sizeof(preprocess_args_t), slot.stream);
+
+        if (cuda_graph) {
+            // The decoding is on the CPU and the sources are in launch_args, so a graph only takes the batch count
+            auto &key = slot.graph_key;
+            key.assign({(uint64_t) slot.count});
+            cudaEventRecord(slot.events[1], slot.stream);
+            slot.graph.launch(key, slot.stream, [&] {
+                enqueue_preprocess(slot);
+                slot.context->enqueueV2(slot.bindings, slot.stream, nullptr);
+                slot.output.toHost(slot.count * output_sz_ * sizeof(float), slot.stream);
+            });
+            cudaEventRecord(slot.events[2], slot.stream);
+        } else {
+            enqueue_preprocess(slot);
+            cudaEventRecord(slot.events[1], slot.stream);
+            slot.context->enqueueV2(slot.bindings, slot.stream, nullptr);
+            cudaEventRecord(slot.events[2], slot.stream);
+            slot.output.toHost(slot.count * output_sz_ * sizeof(float), slot.stream);
+        }
+        cudaEventRecord(slot.events[3], slot.stream);
 
-        float pixel = image_data[offset];
-        data[offset] = (pixel - img_mean[0]) * img_std[0];
+        return ticket;
     }
-}
-
-void NanoDet_TensorRT::preprocess(cv::Mat& image) const {
-    float* data = zero_copy_buffers[0];
-    float* data2 = new float[10];
-    image.convertTo(image, CV_32FC3, 1 / 1.0);
-    std::vector<cv::Mat> split_img(3);
-    cv::split(image, split_img);
-    int channelLength = input_size_ * input_size_;
-    static const float img_mean[3] = { 103.53f, 116.28f, 123.675f };
-    static const float img_std[3] = { 0.017429f, 0.017507f, 0.017125f };
-//    #pragma omp parallel for default(none) shared(split_img, data, img_mean, img_std, channelLength)
-//    for (int i = 0; i < 3; ++i) {
-//        float* local_data = cpu_data + i * channelLength;
-//        split_img[i] = (split_img[i] - img_mean[i]) * img_std[i];
-//        memcpy(local_data, split_img[i].data, channelLength * sizeof(float));
-//    }
-//    for (int c = 0; c < 3; c++) {
-//        for (int i = 0; i < channelLength; ++i) {
-//            float pixel_value = image.at<cv::Vec3f>(i / input_size_, i % input_size_)[c];
-//            data[i] = (pixel_value - img_mean[c]) * img_std[c];
-//        }
-//        data += channelLength;
-//    }
-    dim3 blockDim(256);
-//    dim3 gridDim(3, (channelLength + blockDim.x - 1) / blockDim.x);
-    dim3 gridDim(3 * (channelLength + blockDim.x - 1) / blockDim.x);
-//    preprocess_kernel<<<gridDim, blockDim, 0, stream>>>(data, reinterpret_cast<const float *>(image.data), input_size_, channelLength, img_mean, img_std);
-//    preprocess_kernel<<<gridDim, blockDim>>>(data, image.data, input_size_, channelLength, img_mean, img_std);
-    cudaStreamSynchronize(stream);
-}
 
-std::vector<BoxInfo> NanoDet_TensorRT::detect(cv::Mat& image, float score_threshold, float nms_threshold) {
-    // Preprocess
-    auto t_start_pre = std::chrono::high_resolution_clock::now();
-    preprocess(image);
-    auto t_end_pre = std::chrono::high_resolution_clock::now();
-    float total_pre = std::chrono::duration<float, std::milli>(t_end_pre - t_start_pre).count();
-    std::cout << "detection prepare image take: " << total_pre << " ms." << std::endl;
-
-    // Inference
-    auto t_start = std::chrono::high_resolution_clock::now();
-    infer();
-    auto t_end = std::chrono::high_resolution_clock::now();
-    float total_inf = std::chrono::duration<float, std::milli>(t_end - t_start).count();
-    std::cout << "detection inference take: " << total_inf << " ms." << std::endl;
-
-    // Postprocess
-    auto r_start = std::chrono::high_resolution_clock::now();
-    std::vector<std::vector<BoxInfo>> results;
-    results.resize(this->num_class_);
-    t_start = std::chrono::high_resolution_clock::now();
-    postprocess(score_threshold, results);
-    t_end = std::chrono::high_resolution_clock::now();
-    auto total_post = std::chrono::duration<float, std::milli>(t_end - t_start).count();
-    std::cout << "true detection postprocess take: " << total_post << " ms." << std::endl;
-    std::vector<BoxInfo> dets;
-    for (auto & result : results) {
-        nms(result, nms_threshold);
-        for (auto box : result) {
-            dets.push_back(box);
+    void NanoDet_TensorRT::enqueue_preprocess(infer_slot_t &slot) {
+        const dim3 block(32, 8);
+        const dim3 grid((input_.width + block.x - 1) / block.x, (input_.height + block.y - 1) / block.y);
+        const auto *args = static_cast<const preprocess_args_t *>(slot.launch_args.deviceData());
+        for (int i = 0; i < slot.count; i++) {
+            nanodet_preprocess_kernel<<<grid, block, 0, slot.stream>>>(args + i, slot.input_device + i * input_sz_,
+                                                                       input_.width, input_.height);
         }
+        // Unused batch entries keep stale input, their results are ignored
     }
-    auto r_end = std::chrono::high_resolution_clock::now();
-    float total_res = std::chrono::duration<float, std::milli>(r_end - r_start).count();
-    std::cout << "detection postprocess take: " << total_res << " ms." << std::endl;
 
-    return dets;
-}
+    std::vector<std::vector<NanoDet_TensorRT::bbox_t>> NanoDet_TensorRT::collect_batch(ticket_t ticket) {
+        auto &slot = slots[ticket % INFER_SLOTS];
+        TRT_ASSERT(slot.in_flight && slot.ticket == ticket);
+        cudaStreamSynchronize(slot.stream);
+        slot.in_flight = false;
+        cudaEventElapsedTime(&timing.preprocess_ms, slot.events[0], slot.events[1]);
+        cudaEventElapsedTime(&timing.inference_ms, slot.events[1], slot.events[2]);
+        cudaEventElapsedTime(&timing.postprocess_ms, slot.events[2], slot.events[3]);
+        auto cpu_start = std::chrono::steady_clock::now();
+
+        std::vector<std::vector<bbox_t>> rst(slot.count);
+        for (int i = 0; i < slot.count; i++) {
+            postprocess(static_cast<const float *>(slot.output.hostData()) + i * output_sz_, slot.items[i], rst[i]);
+        }
+        auto cpu_time = std::chrono::steady_clock::now() - cpu_start;
+        timing.postprocess_ms += std::chrono::duration<float, std::milli>(cpu_time).count();
+        return rst;
+    }
 
-void NanoDet_TensorRT::postprocess(float threshold, std::vector<std::vector<BoxInfo>>& results)
-{
-    if (zero_copy_buffers[1] == nullptr)
-        return;
-    int total_idx = 0;
-    for (int stage_idx = 0; stage_idx < (int)strides_.size(); stage_idx++)
-    {
-        int stride = this->strides_[stage_idx];
-        int feature_h = ceil(double(this->input_size_) / stride);
-        int feature_w = ceil(double(this->input_size_) / stride);
-        // cv::Mat debug_heatmap = cv::Mat::zeros(feature_h, feature_w, CV_8UC3);
-
-        for (int idx = total_idx; idx < feature_h * feature_w + total_idx; idx++)
-        {
-            int row = (idx - total_idx) / feature_w;
-            int col = (idx - total_idx) % feature_w;
-            float score = -0.0f;
-            int cur_label = 0;
-            for (int label = 0; label < this->num_class_; label++) {
-                float cur_score = zero_copy_buffers[1][idx * (num_class_ + 4 * (reg_max_ + 1))+ label];
-                if (cur_score > score) {
-                    score = cur_score;
-                    cur_label = label;
-                }
-            }
-            if (score > threshold) {
-                //std::cout << "label:" << cur_label << " score:" << score << std::endl;
-                const float* bbox_pred = &zero_copy_buffers[1][idx * (num_class_ + 4 * (reg_max_ + 1)) + num_class_];
-                results[cur_label].push_back(this->disPred2Bbox(bbox_pred, cur_label, score, col, row, stride));
-                // debug_heatmap.at<cv::Vec3b>(row, col)[0] = 255;
-                // cv::imshow("debug", debug_heatmap);
+    void NanoDet_TensorRT::postprocess(const float *output, const batch_item_t &item,
+                                       std::vector<bbox_t> &boxes) const {
+        const int stride_len = num_class_ + 4 * (REG_MAX + 1);
+        int total_idx = 0;
+        for (int stride : strides_) {
+            int feature_h = (int) std::ceil((double) input_.height / stride);
+            int feature_w = (int) std::ceil((double) input_.width / stride);
+            for (int idx = total_idx; idx < feature_h * feature_w + total_idx && idx < anchor_count_; idx++) {
+                const float *scores = output + idx * stride_len;
+                int label = (int) (std::max_element(scores, scores + num_class_) - scores);
+                if (scores[label] <= SCORE_THRES) continue;
+                int row = (idx - total_idx) / feature_w;
+                int col = (idx - total_idx) % feature_w;
+                boxes.emplace_back(distance_to_bbox(scores + num_class_, label, scores[label], col, row, stride));
             }
+            total_idx += feature_h * feature_w;
         }
-        total_idx += feature_h * feature_w;
-    }
-}
 
-BoxInfo NanoDet_TensorRT::disPred2Bbox(const float*& dfl_det, int label, float score, int x, int y, int stride) const {
-    float ct_x = (x + 0.5) * stride;
-    float ct_y = (y + 0.5) * stride;
-    std::vector<float> dis_pred;
-    dis_pred.resize(4);
-    for (int i = 0; i < 4; i++) {
-        float dis = 0;
-        float* dis_after_sm = new float[this->reg_max_ + 1];
-        activation_function_softmax(dfl_det + i * (this->reg_max_ + 1), dis_after_sm, this->reg_max_ + 1);
-        for (int j = 0; j < this->reg_max_ + 1; j++) {
-            dis += j * dis_after_sm[j];
+        // Class-agnostic as YOLODet, armors of different classes do not overlap either
+        nms(boxes, NMS_THRES);
+        for (auto &box : boxes) {
+            for (auto &pt : box.pts) pt.x = pt.x * item.fx + item.ox, pt.y = pt.y * item.fy + item.oy;
         }
-        dis *= stride;
-        //std::cout << "dis:" << dis << std::endl;
-        dis_pred[i] = dis;
-        delete[] dis_after_sm;
     }
-    float xmin = (std::max)(ct_x - dis_pred[0], .0f);
-    float ymin = (std::max)(ct_y - dis_pred[1], .0f);
-    float xmax = (std::min)(ct_x + dis_pred[2], (float)this->input_size_);
-    float ymax = (std::min)(ct_y + dis_pred[3], (float)this->input_size_);
 
-    //std::cout << xmin << "," << ymin << "," << xmax << "," << xmax << "," << std::endl;
-    return BoxInfo { xmin, ymin, xmax, ymax, score, label };
-}
-
-void NanoDet_TensorRT::nms(std::vector<BoxInfo>& input_boxes, float NMS_THRESH)
-{
-    std::sort(input_boxes.begin(), input_boxes.end(), [](BoxInfo a, BoxInfo b) { return a.score > b.score; });
-    std::vector<float> vArea(input_boxes.size());
-    for (int i = 0; i < int(input_boxes.size()); ++i)
-    {
-        vArea[i] = (input_boxes.at(i).x2 - input_boxes.at(i).x1 + 1)
-                   * (input_boxes.at(i).y2 - input_boxes.at(i).y1 + 1);
-    }
-    for (int i = 0; i < int(input_boxes.size()); ++i)
-    {
-        for (int j = i + 1; j < int(input_boxes.size());)
-        {
-            float xx1 = (std::max)(input_boxes[i].x1, input_boxes[j].x1);
-            float yy1 = (std::max)(input_boxes[i].y1, input_boxes[j].y1);
-            float xx2 = (std::min)(input_boxes[i].x2, input_boxes[j].x2);
-            float yy2 = (std::min)(input_boxes[i].y2, input_boxes[j].y2);
-            float w = (std::max)(float(0), xx2 - xx1 + 1);
-            float h = (std::max)(float(0), yy2 - yy1 + 1);
-            float inter = w * h;
-            float ovr = inter / (vArea[i] + vArea[j] - inter);
-            if (ovr >= NMS_THRESH)
-            {
-                input_boxes.erase(input_boxes.begin() + j);
-                vArea.erase(vArea.begin() + j);
-            }
-            else
-            {
-                j++;
-            }
+    Detector::bbox_t NanoDet_TensorRT::distance_to_bbox(const float *dfl_det, int label, float score, int x, int y,
+                                                        int stride) const {
+        float ct_x = ((float) x + 0.5f) * (float) stride;
+        float ct_y = ((float) y + 0.5f) * (float) stride;
+        std::array<float, 4> dis_pred{};
+        std::array<float, REG_MAX + 1> dis_after_sm{};
+        for (int i = 0; i < 4; i++) {
+            activation_function_softmax(dfl_det + i * (REG_MAX + 1), dis_after_sm.data(), REG_MAX + 1);
+            float dis = 0;
+            for (int j = 0; j < REG_MAX + 1; j++) dis += (float) j * dis_after_sm[j];
+            dis_pred[i] = dis * (float) stride;
         }
+        float xmin = std::max(ct_x - dis_pred[0], 0.0f);
+        float ymin = std::max(ct_y - dis_pred[1], 0.0f);
+        float xmax = std::min(ct_x + dis_pred[2], (float) input_.width);
+        float ymax = std::min(ct_y + dis_pred[3], (float) input_.height);
+
+        // bottom left, top left, top right, bottom right, as YOLODet
+        return bbox_t{{cv::Point2f(xmin, ymax), cv::Point2f(xmin, ymin), cv::Point2f(xmax, ymin),
+                       cv::Point2f(xmax, ymax)},
+                      score, label / TAG_COUNT, label % TAG_COUNT};
     }
-}
 
-void NanoDet_TensorRT::prepare_buffer() {
-    auto volume = [](const nvinfer1::Dims& d) -> int64_t {
-        return std::accumulate(d.d, d.d + d.nbDims, 1, std::multiplies<>());
-    };
-    assert(engine->getNbBindings() == 2);
-
-    // Malloc Input Buffer
-    nvinfer1::Dims input_dims = engine->getBindingDimensions(0);
-    nvinfer1::DataType input_dtype = engine->getBindingDataType(0);
-    input_buffer_size = volume(input_dims) * meta::getTrtElementSize(input_dtype);
-//    cudaMalloc(&gpu_buffers[0], input_buffer_size);
-
-    // Malloc Input Buffer on CPU
-//    cudaMallocHost(&cpu_input_buffer, input_buffer_size);
-
-    // Zero Copy Input Buffer (only for Jetson)
-    cudaHostAlloc(&zero_copy_buffers[0], input_buffer_size, cudaHostAllocMapped);
-    cudaError_t error = cudaHostGetDevicePointer(&gpu_buffers[0], zero_copy_buffers[0], cudaMemAttachGlobal);
-    if (error != cudaSuccess) {
-        std::cout << "cudaHostGetDevicePointer failed: " << cudaGetErrorString(error) << std::endl;
+    void NanoDet_TensorRT::nms(std::vector<bbox_t> &boxes, float nms_threshold) {
+        std::sort(boxes.begin(), boxes.end(), [](const bbox_t &a, const bbox_t &b) {
+            return a.confidence > b.confidence;
+        });
+        // pts[1] is the top left and pts[3] the bottom right
+        auto area = [](const bbox_t &b) { return (b.pts[3].x - b.pts[1].x + 1) * (b.pts[3].y - b.pts[1].y + 1); };
+        std::vector<bbox_t> kept;
+        kept.reserve(boxes.size());
+        for (const auto &box : boxes) {
+            bool suppressed = false;
+            for (const auto &k : kept) {
+                float w = std::max(0.0f, std::min(box.pts[3].x, k.pts[3].x) - std::max(box.pts[1].x, k.pts[1].x) + 1);
+                float h = std::max(0.0f, std::min(box.pts[3].y, k.pts[3].y) - std::max(box.pts[1].y, k.pts[1].y) + 1);
+                float inter = w * h;
+                if (inter / (area(box) + area(k) - inter) >= nms_threshold) {
+                    suppressed = true;
+                    break;
+                }
+            }
+            if (!suppressed) kept.emplace_back(box);
+        }
+        boxes.swap(kept);
     }
 
-    // Malloc Output Buffer
-    nvinfer1::Dims output_dims = engine->getBindingDimensions(1);
-    nvinfer1::DataType output_dtype = engine->getBindingDataType(1);
-    output_buffer_size = volume(output_dims) * meta::getTrtElementSize(output_dtype);
-//    cudaMalloc(&gpu_buffers[1], input_buffer_size);
-
-    // Malloc Output Buffer on CPU
-//    cudaMallocHost(&cpu_output_buffer, output_buffer_size);
-
-    // Zero Copy Output Buffer (only for Jetson)
-    cudaHostAlloc(&zero_copy_buffers[1], output_buffer_size, cudaHostAllocMapped);
-    cudaHostGetDevicePointer(&gpu_buffers[1], zero_copy_buffers[1], cudaMemAttachGlobal);
-}
-
-void NanoDet_TensorRT::infer() {
-//    cudaMemcpyAsync(gpu_buffers[0], cpu_input_buffer, input_buffer_size, cudaMemcpyHostToDevice, stream);
-//    cudaStreamSynchronize(stream);
-    context->enqueueV2((void **) zero_copy_buffers, stream, nullptr); // Async execution
-//    context->executeV2(gpu_buffers); // Synchronous execution
-//    cudaMemcpyAsync(cpu_output_buffer, gpu_buffers[1], output_buffer_size, cudaMemcpyDeviceToHost, stream);
-    cudaStreamSynchronize(stream);
-}
-
+} // meta
@@ -0,0 +1,75 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "NumberClassifier.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#include <opencv2/imgproc.hpp>
+
+namespace meta {
+
+// NN_MODEL_ROOT defined in CMakeLists.txt
+std::string NumberClassifier::modelFile() { return std::string(NN_MODEL_ROOT) + "/number-classifier.onnx"; }
+
+NumberClassifier::NumberClassifier(const std::string &onnxFile) {
+    if (!std::filesystem::exists(onnxFile)) {
+        spdlog::warn("NumberClassifier: {} not found, armor numbers are not classified", onnxFile);
+        return;
+    }
+    try {
+        net = cv::dnn::readNetFromONNX(onnxFile);
+        net.setPreferableBackend(cv::dnn::DNN_BACKEND_OPENCV);
+        net.setPreferableTarget(cv::dnn::DNN_TARGET_CPU);
+        loaded = true;
+    } catch (const cv::Exception &e) {
+        spdlog::error("NumberClassifier: failed to load {}: {}", onnxFile, e.what());
+    }
+}
+
+void NumberClassifier::classify(const cv::Mat &img, const std::vector<std::array<cv::Point2f, 4>> &armors,
+                                const std::vector<char> &largeArmor, std::vector<Result> &results) {
+    const int n = (int) armors.size();
+    results.assign(n, Result());
+    if (!loaded || n == 0) return;
+
+    // Patches of all armors, into one batch
+    const int blobShape[] = {n, 1, PATCH_H, PATCH_W};
+    blob.create(4, blobShape, CV_32F);
+    for (int i = 0; i < n; i++) {
+        const int width = largeArmor[i] ? LARGE_ARMOR_WIDTH : SMALL_ARMOR_WIDTH;
+        const float top = (float) (PATCH_H - LIGHT_LENGTH) / 2 - 1, bottom = top + LIGHT_LENGTH;
+        const cv::Point2f dst[4] = {{0, bottom}, {0, top}, {(float) width - 1, top}, {(float) width - 1, bottom}};
+        cv::Mat transform = cv::getPerspectiveTransform(armors[i].data(), dst);
+        cv::warpPerspective(img, patch, transform, cv::Size(width, PATCH_H));
+
+        // The sticker is the middle of the armor, between the lights
+        cv::Mat sticker = patch.colRange((width - PATCH_W) / 2, (width + PATCH_W) / 2);
+        if (sticker.channels() == 3) {
+            cv::cvtColor(sticker, gray, cv::COLOR_BGR2GRAY);
+        } else {
+            sticker.copyTo(gray);
+        }
+        cv::threshold(gray, binary, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+
+        cv::Mat input(PATCH_H, PATCH_W, CV_32F, blob.ptr<float>(i));
+        binary.convertTo(input, CV_32F, 1.0 / 255);
+    }
+
+    net.setInput(blob);
+    net.forward(outputs);
+    const cv::Mat logits = outputs[0].reshape(1, n);  // [N, CLASS_COUNT]
+
+    for (int i = 0; i < n; i++) {
+        const float *row = logits.ptr<float>(i);
+        int best = (int) (std::max_element(row, row + CLASS_COUNT) - row);
+        float sum = 0;
+        for (int c = 0; c < CLASS_COUNT; c++) sum += std::exp(row[c] - row[best]);  // softmax, stable
+        results[i].number = CLASS_NUMBERS[best];
+        results[i].confidence = 1.0f / sum;
+    }
+}
+
+}
@@ -3,6 +3,7 @@
 //
 
 #include "Camera.h"
+#include "ThreadScheduling.h"
 #include <iostream>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <spdlog/spdlog.h>
@@ -15,13 +16,11 @@ bool OpenCVCamera::open(const package::ParamSet &params) {
         close();
     }
     threadShouldExit = false;
+    cameraClock.reset();
     th = new std::thread(&OpenCVCamera::readFrameFromCamera, this, params);
 
-    buffer[0] = cv::Mat(cv::Size(params.roi_width(), params.roi_height()), CV_8UC3);
-    buffer[1] = cv::Mat(cv::Size(params.roi_width(), params.roi_height()), CV_8UC3);
-    while (getFrame().empty()) std::this_thread::yield();
-
-    return true;
+    // Wait for the first frame (none if the camera fails to open)
+    return waitUntil([this] { return (bool) getFrame(); }, std::chrono::milliseconds(3000));
 }
 
 OpenCVCamera::~OpenCVCamera() {
@@ -34,6 +33,7 @@ OpenCVCamera::~OpenCVCamera() {
 }
 
 void OpenCVCamera::readFrameFromCamera(const package::ParamSet &params) {
+    applyThreadScheduling(ThreadRole::CAPTURE, params);
     capInfoSS.str(std::string());  // clear capInfoSS
 
     // Open the camera in the same thread
@@ -80,16 +80,17 @@ void OpenCVCamera::readFrameFromCamera(const package::ParamSet &params) {
     }
 
     // Get a test frame
-    cap.read(buffer[0]);
-    if (buffer->empty()) {
+    cv::Mat testFrame;
+    cap.read(testFrame);
+    if (testFrame.empty()) {
         capInfoSS << "Failed to fetch test image from camera " << params.camera_id() << "\n";
         spdlog::error(capInfoSS.str());
         return;
     }
-    if (buffer[0].cols != params.image_width() || buffer[0].rows != params.image_height()) {
+    if (testFrame.cols != params.image_width() || testFrame.rows != params.image_height()) {
         capInfoSS << "Invalid frame size. "
                   << "Expected: " << params.image_width() << "x" << params.image_height() << ", "
-                  << "Actual: " << buffer[0].cols << "x" << buffer[0].rows << "\n";
+                  << "Actual: " << testFrame.cols << "x" << testFrame.rows << "\n";
         spdlog::error(capInfoSS.str());
         return;
     }
@@ -105,41 +106,48 @@ void OpenCVCamera::readFrameFromCamera(const package::ParamSet &params) {
 
     while (true) {
 
-        uint8_t workingBuffer = 1 - lastBuffer;
-
         if (threadShouldExit || !cap.isOpened()) {
-            bufferCaptureTime[workingBuffer] = 0;  // indicate invalid frame
-            lastBuffer = workingBuffer;  // switch
             break;
         }
 
-        if (!cap.read(buffer[workingBuffer])) {
+        FrameSlot *slot = framePool.acquire();
+        if (!slot) {  // all frames held by consumers
+            framePool.countDroppedFrame();
+            cap.grab();
+            continue;
+        }
+        cv::Mat &image = slot->image;
+        if (!image.empty()) {
+            image.adjustROI(image.rows, image.rows, image.cols, image.cols);  // back to the whole frame, to read into
+        }
+
+        if (!cap.read(image)) {
+            FramePool::discard(slot);
             continue;  // try again
         }
+        slot->arrivalTime = LatencyClock::now();
 
         // Software crop
-        buffer[workingBuffer] = buffer[workingBuffer](cv::Rect{
+        image = image(cv::Rect{
                 (params.image_width() - params.roi_width()) / 2,
                 (params.image_height() - params.roi_height()) / 2,
                 params.roi_width(),
                 params.roi_height()});
 
-        // Save frame if required
-        if (recordingVideo) {
-            videoWriterMutex.lock();
-            {
-                if (videoWriter.isOpened()) videoWriter << buffer[workingBuffer];
-            }
-            videoWriterMutex.unlock();
-        }
+        slot->captureTime = (TimePoint) (cap.get(cv::CAP_PROP_POS_MSEC) * 10);
+        slot->exposureTime = cameraClock.map(slot->captureTime, slot->arrivalTime);
 
-        bufferCaptureTime[workingBuffer] = (TimePoint) (cap.get(cv::CAP_PROP_POS_MSEC) * 10);
+        framePool.publish(slot);
+        notifyNewFrame();
 
-        lastBuffer = workingBuffer;
+        // Save frame if required, encoded on the thread of the recorder
+        if (recorder.isOpened()) recorder.push(getFrame());
 
         ++cumulativeFrameCounter;  // the only place of incrementing
     }
 
+    framePool.publishEnd();  // indicate invalid frame
+    notifyNewFrame();
     cap.release();
     spdlog::info("OpenCVCamera: closed");
 }
@@ -0,0 +1,242 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "PackedImageSet.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace meta {
+
+static constexpr char PACK_MAGIC[8] = {'S', 'O', 'L', 'P', 'A', 'C', 'K', '\0'};
+static constexpr uint32_t PACK_VERSION = 1;
+static constexpr uint64_t FRAME_ALIGNMENT = 4096;  // page size, for frames to be mapped in place
+
+struct FileHeader {
+    char magic[8];         // zero until the writer finishes
+    uint32_t version;
+    uint32_t frameCount;
+    int32_t width;
+    int32_t height;
+    int32_t type;
+    uint32_t reserved;
+    uint64_t indexOffset;  // frameCount entries
+};
+
+struct PackedImageSet::Entry {
+    uint64_t frameOffset;
+    uint64_t nameOffset;
+    uint64_t annotationOffset;
+    uint32_t nameSize;
+    uint32_t annotationSize;
+};
+
+struct PackedImageSet::Mapping {
+    uint8_t *base = nullptr;
+    size_t size = 0;
+
+    ~Mapping() {
+        if (base) munmap(base, size);
+    }
+};
+
+/**
+ * Allocator of the frames of a mapping. It only owns a reference to the mapping, and Mats that are reallocated (e.g.
+ * resized in place) get standard memory.
+ */
+class MappedFrameAllocator : public cv::MatAllocator {
+public:
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData *u, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData *u) const override {
+        if (!u) return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        delete static_cast<std::shared_ptr<const void> *>(u->userdata);
+        delete u;
+    }
+};
+
+static MappedFrameAllocator *mappedFrameAllocator() {
+    static auto *allocator = new MappedFrameAllocator;  // never destroyed, Mats may outlive static destruction
+    return allocator;
+}
+
+static size_t frameBytes(cv::Size size, int type) {
+    return (size_t) size.width * size.height * CV_ELEM_SIZE(type);
+}
+
+bool PackedImageSet::isPackFile(const fs::path &file) {
+    return strcasecmp(file.extension().c_str(), EXTENSION) == 0;
+}
+
+bool PackedImageSet::open(const fs::path &file) {
+    close();
+
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "PackedImageSet: failed to open " << file << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(FileHeader)) {
+        std::cerr << "PackedImageSet: " << file << " is not a packed image set\n";
+        ::close(fd);
+        return false;
+    }
+
+    // Private and writable: copy-on-write pages, so that Mats may be written as any other frame
+    auto m = std::make_shared<Mapping>();
+    m->size = st.st_size;
+    void *p = mmap(nullptr, m->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // the mapping keeps the file
+    if (p == MAP_FAILED) {
+        std::cerr << "PackedImageSet: failed to map " << file << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    m->base = static_cast<uint8_t *>(p);
+    madvise(m->base, m->size, MADV_SEQUENTIAL);  // replayed in order, read ahead aggressively
+
+    // Validate everything once, so that accessors need no check
+    const auto &header = *reinterpret_cast<const FileHeader *>(m->base);
+    const size_t bytes = frameBytes(cv::Size(header.width, header.height), header.type);
+    bool valid = memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0 && header.version == PACK_VERSION &&
+                 header.width > 0 && header.height > 0 && header.indexOffset % alignof(Entry) == 0 &&
+                 header.indexOffset <= m->size &&
+                 header.frameCount <= (m->size - header.indexOffset) / sizeof(Entry);
+    auto inFile = [&](uint64_t offset, uint64_t size) { return offset <= m->size && size <= m->size - offset; };
+    auto index = reinterpret_cast<const Entry *>(m->base + header.indexOffset);
+    for (uint32_t i = 0; valid && i < header.frameCount; i++) {
+        valid = index[i].frameOffset % FRAME_ALIGNMENT == 0 && inFile(index[i].frameOffset, bytes) &&
+                inFile(index[i].nameOffset, index[i].nameSize) &&
+                inFile(index[i].annotationOffset, index[i].annotationSize);
+    }
+    if (!valid) {
+        std::cerr << "PackedImageSet: " << file << " is incomplete or of another version\n";
+        return false;
+    }
+
+    mapping = std::move(m);
+    entries = index;
+    count = header.frameCount;
+    imageSize = cv::Size(header.width, header.height);
+    type = header.type;
+    return true;
+}
+
+void PackedImageSet::close() {
+    mapping.reset();  // unmapped after the last frame is released
+    entries = nullptr;
+    count = 0;
+}
+
+cv::Mat PackedImageSet::frame(size_t index) const {
+    auto data = mapping->base + entries[index].frameOffset;
+    cv::Mat mat(imageSize, type, data);
+
+    // Take over the header as if allocated, for the reference counting to hold the mapping
+    auto u = new cv::UMatData(mappedFrameAllocator());
+    u->data = u->origdata = data;
+    u->size = frameBytes(imageSize, type);
+    u->userdata = new std::shared_ptr<const void>(mapping);
+    u->refcount = 1;
+    mat.allocator = mappedFrameAllocator();
+    mat.u = u;
+    return mat;
+}
+
+std::string_view PackedImageSet::name(size_t index) const {
+    return {reinterpret_cast<const char *>(mapping->base + entries[index].nameOffset), entries[index].nameSize};
+}
+
+std::string_view PackedImageSet::annotation(size_t index) const {
+    return {reinterpret_cast<const char *>(mapping->base + entries[index].annotationOffset),
+            entries[index].annotationSize};
+}
+
+bool PackedImageSet::Writer::open(const fs::path &file, cv::Size frameSize, int frameType) {
+    size = frameSize;
+    type = frameType;
+    pending.clear();
+    out.open(file, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "PackedImageSet: failed to create " << file << "\n";
+        return false;
+    }
+    FileHeader header{};  // no magic yet
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pad();
+    return (bool) out;
+}
+
+void PackedImageSet::Writer::pad() {
+    static const char zeros[FRAME_ALIGNMENT] = {};
+    auto offset = (uint64_t) out.tellp();
+    out.write(zeros, (std::streamsize) ((FRAME_ALIGNMENT - offset % FRAME_ALIGNMENT) % FRAME_ALIGNMENT));
+}
+
+bool PackedImageSet::Writer::add(const std::string &name, const cv::Mat &frame, const std::string &annotation) {
+    if (frame.size() != size || frame.type() != type) {
+        std::cerr << "PackedImageSet: " << name << " differs in size or type from the other frames\n";
+        return false;
+    }
+    pending.emplace_back(PendingEntry{(uint64_t) out.tellp(), name, annotation});
+    const size_t rowBytes = frame.cols * frame.elemSize();
+    for (int row = 0; row < frame.rows; row++) {  // not necessarily continuous
+        out.write(reinterpret_cast<const char *>(frame.ptr(row)), (std::streamsize) rowBytes);
+    }
+    pad();
+    return (bool) out;
+}
+
+bool PackedImageSet::Writer::finish() {
+    std::vector<Entry> index;
+    index.reserve(pending.size());
+    for (const auto &p : pending) {
+        Entry entry{p.frameOffset, 0, 0, (uint32_t) p.name.size(), (uint32_t) p.annotation.size()};
+        entry.nameOffset = out.tellp();
+        out.write(p.name.data(), (std::streamsize) p.name.size());
+        entry.annotationOffset = out.tellp();
+        out.write(p.annotation.data(), (std::streamsize) p.annotation.size());
+        index.emplace_back(entry);
+    }
+    static const char zeros[alignof(Entry)] = {};
+    out.write(zeros, (std::streamsize) ((alignof(Entry) - (uint64_t) out.tellp() % alignof(Entry)) % alignof(Entry)));
+
+    FileHeader header{};
+    header.version = PACK_VERSION;
+    header.frameCount = index.size();
+    header.width = size.width;
+    header.height = size.height;
+    header.type = type;
+    header.indexOffset = out.tellp();
+    out.write(reinterpret_cast<const char *>(index.data()), (std::streamsize) (index.size() * sizeof(Entry)));
+
+    // The header with the magic last, so that an interrupted conversion leaves an invalid file
+    memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    pending.clear();
+    if (out.fail()) {
+        std::cerr << "PackedImageSet: failed to write the packed file\n";
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,84 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ParamSetDiff.h"
+#include <google/protobuf/descriptor.h>
+
+namespace meta {
+
+using google::protobuf::FieldDescriptor;
+
+ParamMask paramMask(std::initializer_list<int> fieldNumbers) {
+    ParamMask mask;
+    for (int number : fieldNumbers) mask.set(number);
+    return mask;
+}
+
+ParamMask diffParamSets(const ParamSet &a, const ParamSet &b) {
+    const auto *descriptor = ParamSet::descriptor();
+    const auto *reflection = ParamSet::GetReflection();
+
+    ParamMask mask;
+    for (int i = 0; i < descriptor->field_count(); i++) {
+        const FieldDescriptor *field = descriptor->field(i);
+        if (field->number() >= PARAM_MASK_BITS) return ParamMask().set();  // treat as all changed
+
+        bool same;
+        switch (field->cpp_type()) {
+            case FieldDescriptor::CPPTYPE_INT32:
+                same = reflection->GetInt32(a, field) == reflection->GetInt32(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_INT64:
+                same = reflection->GetInt64(a, field) == reflection->GetInt64(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_UINT32:
+                same = reflection->GetUInt32(a, field) == reflection->GetUInt32(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_UINT64:
+                same = reflection->GetUInt64(a, field) == reflection->GetUInt64(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_FLOAT:
+                same = reflection->GetFloat(a, field) == reflection->GetFloat(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_DOUBLE:
+                same = reflection->GetDouble(a, field) == reflection->GetDouble(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_BOOL:
+                same = reflection->GetBool(a, field) == reflection->GetBool(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_ENUM:
+                same = reflection->GetEnumValue(a, field) == reflection->GetEnumValue(b, field);
+                break;
+            case FieldDescriptor::CPPTYPE_MESSAGE:
+                // Small messages of a few scalars (ToggledFloat, IntPair, etc.)
+                same = reflection->GetMessage(a, field).SerializePartialAsString() ==
+                       reflection->GetMessage(b, field).SerializePartialAsString();
+                break;
+            default:
+                same = false;
+                break;
+        }
+        if (!same) mask.set(field->number());
+    }
+    return mask;
+}
+
+void PendingParams::post(const ParamSet &params, const ParamMask &changed) {
+    // Only the consumer takes the update away, so after taking back ours, no one else stores into pending
+    ParamUpdate *old = pending.exchange(nullptr, std::memory_order_acquire);
+    auto *update = new ParamUpdate{params, changed | (old ? old->changed : ParamMask())};
+    delete old;
+    pending.store(update, std::memory_order_release);
+}
+
+bool PendingParams::take(ParamUpdate &update) {
+    if (pending.load(std::memory_order_relaxed) == nullptr) return false;  // cheap check every frame
+    ParamUpdate *p = pending.exchange(nullptr, std::memory_order_acquire);
+    if (!p) return false;
+    update = std::move(*p);
+    delete p;
+    return true;
+}
+
+}
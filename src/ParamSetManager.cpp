@@ -11,18 +11,93 @@
 #include <google/protobuf/util/json_util.h>
 #include <boost/asio/ip/host_name.hpp>
 #include <fstream>
+#include <cstring>
+#include <string_view>
 
 namespace meta {
 
+namespace {
+
+constexpr uint32_t CACHE_MAGIC = 0x42505053;  // "SPPB"
+constexpr uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    int64_t mtime;        // of the JSON file
+    uint64_t size;        // of the JSON file
+    uint64_t jsonHash;    // of the content of the JSON file
+    uint64_t schemaHash;  // of the fields of ParamSet, so that a cache of another build is not taken
+};
+
+uint64_t fnv1aHash(std::string_view data) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t schemaHash() {
+    static const uint64_t hash = fnv1aHash(ParamSet::descriptor()->DebugString());
+    return hash;
+}
+
+/**
+ * Write a file aside and rename it, so that the file is either the old one or the new one, even after a crash.
+ */
+bool writeFileAtomically(const fs::path &filename, const std::string &content) {
+    fs::path tmp = filename;
+    tmp += ".tmp";
+    {
+        std::ofstream file(tmp.string(), std::ios::binary | std::ios::trunc);
+        file.write(content.data(), (std::streamsize) content.size());
+        if (!file) {
+            spdlog::error("ParamSetManager: failed to write {}", tmp.string());
+            return false;
+        }
+    }
+    std::error_code ec;
+    fs::rename(tmp, filename, ec);
+    if (ec) {
+        spdlog::error("ParamSetManager: failed to replace {}: {}", filename.string(), ec.message());
+        return false;
+    }
+    return true;
+}
+
+std::string readFile(const fs::path &filename) {
+    std::ifstream file(filename.string(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+}
+
 // PARAM_SET_ROOT defined in CMakeLists.txt
 ParamSetManager::ParamSetManager()
-        : paramSetRoot(fs::path(PARAM_SET_ROOT) / "params"), defaultParamSetName(boost::asio::ip::host_name()) {
+        : paramSetRoot(fs::path(PARAM_SET_ROOT) / "params"), cacheRoot(paramSetRoot / ".cache"),
+          defaultParamSetName(boost::asio::ip::host_name()) {
     spdlog::info("ParamSetManager: paramSetRoot = {}", paramSetRoot.string());
     spdlog::info("ParamSetManager: using default ParamSet {}.json", defaultParamSetName);
 
     if (!fs::exists(paramSetRoot / ".." / "params_backup")) {
         fs::create_directories(paramSetRoot / ".." / "params_backup");
     }
+    if (!fs::exists(cacheRoot)) {
+        fs::create_directories(cacheRoot);
+    }
+
+    saveThread = std::thread(&ParamSetManager::runSaveThread, this);
+}
+
+ParamSetManager::~ParamSetManager() {
+    {
+        std::lock_guard<std::mutex> lock(saveMutex);
+        saveThreadShouldExit = true;
+    }
+    saveCondition.notify_all();
+    saveThread.join();
 }
 
 void ParamSetManager::reloadParamSetList() {
@@ -41,12 +116,18 @@ void ParamSetManager::reloadParamSetList() {
         params.set_enemy_color(ParamSet::BLUE);
         params.set_video_speed(1);
         params.set_video_playback_speed(1);
+        params.set_video_decode_queue_depth(8);
+        params.set_video_replay_mode(ParamSet::REAL_TIME);
 
         params.set_camera_backend(ParamSet::OPENCV);
         params.set_camera_id(0);
         params.set_fps(120);
         params.set_allocated_gamma(allocToggledFloat(false));
         params.set_allocated_manual_exposure(allocToggledInt(false));
+        params.set_raw_bayer_capture(false);
+        params.set_allocated_dynamic_sensor_roi(allocToggledFloat(false, 0.5));
+        params.set_v4l2_buffer_count(8);
+        params.set_allocated_secondary_camera(allocToggledInt(false, 1));
 
         params.set_brightness_threshold(155);
 
@@ -65,6 +146,7 @@ void ParamSetManager::reloadParamSetList() {
         params.set_allocated_long_edge_min_length(allocToggledInt(true, 30));
         params.set_allocated_light_aspect_ratio(allocToggledFloatRange(true, 2, 30));
         params.set_allocated_light_max_rotation(allocToggledFloat(true, 15));
+        params.set_allocated_parallel_bands(allocToggledInt(false, 4));
 
         params.set_allocated_light_length_max_ratio(allocToggledFloat(true, 1.5));
         params.set_allocated_light_x_dist_over_l(allocToggledFloatRange(false, 1, 3));
@@ -77,6 +159,7 @@ void ParamSetManager::reloadParamSetList() {
 
         params.set_allocated_small_armor_size(allocIntPair(120, 60));
         params.set_allocated_large_armor_size(allocIntPair(240, 60));
+        params.set_allocated_number_classifier(allocToggledFloat(false, 0.7));
 
         params.set_pulse_min_x_offset(500);
         params.set_pulse_max_y_offset(300);
@@ -86,6 +169,24 @@ void ParamSetManager::reloadParamSetList() {
         params.set_tk_target_dist_offset(-50);
         params.set_tracking_life_time(40);
         params.set_allocated_manual_delta_offset(allocFloatPair(0, 0));
+        params.set_allocated_motion_prediction(allocToggledFloat(false, 15));
+        params.set_allocated_motion_filter_noise(allocFloatPair(5, 20));
+        params.set_allocated_pipelined_execution(allocToggledInt(false, 2));
+        params.set_pipeline_drop_oldest(true);
+        params.set_allocated_tracking_roi(allocToggledInt(false, 10));
+        params.set_allocated_adaptive_quality(allocToggledFloat(false, 10));
+        params.set_allocated_latency_budget(allocToggledFloat(false, 30));
+        params.set_telemetry_log(false);
+        params.set_detector_model(ParamSet::YOLOV5);
+        params.set_detector_device(ParamSet::GPU);
+        params.set_light_fusion(false);
+        params.set_detection_contexts(2);
+        params.set_terminal_image_encoding(ParamSet::CPU_JPEG);
+        params.set_allocated_capture_thread_scheduling(allocIntPair(0, 0));
+        params.set_allocated_detection_thread_scheduling(allocIntPair(0, 0));
+        params.set_allocated_serial_thread_scheduling(allocIntPair(0, 0));
+        params.set_allocated_io_thread_scheduling(allocIntPair(0, 0));
+        params.set_lock_memory(false);
 
         spdlog::info("ParamSetManager: create default ParamSet {}.json", defaultParamSetName);
         saveParamSetToJson(params, paramSetRoot / (defaultParamSetName + ".json"));
@@ -102,42 +203,140 @@ void ParamSetManager::reloadParamSetList() {
     }
 
     curParamSetName = defaultParamSetName;  // switch to default
+
+    // So that switching is instant
+    for (const auto &name : paramsSetNames) loadParamSet(name);
 }
 
 ParamSet ParamSetManager::loadCurrentParamSet() const {
-    ParamSet p;
-    auto filename = paramSetRoot / (curParamSetName + ".json");
+    return loadParamSet(curParamSetName);
+}
 
-    std::ifstream file(filename.string());
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+ParamSet ParamSetManager::loadParamSet(const std::string &name) const {
+    {
+        std::lock_guard<std::mutex> lock(saveMutex);
+        auto it = pendingSaves.find(name);
+        if (it != pendingSaves.end()) return it->second.params;  // not written yet
+    }
 
-    auto status = JsonStringToMessage(content, &p, google::protobuf::util::JsonParseOptions());
-    if (!status.ok()) {
-        spdlog::error("Failed to load {} : {}", filename.string(), status.message().as_string());
+    auto filename = paramSetRoot / (name + ".json");
+    std::error_code ec;
+    auto mtime = fs::last_write_time(filename, ec);
+    uintmax_t size = (ec ? 0 : fs::file_size(filename, ec));
+    if (ec) {
+        spdlog::error("Failed to load {} : {}", filename.string(), ec.message());
         return ParamSet();
-    } else {
-        return p;
     }
+    {
+        std::lock_guard<std::mutex> lock(loadedMutex);
+        auto it = loaded.find(name);
+        if (it != loaded.end() && it->second.mtime == mtime && it->second.size == size) return it->second.params;
+    }
+
+    ParamSet p;
+    std::string content = readFile(filename);
+    if (!loadBinaryCache(name, content, mtime, p)) {
+        auto status = JsonStringToMessage(content, &p, google::protobuf::util::JsonParseOptions());
+        if (!status.ok()) {
+            spdlog::error("Failed to load {} : {}", filename.string(), status.message().as_string());
+            return ParamSet();
+        }
+        saveBinaryCache(name, content, mtime, p);
+    }
+
+    std::lock_guard<std::mutex> lock(loadedMutex);
+    loaded[name] = {p, mtime, size};
+    return p;
+}
+
+bool ParamSetManager::loadBinaryCache(const std::string &name, const std::string &json,
+                                      const fs::file_time_type &mtime, ParamSet &p) const {
+    std::string cache = readFile(cacheRoot / (name + ".bin"));
+    if (cache.size() < sizeof(CacheHeader)) return false;
+    CacheHeader header;
+    memcpy(&header, cache.data(), sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+        header.mtime != (int64_t) mtime.time_since_epoch().count() || header.size != json.size() ||
+        header.schemaHash != schemaHash() || header.jsonHash != fnv1aHash(json)) {
+        return false;
+    }
+    // Fails as well if a required field is missing
+    return p.ParseFromArray(cache.data() + sizeof(header), (int) (cache.size() - sizeof(header)));
+}
+
+void ParamSetManager::saveBinaryCache(const std::string &name, const std::string &json,
+                                      const fs::file_time_type &mtime, const ParamSet &p) const {
+    CacheHeader header{CACHE_MAGIC, CACHE_VERSION, (int64_t) mtime.time_since_epoch().count(), json.size(),
+                       fnv1aHash(json), schemaHash()};
+    std::string cache(reinterpret_cast<const char *>(&header), sizeof(header));
+    p.AppendToString(&cache);
+    writeFileAtomically(cacheRoot / (name + ".bin"), cache);
 }
 
 void ParamSetManager::saveCurrentParamSet(const ParamSet &p) {
-    saveParamSetToJson(p, paramSetRoot / (curParamSetName + ".json"));
+    {
+        std::lock_guard<std::mutex> lock(saveMutex);
+        auto &pending = pendingSaves[curParamSetName];
+        pending.params = p;
+        pending.version++;
+    }
+    saveCondition.notify_all();
+}
 
-    // Backup
-    fs::path filename = paramSetRoot / ".." / "params_backup" / fs::path(curParamSetName + "_" + currentTimeString() + ".json");
-    saveParamSetToJson(p, filename);  // simply overwrite if exists
+void ParamSetManager::flush() {
+    std::unique_lock<std::mutex> lock(saveMutex);
+    saveCondition.wait(lock, [this] { return pendingSaves.empty(); });
 }
 
-void ParamSetManager::saveParamSetToJson(const ParamSet &p, const fs::path &filename) {
+void ParamSetManager::runSaveThread() {
+    std::unique_lock<std::mutex> lock(saveMutex);
+    while (true) {
+        saveCondition.wait(lock, [this] { return !pendingSaves.empty() || saveThreadShouldExit; });
+        if (pendingSaves.empty()) break;  // exiting, everything is written
+
+        std::string name = pendingSaves.begin()->first;
+        PendingSave save = pendingSaves.begin()->second;
+        lock.unlock();
+        writeParamSet(name, save.params);
+        lock.lock();
+
+        // Unless saved again in the meantime
+        auto it = pendingSaves.find(name);
+        if (it != pendingSaves.end() && it->second.version == save.version) pendingSaves.erase(it);
+        saveCondition.notify_all();  // for flush()
+    }
+}
+
+void ParamSetManager::writeParamSet(const std::string &name, const ParamSet &p) {
+    auto filename = paramSetRoot / (name + ".json");
     std::string content;
+    if (saveParamSetToJson(p, filename, &content)) {
+        std::error_code ec;
+        auto mtime = fs::last_write_time(filename, ec);
+        if (!ec) {
+            saveBinaryCache(name, content, mtime, p);
+            std::lock_guard<std::mutex> lock(loadedMutex);
+            loaded[name] = {p, mtime, content.size()};
+        }
+    }
+
+    // Backup
+    fs::path backup = paramSetRoot / ".." / "params_backup" / fs::path(name + "_" + currentTimeString() + ".json");
+    saveParamSetToJson(p, backup);  // simply overwrite if exists
+}
+
+bool ParamSetManager::saveParamSetToJson(const ParamSet &p, const fs::path &filename, std::string *content) {
+    std::string json;
 
     google::protobuf::util::JsonPrintOptions options;
     options.add_whitespace = true;
     options.always_print_primitive_fields = true;
     options.preserve_proto_field_names = true;
-    MessageToJsonString(p, &content, options);
+    MessageToJsonString(p, &json, options);
 
-    std::ofstream(filename.string()) << content;
+    bool written = writeFileAtomically(filename, json);
+    if (content) *content = std::move(json);
+    return written;
 }
 
-}
\ No newline at end of file
+}
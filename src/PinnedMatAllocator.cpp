@@ -0,0 +1,83 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "PinnedMatAllocator.h"
+#include <spdlog/spdlog.h>
+
+#ifdef ON_JETSON
+#include <cuda_runtime_api.h>
+#endif
+
+namespace meta {
+
+#ifdef ON_JETSON
+
+/**
+ * Same as the standard allocator of OpenCV except that memory comes from cudaHostAlloc. Note that on older Tegra
+ * (Nano/TX2) pinned memory is not cached by the CPU, so it suits buffers that are mainly read on GPU.
+ */
+class PinnedMatAllocator : public cv::MatAllocator {
+public:
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data0, size_t *step, cv::AccessFlag,
+                           cv::UMatUsageFlags) const override {
+        size_t total = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; i--) {
+            if (step) {
+                if (data0 && step[i] != CV_AUTOSTEP) {
+                    CV_Assert(total <= step[i]);
+                    total = step[i];
+                } else {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+
+        void *data = data0;
+        if (!data) {
+            cudaError_t err = cudaHostAlloc(&data, total, cudaHostAllocMapped);
+            if (err != cudaSuccess) {
+                spdlog::error("PinnedMatAllocator: cudaHostAlloc of {} bytes failed: {}", total, cudaGetErrorString(err));
+                CV_Error(cv::Error::StsNoMem, "cudaHostAlloc failed");
+            }
+        }
+
+        auto u = new cv::UMatData(this);
+        u->data = u->origdata = static_cast<uchar *>(data);
+        u->size = total;
+        if (data0) u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    bool allocate(cv::UMatData *u, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return u != nullptr;
+    }
+
+    void deallocate(cv::UMatData *u) const override {
+        if (!u) return;
+        CV_Assert(u->urefcount == 0);
+        CV_Assert(u->refcount == 0);
+        if (!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+            cudaFreeHost(u->origdata);
+            u->origdata = nullptr;
+        }
+        delete u;
+    }
+};
+
+cv::MatAllocator *pinnedMatAllocator() {
+    static auto *allocator = new PinnedMatAllocator;  // never destroyed, Mats may outlive static destruction
+    return allocator;
+}
+
+#else
+
+cv::MatAllocator *pinnedMatAllocator() {
+    return cv::Mat::getStdAllocator();
+}
+
+#endif
+
+}
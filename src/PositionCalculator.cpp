@@ -4,27 +4,193 @@
 
 #include "PositionCalculator.h"
 #include <opencv2/calib3d.hpp>
+#include <cmath>
+#include <algorithm>
 #include <utility>
 
 namespace meta {
 
+namespace {
+
+/*
+ * IPPE in plain fixed-size arrays. Object points are (x, y) on the plane z = 0, centered at the origin, and image points
+ * are normalized (undistorted, K^-1 applied).
+ */
+
+// Solve A x = b with Gaussian elimination and partial pivoting. A and b are destroyed.
+bool solveLinear8(double A[8][8], double b[8], double x[8]) {
+    for (int col = 0; col < 8; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 8; row++) {
+            if (std::abs(A[row][col]) > std::abs(A[pivot][col])) pivot = row;
+        }
+        if (std::abs(A[pivot][col]) < 1e-12) return false;
+        if (pivot != col) {
+            std::swap(A[pivot], A[col]);
+            std::swap(b[pivot], b[col]);
+        }
+        for (int row = col + 1; row < 8; row++) {
+            double f = A[row][col] / A[col][col];
+            for (int k = col; k < 8; k++) A[row][k] -= f * A[col][k];
+            b[row] -= f * b[col];
+        }
+    }
+    for (int row = 7; row >= 0; row--) {
+        double s = b[row];
+        for (int k = row + 1; k < 8; k++) s -= A[row][k] * x[k];
+        x[row] = s / A[row][row];
+    }
+    return true;
+}
+
+// Homography (h22 = 1) from the plane to the image through four points
+bool computeHomography(const double obj[4][2], const double img[4][2], double H[3][3]) {
+    double A[8][8], b[8], h[8];
+    for (int i = 0; i < 4; i++) {
+        double X = obj[i][0], Y = obj[i][1], u = img[i][0], v = img[i][1];
+        double r0[8] = {X, Y, 1, 0, 0, 0, -u * X, -u * Y};
+        double r1[8] = {0, 0, 0, X, Y, 1, -v * X, -v * Y};
+        std::copy(r0, r0 + 8, A[2 * i]);
+        std::copy(r1, r1 + 8, A[2 * i + 1]);
+        b[2 * i] = u;
+        b[2 * i + 1] = v;
+    }
+    if (!solveLinear8(A, b, h)) return false;
+    H[0][0] = h[0], H[0][1] = h[1], H[0][2] = h[2];
+    H[1][0] = h[3], H[1][1] = h[4], H[1][2] = h[5];
+    H[2][0] = h[6], H[2][1] = h[7], H[2][2] = 1;
+    return true;
+}
+
+// Rotation that takes the z-axis to the direction of (p, q, 1)
+void rotationFromZAxis(double p, double q, double R[3][3]) {
+    double n = std::sqrt(p * p + q * q + 1);
+    double bx = p / n, by = q / n, c = 1 / n;  // cosine of the angle to the z-axis, always > 0
+    // Rodrigues with axis z x b = (-by, bx, 0): R = I + [v]x + [v]x^2 / (1 + c)
+    double k = 1 / (1 + c);
+    R[0][0] = 1 - k * bx * bx, R[0][1] = -k * bx * by, R[0][2] = bx;
+    R[1][0] = -k * bx * by, R[1][1] = 1 - k * by * by, R[1][2] = by;
+    R[2][0] = -bx, R[2][1] = -by, R[2][2] = c;
+}
+
+// The two rotations that fit the Jacobian J of the homography at the origin, whose image is (p, q)
+bool computeRotations(const double J[2][2], double p, double q, double R1[3][3], double R2[3][3]) {
+    double Rv[3][3];
+    rotationFromZAxis(p, q, Rv);
+
+    // B = [I2 | -(p, q)] Rv[:, 0:2], A = B^-1 J
+    double b00 = Rv[0][0] - p * Rv[2][0], b01 = Rv[0][1] - p * Rv[2][1];
+    double b10 = Rv[1][0] - q * Rv[2][0], b11 = Rv[1][1] - q * Rv[2][1];
+    double det = b00 * b11 - b01 * b10;
+    if (std::abs(det) < 1e-12) return false;
+    double i00 = b11 / det, i01 = -b01 / det, i10 = -b10 / det, i11 = b00 / det;
+    double a00 = i00 * J[0][0] + i01 * J[1][0], a01 = i00 * J[0][1] + i01 * J[1][1];
+    double a10 = i10 * J[0][0] + i11 * J[1][0], a11 = i10 * J[0][1] + i11 * J[1][1];
+
+    // Largest singular value of A
+    double ata00 = a00 * a00 + a10 * a10, ata01 = a00 * a01 + a10 * a11, ata11 = a01 * a01 + a11 * a11;
+    double gamma2 = 0.5 * (ata00 + ata11 + std::sqrt((ata00 - ata11) * (ata00 - ata11) + 4 * ata01 * ata01));
+    if (!(gamma2 > 1e-24)) return false;
+    double gamma = std::sqrt(gamma2);
+
+    // The top-left 2x2 of the rotation in the frame of Rv, completed to unit orthogonal columns in two ways
+    double r00 = a00 / gamma, r01 = a01 / gamma, r10 = a10 / gamma, r11 = a11 / gamma;
+    double c0 = std::sqrt(std::max(0.0, 1 - r00 * r00 - r10 * r10));
+    double c1 = std::sqrt(std::max(0.0, 1 - r01 * r01 - r11 * r11));
+    if (r00 * r01 + r10 * r11 > 0) c1 = -c1;  // columns orthogonal: r00 r01 + r10 r11 + c0 c1 = 0
+
+    for (int s = 0; s < 2; s++) {
+        double (*R)[3] = (s == 0 ? R1 : R2);
+        double sign = (s == 0 ? 1 : -1);
+        double col0[3] = {r00, r10, sign * c0};
+        double col1[3] = {r01, r11, sign * c1};
+        double col2[3] = {col0[1] * col1[2] - col0[2] * col1[1],
+                          col0[2] * col1[0] - col0[0] * col1[2],
+                          col0[0] * col1[1] - col0[1] * col1[0]};
+        for (int i = 0; i < 3; i++) {
+            R[i][0] = Rv[i][0] * col0[0] + Rv[i][1] * col0[1] + Rv[i][2] * col0[2];
+            R[i][1] = Rv[i][0] * col1[0] + Rv[i][1] * col1[1] + Rv[i][2] * col1[2];
+            R[i][2] = Rv[i][0] * col2[0] + Rv[i][1] * col2[1] + Rv[i][2] * col2[2];
+        }
+    }
+    return true;
+}
+
+// Least-squares translation for a rotation: [1 0 -u; 0 1 -v] (R P + t) = 0 for each point
+bool computeTranslation(const double R[3][3], const double obj[4][2], const double img[4][2], double t[3]) {
+    double M[3][3] = {}, r[3] = {};
+    for (int i = 0; i < 4; i++) {
+        double X = obj[i][0], Y = obj[i][1], u = img[i][0], v = img[i][1];
+        double P[3] = {R[0][0] * X + R[0][1] * Y, R[1][0] * X + R[1][1] * Y, R[2][0] * X + R[2][1] * Y};
+        double rows[2][3] = {{1, 0, -u}, {0, 1, -v}};
+        double rhs[2] = {-(P[0] - u * P[2]), -(P[1] - v * P[2])};
+        for (int k = 0; k < 2; k++) {
+            for (int a = 0; a < 3; a++) {
+                for (int c = 0; c < 3; c++) M[a][c] += rows[k][a] * rows[k][c];
+                r[a] += rows[k][a] * rhs[k];
+            }
+        }
+    }
+    // Cramer's rule on the 3x3 normal equations
+    auto det3 = [](const double m[3][3]) {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    };
+    double d = det3(M);
+    if (std::abs(d) < 1e-12) return false;
+    for (int c = 0; c < 3; c++) {
+        double Mc[3][3];
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) Mc[a][b] = (b == c ? r[a] : M[a][b]);
+        }
+        t[c] = det3(Mc) / d;
+    }
+    return true;
+}
+
+double reprojectionError(const double R[3][3], const double t[3], const double obj[4][2], const double img[4][2]) {
+    double error = 0;
+    for (int i = 0; i < 4; i++) {
+        double X = obj[i][0], Y = obj[i][1];
+        double x = R[0][0] * X + R[0][1] * Y + t[0];
+        double y = R[1][0] * X + R[1][1] * Y + t[1];
+        double z = R[2][0] * X + R[2][1] * Y + t[2];
+        if (z <= 0) return HUGE_VAL;  // behind the camera
+        double du = x / z - img[i][0], dv = y / z - img[i][1];
+        error += du * du + dv * dv;
+    }
+    return error;
+}
+
+}
+
 void PositionCalculator::setParameters(cv::Point2f smallArmorSize_, cv::Point2f largeArmorSize_,
-                                       const cv::Mat &cameraMatrix_, const cv::Mat &distCoeffs_, float zScale_) {
+                                       const cv::Mat &cameraMatrix_, const cv::Mat &distCoeffs_, float zScale_,
+                                       cv::Size imageSize_) {
     smallArmorSize = std::move(smallArmorSize_);
     largeArmorSize = std::move(largeArmorSize_);
-    cameraMatrix = cameraMatrix_;
-    distCoeffs = distCoeffs_;
     zScale = zScale_;
 
-    smallArmorObjectPoints = {{-smallArmorSize.x / 2, smallArmorSize.y / 2,  0},
-                              {-smallArmorSize.x / 2, -smallArmorSize.y / 2, 0},
-                              {smallArmorSize.x / 2,  -smallArmorSize.y / 2, 0},
-                              {smallArmorSize.x / 2,  smallArmorSize.y / 2,  0}};
+    auto sameMat = [](const cv::Mat &a, const cv::Mat &b) {
+        return a.size() == b.size() && a.type() == b.type() && (a.empty() || cv::norm(a, b, cv::NORM_INF) == 0);
+    };
+    if (!sameMat(cameraMatrix, cameraMatrix_) || !sameMat(distCoeffs, distCoeffs_) || imageSize != imageSize_ ||
+        undistortMap.empty()) {
+        cameraMatrix = cameraMatrix_.clone();
+        distCoeffs = distCoeffs_.clone();
+        imageSize = imageSize_;
+        buildUndistortMap();
+    }
+
+    smallArmorObjectPoints = {cv::Point3d{-smallArmorSize.x / 2, smallArmorSize.y / 2,  0},
+                              cv::Point3d{-smallArmorSize.x / 2, -smallArmorSize.y / 2, 0},
+                              cv::Point3d{smallArmorSize.x / 2,  -smallArmorSize.y / 2, 0},
+                              cv::Point3d{smallArmorSize.x / 2,  smallArmorSize.y / 2,  0}};
 
-    largeArmorObjectPoints = {{-largeArmorSize.x / 2, largeArmorSize.y / 2,  0},
-                              {-largeArmorSize.x / 2, -largeArmorSize.y / 2, 0},
-                              {largeArmorSize.x / 2,  -largeArmorSize.y / 2, 0},
-                              {largeArmorSize.x / 2,  largeArmorSize.y / 2,  0}};
+    largeArmorObjectPoints = {cv::Point3d{-largeArmorSize.x / 2, largeArmorSize.y / 2,  0},
+                              cv::Point3d{-largeArmorSize.x / 2, -largeArmorSize.y / 2, 0},
+                              cv::Point3d{largeArmorSize.x / 2,  -largeArmorSize.y / 2, 0},
+                              cv::Point3d{largeArmorSize.x / 2,  largeArmorSize.y / 2,  0}};
 
     /*
      *              1 ----------- 2
@@ -37,10 +203,8 @@ void PositionCalculator::setParameters(cv::Point2f smallArmorSize_, cv::Point2f
 }
 
 bool PositionCalculator::solve(const std::array<cv::Point2f, 4> &imagePoints, bool largeArmor, bool manualImagePoints,
-                               cv::Point3f &offset) const {
+                               cv::Point3f &offset, Pose *pose, const Pose *prior) const {
 
-    cv::Mat rVec = cv::Mat::zeros(3, 1, CV_64FC1);
-    cv::Mat tVec = cv::Mat::zeros(3, 1, CV_64FC1);
     std::array<cv::Point2f, 4> points;
 
     if (!manualImagePoints) {
@@ -56,13 +220,146 @@ bool PositionCalculator::solve(const std::array<cv::Point2f, 4> &imagePoints, bo
                   cv::Point2f{center.x + width / 2, center.y + height / 2}};
     }
 
-    cv::solvePnP((largeArmor ? largeArmorObjectPoints : smallArmorObjectPoints), points,
-                 cameraMatrix, distCoeffs, rVec, tVec, false, cv::SOLVEPNP_ITERATIVE);
+    std::array<cv::Point2d, 4> img;
+    undistort(points, img);
 
-    offset = {static_cast<float>(tVec.at<double>(0, 0)),
-              static_cast<float>(tVec.at<double>(1, 0)),
-              static_cast<float>(tVec.at<double>(2, 0)) * zScale};
+    std::array<Pose, 2> poses;
+    std::array<double, 2> errors;
+    if (!solveIPPE(largeArmor ? largeArmorObjectPoints : smallArmorObjectPoints, img, poses, errors)) return false;
+
+    int best = (errors[0] <= errors[1] ? 0 : 1);
+    if (errors[best] == HUGE_VAL) return false;
+    if (prior && errors[1 - best] < errors[best] * AMBIGUITY_RATIO) {
+        // Ambiguous, take the one that rotates less from the prior (larger trace of R_prior^T R)
+        auto closeness = [&](const Pose &p) { return cv::trace(prior->rotation.t() * p.rotation); };
+        if (closeness(poses[1 - best]) > closeness(poses[best])) best = 1 - best;
+    }
+
+    const auto &t = poses[best].translation;
+    offset = {static_cast<float>(t[0]),
+              static_cast<float>(t[1]),
+              static_cast<float>(t[2]) * zScale};
+    if (pose) *pose = poses[best];
     return true;
 }
 
-}
\ No newline at end of file
+void PositionCalculator::buildUndistortMap() {
+    hasDistortion = (!distCoeffs.empty() && cv::countNonZero(distCoeffs) > 0);
+    undistortMapCols = imageSize.width / UNDISTORT_MAP_STEP + 2;  // cover the last column and row of pixels
+    undistortMapRows = imageSize.height / UNDISTORT_MAP_STEP + 2;
+
+    std::vector<cv::Point2f> grid;
+    grid.reserve(undistortMapCols * undistortMapRows);
+    for (int r = 0; r < undistortMapRows; r++) {
+        for (int c = 0; c < undistortMapCols; c++) {
+            grid.emplace_back((float) (c * UNDISTORT_MAP_STEP), (float) (r * UNDISTORT_MAP_STEP));
+        }
+    }
+    // One call for the whole grid, as K^-1 only if there is no distortion
+    cv::undistortPoints(grid, undistortMap, cameraMatrix, hasDistortion ? distCoeffs : cv::noArray());
+}
+
+void PositionCalculator::undistort(const std::array<cv::Point2f, 4> &points,
+                                   std::array<cv::Point2d, 4> &normalizedPoints) const {
+    for (int i = 0; i < 4; i++) {
+        float x = points[i].x / UNDISTORT_MAP_STEP, y = points[i].y / UNDISTORT_MAP_STEP;
+        int c = (int) std::floor(x), r = (int) std::floor(y);
+        if (c < 0 || r < 0 || c + 1 >= undistortMapCols || r + 1 >= undistortMapRows) {
+            // Outside the image, e.g. manual image points of an armor at the border
+            std::array<cv::Point2f, 1> normalized;
+            cv::Mat normalizedMat(1, 1, CV_32FC2, normalized.data());
+            cv::undistortPoints(cv::Mat(1, 1, CV_32FC2, (void *) &points[i]), normalizedMat, cameraMatrix,
+                                hasDistortion ? distCoeffs : cv::noArray());
+            normalizedPoints[i] = normalized[0];
+            continue;
+        }
+        float fx = x - (float) c, fy = y - (float) r;
+        const cv::Point2f *row0 = &undistortMap[r * undistortMapCols + c];
+        const cv::Point2f *row1 = row0 + undistortMapCols;
+        cv::Point2f top = row0[0] + (row0[1] - row0[0]) * fx;
+        cv::Point2f bottom = row1[0] + (row1[1] - row1[0]) * fx;
+        normalizedPoints[i] = top + (bottom - top) * fy;
+    }
+}
+
+const PositionCalculator::Pose *PositionCalculator::PoseHistory::find(const cv::Point2f &center, float radius) const {
+    const Pose *ret = nullptr;
+    float minDistance = radius;
+    for (const auto &[c, pose] : previous) {
+        float distance = (float) cv::norm(c - center);
+        if (distance < minDistance) {
+            minDistance = distance;
+            ret = &pose;
+        }
+    }
+    return ret;
+}
+
+std::string PositionCalculator::calibrationPath(const ParamSet &p) {
+    // PARAM_SET_ROOT defined in CMakeLists.txt
+    return std::string(PARAM_SET_ROOT) + "/params/" + std::to_string(p.image_width()) + "x" +
+           std::to_string(p.image_height());
+}
+
+bool PositionCalculator::loadCalibration(const ParamSet &p, const std::string &filename) {
+    cv::Mat cameraMatrix;
+    cv::Mat distCoeffs;
+    float zScale;
+
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) return false;
+
+    fs["cameraMatrix"] >> cameraMatrix;
+    cameraMatrix.at<double>(0, 2) *= (float) p.roi_width() / (float) p.image_width();
+    cameraMatrix.at<double>(1, 2) *= (float) p.roi_height() / (float) p.image_height();
+    fs["distCoeffs"] >> distCoeffs;
+    fs["zScale"] >> zScale;
+
+    setParameters({(float) p.small_armor_size().x(), (float) p.small_armor_size().y()},
+                  {(float) p.large_armor_size().x(), (float) p.large_armor_size().y()},
+                  cameraMatrix, distCoeffs, zScale, cv::Size(p.roi_width(), p.roi_height()));
+    return true;
+}
+
+void PositionCalculator::PoseHistory::nextFrame() {
+    std::swap(previous, current);
+    current.clear();
+}
+
+bool PositionCalculator::solveIPPE(const std::array<cv::Point3d, 4> &objectPoints,
+                                   const std::array<cv::Point2d, 4> &imagePoints,
+                                   std::array<Pose, 2> &poses, std::array<double, 2> &errors) {
+    double obj[4][2], objScaled[4][2], img[4][2];
+    double scale = 0;  // scale the armor to about unit size for the conditioning of the homography
+    for (int i = 0; i < 4; i++) scale = std::max({scale, std::abs(objectPoints[i].x), std::abs(objectPoints[i].y)});
+    if (scale == 0) return false;
+    for (int i = 0; i < 4; i++) {
+        obj[i][0] = objectPoints[i].x, obj[i][1] = objectPoints[i].y;
+        objScaled[i][0] = obj[i][0] / scale, objScaled[i][1] = obj[i][1] / scale;
+        img[i][0] = imagePoints[i].x, img[i][1] = imagePoints[i].y;
+    }
+
+    double H[3][3];
+    if (!computeHomography(objScaled, img, H)) return false;
+
+    // Jacobian of the homography at the origin (in the unscaled object frame) and the image of the origin
+    double p = H[0][2], q = H[1][2];
+    double J[2][2] = {{(H[0][0] - H[2][0] * p) / scale, (H[0][1] - H[2][1] * p) / scale},
+                      {(H[1][0] - H[2][0] * q) / scale, (H[1][1] - H[2][1] * q) / scale}};
+
+    double R[2][3][3];
+    if (!computeRotations(J, p, q, R[0], R[1])) return false;
+
+    for (int s = 0; s < 2; s++) {
+        double t[3];
+        if (!computeTranslation(R[s], obj, img, t)) return false;
+        errors[s] = reprojectionError(R[s], t, obj, img);
+        poses[s].rotation = cv::Matx33d(R[s][0][0], R[s][0][1], R[s][0][2],
+                                        R[s][1][0], R[s][1][1], R[s][1][2],
+                                        R[s][2][0], R[s][2][1], R[s][2][2]);
+        poses[s].translation = cv::Vec3d(t[0], t[1], t[2]);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,181 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "QualityController.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <spdlog/spdlog.h>
+#include <fmt/format.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/resource.h>
+#endif
+
+namespace meta {
+
+namespace fs = std::filesystem;
+
+// GPU of Orin, Xavier and Nano
+static const char *const GPU_DEVFREQ_DIRS[] = {
+        "/sys/class/devfreq/17000000.ga10b",
+        "/sys/class/devfreq/17000000.gv11b",
+        "/sys/class/devfreq/57000000.gpu",
+};
+
+static const char *const CPU_FREQ_DIR = "/sys/devices/system/cpu/cpu0/cpufreq";
+
+/**
+ * @return The first number in the file, 0 if it can't be read.
+ */
+static long readSysfsNumber(const fs::path &file) {
+    std::ifstream in(file);
+    long value = 0;
+    if (!(in >> value)) return 0;
+    return value;
+}
+
+static std::string readSysfsString(const fs::path &file) {
+    std::ifstream in(file);
+    std::string value;
+    in >> value;
+    return value;
+}
+
+QualityController::QualityController() {
+    samplerThread = std::thread(&QualityController::runSampler, this);
+}
+
+QualityController::~QualityController() {
+    {
+        std::lock_guard<std::mutex> lock(samplerMutex);
+        samplerShouldExit = true;
+    }
+    samplerCondition.notify_all();
+    samplerThread.join();
+}
+
+void QualityController::runSampler() {
+#ifdef __linux__
+    // Default time sharing at the lowest nice (per thread on Linux), whichever thread created the controller
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+    std::unique_lock<std::mutex> lock(samplerMutex);
+    while (!samplerShouldExit) {
+        lock.unlock();
+        BoardStatus status = readBoardStatus();
+        sampledTemperature.store(status.temperature, std::memory_order_relaxed);
+        sampledCpuMHz.store(status.cpuMHz, std::memory_order_relaxed);
+        sampledCpuMaxMHz.store(status.cpuMaxMHz, std::memory_order_relaxed);
+        sampledGpuMHz.store(status.gpuMHz, std::memory_order_relaxed);
+        sampledGpuMaxMHz.store(status.gpuMaxMHz, std::memory_order_relaxed);
+        lock.lock();
+        samplerCondition.wait_for(lock, BOARD_SAMPLE_PERIOD, [this] { return samplerShouldExit; });
+    }
+}
+
+QualityController::BoardStatus QualityController::boardStatus() const {
+    BoardStatus status;
+    status.temperature = sampledTemperature.load(std::memory_order_relaxed);
+    status.cpuMHz = sampledCpuMHz.load(std::memory_order_relaxed);
+    status.cpuMaxMHz = sampledCpuMaxMHz.load(std::memory_order_relaxed);
+    status.gpuMHz = sampledGpuMHz.load(std::memory_order_relaxed);
+    status.gpuMaxMHz = sampledGpuMaxMHz.load(std::memory_order_relaxed);
+    return status;
+}
+
+void QualityController::setDeadline(bool enabled_, float deadlineMs) {
+    enabled = enabled_;
+    deadline = deadlineMs;
+    if (!enabled && level() != FULL) changeLevel(FULL, "adaptive quality disabled", LatencyClock::now());
+}
+
+void QualityController::reset() {
+    if (level() != FULL) changeLevel(FULL, "restarted", LatencyClock::now());
+    smoothedBusy = 0;
+}
+
+void QualityController::frameProcessed(LatencyClock::duration busy, LatencyClock::time_point time) {
+    if (!enabled) return;
+
+    float sample = std::chrono::duration<float, std::milli>(busy).count();
+    smoothedBusy = (smoothedBusy == 0 ? sample : smoothedBusy + BUSY_GAIN * (sample - smoothedBusy));
+
+    board = boardStatus();  // sampled in the background
+
+    bool late = (smoothedBusy > deadline);
+    bool hot = (board.temperature > HOT_TEMPERATURE);
+    bool good = (smoothedBusy < deadline * STEP_UP_RATIO && board.temperature < COOL_TEMPERATURE);
+    if (!good) lastNotGoodTime = time;  // stepping up needs the detection to be good throughout the hold
+
+    Level l = level();
+    if ((late || hot) && l + 1 < LEVEL_COUNT && time - lastChangeTime > STEP_DOWN_HOLD) {
+        changeLevel((Level) (l + 1), late ? "missing the deadline" : "hot", time);
+    } else if (good && l > FULL && time - std::max(lastChangeTime, lastNotGoodTime) > STEP_UP_HOLD) {
+        changeLevel((Level) (l - 1), "within the deadline", time);
+    }
+}
+
+void QualityController::changeLevel(Level l, const char *reason, LatencyClock::time_point time) {
+    currentLevel.store(l, std::memory_order_relaxed);
+    lastChangeTime = time;
+
+    std::string decision = fmt::format("quality {} ({}), detection {:.1f}/{:.1f} ms, {:.1f} C, CPU {}/{} MHz, "
+                                       "GPU {}/{} MHz", levelName(l), reason, smoothedBusy, deadline,
+                                       board.temperature, board.cpuMHz, board.cpuMaxMHz, board.gpuMHz,
+                                       board.gpuMaxMHz);
+    spdlog::info("QualityController: {}", decision);
+    {
+        std::lock_guard<std::mutex> lock(decisionMutex);
+        if (decisions.size() == MAX_PENDING_DECISIONS) decisions.pop_front();  // no terminal fetching them
+        decisions.emplace_back(std::move(decision));
+    }
+}
+
+std::vector<std::string> QualityController::fetchDecisions() {
+    std::lock_guard<std::mutex> lock(decisionMutex);
+    std::vector<std::string> ret(std::make_move_iterator(decisions.begin()), std::make_move_iterator(decisions.end()));
+    decisions.clear();
+    return ret;
+}
+
+QualityController::BoardStatus QualityController::readBoardStatus() {
+    BoardStatus status;
+
+    // Thermal zones of the CPU and the GPU (e.g. CPU-therm on Nano, cpu-thermal on Orin), not the others such as
+    // PMIC-Die of Nano, which always reads 100
+    std::error_code ec;
+    for (const auto &zone : fs::directory_iterator("/sys/class/thermal", ec)) {
+        if (zone.path().filename().string().rfind("thermal_zone", 0) != 0) continue;
+        std::string type = readSysfsString(zone.path() / "type");
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+        if (type.rfind("cpu", 0) != 0 && type.rfind("gpu", 0) != 0) continue;
+        status.temperature = std::max(status.temperature, readSysfsNumber(zone.path() / "temp") / 1000.0f);
+    }
+
+    status.cpuMHz = (int) (readSysfsNumber(fs::path(CPU_FREQ_DIR) / "scaling_cur_freq") / 1000);  // [kHz]
+    status.cpuMaxMHz = (int) (readSysfsNumber(fs::path(CPU_FREQ_DIR) / "cpuinfo_max_freq") / 1000);
+
+    for (const char *dir : GPU_DEVFREQ_DIRS) {
+        if (!fs::exists(dir, ec)) continue;
+        status.gpuMHz = (int) (readSysfsNumber(fs::path(dir) / "cur_freq") / 1000000);  // [Hz]
+        status.gpuMaxMHz = (int) (readSysfsNumber(fs::path(dir) / "max_freq") / 1000000);
+        break;
+    }
+    return status;
+}
+
+const char *QualityController::levelName(Level level) {
+    switch (level) {
+        case FULL:               return "full";
+        case LIGHT_OUTPUTS:      return "light outputs";
+        case TRACKING_ROI:       return "tracking ROI";
+        case SPARSE_FULL_SEARCH: return "sparse full search";
+        default:                 return "unknown";
+    }
+}
+
+}
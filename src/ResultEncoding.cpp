@@ -0,0 +1,42 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ResultEncoding.h"
+
+namespace meta {
+
+void addResultDetections(const std::vector<cv::RotatedRect> &lightRects, const AimingSolver::ArmorList &armors,
+                         const cv::Point2f &frameOffset, float imageScale, Result &result) {
+    // Light Rects
+    for (const auto &rect : lightRects) {
+        auto r = result.add_lights();
+        setResultPoint2f(r->mutable_center(), rect.center.x * imageScale, rect.center.y * imageScale);
+        setResultPoint2f(r->mutable_size(), rect.size.width * imageScale, rect.size.height * imageScale);
+        if (rect.angle <= 90) {
+            r->set_angle(rect.angle);
+        } else {
+            r->set_angle(rect.angle - 180);
+        }
+    }
+
+    // Armors, drawn over the frame (a part of the configured ROI if the sensor window follows the target)
+    for (const auto &armor : armors) {
+        auto armorInfo = result.add_armors();
+        for (int i = 0; i < 4; i++) {
+            auto imagePoint = armorInfo->add_image_points();
+            imagePoint->set_x((armor.imgPoints[i].x - frameOffset.x) * imageScale);
+            imagePoint->set_y((armor.imgPoints[i].y - frameOffset.y) * imageScale);
+        }
+        setResultPoint2f(armorInfo->mutable_image_center(),
+                         (armor.imgCenter.x - frameOffset.x) * imageScale,
+                         (armor.imgCenter.y - frameOffset.y) * imageScale);
+        setResultPoint3f(armorInfo->mutable_offset(), armor.offset.x, armor.offset.y, armor.offset.z);
+        armorInfo->set_large_armor(armor.largeArmor);
+        armorInfo->set_number(armor.number);
+        armorInfo->set_selected(armor.flags & AimingSolver::ArmorInfo::SELECTED_TARGET);
+        setResultPoint3f(armorInfo->mutable_ypd(), armor.ypd.x, armor.ypd.y, armor.ypd.z);
+    }
+}
+
+}
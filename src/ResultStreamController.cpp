@@ -0,0 +1,79 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ResultStreamController.h"
+#include "TerminalParameters.h"
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+namespace meta {
+
+const ResultStreamController::Quality ResultStreamController::LEVELS[] = {
+        {TERMINAL_IMAGE_PREVIEW_HEIGHT,         60, "TTTT"},
+        {TERMINAL_IMAGE_PREVIEW_HEIGHT,         40, "TTTT"},
+        {TERMINAL_IMAGE_PREVIEW_HEIGHT * 3 / 4, 35, "TFFT"},  // drop the brightness and color masks
+        {TERMINAL_IMAGE_PREVIEW_HEIGHT / 2,     30, "TFFF"},  // camera only
+};
+
+const int ResultStreamController::LEVEL_COUNT = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+void ResultStreamController::replySent(Clock::time_point time) {
+    awaitingAck = true;
+    replyTime = time;
+}
+
+const ResultStreamController::Quality &ResultStreamController::fetchReceived(size_t bytesInFlight,
+                                                                              Clock::time_point time) {
+    if (awaitingAck) {
+        awaitingAck = false;
+        auto roundTrip = time - replyTime;
+        if (roundTrip > STREAM_PAUSE) {
+            srtt = 0;  // start over
+        } else {
+            float sample = std::chrono::duration<float, std::milli>(roundTrip).count();
+            srtt = (srtt == 0 ? sample : srtt + SRTT_GAIN * (sample - srtt));
+        }
+    }
+
+    bool congested = (srtt > (float) targetRoundTrip.count() || bytesInFlight > maxBytesInFlight);
+    bool good = (srtt != 0 && srtt < (float) targetRoundTrip.count() / 2 && bytesInFlight <= maxBytesInFlight / 4);
+
+    if (!good) lastNotGoodTime = time;  // stepping up needs the link to be good throughout the hold
+
+    if (currentLevel < minLevel) {
+        changeLevel(std::min(minLevel, LEVEL_COUNT - 1), bytesInFlight, time);
+    } else if (congested && currentLevel + 1 < LEVEL_COUNT && time - lastChangeTime > STEP_DOWN_HOLD) {
+        changeLevel(currentLevel + 1, bytesInFlight, time);
+    } else if (good && currentLevel > minLevel &&
+               time - std::max(lastChangeTime, lastNotGoodTime) > STEP_UP_HOLD) {
+        changeLevel(currentLevel - 1, bytesInFlight, time);
+    }
+
+    return LEVELS[currentLevel];
+}
+
+std::string ResultStreamController::filterMask(std::string_view mask) const {
+    std::string ret(mask);
+    const char *allowed = LEVELS[currentLevel].imageMask;
+    for (size_t i = 0; i < ret.size() && allowed[i] != '\0'; i++) {
+        if (allowed[i] == 'F') ret[i] = 'F';
+    }
+    return ret;
+}
+
+void ResultStreamController::reset() {
+    currentLevel = 0;
+    srtt = 0;
+    awaitingAck = false;
+}
+
+void ResultStreamController::changeLevel(int level, size_t bytesInFlight, Clock::time_point time) {
+    currentLevel = level;
+    lastChangeTime = time;
+    const auto &q = LEVELS[currentLevel];
+    spdlog::info("ResultStreamController: level {} ({}p, quality {}, images {}), round trip {:.0f} ms, "
+                 "{} bytes in flight", currentLevel, q.previewHeight, q.jpegQuality, q.imageMask, srtt, bytesInFlight);
+}
+
+}
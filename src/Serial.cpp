@@ -4,11 +4,15 @@
 
 #include "Serial.h"
 #include "CRC.h"
+#include "TelemetryLog.h"
+#include <algorithm>
 #include <iostream>
 namespace meta {
 
 Serial::Serial(boost::asio::io_context &ioContext)
-        : ioContext(ioContext), serial(ioContext) {
+        : ioContext(ioContext), serial(ioContext) {}
+
+void Serial::open() {
 
     boost::system::error_code ec;
     // SERIAL_DEVICE defined in CMakeLists.txt
@@ -20,22 +24,45 @@ Serial::Serial(boost::asio::io_context &ioContext)
 #ifndef BOOST_OS_WINDOWS
     ::tcflush(serial.lowest_layer().native_handle(), TCIOFLUSH);  // flush input and output
 #endif
-    serial.set_option(boost::asio::serial_port::baud_rate(SERIAL_BAUD_RATE));
-    serial.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none));
-    serial.set_option(boost::asio::serial_port_base::character_size(8));
-    serial.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one));
+    // Not fatal, as some links (e.g. USB CDC ACM) do not take all the options
+    serial.set_option(boost::asio::serial_port::baud_rate(SERIAL_BAUD_RATE), ec);
+    if (ec) std::cerr << "Serial: failed to set baud rate " << SERIAL_BAUD_RATE << ": " << ec.message() << std::endl;
+    serial.set_option(boost::asio::serial_port::flow_control(boost::asio::serial_port::flow_control::none), ec);
+    if (ec) std::cerr << "Serial: failed to disable flow control: " << ec.message() << std::endl;
+    serial.set_option(boost::asio::serial_port_base::character_size(8), ec);
+    if (ec) std::cerr << "Serial: failed to set character size 8: " << ec.message() << std::endl;
+    serial.set_option(boost::asio::serial_port::stop_bits(boost::asio::serial_port::stop_bits::one), ec);
+    if (ec) std::cerr << "Serial: failed to set one stop bit: " << ec.message() << std::endl;
 
     // Start receiving SOF
     boost::asio::async_read(serial,
                             boost::asio::buffer(((uint8_t *) &recvPackage), 1),
                             boost::asio::transfer_exactly(1),
                             [this](auto &error, auto numBytes) { handleRecv(error, numBytes); });
+
+    {
+        std::lock_guard<std::mutex> lock(openMutex);
+        opened = true;
+    }
+    openCondition.notify_all();
 }
 
 bool Serial::sendControlCommand(bool detected, bool topKillerTriggered, TimePoint time, float yawDelta, float pitchDelta, float distance,
-                                float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period) {
+                                float avgLightAngle, float imageX, float imageY, int remainingTimeToTarget, int period,
+                                LatencyClock::time_point frameArrivalTime, LatencyClock::time_point frameCaptureTime) {
+
+    if (!opened) {  // only the first commands, if the bring-up has not finished opening the device
+        std::unique_lock<std::mutex> lock(openMutex);
+        openCondition.wait(lock, [this] { return opened.load(); });
+    }
 
-    auto pkg = std::make_shared<Package>();
+    std::lock_guard<std::mutex> lock(txMutex);
+
+    // Fill the pending slot, replacing the command there if it has not been written yet
+    if (hasPending) ++supersededCommands;
+    Package *pkg = &txPending.pkg;
+    txPending.frameArrivalTime = frameArrivalTime;
+    txPending.frameCaptureTime = (frameCaptureTime != LatencyClock::time_point() ? frameCaptureTime : frameArrivalTime);
 
     pkg->sof = SOF;
     pkg->cmdID = VISION_CONTROL_CMD_ID;
@@ -52,24 +79,66 @@ bool Serial::sendControlCommand(bool detected, bool topKillerTriggered, TimePoin
     pkg->command.imageY = (int16_t) imageY;
     pkg->command.remainingTimeToTarget = (int16_t) remainingTimeToTarget;
     pkg->command.period = (int16_t) period;
-    rm::appendCRC8CheckSum((uint8_t *) (pkg.get()), sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t));
+    hasPending = true;
+
+    if (!writing) {  // otherwise handleSend() picks up the latest pending command
+        std::swap(txWriting, txPending);
+        hasPending = false;
+        writing = true;
+        startWrite();
+    }
+
+    return true;
+}
+
+void Serial::startWrite() {
+    // Age at the start of the write, including the wait behind the previous command
+    auto &command = txWriting.pkg.command;
+    command.frameAge = UINT16_MAX;
+    if (txWriting.frameCaptureTime != LatencyClock::time_point()) {
+        auto age = std::chrono::duration_cast<std::chrono::microseconds>(LatencyClock::now() -
+                                                                         txWriting.frameCaptureTime).count() / 100;
+        command.frameAge = (uint16_t) std::clamp<int64_t>(age, 0, UINT16_MAX);
+    }
+    rm::appendCRC8CheckSum((uint8_t *) &txWriting.pkg, COMMAND_PACKAGE_SIZE);
 
     //::tcflush(serial.lowest_layer().native_handle(), TCIFLUSH);  // clear input buffer
     boost::asio::async_write(
             serial,
-            boost::asio::buffer(pkg.get(), sizeof(uint8_t) * 2 + sizeof(VisionCommand) + sizeof(uint8_t)),
-            [this, pkg](auto &error, auto numBytes) { handleSend(pkg, error, numBytes); }
+            boost::asio::buffer(&txWriting.pkg, COMMAND_PACKAGE_SIZE),
+            [this](auto &error, auto numBytes) { handleSend(error, numBytes); }
     );
-
-    return true;
 }
 
-void Serial::handleSend(std::shared_ptr<Package> buf, const boost::system::error_code &error,
-                        size_t numBytes) {
+void Serial::handleSend(const boost::system::error_code &error, size_t numBytes) {
     if (error) {
         std::cerr << "Serial: send error: " << error.message() << "\n";
+    } else {
+        if (txWriting.frameArrivalTime != LatencyClock::time_point()) {
+            auto now = LatencyClock::now();
+            latencyStats().record(LatencyStats::END_TO_END, txWriting.frameArrivalTime, now);
+            float latency = std::chrono::duration<float, std::milli>(now - txWriting.frameArrivalTime).count();
+            float last = smoothedLatency;
+            smoothedLatency = (last == 0 ? latency : last + LATENCY_SMOOTHING_GAIN * (latency - last));
+        }
+        if (telemetryLog().isOpened()) {
+            const auto &c = txWriting.pkg.command;
+            telemetryLog().logCommand({c.frameTime, c.yawDelta, c.pitchDelta, c.distance, c.avgLightAngle, c.imageX,
+                                       c.imageY, c.remainingTimeToTarget, c.period, c.frameAge, c.flag, 0,
+                                       TelemetryLog::toNanoseconds(txWriting.frameArrivalTime)});
+        }
     }
     ++cumulativeFrameCounter;
+
+    // Send the latest command that came during the write, if any
+    std::lock_guard<std::mutex> lock(txMutex);
+    if (hasPending) {
+        std::swap(txWriting, txPending);
+        hasPending = false;
+        startWrite();
+    } else {
+        writing = false;
+    }
 }
 
 void Serial::handleRecv(const boost::system::error_code &error, size_t numBytes) {
@@ -103,6 +172,18 @@ void Serial::handleRecv(const boost::system::error_code &error, size_t numBytes)
 
                 switch (recvPackage.cmdID) {
 
+                    case GIMBAL_FEEDBACK_CMD_ID: {
+                        const auto &feedback = recvPackage.feedback;
+                        auto received = LatencyClock::now() -
+                                        transferTime(sizeof(uint8_t) * 2 + sizeof(GimbalFeedback) + sizeof(uint8_t));
+                        auto sampleTime = controlClock.map(feedback.time, received);
+                        attitudeHistory.push(sampleTime, {feedback.yaw / 100.0f, feedback.pitch / 100.0f});
+                        telemetryLog().logFeedback({feedback.time, feedback.yaw, feedback.pitch,
+                                                    TelemetryLog::toNanoseconds(sampleTime)});
+                    } break;
+
+                    default:
+                        break;
                 }
             }
             recvState = RECV_PREAMBLE;
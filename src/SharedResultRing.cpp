@@ -0,0 +1,162 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "SharedResultRing.h"
+#include "ThreadScheduling.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace meta {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "slot states must be lock-free to be shared by processes");
+
+static constexpr uint32_t RING_MAGIC = 0x534F4C52;  // "SOLR"
+static constexpr uint32_t RING_VERSION = 1;
+static constexpr size_t ALIGNMENT = 64;
+
+struct SharedResultRing::RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t reserved;
+    uint64_t slotCapacity;
+};
+
+struct alignas(ALIGNMENT) SharedResultRing::SlotHeader {
+    std::atomic<uint64_t> state;  // sequence number of the content, 0 while written
+    uint64_t messageOffset;
+    uint64_t messageSize;
+};
+
+size_t SharedResultRing::slotStride() {
+    return sizeof(SlotHeader) + (SLOT_CAPACITY + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+size_t SharedResultRing::totalSize() {
+    return ALIGNMENT + SLOT_COUNT * slotStride();  // header padded to the alignment of the slots
+}
+
+SharedResultRing::SlotHeader *SharedResultRing::slot(uint64_t sequence) const {
+    return reinterpret_cast<SlotHeader *>(base + ALIGNMENT + ((sequence - 1) % SLOT_COUNT) * slotStride());
+}
+
+bool SharedResultRing::fail(const std::string &what) {
+    error = what + ": " + strerror(errno);
+    return false;
+}
+
+bool SharedResultRing::map(int fd, bool writable) {
+    void *p = mmap(nullptr, mappedSize, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the object
+    if (p == MAP_FAILED) return fail("mmap " + ringName);
+    base = static_cast<uint8_t *>(p);
+    return true;
+}
+
+bool SharedResultRing::create(const std::string &name) {
+    close();
+    ringName = name;
+    shm_unlink(name.c_str());  // left behind by a crashed writer
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return fail("shm_open " + name);
+    mappedSize = totalSize();
+    if (ftruncate(fd, (off_t) mappedSize) != 0) {
+        fail("ftruncate " + name);
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    if (!map(fd, true)) {
+        shm_unlink(name.c_str());
+        return false;
+    }
+    owner = true;
+    lockBuffer(base, mappedSize);  // written at each reply
+
+    auto header = reinterpret_cast<RingHeader *>(base);
+    header->version = RING_VERSION;
+    header->slotCount = SLOT_COUNT;
+    header->slotCapacity = SLOT_CAPACITY;
+    for (uint64_t s = 1; s <= SLOT_COUNT; s++) new(slot(s)) SlotHeader{{0}, 0, 0};
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = RING_MAGIC;  // last, so that a reader never sees a half-initialized ring as valid
+    nextSequence = 1;
+    return true;
+}
+
+bool SharedResultRing::open(const std::string &name) {
+    close();
+    ringName = name;
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return fail("shm_open " + name);
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size != totalSize()) {
+        ::close(fd);
+        errno = EINVAL;
+        return fail("size of " + name);
+    }
+    mappedSize = totalSize();
+    if (!map(fd, false)) return false;
+
+    auto header = reinterpret_cast<const RingHeader *>(base);
+    if (header->magic != RING_MAGIC || header->version != RING_VERSION || header->slotCount != SLOT_COUNT ||
+        header->slotCapacity != SLOT_CAPACITY) {
+        close();
+        errno = EPROTO;
+        return fail("layout of " + name);
+    }
+    return true;
+}
+
+void SharedResultRing::close() {
+    if (base != nullptr) {
+        munmap(base, mappedSize);
+        base = nullptr;
+    }
+    if (owner) {
+        shm_unlink(ringName.c_str());
+        owner = false;
+    }
+}
+
+uint8_t *SharedResultRing::beginWrite() {
+    writingSequence = nextSequence++;
+    auto s = slot(writingSequence);
+    s->state.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);  // invalid before any byte of the payload changes
+    return reinterpret_cast<uint8_t *>(s) + sizeof(SlotHeader);
+}
+
+uint64_t SharedResultRing::commit(size_t messageOffset, size_t messageSize) {
+    auto s = slot(writingSequence);
+    s->messageOffset = messageOffset;
+    s->messageSize = messageSize;
+    s->state.store(writingSequence, std::memory_order_release);
+    return writingSequence;
+}
+
+bool SharedResultRing::read(uint64_t sequence, SlotView &view) const {
+    if (base == nullptr || sequence == 0) return false;
+    auto s = slot(sequence);
+    if (s->state.load(std::memory_order_acquire) != sequence) return false;
+    view.payload = reinterpret_cast<const uint8_t *>(s) + sizeof(SlotHeader);
+    view.messageOffset = s->messageOffset;
+    view.messageSize = s->messageSize;
+    if (view.messageOffset > SLOT_CAPACITY || view.messageSize > SLOT_CAPACITY - view.messageOffset) return false;
+    view.message = view.payload + view.messageOffset;
+    return isValid(sequence);
+}
+
+bool SharedResultRing::isValid(uint64_t sequence) const {
+    std::atomic_thread_fence(std::memory_order_acquire);  // the payload is read before the state below
+    return base != nullptr && sequence != 0 && slot(sequence)->state.load(std::memory_order_relaxed) == sequence;
+}
+
+}
@@ -0,0 +1,64 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "TargetMotionFilter.h"
+
+namespace meta {
+
+void TargetMotionFilter::reset(const cv::Point3f &position, TimePoint time) {
+    const float p[3] = {position.x, position.y, position.z};
+    for (int i = 0; i < 3; i++) {
+        axes[i] = {p[i], 0, r, 0, INITIAL_VELOCITY_VARIANCE};
+    }
+    lastTime = time;
+    updateCount = 1;
+}
+
+void TargetMotionFilter::update(const cv::Point3f &position, TimePoint time) {
+    if (updateCount == 0) {
+        reset(position, time);
+        return;
+    }
+
+    float dt = secondsBetween(lastTime, time);
+    if (dt < 0) dt = 0;  // out-of-order frames are treated as simultaneous
+    const float z[3] = {position.x, position.y, position.z};
+    const float dt2 = dt * dt, dt3 = dt2 * dt, dt4 = dt3 * dt;
+
+    for (int i = 0; i < 3; i++) {
+        auto &a = axes[i];
+
+        // Predict: x = F x, P = F P F^T + Q, with F = [1 dt; 0 1], Q = q [dt^4/4 dt^3/2; dt^3/2 dt^2]
+        a.p += a.v * dt;
+        float p00 = a.p00 + 2 * dt * a.p01 + dt2 * a.p11 + q * dt4 / 4;
+        float p01 = a.p01 + dt * a.p11 + q * dt3 / 2;
+        float p11 = a.p11 + q * dt2;
+
+        // Correct with H = [1 0]
+        float s = p00 + r;
+        float k0 = p00 / s, k1 = p01 / s;
+        float innovation = z[i] - a.p;
+        a.p += k0 * innovation;
+        a.v += k1 * innovation;
+        a.p00 = (1 - k0) * p00;
+        a.p01 = (1 - k0) * p01;
+        a.p11 = p11 - k1 * p01;
+    }
+
+    lastTime = time;
+    updateCount++;
+}
+
+cv::Point3f TargetMotionFilter::predict(float seconds) const {
+    return {axes[0].p + axes[0].v * seconds,
+            axes[1].p + axes[1].v * seconds,
+            axes[2].p + axes[2].v * seconds};
+}
+
+cv::Point3f TargetMotionFilter::predictAt(TimePoint time) const {
+    float dt = secondsBetween(lastTime, time);
+    return predict(dt > 0 ? dt : 0);
+}
+
+}
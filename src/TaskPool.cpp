@@ -0,0 +1,68 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "TaskPool.h"
+
+namespace meta {
+
+void TaskPool::setWorkerCount(int count) {
+    if (count == (int) workers.size()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCV.notify_all();
+    for (auto &worker : workers) worker.join();
+    workers.clear();
+
+    stopping = false;
+    for (int i = 0; i < count; i++) workers.emplace_back(&TaskPool::workerLoop, this, generation);
+}
+
+void TaskPool::run(int taskCount, const std::function<void(int)> &task) {
+    if (workers.empty() || taskCount <= 1) {
+        for (int i = 0; i < taskCount; i++) task(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &task;
+        jobTaskCount = taskCount;
+        nextTask.store(0, std::memory_order_relaxed);
+        busyWorkers = (int) workers.size();
+        generation++;
+    }
+    wakeCV.notify_all();
+
+    runTasks();
+
+    // Workers may still be running their last task, and must be done with job before it goes out of scope
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCV.wait(lock, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void TaskPool::runTasks() {
+    int i;
+    while ((i = nextTask.fetch_add(1, std::memory_order_relaxed)) < jobTaskCount) (*job)(i);
+}
+
+void TaskPool::workerLoop(uint64_t seen) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wakeCV.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+
+        lock.unlock();
+        runTasks();
+        lock.lock();
+
+        if (--busyWorkers == 0) doneCV.notify_one();
+    }
+}
+
+}
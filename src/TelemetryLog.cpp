@@ -0,0 +1,295 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "TelemetryLog.h"
+#include "Utilities.h"
+#include "ThreadScheduling.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+
+namespace meta {
+
+TelemetryLog &telemetryLog() {
+    static TelemetryLog log;
+    return log;
+}
+
+std::string TelemetryLog::open(const std::string &directory) {
+    close();
+
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+    path = directory + "/" + currentTimeString() + ".slog";
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        spdlog::error("TelemetryLog: failed to create {}: {}", path, strerror(errno));
+        return "";
+    }
+    chunkOffset = chunkUsed = 0;
+    writeFailed = false;
+    if (!mapChunk(0)) {
+        ::close(fd);
+        fd = -1;
+        return "";
+    }
+
+    FileHeader header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.headerSize = sizeof(FileHeader);
+    header.startTime = toNanoseconds(LatencyClock::now());
+    header.wallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    append(&header, sizeof(header));
+
+    // Records pushed by a producer that raced with the last close(), not of this run
+    {
+        FrameSlot frame;
+        EventSlot event;
+        while (frameQueue.pop(frame)) {}
+        while (eventQueue.pop(event)) {}
+    }
+    dropped = 0;
+    written = 0;
+
+    running = true;
+    th = new std::thread(&TelemetryLog::writeRecords, this);
+    spdlog::info("TelemetryLog: logging to {}", path);
+    return path;
+}
+
+void TelemetryLog::close() {
+    if (!th) return;
+    running = false;
+    th->join();  // the records queued are written
+    delete th;
+    th = nullptr;
+
+    size_t size = chunkOffset + chunkUsed;
+    if (chunk) munmap(chunk, CHUNK_SIZE);
+    chunk = nullptr;
+    if (ftruncate(fd, (off_t) size) != 0) {  // cut the preallocated zeros
+        spdlog::error("TelemetryLog: failed to truncate {}: {}", path, strerror(errno));
+    }
+    fsync(fd);
+    ::close(fd);
+    fd = -1;
+    spdlog::info("TelemetryLog: {} records ({} KB) written to {}, {} dropped", written, size >> 10, path, dropped);
+}
+
+void TelemetryLog::logParams(const package::ParamSet &p, bool resetHistory) {
+    if (!isOpened()) return;
+    FrameSlot slot;
+    size_t size = p.ByteSizeLong();
+    if (size > MAX_PARAMS_SIZE) {
+        spdlog::error("TelemetryLog: parameter set of {} bytes not logged", size);
+        return;
+    }
+    p.SerializeWithCachedSizesToArray(slot.params.serialized);
+    const size_t padded = (size + RECORD_ALIGNMENT - 1) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+    memset(slot.params.serialized + size, 0, padded - size);
+    slot.params.record = {};
+    slot.params.record.resetHistory = resetHistory;
+    slot.params.record.size = (uint32_t) size;
+    slot.header = {PARAMS, (uint16_t) (sizeof(RecordHeader) + sizeof(ParamsRecord) + padded), 0,
+                   toNanoseconds(LatencyClock::now())};
+    if (!frameQueue.push(std::move(slot))) dropped++;
+}
+
+void TelemetryLog::logFrame(const FrameRecord &record) {
+    if (!isOpened()) return;
+    FrameSlot slot;
+    const size_t size = offsetof(FrameRecord, armors) + record.armorCount * sizeof(ArmorRecord);
+    memcpy(&slot.frame, &record, size);
+    slot.header = {FRAME, (uint16_t) (sizeof(RecordHeader) + size), 0, toNanoseconds(LatencyClock::now())};
+    if (!frameQueue.push(std::move(slot))) dropped++;
+}
+
+void TelemetryLog::logCommand(const CommandRecord &record) {
+    if (!isOpened()) return;
+    EventSlot slot;
+    slot.command = record;
+    slot.header = {COMMAND, sizeof(RecordHeader) + sizeof(CommandRecord), 0, toNanoseconds(LatencyClock::now())};
+    if (!eventQueue.push(std::move(slot))) dropped++;
+}
+
+void TelemetryLog::logFeedback(const FeedbackRecord &record) {
+    if (!isOpened()) return;
+    EventSlot slot;
+    slot.feedback = record;
+    slot.header = {FEEDBACK, sizeof(RecordHeader) + sizeof(FeedbackRecord), 0, toNanoseconds(LatencyClock::now())};
+    if (!eventQueue.push(std::move(slot))) dropped++;
+}
+
+TelemetryLog::ArmorRecord TelemetryLog::toRecord(const AimingSolver::ArmorInfo &armor) {
+    ArmorRecord r{};
+    for (int i = 0; i < 4; i++) {
+        r.imgPoints[i * 2] = armor.imgPoints[i].x;
+        r.imgPoints[i * 2 + 1] = armor.imgPoints[i].y;
+    }
+    r.imgCenter[0] = armor.imgCenter.x;
+    r.imgCenter[1] = armor.imgCenter.y;
+    r.offset[0] = armor.offset.x;
+    r.offset[1] = armor.offset.y;
+    r.offset[2] = armor.offset.z;
+    r.ypd[0] = armor.ypd.x;
+    r.ypd[1] = armor.ypd.y;
+    r.ypd[2] = armor.ypd.z;
+    r.avgLightAngle = armor.avgLightAngle;
+    r.largeArmor = armor.largeArmor;
+    r.number = (uint8_t) armor.number;
+    r.flags = (uint16_t) armor.flags;
+    return r;
+}
+
+AimingSolver::ArmorInfo TelemetryLog::fromRecord(const ArmorRecord &r) {
+    std::array<cv::Point2f, 4> points;
+    for (int i = 0; i < 4; i++) points[i] = {r.imgPoints[i * 2], r.imgPoints[i * 2 + 1]};
+    return {points, {r.imgCenter[0], r.imgCenter[1]}, {r.offset[0], r.offset[1], r.offset[2]}, r.avgLightAngle,
+            r.largeArmor != 0, r.number};
+}
+
+void TelemetryLog::writeRecords() {
+    FrameSlot frame;
+    EventSlot event;
+    auto lastSync = LatencyClock::now();
+    while (true) {
+        bool shouldExit = !running;  // nothing is logged after running is cleared, drain the queues once more
+
+        // Producers are polled rather than woken up, so that logging a record never takes a lock or a system call
+        while (eventQueue.pop(event)) {
+            if (append(&event, event.header.size)) written++;
+        }
+        while (frameQueue.pop(frame)) {
+            if (append(&frame, frame.header.size)) written++;
+        }
+        if (shouldExit) break;
+
+        auto now = LatencyClock::now();
+        if (now - lastSync > SYNC_PERIOD) {
+#ifdef __linux__
+            fdatasync(fd);
+#else
+            fsync(fd);
+#endif
+            lastSync = now;
+        }
+        std::this_thread::sleep_for(WRITER_PERIOD);
+    }
+}
+
+bool TelemetryLog::append(const void *data, size_t size) {
+    if (writeFailed) return false;
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        if (chunkUsed == CHUNK_SIZE) {
+            if (!mapChunk(chunkOffset + CHUNK_SIZE)) {
+                writeFailed = true;  // records cut here end the file for the reader
+                return false;
+            }
+        }
+        size_t n = std::min(size, CHUNK_SIZE - chunkUsed);
+        memcpy(chunk + chunkUsed, bytes, n);
+        chunkUsed += n;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool TelemetryLog::mapChunk(size_t offset) {
+    if (chunk) munmap(chunk, CHUNK_SIZE);
+    chunk = nullptr;
+    if (offset + CHUNK_SIZE > MAX_FILE_SIZE) {
+        spdlog::error("TelemetryLog: {} reached {} MB, no more records are logged", path, MAX_FILE_SIZE >> 20);
+        return false;
+    }
+#ifdef __linux__
+    int err = posix_fallocate(fd, (off_t) offset, CHUNK_SIZE);
+#else
+    // Not reserved on the disk, but the file must cover the mapping, which is otherwise out of bounds (SIGBUS)
+    int err = (ftruncate(fd, (off_t) (offset + CHUNK_SIZE)) == 0 ? 0 : errno);
+#endif
+    if (err != 0) {
+        spdlog::error("TelemetryLog: failed to extend {}: {}", path, strerror(err));
+        return false;
+    }
+    void *ptr = mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t) offset);
+    if (ptr == MAP_FAILED) {
+        spdlog::error("TelemetryLog: failed to map {}: {}", path, strerror(errno));
+        return false;
+    }
+    lockBuffer(ptr, CHUNK_SIZE);  // unlocked with munmap()
+    chunk = static_cast<uint8_t *>(ptr);
+    chunkOffset = offset;
+    chunkUsed = 0;
+    return true;
+}
+
+bool TelemetryReader::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "failed to open " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    size = (size_t) st.st_size;
+    void *ptr = (size >= sizeof(TelemetryLog::FileHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                                                           : MAP_FAILED);
+    ::close(fd);  // the mapping stays
+    if (ptr == MAP_FAILED) {
+        error = "failed to map " + path;
+        size = 0;
+        return false;
+    }
+    data = static_cast<const uint8_t *>(ptr);
+
+    const auto &header = fileHeader();
+    if (header.magic != TelemetryLog::MAGIC || header.version != TelemetryLog::VERSION) {
+        error = path + " is not a telemetry log of version " + std::to_string(TelemetryLog::VERSION);
+        close();
+        return false;
+    }
+    position = header.headerSize;
+    return true;
+}
+
+void TelemetryReader::close() {
+    if (data) munmap(const_cast<uint8_t *>(data), size);
+    data = nullptr;
+    size = position = 0;
+}
+
+bool TelemetryReader::next(const TelemetryLog::RecordHeader *&header, const uint8_t *&payload) {
+    if (position + sizeof(TelemetryLog::RecordHeader) > size) return false;
+    header = reinterpret_cast<const TelemetryLog::RecordHeader *>(data + position);
+    if (header->type == TelemetryLog::NONE || header->type >= TelemetryLog::RECORD_TYPE_COUNT ||
+        header->size < sizeof(TelemetryLog::RecordHeader) || position + header->size > size) {
+        return false;
+    }
+    payload = data + position + sizeof(TelemetryLog::RecordHeader);
+    position += header->size;
+    return true;
+}
+
+bool TelemetryReader::parseParams(const uint8_t *payload, size_t size, package::ParamSet &params,
+                                  bool &resetHistory) {
+    if (size < sizeof(TelemetryLog::ParamsRecord)) return false;
+    TelemetryLog::ParamsRecord record;
+    memcpy(&record, payload, sizeof(record));
+    if (sizeof(record) + record.size > size) return false;
+    resetHistory = record.resetHistory != 0;
+    return params.ParseFromArray(payload + sizeof(record), (int) record.size);
+}
+
+}
@@ -26,9 +26,7 @@ bool TerminalSocketBase::sendSingleString(const std::string &name, const std::st
     buf->emplace_back('\0');
 
     // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    startSend(std::move(buf));
 
     return true;
 }
@@ -42,9 +40,7 @@ bool TerminalSocketBase::sendSingleInt(const std::string &name, int32_t n) {
     emplaceInt32(*buf, (uint32_t) n);
 
     // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    startSend(std::move(buf));
 
     return true;
 }
@@ -62,9 +58,7 @@ bool TerminalSocketBase::sendBytes(const std::string &name, uint8_t *data, size_
     }
 
     // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    startSend(std::move(buf));
 
     return true;
 }
@@ -72,17 +66,56 @@ bool TerminalSocketBase::sendBytes(const std::string &name, uint8_t *data, size_
 bool TerminalSocketBase::sendBytes(const std::string &name, const google::protobuf::Message &message) {
     if (!connected()) return false;
 
+    // Send the data
+    startSend(packMessage(name, message));
+
+    return true;
+}
+
+bool TerminalSocketBase::sendLatestBytes(const std::string &name, const uint8_t *data, size_t size) {
+    if (!connected()) return false;
+
+    auto buf = allocateBuffer(BYTES, name, size);
+    if (size != 0) {
+        assert(data != nullptr);
+        buf->insert(buf->end(), data, data + size);
+    }
+
+    return sendLatestPackage(name, std::move(buf));
+}
+
+TerminalSocketBase::Package TerminalSocketBase::packMessage(const std::string &name,
+                                                            const google::protobuf::Message &message) {
     size_t size = message.ByteSizeLong();
     auto buf = allocateBuffer(BYTES, name, size);
 
-    // Data
+    // Data, serialized in place
     buf->resize(buf->size() + size);
     message.SerializeWithCachedSizesToArray(buf->data() + (buf->size() - size));
 
-    // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    return buf;
+}
+
+bool TerminalSocketBase::sendPackage(Package package) {
+    if (!connected()) return false;
+
+    startSend(std::move(package));
+
+    return true;
+}
+
+bool TerminalSocketBase::sendLatestPackage(const std::string &name, Package package) {
+    if (!connected()) return false;
+
+    auto slot = latestPackageSlots.find(name);
+    if (slot == latestPackageSlots.end()) slot = latestPackageSlots.emplace(name, LatestPackageSlot{}).first;
+    if (slot->second.writing) {
+        // Coalesce: the waiting one (if any) is superseded before it gets to the socket
+        slot->second.waiting = std::move(package);
+    } else {
+        slot->second.writing = true;
+        startLatestSend(name, std::move(package));
+    }
 
     return true;
 }
@@ -105,19 +138,45 @@ bool TerminalSocketBase::sendListOfStrings(const std::string &name, const std::v
     }
 
     // Send the data
-    boost::asio::async_write(*socket,
-                             boost::asio::buffer(*buf),
-                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+    startSend(std::move(buf));
 
     return true;
 }
 
+std::shared_ptr<std::vector<uint8_t>> TerminalSocketBase::BufferPool::acquire(size_t capacity) {
+    std::unique_ptr<std::vector<uint8_t>> buf;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buffers.empty()) {
+            buf = std::move(buffers.back());
+            buffers.pop_back();
+        }
+    }
+    if (!buf) buf = std::make_unique<std::vector<uint8_t>>();
+    buf->clear();
+    buf->reserve(capacity);
+
+    std::weak_ptr<BufferPool> pool = shared_from_this();
+    return {buf.release(), [pool](std::vector<uint8_t> *b) {
+        if (auto p = pool.lock()) {
+            p->recycle(b);
+        } else {
+            delete b;  // the socket is gone
+        }
+    }};
+}
+
+void TerminalSocketBase::BufferPool::recycle(std::vector<uint8_t> *buf) {
+    std::unique_ptr<std::vector<uint8_t>> b(buf);
+    if (b->capacity() > MAX_POOLED_CAPACITY) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (buffers.size() < MAX_POOLED_BUFFERS) buffers.emplace_back(std::move(b));
+}
+
 std::shared_ptr<std::vector<uint8_t>> TerminalSocketBase::allocateBuffer(PackageType type, const std::string &name,
                                                                          size_t contentSize) {
-    auto buf = std::make_shared<std::vector<uint8_t>>();
-
     size_t bufSize = 1 + 1 + (name.length() + 1) + 4 + contentSize;
-    buf->reserve(bufSize);
+    auto buf = bufferPool->acquire(bufSize);
 
     // Preamble, 1 byte
     buf->emplace_back(PREAMBLE);
@@ -143,6 +202,31 @@ void TerminalSocketBase::emplaceInt32(std::vector<uint8_t> &buf, int32_t n) {
     buf.emplace_back((uint8_t) ((n >> 24) & 0xFF));
 }
 
+void TerminalSocketBase::startSend(std::shared_ptr<std::vector<uint8_t>> buf) {
+    bytesInFlight += buf->size();
+    boost::asio::async_write(*socket,
+                             boost::asio::buffer(*buf),
+                             [this, buf](auto &error, auto numBytes) { handleSend(buf, error, numBytes); });
+}
+
+void TerminalSocketBase::startLatestSend(const std::string &name, std::shared_ptr<std::vector<uint8_t>> buf) {
+    bytesInFlight += buf->size();
+    boost::asio::async_write(*socket,
+                             boost::asio::buffer(*buf),
+                             [this, buf, name, generation = socketGeneration](auto &error, auto numBytes) {
+                                 handleSend(buf, error, numBytes);
+                                 if (generation != socketGeneration) return;  // slots are reset with the socket
+
+                                 auto &slot = latestPackageSlots[name];
+                                 if (slot.waiting && connected()) {
+                                     startLatestSend(name, std::move(slot.waiting));  // still writing
+                                 } else {
+                                     slot.waiting.reset();
+                                     slot.writing = false;
+                                 }
+                             });
+}
+
 void TerminalSocketBase::handleSend(std::shared_ptr<std::vector<uint8_t>> buf, const boost::system::error_code &error,
                                     size_t numBytes) {
     if (error == boost::asio::error::eof || error == boost::asio::error::connection_reset ||
@@ -158,6 +242,7 @@ void TerminalSocketBase::handleSend(std::shared_ptr<std::vector<uint8_t>> buf, c
     }
 
     uploadBytes += numBytes;
+    bytesInFlight -= buf->size();
 }
 
 template<class T>
@@ -168,6 +253,8 @@ void TerminalSocketBase::setupSocket(std::shared_ptr<tcp::socket> newSocket, std
     // Setup socket
     socketDisconnected = false;
     socket = std::move(newSocket);
+    latestPackageSlots.clear();
+    socketGeneration++;
 
     // Start recv cycle
     recvState = RECV_PREAMBLE;
@@ -0,0 +1,133 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ThreadScheduling.h"
+#include <spdlog/spdlog.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace meta {
+
+static const char *roleName(ThreadRole role) {
+    switch (role) {
+        case ThreadRole::CAPTURE:   return "capture";
+        case ThreadRole::DETECTION: return "detection";
+        case ThreadRole::SERIAL:    return "serial";
+        case ThreadRole::IO:        return "IO";
+        default:                    return "unknown";
+    }
+}
+
+static const IntPair &roleScheduling(ThreadRole role, const ParamSet &params) {
+    switch (role) {
+        case ThreadRole::CAPTURE:   return params.capture_thread_scheduling();
+        case ThreadRole::DETECTION: return params.detection_thread_scheduling();
+        case ThreadRole::SERIAL:    return params.serial_thread_scheduling();
+        case ThreadRole::IO:
+        default:                    return params.io_thread_scheduling();
+    }
+}
+
+/**
+ * @param mask  Bit i for CPU i, 0 for all CPUs (rather than keeping the affinity inherited from the creating thread).
+ */
+static bool setAffinity(uint32_t mask, const char *name) {
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    const long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+    for (long i = 0; i < cpuCount && i < CPU_SETSIZE; i++) {
+        if (mask == 0 || (i < 32 && (mask >> i & 1))) CPU_SET(i, &cpus);
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+        spdlog::error("Scheduling: CPU mask {:#x} of the {} thread has none of the {} CPUs", mask, name, cpuCount);
+        return false;
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0) {
+        spdlog::error("Scheduling: failed to pin the {} thread to CPUs {:#x}: {}", name, mask, strerror(err));
+        return false;
+    }
+    return true;
+#else
+    if (mask != 0) spdlog::warn("Scheduling: CPU affinity of the {} thread is not supported here", name);
+    return mask == 0;
+#endif
+}
+
+static bool setPriority(int priority, const char *name) {
+    sched_param param{};
+    int policy = SCHED_OTHER;
+    if (priority > 0) {
+        policy = SCHED_FIFO;
+        param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    }
+    int err = pthread_setschedparam(pthread_self(), policy, &param);
+    if (err != 0) {
+        spdlog::error("Scheduling: failed to set the {} thread to {}: {}", name,
+                      priority > 0 ? "SCHED_FIFO " + std::to_string(param.sched_priority) : "SCHED_OTHER",
+                      strerror(err));
+        return false;
+    }
+    return true;
+}
+
+bool applyThreadScheduling(ThreadRole role, const ParamSet &params) {
+    const char *name = roleName(role);
+    const IntPair &scheduling = roleScheduling(role, params);
+    const auto mask = (uint32_t) scheduling.x();
+    const int priority = std::max(scheduling.y(), 0);
+
+    bool pinned = setAffinity(mask, name);
+    bool prioritized = setPriority(priority, name);
+    if (mask != 0 || priority != 0) {
+        spdlog::info("Scheduling: {} thread on CPUs {}, {}", name, mask ? fmt::format("{:#x}", mask) : "all",
+                     priority ? fmt::format("SCHED_FIFO {}", priority) : "SCHED_OTHER");
+    }
+    return pinned && prioritized;
+}
+
+static std::atomic<bool> memoryLocked{false};
+
+bool lockProcessMemory(const ParamSet &params) {
+    if (!params.lock_memory()) return false;
+#ifdef __linux__
+    if (mlockall(MCL_CURRENT) != 0) {
+        spdlog::error("Scheduling: failed to lock memory: {} (RLIMIT_MEMLOCK or CAP_IPC_LOCK)", strerror(errno));
+        return false;
+    }
+    memoryLocked = true;
+    spdlog::info("Scheduling: memory locked");
+    return true;
+#else
+    spdlog::warn("Scheduling: memory locking is not supported here");
+    return false;
+#endif
+}
+
+bool lockBuffer(const void *data, size_t size) {
+    if (!memoryLocked || !data || size == 0) return false;
+#ifdef __linux__
+    if (mlock(data, size) != 0) {
+        static std::atomic<bool> reported{false};
+        if (!reported.exchange(true)) {
+            spdlog::error("Scheduling: failed to lock a buffer of {} KB: {} (RLIMIT_MEMLOCK)", size >> 10,
+                          strerror(errno));
+        }
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
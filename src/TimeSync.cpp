@@ -0,0 +1,70 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "TimeSync.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace meta {
+
+namespace {
+
+constexpr int64_t NS_PER_TIME_POINT = 100000;  // TimePoint is 0.1 ms
+
+int64_t toNanoseconds(LatencyClock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+LatencyClock::time_point fromNanoseconds(int64_t ns) {
+    return LatencyClock::time_point(std::chrono::duration_cast<LatencyClock::duration>(std::chrono::nanoseconds(ns)));
+}
+
+}
+
+/** ClockMapper **/
+
+void ClockMapper::reset() {
+    sampleCount = 0;
+    offset = 0;
+    lastDeviceTime = 0;
+    lastUnwrapped = 0;
+}
+
+LatencyClock::time_point ClockMapper::map(TimePoint deviceTime, LatencyClock::time_point receivedTime) {
+    int64_t unwrapped = (sampleCount > 0 ? unwrap(deviceTime) : (int64_t) deviceTime);
+    int64_t sampleOffset = toNanoseconds(receivedTime) - unwrapped * NS_PER_TIME_POINT;
+
+    if (sampleCount > 0 && std::abs(sampleOffset - offset) > RESYNC_THRESHOLD) {
+        // The device clock restarted (or a video looped), start over
+        reset();
+        unwrapped = deviceTime;
+        sampleOffset = toNanoseconds(receivedTime) - unwrapped * NS_PER_TIME_POINT;
+    }
+
+    lastDeviceTime = deviceTime;
+    lastUnwrapped = unwrapped;
+    offsets[sampleCount % WINDOW] = sampleOffset;
+    sampleCount++;
+    offset = *std::min_element(offsets.begin(), offsets.begin() + std::min(sampleCount, WINDOW));
+
+    return toHost(deviceTime);
+}
+
+LatencyClock::time_point ClockMapper::toHost(TimePoint deviceTime) const {
+    return fromNanoseconds(unwrap(deviceTime) * NS_PER_TIME_POINT + offset);
+}
+
+/** AttitudeHistory **/
+
+void AttitudeHistory::push(LatencyClock::time_point time, const GimbalAttitude &attitude) {
+    ring.push(toNanoseconds(time), attitude.yaw, attitude.pitch);
+}
+
+bool AttitudeHistory::interpolate(LatencyClock::time_point time, GimbalAttitude &attitude) const {
+    const int64_t maxHold = std::chrono::duration_cast<std::chrono::nanoseconds>(MAX_HOLD_TIME).count();
+    return ring.interpolate(toNanoseconds(time), maxHold, 360.0f, attitude.yaw, attitude.pitch);  // [deg]
+}
+
+}
@@ -0,0 +1,460 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "Camera.h"
+#include "PinnedMatAllocator.h"
+#include "ThreadScheduling.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+#endif
+
+namespace meta {
+
+#ifdef __linux__
+
+namespace {
+
+int xioctl(int fd, unsigned long request, void *arg) {
+    int res;
+    do {
+        res = ioctl(fd, request, arg);
+    } while (res < 0 && errno == EINTR);
+    return res;
+}
+
+bool setControl(int fd, uint32_t id, int32_t value) {
+    v4l2_control control{};
+    control.id = id;
+    control.value = value;
+    return xioctl(fd, VIDIOC_S_CTRL, &control) == 0;
+}
+
+std::string fourccName(uint32_t fourcc) {
+    return {(char) (fourcc & 0xFF), (char) ((fourcc >> 8) & 0xFF), (char) ((fourcc >> 16) & 0xFF),
+            (char) ((fourcc >> 24) & 0xFF)};
+}
+
+}
+
+bool V4L2Camera::open(const package::ParamSet &params) {
+    if (fd >= 0) close();
+    capInfoSS.str(std::string());  // clear capInfoSS
+
+    const std::string path = "/dev/video" + std::to_string(params.camera_id());
+    fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+        capInfoSS << "Failed to open " << path << ": " << strerror(errno) << "\n";
+        spdlog::error(capInfoSS.str());
+        return false;
+    }
+    if (!configure(params) || !mapBuffers(params.v4l2_buffer_count())) {
+        spdlog::error(capInfoSS.str());
+        closeDevice();
+        return false;
+    }
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+        capInfoSS << "Failed to start streaming: " << strerror(errno) << "\n";
+        spdlog::error(capInfoSS.str());
+        closeDevice();
+        return false;
+    }
+
+    // Start the capture thread and wait for the first frame
+    cameraClock.reset();
+    threadShouldExit = false;
+    capturing = true;
+    th = new std::thread(&V4L2Camera::captureFrames, this, params);
+    if (!waitUntil([this] { return (bool) getFrame() || !capturing; }, OPEN_TIMEOUT) || !getFrame()) {
+        capInfoSS << "No frame from camera " << path << " in " << OPEN_TIMEOUT.count() << " ms\n";
+        spdlog::error(capInfoSS.str());
+        close();
+        return false;
+    }
+    if (rawFormat.raw()) {
+        // Estimated by the capture thread before publishing the first frame, only read since
+        capInfoSS << "White balance gains (R, G, B): " << rawFormat.gains[0] << ", " << rawFormat.gains[1] << ", "
+                  << rawFormat.gains[2] << "\n";
+    }
+
+    // Report actual parameters
+    capInfoSS << "V4L2Camera " << path << ", " << crop.width << "x" << crop.height << " @ " << fps << " fps\n";
+    spdlog::info(capInfoSS.str());
+    return true;
+}
+
+bool V4L2Camera::configure(const package::ParamSet &params) {
+    v4l2_capability capability{};
+    if (xioctl(fd, VIDIOC_QUERYCAP, &capability) < 0) {
+        capInfoSS << "Not a V4L2 device: " << strerror(errno) << "\n";
+        return false;
+    }
+    uint32_t caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) ? capability.device_caps
+                                                                      : capability.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+        capInfoSS << capability.card << " is not a streaming capture device\n";
+        return false;
+    }
+
+    // Formats in the order of preference: those taken without copying, then the cheapest to convert
+    struct Candidate {
+        uint32_t fourcc;
+        Conversion conversion;
+        BayerPattern pattern;
+    };
+    std::vector<Candidate> candidates;
+    if (params.raw_bayer_capture()) {
+        candidates = {{V4L2_PIX_FMT_SRGGB8, WRAPPED, BayerPattern::RGGB},
+                      {V4L2_PIX_FMT_SGRBG8, WRAPPED, BayerPattern::GRBG},
+                      {V4L2_PIX_FMT_SGBRG8, WRAPPED, BayerPattern::GBRG},
+                      {V4L2_PIX_FMT_SBGGR8, WRAPPED, BayerPattern::BGGR}};
+    }
+    candidates.push_back({V4L2_PIX_FMT_BGR24, WRAPPED, BayerPattern::NONE});
+    candidates.push_back({V4L2_PIX_FMT_YUYV, YUYV, BayerPattern::NONE});
+    candidates.push_back({V4L2_PIX_FMT_MJPEG, MJPEG, BayerPattern::NONE});
+
+    std::vector<uint32_t> supported;
+    capInfoSS << "Supported output formats: \n";
+    v4l2_fmtdesc desc{};
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        supported.push_back(desc.pixelformat);
+        capInfoSS << "  " << desc.description << ": " << fourccName(desc.pixelformat) << " \n";
+    }
+    auto chosen = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate &c) {
+        return std::find(supported.begin(), supported.end(), c.fourcc) != supported.end();
+    });
+    if (chosen == candidates.end()) {
+        capInfoSS << "No supported format (8-bit Bayer, BGR24, YUYV or MJPEG)\n";
+        return false;
+    }
+    if (params.raw_bayer_capture() && chosen->pattern == BayerPattern::NONE) {
+        capInfoSS << "Note: no 8-bit Bayer output, raw Bayer capture disabled.\n";
+    }
+    conversion = chosen->conversion;
+    rawFormat = BayerFormat();
+    rawFormat.pattern = chosen->pattern;
+    whiteBalanced = false;
+
+    v4l2_format format{};
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = params.image_width();
+    format.fmt.pix.height = params.image_height();
+    format.fmt.pix.pixelformat = chosen->fourcc;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &format) < 0 || format.fmt.pix.pixelformat != chosen->fourcc) {
+        capInfoSS << "Failed to set format " << fourccName(chosen->fourcc) << "\n";
+        return false;
+    }
+    if ((int) format.fmt.pix.width != params.image_width() || (int) format.fmt.pix.height != params.image_height()) {
+        capInfoSS << "Invalid frame size. "
+                  << "Expected: " << params.image_width() << "x" << params.image_height() << ", "
+                  << "Actual: " << format.fmt.pix.width << "x" << format.fmt.pix.height << "\n";
+        return false;
+    }
+    capInfoSS << "Format: " << fourccName(chosen->fourcc) << (conversion == WRAPPED ? ", no copying" : "") << "\n";
+    frameSize = cv::Size(params.image_width(), params.image_height());
+    sourceType = (conversion == YUYV ? CV_8UC2 : rawFormat.raw() ? CV_8UC1 : CV_8UC3);
+    bytesPerLine = std::max<size_t>(format.fmt.pix.bytesperline, frameSize.width * CV_ELEM_SIZE(sourceType));
+
+    // ROI at the center like the other cameras, at even offsets to keep the Bayer pattern and the YUYV pairs
+    crop = cv::Rect(((params.image_width() - params.roi_width()) / 2) & ~1,
+                    ((params.image_height() - params.roi_height()) / 2) & ~1,
+                    params.roi_width(), params.roi_height());
+    if (crop.size() != frameSize) {
+        v4l2_selection selection{};
+        selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        selection.target = V4L2_SEL_TGT_CROP;
+        selection.r = {crop.x, crop.y, (uint32_t) crop.width, (uint32_t) crop.height};
+        bool selected = (xioctl(fd, VIDIOC_S_SELECTION, &selection) == 0);
+        v4l2_format cropped{};
+        cropped.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (selected && selection.r.left == crop.x && selection.r.top == crop.y &&
+            xioctl(fd, VIDIOC_G_FMT, &cropped) == 0 &&
+            (int) cropped.fmt.pix.width == crop.width && (int) cropped.fmt.pix.height == crop.height) {
+            frameSize = crop.size();
+            bytesPerLine = std::max<size_t>(cropped.fmt.pix.bytesperline, frameSize.width * CV_ELEM_SIZE(sourceType));
+            crop = cv::Rect(cv::Point(0, 0), frameSize);
+            capInfoSS << "Note: ROI enabled.\n";
+        } else {
+            if (selected) {  // cropped, but scaled or moved: back to the whole sensor
+                selection.target = V4L2_SEL_TGT_CROP_DEFAULT;
+                if (xioctl(fd, VIDIOC_G_SELECTION, &selection) == 0) {
+                    selection.target = V4L2_SEL_TGT_CROP;
+                    xioctl(fd, VIDIOC_S_SELECTION, &selection);
+                }
+                if (xioctl(fd, VIDIOC_S_FMT, &format) < 0) {
+                    capInfoSS << "Failed to restore format after cropping\n";
+                    return false;
+                }
+            }
+            capInfoSS << "Note: ROI is not effective in hardware, taken as a part of the frame.\n";
+        }
+    }
+
+    v4l2_streamparm streamParams{};
+    streamParams.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    streamParams.parm.capture.timeperframe = {1, (uint32_t) params.fps()};
+    if (xioctl(fd, VIDIOC_S_PARM, &streamParams) < 0) {
+        capInfoSS << "Failed to set fps.\n";
+    }
+    const auto &timePerFrame = streamParams.parm.capture.timeperframe;
+    fps = (timePerFrame.numerator ? (int) (timePerFrame.denominator / timePerFrame.numerator) : 0);
+
+    // Values in the units of the driver, as OpenCVCamera sets them
+    if (params.gamma().enabled()) {
+        if (!setControl(fd, V4L2_CID_GAMMA, (int32_t) params.gamma().val())) {
+            capInfoSS << "Failed to set gamma.\n";
+        }
+    }
+    if (params.manual_exposure().enabled()) {
+        if (!setControl(fd, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL)) {
+            capInfoSS << "Failed to set manual exposure mode.\n";
+        }
+        if (!setControl(fd, V4L2_CID_EXPOSURE_ABSOLUTE, params.manual_exposure().val())) {
+            capInfoSS << "Failed to set exposure.\n";
+        }
+    } else {
+        // UVC cameras only have the aperture priority mode as auto
+        if (!setControl(fd, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_APERTURE_PRIORITY) &&
+            !setControl(fd, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_AUTO)) {
+            capInfoSS << "Failed to set auto exposure mode.\n";
+        }
+    }
+    return true;
+}
+
+bool V4L2Camera::mapBuffers(int count) {
+    v4l2_requestbuffers request{};
+    request.count = std::max(count, 2);
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0 || request.count < 2) {
+        capInfoSS << "Failed to request " << count << " buffers: " << strerror(errno) << "\n";
+        return false;
+    }
+    if ((int) request.count != count) {
+        capInfoSS << "Note: " << request.count << " buffers given by the driver.\n";
+    }
+
+    buffers.assign(request.count, Buffer());
+    for (unsigned i = 0; i < request.count; i++) {
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            capInfoSS << "Failed to query buffer " << i << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        void *start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        if (start == MAP_FAILED) {
+            capInfoSS << "Failed to map buffer " << i << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        buffers[i].start = static_cast<uint8_t *>(start);
+        buffers[i].length = buf.length;
+        if (!queueBuffer(i)) return false;
+    }
+    return true;
+}
+
+bool V4L2Camera::queueBuffer(unsigned index) {
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) {
+        spdlog::error("V4L2Camera: failed to queue buffer {}: {}", index, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void V4L2Camera::reclaimBuffers() {
+    for (unsigned i = 0; i < buffers.size(); i++) {
+        // Acquire ordering: the consumers are done with the pixels before the driver writes them again
+        if (buffers[i].slot && buffers[i].slot->refs.load(std::memory_order_acquire) == 0) {
+            buffers[i].slot = nullptr;
+            queueBuffer(i);
+        }
+    }
+    retiredBuffers.erase(std::remove_if(retiredBuffers.begin(), retiredBuffers.end(), [](const Buffer &buffer) {
+        if (buffer.slot->refs.load(std::memory_order_acquire) != 0) return false;
+        munmap(buffer.start, buffer.length);
+        return true;
+    }), retiredBuffers.end());
+}
+
+void V4L2Camera::releaseBufferOf(const FrameSlot *slot) {
+    for (unsigned i = 0; i < buffers.size(); i++) {
+        if (buffers[i].slot == slot) {
+            buffers[i].slot = nullptr;
+            queueBuffer(i);
+        }
+    }
+    retiredBuffers.erase(std::remove_if(retiredBuffers.begin(), retiredBuffers.end(), [slot](const Buffer &buffer) {
+        if (buffer.slot != slot) return false;
+        munmap(buffer.start, buffer.length);
+        return true;
+    }), retiredBuffers.end());
+}
+
+void V4L2Camera::captureFrames(package::ParamSet params) {
+    applyThreadScheduling(ThreadRole::CAPTURE, params);
+
+    while (!threadShouldExit) {
+
+        reclaimBuffers();
+        pollfd pfd{fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, POLL_TIMEOUT_MS);
+        if (ready < 0 && errno != EINTR) {
+            spdlog::error("V4L2Camera: poll failed: {}", strerror(errno));
+            break;
+        }
+        if (ready <= 0) continue;
+
+        v4l2_buffer buf{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+            if (errno == EAGAIN) continue;
+            spdlog::error("V4L2Camera: failed to dequeue a buffer: {}", strerror(errno));  // e.g. unplugged
+            break;
+        }
+        const auto arrivalTime = LatencyClock::now();
+        if (buf.flags & V4L2_BUF_FLAG_ERROR) {  // corrupted frame
+            queueBuffer(buf.index);
+            continue;
+        }
+
+        FrameSlot *slot = framePool.acquire();
+        if (!slot) {  // all frames held by consumers
+            framePool.countDroppedFrame();
+            queueBuffer(buf.index);
+            continue;
+        }
+        releaseBufferOf(slot);
+        Buffer &buffer = buffers[buf.index];
+        cv::Mat &image = slot->image;
+
+        bool loaded = true;
+        switch (conversion) {
+            case WRAPPED:
+                image = cv::Mat(frameSize, sourceType, buffer.start, bytesPerLine)(crop);  // not owning the pixels
+                buffer.slot = slot;
+                break;
+            case YUYV:
+                FramePool::prepare(slot, crop.size(), CV_8UC3, pinnedMatAllocator());
+                cv::cvtColor(cv::Mat(frameSize, CV_8UC2, buffer.start, bytesPerLine)(crop), image,
+                             cv::COLOR_YUV2BGR_YUYV);
+                break;
+            case MJPEG:
+                if (!image.empty()) {
+                    image.adjustROI(image.rows, image.rows, image.cols, image.cols);  // back to the whole frame
+                }
+                FramePool::prepare(slot, frameSize, CV_8UC3, pinnedMatAllocator());
+                cv::imdecode(cv::Mat(1, (int) buf.bytesused, CV_8UC1, buffer.start), cv::IMREAD_COLOR, &image);
+                loaded = (image.size() == frameSize);
+                if (loaded) image = image(crop);
+                break;
+        }
+        if (conversion != WRAPPED) queueBuffer(buf.index);  // done with its pixels
+        if (!loaded) {
+            FramePool::discard(slot);
+            continue;
+        }
+
+        if (rawFormat.raw() && !whiteBalanced) {
+            estimateWhiteBalance(image, rawFormat);
+            whiteBalanced = true;
+        }
+        slot->format = rawFormat;  // BGR8 unless raw
+
+        // The kernel monotonic clock is LatencyClock, so that frames stamped on it need no mapping. UVC stamps the
+        // start of the exposure.
+        const int64_t timestamp = (int64_t) buf.timestamp.tv_sec * 1000000000 + (int64_t) buf.timestamp.tv_usec * 1000;
+        slot->captureTime = (TimePoint) (timestamp / 100000);
+        slot->arrivalTime = arrivalTime;
+        if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && timestamp != 0) {
+            slot->exposureTime = LatencyClock::time_point(std::chrono::nanoseconds(timestamp));
+        } else {
+            slot->exposureTime = cameraClock.map(slot->captureTime, arrivalTime);
+        }
+        slot->offset = cv::Point();
+
+        framePool.publish(slot);
+        notifyNewFrame();
+
+        // Save frame if required, encoded on the thread of the recorder
+        if (recorder.isOpened()) recorder.push(getFrame());
+
+        ++cumulativeFrameCounter;  // the only place of incrementing
+    }
+
+    capturing = false;
+    framePool.publishEnd();  // indicate invalid frame
+    notifyNewFrame();
+    spdlog::info("V4L2Camera: closed");
+}
+
+void V4L2Camera::closeDevice() {
+    if (fd < 0) return;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);  // the driver no longer writes any buffer
+    for (const auto &buffer : buffers) {
+        if (!buffer.start) continue;
+        if (buffer.slot) {
+            retiredBuffers.push_back(buffer);  // the mapping keeps the memory after the device is closed
+        } else {
+            munmap(buffer.start, buffer.length);
+        }
+    }
+    buffers.clear();
+    ::close(fd);
+    fd = -1;
+}
+
+void V4L2Camera::close() {
+    if (th) {
+        threadShouldExit = true;
+        th->join();
+        delete th;
+        th = nullptr;
+    }
+    closeDevice();
+}
+
+V4L2Camera::~V4L2Camera() {
+    close();
+    for (const auto &buffer : retiredBuffers) munmap(buffer.start, buffer.length);  // no consumer left
+}
+
+#else
+
+bool V4L2Camera::open(const package::ParamSet &params) {
+    capInfoSS.str("V4L2 is only available on Linux\n");
+    spdlog::error(capInfoSS.str());
+    return false;
+}
+
+void V4L2Camera::close() {}
+
+V4L2Camera::~V4L2Camera() = default;
+
+#endif
+
+}
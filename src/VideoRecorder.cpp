@@ -0,0 +1,104 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "VideoRecorder.h"
+#include <utility>
+#include <spdlog/spdlog.h>
+
+namespace meta {
+
+bool VideoRecorder::open(const std::string &path, int fps, cv::Size size) {
+    close();
+    written = 0;
+    dropped = 0;
+
+#ifdef GSTREAMER_FOUND
+    // https://stackoverflow.com/questions/43412797/opening-a-gstreamer-pipeline-from-opencv-with-videowriter
+    // Use H264 instead for H265 for compatibility of videoWriter
+    const std::pair<const char *, std::string> pipelines[] = {
+            {"nvv4l2h264enc",
+             "appsrc ! video/x-raw,format=BGR ! videoconvert ! video/x-raw,format=BGRx ! "
+             "nvvidconv ! video/x-raw(memory:NVMM),format=NV12 ! "
+             "nvv4l2h264enc maxperf-enable=true insert-sps-pps=true ! h264parse ! "
+             "matroskamux ! filesink location=" + path + " sync=false"},
+            {"omxh264enc",
+             "appsrc ! autovideoconvert ! omxh264enc ! matroskamux ! filesink location=" + path + " sync=false"},
+    };
+    for (const auto &pipeline : pipelines) {
+        writer.open(pipeline.second, cv::CAP_GSTREAMER, 0, fps, size, true);
+        if (writer.isOpened()) {
+            backend = pipeline.first;
+            break;
+        }
+    }
+#endif
+    if (!writer.isOpened()) {
+        writer.open(path, cv::VideoWriter::fourcc('H', '2', '6', '4'), fps, size);
+        backend = "OpenCV";
+    }
+    if (!writer.isOpened()) {
+        spdlog::error("VideoRecorder: failed to open {}", path);
+        return false;
+    }
+
+    running = true;
+    th = new std::thread(&VideoRecorder::writeFrames, this);
+    spdlog::info("VideoRecorder: recording to {} with {}", path, backend);
+    return true;
+}
+
+void VideoRecorder::close() {
+    if (!th) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;  // no more push() from now on
+    }
+    condition.notify_one();
+    th->join();  // the frames queued are written
+    delete th;
+    th = nullptr;
+    spdlog::info("VideoRecorder: {} frames written, {} dropped", written, dropped);
+}
+
+bool VideoRecorder::push(const FrameHandle &frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return false;
+        FrameHandle handle = frame;
+        if (!queue.push(std::move(handle))) {  // the writer falls behind
+            dropped++;
+            return false;
+        }
+    }
+    condition.notify_one();
+    return true;
+}
+
+void VideoRecorder::writeFrames() {
+    FrameHandle frame;
+    while (true) {
+        bool shouldExit;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return !queue.empty() || !running; });
+            shouldExit = !running;
+        }
+
+        while (queue.pop(frame)) {  // encode out of the lock
+            if (frame.format().raw()) {
+                bayerToBGR(frame.image(), frame.format(), bgr);  // demosaic here rather than in the capture thread
+                writer << bgr;
+            } else {
+                writer << frame.image();
+            }
+            frame.reset();  // give the slot back to the source
+            written++;
+        }
+
+        if (shouldExit) break;  // nothing is pushed after running is cleared, so the queue is drained
+    }
+    writer.release();
+}
+
+}
@@ -4,8 +4,10 @@
 
 #include "VideoSet.h"
 #include "Utilities.h"
+#include "ThreadScheduling.h"
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <opencv2/imgproc/imgproc.hpp>
 
 namespace meta {
@@ -46,65 +48,173 @@ cv::Mat VideoSet::getVideoFirstFrame(const std::string &videoName, const ParamSe
     return img;
 }
 
+cv::VideoCapture VideoSet::openCapture(const fs::path &file, const cv::Size &size) {
+    cv::VideoCapture video;
+#ifdef ON_JETSON
+    // NVDEC, and the frames are scaled by the VIC (nvvidconv) instead of cv::resize
+    std::string pipeline = "filesrc location=\"" + file.string() + "\" ! parsebin ! nvv4l2decoder ! nvvidconv ! "
+                           "video/x-raw,format=BGRx,width=" + std::to_string(size.width) +
+                           ",height=" + std::to_string(size.height) +
+                           " ! videoconvert ! video/x-raw,format=BGR ! appsink sync=false";
+    if (video.open(pipeline, cv::CAP_GSTREAMER)) {
+        std::cout << "VideoSet: decoding " << file.filename() << " with nvv4l2decoder\n";
+        return video;
+    }
+#endif
+    // The FFmpeg backend decodes with a thread per core by default
+    if (video.open(file.string(), cv::CAP_FFMPEG, {cv::CAP_PROP_HW_ACCELERATION, cv::VIDEO_ACCELERATION_ANY})) {
+        return video;
+    }
+    video.open(file.string());  // any other backend
+    return video;
+}
+
 bool VideoSet::openVideo(const std::string &videoName, const ParamSet &params) {
     if (th) close();
 
     threadShouldExit = false;
+    shouldFetchNextFrame = true;  // the first frame
+    decodedFrames.clear();
     th = new std::thread(&VideoSet::loadFrameFromVideo, this, videoName, params);
     return true;
 }
 
-void VideoSet::loadFrameFromVideo(const std::string &videoName, const ParamSet &params) {
+void VideoSet::decodeVideo(cv::VideoCapture &video, size_t queueDepth, cv::Size size) {
+    while (true) {
+        DecodedFrame frame;
+        cv::Mat img;
+        if (!threadShouldExit && video.read(img)) {
+            frame.timeMS = video.get(cv::CAP_PROP_POS_MSEC);
+            if (img.size() != size) {
+                cv::resize(img, frame.image, size);
+            } else {
+                frame.image = img;
+            }
+        }  // otherwise the end of the video, still queued for the publisher to stop
+
+        bool end = frame.image.empty();
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCondition.wait(lock, [&] { return decodedFrames.size() < queueDepth || threadShouldExit; });
+            if (threadShouldExit) break;
+            decodedFrames.emplace_back(std::move(frame));
+        }
+        queueCondition.notify_all();
+        if (end) break;
+    }
+}
 
-    cv::VideoCapture video((videoSetRoot / videoName).string());
+void VideoSet::loadFrameFromVideo(const std::string &videoName, const ParamSet &params) {
+    applyThreadScheduling(ThreadRole::CAPTURE, params);  // replays as the camera would run, the decoder inherits it
 
-    auto startTime = std::chrono::steady_clock::now();
+    const cv::Size size(params.roi_width(), params.roi_height());
+    const bool maxSpeed = (params.video_replay_mode() == ParamSet::MAX_SPEED);
+    const double speed = params.video_speed() * params.video_playback_speed();
 
     threadRunning = true;
-    while (video.isOpened()) {
+    cv::VideoCapture video = openCapture(videoSetRoot / videoName, size);
+    const bool opened = video.isOpened();
+    std::thread decoder;
+    if (opened) {
+        decoder = std::thread(&VideoSet::decodeVideo, this, std::ref(video),
+                              (size_t) std::max(params.video_decode_queue_depth(), 1), size);
+    } else {
+        std::cerr << "VideoSet: failed to open " << videoName << "\n";
+    }
 
-        uint8_t workingBuffer = 1 - lastBuffer;
+    std::chrono::steady_clock::time_point startTime;
+    double startFrameTimeMS = -1;  // of the first frame
+    while (opened) {
 
-        // Load the image
-        cv::Mat img;
-        if (threadShouldExit || !video.read(img)) {  // no more image
-            bufferCaptureTime[workingBuffer] = 0;  // indicate invalid frame
-            lastBuffer = workingBuffer;  // switch
-            break;
+        DecodedFrame frame;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            if (maxSpeed) {
+                queueCondition.wait(lock, [this] { return shouldFetchNextFrame || threadShouldExit; });
+                shouldFetchNextFrame = false;
+            }
+            queueCondition.wait(lock, [this] { return !decodedFrames.empty() || threadShouldExit; });
+            if (threadShouldExit) break;
+            frame = std::move(decodedFrames.front());
+            decodedFrames.pop_front();
         }
+        queueCondition.notify_all();  // the decoder may continue
 
-        // Wait for correct frame time
-        auto now = std::chrono::steady_clock::now();
-        auto frameTimeMS = video.get(cv::CAP_PROP_POS_MSEC);
-        auto expectedTime = startTime + std::chrono::nanoseconds(
-                (long long) (frameTimeMS * 1E6 / params.video_speed() / params.video_playback_speed()));
-        if (now < expectedTime) {
-            std::this_thread::sleep_for(expectedTime - now);
+        if (frame.image.empty()) {  // no more image
+            break;
         }
 
+        FrameSlot *slot;
+        if (maxSpeed) {
+            // Frames are not to be skipped, wait for consumers to release a frame (only if the pipeline holds them all)
+            slot = framePool.acquireWait(threadShouldExit);
+            if (!slot) break;
+        } else {
+            // Wait for correct frame time
+            auto now = std::chrono::steady_clock::now();
+            if (startFrameTimeMS < 0) {
+                startTime = now;
+                startFrameTimeMS = frame.timeMS;
+            }
+            auto expectedTime = startTime + std::chrono::nanoseconds(
+                    (long long) ((frame.timeMS - startFrameTimeMS) * 1E6 / speed));
+            if (now < expectedTime) {
+                std::this_thread::sleep_for(expectedTime - now);
+            }
 
-        if (img.rows != params.roi_width() || img.cols != params.roi_width()) {
-            cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+            slot = framePool.acquire();
+            if (!slot) {  // all frames held by consumers, dropped like a camera
+                framePool.countDroppedFrame();
+                continue;
+            }
         }
-        buffer[workingBuffer] = img;
 
-        // Increment frame time, using the actual capture time
-        bufferCaptureTime[workingBuffer] = (int) (frameTimeMS * 10 / params.video_speed());;
+        slot->image = frame.image;  // already resized by the decoder
+
+        // Increment frame time, using the actual capture time (0 indicates the end of the stream)
+        slot->captureTime = (TimePoint) (frame.timeMS * 10 / params.video_speed()) + 1;
 
         // Switch
-        lastBuffer = workingBuffer;
+        framePool.publish(slot);
+        notifyNewFrame();
 
         // The only place of incrementing
         ++cumulativeFrameCounter;
     }
+
+    if (opened) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            threadShouldExit = true;  // the decoder may be waiting for room in the queue
+        }
+        queueCondition.notify_all();
+        decoder.join();
+    }
+    decodedFrames.clear();
+
+    framePool.publishEnd();  // indicate invalid frame
+    notifyNewFrame();
     threadRunning = false;
 
     std::cout << "VideoSet: closed\n";
 }
 
+void VideoSet::fetchNextFrame() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        shouldFetchNextFrame = true;
+    }
+    queueCondition.notify_all();
+}
+
 void VideoSet::close() {
     if (th) {
-        threadShouldExit = true;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            threadShouldExit = true;
+        }
+        queueCondition.notify_all();
+        framePool.cancelWait();  // may be waiting for a free slot
         th->join();
         delete th;
         th = nullptr;
@@ -0,0 +1,83 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "YOLOv5_Calibrator.h"
+#include "YOLOv5_Preprocess.h"
+#include "GpuMemoryPool.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <strings.h>
+#include <cuda_runtime_api.h>
+#include <opencv2/imgcodecs.hpp>
+#include "spdlog/spdlog.h"
+
+namespace meta {
+
+    namespace fs = std::filesystem;
+
+    YOLOCalibrator::YOLOCalibrator(const std::string &image_dir, std::string table_file, int input_w, int input_h)
+            : table_file(std::move(table_file)), input_w(input_w), input_h(input_h) {
+        if (fs::is_directory(image_dir)) {
+            for (const auto &entry : fs::directory_iterator(image_dir)) {
+                if (strcasecmp(entry.path().extension().c_str(), ".jpg") == 0) {
+                    image_files.emplace_back(entry.path().string());
+                }
+            }
+        }
+        std::sort(image_files.begin(), image_files.end());
+        spdlog::info("YOLOv5: {} calibration images in {}", image_files.size(), image_dir);
+        device_input = GpuMemoryPool::instance().allocate((size_t) input_w * input_h * 3 * sizeof(float));
+    }
+
+    YOLOCalibrator::~YOLOCalibrator() {
+        GpuMemoryPool::instance().free(device_image);
+        GpuMemoryPool::instance().free(device_input);
+    }
+
+    bool YOLOCalibrator::getBatch(void *bindings[], const char *names[], int nbBindings) noexcept {
+        cv::Mat img;
+        while (img.empty()) {
+            if (image_idx >= image_files.size()) return false;
+            img = cv::imread(image_files[image_idx++]);
+        }
+        if (image_idx % 50 == 0) {
+            spdlog::info("YOLOv5: calibrating {}/{}", image_idx, image_files.size());
+        }
+
+        size_t sz = img.step[0] * img.rows;
+        if (sz > device_image_sz) {
+            GpuMemoryPool::instance().free(device_image);
+            if ((device_image = GpuMemoryPool::instance().allocate(sz)) == nullptr) return false;
+            device_image_sz = sz;
+        }
+        cudaMemcpy(device_image, img.data, sz, cudaMemcpyHostToDevice);
+        yolo_preprocess(static_cast<const uint8_t *>(device_image), (int) img.step[0], img.cols, img.rows,
+                        static_cast<float *>(device_input), input_w, input_h, nullptr);
+        if (cudaDeviceSynchronize() != cudaSuccess) return false;
+
+        bindings[0] = device_input;
+        return true;
+    }
+
+    const void *YOLOCalibrator::readCalibrationCache(size_t &length) noexcept {
+        table.clear();
+        std::ifstream input(table_file, std::ios::binary);
+        input >> std::noskipws;
+        if (input.good()) {
+            spdlog::info("YOLOv5: reading calibration table {}", table_file);
+            std::copy(std::istream_iterator<char>(input), std::istream_iterator<char>(), std::back_inserter(table));
+        }
+        length = table.size();
+        return length ? table.data() : nullptr;
+    }
+
+    void YOLOCalibrator::writeCalibrationCache(const void *cache, size_t length) noexcept {
+        spdlog::info("YOLOv5: writing calibration table {} ({} bytes)", table_file, length);
+        std::ofstream output(table_file, std::ios::binary);
+        output.write(static_cast<const char *>(cache), (std::streamsize) length);
+    }
+
+} // meta
@@ -0,0 +1,71 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "YOLOv5_Postprocess.h"
+
+namespace meta {
+
+    __device__ static inline int device_argmax(const float *ptr, int len) {
+        int max_arg = 0;
+        for (int i = 1; i < len; i++) {
+            if (ptr[i] > ptr[max_arg]) max_arg = i;
+        }
+        return max_arg;
+    }
+
+    __global__ void yolo_postprocess_kernel(const float *output, int num, int stride, float keep_logit,
+                                            const yolo_transform_t *transform, yolo_detections_t *dst) {
+        extern __shared__ float4 bounds[];  // [num] min x, min y, max x, max y, followed by alive flags
+        auto *alive = reinterpret_cast<int *>(bounds + num);
+
+        int i = threadIdx.x;
+        const float *box = output + i * stride;
+        if (i < num) {
+            bounds[i] = make_float4(fminf(fminf(box[0], box[2]), fminf(box[4], box[6])),
+                                    fminf(fminf(box[1], box[3]), fminf(box[5], box[7])),
+                                    fmaxf(fmaxf(box[0], box[2]), fmaxf(box[4], box[6])),
+                                    fmaxf(fmaxf(box[1], box[3]), fmaxf(box[5], box[7])));
+            alive[i] = (box[8] >= keep_logit);  // sorted, so all the boxes after the first failed one fail as well
+        }
+        __syncthreads();
+
+        // Greedy NMS, the same order as the CPU version: a kept box removes all later overlapping ones
+        for (int k = 0; k < num; k++) {
+            if (alive[k] && i > k && i < num && alive[i]) {
+                float w = fminf(bounds[k].z, bounds[i].z) - fmaxf(bounds[k].x, bounds[i].x);
+                float h = fminf(bounds[k].w, bounds[i].w) - fmaxf(bounds[k].y, bounds[i].y);
+                if (w > 0 && h > 0) alive[i] = 0;
+            }
+            __syncthreads();
+        }
+
+        // Compact, keeping the order of confidence
+        bool keep = (i < num && alive[i]);
+        int total = __syncthreads_count(keep);
+        if (keep) {
+            int pos = 0;
+            for (int j = 0; j < i; j++) pos += alive[j];
+            if (pos < YOLO_MAX_DETECTIONS) {
+                const yolo_transform_t t = *transform;
+                auto &out = dst->boxes[pos];
+                for (int p = 0; p < 4; p++) {
+                    out.pts[p * 2] = box[p * 2] * t.fx + t.ox;
+                    out.pts[p * 2 + 1] = box[p * 2 + 1] * t.fy + t.oy;
+                }
+                out.confidence = 1.f / (1.f + expf(-box[8]));
+                out.color_id = device_argmax(box + 9, 4);
+                out.tag_id = device_argmax(box + 13, 7);
+            }
+        }
+        if (i == 0) dst->count = min(total, YOLO_MAX_DETECTIONS);
+    }
+
+    void yolo_postprocess(const float *output, int num, int stride, float keep_logit,
+                          const yolo_transform_t *transform, yolo_detections_t *dst, cudaStream_t stream) {
+        int threads = (num + 31) / 32 * 32;
+        size_t shared = num * (sizeof(float4) + sizeof(int));
+        yolo_postprocess_kernel<<<1, threads, shared, stream>>>(output, num, stride, keep_logit, transform, dst);
+    }
+
+} // meta
@@ -0,0 +1,122 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "YOLOv5_Preprocess.h"
+#include "BayerDemosaic.cuh"
+
+namespace meta {
+
+    __device__ static inline void preprocess_pixel(const yolo_preprocess_args_t &a, float *dst,
+                                                   int dst_width, int dst_height, int dx, int dy) {
+        float scale_x = (float) a.src_width / (float) dst_width;
+        float scale_y = (float) a.src_height / (float) dst_height;
+
+        // Pixel center alignment as cv::resize, so that 1:1 scale is an exact copy
+        float src_x = fminf(fmaxf((dx + 0.5f) * scale_x - 0.5f, 0.f), (float) (a.src_width - 1));
+        float src_y = fminf(fmaxf((dy + 0.5f) * scale_y - 0.5f, 0.f), (float) (a.src_height - 1));
+        int x_low = (int) src_x, y_low = (int) src_y;
+        int x_high = min(x_low + 1, a.src_width - 1), y_high = min(y_low + 1, a.src_height - 1);
+        float lx = src_x - x_low, ly = src_y - y_low;
+        float hx = 1.f - lx, hy = 1.f - ly;
+        float w1 = hy * hx, w2 = hy * lx, w3 = ly * hx, w4 = ly * lx;
+
+        const uint8_t *v1 = a.src + y_low * a.src_step + x_low * 3;
+        const uint8_t *v2 = a.src + y_low * a.src_step + x_high * 3;
+        const uint8_t *v3 = a.src + y_high * a.src_step + x_low * 3;
+        const uint8_t *v4 = a.src + y_high * a.src_step + x_high * 3;
+
+        // BGR to RGB
+        float *p = dst + (dy * dst_width + dx) * 3;
+        p[0] = w1 * v1[2] + w2 * v2[2] + w3 * v3[2] + w4 * v4[2];
+        p[1] = w1 * v1[1] + w2 * v2[1] + w3 * v3[1] + w4 * v4[1];
+        p[2] = w1 * v1[0] + w2 * v2[0] + w3 * v3[0] + w4 * v4[0];
+    }
+
+    __device__ static inline void preprocess_bayer_pixel(const yolo_preprocess_args_t &a, float *dst,
+                                                         int dst_width, int dst_height, int dx, int dy) {
+        float scale_x = (float) a.src_width / (float) dst_width;
+        float scale_y = (float) a.src_height / (float) dst_height;
+
+        // Same sampling as preprocess_pixel()
+        float src_x = fminf(fmaxf((dx + 0.5f) * scale_x - 0.5f, 0.f), (float) (a.src_width - 1));
+        float src_y = fminf(fmaxf((dy + 0.5f) * scale_y - 0.5f, 0.f), (float) (a.src_height - 1));
+        int x_low = (int) src_x, y_low = (int) src_y;
+        int x_high = min(x_low + 1, a.src_width - 1), y_high = min(y_low + 1, a.src_height - 1);
+        float lx = src_x - x_low, ly = src_y - y_low;
+        float hx = 1.f - lx, hy = 1.f - ly;
+        float w1 = hy * hx, w2 = hy * lx, w3 = ly * hx, w4 = ly * lx;
+
+        float v1[3], v2[3], v3[3], v4[3];
+        demosaic_at(a.src, a.src_step, a.src_width, a.src_height, x_low, y_low, a.red_x, a.red_y, v1);
+        demosaic_at(a.src, a.src_step, a.src_width, a.src_height, x_high, y_low, a.red_x, a.red_y, v2);
+        demosaic_at(a.src, a.src_step, a.src_width, a.src_height, x_low, y_high, a.red_x, a.red_y, v3);
+        demosaic_at(a.src, a.src_step, a.src_width, a.src_height, x_high, y_high, a.red_x, a.red_y, v4);
+
+        // Already RGB, saturated after white balance as the ISP output
+        float *p = dst + (dy * dst_width + dx) * 3;
+        p[0] = fminf((w1 * v1[0] + w2 * v2[0] + w3 * v3[0] + w4 * v4[0]) * a.gains[0], 255.f);
+        p[1] = fminf((w1 * v1[1] + w2 * v2[1] + w3 * v3[1] + w4 * v4[1]) * a.gains[1], 255.f);
+        p[2] = fminf((w1 * v1[2] + w2 * v2[2] + w3 * v3[2] + w4 * v4[2]) * a.gains[2], 255.f);
+    }
+
+    // Arguments by value, or read from memory when the kernel runs (indirect)
+    template<bool RAW>
+    __global__ void yolo_preprocess_kernel(yolo_preprocess_args_t args, float *dst, int dst_width, int dst_height) {
+        int dx = blockIdx.x * blockDim.x + threadIdx.x;
+        int dy = blockIdx.y * blockDim.y + threadIdx.y;
+        if (dx >= dst_width || dy >= dst_height) return;
+        if (RAW) {
+            preprocess_bayer_pixel(args, dst, dst_width, dst_height, dx, dy);
+        } else {
+            preprocess_pixel(args, dst, dst_width, dst_height, dx, dy);
+        }
+    }
+
+    template<bool RAW>
+    __global__ void yolo_preprocess_indirect_kernel(const yolo_preprocess_args_t *args, float *dst,
+                                                    int dst_width, int dst_height) {
+        int dx = blockIdx.x * blockDim.x + threadIdx.x;
+        int dy = blockIdx.y * blockDim.y + threadIdx.y;
+        if (dx >= dst_width || dy >= dst_height) return;
+        const yolo_preprocess_args_t a = *args;
+        if (RAW) {
+            preprocess_bayer_pixel(a, dst, dst_width, dst_height, dx, dy);
+        } else {
+            preprocess_pixel(a, dst, dst_width, dst_height, dx, dy);
+        }
+    }
+
+    static inline dim3 preprocess_grid(const dim3 &block, int dst_width, int dst_height) {
+        return {(dst_width + block.x - 1) / block.x, (dst_height + block.y - 1) / block.y};
+    }
+
+    void yolo_preprocess(const uint8_t *src, int src_step, int src_width, int src_height,
+                         float *dst, int dst_width, int dst_height, cudaStream_t stream) {
+        dim3 block(32, 8);
+        yolo_preprocess_args_t args{src, src_step, src_width, src_height, 0, 0, {1, 1, 1}};
+        yolo_preprocess_kernel<false><<<preprocess_grid(block, dst_width, dst_height), block, 0, stream>>>(
+                args, dst, dst_width, dst_height);
+    }
+
+    void yolo_preprocess_bayer(const uint8_t *src, int src_step, int src_width, int src_height, int red_x, int red_y,
+                               float gain_r, float gain_g, float gain_b,
+                               float *dst, int dst_width, int dst_height, cudaStream_t stream) {
+        dim3 block(32, 8);
+        yolo_preprocess_args_t args{src, src_step, src_width, src_height, red_x, red_y, {gain_r, gain_g, gain_b}};
+        yolo_preprocess_kernel<true><<<preprocess_grid(block, dst_width, dst_height), block, 0, stream>>>(
+                args, dst, dst_width, dst_height);
+    }
+
+    void yolo_preprocess_indirect(const yolo_preprocess_args_t *args, bool raw,
+                                  float *dst, int dst_width, int dst_height, cudaStream_t stream) {
+        dim3 block(32, 8);
+        dim3 grid = preprocess_grid(block, dst_width, dst_height);
+        if (raw) {
+            yolo_preprocess_indirect_kernel<true><<<grid, block, 0, stream>>>(args, dst, dst_width, dst_height);
+        } else {
+            yolo_preprocess_indirect_kernel<false><<<grid, block, 0, stream>>>(args, dst, dst_width, dst_height);
+        }
+    }
+
+} // meta
@@ -3,8 +3,13 @@
 //
 
 #include "YOLOv5_TensorRT.h"
+#include "YOLOv5_Preprocess.h"
+#include "YOLOv5_Calibrator.h"
+#include "GpuMemoryPool.h"
 #include <fstream>
+#include <chrono>
 #include <filesystem>
+#include <limits>
 #include <TrtLogger.h>
 #include <cuda.h>
 #include <cuda_runtime_api.h>
@@ -24,12 +29,6 @@
 
 using namespace nvinfer1;
 
-static inline size_t get_dims_size(const Dims &dims) {
-    size_t sz = 1;
-    for (int i = 0; i < dims.nbDims; i++) sz *= dims.d[i];
-    return sz;
-}
-
 template<class F, class T, class ...Ts>
 T reduce(F &&func, T x, Ts... xs) {
     if constexpr (sizeof...(Ts) > 0){
@@ -83,44 +82,187 @@ namespace meta {
 
     namespace fs = std::filesystem;
 
-    YOLODet::YOLODet(const std::string &onnx_file) {
-        fs::path onnx_file_path(onnx_file);
-        auto cache_file_path = onnx_file_path;
-        cache_file_path.replace_extension("engine");
-        if (fs::exists(cache_file_path)) {
-            build_engine_from_cache(cache_file_path.c_str());
-        } else {
-            build_engine_from_onnx(onnx_file_path.c_str());
-            cache_engine(cache_file_path.c_str());
+    const float YOLODet::KEEP_LOGIT = inv_sigmoid(KEEP_THRES);
+
+    const std::vector<cv::Size> YOLODet::PROFILE_SIZES = {{INPUT_W, INPUT_H}, {480, 288}, {320, 192}};
+
+    // Header in front of the serialized engine. The cache is reused only if everything but the input shape matches;
+    // the input shape is checked against what this code feeds after deserialization.
+    struct engine_cache_header_t {
+        char magic[8];
+        uint32_t header_version;
+        int32_t trt_version;
+        uint64_t onnx_hash;
+        char device_name[256];
+        int32_t precision;
+        int32_t dla_core;
+        int32_t input_nb_dims;
+        int32_t input_dims[Dims::MAX_DIMS];
+    };
+
+    static constexpr char ENGINE_CACHE_MAGIC[8] = "SOLAISE";
+    static constexpr uint32_t ENGINE_CACHE_VERSION = 3;  // 3: MAX_INFER_SLOTS profiles of each size
+
+    // FNV-1a of the whole file, model files are small enough for this to be negligible at startup
+    static uint64_t hash_file(const std::string &file) {
+        std::ifstream ifs(file, std::ios::binary);
+        TRT_ASSERT(ifs.good());
+        uint64_t hash = 14695981039346656037ULL;
+        char buf[1 << 16];
+        while (ifs.read(buf, sizeof(buf)) || ifs.gcount() > 0) {
+            for (std::streamsize i = 0; i < ifs.gcount(); i++) {
+                hash = (hash ^ (uint8_t) buf[i]) * 1099511628211ULL;
+            }
+        }
+        return hash;
+    }
+
+    static engine_cache_header_t make_cache_header(const std::string &onnx_file, YOLODet::precision_t precision,
+                                                   int dla_core) {
+        engine_cache_header_t header{};
+        memcpy(header.magic, ENGINE_CACHE_MAGIC, sizeof(header.magic));
+        header.header_version = ENGINE_CACHE_VERSION;
+        header.trt_version = getInferLibVersion();
+        header.onnx_hash = hash_file(onnx_file);
+        cudaDeviceProp prop{};
+        int device;
+        TRT_ASSERT(cudaGetDevice(&device) == 0);
+        TRT_ASSERT(cudaGetDeviceProperties(&prop, device) == 0);
+        strncpy(header.device_name, prop.name, sizeof(header.device_name) - 1);
+        header.precision = static_cast<int32_t>(precision);
+        header.dla_core = dla_core;
+        return header;
+    }
+
+    // Explain the mismatch, or return empty if the cache can be used
+    static std::string cache_header_mismatch(const engine_cache_header_t &expected, const engine_cache_header_t &actual) {
+        if (memcmp(actual.magic, ENGINE_CACHE_MAGIC, sizeof(actual.magic)) != 0) return "no header (legacy cache)";
+        if (actual.header_version != expected.header_version) return "header version";
+        if (actual.trt_version != expected.trt_version) {
+            return "TensorRT " + std::to_string(actual.trt_version) + " -> " + std::to_string(expected.trt_version);
+        }
+        if (actual.onnx_hash != expected.onnx_hash) return "ONNX model changed";
+        if (strncmp(actual.device_name, expected.device_name, sizeof(actual.device_name)) != 0) {
+            return std::string("device ") + actual.device_name + " -> " + expected.device_name;
+        }
+        if (actual.precision != expected.precision) return "precision";
+        if (actual.dla_core != expected.dla_core) return "DLA core";
+        return "";
+    }
+
+    bool YOLODet::is_cache_valid(const std::string &onnx_file, precision_t precision, int dla_core) {
+        if (!fs::exists(onnx_file)) return false;  // hash_file() asserts it can be read
+        std::ifstream ifs(engine_file(onnx_file, precision, dla_core), std::ios::binary);
+        engine_cache_header_t header{};
+        if (!ifs.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+        return cache_header_mismatch(make_cache_header(onnx_file, precision, dla_core), header).empty();
+    }
+
+    int YOLODet::dla_core_count() {
+        auto runtime = createInferRuntime(gLogger);
+        TRT_ASSERT(runtime != nullptr);
+        int count = runtime->getNbDLACores();
+        delete runtime;
+        return count;
+    }
+
+    static_assert(sizeof(YOLODet::bbox_t) == sizeof(yolo_box_t), "yolo_box_t must match bbox_t");
+
+    YOLODet::YOLODet(const std::string &onnx_file, precision_t precision, const std::string &calib_image_dir,
+                     bool gpu_postprocess, bool cuda_graph, int dla_core, int slots_)
+            : Detector(precision, true), gpu_postprocess(gpu_postprocess), cuda_graph(cuda_graph), dla(dla_core) {
+        TRT_ASSERT(dla < dla_core_count());
+        TRT_ASSERT(slots_ >= 1 && slots_ <= MAX_INFER_SLOTS);
+        slot_count = slots_;
+        slots.reset(new infer_slot_t[slot_count]);
+        fs::path cache_file_path = engine_file(onnx_file, precision, dla);
+        auto header = make_cache_header(onnx_file, precision, dla);
+        if (!build_engine_from_cache(cache_file_path.c_str(), header)) {
+            auto calib_table_path = cache_file_path;
+            calib_table_path.replace_extension("calib");
+            build_engine_from_onnx(onnx_file, precision, calib_image_dir, calib_table_path.string());
+            cache_engine(cache_file_path.c_str(), header);
         }
-        TRT_ASSERT((context = engine->createExecutionContext()) != nullptr);
         TRT_ASSERT((input_idx = engine->getBindingIndex("input")) == 0);
         TRT_ASSERT((output_idx = engine->getBindingIndex("output-topk")) == 1);
-//        auto input_dims = engine->getBindingDimensions(input_idx);
         auto input_dims = engine->getTensorShape("input");
-//        auto output_dims = engine->getBindingDimensions(output_idx);
-        auto output_dims = engine->getTensorShape("output-topk");
-        input_sz = get_dims_size(input_dims);
-        output_sz = get_dims_size(output_dims);
-        TRT_ASSERT(cudaMalloc(&device_buffer[input_idx], input_sz * sizeof(float)) == 0);
-        TRT_ASSERT(cudaMalloc(&device_buffer[output_idx], output_sz * sizeof(float)) == 0);
-        TRT_ASSERT(cudaStreamCreate(&stream) == 0);
-        output_buffer = new float[output_sz];
-        TRT_ASSERT(output_buffer != nullptr);
+        batch = input_dims.d[0];
+        TRT_ASSERT(batch >= 1);  // the batch dimension of the model must be static
+        dynamic_input = (engine->getNbOptimizationProfiles() > 1);
+        if (dynamic_input) {
+            inputs = PROFILE_SIZES;
+        } else {
+            inputs = {{INPUT_W, INPUT_H}};
+        }
+        output_sz = TOPK_NUM * 20;  // whatever the input size
+        size_t max_input_sz = (size_t) INPUT_W * INPUT_H * 3;  // the largest size
+
+        for (int s = 0; s < slot_count; s++) {
+            auto &slot = slots[s];
+            TRT_ASSERT(cudaStreamCreate(&slot.stream) == 0);
+            auto &pool = GpuMemoryPool::instance();
+            slot.device_buffer[input_idx] = pool.allocate(batch * max_input_sz * sizeof(float), slot.stream);
+            TRT_ASSERT(slot.device_buffer[input_idx] != nullptr);
+            if (gpu_postprocess) {
+                slot.device_buffer[output_idx] = pool.allocate(batch * output_sz * sizeof(float), slot.stream);
+                TRT_ASSERT(slot.device_buffer[output_idx] != nullptr);
+                slot.detections.reserve(batch * sizeof(yolo_detections_t));
+            } else {
+                slot.output.reserve(batch * output_sz * sizeof(float));
+                slot.device_buffer[output_idx] = slot.output.deviceData();
+            }
+
+            // A context for each input size, on a profile of its own (see build_engine_from_onnx)
+            for (size_t i = 0; i < inputs.size(); i++) {
+                IExecutionContext *context = engine->createExecutionContext();
+                TRT_ASSERT(context != nullptr);
+                if (dynamic_input) {
+                    TRT_ASSERT(context->setOptimizationProfileAsync((int) i * MAX_INFER_SLOTS + s, slot.stream));
+                    TRT_ASSERT(context->setInputShape("input", Dims4{batch, inputs[i].height, inputs[i].width, 3}));
+                }
+                TRT_ASSERT(context->setTensorAddress("input", slot.device_buffer[input_idx]));
+                TRT_ASSERT(context->setTensorAddress("output-topk", slot.device_buffer[output_idx]));
+                slot.contexts.emplace_back(context);
+            }
+            cudaStreamSynchronize(slot.stream);
+
+            for (auto &event : slot.events) TRT_ASSERT(cudaEventCreate(&event) == 0);
+            slot.items.resize(batch);
+            slot.launch_args.reserve(batch * sizeof(launch_args_t));
+        }
+        bool integrated_gpu = isIntegratedGpu();
+        spdlog::info("YOLOv5: {} GPU, pre-processing reads frames {}, post-processing on {}, {} inference slots, "
+                     "batch {}{}{}", integrated_gpu ? "integrated" : "discrete",
+                     integrated_gpu ? "from mapped memory" : "from device copies",
+                     gpu_postprocess ? "GPU" : "CPU", slot_count, batch, cuda_graph ? ", CUDA graphs" : "",
+                     dla >= 0 ? ", network on DLA core " + std::to_string(dla) : "");
+        if (dynamic_input) {
+            std::string sizes;
+            for (const auto &size : inputs) sizes += fmt::format(" {}x{}", size.width, size.height);
+            spdlog::info("YOLOv5: input sizes{}", sizes);
+        }
     }
 
     YOLODet::~YOLODet() {
-        delete[] output_buffer;
-        cudaStreamDestroy(stream);
-        cudaFree(device_buffer[output_idx]);
-        cudaFree(device_buffer[input_idx]);
+        for (int s = 0; s < slot_count; s++) {
+            auto &slot = slots[s];
+            if (slot.in_flight) cudaStreamSynchronize(slot.stream);
+            for (auto *context : slot.contexts) delete context;
+            // Otherwise the output is owned by slot.output
+            if (gpu_postprocess) GpuMemoryPool::instance().free(slot.device_buffer[output_idx], slot.stream);
+            GpuMemoryPool::instance().free(slot.device_buffer[input_idx], slot.stream);
+            for (auto &event : slot.events) cudaEventDestroy(event);
+            cudaStreamDestroy(slot.stream);  // last, the frees are ordered on it
+        }
         delete engine;
     }
 
-    void YOLODet::build_engine_from_onnx(const std::string &onnx_file) {
-        spdlog::info("YOLOv5: Building engine from ONNX file: {}", onnx_file);
+    void YOLODet::build_engine_from_onnx(const std::string &onnx_file, precision_t precision,
+                                         const std::string &calib_image_dir, const std::string &calib_table_file) {
+        spdlog::info("YOLOv5: Building {} engine from ONNX file: {}", precision_name(precision), onnx_file);
         auto builder = createInferBuilder(gLogger);
         TRT_ASSERT(builder != nullptr);
+        builder->setGpuAllocator(GpuMemoryPool::instance().trtAllocator());  // the build workspace too
         const auto explicitBatch = 1U << static_cast<uint32_t>(NetworkDefinitionCreationFlag::kEXPLICIT_BATCH);
         auto network = builder->createNetworkV2(explicitBatch);
         TRT_ASSERT(network != nullptr);
@@ -128,10 +270,38 @@ namespace meta {
         TRT_ASSERT(parser != nullptr);
         parser->parseFromFile(onnx_file.c_str(), static_cast<int>(ILogger::Severity::kINFO));
         auto yolov5_output = network->getOutput(0);
-        auto slice_layer = network->addSlice(*yolov5_output, Dims3{0, 0, 8}, Dims3{1, 15120, 1}, Dims3{1, 1, 1});
+        auto input_dims = network->getInput(0)->getDimensions();  // NHWC
+        int batch_size = input_dims.d[0];  // static batch of the model, for multiple cameras
+        TRT_ASSERT(batch_size >= 1);
+        network->getInput(0)->setName("input");
+        bool dynamic = (input_dims.d[1] < 0 || input_dims.d[2] < 0);
+        // DLA only runs static shapes, so a dynamic input is fixed to the default size instead of having profiles
+        bool profiles = (dynamic && dla < 0);
+        if (dynamic && !profiles) {
+            network->getInput(0)->setDimensions(Dims4{batch_size, INPUT_H, INPUT_W, 3});
+            input_dims = network->getInput(0)->getDimensions();
+        }
+
+        // Confidences of all anchors, whose number follows from the input size (3 per cell of strides 8, 16, 32;
+        // 15120 at 640x384)
+        ISliceLayer *slice_layer;
+        std::array<int32_t, 3> slice_limit = {batch_size, std::numeric_limits<int32_t>::max(), 1};  // until built
+        if (!dynamic) {
+            int anchors = yolov5_output->getDimensions().d[1];
+            slice_layer = network->addSlice(*yolov5_output, Dims3{0, 0, 8}, Dims3{batch_size, anchors, 1},
+                                            Dims3{1, 1, 1});
+        } else {
+            // Size of the slice from the runtime shape of the output, [batch, anchors, 1]
+            auto output_shape = network->addShape(*yolov5_output)->getOutput(0);
+            auto limit = network->addConstant(Dims{1, {3}}, Weights{DataType::kINT32, slice_limit.data(), 3});
+            auto slice_size = network->addElementWise(*output_shape, *limit->getOutput(0),
+                                                      ElementWiseOperation::kMIN)->getOutput(0);
+            slice_layer = network->addSlice(*yolov5_output, Dims3{0, 0, 8}, Dims3{0, 0, 0}, Dims3{1, 1, 1});
+            slice_layer->setInput(2, *slice_size);
+        }
         auto yolov5_conf = slice_layer->getOutput(0);
         auto shuffle_layer = network->addShuffle(*yolov5_conf);
-        shuffle_layer->setReshapeDimensions(Dims2{1, 15120});
+        shuffle_layer->setReshapeDimensions(Dims2{batch_size, -1});
         yolov5_conf = shuffle_layer->getOutput(0);
         auto topk_layer = network->addTopK(*yolov5_conf, TopKOperation::kMAX, TOPK_NUM, 1 << 1);
         auto topk_idx = topk_layer->getOutput(1);
@@ -139,66 +309,297 @@ namespace meta {
         gather_layer->setNbElementWiseDims(1);
         auto yolov5_output_topk = gather_layer->getOutput(0);
         yolov5_output_topk->setName("output-topk");
-        network->getInput(0)->setName("input");
         network->markOutput(*yolov5_output_topk);
         network->unmarkOutput(*yolov5_output);
         auto config = builder->createBuilderConfig();
-        if (builder->platformHasFastFp16()) {
-            spdlog::info("YOLOv5: Current Platform supports FP16, FP16 enabled");
-            config->setFlag(BuilderFlag::kFP16);
+
+        // A profile for each input size and slot: contexts running at the same time can't share a profile. Profiles
+        // of the same size are built once, the others hit the timing cache. There are profiles for MAX_INFER_SLOTS
+        // slots, so that the same engine takes any number of them.
+        IOptimizationProfile *calib_profile = nullptr;
+        if (profiles) {
+            for (const auto &size : PROFILE_SIZES) {
+                for (int s = 0; s < MAX_INFER_SLOTS; s++) {
+                    auto profile = builder->createOptimizationProfile();
+                    Dims4 dims{batch_size, size.height, size.width, 3};
+                    // Exactly the size fed
+                    profile->setDimensions("input", OptProfileSelector::kMIN, dims);
+                    profile->setDimensions("input", OptProfileSelector::kOPT, dims);
+                    profile->setDimensions("input", OptProfileSelector::kMAX, dims);
+                    config->addOptimizationProfile(profile);
+                    if (calib_profile == nullptr) calib_profile = profile;
+                }
+            }
+            spdlog::info("YOLOv5: Dynamic input size, {} profiles", PROFILE_SIZES.size() * MAX_INFER_SLOTS);
         } else {
-            spdlog::info("YOLOv5: Current Platform doesn't support FP16, FP32 enabled");
+            spdlog::info("YOLOv5: Static input size {}x{}", input_dims.d[2], input_dims.d[1]);
+        }
+        std::unique_ptr<YOLOCalibrator> calibrator;
+        if (precision != precision_t::FP32) {
+            if (builder->platformHasFastFp16()) {
+                spdlog::info("YOLOv5: Current Platform supports FP16, FP16 enabled");
+                config->setFlag(BuilderFlag::kFP16);
+            } else {
+                spdlog::info("YOLOv5: Current Platform doesn't support FP16, FP32 enabled");
+            }
+        }
+        if (dla >= 0) {
+            TRT_ASSERT(dla < builder->getNbDLACores());
+            config->setDefaultDeviceType(DeviceType::kDLA);
+            config->setDLACore(dla);
+            config->setFlag(BuilderFlag::kGPU_FALLBACK);
+            if (precision == precision_t::FP32) {
+                spdlog::warn("YOLOv5: DLA doesn't run FP32, FP16 enabled");
+                config->setFlag(BuilderFlag::kFP16);
+            }
+            spdlog::info("YOLOv5: DLA core {} enabled, with GPU fallback", dla);
+        }
+        if (precision == precision_t::INT8) {
+            if (!builder->platformHasFastInt8()) {
+                spdlog::warn("YOLOv5: Current Platform doesn't have fast INT8, the engine may not be faster");
+            }
+            // At the default size, the first profile of a dynamic input
+            calibrator = std::make_unique<YOLOCalibrator>(calib_image_dir, calib_table_file,
+                                                          profiles ? INPUT_W : input_dims.d[2],
+                                                          profiles ? INPUT_H : input_dims.d[1]);
+            config->setFlag(BuilderFlag::kINT8);
+            config->setInt8Calibrator(calibrator.get());
+            if (calib_profile != nullptr) config->setCalibrationProfile(calib_profile);
+            spdlog::info("YOLOv5: INT8 enabled");
         }
         size_t free, total;
         cuMemGetInfo(&free, &total);
         spdlog::info("YOLOv5: Total GPU memory: {}MB, free GPU memory: {}MB", total >> 20, free >> 20);
-        spdlog::info("YOLOv5: Max workspace size: {}MB", free >> 20);
-        config->setMaxWorkspaceSize(free);
+        // Leave memory for the rest of the process (it may be running while the engine builds in background)
+        size_t workspace = std::min(free / 2, MAX_WORKSPACE_SIZE);
+        spdlog::info("YOLOv5: Max workspace size: {}MB", workspace >> 20);
+        config->setMaxWorkspaceSize(workspace);
         TRT_ASSERT((engine = builder->buildEngineWithConfig(*network, *config)) != nullptr);
+        GpuMemoryPool::instance().logStats("after building the engine");
         delete config;
         delete parser;
         delete network;
         delete builder;
     }
 
-    void YOLODet::build_engine_from_cache(const std::string &cache_file) {
-        spdlog::info("YOLOv5: Building engine from .engine file {}", cache_file);
+    bool YOLODet::build_engine_from_cache(const std::string &cache_file, const engine_cache_header_t &expected) {
         std::ifstream ifs(cache_file, std::ios::binary);
+        if (!ifs.good()) {
+            spdlog::info("YOLOv5: No engine cache {}", cache_file);
+            return false;
+        }
         ifs.seekg(0, std::ios::end);
         size_t sz = ifs.tellg();
         ifs.seekg(0, std::ios::beg);
+        engine_cache_header_t header{};
+        if (sz < sizeof(header) || !ifs.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+            spdlog::warn("YOLOv5: Engine cache {} is truncated, rebuilding", cache_file);
+            return false;
+        }
+        auto mismatch = cache_header_mismatch(expected, header);
+        if (!mismatch.empty()) {
+            spdlog::warn("YOLOv5: Engine cache {} is stale ({}), rebuilding", cache_file, mismatch);
+            return false;
+        }
+
+        spdlog::info("YOLOv5: Building engine from .engine file {}", cache_file);
+        sz -= sizeof(header);
         auto buffer = std::make_unique<char[]>(sz);
         ifs.read(buffer.get(), sz);
         auto runtime = createInferRuntime(gLogger);
         TRT_ASSERT(runtime != nullptr);
-        TRT_ASSERT((engine = runtime->deserializeCudaEngine(buffer.get(), sz)) != nullptr);
+        runtime->setGpuAllocator(GpuMemoryPool::instance().trtAllocator());
+        if (dla >= 0) runtime->setDLACore(dla);
+        engine = runtime->deserializeCudaEngine(buffer.get(), sz);
         delete runtime;
+        if (engine == nullptr) {
+            spdlog::warn("YOLOv5: Failed to deserialize {}, rebuilding", cache_file);
+            return false;
+        }
+
+        if (!has_expected_input(*engine)) {
+            spdlog::warn("YOLOv5: Engine cache {} has unexpected input shape, rebuilding", cache_file);
+            delete engine;
+            engine = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool YOLODet::has_expected_input(const ICudaEngine &engine) {
+        auto input_dims = engine.getTensorShape("input");
+        if (input_dims.nbDims != 4 || input_dims.d[3] != 3) return false;
+        if (engine.getNbOptimizationProfiles() == 1) {
+            return input_dims.d[1] == INPUT_H && input_dims.d[2] == INPUT_W;
+        }
+        if (engine.getNbOptimizationProfiles() != (int) PROFILE_SIZES.size() * MAX_INFER_SLOTS) return false;
+        for (int p = 0; p < engine.getNbOptimizationProfiles(); p++) {
+            auto dims = engine.getProfileShape("input", p, OptProfileSelector::kOPT);
+            const auto &size = PROFILE_SIZES[p / MAX_INFER_SLOTS];
+            if (dims.d[1] != size.height || dims.d[2] != size.width) return false;
+        }
+        return true;
     }
 
-    void YOLODet::cache_engine(const std::string &cache_file) {
+    void YOLODet::cache_engine(const std::string &cache_file, engine_cache_header_t header) {
         auto engine_buffer = engine->serialize();
         TRT_ASSERT(engine_buffer != nullptr);
-        std::ofstream ofs(cache_file, std::ios::binary);
-        ofs.write(static_cast<const char *>(engine_buffer->data()), engine_buffer->size());
+        auto input_dims = engine->getTensorShape("input");
+        header.input_nb_dims = input_dims.nbDims;
+        std::copy(input_dims.d, input_dims.d + input_dims.nbDims, header.input_dims);
+
+        // Write to a temporary file first so that an interrupted build never leaves a broken cache
+        auto tmp_file = cache_file + ".tmp";
+        {
+            std::ofstream ofs(tmp_file, std::ios::binary);
+            ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            ofs.write(static_cast<const char *>(engine_buffer->data()), engine_buffer->size());
+        }
+        fs::rename(tmp_file, cache_file);
         delete engine_buffer;
+        spdlog::info("YOLOv5: Engine cached as {}", cache_file);
+    }
+
+    const uint8_t *YOLODet::upload_input(batch_item_t &item, cudaStream_t stream, const cv::Mat &src) {
+        size_t sz = src.step[0] * (src.rows - 1) + src.cols * src.elemSize();  // src may be a region of a frame
+        // uint8, a quarter of the float tensor. Frames already in mapped memory are read in place.
+        return static_cast<const uint8_t *>(item.staging.stage(src.data, sz, stream));
     }
 
-    std::vector<YOLODet::bbox_t> YOLODet::operator()(const cv::Mat &src) const {
-        // pre-process [bgr2rgb & resize]
-        cv::Mat x;
-        float fx = (float) src.cols / 640.f, fy = (float) src.rows / 384.f;
-        cv::cvtColor(src, x, cv::COLOR_BGR2RGB);
-        if (src.cols != 640 || src.rows != 384) {
-            cv::resize(x, x, {640, 384});
+    YOLODet::ticket_t YOLODet::submit_batch(const std::vector<cv::Mat> &frames, const std::vector<cv::Rect> &rois,
+                                            const std::vector<BayerFormat> &formats) {
+        TRT_ASSERT(!frames.empty() && (int) frames.size() <= batch);
+        TRT_ASSERT(rois.empty() || rois.size() == frames.size());
+        TRT_ASSERT(formats.empty() || formats.size() == frames.size());
+
+        ticket_t ticket = next_ticket++;
+        auto &slot = slots[ticket % slot_count];
+        TRT_ASSERT(!slot.in_flight);  // more than infer_slots() frames submitted without collecting
+        slot.ticket = ticket;
+        slot.in_flight = true;
+        slot.count = (int) frames.size();
+
+        // The smallest input size taking all the regions at native resolution, the default one if none does
+        cv::Size region;
+        for (int i = 0; i < slot.count; i++) {
+            cv::Size size = (rois.empty() || rois[i].empty() ? frames[i].size() : rois[i].size());
+            region.width = std::max(region.width, size.width), region.height = std::max(region.height, size.height);
+        }
+        slot.input_index = fitting_input(region);
+        const cv::Size &input_size = inputs[slot.input_index];
+
+        cudaEventRecord(slot.events[0], slot.stream);
+        // Stage the frames first: the copies are on the host, or from pageable memory, and can't be in a graph
+        for (int i = 0; i < slot.count; i++) {
+            const BayerFormat format = (formats.empty() ? BayerFormat() : formats[i]);
+            TRT_ASSERT(frames[i].type() == (format.raw() ? CV_8UC1 : CV_8UC3));
+            cv::Rect roi = (rois.empty() ? cv::Rect() : rois[i]);
+            const cv::Mat src = (roi.empty() ? frames[i] : frames[i](roi));  // view, no copying
+            auto &item = slot.items[i];
+
+            item.src = upload_input(item, slot.stream, src);
+            item.src_step = (int) src.step[0], item.src_width = src.cols, item.src_height = src.rows;
+            item.format = format;
+            // The pattern of the region is shifted by its offset
+            item.red_x = format.redX() ^ (roi.x & 1), item.red_y = format.redY() ^ (roi.y & 1);
+            item.fx = (float) src.cols / (float) input_size.width;
+            item.fy = (float) src.rows / (float) input_size.height;
+            item.ox = (float) roi.x, item.oy = (float) roi.y;
         }
-        x.convertTo(x, CV_32F);
 
-        // run model
-        cudaMemcpyAsync(device_buffer[input_idx], x.data, input_sz * sizeof(float), cudaMemcpyHostToDevice, stream);
-        context->enqueue(1, device_buffer, stream, nullptr);
-        cudaMemcpyAsync(output_buffer, device_buffer[output_idx], output_sz * sizeof(float), cudaMemcpyDeviceToHost,
-                        stream);
-        cudaStreamSynchronize(stream);
+        // Arguments of the frames, read by the kernels when they run. The slot is not in flight, so the last
+        // submission has read them.
+        auto *args = static_cast<launch_args_t *>(slot.launch_args.hostData());
+        for (int i = 0; i < slot.count; i++) {
+            const auto &item = slot.items[i];
+            args[i].preprocess = {item.src, item.src_step, item.src_width, item.src_height, item.red_x, item.red_y,
+                                  {item.format.gains[0], item.format.gains[1], item.format.gains[2]}};
+            args[i].transform = {item.fx, item.fy, item.ox, item.oy};
+        }
+        slot.launch_args.toDevice(slot.count * sizeof(launch_args_t), slot.stream);
+
+        if (cuda_graph) {
+            // Only the shape of the submission is baked into a graph: frames (in the rotating buffers of a frame
+            // pool) and regions (moving with the target) are in launch_args
+            auto &key = slot.graph_key;
+            key.assign({(uint64_t) slot.count, (uint64_t) slot.input_index});
+            for (int i = 0; i < slot.count; i++) key.emplace_back((uint64_t) slot.items[i].format.raw());
+            cudaEventRecord(slot.events[1], slot.stream);
+            slot.graph.launch(key, slot.stream, [&] {
+                enqueue_preprocess(slot);
+                slot.contexts[slot.input_index]->enqueueV3(slot.stream);
+                enqueue_postprocess(slot);
+            });
+            cudaEventRecord(slot.events[2], slot.stream);
+        } else {
+            enqueue_preprocess(slot);
+            cudaEventRecord(slot.events[1], slot.stream);
+
+            // run model
+            slot.contexts[slot.input_index]->enqueueV3(slot.stream);
+            cudaEventRecord(slot.events[2], slot.stream);
+
+            enqueue_postprocess(slot);
+        }
+        cudaEventRecord(slot.events[3], slot.stream);
+
+        return ticket;
+    }
+
+    void YOLODet::enqueue_preprocess(infer_slot_t &slot) {
+        const cv::Size &size = inputs[slot.input_index];
+        const auto *args = static_cast<const launch_args_t *>(slot.launch_args.deviceData());
+        for (int i = 0; i < slot.count; i++) {
+            float *input = static_cast<float *>(slot.device_buffer[input_idx]) + (size_t) i * size.area() * 3;
+            // pre-process [(debayer & white balance &) bgr2rgb & resize & to float], fused on GPU
+            yolo_preprocess_indirect(&args[i].preprocess, slot.items[i].format.raw(), input, size.width, size.height,
+                                     slot.stream);
+        }
+        // Unused batch entries keep stale input, their results are ignored
+    }
+
+    void YOLODet::enqueue_postprocess(infer_slot_t &slot) {
+        if (gpu_postprocess) {
+            // post-process [nms & decode] on GPU, only copy back the surviving boxes
+            const auto *args = static_cast<const launch_args_t *>(slot.launch_args.deviceData());
+            for (int i = 0; i < slot.count; i++) {
+                yolo_postprocess(static_cast<const float *>(slot.device_buffer[output_idx]) + i * output_sz, TOPK_NUM,
+                                 20, KEEP_LOGIT, &args[i].transform,
+                                 static_cast<yolo_detections_t *>(slot.detections.deviceData()) + i, slot.stream);
+            }
+            slot.detections.toHost(slot.count * sizeof(yolo_detections_t), slot.stream);
+        } else {
+            slot.output.toHost(slot.count * output_sz * sizeof(float), slot.stream);
+        }
+    }
+
+    std::vector<std::vector<YOLODet::bbox_t>> YOLODet::collect_batch(ticket_t ticket) {
+        auto &slot = slots[ticket % slot_count];
+        TRT_ASSERT(slot.in_flight && slot.ticket == ticket);
+        cudaStreamSynchronize(slot.stream);
+        slot.in_flight = false;
+        cudaEventElapsedTime(&timing.preprocess_ms, slot.events[0], slot.events[1]);
+        cudaEventElapsedTime(&timing.inference_ms, slot.events[1], slot.events[2]);
+        cudaEventElapsedTime(&timing.postprocess_ms, slot.events[2], slot.events[3]);
+        auto cpu_start = std::chrono::steady_clock::now();
+
+        std::vector<std::vector<YOLODet::bbox_t>> rst(slot.count);
+        for (int i = 0; i < slot.count; i++) {
+            if (gpu_postprocess) {
+                const auto &detections = static_cast<const yolo_detections_t *>(slot.detections.hostData())[i];
+                rst[i].resize(detections.count);
+                memcpy(rst[i].data(), detections.boxes, detections.count * sizeof(bbox_t));
+            } else {
+                rst[i] = postprocess_on_cpu(static_cast<const float *>(slot.output.hostData()) + i * output_sz,
+                                            slot.items[i]);
+            }
+        }
+        timing.postprocess_ms += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpu_start).count();
+        return rst;
+    }
+
+    std::vector<YOLODet::bbox_t> YOLODet::postprocess_on_cpu(const float *output_buffer, const batch_item_t &item) {
+        float fx = item.fx, fy = item.fy, ox = item.ox, oy = item.oy;
 
         // post-process [nms]
         std::vector<YOLODet::bbox_t> rst;
@@ -206,18 +607,18 @@ namespace meta {
         std::vector<uint8_t> removed(TOPK_NUM);
         for (int i = 0; i < TOPK_NUM; i++) {
             auto *box_buffer = output_buffer + i * 20;  // 20->23
-            if (box_buffer[8] < inv_sigmoid(KEEP_THRES)) break;
+            if (box_buffer[8] < KEEP_LOGIT) break;
             if (removed[i]) continue;
             rst.emplace_back();
             auto &box = rst.back();
             memcpy(&box.pts, box_buffer, 8 * sizeof(float));
-            for (auto &pt : box.pts) pt.x *= fx, pt.y *= fy;
+            for (auto &pt : box.pts) pt.x = pt.x * fx + ox, pt.y = pt.y * fy + oy;
             box.confidence = sigmoid(box_buffer[8]);
             box.color_id = argmax(box_buffer + 9, 4);
             box.tag_id = argmax(box_buffer + 13, 7);
             for (int j = i + 1; j < TOPK_NUM; j++) {
                 auto *box2_buffer = output_buffer + j * 20;
-                if (box2_buffer[8] < inv_sigmoid(KEEP_THRES)) break;
+                if (box2_buffer[8] < KEEP_LOGIT) break;
                 if (removed[j]) continue;
                 if (is_overlap(box_buffer, box2_buffer)) removed[j] = true;
             }
@@ -5,9 +5,20 @@
 #include "Executor.h"  // includes headers of all components
 #include "TerminalSocket.h"
 #include "TerminalParameters.h"
+#include "ImageEncoder.h"
+#include "ResultStreamController.h"
+#include "SharedResultRing.h"
+#include "ResultEncoding.h"
+#include "ThreadScheduling.h"
 #include "Parameters.pb.h"
+#include <google/protobuf/arena.h>
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <chrono>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/core/utility.hpp>
@@ -24,8 +35,10 @@ using namespace package;
 boost::asio::io_context tcpIOContext;
 std::thread *tcpIOThread = nullptr;
 
+void handleDisconnection(TerminalSocketServer *);
+
 // Setup a server with automatic acceptance
-TerminalSocketServer socketServer(tcpIOContext, 8800);
+TerminalSocketServer socketServer(tcpIOContext, 8800, handleDisconnection);
 
 
 /** TCP Handling **/
@@ -35,123 +48,303 @@ std::unique_ptr<Executor> executor;
 
 // Reuse message objects: developers.google.com/protocol-buffers/docs/cpptutorial#optimization-tips
 ParamSet recvParams;
-Result resultPackage;
+Result resultPackage;  // used by the TCP thread
+
+// Encoder of video previews on the TCP thread
+OpenCVJPEGEncoder previewEncoder;
 
-Image *allocProtoJPG(const cv::Mat &mat) {
-    auto image = new package::Image;
-    image->set_format(package::Image::JPEG);
+/**
+ * Encode an image resized to a height.
+ * @param image  [Out] Cleared, kept across messages so that its data keeps its capacity.
+ */
+void encodeProtoImage(const cv::Mat &mat, ImageEncoder &encoder, Image *image,
+                      int height = TERMINAL_IMAGE_PREVIEW_HEIGHT) {
+    image->set_format(encoder.format());
 
     if (!mat.empty()) {
         cv::Mat outImage;
-        std::vector<uchar> buf;
-        float ratio = (float) TERMINAL_IMAGE_PREVIEW_HEIGHT / (float) mat.rows;
+        float ratio = (float) height / (float) mat.rows;
 
         cv::resize(mat, outImage, cv::Size(), ratio, ratio);
-        cv::imencode(".jpg", outImage, buf, {cv::IMWRITE_JPEG_QUALITY, 60});
-
-        image->set_data(buf.data(), buf.size());
+        image->set_width(outImage.cols);
+        image->set_height(outImage.rows);
+        if (!encoder.encode(outImage, *image->mutable_data())) image->clear_data();
     }
-    return image;
 }
 
 void sendStatusBarMsg(const std::string &msg) {
     socketServer.sendSingleString("msg", "Core: " + msg);
 }
 
-void sendResult(std::string_view mask) {
+/** Result Encoding **/
+
+/*
+ * Results are built and their images encoded on a separate thread, so that the TCP thread is never blocked by
+ * encoding. The TCP thread hands over the fetch request, and the encoder thread posts the reply back to tcpIOContext.
+ * The terminal sends the next fetch only after the reply, so there is at most one request in flight.
+ *
+ * The next fetch also acknowledges the reply. streamController adapts the quality of the replies to the round trip
+ * and the bytes in flight on the socket, and replies are sent with sendLatestBytes() so that a superseded one is
+ * dropped rather than queued behind a slow write.
+ *
+ * A terminal on the same machine can ask for results through shared memory (SharedResultRing). Images are then
+ * written raw into a slot of the ring, without encoding, the Result follows them, and only its sequence number is sent
+ * on the socket ("resShm").
+ */
+
+struct FetchRequest {
+    std::string mask;  // requested and allowed by the stream quality
+    bool hasOutputs;
+    bool sharedMemory;  // reply through resultRing
+    ParamSet::TerminalImageEncoding encoding;
+    int roiHeight;
+    ResultStreamController::Quality quality;
+};
+
+ResultStreamController streamController;  // used by the TCP thread
+bool sharedMemoryReplies = false;  // used by the TCP thread
+
+// Created on the TCP thread before sharedMemoryReplies is set, then only written by the encoder thread
+SharedResultRing resultRing;
+
+// Room left for the Result after the images in a slot of resultRing
+constexpr size_t SHARED_MESSAGE_RESERVE = 1024 * 1024;
+
+std::thread *resultEncoderThread = nullptr;
+std::mutex fetchRequestMutex;
+std::condition_variable fetchRequestCV;
+FetchRequest fetchRequest;
+bool fetchRequested = false;
+
+// Only used by the encoder thread. The Result is built on an arena, starting in a static block, and reused across
+// replies: Clear() keeps its sub-messages, repeated elements and the capacity of the image data, so that a reply in
+// steady state allocates nothing for it. The arena only grows with the peaks of lights and armors, and is reset past
+// RESULT_ARENA_MAX_SIZE.
+constexpr size_t RESULT_ARENA_INITIAL_SIZE = 256 * 1024;
+constexpr size_t RESULT_ARENA_MAX_SIZE = 4 * 1024 * 1024;
+alignas(16) char resultArenaBlock[RESULT_ARENA_INITIAL_SIZE];
+
+google::protobuf::ArenaOptions resultArenaOptions() {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = resultArenaBlock;
+    options.initial_block_size = sizeof(resultArenaBlock);
+    return options;
+}
+
+google::protobuf::Arena resultArena(resultArenaOptions());
+Result *encodedResult = google::protobuf::Arena::CreateMessage<Result>(&resultArena);
+std::vector<cv::RotatedRect> lightRects;  // kept across fetches for the capacity
+std::unique_ptr<ImageEncoder> cameraEncoder;
+MaskRLEEncoder maskEncoder;  // brightness, color and contour images are binary masks
+AimingSolver::PulseHistory tkPulses;  // kept across fetches, so that only new pulses are copied
+
+// Restart the video stream (key frame first) if the terminal hasn't fetched for a while, e.g. a new connection
+constexpr auto VIDEO_STREAM_RESTART_GAP = std::chrono::seconds(1);
+
+void handleDisconnection(TerminalSocketServer *) {
+    streamController.reset();  // a new connection starts at the full quality
+    sharedMemoryReplies = false;  // until the new terminal asks for it
+    if (executor) executor->unsubscribeOutputs();  // nothing kept for the debugging until the next fetch
+}
+
+/**
+ * Raw image written into a slot of resultRing, resized straight into it.
+ * @param image   [Out] Cleared, left empty if it doesn't fit.
+ * @param offset  [In/Out] Offset of the image in the payload, advanced past it.
+ */
+void writeSharedImage(const cv::Mat &mat, int height, uint8_t *payload, size_t &offset, Image *image) {
+    image->set_format(Image::RAW);
+
+    if (!mat.empty() && mat.depth() == CV_8U && (mat.channels() == 1 || mat.channels() == 3)) {
+        float ratio = (float) height / (float) mat.rows;
+        cv::Size size(cv::saturate_cast<int>(mat.cols * ratio), cv::saturate_cast<int>(mat.rows * ratio));
+        size_t bytes = size.area() * mat.elemSize();
+        if (offset + bytes <= SharedResultRing::SLOT_CAPACITY - SHARED_MESSAGE_RESERVE) {
+            cv::Mat outImage(size, mat.type(), payload + offset);
+            cv::resize(mat, outImage, size);
+            image->set_width(size.width);
+            image->set_height(size.height);
+            image->set_channels(mat.channels());
+            image->set_data_offset(offset);
+            offset = (offset + bytes + 63) / 64 * 64;
+        }
+    }
+}
+
+void requestResult(std::string_view requestedMask) {
+
+    streamController.setMinLevel(executor->minStreamQualityLevel());
+    const auto &quality = streamController.fetchReceived(socketServer.getBytesInFlight());
+    std::string mask = streamController.filterMask(requestedMask);
+
+    // The executor only keeps the images subscribed to, and the detector only makes the debug ones on demand, which
+    // takes effect from the next frames
+    executor->subscribeOutputs(mask);
+
+    {
+        std::lock_guard<std::mutex> lock(fetchRequestMutex);
+        fetchRequest.mask = std::move(mask);
+        fetchRequest.hasOutputs = executor->hasOutputs();
+        fetchRequest.sharedMemory = sharedMemoryReplies;
+        fetchRequest.encoding = executor->getCurrentParams().terminal_image_encoding();
+        fetchRequest.roiHeight = executor->getCurrentParams().roi_height();
+        fetchRequest.quality = quality;
+        fetchRequested = true;
+    }
+    fetchRequestCV.notify_one();
+}
+
+void replyResult(const FetchRequest &request) {
 
     // Always send a package, but non-empty only if the executor is running
-    if (executor->hasOutputs()) {
-        resultPackage.Clear();
+    if (request.hasOutputs) {
+        const auto &mask = request.mask;
+        const int previewHeight = request.quality.previewHeight;
+        if (resultArena.SpaceAllocated() > RESULT_ARENA_MAX_SIZE) {
+            resultArena.Reset();
+            encodedResult = google::protobuf::Arena::CreateMessage<Result>(&resultArena);
+        } else {
+            encodedResult->Clear();
+        }
 
         // Fetch outputs
+        FrameHandle sourceFrame;  // held until originalImage is encoded
         cv::Mat originalImage, brightnessImage, colorImage, lightsImage;
-        std::vector<cv::RotatedRect> lightRects;
-        std::vector<AimingSolver::ArmorInfo> armors;
+        AimingSolver::ArmorList armors;
         bool tkTriggered;
-        std::deque<AimingSolver::PulseInfo> tkPulses;
         TimePoint tkPeriod;
 
-        executor->fetchOutputs(originalImage, brightnessImage, colorImage, lightsImage, lightRects, armors,
-                               tkTriggered, tkPulses, tkPeriod);
-        // If can't lock immediately, simply wait. Detector only performs several non-copy assignments.
-
-        // Detector images
-        {
-            // Empty handled in allocateProtoJPG
-            if (mask[0] == 'T') resultPackage.set_allocated_camera_image(allocProtoJPG(originalImage));
-            if (mask[1] == 'T') resultPackage.set_allocated_brightness_image(allocProtoJPG(brightnessImage));
-            if (mask[2] == 'T') resultPackage.set_allocated_color_image(allocProtoJPG(colorImage));
-            if (mask[3] == 'T') resultPackage.set_allocated_contour_image(allocProtoJPG(lightsImage));
+        executor->fetchOutputs(sourceFrame, originalImage, brightnessImage, colorImage, lightsImage, lightRects,
+                               armors, tkTriggered, tkPulses, tkPeriod);
+        if (mask[0] == 'T' && originalImage.type() == CV_8UC1 && sourceFrame.format().raw()) {
+            // Raw frame of the GPU path, the preview is downscaled anyway so take the cheap half-size demosaic
+            bayerToBGR(originalImage, sourceFrame.format(), originalImage, true);
         }
 
-        float imageScale = (float) TERMINAL_IMAGE_PREVIEW_HEIGHT / executor->getCurrentParams().roi_height();
-
-        // Light Rects
+        // Detector images
+        uint8_t *payload = (request.sharedMemory ? resultRing.beginWrite() : nullptr);
+        size_t payloadOffset = 0;
         {
-            for (const auto &rect : lightRects) {
-                auto r = resultPackage.add_lights();
-                r->set_allocated_center(allocResultPoint2f(rect.center.x * imageScale, rect.center.y * imageScale));
-                r->set_allocated_size(allocResultPoint2f(rect.size.width * imageScale, rect.size.height * imageScale));
-                if (rect.angle <= 90) {
-                    r->set_angle(rect.angle);
+            // Empty handled in encodeProtoImage and writeSharedImage
+            auto encodeImage = [&](const cv::Mat &mat, ImageEncoder &encoder, Image *image) {
+                if (payload) {
+                    writeSharedImage(mat, previewHeight, payload, payloadOffset, image);
                 } else {
-                    r->set_angle(rect.angle - 180);
+                    encodeProtoImage(mat, encoder, image, previewHeight);
                 }
+            };
+            if (mask[0] == 'T') {
+                cameraEncoder->setQuality(request.quality.jpegQuality);
+                encodeImage(originalImage, *cameraEncoder, encodedResult->mutable_camera_image());
             }
-        }
-
-        // Armors
-        {
-            for (const auto &armor : armors) {
-                auto armorInfo = resultPackage.add_armors();
-                for (int i = 0; i < 4; i++) {
-                    auto imagePoint = armorInfo->add_image_points();
-                    imagePoint->set_x(armor.imgPoints[i].x * imageScale);
-                    imagePoint->set_y(armor.imgPoints[i].y * imageScale);
-                }
-                armorInfo->set_allocated_image_center(allocResultPoint2f(
-                        armor.imgCenter.x * imageScale, armor.imgCenter.y * imageScale));
-                armorInfo->set_allocated_offset(allocResultPoint3f(armor.offset.x, armor.offset.y, armor.offset.z));
-                armorInfo->set_large_armor(armor.largeArmor);
-                armorInfo->set_number(armor.number);
-                armorInfo->set_selected(armor.flags & AimingSolver::ArmorInfo::SELECTED_TARGET);
-                armorInfo->set_allocated_ypd(allocResultPoint3f(armor.ypd.x, armor.ypd.y, armor.ypd.z));
+            if (mask[1] == 'T') {
+                encodeImage(brightnessImage, maskEncoder, encodedResult->mutable_brightness_image());
+            }
+            if (mask[2] == 'T') {
+                encodeImage(colorImage, maskEncoder, encodedResult->mutable_color_image());
+            }
+            if (mask[3] == 'T') {
+                encodeImage(lightsImage, maskEncoder, encodedResult->mutable_contour_image());
             }
         }
 
+        // Images are scaled from the frame, which is smaller than the ROI if the sensor window follows the target
+        float imageScale = (float) previewHeight / (sourceFrame ? sourceFrame.image().rows : request.roiHeight);
+
+        // Light rects and armors, drawn over the frame
+        addResultDetections(lightRects, armors, sourceFrame.offset(), imageScale, *encodedResult);
+
         // TopKiller
         {
-            resultPackage.set_tk_triggered(tkTriggered);
+            encodedResult->set_tk_triggered(tkTriggered);
             for (const auto &pulse : tkPulses) {
-                auto p = resultPackage.add_tk_pulses();
-                p->set_allocated_mid_ypd(allocResultPoint3f(pulse.ypdMid.x, pulse.ypdMid.y, pulse.ypdMid.z));
+                auto p = encodedResult->add_tk_pulses();
+                setResultPoint3f(p->mutable_mid_ypd(), pulse.ypdMid.x, pulse.ypdMid.y, pulse.ypdMid.z);
                 p->set_avg_time(pulse.avgTime / 10);
                 p->set_frame_count(pulse.frameCount);
             }
-            resultPackage.set_tk_period(tkPeriod / 10);
+            encodedResult->set_tk_period(tkPeriod / 10);
         }
 
         // Aiming
         {
             AimingSolver::ControlCommand command;
             if (executor->aimingSolver()->getControlCommand(command)) {
-                resultPackage.set_allocated_aiming_target(allocResultPoint2f(command.yawDelta, command.pitchDelta));
-//                resultPackage.set_remaining_time_to_target(command.remainingTimeToTarget);
+                setResultPoint2f(encodedResult->mutable_aiming_target(), command.yawDelta, command.pitchDelta);
+//                encodedResult->set_remaining_time_to_target(command.remainingTimeToTarget);
             }
         }
-        socketServer.sendBytes("res", resultPackage);
+
+        if (payload) {
+            // Serialize after the images in the slot, and only send the sequence number
+            size_t messageSize = encodedResult->ByteSizeLong();
+            if (payloadOffset + messageSize > SharedResultRing::SLOT_CAPACITY) {
+                spdlog::error("Result of {} bytes doesn't fit in shared memory, lights dropped", messageSize);
+                encodedResult->clear_lights();
+                messageSize = encodedResult->ByteSizeLong();
+            }
+            if (payloadOffset + messageSize > SharedResultRing::SLOT_CAPACITY) {
+                // Still too large: the slot is left uncommitted, so send over TCP without its images
+                spdlog::error("Result of {} bytes doesn't fit in shared memory, sent without images", messageSize);
+                encodedResult->clear_camera_image();
+                encodedResult->clear_brightness_image();
+                encodedResult->clear_color_image();
+                encodedResult->clear_contour_image();
+                payload = nullptr;
+            }
+        }
+        if (payload) {
+            encodedResult->SerializeWithCachedSizesToArray(payload + payloadOffset);
+            uint64_t sequence = resultRing.commit(payloadOffset, encodedResult->GetCachedSize());
+            boost::asio::post(tcpIOContext, [sequence] {
+                if (socketServer.sendLatestBytes("resShm", (const uint8_t *) &sequence, sizeof(sequence))) {
+                    streamController.replySent();
+                }
+            });
+        } else {
+            // Serialize here, straight into a package buffer, and only send on the TCP thread
+            auto package = socketServer.packMessage("res", *encodedResult);
+            boost::asio::post(tcpIOContext, [package] {
+                if (socketServer.sendLatestPackage("res", package)) streamController.replySent();
+            });
+        }
 
     } else {
 
-        socketServer.sendBytes("res", nullptr, 0);
+        boost::asio::post(tcpIOContext, [] { socketServer.sendBytes("res", nullptr, 0); });
     }
 
 }
 
+void runResultEncoder() {
+    ParamSet::TerminalImageEncoding encoding = ParamSet::CPU_JPEG;
+    cameraEncoder = createCameraImageEncoder(encoding);
+    auto lastFetchTime = std::chrono::steady_clock::now();
+
+    FetchRequest request;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(fetchRequestMutex);
+            fetchRequestCV.wait(lock, [] { return fetchRequested; });
+            request = fetchRequest;
+            fetchRequested = false;
+        }
+
+        if (request.encoding != encoding) {
+            encoding = request.encoding;
+            cameraEncoder = createCameraImageEncoder(encoding);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastFetchTime > VIDEO_STREAM_RESTART_GAP) cameraEncoder->reset();
+        lastFetchTime = now;
+
+        replyResult(request);
+    }
+}
+
 void handleRecvSingleString(std::string_view name, std::string_view s) {
     if (name == "fetch") {
-        sendResult(s);  // reply anyway, whether the executor is running or not
+        requestResult(s);  // reply anyway, whether the executor is running or not
 
     } else if (name == "switchImageSet") {
         if (executor->switchImageSet(std::string(s)) == 0) {
@@ -176,7 +369,7 @@ void handleRecvSingleString(std::string_view name, std::string_view s) {
     } else if (name == "previewVideo") {
         auto img = executor->getVideoPreview(std::string(s));
         resultPackage.Clear();
-        resultPackage.set_allocated_camera_image(allocProtoJPG(img));
+        encodeProtoImage(img, previewEncoder, resultPackage.mutable_camera_image());
         socketServer.sendBytes("res", resultPackage);
 
     } else goto INVALID_COMMAND;
@@ -188,12 +381,24 @@ void handleRecvSingleString(std::string_view name, std::string_view s) {
 
 void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
     if (name == "fps") {
+        for (const auto &decision : executor->fetchQualityDecisions()) sendStatusBarMsg(decision);
         socketServer.sendListOfStrings("fps", {
                 std::to_string(executor->fetchAndClearInputFrameCounter()),
                 std::to_string(executor->fetchAndClearExecutorFrameCounter()),
                 std::to_string(executor->fetchAndClearSerialFrameCounter()),
         });
 
+    } else if (name == "latency") {
+        std::vector<std::string> list;
+        auto summaries = latencyStats().fetchAndClear();
+        for (int i = 0; i < LatencyStats::STAGE_COUNT; i++) {
+            const auto &s = summaries[i];
+            list.emplace_back(LatencyStats::stageName((LatencyStats::Stage) i));
+            list.emplace_back(std::to_string(s.count));
+            for (float v : {s.p50, s.p95, s.p99, s.max}) list.emplace_back(fmt::format("{:.2f}", v));
+        }
+        socketServer.sendListOfStrings("latency", list);
+
     } else if (name == "setParams") {
         if (!recvParams.ParseFromArray(buf, size)) {
             sendStatusBarMsg("invalid ParamSet package");
@@ -232,12 +437,26 @@ void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
         }
 
     } else if (name == "fetchLists") {
+        executor->listDataSetsIfNeeded();
         socketServer.sendListOfStrings("imageSetList", executor->imageSet()->getImageSetList());
         socketServer.sendListOfStrings("videoList", executor->videoSet()->getVideoList());
         socketServer.sendListOfStrings("paramSetList", executor->dataManager()->getParamSetList());
         socketServer.sendSingleString("currentParamSetName", executor->dataManager()->currentParamSetName());
         socketServer.sendBytes("params", executor->getCurrentParams());
 
+    } else if (name == "openSharedMemory") {
+        // Terminal on the same machine, replies go through resultRing from the next fetch
+        if (!resultRing.isOpen() && !resultRing.create()) {
+            spdlog::error("Failed to create shared memory for results: {}", resultRing.errorMessage());
+            sendStatusBarMsg("no shared memory for results (" + resultRing.errorMessage() + "), using TCP");
+        } else {
+            sharedMemoryReplies = true;
+            socketServer.sendSingleString("sharedMemory", resultRing.name());
+        }
+
+    } else if (name == "closeSharedMemory") {
+        sharedMemoryReplies = false;
+
     } else if (name == "reloadLists") {
         executor->reloadLists();  // switch to default parameter set
 
@@ -250,8 +469,7 @@ void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size) {
         socketServer.sendSingleString("executionStarted", "recording " + filename);
 
     } else if (name == "stopRecord") {
-        executor->stopRecordToVideo();
-        sendStatusBarMsg("stop recording video");
+        sendStatusBarMsg("stop recording video: " + executor->stopRecordToVideo());
 
     } else {
         spdlog::error("Unknown bytes package <{}>", name);
@@ -266,11 +484,14 @@ boost::asio::io_context serialIOContext;
 // TCP handling should not operates on these components directly, so they are put at last
 std::unique_ptr<OpenCVCamera> openCVCamera;
 std::unique_ptr<MVCamera> mvCamera;
+std::unique_ptr<MVCamera> secondaryMvCamera;  // secondary_camera
+std::unique_ptr<V4L2Camera> v4l2Camera;
 std::unique_ptr<ImageSet> imageSet;
 std::unique_ptr<VideoSet> videoSet;
 std::unique_ptr<ArmorDetector> detector;
 std::unique_ptr<ParamSetManager> paramSetManager;
 std::unique_ptr<PositionCalculator> positionCalculator;
+std::unique_ptr<PositionCalculator> secondaryPositionCalculator;
 std::unique_ptr<AimingSolver> aimingSolver;
 std::unique_ptr<Serial> serial;
 
@@ -289,39 +510,93 @@ int main(int argc, char *argv[]) {
 
     CameraSdkInit(0);   // for MVCamera
 
+    /*
+     * Bring-up. Deserializing the engine, opening the camera (waiting for its first frame) and opening the serial take
+     * the longest and do not depend on each other, so they run concurrently. The camera is opened with the default
+     * parameter set, which the executor applies as well, so it is not reopened. The executor waits for the camera and
+     * the detector only: the serial is still opening while detection starts, and the first command waits for it (see
+     * Serial::sendControlCommand()).
+     */
+    auto startupTime = std::chrono::steady_clock::now();
+    auto bringUp = [startupTime](const char *component, std::function<bool()> open) {
+        return std::async(std::launch::async, [startupTime, component, open = std::move(open)] {
+            bool ready = open();
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startupTime).count();
+            if (ready) {
+                spdlog::info("Solais: {} ready at {:.2f} s", component, elapsed);
+            } else {
+                spdlog::error("Solais: {} failed at {:.2f} s", component, elapsed);
+            }
+            return ready;
+        });
+    };
+
     openCVCamera = std::make_unique<OpenCVCamera>();
     mvCamera = std::make_unique<MVCamera>();
+    secondaryMvCamera = std::make_unique<MVCamera>();
+    v4l2Camera = std::make_unique<V4L2Camera>();
     imageSet = std::make_unique<ImageSet>();
     videoSet = std::make_unique<VideoSet>();
-    detector = std::make_unique<ArmorDetector>();
     paramSetManager = std::make_unique<ParamSetManager>();
     positionCalculator = std::make_unique<PositionCalculator>();
+    secondaryPositionCalculator = std::make_unique<PositionCalculator>();
     aimingSolver = std::make_unique<AimingSolver>();
+
+    paramSetManager->reloadParamSetList();
+    const ParamSet startupParams = paramSetManager->loadCurrentParamSet();
+    lockProcessMemory(startupParams);  // before the engine, the camera and the frame pools are allocated
+    auto cameraReady = bringUp("camera", [&startupParams] {
+        if (startupParams.camera_backend() == ParamSet::MV_CAMERA) return mvCamera->open(startupParams);
+        if (startupParams.camera_backend() == ParamSet::V4L2) return v4l2Camera->open(startupParams);
+        return openCVCamera->open(startupParams);
+    });
+    auto detectorReady = bringUp("detector", [] {
+        detector = std::make_unique<ArmorDetector>();  // deserializes the engine on Jetson
+        return true;
+    });
+    std::future<bool> serialReady;
     if (strlen(SERIAL_DEVICE) != 0) {
         serial = std::make_unique<Serial>(serialIOContext);
+        serialReady = bringUp("serial", [] {
+            serial->open();  // exits if it fails
+            return true;
+        });
     } else {
         spdlog::warn("Solais: Serial connection disabled for debug purposes");
     }
-    executor = std::make_unique<Executor>(openCVCamera.get(), mvCamera.get(), imageSet.get(), videoSet.get(),
-                                          paramSetManager.get(),
+
+    detectorReady.wait();
+    cameraReady.wait();  // the executor must not touch the camera while it is opened
+    executor = std::make_unique<Executor>(openCVCamera.get(), mvCamera.get(), v4l2Camera.get(), imageSet.get(),
+                                          videoSet.get(), paramSetManager.get(),
                                           detector.get(), positionCalculator.get(), aimingSolver.get(),
-                                          serial.get());
+                                          serial.get(), secondaryMvCamera.get(), secondaryPositionCalculator.get());
 
-    tcpIOThread = new std::thread([] {
+    tcpIOThread = new std::thread([&startupParams] {
+        applyThreadScheduling(ThreadRole::IO, startupParams);
         boost::asio::executor_work_guard<boost::asio::io_context::executor_type> workGuard(tcpIOContext.get_executor());
         tcpIOContext.run();  // this operation is blocking, until ioContext is deleted
     });
 
+    resultEncoderThread = new std::thread([&startupParams] {
+        applyThreadScheduling(ThreadRole::IO, startupParams);  // kept off the cores of capture and detection
+        runResultEncoder();
+    });
+
     socketServer.startAccept();
     socketServer.setCallbacks(handleRecvSingleString,
                               nullptr,
                               handleRecvBytes,
                               nullptr);
 
-    // Start on camera
-    executor->startRealTimeDetection();
+    // Start on camera, opened once more if it failed
+    if (executor->startRealTimeDetection()) {
+        spdlog::info("Solais: detection started at {:.2f} s",
+                     std::chrono::duration<double>(std::chrono::steady_clock::now() - startupTime).count());
+    }
 
-    // Main thread is then used for serial IO
+    // Main thread is then used for serial IO, scheduled last as the threads above would inherit it
+    applyThreadScheduling(ThreadRole::SERIAL, startupParams);
     boost::asio::executor_work_guard<boost::asio::io_context::executor_type> workGuard(serialIOContext.get_executor());
     serialIOContext.run();  // this operation is blocking, until ioContext is deleted
 
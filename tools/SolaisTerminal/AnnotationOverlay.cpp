@@ -0,0 +1,59 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "AnnotationOverlay.h"
+#include <QLabel>
+#include <QPainter>
+#include <QEvent>
+#include <QOpenGLFunctions>
+
+namespace meta {
+
+AnnotationOverlay::AnnotationOverlay(QLabel *label) : QOpenGLWidget(label), label(label) {
+    // Composited over the label with the alpha of the framebuffer, and mouse events go to the label
+    setAttribute(Qt::WA_AlwaysStackOnTop);
+    setAttribute(Qt::WA_TransparentForMouseEvents);
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setAlphaBufferSize(8);
+    setFormat(format);
+
+    resize(label->size());
+    label->installEventFilter(this);
+}
+
+void AnnotationOverlay::setShapes(const QSize &size, std::vector<Shape> newShapes) {
+    imageSize = size;
+    shapes = std::move(newShapes);
+    update();
+}
+
+bool AnnotationOverlay::eventFilter(QObject *watched, QEvent *event) {
+    if (watched == label && event->type() == QEvent::Resize) resize(label->size());
+    return QOpenGLWidget::eventFilter(watched, event);
+}
+
+void AnnotationOverlay::paintGL() {
+    auto gl = context()->functions();
+    gl->glClearColor(0, 0, 0, 0);
+    gl->glClear(GL_COLOR_BUFFER_BIT);
+    if (shapes.empty()) return;
+
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+    // Image centered in the label
+    painter.translate((width() - imageSize.width()) / 2, (height() - imageSize.height()) / 2);
+    for (const auto &shape : shapes) {
+        painter.setPen(shape.color);
+        if (shape.points.size() == 1) {
+            painter.drawPoint(shape.points[0]);
+        } else if (shape.closed) {
+            painter.drawPolygon(shape.points);
+        } else {
+            painter.drawPolyline(shape.points);
+        }
+        if (!shape.text.isEmpty()) painter.drawText(shape.textPos, shape.text);
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_ANNOTATIONOVERLAY_H
+#define META_VISION_SOLAIS_ANNOTATIONOVERLAY_H
+
+#include <QOpenGLWidget>
+#include <QPolygonF>
+#include <QColor>
+#include <QString>
+#include <vector>
+
+class QLabel;
+
+namespace meta {
+
+/**
+ * Transparent OpenGL layer over an image label, drawing annotations (light rects, armor polygons) with the GL paint
+ * engine instead of rasterizing them into a copy of the image on the CPU. The image is shown 1:1 and centered in the
+ * label (see GeneratePhaseUI.py), so shapes are in the coordinates of the image.
+ */
+class AnnotationOverlay : public QOpenGLWidget {
+Q_OBJECT
+
+public:
+
+    struct Shape {
+        QPolygonF points;   // a single point is drawn as a point
+        bool closed = true;
+        QColor color;
+        QString text;       // drawn at textPos if not empty
+        QPointF textPos;
+    };
+
+    /**
+     * Cover a label, following its size.
+     */
+    explicit AnnotationOverlay(QLabel *label);
+
+    /**
+     * Replace the shapes.
+     * @param imageSize  Size of the image shown by the label.
+     * @param shapes     Shapes in the coordinates of the image.
+     */
+    void setShapes(const QSize &imageSize, std::vector<Shape> shapes);
+
+    void clear() { setShapes(QSize(), {}); }
+
+protected:
+
+    void paintGL() override;
+
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+
+    QLabel *label;
+    QSize imageSize;
+    std::vector<Shape> shapes;
+};
+
+}
+
+#endif //META_VISION_SOLAIS_ANNOTATIONOVERLAY_H
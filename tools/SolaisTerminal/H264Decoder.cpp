@@ -0,0 +1,90 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "H264Decoder.h"
+
+#ifdef FFMPEG_FOUND
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+namespace meta {
+
+#ifdef FFMPEG_FOUND
+
+H264Decoder::H264Decoder() { open(); }
+
+H264Decoder::~H264Decoder() { close(); }
+
+bool H264Decoder::supported() { return true; }
+
+void H264Decoder::open() {
+    const AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec) return;
+    context = avcodec_alloc_context3(codec);
+    context->flags |= AV_CODEC_FLAG_LOW_DELAY;  // output each frame as soon as it is decoded
+    if (avcodec_open2(context, codec, nullptr) < 0) {
+        avcodec_free_context(&context);
+        return;
+    }
+    frame = av_frame_alloc();
+    packet = av_packet_alloc();
+}
+
+void H264Decoder::close() {
+    if (context) avcodec_free_context(&context);
+    if (frame) av_frame_free(&frame);
+    if (packet) av_packet_free(&packet);
+    if (swsContext) {
+        sws_freeContext(swsContext);
+        swsContext = nullptr;
+    }
+}
+
+void H264Decoder::reset() {
+    close();
+    open();
+}
+
+QImage H264Decoder::decode(const std::string &data) {
+    if (!context || data.empty()) return {};
+
+    packet->data = (uint8_t *) data.data();
+    packet->size = (int) data.size();
+    int ret = avcodec_send_packet(context, packet);
+    packet->data = nullptr;
+    packet->size = 0;
+    if (ret < 0) return {};
+
+    QImage image;
+    while (avcodec_receive_frame(context, frame) == 0) {  // keep the last one if there are several
+        swsContext = sws_getCachedContext(swsContext, frame->width, frame->height, (AVPixelFormat) frame->format,
+                                          frame->width, frame->height, AV_PIX_FMT_RGB24,
+                                          SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (!swsContext) return {};
+        image = QImage(frame->width, frame->height, QImage::Format_RGB888);
+        uint8_t *dst[] = {image.bits()};
+        int dstStride[] = {(int) image.bytesPerLine()};
+        sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+    }
+    return image;
+}
+
+#else
+
+H264Decoder::H264Decoder() = default;
+
+H264Decoder::~H264Decoder() = default;
+
+bool H264Decoder::supported() { return false; }
+
+QImage H264Decoder::decode(const std::string &) { return {}; }
+
+void H264Decoder::reset() {}
+
+#endif
+
+}
@@ -0,0 +1,60 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_H264DECODER_H
+#define META_VISION_SOLAIS_H264DECODER_H
+
+#include <QImage>
+#include <string>
+
+#ifdef FFMPEG_FOUND
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+#endif
+
+namespace meta {
+
+/**
+ * Decoder of the H.264 camera stream (Image::H264), one access unit per Result package. Without FFmpeg, decode()
+ * always fails.
+ */
+class H264Decoder {
+public:
+
+    H264Decoder();
+
+    ~H264Decoder();
+
+    /**
+     * Decode an access unit.
+     * @param data  Access unit in Annex B byte stream.
+     * @return      Decoded frame, or a null QImage if no frame is available (e.g. waiting for a key frame).
+     */
+    QImage decode(const std::string &data);
+
+    /**
+     * Drop the decoder state, e.g. after a disconnection. Decoding restarts from the next key frame.
+     */
+    void reset();
+
+    static bool supported();
+
+private:
+#ifdef FFMPEG_FOUND
+    AVCodecContext *context = nullptr;
+    AVFrame *frame = nullptr;
+    AVPacket *packet = nullptr;
+    SwsContext *swsContext = nullptr;
+
+    void open();
+
+    void close();
+#endif
+};
+
+}
+
+#endif //META_VISION_SOLAIS_H264DECODER_H
@@ -4,7 +4,8 @@
 #include <QTextStream>
 #include <QTimer>
 #include <iostream>
-#include <QPainter>
+#include <QTransform>
+#include <cstring>
 #include "Parameters.ui.h"
 #include "TerminalParameters.h"
 
@@ -21,6 +22,8 @@ MainWindow::MainWindow(QWidget *parent) :
     setWindowTitle("Meta-Vision-Solais Terminal");
     ui->setupUi(this);
     phases = new PhaseController(ui->centralContainer, ui->centralContainerVertialLayout, this);
+    contourOverlay = new AnnotationOverlay(phases->contourImageLabel);
+    armorOverlay = new AnnotationOverlay(phases->armorImageLabel);
 
     // Setup IO
     socket.setCallbacks([this](auto name, auto s) { handleRecvSingleString(name, s); },
@@ -52,7 +55,7 @@ MainWindow::MainWindow(QWidget *parent) :
         if (state == Qt::Checked) {
             sendFetch();
         } else {
-            phases->resetImageLabels();
+            resetImages();
         }
         holdingFetchPackage = false;  // the on-hold fetch package is either sent or discarded
     });
@@ -112,6 +115,11 @@ MainWindow::MainWindow(QWidget *parent) :
 
 }
 
+// Solais on this machine, whose results can go through shared memory
+static bool isLocalServer(const QString &server) {
+    return server == "localhost" || server == "127.0.0.1" || server == "::1";
+}
+
 void MainWindow::connectToServer() {
     if (ui->connectButton->text() == "Connect") {
         if (socket.connect(ui->serverCombo->currentText().toStdString(), TCP_SOCKET_PORT_STR)) {
@@ -128,6 +136,9 @@ void MainWindow::connectToServer() {
 
             socket.sendBytes("fetchLists");  // will trigger data set and param set reloads
 
+            // Raw images through shared memory instead of JPEG over the socket, confirmed by "sharedMemory"
+            if (isLocalServer(ui->serverCombo->currentText())) socket.sendBytes("openSharedMemory");
+
         } else {
             showStatusMessage("Failed to connected to " + ui->serverCombo->currentText() + ":" +
                               TCP_SOCKET_PORT_STR);
@@ -156,7 +167,9 @@ void MainWindow::handleClientDisconnection(TerminalSocketClient *) {
     ui->serverCombo->setEnabled(true);
     ui->connectButton->setText("Connect");
 
-    phases->resetImageLabels();
+    resetImages();
+    resultDecoder.resetStream();  // a new connection starts a new stream
+    resultRing.close();
     ui->imageSetList->clear();
     ui->imageList->clear();
     ui->paramSetCombo->clear();
@@ -175,14 +188,32 @@ void MainWindow::handleRecvBytes(std::string_view name, const uint8_t *buf, size
             } else {
                 if (!resultMessage.ParseFromArray(buf, size)) {
                     showStatusMessage("Received an invalid Result package");
+                    sendFetch();  // continue for next cycle
                 } else {
                     ++resultPackageCounter;
-                    applyResultMessage();
+                    applyResultMessage();  // sends the next fetch once the images are shown
                 }
-                sendFetch();  // continue for next cycle
             }
         }  // Otherwise, discard result and do not send next fetching request
 
+    } else if (name == "resShm") {
+
+        // Same as a non-empty "res", with the Result in the slot of the sequence number in resultRing
+        if (ui->transferImagesCheck->isChecked()) {
+            uint64_t sequence = 0;
+            SharedResultRing::SlotView slot{};
+            if (size == sizeof(sequence)) memcpy(&sequence, buf, sizeof(sequence));
+            if (!resultRing.read(sequence, slot) ||
+                !resultMessage.ParseFromArray(slot.message, (int) slot.messageSize)) {
+                showStatusMessage("Received an invalid or stale shared-memory Result");
+                sendFetch();  // continue for next cycle
+            } else {
+                ++resultPackageCounter;
+                applyResultMessage(&slot);  // RAW images are taken before it returns
+                if (!resultRing.isValid(sequence)) showStatusMessage("Shared-memory Result overwritten while shown");
+            }
+        }
+
     } else if (name == "params") {
 
         if (!paramsMessage.ParseFromArray(buf, size)) {
@@ -208,6 +239,14 @@ void MainWindow::handleRecvSingleString(std::string_view name, std::string_view
         ui->paramSetCombo->setCurrentText(QString::fromStdString(std::string(s)));
         ui->paramSetCombo->blockSignals(false);
 
+    } else if (name == "sharedMemory") {
+        if (resultRing.open(std::string(s))) {
+            showStatusMessage("Results through shared memory " + QString::fromStdString(std::string(s)));
+        } else {
+            showStatusMessage("Failed to open shared memory: " + QString::fromStdString(resultRing.errorMessage()));
+            socket.sendBytes("closeSharedMemory");  // stay on TCP
+        }
+
     } else if (name == "executionStarted") {
         showStatusMessage("Start execution on " + QString::fromStdString(std::string(s)));
         if (holdingFetchPackage || lastRunSingleImage) {
@@ -240,6 +279,24 @@ void MainWindow::handleRecvListOfStrings(std::string_view name, const std::vecto
             showStatusMessage("Invalid fps package size " + QString::number(list.size()));
         }
 
+    } else if (name == "latency") {
+        // Each stage: name, sample count, p50, p95, p99, max [ms]
+        if (list.size() % 6 == 0) {
+            QString s;
+            QTextStream ss(&s);
+            ss << "<table width=\"100%\">";
+            for (size_t i = 0; i < list.size(); i += 6) {
+                if (QString(list[i + 1]) == "0") continue;  // stage not running
+                ss << "<tr><td><b>" << list[i] << "</b></td><td align=\"right\">"
+                   << list[i + 2] << " / " << list[i + 3] << " / " << list[i + 4] << " / " << list[i + 5]
+                   << "</td></tr>";
+            }
+            ss << "</table>";
+            ui->latencyLabel->setText(s);
+        } else {
+            showStatusMessage("Invalid latency package size " + QString::number(list.size()));
+        }
+
 
     } else if (name == "imageList") {
         loadListOfStringsToQListWidget(list, ui->imageList);
@@ -289,64 +346,58 @@ void MainWindow::showStatusMessage(const QString &text) {
     ui->statusBar->showMessage(text, 5000);
 }
 
-void MainWindow::applyResultMessage() {
+/**
+ * Take a RAW image of a shared-memory slot. It is wrapped in place without any decoding, and copied to outlive the
+ * slot.
+ * @return The image, or a null QImage if it is malformed.
+ */
+static QImage takeRawImage(const package::Image &image, const SharedResultRing::SlotView &slot) {
+    if (image.width() <= 0 || image.height() <= 0 || (image.channels() != 1 && image.channels() != 3)) return {};
+    size_t bytesPerLine = (size_t) image.width() * image.channels();
+    if (image.data_offset() + bytesPerLine * image.height() > slot.messageOffset) return {};
+    return QImage(slot.payload + image.data_offset(), image.width(), image.height(), (int) bytesPerLine,
+                  image.channels() == 3 ? QImage::Format_BGR888 : QImage::Format_Grayscale8).copy();
+}
+
+void MainWindow::applyResultMessage(const SharedResultRing::SlotView *slot) {
 
     // GROUP: Input
     if (resultMessage.has_camera_info()) {
         phases->cameraInfoLabel->setText(QString::fromStdString(resultMessage.camera_info()));
     }
-    if (resultMessage.has_camera_image()) {
-        if (!resultMessage.camera_image().data().empty()) {
-            phases->cameraImage = QImage::fromData((const uint8_t *) resultMessage.camera_image().data().c_str(),
-                                                   resultMessage.camera_image().data().size()).copy();
-            phases->cameraImageLabel->setPixmap(QPixmap::fromImage(phases->cameraImage));
-        } else {
-            phases->cameraImageLabel->setText("Empty");
-        }
-    }
-
-    // GROUP: Brightness
-    if (resultMessage.has_brightness_image()) {
-        if (!resultMessage.brightness_image().data().empty()) {
-            phases->brightnessImage = QImage::fromData(
-                    (const uint8_t *) resultMessage.brightness_image().data().c_str(),
-                    resultMessage.brightness_image().data().size()).copy();
-            phases->brightnessImageLabel->setPixmap(QPixmap::fromImage(phases->brightnessImage));
-        } else {
-            phases->brightnessImageLabel->setText("Empty");
-        }
-    }
 
-    // GROUP: Color
-    if (resultMessage.has_color_image()) {
-        if (!resultMessage.color_image().data().empty()) {
-            phases->colorImage = QImage::fromData((const uint8_t *) resultMessage.color_image().data().c_str(),
-                                                  resultMessage.color_image().data().size()).copy();
-            phases->colorImageLabel->setPixmap(QPixmap::fromImage(phases->colorImage));
-        } else {
-            phases->colorImageLabel->setText("Empty");
-        }
-    }
+    // Images are only decoded for the panels shown, on the decoder thread, and shown by showResultImages()
+    ResultImageDecoder::Job job;
+    auto addImage = [&](ResultImageDecoder::ImageIndex index, bool has, const package::Image &image, bool shown) {
+        if (!has) return;
+        job.images[index] = image;
+        job.wanted[index] = shown;
+        if (image.format() == package::Image::RAW && shown && slot) job.decoded[index] = takeRawImage(image, *slot);
+    };
+    addImage(ResultImageDecoder::CAMERA, resultMessage.has_camera_image(), resultMessage.camera_image(),
+             !phases->cameraImageLabel->visibleRegion().isEmpty() ||
+             !phases->armorImageLabel->visibleRegion().isEmpty());
+    addImage(ResultImageDecoder::BRIGHTNESS, resultMessage.has_brightness_image(), resultMessage.brightness_image(),
+             !phases->brightnessImageLabel->visibleRegion().isEmpty());
+    addImage(ResultImageDecoder::COLOR, resultMessage.has_color_image(), resultMessage.color_image(),
+             !phases->colorImageLabel->visibleRegion().isEmpty());
+    addImage(ResultImageDecoder::CONTOUR, resultMessage.has_contour_image(), resultMessage.contour_image(),
+             !phases->contourImageLabel->visibleRegion().isEmpty());
 
     // GROUP: Contours
+    std::vector<AnnotationOverlay::Shape> lightShapes;
     if (resultMessage.has_contour_image()) {
-        if (!resultMessage.contour_image().data().empty()) {
-            phases->contourImage = QImage::fromData((const uint8_t *) resultMessage.contour_image().data().c_str(),
-                                                    resultMessage.contour_image().data().size())
-                    .copy()
-                    .convertToFormat(QImage::Format_BGR888);
-            QPainter painter(&phases->contourImage);
-            painter.setPen(Qt::yellow);
-            for (const auto &rect : resultMessage.lights()) {
-                painter.resetTransform();
-                painter.drawText(rect.center().x(), rect.center().y() - 5, QString::number((int) rect.angle()));
-                painter.translate(rect.center().x(), rect.center().y());
-                painter.rotate(rect.angle());
-                painter.drawRect(-rect.size().x() / 2, -rect.size().y() / 2, rect.size().x(), rect.size().y());
-            }
-            phases->contourImageLabel->setPixmap(QPixmap::fromImage(phases->contourImage));
-        } else {
-            phases->contourImageLabel->setText("Empty");
+        for (const auto &rect : resultMessage.lights()) {
+            AnnotationOverlay::Shape shape;
+            QTransform transform;
+            transform.translate(rect.center().x(), rect.center().y());
+            transform.rotate(rect.angle());
+            shape.points = transform.map(QPolygonF(QRectF(-rect.size().x() / 2, -rect.size().y() / 2,
+                                                          rect.size().x(), rect.size().y())));
+            shape.color = Qt::yellow;
+            shape.text = QString::number((int) rect.angle());
+            shape.textPos = QPointF(rect.center().x(), rect.center().y() - 5);
+            lightShapes.emplace_back(std::move(shape));
         }
     }
 
@@ -370,11 +421,8 @@ void MainWindow::applyResultMessage() {
     }
 
     // GROUP: Armors
-    if (resultMessage.armors_size() != 0) {
-
-        phases->armorImage = phases->cameraImage.copy();
-        QPainter painter(&phases->armorImage);
-
+    std::vector<AnnotationOverlay::Shape> armorShapes;
+    {
         QString s;
         QTextStream ss(&s);
         for (const auto &armorInfo : resultMessage.armors()) {
@@ -384,14 +432,16 @@ void MainWindow::applyResultMessage() {
                 showStatusMessage("Invalid armor points");
                 continue;
             }
-            painter.setPen(armorInfo.selected() ? Qt::red : Qt::yellow);
-            const auto &points = armorInfo.image_points();
-            for (int i = 0; i < 4; i++) {
-                painter.drawLine(points[i].x(), points[i].y(), points[(i + 1) % 4].x(), points[(i + 1) % 4].y());
-            }
+            AnnotationOverlay::Shape polygon;
+            polygon.color = armorInfo.selected() ? Qt::red : Qt::yellow;
+            for (const auto &point : armorInfo.image_points()) polygon.points << QPointF(point.x(), point.y());
 
             // Image center
-            painter.drawPoint(armorInfo.image_center().x(), armorInfo.image_center().y());
+            AnnotationOverlay::Shape center;
+            center.color = polygon.color;
+            center.points << QPointF(armorInfo.image_center().x(), armorInfo.image_center().y());
+            armorShapes.emplace_back(std::move(polygon));
+            armorShapes.emplace_back(std::move(center));
 
             // Large/small armor, number, and offset
             if (armorInfo.large_armor()) {
@@ -403,13 +453,9 @@ void MainWindow::applyResultMessage() {
                << QString::number(armorInfo.ypd().y(), 'f', 1) << ", "
                << QString::number(armorInfo.ypd().z(), 'f', 0) << "\n";
         }
-
         phases->armorInfoLabel->setText(s);
-        phases->armorImageLabel->setPixmap(QPixmap::fromImage(phases->armorImage));
-    } else {
-        phases->armorInfoLabel->setText("");
-        phases->armorImageLabel->setText("Empty");
     }
+    bool hasArmors = (resultMessage.armors_size() != 0);
 
     // GROUP: Aiming
     {
@@ -423,6 +469,75 @@ void MainWindow::applyResultMessage() {
         phases->aimingInfoLabel->setText(s);
     }
 
+    resultDecoder.decode(std::move(job), [this, generation = imageGeneration, lightShapes = std::move(lightShapes),
+                                          armorShapes = std::move(armorShapes), hasArmors](auto &job) mutable {
+        if (generation != imageGeneration) return;  // images reset meanwhile, e.g. disconnected
+        showResultImages(job, std::move(lightShapes), std::move(armorShapes), hasArmors);
+        if (ui->transferImagesCheck->isChecked()) sendFetch();  // continue for next cycle
+    });
+}
+
+void MainWindow::showResultImages(ResultImageDecoder::Job &job, std::vector<AnnotationOverlay::Shape> lightShapes,
+                                  std::vector<AnnotationOverlay::Shape> armorShapes, bool hasArmors) {
+
+    // Show a still image, keep the last one if it is not decoded as its panel is hidden
+    auto showStill = [&job](ResultImageDecoder::ImageIndex index, QImage &phaseImage, QLabel *label) {
+        const auto &image = job.images[index];
+        if (!image.has_format()) return false;
+        if (!ResultImageDecoder::hasImageData(image)) {
+            label->setText("Empty");
+            return false;
+        }
+        if (!job.wanted[index]) return false;
+        phaseImage = std::move(job.decoded[index]);
+        label->setPixmap(QPixmap::fromImage(phaseImage));
+        return true;
+    };
+
+    // GROUP: Input
+    const auto &cameraImage = job.images[ResultImageDecoder::CAMERA];
+    if (cameraImage.has_format() && cameraImage.format() == package::Image::H264) {
+        // Frames of a stream, keep the last frame if nothing is decoded
+        if (!job.decoded[ResultImageDecoder::CAMERA].isNull()) {
+            phases->cameraImage = std::move(job.decoded[ResultImageDecoder::CAMERA]);
+            phases->cameraImageLabel->setPixmap(QPixmap::fromImage(phases->cameraImage));
+        } else if (!H264Decoder::supported()) {
+            phases->cameraImageLabel->setText("H.264 not supported (built without FFmpeg)");
+        }
+    } else {
+        showStill(ResultImageDecoder::CAMERA, phases->cameraImage, phases->cameraImageLabel);
+    }
+
+    // GROUP: Brightness
+    showStill(ResultImageDecoder::BRIGHTNESS, phases->brightnessImage, phases->brightnessImageLabel);
+
+    // GROUP: Color
+    showStill(ResultImageDecoder::COLOR, phases->colorImage, phases->colorImageLabel);
+
+    // GROUP: Contours
+    if (showStill(ResultImageDecoder::CONTOUR, phases->contourImage, phases->contourImageLabel)) {
+        contourOverlay->setShapes(phases->contourImage.size(), std::move(lightShapes));
+    } else if (job.images[ResultImageDecoder::CONTOUR].has_format()) {
+        contourOverlay->clear();
+    }
+
+    // GROUP: Armors
+    if (hasArmors) {
+        // The camera image itself (shared, not copied), with the armors drawn over it
+        phases->armorImage = phases->cameraImage;
+        phases->armorImageLabel->setPixmap(QPixmap::fromImage(phases->armorImage));
+        armorOverlay->setShapes(phases->armorImage.size(), std::move(armorShapes));
+    } else {
+        phases->armorImageLabel->setText("Empty");
+        armorOverlay->clear();
+    }
+}
+
+void MainWindow::resetImages() {
+    ++imageGeneration;  // drop images still being decoded
+    phases->resetImageLabels();
+    contourOverlay->clear();
+    armorOverlay->clear();
 }
 
 void MainWindow::updateStats() {
@@ -432,6 +547,7 @@ void MainWindow::updateStats() {
     ui->resultFPSLabel->setText(QString::number(resultPackageCounter) + " pkgs/s");
     resultPackageCounter = 0;
     socket.sendBytes("fps");  // request for FPS, handled by callback
+    socket.sendBytes("latency");  // request for stage latency, handled by callback
 }
 
 void MainWindow::performIO() {
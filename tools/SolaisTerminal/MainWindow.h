@@ -5,7 +5,10 @@
 #include <QtWidgets/QListWidget>
 //#include "AnnotatedMatViewer.h"
 #include "TerminalSocket.h"
+#include "SharedResultRing.h"
 #include "Parameters.pb.h"
+#include "ResultImageDecoder.h"
+#include "AnnotationOverlay.h"
 
 namespace Ui {
 class MainWindow;
@@ -42,6 +45,16 @@ private:
 
     int resultPackageCounter = 0;
 
+    ResultImageDecoder resultDecoder;
+    unsigned imageGeneration = 0;  // images decoded before a reset are dropped
+
+    // Lights and armors drawn over the images, not into them
+    AnnotationOverlay *contourOverlay;
+    AnnotationOverlay *armorOverlay;
+
+    // Results of Solais on the same machine, with raw images (Image::RAW), see SharedResultRing
+    SharedResultRing resultRing;
+
     void handleClientDisconnection(TerminalSocketClient *client);
 
     void handleRecvBytes(std::string_view name, const uint8_t *buf, size_t size);
@@ -56,7 +69,22 @@ private:
 
     void showStatusMessage(const QString &text);
 
-    void applyResultMessage();
+    /**
+     * Show resultMessage.
+     * @param slot  The slot of resultRing it comes from, for Image::RAW images, or nullptr.
+     */
+    void applyResultMessage(const SharedResultRing::SlotView *slot = nullptr);
+
+    /**
+     * Show the decoded images of a Result and their annotations.
+     */
+    void showResultImages(ResultImageDecoder::Job &job, std::vector<AnnotationOverlay::Shape> lightShapes,
+                          std::vector<AnnotationOverlay::Shape> armorShapes, bool hasArmors);
+
+    /**
+     * Reset the image labels and their annotations.
+     */
+    void resetImages();
 
     void runOnCurrentSelectedImage();
 
@@ -0,0 +1,66 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#include "ResultImageDecoder.h"
+#include "MaskRLE.h"
+
+namespace meta {
+
+ResultImageDecoder::ResultImageDecoder(QObject *parent) : QObject(parent), worker(new QObject) {
+    worker->moveToThread(&thread);
+    connect(&thread, &QThread::finished, worker, &QObject::deleteLater);
+    thread.start();
+}
+
+ResultImageDecoder::~ResultImageDecoder() {
+    thread.quit();
+    thread.wait();  // callbacks posted to this object after it is destroyed are dropped by Qt
+}
+
+void ResultImageDecoder::decode(Job job, Callback done) {
+    QMetaObject::invokeMethod(worker, [this, job = std::move(job), done = std::move(done)]() mutable {
+        run(job);
+        QMetaObject::invokeMethod(this, [job = std::move(job), done = std::move(done)]() mutable {
+            done(job);
+        }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void ResultImageDecoder::resetStream() {
+    QMetaObject::invokeMethod(worker, [this] { cameraStreamDecoder.reset(); }, Qt::QueuedConnection);
+}
+
+void ResultImageDecoder::run(Job &job) {
+    for (int i = 0; i < IMAGE_COUNT; i++) {
+        const auto &image = job.images[i];
+        if (!job.decoded[i].isNull() || !hasImageData(image)) continue;
+        if (image.format() == package::Image::H264) {
+            // Every access unit, even if not shown, as the following ones depend on it
+            QImage frame = cameraStreamDecoder.decode(image.data());
+            if (job.wanted[i]) job.decoded[i] = std::move(frame);
+        } else if (job.wanted[i]) {
+            job.decoded[i] = decodeStill(image);
+        }
+    }
+}
+
+/**
+ * Decode a still image of a Result package (JPEG or MASK_RLE).
+ * @param image
+ * @return The image, or a null QImage if it fails.
+ */
+QImage ResultImageDecoder::decodeStill(const package::Image &image) {
+    if (image.format() == package::Image::MASK_RLE) {
+        QImage mask(image.width(), image.height(), QImage::Format_Grayscale8);
+        if (mask.isNull() ||
+            !decodeMaskRLE(image.data(), image.width(), image.height(), mask.bits(), mask.bytesPerLine())) {
+            return {};
+        }
+        return mask;
+    }
+    if (image.format() == package::Image::RAW) return {};  // taken by MainWindow from the shared-memory slot
+    return QImage::fromData((const uint8_t *) image.data().c_str(), image.data().size()).copy();
+}
+
+}
@@ -0,0 +1,79 @@
+//
+// Created by niceme on 10/14/26.
+//
+
+#ifndef META_VISION_SOLAIS_RESULTIMAGEDECODER_H
+#define META_VISION_SOLAIS_RESULTIMAGEDECODER_H
+
+#include <QObject>
+#include <QImage>
+#include <QThread>
+#include <array>
+#include <functional>
+#include "Parameters.pb.h"
+#include "H264Decoder.h"
+
+namespace meta {
+
+/**
+ * Decodes the images of Result packages (JPEG, MASK_RLE, H264) on a thread of its own, so that the GUI thread only
+ * shows them. Jobs run one at a time in order, which the H.264 stream requires. RAW images of the shared-memory ring
+ * are not decoded and are taken as they come (see MainWindow).
+ */
+class ResultImageDecoder : public QObject {
+Q_OBJECT
+
+public:
+
+    enum ImageIndex {
+        CAMERA,
+        BRIGHTNESS,
+        COLOR,
+        CONTOUR,
+
+        IMAGE_COUNT
+    };
+
+    struct Job {
+        std::array<package::Image, IMAGE_COUNT> images;  // format, size and data
+        std::array<bool, IMAGE_COUNT> wanted{};          // shown, the others are skipped except the camera stream
+        std::array<QImage, IMAGE_COUNT> decoded;         // filled by the decoder, or beforehand for RAW
+    };
+
+    using Callback = std::function<void(Job &job)>;
+
+    explicit ResultImageDecoder(QObject *parent = nullptr);
+
+    ~ResultImageDecoder() override;
+
+    /**
+     * Decode the images of a job on the decoder thread.
+     * @param job   The job.
+     * @param done  Called on the thread of this object (the GUI thread) with the decoded images, null for images
+     *              that fail, are not wanted or are waiting for a key frame.
+     */
+    void decode(Job job, Callback done);
+
+    /**
+     * Drop the state of the H.264 stream, e.g. after a disconnection. Ordered after the jobs already submitted.
+     */
+    void resetStream();
+
+    static bool hasImageData(const package::Image &image) {
+        return image.format() == package::Image::RAW ? image.width() > 0 : !image.data().empty();
+    }
+
+private:
+
+    QThread thread;
+    QObject *worker;                 // lives in thread
+    H264Decoder cameraStreamDecoder;  // only used in thread
+
+    void run(Job &job);
+
+    static QImage decodeStill(const package::Image &image);
+};
+
+}
+
+#endif //META_VISION_SOLAIS_RESULTIMAGEDECODER_H
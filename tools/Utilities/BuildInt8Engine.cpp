@@ -0,0 +1,112 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A tool to build the INT8 engine of the armor YOLOv5 model and report its accuracy against FP16.
+ *
+ * Usage:
+ * Set the model and image sets below, or pass them as arguments:
+ *     BuildInt8Engine [model.onnx] [calib dir] [eval dir] [DLA core]
+ * Run the program on the target device (the engine is specific to the GPU and TensorRT version)
+ * Delete <model>.int8.engine to go back to FP16 in Solais, and also <model>.int8.calib to recalibrate
+ * With a DLA core (Xavier and Orin), the INT8 engine is built for it as <model>.int8.dla<core>.engine, which Solais
+ * uses when detector_device runs YOLOv5 on DLA
+ *
+ * The evaluation set does not need labels: FP16 detections are taken as reference. A reference box is matched by an
+ * INT8 box of the same color and tag whose corners are all within maxCornerError pixels.
+ */
+
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <strings.h>
+#include <opencv2/opencv.hpp>
+#include "YOLOv5_TensorRT.h"
+
+using namespace std;
+using namespace meta;
+namespace fs = std::filesystem;
+
+string modelFile = "../../../nn-models/model-opt-4.onnx";
+string calibImageDir = "../../../data/images/calibration";
+string evalImageDir = "../../../data/images/evaluation";
+int dlaCore = -1;
+const float maxCornerError = 8;  // [px]
+
+static vector<string> listImages(const string &dir) {
+    vector<string> files;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        if (strcasecmp(entry.path().extension().c_str(), ".jpg") == 0) files.emplace_back(entry.path().string());
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+static float maxCornerDistance(const YOLODet::bbox_t &a, const YOLODet::bbox_t &b) {
+    float d = 0;
+    for (int i = 0; i < 4; i++) d = max(d, (float) norm(a.pts[i] - b.pts[i]));
+    return d;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) modelFile = argv[1];
+    if (argc > 2) calibImageDir = argv[2];
+    if (argc > 3) evalImageDir = argv[3];
+    if (argc > 4) dlaCore = stoi(argv[4]);
+
+    YOLODet fp16(modelFile, YOLODet::precision_t::FP16);
+    YOLODet int8(modelFile, YOLODet::precision_t::INT8, calibImageDir, true, true, dlaCore);
+    cout << "INT8 engine: " << YOLODet::engine_file(modelFile, YOLODet::precision_t::INT8, dlaCore) << endl;
+
+    int referenceCount = 0, matchedCount = 0, int8Count = 0, imageCount = 0;
+    double cornerErrorSum = 0, confidenceDeltaSum = 0;
+    double fp16Time = 0, int8Time = 0;  // [ms]
+
+    for (const auto &file : listImages(evalImageDir)) {
+        Mat img = imread(file);
+        if (img.empty()) continue;
+        imageCount++;
+
+        auto t0 = chrono::high_resolution_clock::now();
+        auto reference = fp16(img);
+        auto t1 = chrono::high_resolution_clock::now();
+        auto result = int8(img);
+        auto t2 = chrono::high_resolution_clock::now();
+        fp16Time += chrono::duration<double, milli>(t1 - t0).count();
+        int8Time += chrono::duration<double, milli>(t2 - t1).count();
+
+        referenceCount += (int) reference.size();
+        int8Count += (int) result.size();
+        vector<bool> used(result.size());
+        for (const auto &ref : reference) {
+            int best = -1;
+            float bestError = maxCornerError;
+            for (int i = 0; i < (int) result.size(); i++) {
+                if (used[i] || result[i].color_id != ref.color_id || result[i].tag_id != ref.tag_id) continue;
+                float error = maxCornerDistance(ref, result[i]);
+                if (error <= bestError) best = i, bestError = error;
+            }
+            if (best != -1) {
+                used[best] = true;
+                matchedCount++;
+                cornerErrorSum += bestError;
+                confidenceDeltaSum += result[best].confidence - ref.confidence;
+            }
+        }
+    }
+
+    if (imageCount == 0) {
+        cout << "No evaluation image in " << evalImageDir << endl;
+        return -1;
+    }
+
+    cout << "Images: " << imageCount << "\n"
+         << "FP16 boxes: " << referenceCount << ", INT8 boxes: " << int8Count << "\n"
+         << "Matched: " << matchedCount << " (" << (referenceCount ? 100.0 * matchedCount / referenceCount : 100.0)
+         << "% of FP16), INT8 only: " << int8Count - matchedCount << "\n"
+         << "Mean max corner error of matched: " << (matchedCount ? cornerErrorSum / matchedCount : 0) << " px\n"
+         << "Mean confidence delta of matched: " << (matchedCount ? confidenceDeltaSum / matchedCount : 0) << "\n"
+         << "Mean latency: FP16 " << fp16Time / imageCount << " ms, INT8 " << int8Time / imageCount << " ms"
+         << endl;
+    return 0;
+}
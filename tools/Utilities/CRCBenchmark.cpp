@@ -0,0 +1,87 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A microbenchmark of the CRC8 and CRC16 of CRC.h (slicing-by-8) against the byte-at-a-time table lookup they
+ * replace, for the package sizes of the serial links (vision commands up to referee system telemetry).
+ *
+ * Usage: CRCBenchmark [iterations]
+ *  iterations  Times each package size is checked (default 1000000).
+ *
+ * Also checks that both give the same CRCs, and that feeding a package in pieces (updateCRC8/16) gives the CRC of the
+ * whole package.
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "CRC.h"
+
+using namespace std;
+using namespace rm;
+
+static uint8_t byteTable8[256];
+static uint16_t byteTable16[256];
+
+static void buildByteTables() {
+    // The CRC of one zero byte from state i is the table entry of i
+    const uint8_t zero = 0;
+    for (int i = 0; i < 256; i++) {
+        byteTable8[i] = updateCRC8((uint8_t) i, &zero, 1);
+        byteTable16[i] = updateCRC16((uint16_t) i, &zero, 1);
+    }
+}
+
+static uint8_t byteWiseCRC8(const uint8_t *data, size_t length) {
+    uint8_t crc = CRC8_INIT;
+    while (length--) crc = byteTable8[crc ^ *data++];
+    return crc;
+}
+
+static uint16_t byteWiseCRC16(const uint8_t *data, size_t length) {
+    uint16_t crc = CRC16_INIT;
+    while (length--) crc = (uint16_t) ((crc >> 8) ^ byteTable16[(crc ^ *data++) & 0xff]);
+    return crc;
+}
+
+template<class F>
+static double nsPerByte(F f, const vector<uint8_t> &data, size_t iterations) {
+    volatile unsigned sink = 0;  // keep the results alive
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) sink = sink + f(data.data(), data.size());
+    auto end = chrono::steady_clock::now();
+    return (double) chrono::duration_cast<chrono::nanoseconds>(end - start).count() / (double) iterations /
+           (double) data.size();
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = (argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000);
+    buildByteTables();
+
+    printf("%8s %12s %12s %12s %12s\n", "bytes", "crc8 byte", "crc8 slice", "crc16 byte", "crc16 slice");
+    for (size_t size : {11, 32, 64, 128, 512, 1024}) {
+        vector<uint8_t> data(size);
+        for (auto &b : data) b = (uint8_t) rand();
+
+        // Same results, in one go and in pieces
+        size_t half = size / 2 + 1;
+        if (getCRC8CheckSum(data.data(), size) != byteWiseCRC8(data.data(), size) ||
+            updateCRC8(updateCRC8(CRC8_INIT, data.data(), half), data.data() + half, size - half) !=
+            byteWiseCRC8(data.data(), size) ||
+            getCRC16CheckSum(data.data(), size) != byteWiseCRC16(data.data(), size) ||
+            updateCRC16(updateCRC16(CRC16_INIT, data.data(), half), data.data() + half, size - half) !=
+            byteWiseCRC16(data.data(), size)) {
+            cerr << "CRC mismatch for " << size << " bytes" << endl;
+            return 1;
+        }
+
+        size_t n = iterations * 64 / size + 1;  // about the same total bytes for every size
+        printf("%8zu %9.3f ns %9.3f ns %9.3f ns %9.3f ns\n", size,
+               nsPerByte(byteWiseCRC8, data, n),
+               nsPerByte([](const uint8_t *p, size_t l) { return updateCRC8(CRC8_INIT, p, l); }, data, n),
+               nsPerByte(byteWiseCRC16, data, n),
+               nsPerByte([](const uint8_t *p, size_t l) { return updateCRC16(CRC16_INIT, p, l); }, data, n));
+    }
+    return 0;
+}
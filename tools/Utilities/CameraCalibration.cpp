@@ -2,123 +2,269 @@
  * Created by liuzikai on 4/16/20.
  * Reference: https://blog.csdn.net/Loser__Wang/article/details/51811347
  *
- * Usage:
- * Set camera parameters and calibration parameters below
- * Run the program and see the result
- * Parameters are saved as ../../../data/params/<width>x<height>.xml using cv::FileStorage
- * Press ESC to exit
+ * Calibrate the camera from photos of a chessboard (e.g. taken with TakePhotoUsingCamera).
+ *
+ * Usage: CameraCalibration <images> <board> <square> [zScale]
+ *  images  Directory of the photos, or the name of an image set under data/images.
+ *  board   Inner corners per row and per column, e.g. 9x6.
+ *  square  Side of a square [mm].
+ *  zScale  Written as is (default: kept from the existing parameter file, 1 if none).
+ *
+ * Corners are detected and refined on all cores, each photo searched at a reduced resolution and refined at the full
+ * one. The corners of each photo are cached in <images>/.corners, keyed on the board and on the size and modification
+ * time of the photo, so that a re-run after adding photos (or to try another board) only detects the new ones. Photos
+ * whose reprojection error is far over the others (blurred, or corners matched in the wrong order) are dropped and the
+ * camera is calibrated again without them.
+ *
+ * Results are saved as data/params/<width>x<height>.xml (cameraMatrix, distCoeffs and zScale, read by Solais) and as
+ * <images>/camera_info.yaml (ROS camera_info).
  */
 
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <thread>
 #include <opencv2/opencv.hpp>
+#include "TaskPool.h"
 
 using namespace cv;
 using namespace std;
+namespace fs = std::filesystem;
 
-const int cameraIndex = 0;
-const int cameraWidth = 1280;
-const int cameraHeight = 1024;
-const int cameraFPS = 211;
-
-int main() {
-    VideoCapture inputVideo(cameraIndex);
-
-    if (!inputVideo.isOpened()) {
-        cout << "Could not open the input video " << endl;
-        return -1;
-    }
-
-    inputVideo.set(CAP_PROP_FRAME_WIDTH, cameraWidth);
-    inputVideo.set(CAP_PROP_FRAME_HEIGHT, cameraHeight);
-    inputVideo.set(CAP_PROP_FOURCC, VideoWriter::fourcc('M', 'J', 'P', 'G'));
-    inputVideo.set(CAP_PROP_FPS, cameraFPS);
-
-    cout << inputVideo.get(CAP_PROP_FRAME_WIDTH) << "x"
-         << inputVideo.get(CAP_PROP_FRAME_HEIGHT) << "@"
-         << inputVideo.get(CAP_PROP_FPS);
-
-    Mat frame;
-    Mat frameCalibration;
-
-    inputVideo >> frame;
+const int detectionWidth = 640;  // photos are searched at this width at most, then refined at the full resolution
+const Size subPixWindow(11, 11);
+const double maxErrorOverMedian = 3;  // photos with a reprojection error over this times the median are dropped
+const double minDroppedError = 0.5;   // [pixel] but not under this
 
-    /*
-     >> cameraParams.IntrinsicMatrix
-
-        ans =
+struct PhotoCorners {
+    fs::path path;
+    bool found = false;
+    Size imageSize;
+    vector<Point2f> corners;
+};
 
-          342.3936         0         0
-           -0.0265  342.2803         0
-          320.3885  174.8987    1.0000
-     */
-    /*Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
-    cameraMatrix.at<double>(0, 0) = 342.3936;
-    cameraMatrix.at<double>(0, 1) = -0.0265;
-    cameraMatrix.at<double>(0, 2) = 320.3885;
-    cameraMatrix.at<double>(1, 1) = 342.2803;
-    cameraMatrix.at<double>(1, 2) = 174.8987;*/
+static fs::path cachePath(const fs::path &photo) {
+    return photo.parent_path() / ".corners" / (photo.filename().string() + ".yml");
+}
 
+/**
+ * @return Cache key of the photo, changed whenever the photo or the board changes.
+ */
+static string cacheKey(const fs::path &photo, Size board) {
+    error_code ec;
+    auto size = fs::file_size(photo, ec);
+    auto time = fs::last_write_time(photo, ec).time_since_epoch().count();
+    return to_string(board.width) + "x" + to_string(board.height) + "_" + to_string(size) + "_" + to_string(time);
+}
 
-    Mat cameraMatrix = Mat::eye(3, 3, CV_64F);
-    cameraMatrix.at<double>(0, 0) = 1.3844E3;
-    cameraMatrix.at<double>(0, 1) = 0;
-    cameraMatrix.at<double>(0, 2) = 0.6167E3;
-    cameraMatrix.at<double>(1, 1) = 1.3799E3;
-    cameraMatrix.at<double>(1, 2) = 0.4678E3;
+static bool loadCachedCorners(PhotoCorners &photo, const string &key, Size board) {
+    FileStorage fs;
+    try {
+        if (!fs.open(cachePath(photo.path).string(), FileStorage::READ)) return false;
+    } catch (const cv::Exception &) {
+        return false;  // corrupted by an interrupted run
+    }
+    if ((string) fs["key"] != key) return false;
+    Mat corners;
+    int found = 0;
+    fs["imageSize"] >> photo.imageSize;
+    fs["found"] >> found;
+    fs["corners"] >> corners;
+    photo.found = (found != 0 && (int) corners.total() == board.area() && corners.type() == CV_32FC2);
+    if (photo.found) photo.corners.assign(corners.begin<Point2f>(), corners.end<Point2f>());
+    return true;
+}
 
-    /*
-     >> cameraParams.RadialDistortion
+static void saveCachedCorners(const PhotoCorners &photo, const string &key) {
+    error_code ec;
+    fs::create_directories(cachePath(photo.path).parent_path(), ec);
+    FileStorage fs(cachePath(photo.path).string(), FileStorage::WRITE);
+    fs << "key" << key;
+    fs << "imageSize" << photo.imageSize;
+    fs << "found" << (int) photo.found;
+    fs << "corners" << Mat(photo.corners, true);
+}
 
-        ans =
+static void detectCorners(PhotoCorners &photo, Size board) {
+    Mat gray = imread(photo.path.string(), IMREAD_GRAYSCALE);
+    if (gray.empty()) return;
+    photo.imageSize = gray.size();
 
-            0.0396   -0.0614
+    // The search on a full-size photo without the board takes seconds, at a reduced resolution only a fraction
+    double scale = min(1.0, (double) detectionWidth / gray.cols);
+    Mat small;
+    if (scale < 1) {
+        resize(gray, small, Size(), scale, scale, INTER_AREA);
+    } else {
+        small = gray;
+    }
+    photo.found = findChessboardCorners(small, board, photo.corners,
+                                        CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK);
+    if (!photo.found) {
+        photo.corners.clear();
+        return;
+    }
+    for (auto &corner : photo.corners) corner *= (float) (1 / scale);
+    cornerSubPix(gray, photo.corners, subPixWindow, Size(-1, -1),
+                 TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 30, 0.01));
+}
 
-        >> cameraParams.TangentialDistortion
+static void writeCameraInfo(const fs::path &path, Size imageSize, const Mat &cameraMatrix, const Mat &distCoeffs) {
+    auto row = [](const Mat &m) {
+        string s;
+        for (int i = 0; i < (int) m.total(); i++) s += (i ? ", " : "") + to_string(m.at<double>(i));
+        return s;
+    };
+    Mat projection = Mat::zeros(3, 4, CV_64F);
+    cameraMatrix.copyTo(projection(Rect(0, 0, 3, 3)));
 
-        ans =
+    ofstream out(path);
+    out << "image_width: " << imageSize.width << "\n"
+        << "image_height: " << imageSize.height << "\n"
+        << "camera_name: solais\n"
+        << "camera_matrix:\n  rows: 3\n  cols: 3\n  data: [" << row(cameraMatrix) << "]\n"
+        << "distortion_model: plumb_bob\n"
+        << "distortion_coefficients:\n  rows: 1\n  cols: " << distCoeffs.total() << "\n  data: [" << row(distCoeffs)
+        << "]\n"
+        << "rectification_matrix:\n  rows: 3\n  cols: 3\n  data: [" << row(Mat::eye(3, 3, CV_64F)) << "]\n"
+        << "projection_matrix:\n  rows: 3\n  cols: 4\n  data: [" << row(projection) << "]\n";
+}
 
-            0.0008   -0.0012
-     */
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        cout << "Usage: " << argv[0] << " <images> <board> <square> [zScale]" << endl;
+        return -1;
+    }
+    fs::path imageDir = argv[1];
+    // DATA_SET_ROOT and PARAM_SET_ROOT defined in CMakeLists.txt
+    if (!fs::is_directory(imageDir)) imageDir = fs::path(DATA_SET_ROOT) / "images" / argv[1];
+    Size board;
+    if (sscanf(argv[2], "%dx%d", &board.width, &board.height) != 2 || board.width < 2 || board.height < 2) {
+        cout << "Invalid board " << argv[2] << ", expecting inner corners per row and column such as 9x6" << endl;
+        return -1;
+    }
+    const float squareSize = stof(argv[3]);
 
-    /*Mat distCoeffs = Mat::zeros(5, 1, CV_64F);
-    distCoeffs.at<double>(0, 0) = 0.0396;
-    distCoeffs.at<double>(1, 0) = -0.0614;
-    distCoeffs.at<double>(2, 0) = 0.0008;
-    distCoeffs.at<double>(3, 0) = -0.0012;
-    distCoeffs.at<double>(4, 0) = 0;*/
+    vector<PhotoCorners> photos;
+    error_code ec;
+    for (const auto &entry : fs::directory_iterator(imageDir, ec)) {
+        string ext = entry.path().extension().string();
+        transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if (ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp") photos.push_back({entry.path()});
+    }
+    if (photos.empty()) {
+        cout << "No photo in " << imageDir << endl;
+        return -1;
+    }
+    sort(photos.begin(), photos.end(), [](auto &a, auto &b) { return a.path < b.path; });
 
-    Mat distCoeffs = Mat::zeros(5, 1, CV_64F);
-    distCoeffs.at<double>(0, 0) = -0.0697;
-    distCoeffs.at<double>(1, 0) = 0.1052;
-    distCoeffs.at<double>(2, 0) = 0;
-    distCoeffs.at<double>(3, 0) = 0;
-    distCoeffs.at<double>(4, 0) = 0;
+    // Detection, one photo per task. OpenCV's own threads are disabled meanwhile, the photos keep all cores busy.
+    auto startTime = chrono::steady_clock::now();
+    atomic<int> cachedPhotos{0};
+    {
+        int threads = max((int) thread::hardware_concurrency(), 1);
+        int openCVThreads = getNumThreads();
+        setNumThreads(1);
+        meta::TaskPool pool;
+        pool.setWorkerCount(threads - 1);
+        pool.run((int) photos.size(), [&](int i) {
+            auto &photo = photos[i];
+            string key = cacheKey(photo.path, board);
+            if (loadCachedCorners(photo, key, board)) {
+                cachedPhotos++;
+                return;
+            }
+            detectCorners(photo, board);
+            if (!photo.imageSize.empty()) saveCachedCorners(photo, key);
+        });
+        setNumThreads(openCVThreads);
+        cout << photos.size() << " photos (" << cachedPhotos << " cached) searched on " << threads << " threads in "
+             << chrono::duration<double>(chrono::steady_clock::now() - startTime).count() << " s" << endl;
+    }
 
-    float zScale = 0.5;
+    // All photos have to be of one size, the most common one
+    map<pair<int, int>, int> sizeCounts;
+    for (const auto &photo : photos) {
+        if (photo.found) sizeCounts[{photo.imageSize.width, photo.imageSize.height}]++;
+    }
+    if (sizeCounts.empty()) {
+        cout << "The board is found in none of the photos" << endl;
+        return -1;
+    }
+    auto commonSize = max_element(sizeCounts.begin(), sizeCounts.end(),
+                                  [](auto &a, auto &b) { return a.second < b.second; })->first;
+    const Size imageSize(commonSize.first, commonSize.second);
 
-    FileStorage fs("../../../data/params/" + std::to_string(cameraWidth) + "x" + std::to_string(cameraHeight) + ".xml", FileStorage::WRITE);
-    fs << "cameraMatrix" << cameraMatrix;
-    fs << "distCoeffs" << distCoeffs;
-    fs << "zScale" << zScale;
-    fs.release();
+    vector<Point3f> boardPoints;
+    for (int y = 0; y < board.height; y++) {
+        for (int x = 0; x < board.width; x++) boardPoints.emplace_back(x * squareSize, y * squareSize, 0);
+    }
+    vector<const PhotoCorners *> views;
+    for (const auto &photo : photos) {
+        if (photo.found && photo.imageSize == imageSize) views.push_back(&photo);
+    }
+    cout << views.size() << " photos of " << imageSize << " with the board" << endl;
+    if (views.size() < 3) {
+        cout << "Too few photos to calibrate" << endl;
+        return -1;
+    }
 
-    Mat view, rview, map1, map2;
-    Size imageSize;
-    imageSize = frame.size();
-    initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat(),
-                            getOptimalNewCameraMatrix(cameraMatrix, distCoeffs, imageSize, 1, imageSize, 0),
-                            imageSize, CV_16SC2, map1, map2);
+    // Radial k1, k2 and tangential p1, p2, as the 5 coefficients of PositionCalculator with k3 = 0
+    Mat cameraMatrix, distCoeffs, stdDevIntrinsics, stdDevExtrinsics, perViewErrors;
+    vector<Mat> rvecs, tvecs;
+    double rms = 0;
+    auto calibrate = [&] {
+        vector<vector<Point3f>> objectPoints(views.size(), boardPoints);
+        vector<vector<Point2f>> imagePoints;
+        for (const auto *view : views) imagePoints.push_back(view->corners);
+        startTime = chrono::steady_clock::now();
+        rms = calibrateCamera(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, rvecs, tvecs,
+                              stdDevIntrinsics, stdDevExtrinsics, perViewErrors, CALIB_FIX_K3);
+        distCoeffs = distCoeffs.reshape(1, (int) distCoeffs.total());  // a column, as in the parameter files
+        cout << "Calibrated on " << views.size() << " photos in "
+             << chrono::duration<double>(chrono::steady_clock::now() - startTime).count() << " s, RMS error " << rms
+             << " pixel" << endl;
+    };
+    calibrate();
 
+    vector<double> errors(perViewErrors.begin<double>(), perViewErrors.end<double>());
+    vector<double> sortedErrors = errors;
+    nth_element(sortedErrors.begin(), sortedErrors.begin() + sortedErrors.size() / 2, sortedErrors.end());
+    const double maxError = max(sortedErrors[sortedErrors.size() / 2] * maxErrorOverMedian, minDroppedError);
+    vector<const PhotoCorners *> keptViews;
+    for (size_t i = 0; i < views.size(); i++) {
+        if (errors[i] <= maxError) {
+            keptViews.push_back(views[i]);
+        } else {
+            cout << "  dropped " << views[i]->path.filename().string() << ", error " << errors[i] << " pixel" << endl;
+        }
+    }
+    if (keptViews.size() != views.size() && keptViews.size() >= 3) {
+        views = keptViews;
+        calibrate();
+    }
+    cout << "cameraMatrix = " << endl << cameraMatrix << endl;
+    cout << "distCoeffs = " << distCoeffs.t() << endl;
 
-    while (true) //Show the image captured in the window and repeat
-    {
-        inputVideo >> frame;              // read
-        if (frame.empty()) break;         // check if at end
-        remap(frame, frameCalibration, map1, map2, INTER_LINEAR);
-        imshow("Original", frame);
-        imshow("Calibration", frameCalibration);
-        char key = waitKey(1);
-        if (key == 27) break;
+    fs::path paramFile = fs::path(PARAM_SET_ROOT) / "params" /
+                         (to_string(imageSize.width) + "x" + to_string(imageSize.height) + ".xml");
+    float zScale = 1;
+    if (argc > 4) {
+        zScale = stof(argv[4]);
+    } else if (fs::exists(paramFile)) {
+        FileStorage existing(paramFile.string(), FileStorage::READ);
+        if (!existing["zScale"].empty()) existing["zScale"] >> zScale;
     }
+    FileStorage out(paramFile.string(), FileStorage::WRITE);
+    out << "cameraMatrix" << cameraMatrix;
+    out << "distCoeffs" << distCoeffs;
+    out << "zScale" << zScale;
+    out.release();
+    writeCameraInfo(imageDir / "camera_info.yaml", imageSize, cameraMatrix, distCoeffs);
+    cout << "Saved as " << paramFile.string() << " and " << (imageDir / "camera_info.yaml").string() << endl;
     return 0;
 }
@@ -0,0 +1,554 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * Microbenchmarks of the hot functions of the pipeline in isolation, on fixed fixtures: light canonicalization, light
+ * pairing and the filter of armors sharing lights of ArmorDetector, PositionCalculator::solve(),
+ * AimingSolver::updateArmors(), the CRCs of the serial links, and the serialization and packing of results for the
+ * terminal. Each benchmark reports its median time and the heap allocations (operator new) per operation.
+ *
+ * Usage: ComponentBenchmark <param set> [fixtures.yml | -] [report.json] [baseline.json] [repeats]
+ *        ComponentBenchmark --record <param set> <image set> <fixtures.yml>
+ *  param set      Name of a parameter set in data/params (e.g. meta-jetson-nano-1), for the filters and the camera.
+ *  fixtures.yml   Fixtures recorded with --record, or - (default) for the synthetic ones (fixed seed).
+ *  report.json    Report file (default component_benchmark.json).
+ *  baseline.json  A report of an earlier run to compare with. A benchmark regresses if it is more than 10% slower
+ *                 or allocates more, and then the exit code is 1.
+ *  repeats        Timed passes over the fixtures of each benchmark (default 15), the median is reported.
+ *  image set      Directory or packed image set under data/images, run through the legacy detection to record the
+ *                 light rects, the armor corners and the results of its frames.
+ *
+ * Allocations are counted by replacing the global operator new, so buffers of cv::Mat (cv::fastMalloc) don't count.
+ * Runs are comparable only on the same fixtures and param set.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <vector>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "Parameters.h"
+#include "ParamSetManager.h"
+#include "ImageSet.h"
+#include "ArmorDetector.h"
+#include "PositionCalculator.h"
+#include "AimingSolver.h"
+#include "TerminalSocket.h"
+#include "ResultEncoding.h"
+#include "CRC.h"
+
+using namespace std;
+using namespace meta;
+
+static atomic<size_t> allocationCount{0};
+
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static constexpr int SYNTHETIC_FRAMES = 64;
+static constexpr uint64_t SYNTHETIC_SEED = 20261014;
+static constexpr double REGRESSION_TOLERANCE = 0.1;  // of the time per operation
+static constexpr TimePoint FRAME_TIME_STEP = 100;    // 10 ms between frames of the aiming benchmark
+
+struct Fixtures {
+    vector<vector<cv::RotatedRect>> lights;                // per frame, canonicalized as ArmorDetector::lightRects
+    vector<vector<ArmorDetector::DetectedArmor>> armors;   // per frame, as detected
+    vector<vector<uint8_t>> results;                       // serialized Result, per frame
+};
+
+/**
+ * The part of main.cpp of Solais that fills a Result, without the images.
+ */
+static void fillResult(const vector<cv::RotatedRect> &lights, const AimingSolver::ArmorList &armors, Result &result) {
+    result.set_camera_info("ComponentBenchmark fixture");
+    addResultDetections(lights, armors, cv::Point2f(), 1.0f, result);
+}
+
+/**
+ * Armors of a frame with their offsets, as Executor::solveArmorPositions() without the pose history.
+ */
+static void solveArmors(const PositionCalculator &positionCalculator,
+                        const vector<ArmorDetector::DetectedArmor> &detectedArmors, AimingSolver::ArmorList &armors) {
+    armors.clear();
+    for (const auto &detectedArmor : detectedArmors) {
+        if (armors.full()) break;
+        cv::Point3f offset;
+        if (positionCalculator.solve(detectedArmor.points, detectedArmor.largeArmor, false, offset)) {
+            armors.emplace_back(AimingSolver::ArmorInfo{detectedArmor.points, detectedArmor.center, offset,
+                                                        detectedArmor.avgLightAngle, detectedArmor.largeArmor,
+                                                        detectedArmor.number});
+        }
+    }
+}
+
+static vector<uint8_t> serializeResult(const vector<cv::RotatedRect> &lights, const AimingSolver::ArmorList &armors) {
+    Result result;
+    fillResult(lights, armors, result);
+    vector<uint8_t> bytes(result.ByteSizeLong());
+    result.SerializeToArray(bytes.data(), (int) bytes.size());
+    return bytes;
+}
+
+static PositionCalculator loadPositionCalculator(const ParamSet &params) {
+    // Same as Executor::loadPositionCalculatorParams()
+    string filename = PositionCalculator::calibrationPath(params) + ".xml";
+    PositionCalculator positionCalculator;
+    if (!positionCalculator.loadCalibration(params, filename)) {
+        cerr << "Failed to open " << filename << endl;
+        exit(1);
+    }
+    return positionCalculator;
+}
+
+namespace meta {
+
+/**
+ * Access to the private stages of ArmorDetector (a friend of it).
+ */
+class ComponentBenchmark {
+public:
+
+    static void canonicalize(cv::RotatedRect &rect) { ArmorDetector::canonicalizeRotatedRect(rect); }
+
+    static vector<cv::RotatedRect> &lightRects(ArmorDetector &detector) { return detector.lightRects; }
+
+    static void combineLights(ArmorDetector &detector, vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+        detector.combineLights(acceptedArmors);
+    }
+
+    static void pairLights(ArmorDetector &detector, vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+        detector.pairLights(acceptedArmors);
+    }
+
+    static void filterArmorsSharingLights(ArmorDetector &detector,
+                                          vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+        detector.filterArmorsSharingLights(acceptedArmors);
+    }
+};
+
+}
+
+/**
+ * Frames of armors (light pairs at the spacing of small and large armors, slightly tilted) among noise lights.
+ */
+static Fixtures syntheticFixtures(const ParamSet &params, ArmorDetector &detector,
+                                  const PositionCalculator &positionCalculator) {
+    Fixtures fixtures;
+    cv::RNG rng(SYNTHETIC_SEED);
+    const float width = (float) params.roi_width(), height = (float) params.roi_height();
+    AimingSolver::ArmorList solvedArmors;
+    for (int frame = 0; frame < SYNTHETIC_FRAMES; frame++) {
+        vector<cv::RotatedRect> lights;
+        int armorCount = rng.uniform(1, 5);
+        for (int i = 0; i < armorCount; i++) {
+            float length = rng.uniform(12.f, 80.f);
+            float spacing = length * (rng.uniform(0, 3) == 0 ? 4.2f : 2.3f);  // large or small armor
+            float tilt = rng.uniform(-15.f, 15.f);
+            cv::Point2f center(rng.uniform(spacing, max(width - spacing, spacing + 1)),
+                               rng.uniform(length, max(height - length, length + 1)));
+            float tiltRad = tilt * (float) CV_PI / 180;
+            float dx = spacing / 2 * cos(tiltRad), dy = spacing / 2 * sin(tiltRad);
+            for (int side : {-1, 1}) {
+                lights.emplace_back(cv::Point2f(center.x + side * dx, center.y + side * dy),
+                                    cv::Size2f(length / 5, length), tilt + rng.uniform(-3.f, 3.f));
+            }
+        }
+        int noiseCount = rng.uniform(0, 12);
+        for (int i = 0; i < noiseCount; i++) {
+            float length = rng.uniform(4.f, 60.f);
+            lights.emplace_back(cv::Point2f(rng.uniform(0.f, width), rng.uniform(0.f, height)),
+                                cv::Size2f(length / rng.uniform(1.f, 8.f), length), rng.uniform(-90.f, 90.f));
+        }
+        // As the fit of the contours gives them
+        for (auto &light : lights) {
+            cv::Point2f points[4];
+            light.points(points);
+            light = cv::minAreaRect(vector<cv::Point2f>(points, points + 4));
+            ComponentBenchmark::canonicalize(light);
+        }
+
+        auto &rects = ComponentBenchmark::lightRects(detector);
+        rects = lights;
+        vector<ArmorDetector::DetectedArmor> armors;
+        ComponentBenchmark::combineLights(detector, armors);
+        solveArmors(positionCalculator, armors, solvedArmors);
+
+        fixtures.results.emplace_back(serializeResult(rects, solvedArmors));
+        fixtures.lights.emplace_back(rects);  // sorted
+        fixtures.armors.emplace_back(move(armors));
+    }
+    return fixtures;
+}
+
+static Fixtures recordFixtures(const ParamSet &params, const string &dataSet, ArmorDetector &detector,
+                               const PositionCalculator &positionCalculator) {
+    Fixtures fixtures;
+    ImageSet imageSet;
+    imageSet.reloadImageSetList();
+    imageSet.switchImageSet(dataSet);
+    AimingSolver::ArmorList solvedArmors;
+    for (size_t i = 0; i < imageSet.getImageList().size(); i++) {
+        auto img = imageSet.loadImage(i, params);
+        if (img.empty()) continue;
+        vector<ArmorDetector::DetectedArmor> armors;
+        detector.detect(img, armors);
+        const auto &rects = ComponentBenchmark::lightRects(detector);
+        solveArmors(positionCalculator, armors, solvedArmors);
+
+        fixtures.results.emplace_back(serializeResult(rects, solvedArmors));
+        fixtures.lights.emplace_back(rects);
+        fixtures.armors.emplace_back(move(armors));
+    }
+    return fixtures;
+}
+
+// Fixture files: a sequence of frames, lights as rows of (center x, y, width, height, angle), armors as rows of
+// (4 points, center, large armor, number, light angle diff, average light angle, light indices), results as bytes
+
+static void writeFixtures(const string &filename, const Fixtures &fixtures) {
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        cerr << "Failed to open " << filename << endl;
+        exit(1);
+    }
+    fs << "frames" << "[";
+    for (size_t f = 0; f < fixtures.lights.size(); f++) {
+        cv::Mat lights((int) fixtures.lights[f].size(), 5, CV_32F);
+        for (int i = 0; i < lights.rows; i++) {
+            const auto &rect = fixtures.lights[f][i];
+            float row[5] = {rect.center.x, rect.center.y, rect.size.width, rect.size.height, rect.angle};
+            std::copy(row, row + 5, lights.ptr<float>(i));
+        }
+        cv::Mat armors((int) fixtures.armors[f].size(), 16, CV_32F);
+        for (int i = 0; i < armors.rows; i++) {
+            const auto &armor = fixtures.armors[f][i];
+            float *row = armors.ptr<float>(i);
+            for (int j = 0; j < 4; j++) row[j * 2] = armor.points[j].x, row[j * 2 + 1] = armor.points[j].y;
+            row[8] = armor.center.x, row[9] = armor.center.y;
+            row[10] = (float) armor.largeArmor, row[11] = (float) armor.number;
+            row[12] = armor.lightAngleDiff, row[13] = armor.avgLightAngle;
+            row[14] = (float) armor.lightIndex[0], row[15] = (float) armor.lightIndex[1];
+        }
+        const auto &result = fixtures.results[f];
+        fs << "{" << "lights" << lights << "armors" << armors
+           << "result" << cv::Mat(1, (int) result.size(), CV_8U, (void *) result.data()) << "}";
+    }
+    fs << "]";
+}
+
+static Fixtures readFixtures(const string &filename) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        cerr << "Failed to open " << filename << endl;
+        exit(1);
+    }
+    Fixtures fixtures;
+    cv::FileNode frames = fs["frames"];
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        cv::Mat lights, armors, result;
+        (*it)["lights"] >> lights;
+        (*it)["armors"] >> armors;
+        (*it)["result"] >> result;
+
+        auto &frameLights = fixtures.lights.emplace_back();
+        for (int i = 0; i < lights.rows; i++) {
+            const float *row = lights.ptr<float>(i);
+            frameLights.emplace_back(cv::Point2f(row[0], row[1]), cv::Size2f(row[2], row[3]), row[4]);
+        }
+        auto &frameArmors = fixtures.armors.emplace_back();
+        for (int i = 0; i < armors.rows; i++) {
+            const float *row = armors.ptr<float>(i);
+            auto &armor = frameArmors.emplace_back();
+            for (int j = 0; j < 4; j++) armor.points[j] = {row[j * 2], row[j * 2 + 1]};
+            armor.center = {row[8], row[9]};
+            armor.largeArmor = (row[10] != 0), armor.number = (int) row[11];
+            armor.lightAngleDiff = row[12], armor.avgLightAngle = row[13];
+            armor.lightIndex = {(int) row[14], (int) row[15]};
+        }
+        fixtures.results.emplace_back(result.data, result.data + result.total());
+    }
+    return fixtures;
+}
+
+struct Measurement {
+    string name;
+    size_t ops = 0;          // per pass
+    double nsPerOp = 0;      // median of the passes
+    double allocsPerOp = 0;  // over all timed passes
+};
+
+/**
+ * Run a pass (returning its number of operations) once as warm-up, then the given times.
+ */
+static Measurement measure(const string &name, int repeats, const function<size_t()> &pass) {
+    Measurement m;
+    m.name = name;
+    pass();  // warm up caches and the capacity of scratch storage
+    vector<double> times;
+    size_t allocations = allocationCount.load(memory_order_relaxed), totalOps = 0;
+    for (int i = 0; i < repeats; i++) {
+        auto start = chrono::steady_clock::now();
+        size_t ops = pass();
+        auto end = chrono::steady_clock::now();
+        m.ops = ops;
+        totalOps += ops;
+        times.emplace_back((double) chrono::duration_cast<chrono::nanoseconds>(end - start).count() /
+                           (double) max(ops, (size_t) 1));
+    }
+    allocations = allocationCount.load(memory_order_relaxed) - allocations;
+    nth_element(times.begin(), times.begin() + (long) times.size() / 2, times.end());
+    m.nsPerOp = times[times.size() / 2];
+    m.allocsPerOp = (double) allocations / (double) max(totalOps, (size_t) 1);
+    return m;
+}
+
+int main(int argc, char *argv[]) {
+    bool recordMode = (argc > 1 && strcmp(argv[1], "--record") == 0);
+    if (argc < 2 || (recordMode && argc < 5)) {
+        cout << "Usage: " << argv[0] << " <param set> [fixtures.yml | -] [report.json] [baseline.json] [repeats]\n"
+             << "       " << argv[0] << " --record <param set> <image set> <fixtures.yml>" << endl;
+        return -1;
+    }
+    string paramSetName = argv[recordMode ? 2 : 1];
+
+    ParamSetManager paramSetManager;
+    paramSetManager.reloadParamSetList();
+    paramSetManager.switchToParamSet(paramSetName);
+    ParamSet params = paramSetManager.loadCurrentParamSet();
+
+    ArmorDetector detector;
+    detector.setParams(params);
+    auto positionCalculator = loadPositionCalculator(params);
+    AimingSolver aimingSolver;
+    aimingSolver.setParams(params);
+
+    if (recordMode) {
+        auto fixtures = recordFixtures(params, argv[3], detector, positionCalculator);
+        writeFixtures(argv[4], fixtures);
+        cout << fixtures.lights.size() << " frames recorded to " << argv[4] << endl;
+        return 0;
+    }
+
+    string fixtureFile = (argc > 2 ? argv[2] : "-");
+    string reportFile = (argc > 3 ? argv[3] : "component_benchmark.json");
+    string baselineFile = (argc > 4 ? argv[4] : "");
+    int repeats = (argc > 5 ? max(stoi(argv[5]), 1) : 15);
+
+    Fixtures fixtures = (fixtureFile == "-" ? syntheticFixtures(params, detector, positionCalculator)
+                                            : readFixtures(fixtureFile));
+    if (fixtures.lights.empty()) {
+        cout << "No fixture frame" << endl;
+        return -1;
+    }
+    size_t lightCount = 0, armorCount = 0;
+    for (const auto &lights : fixtures.lights) lightCount += lights.size();
+    for (const auto &armors : fixtures.armors) armorCount += armors.size();
+    printf("%s, %s fixtures: %zu frames, %zu lights, %zu armors\n", paramSetName.c_str(),
+           (fixtureFile == "-" ? "synthetic" : fixtureFile.c_str()), fixtures.lights.size(), lightCount, armorCount);
+
+    // Derived inputs, prepared out of the timed passes
+    vector<vector<cv::RotatedRect>> rawLights;  // as minAreaRect() gives them
+    for (const auto &lights : fixtures.lights) {
+        auto &raw = rawLights.emplace_back();
+        for (const auto &light : lights) {
+            cv::Point2f points[4];
+            light.points(points);
+            raw.emplace_back(cv::minAreaRect(vector<cv::Point2f>(points, points + 4)));
+        }
+    }
+    vector<vector<ArmorDetector::DetectedArmor>> candidateArmors;  // paired, before the filter of sharing lights
+    for (const auto &lights : fixtures.lights) {
+        ComponentBenchmark::lightRects(detector) = lights;  // already sorted
+        ComponentBenchmark::pairLights(detector, candidateArmors.emplace_back());
+    }
+    vector<AimingSolver::ArmorList> solvedArmors(fixtures.armors.size());
+    for (size_t f = 0; f < fixtures.armors.size(); f++) {
+        solveArmors(positionCalculator, fixtures.armors[f], solvedArmors[f]);
+    }
+    vector<Result> results(fixtures.results.size());
+    for (size_t f = 0; f < fixtures.results.size(); f++) {
+        results[f].ParseFromArray(fixtures.results[f].data(), (int) fixtures.results[f].size());
+    }
+    vector<vector<uint8_t>> packages;
+    cv::RNG rng(SYNTHETIC_SEED);
+    for (size_t size : {4, 11, 32, 128}) {  // frame headers (CRC8) up to telemetry (CRC16)
+        auto &package = packages.emplace_back(size);
+        for (auto &b : package) b = (uint8_t) rng.uniform(0, 256);
+    }
+
+    boost::asio::io_context ioContext;  // never run, packing only
+    TerminalSocketClient socket(ioContext);
+
+    volatile unsigned sink = 0;  // keep the results alive
+    vector<Measurement> measurements;
+    vector<cv::RotatedRect> rectScratch;
+    vector<ArmorDetector::DetectedArmor> armorScratch;
+    vector<uint8_t> serializeBuffer;
+
+    measurements.emplace_back(measure("canonicalize_light", repeats, [&] {
+        size_t ops = 0;
+        for (const auto &raw : rawLights) {
+            rectScratch.assign(raw.begin(), raw.end());
+            for (auto &rect : rectScratch) ComponentBenchmark::canonicalize(rect);
+            ops += rectScratch.size();
+        }
+        return ops;
+    }));
+    measurements.emplace_back(measure("combine_lights", repeats, [&] {
+        for (const auto &lights : fixtures.lights) {
+            auto &rects = ComponentBenchmark::lightRects(detector);
+            rects.assign(lights.begin(), lights.end());
+            armorScratch.clear();
+            ComponentBenchmark::combineLights(detector, armorScratch);
+            sink = sink + armorScratch.size();
+        }
+        return fixtures.lights.size();
+    }));
+    measurements.emplace_back(measure("filter_sharing_lights", repeats, [&] {
+        for (size_t f = 0; f < candidateArmors.size(); f++) {
+            ComponentBenchmark::lightRects(detector).assign(fixtures.lights[f].begin(), fixtures.lights[f].end());
+            armorScratch.assign(candidateArmors[f].begin(), candidateArmors[f].end());
+            ComponentBenchmark::filterArmorsSharingLights(detector, armorScratch);
+            sink = sink + armorScratch.size();
+        }
+        return candidateArmors.size();
+    }));
+    measurements.emplace_back(measure("pnp_solve", repeats, [&] {
+        size_t ops = 0;
+        for (const auto &armors : fixtures.armors) {
+            for (const auto &armor : armors) {
+                cv::Point3f offset;
+                sink = sink + positionCalculator.solve(armor.points, armor.largeArmor, false, offset);
+            }
+            ops += armors.size();
+        }
+        return ops;
+    }));
+    measurements.emplace_back(measure("aiming_update", repeats, [&] {
+        aimingSolver.resetHistory();
+        TimePoint frameTime = 0;
+        AimingSolver::ArmorList armors;
+        for (const auto &solved : solvedArmors) {
+            armors = solved;  // updated in place
+            aimingSolver.updateArmors(armors, frameTime += FRAME_TIME_STEP);
+            AimingSolver::ControlCommand command;
+            sink = sink + aimingSolver.getControlCommand(command);
+        }
+        return solvedArmors.size();
+    }));
+    measurements.emplace_back(measure("crc8", repeats, [&] {
+        for (int i = 0; i < 1000; i++) {
+            for (const auto &package : packages) sink = sink + rm::getCRC8CheckSum(package.data(), package.size());
+        }
+        return 1000 * packages.size();
+    }));
+    measurements.emplace_back(measure("crc16", repeats, [&] {
+        for (int i = 0; i < 1000; i++) {
+            for (const auto &package : packages) sink = sink + rm::getCRC16CheckSum(package.data(), package.size());
+        }
+        return 1000 * packages.size();
+    }));
+    measurements.emplace_back(measure("result_fill", repeats, [&] {
+        Result result;
+        for (size_t f = 0; f < solvedArmors.size(); f++) {
+            result.Clear();
+            fillResult(fixtures.lights[f], solvedArmors[f], result);
+            sink = sink + result.lights_size();
+        }
+        return solvedArmors.size();
+    }));
+    measurements.emplace_back(measure("result_serialize", repeats, [&] {
+        for (const auto &result : results) {
+            serializeBuffer.resize(result.ByteSizeLong());
+            result.SerializeWithCachedSizesToArray(serializeBuffer.data());
+            sink = sink + serializeBuffer.size();
+        }
+        return results.size();
+    }));
+    measurements.emplace_back(measure("socket_pack", repeats, [&] {
+        for (const auto &result : results) {
+            auto package = socket.packMessage("result", result);  // back to the pool when released
+            sink = sink + package->size();
+        }
+        return results.size();
+    }));
+
+    char hostName[256] = {};
+    gethostname(hostName, sizeof(hostName) - 1);
+
+    // Baseline comparison
+    vector<string> regressions;
+    cv::FileStorage baseline;
+    if (!baselineFile.empty() && !baseline.open(baselineFile, cv::FileStorage::READ)) {
+        cerr << "Failed to open " << baselineFile << endl;
+        return -1;
+    }
+
+    printf("%-24s %10s %12s %12s %10s\n", "benchmark", "ops", "ns/op", "allocs/op", "vs base");
+    for (const auto &m : measurements) {
+        printf("%-24s %10zu %12.1f %12.3f", m.name.c_str(), m.ops, m.nsPerOp, m.allocsPerOp);
+        if (baseline.isOpened()) {
+            cv::FileNode base = baseline["benchmarks"][m.name];
+            if (base.empty()) {
+                printf(" %10s", "new");
+            } else {
+                double baseNs = (double) base["ns_per_op"], baseAllocs = (double) base["allocs_per_op"];
+                printf(" %+9.1f%%", (m.nsPerOp / baseNs - 1) * 100);
+                if (m.nsPerOp > baseNs * (1 + REGRESSION_TOLERANCE) || m.allocsPerOp > baseAllocs + 1e-6) {
+                    regressions.emplace_back(m.name);
+                    printf(" REGRESSED");
+                }
+            }
+        }
+        printf("\n");
+    }
+
+    ofstream ofs(reportFile);
+    ofs << "{\n"
+        << "  \"host\": \"" << hostName << "\",\n"
+        << "  \"param_set\": \"" << paramSetName << "\",\n"
+        << "  \"fixtures\": \"" << (fixtureFile == "-" ? "synthetic" : fixtureFile) << "\",\n"
+        << "  \"frames\": " << fixtures.lights.size() << ",\n"
+        << "  \"repeats\": " << repeats << ",\n"
+        << "  \"benchmarks\": {";
+    bool first = true;
+    for (const auto &m : measurements) {
+        ofs << (first ? "\n" : ",\n") << "    \"" << m.name << "\": {"
+            << "\"ops\": " << m.ops << ", \"ns_per_op\": " << m.nsPerOp << ", \"allocs_per_op\": " << m.allocsPerOp
+            << "}";
+        first = false;
+    }
+    ofs << "\n  }\n}\n";
+    cout << "Report written to " << reportFile << endl;
+
+    if (!regressions.empty()) {
+        cout << regressions.size() << " regression(s) against " << baselineFile << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * Run the legacy detection over an image set and check that a reworked stage of ArmorDetector gives the same results
+ * as the implementation it replaces.
+ *  filter  filterArmorsSharingLights() against the original algorithm that repeatedly erases one armor of the first
+ *          pair sharing a light, on the candidate armors that pairLights() makes of the lights of each frame.
+ *  bands   The lights and armors of detect() with parallel_bands against those without, which must be the same for
+ *          contours across the cuts between bands as well.
+ *
+ * Usage: DetectionEquivalenceCheck filter <param set> <image set> [max reported]
+ *        DetectionEquivalenceCheck bands <param set> <image set> [bands] [max reported]
+ *  param set     Name of a parameter set in data/params (e.g. meta-jetson-nano-1), for the thresholds and filters.
+ *  image set     Directory or packed image set under data/images.
+ *  bands         Row bands (default that of the param set). Bands are at least ArmorDetector::MIN_BAND_ROWS rows.
+ *  max reported  Frames with differences printed in detail (default 10), all of them are counted.
+ *
+ * The exit code is 1 if any frame differs.
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "Parameters.h"
+#include "ParamSetManager.h"
+#include "ImageSet.h"
+#include "ArmorDetector.h"
+
+using namespace std;
+using namespace meta;
+
+namespace meta {
+
+/**
+ * Access to the private stages of ArmorDetector (a friend of it).
+ */
+class DetectionEquivalenceCheck {
+public:
+
+    static const vector<cv::RotatedRect> &lightRects(const ArmorDetector &detector) { return detector.lightRects; }
+
+    static const cv::Rect &detectWindow(const ArmorDetector &detector) { return detector.detectWindow; }
+
+    static int bandCount(const ArmorDetector &detector) { return (int) detector.lightBands.size(); }
+
+    static void pairLights(ArmorDetector &detector, vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+        detector.pairLights(acceptedArmors);
+    }
+
+    static void filterArmorsSharingLights(ArmorDetector &detector,
+                                          vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+        detector.filterArmorsSharingLights(acceptedArmors);
+    }
+};
+
+}
+
+/**
+ * The filter of armors sharing lights before filterArmorsSharingLights(): find the first pair sharing a light, erase
+ * one of them, and start over.
+ */
+static void originalFilterArmorsSharingLights(vector<ArmorDetector::DetectedArmor> &acceptedArmors) {
+    auto armorToRemove = [&]() {
+        for (auto it = acceptedArmors.begin(); it != acceptedArmors.end(); ++it) {
+            for (auto it2 = it + 1; it2 != acceptedArmors.end(); ++it2) {
+                if (it->lightIndex[0] == it2->lightIndex[0] || it->lightIndex[0] == it2->lightIndex[1] ||
+                    it->lightIndex[1] == it2->lightIndex[0] || it->lightIndex[1] == it2->lightIndex[1]) {
+                    // Share light
+
+                    if (it->largeArmor != it2->largeArmor) {  // one small one large, prioritize small
+                        return it->largeArmor ? it : it2;
+                    }
+
+                    // Remove the one that has lights more nonparallel
+                    return (it->lightAngleDiff > it2->lightAngleDiff) ? it : it2;
+                }
+            }
+        }
+        return acceptedArmors.end();  // nothing to remove
+    };
+    while (true) {
+        auto it = armorToRemove();
+        if (it == acceptedArmors.end()) break;
+        acceptedArmors.erase(it);
+    }
+}
+
+static string armorList(const vector<ArmorDetector::DetectedArmor> &armors) {
+    string s;
+    for (const auto &armor : armors) {
+        if (!s.empty()) s += " ";
+        s += "(" + to_string(armor.lightIndex[0]) + "," + to_string(armor.lightIndex[1]) +
+             (armor.largeArmor ? ",L)" : ",S)");
+    }
+    return s.empty() ? "none" : s;
+}
+
+static bool sameArmors(const vector<ArmorDetector::DetectedArmor> &a, const vector<ArmorDetector::DetectedArmor> &b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].lightIndex != b[i].lightIndex || a[i].largeArmor != b[i].largeArmor) return false;
+    }
+    return true;
+}
+
+static bool sameRect(const cv::RotatedRect &a, const cv::RotatedRect &b) {
+    return a.center == b.center && a.size == b.size && a.angle == b.angle;
+}
+
+static string rectString(const cv::RotatedRect &rect) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "center (%.1f, %.1f) size %.1fx%.1f angle %.1f",
+             rect.center.x, rect.center.y, rect.size.width, rect.size.height, rect.angle);
+    return buf;
+}
+
+/**
+ * @return Whether the frame has the same armors after both filters, the differences are reported if so requested.
+ */
+static bool checkFilter(ArmorDetector &detector, const cv::Mat &img, bool report, const string &name) {
+    vector<ArmorDetector::DetectedArmor> armors;
+    detector.detect(img, armors);  // the lights of the frame, sorted by combineLights()
+
+    vector<ArmorDetector::DetectedArmor> candidates;
+    if (DetectionEquivalenceCheck::lightRects(detector).size() >= 2) {
+        DetectionEquivalenceCheck::pairLights(detector, candidates);
+    }
+    auto expected = candidates;
+    originalFilterArmorsSharingLights(expected);
+    auto actual = candidates;
+    DetectionEquivalenceCheck::filterArmorsSharingLights(detector, actual);
+
+    if (sameArmors(expected, actual)) return true;
+    if (report) {
+        cout << name << ": " << candidates.size() << " candidates\n"
+             << "  original: " << armorList(expected) << "\n"
+             << "  new:      " << armorList(actual) << endl;
+    }
+    return false;
+}
+
+/**
+ * Lights of one detect() missing in the other. Both are sorted by combineLights(), so a merge finds them.
+ */
+static void reportMissingLights(const vector<cv::RotatedRect> &lights, const vector<cv::RotatedRect> &others,
+                                const char *what) {
+    auto less = [](const cv::RotatedRect &a, const cv::RotatedRect &b) {
+        return tie(a.center.x, a.center.y, a.size.width, a.size.height, a.angle) <
+               tie(b.center.x, b.center.y, b.size.width, b.size.height, b.angle);
+    };
+    size_t j = 0;
+    for (const auto &rect : lights) {
+        while (j < others.size() && less(others[j], rect)) j++;
+        if (j < others.size() && sameRect(others[j], rect)) {
+            j++;
+        } else {
+            cout << "  " << what << ": " << rectString(rect) << "\n";
+        }
+    }
+}
+
+/**
+ * @return Whether the frame has the same lights and armors with and without bands, the differences are reported if
+ *         so requested.
+ */
+static bool checkBands(ArmorDetector &detector, const ParamSet &singleParams, const ParamSet &bandParams,
+                       const cv::Mat &img, bool report, const string &name) {
+    vector<ArmorDetector::DetectedArmor> expected, actual;
+    detector.setParams(singleParams);
+    detector.detect(img, expected);
+    auto expectedLights = DetectionEquivalenceCheck::lightRects(detector);
+
+    detector.setParams(bandParams);
+    detector.detect(img, actual);
+    const auto &actualLights = DetectionEquivalenceCheck::lightRects(detector);
+
+    bool sameLights = (expectedLights.size() == actualLights.size());
+    for (size_t i = 0; sameLights && i < expectedLights.size(); i++) {
+        sameLights = sameRect(expectedLights[i], actualLights[i]);
+    }
+    if (sameLights && sameArmors(expected, actual)) return true;
+    if (report) {
+        cout << name << ": " << DetectionEquivalenceCheck::bandCount(detector) << " bands over rows ["
+             << DetectionEquivalenceCheck::detectWindow(detector).y << ", "
+             << DetectionEquivalenceCheck::detectWindow(detector).br().y << ")\n";
+        reportMissingLights(expectedLights, actualLights, "light only without bands");
+        reportMissingLights(actualLights, expectedLights, "light only with bands");
+        cout << "  armors without bands: " << armorList(expected) << "\n"
+             << "  armors with bands:    " << armorList(actual) << endl;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    bool bandsMode = (argc > 1 && strcmp(argv[1], "bands") == 0);
+    if (argc < 4 || (!bandsMode && strcmp(argv[1], "filter") != 0)) {
+        cout << "Usage: " << argv[0] << " filter <param set> <image set> [max reported]\n"
+             << "       " << argv[0] << " bands <param set> <image set> [bands] [max reported]" << endl;
+        return -1;
+    }
+    int maxReportedArg = (bandsMode ? 5 : 4);
+    int maxReported = (argc > maxReportedArg ? stoi(argv[maxReportedArg]) : 10);
+
+    ParamSetManager paramSetManager;
+    paramSetManager.reloadParamSetList();
+    paramSetManager.switchToParamSet(argv[2]);
+    ParamSet params = paramSetManager.loadCurrentParamSet();
+
+    ArmorDetector detector;
+    detector.setParams(params);
+
+    // Without bands, and with them (at least two, otherwise detect() takes the single-threaded path)
+    ParamSet singleParams = params, bandParams = params;
+    singleParams.mutable_parallel_bands()->set_enabled(false);
+    bandParams.mutable_parallel_bands()->set_enabled(true);
+    if (argc > 4 && bandsMode) bandParams.mutable_parallel_bands()->set_val(stoi(argv[4]));
+    bandParams.mutable_parallel_bands()->set_val(max(bandParams.parallel_bands().val(), 2));
+
+    ImageSet imageSet;
+    imageSet.reloadImageSetList();
+    imageSet.switchImageSet(argv[3]);
+    const auto &images = imageSet.getImageList();
+
+    int frames = 0, differences = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        auto img = imageSet.loadImage(i, params);
+        if (img.empty()) continue;
+        frames++;
+        bool report = (differences < maxReported);
+        bool same = (bandsMode ? checkBands(detector, singleParams, bandParams, img, report, images[i])
+                               : checkFilter(detector, img, report, images[i]));
+        if (!same) differences++;
+    }
+
+    cout << frames << " frames, " << differences << " with differences" << endl;
+    return differences == 0 ? 0 : 1;
+}
@@ -0,0 +1,299 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A tool to build an image set from a recorded video (e.g. of a match, see Camera::startRecordToVideo()), decoding
+ * parts of the video in parallel, for training or tuning between matches.
+ *
+ * Usage: ExtractImageSetFromVideo <video> <image set> [interval ms] [log.slog] [threads]
+ *  video        Video file, or its name under data/videos.
+ *  image set    Name of the image set to write under data/images: a directory of JPEGs, or a packed image set (see
+ *               PackImageSet) if it ends with .pack. Frames are named <video>_<frame index>.jpg, in the order of time.
+ *  interval ms  Frames are taken this far apart in the video (default 1000), 0 for every frame.
+ *  log.slog     Telemetry log of the same run (telemetry_log). Only the frames where the armors handed to aiming
+ *               changed (count, numbers, types or positions) are taken, at least interval ms apart.
+ *  threads      Decoders in parallel (default: one per core).
+ *
+ * The frames wanted are cut into blocks of consecutive ones, which the decoders take in turn. A decoder seeks to the
+ * first frame of a block (back to the keyframe before it and decoding forward) and to frames far after the previous
+ * one, and otherwise grabs the frames in between without converting them. Packed image sets are written in order from
+ * the blocks done, with a bounded number of blocks decoded ahead.
+ *
+ * Frames of the log are matched by time, from the start time in the name of the recording (to the second) or, if the
+ * name has none, from the first frame of the log. Frames dropped by the recorder shift the video against the log, so
+ * a frame taken may be a moment off the change.
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "Parameters.h"
+#include "ImageSet.h"
+#include "VideoSet.h"
+#include "PackedImageSet.h"
+#include "TelemetryLog.h"
+
+using namespace std;
+using namespace meta;
+
+// Wanted frames per block, and the span of the video a block covers at most [frames]
+const size_t blockFrames = 32;
+const long blockSpan = 1000;
+// Blocks decoded ahead of the one being packed, per decoder
+const size_t packBlocksAheadPerThread = 2;
+// Armors moving more than this from one frame to the next count as a change [pixel]
+const float armorMoveThreshold = 32;
+
+/**
+ * @return Wall time [ns] of the start of the recording, from the time at the end of the name of a video of
+ *         Camera::startRecordToVideo() (local time), or -1.
+ */
+static int64_t recordingStartTime(const fs::path &video) {
+    string stem = video.stem().string();
+    auto pos = stem.rfind('_');
+    string timeString = (pos == string::npos ? stem : stem.substr(pos + 1));
+    if (timeString.size() != 14 || !all_of(timeString.begin(), timeString.end(), ::isdigit)) return -1;
+    std::tm bt{};
+    istringstream iss(timeString);
+    iss >> get_time(&bt, "%Y%m%d%H%M%S");
+    if (iss.fail()) return -1;
+    bt.tm_isdst = -1;
+    return (int64_t) mktime(&bt) * 1000000000LL;
+}
+
+/**
+ * @return Wall times [ns] of the frames of a telemetry log where the armors changed from the previous frame.
+ */
+static vector<int64_t> armorChangeTimes(const string &logFile, int64_t &firstFrameTime) {
+    TelemetryReader reader;
+    if (!reader.open(logFile)) {
+        cerr << reader.errorMessage() << endl;
+        exit(1);
+    }
+    const auto &fileHeader = reader.fileHeader();
+    auto toWallTime = [&](int64_t time) { return fileHeader.wallTime + (time - fileHeader.startTime); };
+
+    vector<int64_t> changes;
+    firstFrameTime = -1;
+    TelemetryLog::FrameRecord previous{};
+    bool first = true;
+    const TelemetryLog::RecordHeader *header;
+    const uint8_t *payload;
+    while (reader.next(header, payload)) {
+        if (header->type != TelemetryLog::FRAME) continue;
+        const size_t payloadSize = header->size - sizeof(TelemetryLog::RecordHeader);
+        TelemetryLog::FrameRecord r{};
+        memcpy(&r, payload, min(payloadSize, sizeof(r)));
+        r.armorCount = min<uint8_t>(r.armorCount, (uint8_t) AimingSolver::MAX_ARMORS);
+        if (firstFrameTime < 0) firstFrameTime = toWallTime(r.captureTime);
+
+        bool changed = first || r.armorCount != previous.armorCount;
+        for (unsigned i = 0; i < r.armorCount && !changed; i++) {
+            const auto &a = r.armors[i], &b = previous.armors[i];
+            changed = a.number != b.number || a.largeArmor != b.largeArmor ||
+                      hypot(a.imgCenter[0] - b.imgCenter[0], a.imgCenter[1] - b.imgCenter[1]) > armorMoveThreshold;
+        }
+        if (changed) changes.emplace_back(toWallTime(r.captureTime));
+        previous = r;
+        first = false;
+    }
+    return changes;
+}
+
+struct Block {
+    size_t begin, end;                   // in wanted frames
+    vector<pair<long, cv::Mat>> frames;  // decoded with their indices, for a packed image set
+    bool done = false;
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <video> <image set> [interval ms] [log.slog] [threads]" << endl;
+        return -1;
+    }
+    VideoSet videoSet;
+    fs::path videoFile = argv[1];
+    if (!fs::exists(videoFile)) videoFile = videoSet.videoSetRoot / argv[1];
+    string imageSetName = argv[2];
+    double interval = (argc > 3 ? max(stod(argv[3]), 0.0) : 1000);
+    string logFile = (argc > 4 ? argv[4] : "");
+    unsigned threadCount = (argc > 5 ? (unsigned) max(stoi(argv[5]), 1) : max(thread::hardware_concurrency(), 1u));
+
+    cv::VideoCapture probe(videoFile.string(), cv::CAP_FFMPEG);
+    if (!probe.isOpened()) {
+        cerr << "Failed to open " << videoFile << endl;
+        return -1;
+    }
+    double fps = probe.get(cv::CAP_PROP_FPS);
+    long frameCount = (long) probe.get(cv::CAP_PROP_FRAME_COUNT);
+    cv::Size size((int) probe.get(cv::CAP_PROP_FRAME_WIDTH), (int) probe.get(cv::CAP_PROP_FRAME_HEIGHT));
+    probe.release();
+    if (fps <= 0 || frameCount <= 0) {
+        cerr << "Unknown frame rate or length of " << videoFile << endl;
+        return -1;
+    }
+    // Grabbing up to about a keyframe interval is no slower than seeking
+    const long seekGap = max((long) (fps * 2), 1L);
+
+    // Frames wanted, in the order of the video
+    vector<long> wanted;
+    const long step = max((long) llround(interval * fps / 1000), 1L);
+    if (logFile.empty()) {
+        for (long i = 0; i < frameCount; i += step) wanted.emplace_back(i);
+    } else {
+        int64_t firstFrameTime;
+        auto changes = armorChangeTimes(logFile, firstFrameTime);
+        int64_t startTime = recordingStartTime(videoFile);
+        if (startTime < 0) {
+            cout << "No start time in the name of " << videoFile.filename() << ", matched from the first frame of "
+                 << logFile << endl;
+            startTime = firstFrameTime;
+        }
+        long last = -step;
+        for (int64_t time : changes) {
+            long i = llround((double) (time - startTime) * 1e-9 * fps);
+            if (i < 0 || i >= frameCount || i - last < step) continue;
+            wanted.emplace_back(i);
+            last = i;
+        }
+        cout << changes.size() << " changes of the armors in " << logFile << endl;
+    }
+    if (wanted.empty()) {
+        cout << "No frame to extract" << endl;
+        return -1;
+    }
+
+    // Output
+    fs::path imageSetPath = fs::path(DATA_SET_ROOT) / "images" / imageSetName;
+    const bool packed = PackedImageSet::isPackFile(imageSetPath);
+    PackedImageSet::Writer writer;
+    if (packed) {
+        if (!writer.open(imageSetPath, size, CV_8UC3)) return -1;
+    } else {
+        fs::create_directories(imageSetPath);
+    }
+    const string videoStem = videoFile.stem().string();
+    auto frameName = [&](long index) {
+        ostringstream oss;
+        oss << videoStem << "_" << setw(7) << setfill('0') << index << ".jpg";
+        return oss.str();
+    };
+
+    vector<Block> blocks;
+    for (size_t i = 0; i < wanted.size();) {
+        size_t end = i + 1;
+        while (end < wanted.size() && end - i < blockFrames && wanted[end] - wanted[i] < blockSpan) end++;
+        blocks.emplace_back(Block{i, end});
+        i = end;
+    }
+    threadCount = min(threadCount, (unsigned) blocks.size());
+    cout << "Extracting " << wanted.size() << " of " << frameCount << " frames of " << videoFile.filename() << " ("
+         << size << ", " << fps << " fps) in " << blocks.size() << " blocks with " << threadCount << " decoders"
+         << endl;
+
+    mutex blockMutex;
+    condition_variable blockCondition;
+    size_t nextBlock = 0, packedBlocks = 0;  // guarded by blockMutex
+    bool stopDecoding = false;               // guarded by blockMutex, set if packing fails
+    const size_t blocksAhead = packBlocksAheadPerThread * threadCount;
+    atomic<unsigned> failedFrames{0};
+
+    auto decode = [&] {
+        cv::VideoCapture cap(videoFile.string(), cv::CAP_FFMPEG);
+        long position = -1;  // of the next frame read, unknown before the first seek
+        while (true) {
+            size_t b;
+            {
+                unique_lock<mutex> lock(blockMutex);
+                blockCondition.wait(lock, [&] {
+                    return stopDecoding || nextBlock >= blocks.size() || !packed ||
+                           nextBlock < packedBlocks + blocksAhead;
+                });
+                if (stopDecoding || nextBlock >= blocks.size()) return;
+                b = nextBlock++;
+            }
+            Block &block = blocks[b];
+            for (size_t i = block.begin; i < block.end; i++) {
+                long index = wanted[i];
+                if (i == block.begin || position < 0 || index < position || index - position > seekGap) {
+                    cap.set(cv::CAP_PROP_POS_FRAMES, (double) index);
+                    position = index;
+                }
+                while (position < index && cap.grab()) position++;
+                cv::Mat frame;
+                if (position != index || !cap.read(frame) || frame.empty()) {
+                    failedFrames++;
+                    position = -1;
+                    continue;
+                }
+                position++;
+                if (frame.size() != size) cv::resize(frame, frame, size);
+                if (packed) {
+                    block.frames.emplace_back(index, frame);
+                } else if (!cv::imwrite((imageSetPath / frameName(index)).string(), frame)) {
+                    failedFrames++;
+                }
+            }
+            {
+                lock_guard<mutex> lock(blockMutex);
+                block.done = true;
+            }
+            blockCondition.notify_all();
+        }
+    };
+    vector<thread> decoders;
+    for (unsigned i = 0; i < threadCount; i++) decoders.emplace_back(decode);
+
+    // Stop the decoders, which may wait for blocks to be packed, before returning
+    auto stopDecoders = [&] {
+        {
+            lock_guard<mutex> lock(blockMutex);
+            stopDecoding = true;
+        }
+        blockCondition.notify_all();
+        for (auto &decoder : decoders) decoder.join();
+    };
+
+    // Pack the blocks in order as they are done
+    size_t extracted = 0;
+    if (packed) {
+        for (auto &block : blocks) {
+            {
+                unique_lock<mutex> lock(blockMutex);
+                blockCondition.wait(lock, [&] { return block.done; });
+            }
+            for (const auto &[index, frame] : block.frames) {
+                if (!writer.add(frameName(index), frame, "")) {
+                    stopDecoders();
+                    return -1;
+                }
+            }
+            extracted += block.frames.size();
+            block.frames = {};  // release the frames
+            {
+                lock_guard<mutex> lock(blockMutex);
+                packedBlocks++;
+            }
+            blockCondition.notify_all();
+            if (packedBlocks % 10 == 0) cout << packedBlocks << "/" << blocks.size() << " blocks packed" << endl;
+        }
+    }
+    for (auto &decoder : decoders) decoder.join();
+    if (packed && !writer.finish()) return -1;
+    if (!packed) extracted = wanted.size() - failedFrames;
+
+    cout << "Extracted " << extracted << " frames into " << imageSetPath;
+    if (failedFrames) cout << ", " << failedFrames << " failed";
+    cout << endl;
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A tool to pack an image set into one file that Solais and ReplayBenchmark map instead of decoding every JPEG, so
+ * that replay runs at thousands of frames per second.
+ *
+ * Usage: PackImageSet <image set> [width height]
+ *  image set     Directory under data/images. Written to data/images/<image set>.pack, which shows up in the list of
+ *                image sets next to the directory.
+ *  width height  Size of the frames, which should be the ROI of the parameter set to replay with, otherwise frames
+ *                are resized when the image set is opened (default: the size of the first image).
+ *
+ * Frames are stored as decoded BGR, about width * height * 3 bytes each, in the order of the image list. The XML
+ * annotation of each image is kept with it.
+ */
+
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include "ImageSet.h"
+#include "PackedImageSet.h"
+
+using namespace std;
+using namespace meta;
+
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 4) {
+        cout << "Usage: " << argv[0] << " <image set> [width height]" << endl;
+        return -1;
+    }
+    string imageSetName = argv[1];
+    fs::path imageSetDir = fs::path(DATA_SET_ROOT) / "images" / imageSetName;
+    fs::path packFile = imageSetDir;
+    packFile += PackedImageSet::EXTENSION;
+    if (!fs::is_directory(imageSetDir)) {
+        cerr << imageSetDir << " is not an image set" << endl;
+        return -1;
+    }
+
+    ImageSet imageSet;
+    imageSet.switchImageSet(imageSetName);
+    const auto &images = imageSet.getImageList();
+    if (images.empty()) {
+        cerr << "No image in " << imageSetDir << endl;
+        return -1;
+    }
+
+    cv::Size size;
+    if (argc == 4) {
+        size = cv::Size(stoi(argv[2]), stoi(argv[3]));
+    } else {
+        size = cv::imread((imageSetDir / images[0]).string()).size();
+    }
+
+    PackedImageSet::Writer writer;
+    if (!writer.open(packFile, size, CV_8UC3)) return -1;
+    size_t packed = 0;
+    for (size_t i = 0; i < images.size(); i++) {
+        auto img = cv::imread((imageSetDir / images[i]).string());
+        if (img.empty()) {
+            cerr << "Failed to read " << images[i] << ", skipped" << endl;
+            continue;
+        }
+        if (img.size() != size) cv::resize(img, img, size);
+
+        if (!writer.add(images[i], img, imageSet.loadAnnotation(i))) return -1;
+        packed++;
+        if ((i + 1) % 100 == 0) cout << i + 1 << "/" << images.size() << " packed" << endl;
+    }
+    if (!writer.finish()) return -1;
+
+    cout << "Packed " << packed << " images of " << size << " into " << packFile << endl;
+    return 0;
+}
@@ -0,0 +1,365 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A tool to tune the parameters of the light and armor filters (detect()) over an annotated image set, instead of
+ * trying values one at a time in SolaisTerminal.
+ *
+ * Usage: ParamTuner <param set> <image set> [field=values ...]
+ *  param set     Name of a parameter set in data/params to start from (e.g. meta-jetson-nano-1).
+ *  image set     Directory or packed image set under data/images, with the XML labels of the images (Pascal VOC, as
+ *                written by labelImg).
+ *  field=values  A field of ParamSet to sweep, with a dot for the members of a message (e.g.
+ *                light_aspect_ratio.min), and its values, either listed (140,150,160) or as from:to:step.
+ *                Toggles are swept with 0,1. The default sweep is below.
+ *
+ * Every combination of the values is a candidate. Candidates are evaluated in parallel, one ArmorDetector per core,
+ * and scored by matching the detected armors against the labels of the enemy color (IoU of the bounding boxes at
+ * least minIoU). The candidates of the Pareto front of precision and recall are printed, and the one of the best F1
+ * score among them is written to data/params/<host>.json (backed up as any save).
+ *
+ * Run it on a laptop: on Jetson every worker would also load the YOLOv5 engine, which the sweep does not use.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <string_view>
+#include <strings.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "Parameters.h"
+#include "ParamSetManager.h"
+#include "ImageSet.h"
+#include "ArmorDetector.h"
+
+using namespace std;
+using namespace meta;
+using google::protobuf::FieldDescriptor;
+
+const double minIoU = 0.5;
+const vector<string> defaultSweep = {
+        "brightness_threshold=120:200:20",
+        "rb_channel_threshold=35:75:10",
+        "contour_pixel_count.val=5:25:10",
+        "light_aspect_ratio.min=1.5,2,3",
+};
+
+struct SweptField {
+    string path;
+    vector<double> values;
+};
+
+struct Score {
+    unsigned truePositives = 0, falsePositives = 0, falseNegatives = 0;
+
+    double precision() const {
+        return truePositives + falsePositives ? (double) truePositives / (truePositives + falsePositives) : 0;
+    }
+
+    double recall() const {
+        return truePositives + falseNegatives ? (double) truePositives / (truePositives + falseNegatives) : 0;
+    }
+
+    double f1() const {
+        double p = precision(), r = recall();
+        return p + r > 0 ? 2 * p * r / (p + r) : 0;
+    }
+};
+
+struct LabeledFrame {
+    cv::Mat image;
+    vector<cv::Rect> armors;  // in the coordinates of the image
+};
+
+/**
+ * Set a numeric field of a ParamSet through reflection.
+ * @param params
+ * @param path    Name of the field, with dots for the members of messages.
+ * @param value   Rounded for integers, non-zero for true, the number of an enum.
+ * @return Whether the field exists and is numeric.
+ */
+static bool setField(ParamSet &params, const string &path, double value) {
+    google::protobuf::Message *message = &params;
+    size_t begin = 0;
+    while (true) {
+        size_t dot = path.find('.', begin);
+        const FieldDescriptor *field = message->GetDescriptor()->FindFieldByName(path.substr(begin, dot - begin));
+        if (!field || field->is_repeated()) return false;
+        auto reflection = message->GetReflection();
+        if (dot == string::npos) {
+            switch (field->cpp_type()) {
+                case FieldDescriptor::CPPTYPE_FLOAT:
+                    reflection->SetFloat(message, field, (float) value);
+                    return true;
+                case FieldDescriptor::CPPTYPE_DOUBLE:
+                    reflection->SetDouble(message, field, value);
+                    return true;
+                case FieldDescriptor::CPPTYPE_INT32:
+                    reflection->SetInt32(message, field, (int32_t) lround(value));
+                    return true;
+                case FieldDescriptor::CPPTYPE_BOOL:
+                    reflection->SetBool(message, field, value != 0);
+                    return true;
+                case FieldDescriptor::CPPTYPE_ENUM:
+                    if (!field->enum_type()->FindValueByNumber((int) value)) return false;
+                    reflection->SetEnumValue(message, field, (int) value);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        if (field->cpp_type() != FieldDescriptor::CPPTYPE_MESSAGE) return false;
+        message = reflection->MutableMessage(message, field);
+        begin = dot + 1;
+    }
+}
+
+static bool parseSweptField(const string &arg, SweptField &swept) {
+    size_t eq = arg.find('=');
+    if (eq == string::npos) return false;
+    swept.path = arg.substr(0, eq);
+    string values = arg.substr(eq + 1);
+    try {
+        size_t colon = values.find(':');
+        if (colon != string::npos) {
+            size_t colon2 = values.find(':', colon + 1);
+            if (colon2 == string::npos) return false;
+            double from = stod(values.substr(0, colon));
+            double to = stod(values.substr(colon + 1, colon2 - colon - 1));
+            double step = stod(values.substr(colon2 + 1));
+            if (step <= 0) return false;
+            for (double v = from; v <= to + step * 1E-6; v += step) swept.values.emplace_back(v);
+        } else {
+            for (size_t begin = 0; begin <= values.size();) {
+                size_t comma = values.find(',', begin);
+                if (comma == string::npos) comma = values.size();
+                swept.values.emplace_back(stod(values.substr(begin, comma - begin)));
+                begin = comma + 1;
+            }
+        }
+    } catch (const std::exception &) {
+        return false;
+    }
+    return !swept.values.empty();
+}
+
+/**
+ * Content of the next element of a tag, searching from pos.
+ * @param xml
+ * @param tag
+ * @param pos  [In/Out] Moved past the element.
+ * @return Empty if there is no more.
+ */
+static string_view nextElement(string_view xml, const string &tag, size_t &pos) {
+    size_t begin = xml.find("<" + tag + ">", pos);
+    if (begin == string_view::npos) return {};
+    begin += tag.size() + 2;
+    size_t end = xml.find("</" + tag + ">", begin);
+    if (end == string_view::npos) return {};
+    pos = end + tag.size() + 3;
+    return xml.substr(begin, end - begin);
+}
+
+static double elementValue(string_view xml, const string &tag) {
+    size_t pos = 0;
+    return atof(string(nextElement(xml, tag, pos)).c_str());
+}
+
+/**
+ * Armors of the enemy color in the labels of an image. Labels with no color in their name are all taken.
+ * @param xml        Pascal VOC annotation.
+ * @param params
+ * @param imageSize  Size of the image used, labels are scaled from the size of the original image.
+ * @return Bounding boxes.
+ */
+static vector<cv::Rect> parseLabels(string_view xml, const ParamSet &params, const cv::Size &imageSize) {
+    vector<cv::Rect> armors;
+    size_t pos = 0;
+    string_view size = nextElement(xml, "size", pos);
+    double scaleX = 1, scaleY = 1;
+    if (!size.empty() && elementValue(size, "width") > 0 && elementValue(size, "height") > 0) {
+        scaleX = imageSize.width / elementValue(size, "width");
+        scaleY = imageSize.height / elementValue(size, "height");
+    }
+
+    const char *enemy = (params.enemy_color() == package::ParamSet_EnemyColor_BLUE ? "blue" : "red");
+    const char *ally = (params.enemy_color() == package::ParamSet_EnemyColor_BLUE ? "red" : "blue");
+    pos = 0;
+    for (string_view object; !(object = nextElement(xml, "object", pos)).empty();) {
+        size_t p = 0;
+        string name(nextElement(object, "name", p));
+        if (strcasestr(name.c_str(), ally) && !strcasestr(name.c_str(), enemy)) continue;
+        p = 0;
+        string_view box = nextElement(object, "bndbox", p);
+        if (box.empty()) continue;
+        cv::Point tl((int) (elementValue(box, "xmin") * scaleX), (int) (elementValue(box, "ymin") * scaleY));
+        cv::Point br((int) (elementValue(box, "xmax") * scaleX), (int) (elementValue(box, "ymax") * scaleY));
+        armors.emplace_back(tl, br);
+    }
+    return armors;
+}
+
+static double iou(const cv::Rect &a, const cv::Rect &b) {
+    double intersection = (a & b).area();
+    return intersection > 0 ? intersection / (a.area() + b.area() - intersection) : 0;
+}
+
+static Score evaluate(ArmorDetector &detector, const ParamSet &candidate, const vector<LabeledFrame> &frames) {
+    ParamSet params = candidate;
+    params.mutable_parallel_bands()->set_enabled(false);  // workers already take all cores
+    detector.setParams(params);
+
+    Score score;
+    vector<ArmorDetector::DetectedArmor> armors;
+    vector<bool> matched;
+    for (const auto &frame : frames) {
+        detector.detect(frame.image, armors);
+        matched.assign(armors.size(), false);
+        for (const auto &label : frame.armors) {
+            int best = -1;
+            double bestIoU = minIoU;
+            for (size_t i = 0; i < armors.size(); i++) {
+                if (matched[i]) continue;
+                double overlap = iou(label, cv::boundingRect(vector<cv::Point2f>(armors[i].points.begin(),
+                                                                                 armors[i].points.end())));
+                if (overlap >= bestIoU) {
+                    best = (int) i;
+                    bestIoU = overlap;
+                }
+            }
+            if (best >= 0) {
+                matched[best] = true;
+                score.truePositives++;
+            } else {
+                score.falseNegatives++;
+            }
+        }
+        score.falsePositives += std::count(matched.begin(), matched.end(), false);
+    }
+    return score;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <param set> <image set> [field=values ...]" << endl;
+        return -1;
+    }
+    string paramSetName = argv[1];
+    string dataSet = argv[2];
+
+    ParamSetManager paramSetManager;
+    paramSetManager.reloadParamSetList();
+    const string hostParamSetName = paramSetManager.currentParamSetName();  // switched to the default one
+    paramSetManager.switchToParamSet(paramSetName);
+    const ParamSet baseParams = paramSetManager.loadCurrentParamSet();
+
+    // Fields and candidates
+    vector<SweptField> sweep;
+    vector<string> sweepArgs(argv + 3, argv + argc);
+    if (sweepArgs.empty()) sweepArgs = defaultSweep;
+    size_t candidateCount = 1;
+    for (const auto &arg : sweepArgs) {
+        SweptField swept;
+        ParamSet test = baseParams;
+        if (!parseSweptField(arg, swept) || !setField(test, swept.path, swept.values[0])) {
+            cerr << "Invalid sweep " << arg << endl;
+            return -1;
+        }
+        candidateCount *= swept.values.size();
+        sweep.emplace_back(std::move(swept));
+    }
+    auto candidate = [&](size_t index) {
+        ParamSet params = baseParams;
+        for (const auto &swept : sweep) {  // index in mixed radix of the value counts
+            setField(params, swept.path, swept.values[index % swept.values.size()]);
+            index /= swept.values.size();
+        }
+        return params;
+    };
+
+    // Frames and labels
+    ImageSet imageSet;
+    imageSet.reloadImageSetList();
+    const auto &imageSets = imageSet.getImageSetList();
+    if (std::find(imageSets.begin(), imageSets.end(), dataSet) == imageSets.end()) {
+        cerr << "No image set " << dataSet << " in data/images" << endl;
+        return -1;
+    }
+    imageSet.switchImageSet(dataSet);
+    vector<LabeledFrame> frames;
+    size_t labelCount = 0;
+    for (size_t i = 0; i < imageSet.getImageList().size(); i++) {
+        LabeledFrame frame;
+        frame.image = imageSet.loadImage(i, baseParams);
+        string annotation = imageSet.loadAnnotation(i);
+        if (frame.image.empty() || annotation.empty()) continue;  // unlabeled images can not be scored
+        frame.armors = parseLabels(annotation, baseParams, frame.image.size());
+        labelCount += frame.armors.size();
+        frames.emplace_back(std::move(frame));
+    }
+    if (frames.empty()) {
+        cerr << "No labeled image in " << dataSet << endl;
+        return -1;
+    }
+
+    const unsigned workerCount = max(thread::hardware_concurrency(), 1u);
+    cout << candidateCount << " candidates over " << frames.size() << " labeled images (" << labelCount
+         << " armors), " << workerCount << " workers" << endl;
+
+    // Evaluate, a candidate at a time per worker
+    vector<Score> scores(candidateCount);
+    atomic<size_t> nextCandidate{0};
+    atomic<size_t> doneCount{0};
+    mutex outputMutex;
+    auto startTime = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned w = 0; w < workerCount; w++) {
+        workers.emplace_back([&] {
+            ArmorDetector detector;
+            for (size_t i; (i = nextCandidate.fetch_add(1)) < candidateCount;) {
+                scores[i] = evaluate(detector, candidate(i), frames);
+                size_t done = ++doneCount;
+                if (done % max(candidateCount / 20, (size_t) 1) == 0) {
+                    lock_guard<mutex> lock(outputMutex);
+                    cout << done << "/" << candidateCount << " evaluated" << endl;
+                }
+            }
+        });
+    }
+    for (auto &worker : workers) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "Done in " << fixed << setprecision(1) << seconds << " s" << endl;
+
+    // Pareto front of precision and recall, sorted by recall
+    vector<size_t> front;
+    for (size_t i = 0; i < candidateCount; i++) {
+        bool dominated = false;
+        for (size_t j = 0; j < candidateCount && !dominated; j++) {
+            dominated = scores[j].precision() >= scores[i].precision() && scores[j].recall() >= scores[i].recall() &&
+                        (scores[j].precision() > scores[i].precision() || scores[j].recall() > scores[i].recall());
+        }
+        if (!dominated) front.emplace_back(i);
+    }
+    std::sort(front.begin(), front.end(), [&](size_t a, size_t b) { return scores[a].recall() < scores[b].recall(); });
+
+    size_t best = front[0];
+    cout << setprecision(3);
+    for (size_t i : front) {
+        cout << "precision " << scores[i].precision() << ", recall " << scores[i].recall() << ", F1 "
+             << scores[i].f1() << ":";
+        size_t index = i;
+        for (const auto &swept : sweep) {
+            cout << " " << swept.path << "=" << swept.values[index % swept.values.size()];
+            index /= swept.values.size();
+        }
+        cout << endl;
+        if (scores[i].f1() > scores[best].f1()) best = i;
+    }
+
+    paramSetManager.switchToParamSet(hostParamSetName);
+    paramSetManager.saveCurrentParamSet(candidate(best));
+    cout << "Saved the candidate of F1 " << scores[best].f1() << " as " << hostParamSetName << ".json" << endl;
+    return 0;
+}
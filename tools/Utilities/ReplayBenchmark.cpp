@@ -0,0 +1,241 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * A headless benchmark that replays an image set or a video through detection, PnP and aiming, and reports the
+ * throughput and the latency of each stage.
+ *
+ * Usage: ReplayBenchmark <param set> <image set | video> [fps] [report.json] [passes]
+ *  param set    Name of a parameter set in data/params (e.g. meta-jetson-nano-1), to compare boards.
+ *  image set    Directory or packed image set (.pack, see PackImageSet) under data/images, or a video file under
+ *               data/videos.
+ *  fps          0 (default) to run as fast as possible, otherwise frames are fed at the given camera rate.
+ *  report.json  Report file (default benchmark.json), to be diffed between commits and boards.
+ *  passes       Times to replay the data set (default 1).
+ *
+ * The whole data set is loaded into memory before the run so that disk and decoding don't count. The first frames are
+ * run as warm-up and are not measured. Frames are fed in the same order in every run, and the aiming history is reset
+ * before each pass, so that runs on the same data set are comparable.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "Parameters.h"
+#include "ParamSetManager.h"
+#include "ImageSet.h"
+#include "VideoSet.h"
+#include "ArmorDetector.h"
+#include "PositionCalculator.h"
+#include "AimingSolver.h"
+#include "LatencyStats.h"
+
+using namespace std;
+using namespace meta;
+
+const int warmUpFrames = 20;
+
+static vector<cv::Mat> loadFrames(const string &dataSet, const ParamSet &params) {
+    vector<cv::Mat> frames;
+    auto fitROI = [&](cv::Mat img) {
+        if (img.rows != params.roi_height() || img.cols != params.roi_width()) {
+            cv::resize(img, img, cv::Size(params.roi_width(), params.roi_height()));
+        }
+        return img;
+    };
+
+    ImageSet imageSet;
+    imageSet.reloadImageSetList();
+    const auto &imageSets = imageSet.getImageSetList();
+    if (std::find(imageSets.begin(), imageSets.end(), dataSet) != imageSets.end()) {
+        imageSet.switchImageSet(dataSet);
+        for (size_t i = 0; i < imageSet.getImageList().size(); i++) {
+            auto img = imageSet.loadImage(i, params);  // mapped without decoding if the image set is packed
+            if (!img.empty()) frames.emplace_back(img);
+        }
+        return frames;
+    }
+
+    VideoSet videoSet;
+    auto video = VideoSet::openCapture(videoSet.videoSetRoot / dataSet,
+                                       cv::Size(params.roi_width(), params.roi_height()));
+    cv::Mat img;
+    while (video.read(img)) frames.emplace_back(fitROI(img.clone()));
+    return frames;
+}
+
+static PositionCalculator loadPositionCalculator(const ParamSet &params) {
+    // Same as Executor::loadPositionCalculatorParams()
+    string filename = PositionCalculator::calibrationPath(params) + ".xml";
+    PositionCalculator positionCalculator;
+    if (!positionCalculator.loadCalibration(params, filename)) {
+        cerr << "Failed to open " << filename << endl;
+        exit(1);
+    }
+    return positionCalculator;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <param set> <image set | video> [fps] [report.json] [passes]" << endl;
+        return -1;
+    }
+    string paramSetName = argv[1];
+    string dataSet = argv[2];
+    double targetFPS = (argc > 3 ? stod(argv[3]) : 0);
+    string reportFile = (argc > 4 ? argv[4] : "benchmark.json");
+    int passes = (argc > 5 ? max(stoi(argv[5]), 1) : 1);
+
+    ParamSetManager paramSetManager;
+    paramSetManager.reloadParamSetList();
+    paramSetManager.switchToParamSet(paramSetName);
+    ParamSet params = paramSetManager.loadCurrentParamSet();
+
+    auto frames = loadFrames(dataSet, params);
+    if (frames.empty()) {
+        cout << "No frame loaded from " << dataSet << endl;
+        return -1;
+    }
+    cout << frames.size() << " frames loaded from " << dataSet << endl;
+
+    ArmorDetector detector;
+    detector.setParams(params);
+    auto positionCalculator = loadPositionCalculator(params);
+    AimingSolver aimingSolver;
+    aimingSolver.setParams(params);
+
+#ifdef ON_JETSON
+    const char *detection = "yolo";
+    if (!detector.isModelReady()) {
+        cout << "Waiting for the detection model to be built..." << endl;
+        while (!detector.isModelReady()) this_thread::sleep_for(chrono::seconds(1));
+    }
+#else
+    const char *detection = "legacy";
+#endif
+
+    unsigned frameCount = 0, lateFrames = 0, detectedArmors = 0, solvedArmors = 0;
+    vector<ArmorDetector::DetectedArmor> detectedArmorsOfFrame;
+    AimingSolver::ArmorList armors;
+    PositionCalculator::PoseHistory poseHistory;
+    auto runFrame = [&](const cv::Mat &img, TimePoint frameTime, LatencyClock::time_point scheduledTime) {
+#ifdef ON_JETSON
+        detectedArmorsOfFrame = detector.detect_NG(img);
+#else
+        detector.detect(img, detectedArmorsOfFrame);
+#endif
+        armors.clear();
+        {
+            ScopedLatency latency(LatencyStats::PNP);
+            // Same as Executor::solveArmorPositions()
+            for (const auto &detectedArmor : detectedArmorsOfFrame) {
+                if (armors.full()) break;
+                cv::Point3f offset;
+                PositionCalculator::Pose pose;
+                float longLightLength = max(cv::norm(detectedArmor.points[1] - detectedArmor.points[0]),
+                                            cv::norm(detectedArmor.points[2] - detectedArmor.points[3]));
+                if (positionCalculator.solve(detectedArmor.points, detectedArmor.largeArmor,
+                                             params.manual_pnp_rect_max_height().enabled() &&
+                                             (longLightLength < params.manual_pnp_rect_max_height().val()),
+                                             offset, &pose, poseHistory.find(detectedArmor.center, longLightLength))) {
+                    poseHistory.add(detectedArmor.center, pose);
+                    armors.emplace_back(AimingSolver::ArmorInfo{detectedArmor.points, detectedArmor.center, offset,
+                                                                detectedArmor.avgLightAngle, detectedArmor.largeArmor,
+                                                                detectedArmor.number});
+                }
+            }
+            poseHistory.nextFrame();
+        }
+        {
+            ScopedLatency latency(LatencyStats::AIMING);
+            aimingSolver.updateArmors(armors, frameTime);
+            AimingSolver::ControlCommand command;
+            aimingSolver.getControlCommand(command);
+        }
+        latencyStats().record(LatencyStats::END_TO_END, scheduledTime, LatencyClock::now());
+        detectedArmors += detectedArmorsOfFrame.size();
+        solvedArmors += armors.size();
+    };
+
+    // Warm up (engine, allocations and caches), not measured
+    for (int i = 0; i < warmUpFrames; i++) {
+        runFrame(frames[i % frames.size()], i + 1, LatencyClock::now());
+    }
+    latencyStats().fetchAndClear();
+    detectedArmors = solvedArmors = 0;
+
+    // Frame time as a camera at the target rate would report, or 0.1 ms apart when running as fast as possible
+    const double frameInterval = (targetFPS > 0 ? 1.0 / targetFPS : 0);  // [s]
+    const TimePoint frameTimeStep = (targetFPS > 0 ? max((TimePoint) (10000 / targetFPS), (TimePoint) 1) : 1);
+
+    auto startTime = LatencyClock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        aimingSolver.resetHistory();
+        poseHistory.clear();
+        for (const auto &img : frames) {
+            auto scheduledTime = startTime + chrono::duration_cast<LatencyClock::duration>(
+                    chrono::duration<double>(frameInterval * frameCount));
+            auto now = LatencyClock::now();
+            if (frameInterval > 0) {
+                if (now < scheduledTime) {
+                    this_thread::sleep_until(scheduledTime);
+                } else if (now - scheduledTime > chrono::duration<double>(frameInterval)) {
+                    lateFrames++;  // more than a frame behind the camera
+                }
+            } else {
+                scheduledTime = now;
+            }
+            frameCount++;
+            runFrame(img, frameCount * frameTimeStep, scheduledTime);
+        }
+    }
+    double elapsed = chrono::duration<double>(LatencyClock::now() - startTime).count();
+    double fps = frameCount / elapsed;
+    auto summaries = latencyStats().fetchAndClear();
+
+    char hostName[256] = {};
+    gethostname(hostName, sizeof(hostName) - 1);
+
+    // Report
+    printf("%s, %s detection, %u frames in %.2f s: %.1f fps", paramSetName.c_str(), detection, frameCount, elapsed, fps);
+    if (frameInterval > 0) printf(" (target %.1f fps, %u late frames)", targetFPS, lateFrames);
+    printf("\n%-12s %8s %8s %8s %8s %8s\n", "stage [ms]", "count", "p50", "p95", "p99", "max");
+    for (int i = 0; i < LatencyStats::STAGE_COUNT; i++) {
+        const auto &s = summaries[i];
+        if (s.count == 0) continue;
+        printf("%-12s %8u %8.2f %8.2f %8.2f %8.2f\n", LatencyStats::stageName((LatencyStats::Stage) i),
+               s.count, s.p50, s.p95, s.p99, s.max);
+    }
+
+    ofstream ofs(reportFile);
+    ofs << "{\n"
+        << "  \"host\": \"" << hostName << "\",\n"
+        << "  \"param_set\": \"" << paramSetName << "\",\n"
+        << "  \"data_set\": \"" << dataSet << "\",\n"
+        << "  \"detection\": \"" << detection << "\",\n"
+        << "  \"target_fps\": " << targetFPS << ",\n"
+        << "  \"passes\": " << passes << ",\n"
+        << "  \"frames\": " << frameCount << ",\n"
+        << "  \"elapsed_s\": " << elapsed << ",\n"
+        << "  \"fps\": " << fps << ",\n"
+        << "  \"late_frames\": " << lateFrames << ",\n"
+        << "  \"detected_armors\": " << detectedArmors << ",\n"
+        << "  \"solved_armors\": " << solvedArmors << ",\n"
+        << "  \"stages\": {";
+    bool first = true;
+    for (int i = 0; i < LatencyStats::STAGE_COUNT; i++) {
+        const auto &s = summaries[i];
+        if (s.count == 0) continue;
+        ofs << (first ? "\n" : ",\n") << "    \"" << LatencyStats::stageName((LatencyStats::Stage) i) << "\": {"
+            << "\"count\": " << s.count << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+            << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << "}";
+        first = false;
+    }
+    ofs << "\n  }\n}\n";
+    cout << "Report written to " << reportFile << endl;
+    return 0;
+}
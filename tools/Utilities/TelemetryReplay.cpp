@@ -0,0 +1,175 @@
+/*
+ * Created by niceme on 10/14/26.
+ *
+ * Summarize a telemetry log of Solais (telemetry_log, data/telemetry/<time>.slog) and re-drive AimingSolver offline
+ * with the armors, the gimbal attitudes and the parameters of every frame, to compare its commands with the logged
+ * ones (e.g. to check a change of the aiming against a match, or to tune it on the logs).
+ *
+ * Usage: TelemetryReplay <log> [frames.csv] [param set]
+ *  log         Telemetry log (.slog).
+ *  frames.csv  Per frame logged and replayed commands (default: not written).
+ *  param set   Name of a parameter set in data/params, whose aiming parameters replace the logged ones, to see how
+ *              they would have aimed. Logged parameters are used if omitted.
+ *
+ * AimingSolver depends on nothing but its input, so with the same code and parameters, the replay reproduces the
+ * logged commands and any difference comes from the change.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "Parameters.h"
+#include "ParamSetManager.h"
+#include "AimingSolver.h"
+#include "TelemetryLog.h"
+
+using namespace std;
+using namespace meta;
+
+// Commands of the log and of the replay differing by more than this are counted as mismatches [deg]
+const float angleTolerance = 0.01f;
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <log> [frames.csv] [param set]" << endl;
+        return 1;
+    }
+
+    TelemetryReader reader;
+    if (!reader.open(argv[1])) {
+        cerr << reader.errorMessage() << endl;
+        return 1;
+    }
+    ofstream csv;
+    if (argc > 2) {
+        csv.open(argv[2]);
+        csv << "frame_time,armors,logged_command,logged_yaw,logged_pitch,logged_dist,"
+               "replayed_command,replayed_yaw,replayed_pitch,replayed_dist\n";
+    }
+    bool overrideParams = (argc > 3);
+    ParamSet overriddenParams;
+    if (overrideParams) {
+        ParamSetManager paramSetManager;
+        paramSetManager.reloadParamSetList();
+        paramSetManager.switchToParamSet(argv[3]);
+        overriddenParams = paramSetManager.loadCurrentParamSet();
+    }
+
+    AimingSolver aimingSolver;
+    bool paramsSet = false;
+    AimingSolver::ArmorList armors;
+
+    unsigned records[TelemetryLog::RECORD_TYPE_COUNT] = {};
+    unsigned framesWithArmors = 0, loggedCommands = 0, replayedCommands = 0, mismatches = 0;
+    float maxYawError = 0, maxPitchError = 0;
+    uint64_t frameAgeSum = 0;
+    unsigned knownFrameAges = 0, maxFrameAge = 0;
+    int64_t firstTime = -1, lastTime = 0;
+
+    const TelemetryLog::RecordHeader *header;
+    const uint8_t *payload;
+    while (reader.next(header, payload)) {
+        const size_t payloadSize = header->size - sizeof(TelemetryLog::RecordHeader);
+        if (firstTime < 0) firstTime = header->time;
+        lastTime = max(lastTime, header->time);
+        records[header->type]++;
+
+        switch (header->type) {
+
+            case TelemetryLog::PARAMS: {
+                ParamSet p;
+                bool resetHistory;
+                if (!TelemetryReader::parseParams(payload, payloadSize, p, resetHistory)) {
+                    cerr << "Invalid parameter record" << endl;
+                    break;
+                }
+                if (overrideParams) {
+                    if (!paramsSet) aimingSolver.setParams(overriddenParams);
+                    else if (resetHistory) aimingSolver.resetHistory();  // as the run did
+                } else if (resetHistory || !paramsSet) {
+                    aimingSolver.setParams(p);
+                } else {
+                    aimingSolver.updateParams(p);
+                }
+                paramsSet = true;
+            } break;
+
+            case TelemetryLog::FRAME: {
+                TelemetryLog::FrameRecord r{};
+                memcpy(&r, payload, min(payloadSize, sizeof(r)));
+                if (!paramsSet) break;  // not the case in a log of Solais
+
+                armors.clear();
+                for (unsigned i = 0; i < r.armorCount && i < AimingSolver::MAX_ARMORS; i++) {
+                    armors.emplace_back(TelemetryLog::fromRecord(r.armors[i]));
+                }
+                if (!armors.empty()) framesWithArmors++;
+                GimbalAttitude attitude{r.attitudeYaw, r.attitudePitch};
+                aimingSolver.setCommandLatency(r.commandLatency);
+                aimingSolver.updateArmors(armors, r.frameTime,
+                                          (r.flags & TelemetryLog::HAS_ATTITUDE) ? &attitude : nullptr);
+
+                AimingSolver::ControlCommand command{};
+                bool replayed = aimingSolver.getControlCommand(command);
+                bool logged = (r.flags & TelemetryLog::HAS_COMMAND);
+                if (logged) loggedCommands++;
+                if (replayed) replayedCommands++;
+                if (logged && replayed) {
+                    float yawError = fabs(command.yawDelta - r.yawDelta);
+                    float pitchError = fabs(command.pitchDelta - r.pitchDelta);
+                    maxYawError = max(maxYawError, yawError);
+                    maxPitchError = max(maxPitchError, pitchError);
+                    if (yawError > angleTolerance || pitchError > angleTolerance ||
+                        command.detected != ((r.flags & TelemetryLog::DETECTED) != 0)) {
+                        mismatches++;
+                    }
+                } else if (logged != replayed) {
+                    mismatches++;
+                }
+
+                if (csv.is_open()) {
+                    csv << r.frameTime << ',' << (int) r.armorCount << ','
+                        << logged << ',' << r.yawDelta << ',' << r.pitchDelta << ',' << r.distance << ','
+                        << replayed << ',' << command.yawDelta << ',' << command.pitchDelta << ',' << command.dist
+                        << '\n';
+                }
+            } break;
+
+            case TelemetryLog::COMMAND: {
+                TelemetryLog::CommandRecord r;
+                memcpy(&r, payload, sizeof(r));
+                if (r.frameAge != UINT16_MAX) {
+                    frameAgeSum += r.frameAge;
+                    knownFrameAges++;
+                    maxFrameAge = max<unsigned>(maxFrameAge, r.frameAge);
+                }
+            } break;
+
+            default:
+                break;
+        }
+    }
+
+    const auto &fileHeader = reader.fileHeader();
+    if (firstTime < 0) firstTime = fileHeader.startTime;  // no record
+    double duration = (lastTime - firstTime) / 1e9;  // [s]
+    cout << argv[1] << ": " << duration << " s from " << (firstTime - fileHeader.startTime) / 1e9
+         << " s after the start of the log" << endl;
+    cout << "  " << records[TelemetryLog::FRAME] << " frames ("
+         << (duration > 0 ? records[TelemetryLog::FRAME] / duration : 0) << " fps), "
+         << framesWithArmors << " with armors, " << records[TelemetryLog::PARAMS] << " parameter changes" << endl;
+    cout << "  " << records[TelemetryLog::COMMAND] << " commands written for " << loggedCommands << " of AimingSolver";
+    if (knownFrameAges) {
+        cout << ", frame age " << frameAgeSum / 10.0 / knownFrameAges << " ms on average, " << maxFrameAge / 10.0
+             << " ms at most";
+    }
+    cout << endl;
+    cout << "  " << records[TelemetryLog::FEEDBACK] << " gimbal feedbacks ("
+         << (duration > 0 ? records[TelemetryLog::FEEDBACK] / duration : 0) << " Hz)" << endl;
+    cout << "Replay" << (overrideParams ? string(" with ") + argv[3] : string()) << ": " << replayedCommands
+         << " commands, " << mismatches << " frames differing from the log, max error yaw " << maxYawError
+         << " deg, pitch " << maxPitchError << " deg" << endl;
+    return 0;
+}